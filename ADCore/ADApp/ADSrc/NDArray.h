@@ -13,6 +13,7 @@
 #define NDArray_H
 
 #include <epicsMutex.h>
+#include <epicsThread.h>
 #include <epicsTime.h>
 #include <stdio.h>
 
@@ -101,7 +102,9 @@ public:
     
 private:
     ELLNODE      node;              /**< This must come first because ELLNODE must have the same address as NDArray object */
-    int          referenceCount;    /**< Reference count for this NDArray=number of clients who are using it */
+    int          referenceCount;    /**< Reference count for this NDArray=number of clients who are using it;
+                                      *  reserve() and release() change it atomically */
+    int          mapped;            /**< 1 if pData was mapped with mmap() by the NDArrayPool, 0 if it must be freed with free() */
 
 public:
     class NDArrayPool *pNDArrayPool; /**< The NDArrayPool object that created this array */
@@ -121,12 +124,40 @@ public:
     NDAttributeList *pAttributeList;  /**< Linked list of attributes */
 };
 
+/** The number of size classes used by NDArrayPool in size-class mode.
+  * Size class n holds free arrays whose buffer size is >= 2^n and < 2^(n+1) bytes. */
+#define ND_POOL_NUM_SIZE_CLASSES 48
+
+/** The number of free arrays each thread may keep in its private cache in size-class mode */
+#define ND_POOL_THREAD_CACHE_SIZE 8
+
+/** The largest buffer (in bytes) that will be kept in a per-thread cache in size-class mode */
+#define ND_POOL_THREAD_CACHE_MAX_BYTES 1048576
+
+/** The number of mutexes used to protect NDArray reference counts when epicsAtomic is not
+  * available (EPICS base before 3.15); arrays are mapped onto these mutexes by address so that
+  * reserve() and release() on different arrays do not contend. */
+#define ND_POOL_NUM_REF_LOCKS 32
+
+/** Structure holding the free list for one NDArrayPool size class, defined in NDArrayPool.cpp */
+struct NDArrayPoolSizeClass;
+/** Structure holding the per-thread cache of free arrays, defined in NDArrayPool.cpp */
+struct NDArrayPoolThreadCache;
+/** Threads that NDArrayPool::convert can divide large regions between, defined in NDStripeWorkers.h */
+class NDStripeWorkers;
+
 /** The NDArrayPool class manages a free list (pool) of NDArray objects.
   * Drivers allocate NDArray objects from the pool, and pass these objects to plugins.
   * Plugins increase the reference count on the object when they place the object on
   * their queue, and decrease the reference count when they are done processing the
   * array. When the reference count reaches 0 again the NDArray object is placed back
   * on the free list. This mechanism minimizes the copying of array data in plugins.
+  *
+  * By default the pool keeps a single free list.  In size-class mode (see setSizeClassMode())
+  * free arrays are instead sorted by buffer size into power-of-2 size classes, each with its
+  * own mutex, and each thread keeps a small private cache of recently released small arrays.
+  * alloc() then returns the best-fitting free buffer without reallocating it, and threads
+  * working on arrays of different sizes do not contend for the same mutex.
   */
 class epicsShareClass NDArrayPool {
 public:
@@ -140,6 +171,13 @@ public:
                             NDArray **ppOut,
                             NDDataType_t dataTypeOut,
                             NDDimension_t *outDims);
+    int          convert   (NDArray *pIn,
+                            NDArray **ppOut,
+                            NDDataType_t dataTypeOut,
+                            NDDimension_t *outDims,
+                            double scale,
+                            NDStripeWorkers *pWorkers=NULL,
+                            int numThreads=1);
     int          convert   (NDArray *pIn,
                             NDArray **ppOut,
                             NDDataType_t dataTypeOut);
@@ -149,9 +187,51 @@ public:
     size_t       maxMemory  ();
     size_t       memorySize ();
     int          numFree    ();
+    int          setSizeClassMode(int enable);
+    int          sizeClassMode();
+    int          emptyFreeList();
+    int          numHits    ();
+    int          numMisses  ();
+    int          numReallocs();
+    int          setBacking (size_t hugePageSize, int numaNode);
+    int          preAllocate(int numArrays, int ndims, size_t *dims, NDDataType_t dataType);
+    int          numHotAllocs();
 private:
+    NDArray*     allocArray (int ndims, size_t *dims, NDDataType_t dataType, size_t dataSize, void *pData,
+                             int preAllocating);
+    NDArray*     allocSizeClass(size_t dataSize, int preAllocating);
+    NDArray*     allocMiss  (size_t dataSize, int preAllocating);
+    void         freeSizeClass(NDArray *pArray);
+    void         addSizeClass(NDArray *pArray);
+    NDArray*     removeSizeClass(int sizeClass, size_t dataSize, int countHit);
+    int          evictSizeClass(size_t dataSize);
+    NDArrayPoolThreadCache* getThreadCache();
+    void         drainThreadCaches();
+    void         freeThreadCache(NDArrayPoolThreadCache *pCache);
+    static void  threadCacheExit(void *pCache);
+    int          countFree  ();
+    epicsMutexId refLock(NDArray *pArray);
+    size_t       bufferSize (size_t dataSize);
+    void*        allocBuffer(size_t dataSize, int *pMapped);
+    void         freeBuffer (NDArray *pArray);
+
     ELLLIST      freeList_;      /**< Linked list of free NDArray objects that form the pool */
     epicsMutexId listLock_;      /**< Mutex to protect the free list */
+    epicsMutexId refLocks_[ND_POOL_NUM_REF_LOCKS]; /**< Mutexes to protect the NDArray reference counts */
+    int          sizeClassMode_; /**< 1 if free arrays are kept in size classes, 0 for a single free list */
+    NDArrayPoolSizeClass *sizeClasses_; /**< Free lists for each size class in size-class mode */
+    ELLLIST      emptyList_;     /**< Free NDArray objects with no data buffer in size-class mode */
+    ELLLIST      threadCaches_;  /**< All of the per-thread caches that have been created for this pool */
+    epicsThreadPrivateId threadCacheId_; /**< Used to find the cache for the calling thread */
+    int          numMisses_;     /**< Number of size-class allocations that required a new buffer */
+    int          numReallocs_;   /**< Number of size-class allocations that freed a smaller buffer and allocated a new one */
+    int          mmapBacking_;   /**< 1 if buffers are allocated with mmap rather than malloc */
+    size_t       hugePageSize_;  /**< Size of the huge pages used for buffers; 0=normal pages */
+    int          numaNode_;      /**< NUMA node that buffers are bound to; -1=not bound */
+    size_t       pageSize_;      /**< Size of a normal page */
+    int          hugePageWarning_; /**< 1 once a warning that huge pages are not available has been printed */
+    int          numPreAllocated_; /**< Number of arrays allocated by the last call to preAllocate() */
+    int          numHotAllocs_;  /**< Number of buffers allocated by alloc() since the last preAllocate() */
     int          maxBuffers_;    /**< Maximum number of buffers this object is allowed to allocate; -1=unlimited */
     int          numBuffers_;    /**< Number of buffers this object has currently allocated */
     size_t       maxMemory_;     /**< Maximum bytes of memory this object is allowed to allocate; -1=unlimited */
@@ -7,13 +7,122 @@
  */
 
 #include <stdlib.h>
+#ifdef __linux__
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/syscall.h>
+  #include <linux/mempolicy.h>
+#endif
 
+#include <epicsThread.h>
+#include <epicsVersion.h>
+#include <cantProceed.h>
 #include <epicsExport.h>
 
+/* epicsAtomic and epicsAtThreadExit are available from EPICS base 3.15 onwards. With older versions
+ * the reference counts are protected by the refLocks_ mutexes instead, and the per-thread caches are
+ * only returned to the pool by emptyFreeList() or when the pool runs out of buffers or memory */
+#if (EPICS_VERSION > 3) || ((EPICS_VERSION == 3) && (EPICS_REVISION >= 15))
+  #define ND_ATOMIC_REFERENCE_COUNT
+  #include <epicsAtomic.h>
+  #define ND_THREAD_CACHE_EXIT
+  #include <epicsExit.h>
+#endif
+
 #include "NDArray.h"
+#include "NDArrayRegion.h"
 
 static const char *driverName = "NDArrayPool";
 
+#ifdef __linux__
+  /* Older kernel headers do not define the flags to select the huge page size */
+  #ifndef MAP_HUGE_SHIFT
+    #define MAP_HUGE_SHIFT 26
+  #endif
+  #ifndef MAP_HUGE_2MB
+    #define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+  #endif
+  #ifndef MAP_HUGE_1GB
+    #define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+  #endif
+#endif
+
+/** Free list for one size class of an NDArrayPool in size-class mode */
+struct NDArrayPoolSizeClass {
+  ELLLIST      freeList;    /**< Free arrays whose buffer size falls in this size class */
+  epicsMutexId lock;        /**< Mutex to protect freeList */
+  int          numHits;     /**< Number of allocations satisfied from this size class */
+};
+
+/** Cache of free arrays that is private to one thread, used in size-class mode.
+  * Only the owning thread normally touches the cache, so its mutex is uncontended except when
+  * another thread drains the cache because the pool has reached maxBuffers or maxMemory. */
+struct NDArrayPoolThreadCache {
+  ELLNODE      node;        /**< This must come first; links all the caches of the pool */
+  NDArrayPool  *pPool;      /**< The pool that owns the cached arrays */
+  epicsMutexId lock;        /**< Mutex to protect pArrays, numArrays and memorySize */
+  NDArray      *pArrays[ND_POOL_THREAD_CACHE_SIZE]; /**< The cached arrays, oldest first */
+  int          numArrays;   /**< Number of arrays in the cache */
+  size_t       memorySize;  /**< Bytes in the buffers of the cached arrays; these remain counted in memorySize_ */
+  int          numHits;     /**< Number of allocations satisfied from this cache */
+};
+
+/** Returns the size class for a buffer size, i.e. the index of the highest bit set */
+static int sizeClassOf(size_t size)
+{
+  int sizeClass = 0;
+
+  while ((size >>= 1) && (sizeClass < ND_POOL_NUM_SIZE_CLASSES-1)) sizeClass++;
+  return sizeClass;
+}
+
+/** Returns the number of bytes required to hold an array with the specified dimensions and data type */
+static size_t arrayBytes(int ndims, size_t *dims, NDDataType_t dataType)
+{
+  size_t nBytes;
+  int i;
+
+  switch(dataType) {
+    case NDInt8:
+    case NDUInt8:
+      nBytes = 1;
+      break;
+    case NDInt16:
+    case NDUInt16:
+      nBytes = 2;
+      break;
+    case NDInt32:
+    case NDUInt32:
+    case NDFloat32:
+      nBytes = 4;
+      break;
+    case NDFloat64:
+      nBytes = 8;
+      break;
+    default:
+      return 0;
+  }
+  for (i=0; i<ndims && i<ND_ARRAY_MAX_DIMS; i++) nBytes *= dims[i];
+  return nBytes;
+}
+
+/** Initializes the fields of an NDArray that alloc() sets for every array it returns */
+static void initArray(NDArray *pArray, NDArrayPool *pPool, int ndims, size_t *dims, NDDataType_t dataType)
+{
+  int i;
+
+  pArray->pNDArrayPool = pPool;
+  pArray->dataType = dataType;
+  pArray->ndims = ndims;
+  memset(pArray->dims, 0, sizeof(pArray->dims));
+  for (i=0; i<ndims && i<ND_ARRAY_MAX_DIMS; i++) {
+    pArray->dims[i].size = dims[i];
+    pArray->dims[i].offset = 0;
+    pArray->dims[i].binning = 1;
+    pArray->dims[i].reverse = 0;
+  }
+}
+
 
 /** eraseNDAttributes is a global flag the controls whether NDArray::clearAttributes() is called
   * each time a new array is allocated with NDArrayPool->alloc().
@@ -33,10 +142,30 @@ extern "C" {epicsExportAddress(int, eraseNDAttributes);}
   * all of the NDArray objects; 0=unlimited.
   */
 NDArrayPool::NDArrayPool(int maxBuffers, size_t maxMemory)
-  : maxBuffers_(maxBuffers), numBuffers_(0), maxMemory_(maxMemory), memorySize_(0), numFree_(0)
+  : sizeClassMode_(0), numMisses_(0), numReallocs_(0),
+    mmapBacking_(0), hugePageSize_(0), numaNode_(-1), pageSize_(4096), hugePageWarning_(0),
+    numPreAllocated_(0), numHotAllocs_(0),
+    maxBuffers_(maxBuffers), numBuffers_(0), maxMemory_(maxMemory), memorySize_(0), numFree_(0)
 {
+  int i;
+
   ellInit(&freeList_);
   listLock_ = epicsMutexCreate();
+  for (i=0; i<ND_POOL_NUM_REF_LOCKS; i++) {
+    refLocks_[i] = epicsMutexMustCreate();
+  }
+  sizeClasses_ = new NDArrayPoolSizeClass[ND_POOL_NUM_SIZE_CLASSES];
+  for (i=0; i<ND_POOL_NUM_SIZE_CLASSES; i++) {
+    ellInit(&sizeClasses_[i].freeList);
+    sizeClasses_[i].lock = epicsMutexMustCreate();
+    sizeClasses_[i].numHits = 0;
+  }
+  ellInit(&emptyList_);
+  ellInit(&threadCaches_);
+  threadCacheId_ = epicsThreadPrivateCreate();
+#ifdef __linux__
+  pageSize_ = sysconf(_SC_PAGESIZE);
+#endif
 }
 
 /** Allocates a new NDArray object; the first 3 arguments are required.
@@ -57,15 +186,69 @@ NDArrayPool::NDArrayPool(int maxBuffers, size_t maxMemory)
   * this NDArray would cause the cumulative memory allocated for the pool to exceed
   * maxMemory then an error will be returned. alloc() sets the reference count for the
   * returned NDArray to 1.
+  *
+  * In size-class mode alloc() first looks in the cache of the calling thread and then in the
+  * free lists for the size class of dataSize and the next larger one, and returns the smallest
+  * free buffer that is large enough.  Only if none is found is a new buffer allocated.
+  * A buffer passed in pData then belongs to the pool and counts against maxMemory.
   */
 NDArray* NDArrayPool::alloc(int ndims, size_t *dims, NDDataType_t dataType, size_t dataSize, void *pData)
+{
+  return allocArray(ndims, dims, dataType, dataSize, pData, 0);
+}
+
+/** Implements alloc().
+  * \param[in] preAllocating 1 if called by preAllocate(), so that the buffers it allocates are not
+  * counted as allocations on the hot path.
+  */
+NDArray* NDArrayPool::allocArray(int ndims, size_t *dims, NDDataType_t dataType, size_t dataSize, void *pData,
+                                 int preAllocating)
 {
   NDArray *pArray;
   NDArrayInfo_t arrayInfo;
-  int i;
+  size_t totalBytes;
   const char* functionName = "NDArrayPool::alloc:";
 
+  if (sizeClassMode_) {
+    totalBytes = arrayBytes(ndims, dims, dataType);
+    if (dataSize == 0) dataSize = totalBytes;
+    if (totalBytes > dataSize) {
+      printf("%s: ERROR: required size=%d passed size=%d is too small\n",
+      functionName, (int)totalBytes, (int)dataSize);
+      return NULL;
+    }
+    /* If the caller passed a valid buffer we only need an array object; the pool then owns the buffer */
+    pArray = allocSizeClass(pData ? 0 : dataSize, preAllocating);
+    if (!pArray) return NULL;
+    if (pData) {
+      epicsMutexLock(listLock_);
+      if (pArray->pData) freeBuffer(pArray);
+      if ((maxMemory_ > 0) && ((memorySize_ + dataSize) > maxMemory_)) evictSizeClass(dataSize);
+      if ((maxMemory_ > 0) && ((memorySize_ + dataSize) > maxMemory_)) {
+        printf("%s: error: reached limit of %ld memory (%d/%d buffers)\n",
+               functionName, (long)maxMemory_, numBuffers_, maxBuffers_);
+        ellAdd(&emptyList_, &pArray->node);
+        epicsMutexUnlock(listLock_);
+        return NULL;
+      }
+      pArray->pData = pData;
+      pArray->mapped = 0;
+      pArray->dataSize = dataSize;
+      memorySize_ += dataSize;
+      epicsMutexUnlock(listLock_);
+    }
+    initArray(pArray, this, ndims, dims, dataType);
+    if (eraseNDAttributes) pArray->pAttributeList->clear();
+    pArray->referenceCount = 1;
+    return pArray;
+  }
+
   epicsMutexLock(listLock_);
+  /* The mode may have been changed since it was tested above */
+  if (sizeClassMode_) {
+    epicsMutexUnlock(listLock_);
+    return allocArray(ndims, dims, dataType, dataSize, pData, preAllocating);
+  }
 
   /* Find a free image */
   pArray = (NDArray *)ellFirst(&freeList_);
@@ -87,16 +270,7 @@ NDArray* NDArrayPool::alloc(int ndims, size_t *dims, NDDataType_t dataType, size
   if (pArray) {
     /* We have a frame */
     /* Initialize fields */
-    pArray->pNDArrayPool = this;
-    pArray->dataType = dataType;
-    pArray->ndims = ndims;
-    memset(pArray->dims, 0, sizeof(pArray->dims));
-    for (i=0; i<ndims && i<ND_ARRAY_MAX_DIMS; i++) {
-      pArray->dims[i].size = dims[i];
-      pArray->dims[i].offset = 0;
-      pArray->dims[i].binning = 1;
-      pArray->dims[i].reverse = 0;
-    }
+    initArray(pArray, this, ndims, dims, dataType);
     /* Erase the attributes if that global flag is set */
     if (eraseNDAttributes) pArray->pAttributeList->clear();
     pArray->getInfo(&arrayInfo);
@@ -112,28 +286,20 @@ NDArray* NDArrayPool::alloc(int ndims, size_t *dims, NDDataType_t dataType, size
     /* If the caller passed a valid buffer use that, trust that its size is correct */
     if (pData) {
       pArray->pData = pData;
+      pArray->mapped = 0;
     } else {
       /* See if the current buffer is big enough */
       if (pArray->dataSize < dataSize) {
         /* No, we need to free the current buffer and allocate a new one */
         /* See if there is enough room */
-        if (pArray->pData) {
-          memorySize_ -= pArray->dataSize;
-          free(pArray->pData);
-          pArray->pData = NULL;
-          pArray->dataSize = 0;
-        }
+        if (pArray->pData) freeBuffer(pArray);
+        dataSize = bufferSize(dataSize);
         if ((maxMemory_ > 0) && ((memorySize_ + dataSize) > maxMemory_)) {
           // We don't have enough memory to allocate the array
           // See if we can get memory by deleting arrays
           NDArray *freeArray = (NDArray *)ellFirst(&freeList_);
           while (freeArray && ((memorySize_ + dataSize) > maxMemory_)) {
-            if (freeArray->pData) {
-              memorySize_ -= freeArray->dataSize;
-              free(freeArray->pData);
-              freeArray->pData = NULL;
-              freeArray->dataSize = 0;
-            }
+            if (freeArray->pData) freeBuffer(freeArray);
             // Next array
             freeArray = (NDArray *)ellNext(&freeArray->node);
           }
@@ -143,8 +309,9 @@ NDArray* NDArrayPool::alloc(int ndims, size_t *dims, NDDataType_t dataType, size
                  functionName, (long)maxMemory_, numBuffers_, maxBuffers_);
           pArray = NULL;
         } else {
-          pArray->pData = malloc(dataSize);
+          pArray->pData = allocBuffer(dataSize, &pArray->mapped);
           if (pArray->pData) {
+            if (!preAllocating) numHotAllocs_++;
             pArray->dataSize = dataSize;
             memorySize_ += dataSize;
           } else {
@@ -166,6 +333,494 @@ NDArray* NDArrayPool::alloc(int ndims, size_t *dims, NDDataType_t dataType, size
   return (pArray);
 }
 
+/** Finds a free array with a buffer of at least dataSize bytes in size-class mode.
+  * \param[in] dataSize The required buffer size; if 0 an array with no buffer is preferred.
+  * \param[in] preAllocating 1 if called by preAllocate().
+  */
+NDArray* NDArrayPool::allocSizeClass(size_t dataSize, int preAllocating)
+{
+  NDArrayPoolThreadCache *pCache;
+  NDArray *pArray=NULL;
+  size_t size;
+  int sizeClass;
+  int i, best=-1;
+
+  if (dataSize == 0) {
+    epicsMutexLock(listLock_);
+    pArray = (NDArray *)ellGet(&emptyList_);
+    epicsMutexUnlock(listLock_);
+    if (pArray) return pArray;
+    return allocMiss(0, preAllocating);
+  }
+
+  sizeClass = sizeClassOf(dataSize);
+  /* Small arrays are usually allocated and released by the same plugin thread, look in its cache first.
+   * Don't use a buffer from more than one size class higher, that would waste memory. */
+  if (dataSize <= ND_POOL_THREAD_CACHE_MAX_BYTES) {
+    pCache = getThreadCache();
+    epicsMutexLock(pCache->lock);
+    for (i=0; i<pCache->numArrays; i++) {
+      size = pCache->pArrays[i]->dataSize;
+      if ((size >= dataSize) && (sizeClassOf(size) <= sizeClass+1) &&
+          ((best < 0) || (size < pCache->pArrays[best]->dataSize))) best = i;
+    }
+    if (best >= 0) {
+      pArray = pCache->pArrays[best];
+      pCache->memorySize -= pArray->dataSize;
+      pCache->numArrays--;
+      for (i=best; i<pCache->numArrays; i++) pCache->pArrays[i] = pCache->pArrays[i+1];
+      pCache->numHits++;
+    }
+    epicsMutexUnlock(pCache->lock);
+    if (pArray) return pArray;
+  }
+
+  /* Look in the free list for this size class, then in the next larger one where every buffer fits */
+  pArray = removeSizeClass(sizeClass, dataSize, 1);
+  if (!pArray && (sizeClass < ND_POOL_NUM_SIZE_CLASSES-1))
+    pArray = removeSizeClass(sizeClass+1, dataSize, 1);
+  if (pArray) return pArray;
+
+  return allocMiss(dataSize, preAllocating);
+}
+
+/** Removes the free array with the smallest buffer of at least dataSize bytes from a size class.
+  * \param[in] sizeClass The size class to search.
+  * \param[in] dataSize The required buffer size.
+  * \param[in] countHit 1 if this removal satisfies an allocation and should be counted as a hit.
+  * \return The array, or NULL if there is no suitable array in this size class.
+  */
+NDArray* NDArrayPool::removeSizeClass(int sizeClass, size_t dataSize, int countHit)
+{
+  NDArrayPoolSizeClass *pClass = &sizeClasses_[sizeClass];
+  NDArray *pArray, *pBest=NULL;
+
+  epicsMutexLock(pClass->lock);
+  for (pArray = (NDArray *)ellFirst(&pClass->freeList); pArray; pArray = (NDArray *)ellNext(&pArray->node)) {
+    if ((pArray->dataSize >= dataSize) && (!pBest || (pArray->dataSize < pBest->dataSize))) {
+      pBest = pArray;
+      if (pBest->dataSize == dataSize) break;
+    }
+  }
+  if (pBest) {
+    ellDelete(&pClass->freeList, &pBest->node);
+    if (countHit) pClass->numHits++;
+  }
+  epicsMutexUnlock(pClass->lock);
+  return pBest;
+}
+
+/** Returns an array with a new buffer of dataSize bytes when no suitable free buffer exists in size-class mode.
+  * An array object without a buffer is reused or created.  If maxBuffers has been reached then
+  * a free array is taken from the largest size class and its buffer is reallocated if it is too small.
+  * If maxMemory would be exceeded the buffers of other free arrays are freed first.
+  */
+NDArray* NDArrayPool::allocMiss(size_t dataSize, int preAllocating)
+{
+  NDArray *pArray;
+  int sizeClass;
+  const char *functionName = "NDArrayPool::allocMiss";
+
+  epicsMutexLock(listLock_);
+  numMisses_++;
+  pArray = (NDArray *)ellGet(&emptyList_);
+  if (!pArray && ((maxBuffers_ <= 0) || (numBuffers_ < maxBuffers_))) {
+    numBuffers_++;
+    pArray = new NDArray;
+  }
+  if (!pArray) {
+    /* We have reached maxBuffers, so we must reuse an existing free array */
+    drainThreadCaches();
+    for (sizeClass=ND_POOL_NUM_SIZE_CLASSES-1; (sizeClass>=0) && !pArray; sizeClass--) {
+      pArray = removeSizeClass(sizeClass, 0, 0);
+    }
+    if (!pArray) {
+      printf("%s: error: reached limit of %d buffers (memory use=%ld/%ld bytes)\n",
+             functionName, maxBuffers_, (long)memorySize_, (long)maxMemory_);
+      epicsMutexUnlock(listLock_);
+      return NULL;
+    }
+    if (pArray->dataSize >= dataSize) {
+      epicsMutexUnlock(listLock_);
+      return pArray;
+    }
+    numReallocs_++;
+    freeBuffer(pArray);
+  }
+  if (dataSize > 0) {
+    dataSize = bufferSize(dataSize);
+    if ((maxMemory_ > 0) && ((memorySize_ + dataSize) > maxMemory_)) evictSizeClass(dataSize);
+    if ((maxMemory_ > 0) && ((memorySize_ + dataSize) > maxMemory_)) {
+      printf("%s: error: reached limit of %ld memory (%d/%d buffers)\n",
+             functionName, (long)maxMemory_, numBuffers_, maxBuffers_);
+      ellAdd(&emptyList_, &pArray->node);
+      epicsMutexUnlock(listLock_);
+      return NULL;
+    }
+    pArray->pData = allocBuffer(dataSize, &pArray->mapped);
+    if (!pArray->pData) {
+      ellAdd(&emptyList_, &pArray->node);
+      epicsMutexUnlock(listLock_);
+      return NULL;
+    }
+    if (!preAllocating) numHotAllocs_++;
+    pArray->dataSize = dataSize;
+    memorySize_ += dataSize;
+  }
+  epicsMutexUnlock(listLock_);
+  return pArray;
+}
+
+/** Frees the buffers of free arrays in size-class mode until dataSize bytes can be allocated
+  * without exceeding maxMemory.  The smallest buffers are freed first, so that the large buffers
+  * used for detector frames stay allocated. Must be called with listLock_ held.
+  */
+int NDArrayPool::evictSizeClass(size_t dataSize)
+{
+  NDArray *pArray;
+  int sizeClass;
+
+  drainThreadCaches();
+  for (sizeClass=0; sizeClass<ND_POOL_NUM_SIZE_CLASSES; sizeClass++) {
+    while ((memorySize_ + dataSize) > maxMemory_) {
+      pArray = removeSizeClass(sizeClass, 0, 0);
+      if (!pArray) break;
+      freeBuffer(pArray);
+      ellAdd(&emptyList_, &pArray->node);
+    }
+    if ((memorySize_ + dataSize) <= maxMemory_) break;
+  }
+  return ND_SUCCESS;
+}
+
+/** Adds a free array to the free list for the size class of its buffer in size-class mode */
+void NDArrayPool::addSizeClass(NDArray *pArray)
+{
+  NDArrayPoolSizeClass *pClass;
+
+  if (pArray->dataSize == 0) {
+    epicsMutexLock(listLock_);
+    ellAdd(&emptyList_, &pArray->node);
+    epicsMutexUnlock(listLock_);
+    return;
+  }
+  pClass = &sizeClasses_[sizeClassOf(pArray->dataSize)];
+  epicsMutexLock(pClass->lock);
+  ellAdd(&pClass->freeList, &pArray->node);
+  epicsMutexUnlock(pClass->lock);
+}
+
+/** Returns an array whose reference count has reached 0 to the pool in size-class mode.
+  * Small arrays are kept in the cache of the calling thread; when the cache is full its oldest
+  * array is moved to the shared free list for its size class.
+  */
+void NDArrayPool::freeSizeClass(NDArray *pArray)
+{
+  NDArrayPoolThreadCache *pCache;
+  NDArray *pOldest=NULL;
+  int i;
+
+  if ((pArray->dataSize == 0) || (pArray->dataSize > ND_POOL_THREAD_CACHE_MAX_BYTES)) {
+    addSizeClass(pArray);
+    return;
+  }
+  pCache = getThreadCache();
+  epicsMutexLock(pCache->lock);
+  if (pCache->numArrays == ND_POOL_THREAD_CACHE_SIZE) {
+    pOldest = pCache->pArrays[0];
+    pCache->memorySize -= pOldest->dataSize;
+    pCache->numArrays--;
+    for (i=0; i<pCache->numArrays; i++) pCache->pArrays[i] = pCache->pArrays[i+1];
+  }
+  pCache->pArrays[pCache->numArrays++] = pArray;
+  pCache->memorySize += pArray->dataSize;
+  epicsMutexUnlock(pCache->lock);
+  if (pOldest) addSizeClass(pOldest);
+}
+
+/** Returns the cache of free arrays for the calling thread, creating it if this thread does not have one yet.
+  * The cache is returned to the pool when the thread exits. */
+NDArrayPoolThreadCache* NDArrayPool::getThreadCache()
+{
+  NDArrayPoolThreadCache *pCache;
+
+  pCache = (NDArrayPoolThreadCache *)epicsThreadPrivateGet(threadCacheId_);
+  if (!pCache) {
+    pCache = (NDArrayPoolThreadCache *)callocMustSucceed(1, sizeof(NDArrayPoolThreadCache),
+                                                         "NDArrayPool::getThreadCache");
+    pCache->pPool = this;
+    pCache->lock = epicsMutexMustCreate();
+    epicsThreadPrivateSet(threadCacheId_, pCache);
+    epicsMutexLock(listLock_);
+    ellAdd(&threadCaches_, &pCache->node);
+    epicsMutexUnlock(listLock_);
+#ifdef ND_THREAD_CACHE_EXIT
+    epicsAtThreadExit(threadCacheExit, pCache);
+#endif
+  }
+  return pCache;
+}
+
+/** Called by EPICS base when a thread that has a cache exits */
+void NDArrayPool::threadCacheExit(void *pCache)
+{
+  NDArrayPoolThreadCache *pThreadCache = (NDArrayPoolThreadCache *)pCache;
+
+  pThreadCache->pPool->freeThreadCache(pThreadCache);
+}
+
+/** Moves the arrays in the cache of an exiting thread to the shared size class free lists and frees the cache */
+void NDArrayPool::freeThreadCache(NDArrayPoolThreadCache *pCache)
+{
+  int i;
+
+  epicsMutexLock(listLock_);
+  ellDelete(&threadCaches_, &pCache->node);
+  epicsMutexLock(pCache->lock);
+  for (i=0; i<pCache->numArrays; i++) addSizeClass(pCache->pArrays[i]);
+  pCache->numArrays = 0;
+  pCache->memorySize = 0;
+  epicsMutexUnlock(pCache->lock);
+  epicsMutexUnlock(listLock_);
+  epicsThreadPrivateSet(threadCacheId_, NULL);
+  epicsMutexDestroy(pCache->lock);
+  free(pCache);
+}
+
+/** Moves the arrays in all of the per-thread caches to the shared size class free lists.
+  * Must be called with listLock_ held. */
+void NDArrayPool::drainThreadCaches()
+{
+  NDArrayPoolThreadCache *pCache;
+  NDArray *pArrays[ND_POOL_THREAD_CACHE_SIZE];
+  int i, numArrays;
+
+  for (pCache = (NDArrayPoolThreadCache *)ellFirst(&threadCaches_); pCache;
+       pCache = (NDArrayPoolThreadCache *)ellNext(&pCache->node)) {
+    epicsMutexLock(pCache->lock);
+    numArrays = pCache->numArrays;
+    for (i=0; i<numArrays; i++) pArrays[i] = pCache->pArrays[i];
+    pCache->numArrays = 0;
+    pCache->memorySize = 0;
+    epicsMutexUnlock(pCache->lock);
+    for (i=0; i<numArrays; i++) addSizeClass(pArrays[i]);
+  }
+}
+
+/** Returns the number of bytes that allocBuffer() will actually allocate for a buffer of dataSize bytes.
+  * With the default malloc backing this is dataSize, with an mmap backing it is rounded up to a
+  * whole number of pages. */
+size_t NDArrayPool::bufferSize(size_t dataSize)
+{
+  size_t pageSize;
+
+  if (!mmapBacking_) return dataSize;
+  pageSize = pageSize_;
+  /* Small buffers would waste most of a huge page, so they use normal pages */
+  if ((hugePageSize_ > 0) && (dataSize >= hugePageSize_/2)) pageSize = hugePageSize_;
+  return ((dataSize + pageSize - 1) / pageSize) * pageSize;
+}
+
+/** Allocates a data buffer using the backing selected with setBacking().
+  * \param[in] dataSize The size of the buffer; must be a value returned by bufferSize().
+  * \param[out] pMapped Set to 1 if the buffer was mapped with mmap(), 0 if it was allocated with malloc().
+  * \return Pointer to the buffer, or NULL if it could not be allocated.
+  *
+  * With an mmap backing the buffer is mapped with huge pages if requested, falling back to
+  * normal pages with transparent huge pages enabled if no huge pages are available, and the
+  * mapping is bound to the selected NUMA node before it is first touched.
+  */
+void* NDArrayPool::allocBuffer(size_t dataSize, int *pMapped)
+{
+  *pMapped = 0;
+  if (!mmapBacking_) return malloc(dataSize);
+#ifdef __linux__
+  void *pData = MAP_FAILED;
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  const char *functionName = "NDArrayPool::allocBuffer";
+
+#ifdef MAP_HUGETLB
+  if ((hugePageSize_ > 0) && ((dataSize % hugePageSize_) == 0)) {
+    pData = mmap(NULL, dataSize, PROT_READ | PROT_WRITE,
+                 flags | MAP_HUGETLB | ((hugePageSize_ == (1<<30)) ? MAP_HUGE_1GB : MAP_HUGE_2MB), -1, 0);
+    if ((pData == MAP_FAILED) && !hugePageWarning_) {
+      printf("%s: WARNING, cannot map %ld bytes with %ld byte huge pages, using normal pages\n",
+             functionName, (long)dataSize, (long)hugePageSize_);
+      hugePageWarning_ = 1;
+    }
+  }
+#endif
+  if (pData == MAP_FAILED) {
+    pData = mmap(NULL, dataSize, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (pData == MAP_FAILED) return NULL;
+#ifdef MADV_HUGEPAGE
+    if (hugePageSize_ > 0) madvise(pData, dataSize, MADV_HUGEPAGE);
+#endif
+  }
+  if (numaNode_ >= 0) {
+    unsigned long nodeMask = 1UL << numaNode_;
+    if (syscall(SYS_mbind, pData, dataSize, MPOL_BIND, &nodeMask, sizeof(nodeMask)*8, 0) != 0) {
+      printf("%s: WARNING, cannot bind buffer to NUMA node %d\n", functionName, numaNode_);
+    }
+  }
+  *pMapped = 1;
+  return pData;
+#else
+  return NULL;
+#endif
+}
+
+/** Frees the data buffer of an array.  Buffers mapped by allocBuffer() are unmapped, all others,
+  * including buffers passed to alloc() by the caller, are freed with free().
+  * Must be called with listLock_ held. */
+void NDArrayPool::freeBuffer(NDArray *pArray)
+{
+  memorySize_ -= pArray->dataSize;
+#ifdef __linux__
+  if (pArray->mapped) munmap(pArray->pData, pArray->dataSize);
+  else
+#endif
+  free(pArray->pData);
+  pArray->pData = NULL;
+  pArray->mapped = 0;
+  pArray->dataSize = 0;
+}
+
+/** Selects how the data buffers of this pool are allocated.
+  * \param[in] hugePageSize Size of the huge pages to map buffers with; 0 for normal pages,
+  * otherwise 2 MB (2097152) or 1 GB (1073741824).
+  * \param[in] numaNode NUMA node that buffer memory is bound to; -1 to not bind the buffers.
+  *
+  * With hugePageSize=0 and numaNode=-1 buffers are allocated with malloc(); otherwise they are
+  * mapped with mmap(), which is only supported on Linux.  The size of each buffer is rounded up
+  * to a whole number of pages and is counted that way against maxMemory.  Buffers smaller than
+  * half a huge page use normal pages.  The huge pages must have been reserved, for example in
+  * /proc/sys/vm/nr_hugepages; if they are not available transparent huge pages are requested instead.
+  * This can only be changed while the pool has no buffers allocated, normally before iocInit.
+  */
+int NDArrayPool::setBacking(size_t hugePageSize, int numaNode)
+{
+  const char *functionName = "NDArrayPool::setBacking";
+
+  if ((hugePageSize != 0) && (hugePageSize != (1<<21)) && (hugePageSize != (1<<30))) {
+    printf("%s: ERROR, unsupported huge page size %ld\n", functionName, (long)hugePageSize);
+    return ND_ERROR;
+  }
+  if ((numaNode < -1) || (numaNode >= (int)(sizeof(unsigned long)*8))) {
+    printf("%s: ERROR, invalid NUMA node %d\n", functionName, numaNode);
+    return ND_ERROR;
+  }
+#ifndef __linux__
+  if ((hugePageSize != 0) || (numaNode != -1)) {
+    printf("%s: ERROR, huge pages and NUMA binding are only supported on Linux\n", functionName);
+    return ND_ERROR;
+  }
+#endif
+  epicsMutexLock(listLock_);
+  if (memorySize_ > 0) {
+    epicsMutexUnlock(listLock_);
+    printf("%s: ERROR, cannot change backing while %ld bytes of buffers are allocated\n",
+           functionName, (long)memorySize_);
+    return ND_ERROR;
+  }
+  hugePageSize_ = hugePageSize;
+  numaNode_ = numaNode;
+  mmapBacking_ = (hugePageSize != 0) || (numaNode != -1);
+  hugePageWarning_ = 0;
+  epicsMutexUnlock(listLock_);
+  return ND_SUCCESS;
+}
+
+/** Allocates arrays ahead of time so that alloc() does not need to allocate memory during acquisition.
+  * \param[in] numArrays The number of arrays to allocate.
+  * \param[in] ndims The number of dimensions of the arrays.
+  * \param[in] dims Array of dimensions, whose size must be at least ndims.
+  * \param[in] dataType Data type of the arrays.
+  *
+  * numArrays arrays are allocated at the same time, every page of their buffers is written so that
+  * the page faults happen now, and then they are all placed on the free list.  Arrays that are
+  * already free are reused, so calling this repeatedly does not grow the pool beyond numArrays
+  * arrays of this size.  The count of buffer allocations on the hot path shown by report() is reset.
+  * \return The number of arrays that were allocated, which is less than numArrays if maxBuffers
+  * or maxMemory was reached.
+  */
+int NDArrayPool::preAllocate(int numArrays, int ndims, size_t *dims, NDDataType_t dataType)
+{
+  NDArray **pArrays;
+  int i, numAllocated=0;
+
+  if (numArrays <= 0) return 0;
+  pArrays = (NDArray **)callocMustSucceed(numArrays, sizeof(NDArray *), "NDArrayPool::preAllocate");
+  for (i=0; i<numArrays; i++) {
+    pArrays[i] = allocArray(ndims, dims, dataType, 0, NULL, 1);
+    if (!pArrays[i]) break;
+    memset(pArrays[i]->pData, 0, pArrays[i]->dataSize);
+    numAllocated++;
+  }
+  for (i=0; i<numAllocated; i++) release(pArrays[i]);
+  free(pArrays);
+  epicsMutexLock(listLock_);
+  /* Arrays released by this thread may be in its cache, make them available to all threads */
+  if (sizeClassMode_) drainThreadCaches();
+  numPreAllocated_ = numAllocated;
+  numHotAllocs_ = 0;
+  epicsMutexUnlock(listLock_);
+  return numAllocated;
+}
+
+/** Returns the number of buffers that alloc() has allocated since the last call to preAllocate() */
+int NDArrayPool::numHotAllocs()
+{
+  return numHotAllocs_;
+}
+
+/** Returns the mutex that protects the reference count of an array */
+epicsMutexId NDArrayPool::refLock(NDArray *pArray)
+{
+  return refLocks_[((size_t)pArray / sizeof(NDArray)) % ND_POOL_NUM_REF_LOCKS];
+}
+
+/** Selects whether free arrays are kept in a single free list or in size classes.
+  * \param[in] enable 1 to use size classes and per-thread caches, 0 to use a single free list.
+  *
+  * The free arrays are moved to the free lists for the new mode.  The mode can only be changed
+  * while all of the arrays of the pool are free, so that release() never puts an array on the
+  * free list of the other mode.
+  */
+int NDArrayPool::setSizeClassMode(int enable)
+{
+  NDArray *pArray;
+  int sizeClass;
+  const char *functionName = "NDArrayPool::setSizeClassMode";
+
+  enable = enable ? 1 : 0;
+  epicsMutexLock(listLock_);
+  if ((enable != sizeClassMode_) && (countFree() != numBuffers_)) {
+    printf("%s: ERROR, cannot change mode while %d arrays are in use\n",
+           functionName, numBuffers_ - countFree());
+    epicsMutexUnlock(listLock_);
+    return ND_ERROR;
+  }
+  if (enable != sizeClassMode_) {
+    if (enable) {
+      while ((pArray = (NDArray *)ellGet(&freeList_))) addSizeClass(pArray);
+      numFree_ = 0;
+    } else {
+      drainThreadCaches();
+      ellConcat(&freeList_, &emptyList_);
+      for (sizeClass=0; sizeClass<ND_POOL_NUM_SIZE_CLASSES; sizeClass++) {
+        epicsMutexLock(sizeClasses_[sizeClass].lock);
+        ellConcat(&freeList_, &sizeClasses_[sizeClass].freeList);
+        epicsMutexUnlock(sizeClasses_[sizeClass].lock);
+      }
+      numFree_ = ellCount(&freeList_);
+    }
+    sizeClassMode_ = enable;
+  }
+  epicsMutexUnlock(listLock_);
+  return ND_SUCCESS;
+}
+
 /** This method makes a copy of an NDArray object.
   * \param[in] pIn The input array to be copied.
   * \param[in] pOut The output array that will be copied to.
@@ -212,7 +867,7 @@ NDArray* NDArrayPool::copy(NDArray *pIn, NDArray *pOut, int copyData)
   * \param[in] pArray The array on which to increase the reference count.
   *
   * Plugins must call reserve() when an NDArray is placed on a queue for later
-  * processing.
+  * processing. The reference count is incremented atomically without taking the pool mutex.
   */
 int NDArrayPool::reserve(NDArray *pArray)
 {
@@ -224,9 +879,13 @@ int NDArrayPool::reserve(NDArray *pArray)
          driverName, functionName, pArray->pNDArrayPool, this);
     return(ND_ERROR);
   }
-  epicsMutexLock(listLock_);
+#ifdef ND_ATOMIC_REFERENCE_COUNT
+  epicsAtomicIncrIntT(&pArray->referenceCount);
+#else
+  epicsMutexLock(refLock(pArray));
   pArray->referenceCount++;
-  epicsMutexUnlock(listLock_);
+  epicsMutexUnlock(refLock(pArray));
+#endif
   return ND_SUCCESS;
 }
 
@@ -234,12 +893,17 @@ int NDArrayPool::reserve(NDArray *pArray)
   * \param[in] pArray The array on which to decrease the reference count.
   *
   * When the reference count reaches 0 the NDArray is placed back in the free list.
+  * The reference count is decremented atomically, so the pool-wide mutex is only taken
+  * when the array goes back on the free list.  With EPICS base versions before 3.15, which
+  * lack epicsAtomic, the count is protected by one of a set of mutexes selected by the
+  * address of the array.
   * Plugins must call release() when an NDArray is removed from the queue and
   * processing on it is complete. Drivers must call release() after calling all
   * plugins.
   */
 int NDArrayPool::release(NDArray *pArray)
 {
+  int referenceCount;
   const char *functionName = "release";
 
   /* Make sure we own this array */
@@ -248,191 +912,31 @@ int NDArrayPool::release(NDArray *pArray)
            driverName, functionName, pArray->pNDArrayPool, this);
     return(ND_ERROR);
   }
-  epicsMutexLock(listLock_);
-  pArray->referenceCount--;
-  if (pArray->referenceCount == 0) {
+#ifdef ND_ATOMIC_REFERENCE_COUNT
+  referenceCount = epicsAtomicDecrIntT(&pArray->referenceCount);
+#else
+  epicsMutexLock(refLock(pArray));
+  referenceCount = --pArray->referenceCount;
+  epicsMutexUnlock(refLock(pArray));
+#endif
+  if (referenceCount == 0) {
     /* The last user has released this image, add it back to the free list */
-    ellAdd(&freeList_, &pArray->node);
-    numFree_++;
+    if (sizeClassMode_) {
+      freeSizeClass(pArray);
+    } else {
+      epicsMutexLock(listLock_);
+      ellAdd(&freeList_, &pArray->node);
+      numFree_++;
+      epicsMutexUnlock(listLock_);
+    }
   }
-  if (pArray->referenceCount < 0) {
+  if (referenceCount < 0) {
     printf("%s:release ERROR, reference count < 0 pArray=%p\n",
            driverName, pArray);
   }
-  epicsMutexUnlock(listLock_);
   return ND_SUCCESS;
 }
 
-template <typename dataTypeIn, typename dataTypeOut> void convertType(NDArray *pIn, NDArray *pOut)
-{
-  size_t i;
-  dataTypeIn *pDataIn = (dataTypeIn *)pIn->pData;
-  dataTypeOut *pDataOut = (dataTypeOut *)pOut->pData;
-  NDArrayInfo_t arrayInfo;
-
-  pOut->getInfo(&arrayInfo);
-  for (i=0; i<arrayInfo.nElements; i++) {
-    *pDataOut++ = (dataTypeOut)(*pDataIn++);
-  }
-}
-
-template <typename dataTypeOut> int convertTypeSwitch (NDArray *pIn, NDArray *pOut)
-{
-  int status = ND_SUCCESS;
-
-  switch(pIn->dataType) {
-    case NDInt8:
-      convertType<epicsInt8, dataTypeOut> (pIn, pOut);
-      break;
-    case NDUInt8:
-      convertType<epicsUInt8, dataTypeOut> (pIn, pOut);
-      break;
-    case NDInt16:
-      convertType<epicsInt16, dataTypeOut> (pIn, pOut);
-      break;
-    case NDUInt16:
-      convertType<epicsUInt16, dataTypeOut> (pIn, pOut);
-      break;
-    case NDInt32:
-      convertType<epicsInt32, dataTypeOut> (pIn, pOut);
-      break;
-    case NDUInt32:
-      convertType<epicsUInt32, dataTypeOut> (pIn, pOut);
-      break;
-    case NDFloat32:
-      convertType<epicsFloat32, dataTypeOut> (pIn, pOut);
-      break;
-    case NDFloat64:
-      convertType<epicsFloat64, dataTypeOut> (pIn, pOut);
-      break;
-    default:
-      status = ND_ERROR;
-      break;
-  }
-  return(status);
-}
-
-
-template <typename dataTypeIn, typename dataTypeOut> void convertDim(NDArray *pIn, NDArray *pOut,
-                                                     void *pDataIn, void *pDataOut, int dim)
-{
-  dataTypeOut *pDOut = (dataTypeOut *)pDataOut;
-  dataTypeIn *pDIn = (dataTypeIn *)pDataIn;
-  NDDimension_t *pOutDims = pOut->dims;
-  NDDimension_t *pInDims = pIn->dims;
-  size_t inStep, outStep, inOffset;
-  int inDir;
-  int i, bin;
-  size_t inc, in, out;
-
-  inStep = 1;
-  outStep = 1;
-  inDir = 1;
-  inOffset = pOutDims[dim].offset;
-  for (i=0; i<dim; i++) {
-    inStep  *= pInDims[i].size;
-    outStep *= pOutDims[i].size;
-  }
-  if (pOutDims[dim].reverse) {
-    inOffset += pOutDims[dim].size * pOutDims[dim].binning - 1;
-    inDir = -1;
-  }
-  inc = inDir * inStep;
-  pDIn += inOffset*inStep;
-  for (in=0, out=0; out<pOutDims[dim].size; out++, in++) {
-    for (bin=0; bin<pOutDims[dim].binning; bin++) {
-      if (dim > 0) {
-        convertDim <dataTypeIn, dataTypeOut> (pIn, pOut, pDIn, pDOut, dim-1);
-      } else {
-        *pDOut += (dataTypeOut)*pDIn;
-      }
-      pDIn += inc;
-    }
-    pDOut += outStep;
-  }
-}
-
-template <typename dataTypeOut> int convertDimensionSwitch(NDArray *pIn, NDArray *pOut,
-                                                           void *pDataIn, void *pDataOut, int dim)
-{
-  int status = ND_SUCCESS;
-
-  switch(pIn->dataType) {
-    case NDInt8:
-      convertDim <epicsInt8, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim);
-      break;
-    case NDUInt8:
-      convertDim <epicsUInt8, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim);
-      break;
-    case NDInt16:
-      convertDim <epicsInt16, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim);
-      break;
-    case NDUInt16:
-      convertDim <epicsUInt16, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim);
-      break;
-    case NDInt32:
-      convertDim <epicsInt32, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim);
-      break;
-    case NDUInt32:
-      convertDim <epicsUInt32, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim);
-      break;
-    case NDFloat32:
-      convertDim <epicsFloat32, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim);
-      break;
-    case NDFloat64:
-      convertDim <epicsFloat64, dataTypeOut> (pIn, pOut, pDataIn, pDataOut, dim);
-      break;
-    default:
-      status = ND_ERROR;
-      break;
-  }
-  return(status);
-}
-
-static int convertDimension(NDArray *pIn,
-                            NDArray *pOut,
-                            void *pDataIn,
-                            void *pDataOut,
-                            int dim)
-{
-  int status = ND_SUCCESS;
-  /* This routine is passed:
-   * A pointer to the start of the input data
-   * A pointer to the start of the output data
-   * An array of dimensions
-   * A dimension index */
-  switch(pOut->dataType) {
-    case NDInt8:
-      convertDimensionSwitch <epicsInt8>(pIn, pOut, pDataIn, pDataOut, dim);
-      break;
-    case NDUInt8:
-      convertDimensionSwitch <epicsUInt8> (pIn, pOut, pDataIn, pDataOut, dim);
-      break;
-    case NDInt16:
-      convertDimensionSwitch <epicsInt16> (pIn, pOut, pDataIn, pDataOut, dim);
-      break;
-    case NDUInt16:
-      convertDimensionSwitch <epicsUInt16> (pIn, pOut, pDataIn, pDataOut, dim);
-      break;
-    case NDInt32:
-      convertDimensionSwitch <epicsInt32> (pIn, pOut, pDataIn, pDataOut, dim);
-      break;
-    case NDUInt32:
-      convertDimensionSwitch <epicsUInt32> (pIn, pOut, pDataIn, pDataOut, dim);
-      break;
-    case NDFloat32:
-      convertDimensionSwitch <epicsFloat32> (pIn, pOut, pDataIn, pDataOut, dim);
-      break;
-    case NDFloat64:
-      convertDimensionSwitch <epicsFloat64> (pIn, pOut, pDataIn, pDataOut, dim);
-      break;
-    default:
-      status = ND_ERROR;
-      break;
-  }
-  return(status);
-}
-
 /** Creates a new output NDArray from an input NDArray, performing
   * conversion operations.
   * This form of the function is for changing the data type only, not the dimensions,
@@ -473,6 +977,30 @@ int NDArrayPool::convert(NDArray *pIn,
                          NDArray **ppOut,
                          NDDataType_t dataTypeOut,
                          NDDimension_t *dimsOut)
+{
+  return this->convert(pIn, ppOut, dataTypeOut, dimsOut, 1.);
+}
+
+/** Creates a new output NDArray from an input NDArray, performing
+  * conversion operations and scaling.
+  * This form of the function also divides the output by scale, and can divide a large
+  * conversion between several threads. The region is copied by NDArrayRegionCopy.
+  * \param[in] pIn The input array, source of the conversion.
+  * \param[out] ppOut The output array, result of the conversion.
+  * \param[in] dataTypeOut The data type of the output array.
+  * \param[in] dimsOut The dimensions of the output array.
+  * \param[in] scale The output is divided by scale if it is not 0 or 1.  The binned sums are then
+  *            computed in double, so that integer data is only truncated once.
+  * \param[in] pWorkers Threads to do the conversion with, or NULL.
+  * \param[in] numThreads The maximum number of threads to use.
+  */
+int NDArrayPool::convert(NDArray *pIn,
+                         NDArray **ppOut,
+                         NDDataType_t dataTypeOut,
+                         NDDimension_t *dimsOut,
+                         double scale,
+                         NDStripeWorkers *pWorkers,
+                         int numThreads)
 {
   int dimsUnchanged;
   size_t dimSizeOut[ND_ARRAY_MAX_DIMS];
@@ -525,51 +1053,14 @@ int NDArrayPool::convert(NDArray *pIn,
 
   pOut->getInfo(&arrayInfo);
 
-  if (dimsUnchanged) {
-    if (pIn->dataType == pOut->dataType) {
-      /* The dimensions are the same and the data type is the same,
-       * then just copy the input image to the output image */
-      memcpy(pOut->pData, pIn->pData, arrayInfo.totalBytes);
-      return ND_SUCCESS;
-    } else {
-      /* We need to convert data types */
-      switch(pOut->dataType) {
-        case NDInt8:
-          convertTypeSwitch <epicsInt8> (pIn, pOut);
-          break;
-        case NDUInt8:
-          convertTypeSwitch <epicsUInt8> (pIn, pOut);
-          break;
-        case NDInt16:
-          convertTypeSwitch <epicsInt16> (pIn, pOut);
-          break;
-        case NDUInt16:
-          convertTypeSwitch <epicsUInt16> (pIn, pOut);
-          break;
-        case NDInt32:
-          convertTypeSwitch <epicsInt32> (pIn, pOut);
-          break;
-        case NDUInt32:
-          convertTypeSwitch <epicsUInt32> (pIn, pOut);
-          break;
-        case NDFloat32:
-          convertTypeSwitch <epicsFloat32> (pIn, pOut);
-          break;
-        case NDFloat64:
-          convertTypeSwitch <epicsFloat64> (pIn, pOut);
-          break;
-        default:
-          //status = ND_ERROR;
-          break;
-      }
-    }
-  } else {
-    /* The input and output dimensions are not the same, so we are extracting a region
-     * and/or binning */
-    /* Clear entire output array */
-    memset(pOut->pData, 0, arrayInfo.totalBytes);
-    convertDimension(pIn, pOut, pIn->pData, pOut->pData, pIn->ndims-1);
+  if (dimsUnchanged && (pIn->dataType == pOut->dataType) && ((scale == 0) || (scale == 1))) {
+    /* The dimensions are the same and the data type is the same,
+     * then just copy the input image to the output image */
+    memcpy(pOut->pData, pIn->pData, arrayInfo.totalBytes);
+    return ND_SUCCESS;
   }
+  /* We need to convert data types and/or extract a region and/or bin */
+  NDArrayRegionCopy(pIn, dimsOutCopy, pOut->dataType, pOut->pData, scale, pWorkers, numThreads);
 
   /* Set fields in the output array */
   for (i=0; i<pIn->ndims; i++) {
@@ -618,7 +1109,111 @@ size_t NDArrayPool::memorySize()
 /** Returns number of NDArray objects in the free list */
 int NDArrayPool::numFree()
 {
-  return numFree_;
+  int num;
+
+  epicsMutexLock(listLock_);
+  num = countFree();
+  epicsMutexUnlock(listLock_);
+  return num;
+}
+
+/** Returns number of free NDArray objects, including those in the per-thread caches.
+  * Must be called with listLock_ held. */
+int NDArrayPool::countFree()
+{
+  NDArrayPoolThreadCache *pCache;
+  int sizeClass;
+  int num;
+
+  if (!sizeClassMode_) return numFree_;
+  num = ellCount(&emptyList_);
+  for (sizeClass=0; sizeClass<ND_POOL_NUM_SIZE_CLASSES; sizeClass++) {
+    epicsMutexLock(sizeClasses_[sizeClass].lock);
+    num += ellCount(&sizeClasses_[sizeClass].freeList);
+    epicsMutexUnlock(sizeClasses_[sizeClass].lock);
+  }
+  for (pCache = (NDArrayPoolThreadCache *)ellFirst(&threadCaches_); pCache;
+       pCache = (NDArrayPoolThreadCache *)ellNext(&pCache->node)) {
+    epicsMutexLock(pCache->lock);
+    num += pCache->numArrays;
+    epicsMutexUnlock(pCache->lock);
+  }
+  return num;
+}
+
+/** Frees all of the free arrays and their buffers, including those in the per-thread caches.
+  * This returns the memory of the pool to the system, for example after acquiring large images.
+  * Arrays that are in use are not affected.
+  */
+int NDArrayPool::emptyFreeList()
+{
+  NDArray *pArray;
+  ELLLIST freeArrays;
+  int sizeClass;
+
+  ellInit(&freeArrays);
+  epicsMutexLock(listLock_);
+  if (sizeClassMode_) {
+    drainThreadCaches();
+    ellConcat(&freeArrays, &emptyList_);
+    for (sizeClass=0; sizeClass<ND_POOL_NUM_SIZE_CLASSES; sizeClass++) {
+      epicsMutexLock(sizeClasses_[sizeClass].lock);
+      ellConcat(&freeArrays, &sizeClasses_[sizeClass].freeList);
+      epicsMutexUnlock(sizeClasses_[sizeClass].lock);
+    }
+  } else {
+    ellConcat(&freeArrays, &freeList_);
+    numFree_ = 0;
+  }
+  while ((pArray = (NDArray *)ellGet(&freeArrays))) {
+    if (pArray->pData) freeBuffer(pArray);
+    numBuffers_--;
+    delete pArray;
+  }
+  epicsMutexUnlock(listLock_);
+  return ND_SUCCESS;
+}
+
+/** Returns 1 if the pool is in size-class mode, 0 if it uses a single free list */
+int NDArrayPool::sizeClassMode()
+{
+  return sizeClassMode_;
+}
+
+/** Returns the number of allocations in size-class mode that were satisfied by a free buffer */
+int NDArrayPool::numHits()
+{
+  NDArrayPoolThreadCache *pCache;
+  int sizeClass;
+  int num=0;
+
+  epicsMutexLock(listLock_);
+  for (sizeClass=0; sizeClass<ND_POOL_NUM_SIZE_CLASSES; sizeClass++) {
+    epicsMutexLock(sizeClasses_[sizeClass].lock);
+    num += sizeClasses_[sizeClass].numHits;
+    epicsMutexUnlock(sizeClasses_[sizeClass].lock);
+  }
+  for (pCache = (NDArrayPoolThreadCache *)ellFirst(&threadCaches_); pCache;
+       pCache = (NDArrayPoolThreadCache *)ellNext(&pCache->node)) {
+    epicsMutexLock(pCache->lock);
+    num += pCache->numHits;
+    epicsMutexUnlock(pCache->lock);
+  }
+  epicsMutexUnlock(listLock_);
+  return num;
+}
+
+/** Returns the number of allocations in size-class mode for which no suitable free buffer was found */
+int NDArrayPool::numMisses()
+{
+  return numMisses_;
+}
+
+/** Returns the number of allocations in size-class mode that had to free a smaller buffer
+  * and allocate a new one because maxBuffers was reached */
+int NDArrayPool::numReallocs()
+{
+  return numReallocs_;
 }
 
 /** Reports on the free list size and other properties of the NDArrayPool
@@ -628,6 +1223,8 @@ int NDArrayPool::numFree()
   */
 int NDArrayPool::report(FILE *fp, int details)
 {
+  int sizeClass;
+
   fprintf(fp, "\n");
   fprintf(fp, "NDArrayPool:\n");
   fprintf(fp, "  numBuffers=%d, maxBuffers=%d\n",
@@ -635,7 +1232,38 @@ int NDArrayPool::report(FILE *fp, int details)
   fprintf(fp, "  memorySize=%ld, maxMemory=%ld\n",
         (long)memorySize_, (long)maxMemory_);
   fprintf(fp, "  numFree=%d\n",
-         numFree_);
+         numFree());
+  fprintf(fp, "  sizeClassMode=%d\n", sizeClassMode_);
+  fprintf(fp, "  backing=%s, hugePageSize=%ld, numaNode=%d\n",
+          mmapBacking_ ? "mmap" : "malloc", (long)hugePageSize_, numaNode_);
+  fprintf(fp, "  numPreAllocated=%d, buffers allocated on hot path=%d%s\n",
+          numPreAllocated_, numHotAllocs_,
+          ((numPreAllocated_ > 0) && (numHotAllocs_ > 0)) ? " (pre-allocation was not sufficient)" : "");
+  if (sizeClassMode_) {
+    NDArrayPoolThreadCache *pCache;
+    size_t cacheMemory=0;
+    int numCaches;
+    epicsMutexLock(listLock_);
+    numCaches = ellCount(&threadCaches_);
+    for (pCache = (NDArrayPoolThreadCache *)ellFirst(&threadCaches_); pCache;
+         pCache = (NDArrayPoolThreadCache *)ellNext(&pCache->node)) {
+      epicsMutexLock(pCache->lock);
+      cacheMemory += pCache->memorySize;
+      epicsMutexUnlock(pCache->lock);
+    }
+    epicsMutexUnlock(listLock_);
+    fprintf(fp, "  numHits=%d, numMisses=%d, numReallocs=%d\n",
+            numHits(), numMisses_, numReallocs_);
+    fprintf(fp, "  threadCaches=%d, memory in thread caches=%ld\n",
+            numCaches, (long)cacheMemory);
+    if (details > 5) {
+      for (sizeClass=0; sizeClass<ND_POOL_NUM_SIZE_CLASSES; sizeClass++) {
+        if (ellCount(&sizeClasses_[sizeClass].freeList) == 0) continue;
+        fprintf(fp, "    sizeClass=%d (>=%.0f bytes) numFree=%d\n",
+                sizeClass, (double)((size_t)1 << sizeClass), ellCount(&sizeClasses_[sizeClass].freeList));
+      }
+    }
+  }
       
   return ND_SUCCESS;
 }
@@ -0,0 +1,292 @@
+/*
+ * NDArrayRegion.cpp
+ *
+ * Copies a region of an NDArray with binning, reversal, data type conversion and scaling.
+ *
+ * Created November 2015
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <vector>
+
+#include <epicsTypes.h>
+#include <epicsExport.h>
+
+#include "NDArray.h"
+#include "NDStripeWorkers.h"
+#include "NDArrayRegion.h"
+
+/** Adds (or stores, when first is set) one binned row of input elements to one row of the output.
+  * Each output element is the sum of bin0 input elements that are step0 elements apart. */
+typedef void (*NDRegionRowFunc_t)(const void *pIn, ptrdiff_t step0, int bin0, size_t n, void *pOut, int first);
+/** Divides a row of double sums by scale and stores it in the output data type */
+typedef void (*NDRegionStoreFunc_t)(const double *pSum, size_t n, double scale, void *pOut);
+
+/** The region being copied, after adjacent dimensions that are contiguous in the input have been merged.
+  * The output is processed one row (output dimension 0) at a time; each output row is the sum of the
+  * input rows selected by the binning of the other dimensions. */
+struct NDRegionPlan {
+    int ndims;
+    size_t outSize[ND_ARRAY_MAX_DIMS];
+    int binning[ND_ARRAY_MAX_DIMS];
+    ptrdiff_t inStep[ND_ARRAY_MAX_DIMS];    /**< Input elements between successive input positions; negative when reversed */
+    const char *pIn;                        /**< First input element of the region */
+    size_t inBytes;
+    char *pOut;
+    size_t outBytes;
+    size_t numRows;
+    int numStripes;
+    double scale;
+    bool sameType;                          /**< The input and output data types are the same */
+    NDRegionRowFunc_t rowFunc;              /**< Converts to the output type, or to double when scaling */
+    NDRegionStoreFunc_t storeFunc;          /**< Only used when scaling */
+};
+
+template <typename dataTypeIn, typename dataTypeOut>
+static void regionRowT(const void *pInV, ptrdiff_t step0, int bin0, size_t n, void *pOutV, int first)
+{
+    const dataTypeIn *pIn = (const dataTypeIn *)pInV;
+    dataTypeOut *pOut = (dataTypeOut *)pOutV;
+    size_t i;
+    int bin;
+
+    /* The sums are done in the output data type, adding each input element converted to that type,
+     * which is what NDArrayPool::convert has always done */
+    if (bin0 == 1) {
+        if (step0 == 1) {
+            if (first) for (i=0; i<n; i++) pOut[i] = (dataTypeOut)pIn[i];
+            else       for (i=0; i<n; i++) pOut[i] += (dataTypeOut)pIn[i];
+        } else {
+            if (first) for (i=0; i<n; i++) pOut[i] = (dataTypeOut)pIn[i*step0];
+            else       for (i=0; i<n; i++) pOut[i] += (dataTypeOut)pIn[i*step0];
+        }
+    } else {
+        /* One pass over the row for each bin, so each output element still gets its bins added in order */
+        ptrdiff_t step = bin0*step0;
+        for (bin=0; bin<bin0; bin++, pIn+=step0) {
+            if (first && (bin == 0)) for (i=0; i<n; i++) pOut[i] = (dataTypeOut)pIn[i*step];
+            else                     for (i=0; i<n; i++) pOut[i] += (dataTypeOut)pIn[i*step];
+        }
+    }
+}
+
+template <typename dataTypeOut>
+static void regionStoreT(const double *pSum, size_t n, double scale, void *pOutV)
+{
+    dataTypeOut *pOut = (dataTypeOut *)pOutV;
+    for (size_t i=0; i<n; i++) pOut[i] = (dataTypeOut)(pSum[i]/scale);
+}
+
+template <typename dataTypeOut>
+static NDRegionRowFunc_t regionRowSwitch(NDDataType_t dataTypeIn)
+{
+    switch (dataTypeIn) {
+        case NDInt8:    return regionRowT<epicsInt8,    dataTypeOut>;
+        case NDUInt8:   return regionRowT<epicsUInt8,   dataTypeOut>;
+        case NDInt16:   return regionRowT<epicsInt16,   dataTypeOut>;
+        case NDUInt16:  return regionRowT<epicsUInt16,  dataTypeOut>;
+        case NDInt32:   return regionRowT<epicsInt32,   dataTypeOut>;
+        case NDUInt32:  return regionRowT<epicsUInt32,  dataTypeOut>;
+        case NDFloat32: return regionRowT<epicsFloat32, dataTypeOut>;
+        case NDFloat64: return regionRowT<epicsFloat64, dataTypeOut>;
+        default:        return NULL;
+    }
+}
+
+static NDRegionRowFunc_t regionRowFunc(NDDataType_t dataTypeIn, NDDataType_t dataTypeOut)
+{
+    switch (dataTypeOut) {
+        case NDInt8:    return regionRowSwitch<epicsInt8>   (dataTypeIn);
+        case NDUInt8:   return regionRowSwitch<epicsUInt8>  (dataTypeIn);
+        case NDInt16:   return regionRowSwitch<epicsInt16>  (dataTypeIn);
+        case NDUInt16:  return regionRowSwitch<epicsUInt16> (dataTypeIn);
+        case NDInt32:   return regionRowSwitch<epicsInt32>  (dataTypeIn);
+        case NDUInt32:  return regionRowSwitch<epicsUInt32> (dataTypeIn);
+        case NDFloat32: return regionRowSwitch<epicsFloat32>(dataTypeIn);
+        case NDFloat64: return regionRowSwitch<epicsFloat64>(dataTypeIn);
+        default:        return NULL;
+    }
+}
+
+static NDRegionStoreFunc_t regionStoreFunc(NDDataType_t dataTypeOut)
+{
+    switch (dataTypeOut) {
+        case NDInt8:    return regionStoreT<epicsInt8>;
+        case NDUInt8:   return regionStoreT<epicsUInt8>;
+        case NDInt16:   return regionStoreT<epicsInt16>;
+        case NDUInt16:  return regionStoreT<epicsUInt16>;
+        case NDInt32:   return regionStoreT<epicsInt32>;
+        case NDUInt32:  return regionStoreT<epicsUInt32>;
+        case NDFloat32: return regionStoreT<epicsFloat32>;
+        case NDFloat64: return regionStoreT<epicsFloat64>;
+        default:        return NULL;
+    }
+}
+
+static size_t regionElementSize(NDDataType_t dataType)
+{
+    switch (dataType) {
+        case NDInt8:    return sizeof(epicsInt8);
+        case NDUInt8:   return sizeof(epicsUInt8);
+        case NDInt16:   return sizeof(epicsInt16);
+        case NDUInt16:  return sizeof(epicsUInt16);
+        case NDInt32:   return sizeof(epicsInt32);
+        case NDUInt32:  return sizeof(epicsUInt32);
+        case NDFloat32: return sizeof(epicsFloat32);
+        case NDFloat64: return sizeof(epicsFloat64);
+        default:        return 0;
+    }
+}
+
+static void removeDimension(NDRegionPlan *p, int dim)
+{
+    for (int i=dim; i<p->ndims-1; i++) {
+        p->outSize[i] = p->outSize[i+1];
+        p->binning[i] = p->binning[i+1];
+        p->inStep[i]  = p->inStep[i+1];
+    }
+    p->ndims--;
+}
+
+/** Copies the output rows of one stripe of the region */
+static void regionStripe(void *drvPvt, int stripe)
+{
+    NDRegionPlan *p = (NDRegionPlan *)drvPvt;
+    size_t rowsPerStripe = (p->numRows + p->numStripes - 1) / p->numStripes;
+    size_t firstRow = stripe * rowsPerStripe;
+    size_t lastRow = firstRow + rowsPerStripe;
+    size_t row, index;
+    size_t rowBytes = p->outSize[0] * p->outBytes;
+    std::vector<double> sum;
+    int bins[ND_ARRAY_MAX_DIMS];
+    int dim, first;
+    bool memcpyRow;
+
+    if (lastRow > p->numRows) lastRow = p->numRows;
+    if (p->storeFunc) sum.resize(p->outSize[0]);
+    /* Unbinned rows that are contiguous in the input and need no conversion are copied with memcpy */
+    memcpyRow = p->sameType && !p->storeFunc && (p->inStep[0] == 1) && (p->binning[0] == 1);
+    for (dim=1; dim<p->ndims; dim++) {
+        if (p->binning[dim] != 1) memcpyRow = false;
+    }
+
+    for (row=firstRow; row<lastRow; row++) {
+        const char *pRowIn = p->pIn;
+        char *pRowOut = p->pOut + row*rowBytes;
+        void *pSum = p->storeFunc ? (void *)&sum[0] : (void *)pRowOut;
+
+        /* Find the first input row of this output row */
+        index = row;
+        for (dim=1; dim<p->ndims; dim++) {
+            pRowIn += (ptrdiff_t)(index % p->outSize[dim]) * p->binning[dim] * p->inStep[dim] * (ptrdiff_t)p->inBytes;
+            index /= p->outSize[dim];
+            bins[dim] = 0;
+        }
+        if (memcpyRow) {
+            memcpy(pRowOut, pRowIn, rowBytes);
+            continue;
+        }
+        /* Add the binned input rows, with the highest dimension changing slowest */
+        first = 1;
+        while (1) {
+            const char *pBinIn = pRowIn;
+            for (dim=1; dim<p->ndims; dim++) pBinIn += (ptrdiff_t)bins[dim] * p->inStep[dim] * (ptrdiff_t)p->inBytes;
+            p->rowFunc(pBinIn, p->inStep[0], p->binning[0], p->outSize[0], pSum, first);
+            first = 0;
+            for (dim=1; dim<p->ndims; dim++) {
+                if (++bins[dim] < p->binning[dim]) break;
+                bins[dim] = 0;
+            }
+            if (dim == p->ndims) break;
+        }
+        if (p->storeFunc) p->storeFunc(&sum[0], p->outSize[0], p->scale, pRowOut);
+    }
+}
+
+/** Copies a region of an NDArray to a buffer, with binning, reversal, data type conversion and scaling.
+  * This is the engine behind NDArrayPool::convert. It works one output row at a time rather than one
+  * element at a time: unbinned rows that are contiguous and of the same type are copied with memcpy,
+  * other rows are converted and binned by loops that the compiler can vectorise, and dimensions that are
+  * contiguous in the input are merged into longer rows first.
+  * \param[in] pIn The input array.
+  * \param[in] dimsOut One entry for each dimension of pIn. size is the output size (the number of input
+  *            elements divided by binning), offset is the first input element, binning is the number of
+  *            input elements summed into each output element, and reverse reverses the order.
+  * \param[in] dataTypeOut The data type of the output.
+  * \param[out] pDataOut The output buffer, which must be large enough for the region. It does not need to be
+  *            initialized; every output element is written.
+  * \param[in] scale When this is not 0 or 1 each output element is divided by it. The binned sums are then
+  *            done in double, so that integer data is only truncated once.
+  * \param[in] pWorkers Threads to copy the region with, or NULL.
+  * \param[in] numThreads Maximum number of threads to use; regions of fewer than 65536 input elements
+  *            are copied by the calling thread. */
+int NDArrayRegionCopy(NDArray *pIn, NDDimension_t *dimsOut, NDDataType_t dataTypeOut, void *pDataOut,
+                      double scale, NDStripeWorkers *pWorkers, int numThreads)
+{
+    NDRegionPlan plan, *p=&plan;
+    NDArrayInfo_t arrayInfo;
+    size_t inStride = 1, work;
+    int dim;
+
+    p->rowFunc = regionRowFunc(pIn->dataType, (scale != 0) && (scale != 1) ? NDFloat64 : dataTypeOut);
+    p->storeFunc = (scale != 0) && (scale != 1) ? regionStoreFunc(dataTypeOut) : NULL;
+    if (!p->rowFunc || (((scale != 0) && (scale != 1)) && !p->storeFunc)) return ND_ERROR;
+    if (pIn->ndims < 1) return ND_SUCCESS;
+
+    pIn->getInfo(&arrayInfo);
+    p->inBytes = arrayInfo.bytesPerElement;
+    p->outBytes = regionElementSize(dataTypeOut);
+    p->sameType = (pIn->dataType == dataTypeOut);
+    p->scale = scale;
+    p->pIn = (const char *)pIn->pData;
+    p->pOut = (char *)pDataOut;
+    p->ndims = pIn->ndims;
+    for (dim=0; dim<pIn->ndims; dim++) {
+        size_t start = dimsOut[dim].offset;
+        p->outSize[dim] = dimsOut[dim].size;
+        p->binning[dim] = dimsOut[dim].binning;
+        p->inStep[dim] = (ptrdiff_t)inStride;
+        if (dimsOut[dim].reverse) {
+            start += dimsOut[dim].size * dimsOut[dim].binning - 1;
+            p->inStep[dim] = -p->inStep[dim];
+        }
+        if (p->outSize[dim] == 0) return ND_SUCCESS;
+        p->pIn += start * inStride * p->inBytes;
+        inStride *= pIn->dims[dim].size;
+    }
+
+    /* Drop unbinned dimensions of size 1, so that selecting one color of an RGB1 array gives long rows,
+     * and merge adjacent unbinned dimensions when the second one continues where the first one ends */
+    for (dim=0; (dim<p->ndims) && (p->ndims>1); ) {
+        if ((p->outSize[dim] == 1) && (p->binning[dim] == 1)) {
+            removeDimension(p, dim);
+        } else {
+            dim++;
+        }
+    }
+    for (dim=0; dim<p->ndims-1; ) {
+        if ((p->binning[dim] == 1) && (p->binning[dim+1] == 1) &&
+            (p->inStep[dim+1] == p->inStep[dim] * (ptrdiff_t)p->outSize[dim])) {
+            p->outSize[dim] *= p->outSize[dim+1];
+            removeDimension(p, dim+1);
+        } else {
+            dim++;
+        }
+    }
+
+    p->numRows = 1;
+    work = p->outSize[0] * p->binning[0];
+    for (dim=1; dim<p->ndims; dim++) {
+        p->numRows *= p->outSize[dim];
+        work *= p->outSize[dim] * p->binning[dim];
+    }
+    p->numStripes = pWorkers ? NDStripeWorkers::numStripes(numThreads, work, p->numRows) : 1;
+    if (p->numStripes == 1) {
+        regionStripe(p, 0);
+    } else {
+        pWorkers->run(p->numStripes, regionStripe, p);
+    }
+    return ND_SUCCESS;
+}
@@ -0,0 +1,13 @@
+#ifndef NDArrayRegion_H
+#define NDArrayRegion_H
+
+#include <shareLib.h>
+
+#include "NDArray.h"
+
+class NDStripeWorkers;
+
+epicsShareFunc int NDArrayRegionCopy(NDArray *pIn, NDDimension_t *dimsOut, NDDataType_t dataTypeOut, void *pDataOut,
+                                     double scale=1., NDStripeWorkers *pWorkers=NULL, int numThreads=1);
+
+#endif
@@ -46,23 +46,7 @@ const char *NDAttribute::attrSourceString(NDAttrSource_t type)
   this->pName = pName? epicsStrDup(pName): epicsStrDup("");
   this->pDescription = pDescription? epicsStrDup(pDescription): epicsStrDup("");
   this->sourceType = sourceType;
-  switch (sourceType) {
-    case NDAttrSourceDriver:
-      this->pSourceTypeString = epicsStrDup("NDAttrSourceDriver");
-      break;
-    case NDAttrSourceEPICSPV:
-      this->pSourceTypeString = epicsStrDup("NDAttrSourceEPICSPV");
-      break;
-    case NDAttrSourceParam:
-      this->pSourceTypeString = epicsStrDup("NDAttrSourceParam");
-      break;
-    case NDAttrSourceFunct:
-      this->pSourceTypeString = epicsStrDup("NDAttrSourceFunct");
-      break;
-    default:
-      this->sourceType = NDAttrSourceUndefined;
-      this->pSourceTypeString = epicsStrDup("Undefined");
-  }
+  this->pSourceTypeString = epicsStrDup(sourceTypeString(&this->sourceType));
   this->pSource = pSource? epicsStrDup(pSource): epicsStrDup("");
   this->pString = NULL;
   if (pValue) {
@@ -70,6 +54,9 @@ const char *NDAttribute::attrSourceString(NDAttrSource_t type)
     this->setValue(pValue);
   }
   this->listNode.pNDAttribute = this;
+  this->nameHash = epicsStrHash(this->pName, 0);
+  this->pHashNext = NULL;
+  this->poolable = 0;
 }
 
 /** NDAttribute copy constructor
@@ -89,6 +76,62 @@ NDAttribute::NDAttribute(NDAttribute& attribute)
   else pValue = &attribute.value;
   this->setValue(pValue);
   this->listNode.pNDAttribute = this;
+  this->nameHash = attribute.nameHash;
+  this->pHashNext = NULL;
+  this->poolable = 0;
+}
+
+/** Returns the source type string for a source type.
+  * \param[in,out] pSourceType The source type; an invalid type is changed to NDAttrSourceUndefined.
+  */
+const char *NDAttribute::sourceTypeString(NDAttrSource_t *pSourceType)
+{
+  switch (*pSourceType) {
+    case NDAttrSourceDriver:
+      return "NDAttrSourceDriver";
+    case NDAttrSourceEPICSPV:
+      return "NDAttrSourceEPICSPV";
+    case NDAttrSourceParam:
+      return "NDAttrSourceParam";
+    case NDAttrSourceFunct:
+      return "NDAttrSourceFunct";
+    default:
+      *pSourceType = NDAttrSourceUndefined;
+      return "Undefined";
+  }
+}
+
+/** Replaces a string only if it has changed, so reusing an attribute normally allocates nothing */
+static void replaceString(char **ppString, const char *pValue)
+{
+  if (!pValue) pValue = "";
+  if (*ppString) {
+    if (strcmp(*ppString, pValue) == 0) return;
+    free(*ppString);
+  }
+  *ppString = epicsStrDup(pValue);
+}
+
+/** Gives an attribute taken from the NDAttributeList pool new properties; the name is unchanged.
+  * The arguments are the same as for the constructor.
+  */
+void NDAttribute::reset(const char *pDescription, NDAttrSource_t sourceType, const char *pSource,
+                        NDAttrDataType_t dataType, void *pValue)
+{
+  replaceString(&this->pDescription, pDescription);
+  if (sourceType != this->sourceType) {
+    this->sourceType = sourceType;
+    replaceString(&this->pSourceTypeString, sourceTypeString(&this->sourceType));
+  }
+  replaceString(&this->pSource, pSource);
+  this->dataType = NDAttrUndefined;
+  if (pValue) {
+    this->setDataType(dataType);
+    this->setValue(pValue);
+  } else if (this->pString) {
+    free(this->pString);
+    this->pString = NULL;
+  }
 }
 
 
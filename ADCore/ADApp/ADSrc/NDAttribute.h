@@ -110,6 +110,9 @@ public:
 
 private:
     template <typename epicsType> int getValueT(void *pValue, size_t dataSize);
+    static const char *sourceTypeString(NDAttrSource_t *pSourceType);
+    void reset(const char *pDescription, NDAttrSource_t sourceType, const char *pSource,
+               NDAttrDataType_t dataType, void *pValue);
     char *pName;                   /**< Name string */
     char *pDescription;            /**< Description string */
     NDAttrDataType_t dataType;     /**< Data type of attribute */
@@ -119,6 +122,9 @@ private:
     NDAttrSource_t sourceType;     /**< Source type */
     char *pSourceTypeString;       /**< Source type string */
     NDAttributeListNode listNode;  /**< Used for NDAttributeList */
+    unsigned int nameHash;         /**< Hash of pName, used by the NDAttributeList index */
+    NDAttribute *pHashNext;        /**< Next attribute in the same NDAttributeList hash bucket */
+    int poolable;                  /**< Created by an NDAttributeList, which may keep it for reuse */
 };
 
 #endif
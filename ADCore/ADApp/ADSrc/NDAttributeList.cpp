@@ -8,6 +8,9 @@
  
 #include <stdlib.h>
 
+#include <epicsString.h>
+#include <cantProceed.h>
+
 #include <epicsExport.h>
 
 #include "NDAttributeList.h"
@@ -15,20 +18,128 @@
 /** NDAttributeList constructor
   */
 NDAttributeList::NDAttributeList()
+  : hashSize(ND_ATTR_LIST_HASH_SIZE), numPooled(0)
 {
   ellInit(&this->list);
+  this->hashTable = (NDAttribute **)callocMustSucceed(this->hashSize, sizeof(NDAttribute *), "NDAttributeList");
+  this->poolTable = (NDAttribute **)callocMustSucceed(this->hashSize, sizeof(NDAttribute *), "NDAttributeList");
   this->lock = epicsMutexCreate();
 }
 
+/** Returns the location of the pointer to the attribute called pName in a hash table,
+  * or of the NULL pointer that ends its bucket if there is no such attribute. */
+NDAttribute** NDAttributeList::findLink(NDAttribute **table, int hashSize, const char *pName, unsigned int hash)
+{
+  NDAttribute **ppLink = &table[hash & (hashSize-1)];
+
+  while (*ppLink) {
+    if (((*ppLink)->nameHash == hash) && (strcmp((*ppLink)->pName, pName) == 0)) break;
+    ppLink = &(*ppLink)->pHashNext;
+  }
+  return ppLink;
+}
+
 /** NDAttributeList destructor
   */
 NDAttributeList::~NDAttributeList()
 {
+  NDAttribute *pAttribute;
+  int i;
+
   this->clear();
   ellFree(&this->list);
+  for (i=0; i<this->hashSize; i++) {
+    while ((pAttribute = this->poolTable[i])) {
+      this->poolTable[i] = pAttribute->pHashNext;
+      delete pAttribute;
+    }
+  }
+  free(this->hashTable);
+  free(this->poolTable);
   epicsMutexDestroy(this->lock);
 }
 
+/** Appends an attribute to the list and to the hash index; the caller must hold the lock and
+  * must have checked that there is no attribute of the same name in the list. */
+void NDAttributeList::insert(NDAttribute *pAttribute)
+{
+  unsigned int bucket;
+
+  ellAdd(&this->list, &pAttribute->listNode.node);
+  if (ellCount(&this->list) > 2*this->hashSize) this->resize(2*this->hashSize);
+  bucket = pAttribute->nameHash & (this->hashSize-1);
+  pAttribute->pHashNext = this->hashTable[bucket];
+  this->hashTable[bucket] = pAttribute;
+}
+
+/** Disposes of an attribute that has been removed from the list; the caller must hold the lock.
+  * Attributes created by this list are put in the pool unless it already holds as many
+  * attributes as there are buckets in the index, all others are deleted. */
+void NDAttributeList::release(NDAttribute *pAttribute)
+{
+  unsigned int bucket;
+
+  if (!pAttribute->poolable || (this->numPooled >= 2*this->hashSize)) {
+    delete pAttribute;
+    return;
+  }
+  bucket = pAttribute->nameHash & (this->hashSize-1);
+  pAttribute->pHashNext = this->poolTable[bucket];
+  this->poolTable[bucket] = pAttribute;
+  this->numPooled++;
+}
+
+/** Takes an attribute out of the pool; the caller must hold the lock.
+  * \param[in] type The class of the attribute wanted.
+  * \param[in] pName The name of the attribute wanted.
+  * \param[in] hash The hash of pName.
+  * \param[in] dataType The data type of the attribute wanted.
+  * \return Returns a pooled attribute with the same name, class and data type, NULL if there is none. */
+NDAttribute* NDAttributeList::takeFromPool(const std::type_info &type, const char *pName, unsigned int hash,
+                                           NDAttrDataType_t dataType)
+{
+  NDAttribute **ppLink = &this->poolTable[hash & (this->hashSize-1)];
+  NDAttribute *pAttribute;
+
+  while ((pAttribute = *ppLink)) {
+    if ((pAttribute->nameHash == hash) && (pAttribute->dataType == dataType) &&
+        (strcmp(pAttribute->pName, pName) == 0) && (typeid(*pAttribute) == type)) {
+      *ppLink = pAttribute->pHashNext;
+      this->numPooled--;
+      return pAttribute;
+    }
+    ppLink = &pAttribute->pHashNext;
+  }
+  return NULL;
+}
+
+/** Changes the number of buckets in the hash index and the pool; the caller must hold the lock */
+void NDAttributeList::resize(int newSize)
+{
+  NDAttribute **tables[2] = {this->hashTable, this->poolTable};
+  NDAttribute **newTable;
+  NDAttribute *pAttribute;
+  unsigned int bucket;
+  int i, j;
+
+  for (j=0; j<2; j++) {
+    newTable = (NDAttribute **)callocMustSucceed(newSize, sizeof(NDAttribute *), "NDAttributeList::resize");
+    for (i=0; i<this->hashSize; i++) {
+      while ((pAttribute = tables[j][i])) {
+        tables[j][i] = pAttribute->pHashNext;
+        bucket = pAttribute->nameHash & (newSize-1);
+        pAttribute->pHashNext = newTable[bucket];
+        newTable[bucket] = pAttribute;
+      }
+    }
+    free(tables[j]);
+    tables[j] = newTable;
+  }
+  this->hashTable = tables[0];
+  this->poolTable = tables[1];
+  this->hashSize = newSize;
+}
+
 /** Adds an attribute to the list.
   * If an attribute of the same name already exists then
   * the existing attribute is deleted and replaced with the new one.
@@ -41,7 +152,7 @@ int NDAttributeList::add(NDAttribute *pAttribute)
   epicsMutexLock(this->lock);
   /* Remove any existing attribute with this name */
   this->remove(pAttribute->pName);
-  ellAdd(&this->list, &pAttribute->listNode.node);
+  this->insert(pAttribute);
   epicsMutexUnlock(this->lock);
   return(ND_SUCCESS);
 }
@@ -56,6 +167,8 @@ int NDAttributeList::add(NDAttribute *pAttribute)
   * of the NDAttribute base class type, not derived class attributes.
   * To add attributes of a derived class to a list the NDAttributeList::add(NDAttribute*)
   * method must be used.
+  * If the attribute is not in the list but there is one with the same name and data type in the
+  * pool then that is reused instead of creating a new one.
   * \param[in] pName The name of the attribute to be added. 
   * \param[in] pDescription The description of the attribute.
   * \param[in] dataType The data type of the attribute.
@@ -66,14 +179,21 @@ NDAttribute* NDAttributeList::add(const char *pName, const char *pDescription, N
 {
   //const char *functionName = "NDAttributeList::add";
   NDAttribute *pAttribute;
+  unsigned int hash = epicsStrHash(pName, 0);
 
   epicsMutexLock(this->lock);
-  pAttribute = this->find(pName);
+  pAttribute = *findLink(this->hashTable, this->hashSize, pName, hash);
   if (pAttribute) {
     pAttribute->setValue(pValue);
   } else {
-    pAttribute = new NDAttribute(pName, pDescription, NDAttrSourceDriver, "Driver", dataType, pValue);
-    ellAdd(&this->list, &pAttribute->listNode.node);
+    pAttribute = this->takeFromPool(typeid(NDAttribute), pName, hash, pValue ? dataType : NDAttrUndefined);
+    if (pAttribute) {
+      pAttribute->reset(pDescription, NDAttrSourceDriver, "Driver", dataType, pValue);
+    } else {
+      pAttribute = new NDAttribute(pName, pDescription, NDAttrSourceDriver, "Driver", dataType, pValue);
+      pAttribute->poolable = 1;
+    }
+    this->insert(pAttribute);
   }
   epicsMutexUnlock(this->lock);
   return(pAttribute);
@@ -88,19 +208,11 @@ NDAttribute* NDAttributeList::add(const char *pName, const char *pDescription, N
 NDAttribute* NDAttributeList::find(const char *pName)
 {
   NDAttribute *pAttribute;
-  NDAttributeListNode *pListNode;
+  unsigned int hash = epicsStrHash(pName, 0);
   //const char *functionName = "NDAttributeList::find";
 
   epicsMutexLock(this->lock);
-  pListNode = (NDAttributeListNode *)ellFirst(&this->list);
-  while (pListNode) {
-    pAttribute = pListNode->pNDAttribute;
-    if (strcmp(pAttribute->pName, pName) == 0) goto done;
-    pListNode = (NDAttributeListNode *)ellNext(&pListNode->node);
-  }
-  pAttribute = NULL;
-
-  done:
+  pAttribute = *findLink(this->hashTable, this->hashSize, pName, hash);
   epicsMutexUnlock(this->lock);
   return(pAttribute);
 }
@@ -138,20 +250,24 @@ int NDAttributeList::count()
 }
 
 /** Removes an attribute from the list.
+  * The attribute is deleted, or put in the pool if it was created by this list.
   * \param[in] pName The name of the attribute to be deleted.
   * \return Returns ND_SUCCESS if the attribute was found and deleted, ND_ERROR if the
   * attribute was not found. */
 int NDAttributeList::remove(const char *pName)
 {
   NDAttribute *pAttribute;
+  NDAttribute **ppLink;
   int status = ND_ERROR;
   //const char *functionName = "NDAttributeList::remove";
 
   epicsMutexLock(this->lock);
-  pAttribute = this->find(pName);
+  ppLink = findLink(this->hashTable, this->hashSize, pName, epicsStrHash(pName, 0));
+  pAttribute = *ppLink;
   if (!pAttribute) goto done;
+  *ppLink = pAttribute->pHashNext;
   ellDelete(&this->list, &pAttribute->listNode.node);
-  delete pAttribute;
+  this->release(pAttribute);
   status = ND_SUCCESS;
 
   done:
@@ -159,7 +275,7 @@ int NDAttributeList::remove(const char *pName)
   return(status);
 }
 
-/** Deletes all attributes from the list. */
+/** Deletes all attributes from the list; attributes created by this list are put in the pool. */
 int NDAttributeList::clear()
 {
   NDAttribute *pAttribute;
@@ -171,9 +287,10 @@ int NDAttributeList::clear()
   while (pListNode) {
     pAttribute = pListNode->pNDAttribute;
     ellDelete(&this->list, &pListNode->node);
-    delete pAttribute;
+    this->release(pAttribute);
     pListNode = (NDAttributeListNode *)ellFirst(&this->list);
   }
+  memset(this->hashTable, 0, this->hashSize*sizeof(NDAttribute *));
   epicsMutexUnlock(this->lock);
   return(ND_SUCCESS);
 }
@@ -182,27 +299,56 @@ int NDAttributeList::clear()
   * It is efficient so that if the attribute already exists in the output
   * list it just copies the properties, and memory allocation is minimized.
   * The attributes are added to any existing attributes already present in the output list.
+  * If an attribute is not in the output list it is taken from the pool of the output list if
+  * possible, so copying into a list that has been cleared allocates no memory.
+  * Both lists are locked, always in order of address, so that copies in opposite directions
+  * between the same two lists cannot deadlock.
   * \param[out] pListOut A pointer to the output attribute list to copy to.
   */
 int NDAttributeList::copy(NDAttributeList *pListOut)
 {
   NDAttribute *pAttrIn, *pAttrOut, *pFound;
   NDAttributeListNode *pListNode;
+  NDAttributeList *pFirst, *pSecond;
+  void *pValue;
   //const char *functionName = "NDAttributeList::copy";
 
-  epicsMutexLock(this->lock);
+  if ((size_t)this < (size_t)pListOut) {
+    pFirst = this;
+    pSecond = pListOut;
+  } else {
+    pFirst = pListOut;
+    pSecond = this;
+  }
+  epicsMutexLock(pFirst->lock);
+  epicsMutexLock(pSecond->lock);
   pListNode = (NDAttributeListNode *)ellFirst(&this->list);
   while (pListNode) {
     pAttrIn = pListNode->pNDAttribute;
     /* See if there is already an attribute of this name in the output list */
-    pFound = pListOut->find(pAttrIn->pName);
+    pFound = *findLink(pListOut->hashTable, pListOut->hashSize, pAttrIn->pName, pAttrIn->nameHash);
+    if (!pFound) {
+      pFound = pListOut->takeFromPool(typeid(*pAttrIn), pAttrIn->pName, pAttrIn->nameHash, pAttrIn->dataType);
+      if (pFound) {
+        /* The pooled attribute still has the description and source of its last use */
+        if (pAttrIn->dataType == NDAttrUndefined) pValue = NULL;
+        else if (pAttrIn->dataType == NDAttrString) pValue = pAttrIn->pString ? pAttrIn->pString : (char *)"";
+        else pValue = &pAttrIn->value;
+        pFound->reset(pAttrIn->pDescription, pAttrIn->sourceType, pAttrIn->pSource, pAttrIn->dataType, pValue);
+        pListOut->insert(pFound);
+      }
+    }
     /* The copy function will copy the properties, and will create the attribute if pFound is NULL */
     pAttrOut = pAttrIn->copy(pFound);
     /* If pFound is NULL, then a copy created a new attribute, need to add it to the list */
-    if (!pFound) pListOut->add(pAttrOut);
+    if (!pFound) {
+      pAttrOut->poolable = 1;
+      pListOut->insert(pAttrOut);
+    }
     pListNode = (NDAttributeListNode *)ellNext(&pListNode->node);
   }
-  epicsMutexUnlock(this->lock);
+  epicsMutexUnlock(pSecond->lock);
+  epicsMutexUnlock(pFirst->lock);
   return(ND_SUCCESS);
 }
 
@@ -238,6 +384,8 @@ int NDAttributeList::report(FILE *fp, int details)
   fprintf(fp, "\n");
   fprintf(fp, "NDAttributeList: address=%p:\n", this);
   fprintf(fp, "  number of attributes=%d\n", this->count());
+  fprintf(fp, "  number of pooled attributes=%d\n", this->numPooled);
+  fprintf(fp, "  hash buckets=%d\n", this->hashSize);
   if (details > 10) {
     pListNode = (NDAttributeListNode *) ellFirst(&this->list);
     while (pListNode) {
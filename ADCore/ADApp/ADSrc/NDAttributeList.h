@@ -10,13 +10,23 @@
 #define NDAttributeList_H
 
 #include <stdio.h>
+#include <typeinfo>
+
 #include <ellLib.h>
 #include <epicsMutex.h>
  
 #include "NDAttribute.h"
 
 
+/** Initial number of buckets in the NDAttributeList hash index */
+#define ND_ATTR_LIST_HASH_SIZE 16
+
 /** NDAttributeList class; this is a linked list of attributes.
+  * A hash index on the attribute names makes find() independent of the length of the list.
+  * Attributes that the list created itself in copy() or add() are not deleted by remove()
+  * and clear() but kept in a pool, and reused the next time an attribute of the same name,
+  * class and data type is needed, so that copying attributes into the same list frame after
+  * frame does not allocate memory.
   */
 class epicsShareClass NDAttributeList {
 public:
@@ -35,8 +45,18 @@ public:
     int          report(FILE *fp, int details);
     
 private:
-    ELLLIST      list;   /**< The EPICS ELLLIST  */
-    epicsMutexId lock;  /**< Mutex to protect the ELLLIST */
+    static NDAttribute** findLink(NDAttribute **table, int hashSize, const char *pName, unsigned int hash);
+    void         insert(NDAttribute *pAttribute);
+    void         release(NDAttribute *pAttribute);
+    NDAttribute* takeFromPool(const std::type_info &type, const char *pName, unsigned int hash,
+                              NDAttrDataType_t dataType);
+    void         resize(int hashSize);
+    ELLLIST      list;          /**< The EPICS ELLLIST  */
+    NDAttribute  **hashTable;   /**< Hash index of the attributes in the list, chained with pHashNext */
+    NDAttribute  **poolTable;   /**< Hash index of the pooled attributes */
+    int          hashSize;      /**< Number of buckets in hashTable and poolTable; a power of 2 */
+    int          numPooled;     /**< Number of attributes in poolTable */
+    epicsMutexId lock;          /**< Mutex to protect the ELLLIST and the hash tables */
 };
 
 #endif
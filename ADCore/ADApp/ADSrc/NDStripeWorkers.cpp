@@ -0,0 +1,189 @@
+/*
+ * NDStripeWorkers.cpp
+ *
+ * Pool of threads that process the stripes of an array in parallel.
+ *
+ * Created November 2015
+ */
+
+#include <stdlib.h>
+
+#include <epicsThread.h>
+#include <epicsString.h>
+#include <epicsStdio.h>
+#include <epicsExport.h>
+
+#include "NDStripeWorkers.h"
+
+static const char *driverName="NDStripeWorkers";
+
+static void stripeTaskC(void *drvPvt)
+{
+    NDStripeWorkers *pWorkers = (NDStripeWorkers *)drvPvt;
+    pWorkers->stripeTask();
+}
+
+/** Constructor.
+  * \param[in] name Name of the owner, used to name the worker threads. */
+NDStripeWorkers::NDStripeWorkers(const char *name)
+    : numThreads_(0), numRunning_(0), exiting_(false), func_(NULL), pvt_(NULL),
+      numStripes_(0), nextStripe_(0), numDone_(0)
+{
+    name_ = epicsStrDup(name);
+    mutexId_     = epicsMutexCreate();
+    runMutexId_  = epicsMutexCreate();
+    workEventId_ = epicsEventCreate(epicsEventEmpty);
+    doneEventId_ = epicsEventCreate(epicsEventEmpty);
+    exitEventId_ = epicsEventCreate(epicsEventEmpty);
+}
+
+/** Returns the number of stripes to split an array into.
+  * \param[in] numThreads Number of threads requested, normally the ComputeThreads parameter.
+  * \param[in] work Amount of work in the array, normally its number of elements.
+  * \param[in] maxStripes Maximum number of stripes, for example the number of rows.
+  * \return Between 1 and maxStripes stripes, 1 if work is less than ND_STRIPE_MIN_ELEMENTS. */
+int NDStripeWorkers::numStripes(int numThreads, size_t work, size_t maxStripes)
+{
+    if (work < ND_STRIPE_MIN_ELEMENTS) return 1;
+    if ((size_t)numThreads > maxStripes) numThreads = (int)maxStripes;
+    if (numThreads < 1) numThreads = 1;
+    return numThreads;
+}
+
+NDStripeWorkers::~NDStripeWorkers()
+{
+    epicsMutexLock(mutexId_);
+    exiting_ = true;
+    epicsMutexUnlock(mutexId_);
+    epicsEventSignal(workEventId_);
+    while (true) {
+        epicsMutexLock(mutexId_);
+        int numRunning = numRunning_;
+        epicsMutexUnlock(mutexId_);
+        if (numRunning == 0) break;
+        epicsEventWait(exitEventId_);
+    }
+    epicsEventDestroy(exitEventId_);
+    epicsEventDestroy(doneEventId_);
+    epicsEventDestroy(workEventId_);
+    epicsMutexDestroy(runMutexId_);
+    epicsMutexDestroy(mutexId_);
+    free(name_);
+}
+
+/** Processes the stripes of an array and returns when they are all done.
+  * The calling thread processes stripes as well, so numStripes-1 worker threads are used.
+  * \param[in] numStripes Number of stripes.
+  * \param[in] func Function called once for each stripe, from any of the threads.
+  * \param[in] pvt Pointer passed to func. */
+void NDStripeWorkers::run(int numStripes, NDStripeFunc_t func, void *pvt)
+{
+    char taskName[64];
+    int stripe;
+    static const char *functionName = "run";
+
+    if (numStripes <= 1) {
+        if (numStripes == 1) func(pvt, 0);
+        return;
+    }
+    epicsMutexLock(runMutexId_);
+    while (numThreads_ < numStripes-1) {
+        epicsSnprintf(taskName, sizeof(taskName), "%s_stripe%d", name_, numThreads_);
+        if (epicsThreadCreate(taskName, epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackMedium),
+                              (EPICSTHREADFUNC)stripeTaskC, this) == NULL) {
+            printf("%s::%s ERROR creating thread %s\n", driverName, functionName, taskName);
+            break;
+        }
+        epicsMutexLock(mutexId_);
+        numThreads_++;
+        numRunning_++;
+        epicsMutexUnlock(mutexId_);
+    }
+
+    epicsMutexLock(mutexId_);
+    func_       = func;
+    pvt_        = pvt;
+    numStripes_ = numStripes;
+    nextStripe_ = 0;
+    numDone_    = 0;
+    epicsMutexUnlock(mutexId_);
+    if (numThreads_ > 0) epicsEventSignal(workEventId_);
+
+    while (takeStripe(&stripe)) {
+        func(pvt, stripe);
+        finishStripe();
+    }
+    epicsMutexLock(mutexId_);
+    while (numDone_ < numStripes_) {
+        epicsMutexUnlock(mutexId_);
+        epicsEventWait(doneEventId_);
+        epicsMutexLock(mutexId_);
+    }
+    epicsMutexUnlock(mutexId_);
+    epicsMutexUnlock(runMutexId_);
+}
+
+/** Takes the next stripe of the current run, if there is one left */
+bool NDStripeWorkers::takeStripe(int *stripe)
+{
+    bool more;
+
+    epicsMutexLock(mutexId_);
+    if (nextStripe_ >= numStripes_) {
+        epicsMutexUnlock(mutexId_);
+        return false;
+    }
+    *stripe = nextStripe_++;
+    more = (nextStripe_ < numStripes_);
+    epicsMutexUnlock(mutexId_);
+    // Wake another worker for the remaining stripes
+    if (more) epicsEventSignal(workEventId_);
+    return true;
+}
+
+void NDStripeWorkers::finishStripe()
+{
+    bool done;
+
+    epicsMutexLock(mutexId_);
+    numDone_++;
+    done = (numDone_ == numStripes_);
+    epicsMutexUnlock(mutexId_);
+    if (done) epicsEventSignal(doneEventId_);
+}
+
+/** Worker thread; processes stripes until the object is deleted */
+void NDStripeWorkers::stripeTask()
+{
+    NDStripeFunc_t func;
+    void *pvt;
+    int stripe;
+    bool more;
+
+    while (true) {
+        epicsMutexLock(mutexId_);
+        while (!exiting_ && (nextStripe_ >= numStripes_)) {
+            epicsMutexUnlock(mutexId_);
+            epicsEventWait(workEventId_);
+            epicsMutexLock(mutexId_);
+        }
+        if (exiting_) {
+            numRunning_--;
+            epicsMutexUnlock(mutexId_);
+            // Wake the next thread so that it exits as well
+            epicsEventSignal(workEventId_);
+            epicsEventSignal(exitEventId_);
+            return;
+        }
+        // Take the stripe together with the function, so that they belong to the same run
+        stripe = nextStripe_++;
+        more = (nextStripe_ < numStripes_);
+        func = func_;
+        pvt  = pvt_;
+        epicsMutexUnlock(mutexId_);
+        if (more) epicsEventSignal(workEventId_);
+        func(pvt, stripe);
+        finishStripe();
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef NDStripeWorkers_H
+#define NDStripeWorkers_H
+
+#include <stddef.h>
+
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <shareLib.h>
+
+/** Arrays with less work than this, in elements, are processed by the calling thread in a single stripe */
+#define ND_STRIPE_MIN_ELEMENTS 65536
+
+/** Function that processes one stripe of an array; pvt is the pointer passed to NDStripeWorkers::run */
+typedef void (*NDStripeFunc_t)(void *pvt, int stripe);
+
+/** Pool of threads that process the stripes of a single array in parallel.
+  * run() hands the stripes out to the worker threads and processes stripes itself until none are left,
+  * then waits for the workers to finish theirs.  The worker threads are created the first time they
+  * are needed and are kept until the object is deleted.
+  */
+class epicsShareClass NDStripeWorkers {
+public:
+    NDStripeWorkers(const char *name);
+    ~NDStripeWorkers();
+
+    void run(int numStripes, NDStripeFunc_t func, void *pvt);
+    static int numStripes(int numThreads, size_t work, size_t maxStripes);
+    void stripeTask();
+
+private:
+    bool takeStripe(int *stripe);
+    void finishStripe();
+
+    char *name_;
+    int numThreads_;            /**< Number of worker threads created */
+    int numRunning_;            /**< Number of worker threads that have not exited */
+    bool exiting_;
+    NDStripeFunc_t func_;
+    void *pvt_;
+    int numStripes_;            /**< Number of stripes in the current run */
+    int nextStripe_;            /**< Next stripe to hand out */
+    int numDone_;               /**< Number of stripes finished */
+    epicsMutexId mutexId_;      /**< Protects the state of the current run */
+    epicsMutexId runMutexId_;   /**< Allows only one run at a time */
+    epicsEventId workEventId_;
+    epicsEventId doneEventId_;
+    epicsEventId exitEventId_;
+};
+
+#endif
@@ -19,6 +19,7 @@
 #include <epicsString.h>
 #include <epicsMutex.h>
 #include <cantProceed.h>
+#include <iocsh.h>
 
 #include <asynDriver.h>
 
@@ -30,6 +31,7 @@
 #include "paramAttribute.h"
 #include "functAttribute.h"
 #include "asynNDArrayDriver.h"
+#include <epicsExport.h>
 
 #define MAX_PATH_PARTS 32
 
@@ -513,6 +515,60 @@ asynStatus asynNDArrayDriver::writeGenericPointer(asynUser *pasynUser, void *gen
     return status;
 }
 
+/** Called when asyn clients call pasynInt32->write().
+  * This function performs actions for the NDArrayPool parameters.
+  * For all parameters it sets the value in the parameter library and calls any registered callbacks.
+  * Derived classes call this method for parameters that belong to this class.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Value to write. */
+asynStatus asynNDArrayDriver::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int addr=0;
+    int function = pasynUser->reason;
+    asynStatus status = asynSuccess;
+    const char *functionName = "writeInt32";
+
+    status = getAddress(pasynUser, &addr); if (status != asynSuccess) return(status);
+    /* Set the parameter in the parameter library. */
+    status = (asynStatus)setIntegerParam(addr, function, value);
+
+    if (function == NDPoolSizeClasses) {
+        this->pNDArrayPool->setSizeClassMode(value);
+        setIntegerParam(addr, function, this->pNDArrayPool->sizeClassMode());
+    } else if (function == NDPoolPreAllocBuffers) {
+        int dataType;
+        int sizes[3];
+        size_t dims[3];
+        int ndims, i;
+        getIntegerParam(addr, NDArraySizeX, &sizes[0]);
+        getIntegerParam(addr, NDArraySizeY, &sizes[1]);
+        getIntegerParam(addr, NDArraySizeZ, &sizes[2]);
+        getIntegerParam(addr, NDDataType, &dataType);
+        if      (sizes[2] > 1) ndims = 3;
+        else if (sizes[1] > 1) ndims = 2;
+        else                   ndims = 1;
+        for (i=0; i<ndims; i++) dims[i] = sizes[i];
+        if ((value > 0) && (sizes[0] > 0))
+            status = preAllocatePool(value, ndims, dims, (NDDataType_t)dataType);
+    } else if (function == NDPoolEmptyFreeList) {
+        if (value) this->pNDArrayPool->emptyFreeList();
+        setIntegerParam(addr, function, 0);
+    }
+
+    /* Do callbacks so higher layers see any changes */
+    callParamCallbacks(addr, addr);
+
+    if (status)
+        epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                  "%s:%s: status=%d, function=%d, value=%d",
+                  driverName, functionName, status, function, value);
+    else
+        asynPrint(pasynUser, ASYN_TRACEIO_DRIVER,
+              "%s:%s: function=%d, value=%d\n",
+              driverName, functionName, function, value);
+    return status;
+}
+
 asynStatus asynNDArrayDriver::readInt32(asynUser *pasynUser, epicsInt32 *value)
 {
     int function = pasynUser->reason;
@@ -525,6 +581,12 @@ asynStatus asynNDArrayDriver::readInt32(asynUser *pasynUser, epicsInt32 *value)
         setIntegerParam(function, this->pNDArrayPool->numBuffers());
     } else if (function == NDPoolFreeBuffers) {
         setIntegerParam(function, this->pNDArrayPool->numFree());
+    } else if (function == NDPoolHits) {
+        setIntegerParam(function, this->pNDArrayPool->numHits());
+    } else if (function == NDPoolMisses) {
+        setIntegerParam(function, this->pNDArrayPool->numMisses());
+    } else if (function == NDPoolReallocs) {
+        setIntegerParam(function, this->pNDArrayPool->numReallocs());
     }
 
     // Call base class
@@ -551,6 +613,43 @@ asynStatus asynNDArrayDriver::readFloat64(asynUser *pasynUser, epicsFloat64 *val
 }
 
 
+/** Selects how the data buffers of the NDArrayPool for this driver are allocated.
+  * This must be called before any arrays have been allocated, normally before iocInit.
+  * \param[in] hugePageSize Size of the huge pages to map buffers with; 0 for normal pages,
+  *            otherwise 2 MB or 1 GB.
+  * \param[in] numaNode NUMA node that buffer memory is bound to; -1 to not bind the buffers.
+  * See NDArrayPool::setBacking() for details. */
+asynStatus asynNDArrayDriver::setPoolBacking(size_t hugePageSize, int numaNode)
+{
+    if (this->pNDArrayPool->setBacking(hugePageSize, numaNode) != ND_SUCCESS) return asynError;
+    return asynSuccess;
+}
+
+/** Allocates arrays in the NDArrayPool for this driver ahead of acquisition.
+  * \param[in] numArrays Number of arrays to allocate.
+  * \param[in] ndims Number of dimensions of the arrays.
+  * \param[in] dims Array of dimensions, whose size must be at least ndims.
+  * \param[in] dataType Data type of the arrays.
+  * See NDArrayPool::preAllocate() for details. */
+asynStatus asynNDArrayDriver::preAllocatePool(int numArrays, int ndims, size_t *dims, NDDataType_t dataType)
+{
+    int numAllocated;
+    static const char *functionName = "preAllocatePool";
+
+    numAllocated = this->pNDArrayPool->preAllocate(numArrays, ndims, dims, dataType);
+    setIntegerParam(NDPoolAllocBuffers, this->pNDArrayPool->numBuffers());
+    setIntegerParam(NDPoolFreeBuffers, this->pNDArrayPool->numFree());
+    setDoubleParam(NDPoolUsedMemory, this->pNDArrayPool->memorySize() / MEGABYTE_DBL);
+    callParamCallbacks();
+    if (numAllocated < numArrays) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s: only allocated %d of %d arrays, check maxBuffers and maxMemory\n",
+            driverName, functionName, numAllocated, numArrays);
+        return asynError;
+    }
+    return asynSuccess;
+}
+
 /** Report status of the driver.
   * This method calls the report function in the asynPortDriver base class. It then
   * calls the NDArrayPool::report() method if details >5.
@@ -649,6 +748,11 @@ asynNDArrayDriver::asynNDArrayDriver(const char *portName, int maxAddr, int numP
     createParam(NDFileLazyOpenString,         asynParamInt32,           &NDFileLazyOpen);
     createParam(NDFileCreateDirString,        asynParamInt32,           &NDFileCreateDir);
     createParam(NDFileTempSuffixString,       asynParamOctet,           &NDFileTempSuffix);
+    createParam(NDFileCaptureBudgetString,    asynParamFloat64,         &NDFileCaptureBudget);
+    createParam(NDFileCaptureSpillPathString, asynParamOctet,           &NDFileCaptureSpillPath);
+    createParam(NDFileCaptureMemoryString,    asynParamFloat64,         &NDFileCaptureMemory);
+    createParam(NDFileCaptureSpilledString,   asynParamFloat64,         &NDFileCaptureSpilled);
+    createParam(NDFileCaptureSpillRateString, asynParamFloat64,         &NDFileCaptureSpillRate);
     createParam(NDAttributesFileString,       asynParamOctet,           &NDAttributesFile);
     createParam(NDArrayDataString,            asynParamGenericPointer,  &NDArrayData);
     createParam(NDArrayCallbacksString,       asynParamInt32,           &NDArrayCallbacks);
@@ -657,6 +761,12 @@ asynNDArrayDriver::asynNDArrayDriver(const char *portName, int maxAddr, int numP
     createParam(NDPoolFreeBuffersString,      asynParamInt32,           &NDPoolFreeBuffers);
     createParam(NDPoolMaxMemoryString,        asynParamFloat64,         &NDPoolMaxMemory);
     createParam(NDPoolUsedMemoryString,       asynParamFloat64,         &NDPoolUsedMemory);
+    createParam(NDPoolSizeClassesString,      asynParamInt32,           &NDPoolSizeClasses);
+    createParam(NDPoolHitsString,             asynParamInt32,           &NDPoolHits);
+    createParam(NDPoolMissesString,           asynParamInt32,           &NDPoolMisses);
+    createParam(NDPoolReallocsString,         asynParamInt32,           &NDPoolReallocs);
+    createParam(NDPoolPreAllocBuffersString,  asynParamInt32,           &NDPoolPreAllocBuffers);
+    createParam(NDPoolEmptyFreeListString,    asynParamInt32,           &NDPoolEmptyFreeList);
 
     /* Here we set the values of read-only parameters and of read/write parameters that cannot
      * or should not get their values from the database.  Note that values set here will override
@@ -697,10 +807,21 @@ asynNDArrayDriver::asynNDArrayDriver(const char *portName, int maxAddr, int numP
     setIntegerParam(NDFileNumCaptured, 0);
     setIntegerParam(NDFileCreateDir, 0);
     setStringParam (NDFileTempSuffix, "");
+    setDoubleParam (NDFileCaptureBudget, 0.);
+    setStringParam (NDFileCaptureSpillPath, "");
+    setDoubleParam (NDFileCaptureMemory, 0.);
+    setDoubleParam (NDFileCaptureSpilled, 0.);
+    setDoubleParam (NDFileCaptureSpillRate, 0.);
 
     setIntegerParam(NDPoolMaxBuffers, this->pNDArrayPool->maxBuffers());
     setIntegerParam(NDPoolAllocBuffers, this->pNDArrayPool->numBuffers());
     setIntegerParam(NDPoolFreeBuffers, this->pNDArrayPool->numFree());
+    setIntegerParam(NDPoolSizeClasses, this->pNDArrayPool->sizeClassMode());
+    setIntegerParam(NDPoolHits, 0);
+    setIntegerParam(NDPoolMisses, 0);
+    setIntegerParam(NDPoolReallocs, 0);
+    setIntegerParam(NDPoolPreAllocBuffers, 0);
+    setIntegerParam(NDPoolEmptyFreeList, 0);
 
 }
 
@@ -712,3 +833,87 @@ asynNDArrayDriver::~asynNDArrayDriver()
     delete this->pAttributeList;
 }    
 
+
+/** Configuration command to select the NDArrayPool buffer backing of a driver or plugin */
+extern "C" int NDPoolConfigBacking(const char *portName, int hugePageSizeMB, int numaNode)
+{
+    asynNDArrayDriver *pDriver;
+    static const char *functionName = "NDPoolConfigBacking";
+
+    pDriver = dynamic_cast<asynNDArrayDriver *>((asynPortDriver *)findAsynPortDriver(portName));
+    if (!pDriver) {
+        printf("%s:%s: ERROR, %s is not an asynNDArrayDriver port\n",
+               driverName, functionName, portName);
+        return(asynError);
+    }
+    return(pDriver->setPoolBacking((size_t)hugePageSizeMB * 1024 * 1024, numaNode));
+}
+
+/** Configuration command to allocate arrays in the NDArrayPool of a driver or plugin before acquisition */
+extern "C" int NDPoolPreAllocate(const char *portName, int numArrays, int nx, int ny, int nz, int dataType)
+{
+    asynNDArrayDriver *pDriver;
+    size_t dims[3];
+    int ndims;
+    asynStatus status;
+    static const char *functionName = "NDPoolPreAllocate";
+
+    pDriver = dynamic_cast<asynNDArrayDriver *>((asynPortDriver *)findAsynPortDriver(portName));
+    if (!pDriver) {
+        printf("%s:%s: ERROR, %s is not an asynNDArrayDriver port\n",
+               driverName, functionName, portName);
+        return(asynError);
+    }
+    dims[0] = nx;
+    dims[1] = ny;
+    dims[2] = nz;
+    if      (nz > 1) ndims = 3;
+    else if (ny > 1) ndims = 2;
+    else             ndims = 1;
+    pDriver->lock();
+    status = pDriver->preAllocatePool(numArrays, ndims, dims, (NDDataType_t)dataType);
+    pDriver->unlock();
+    return(status);
+}
+
+/* EPICS iocsh shell commands */
+static const iocshArg backingArg0 = { "portName",iocshArgString};
+static const iocshArg backingArg1 = { "hugePageSizeMB (0, 2 or 1024)",iocshArgInt};
+static const iocshArg backingArg2 = { "numaNode (-1=any)",iocshArgInt};
+static const iocshArg * const backingArgs[] = {&backingArg0,
+                                               &backingArg1,
+                                               &backingArg2};
+static const iocshFuncDef backingFuncDef = {"NDPoolConfigBacking",3,backingArgs};
+static void backingCallFunc(const iocshArgBuf *args)
+{
+    NDPoolConfigBacking(args[0].sval, args[1].ival, args[2].ival);
+}
+
+static const iocshArg preAllocArg0 = { "portName",iocshArgString};
+static const iocshArg preAllocArg1 = { "numArrays",iocshArgInt};
+static const iocshArg preAllocArg2 = { "nx",iocshArgInt};
+static const iocshArg preAllocArg3 = { "ny",iocshArgInt};
+static const iocshArg preAllocArg4 = { "nz",iocshArgInt};
+static const iocshArg preAllocArg5 = { "dataType",iocshArgInt};
+static const iocshArg * const preAllocArgs[] = {&preAllocArg0,
+                                                &preAllocArg1,
+                                                &preAllocArg2,
+                                                &preAllocArg3,
+                                                &preAllocArg4,
+                                                &preAllocArg5};
+static const iocshFuncDef preAllocFuncDef = {"NDPoolPreAllocate",6,preAllocArgs};
+static void preAllocCallFunc(const iocshArgBuf *args)
+{
+    NDPoolPreAllocate(args[0].sval, args[1].ival, args[2].ival, args[3].ival,
+                      args[4].ival, args[5].ival);
+}
+
+extern "C" void asynNDArrayDriverRegister(void)
+{
+    iocshRegister(&backingFuncDef,backingCallFunc);
+    iocshRegister(&preAllocFuncDef,preAllocCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(asynNDArrayDriverRegister);
+}
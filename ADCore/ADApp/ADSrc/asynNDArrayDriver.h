@@ -77,6 +77,11 @@ typedef enum {
 #define NDFileLazyOpenString    "FILE_LAZY_OPEN"    /**< (asynInt32,    r/w) Don't open file until first frame arrives in Stream mode */
 #define NDFileCreateDirString   "CREATE_DIR"        /**< (asynInt32,    r/w) Create the target directory up to this depth */
 #define NDFileTempSuffixString  "FILE_TEMP_SUFFIX"  /**< (asynOctet,    r/w) Temporary filename suffix while writing data to file. The file will be renamed (suffix removed) upon closing the file. */
+#define NDFileCaptureBudgetString    "CAPTURE_MEMORY_BUDGET" /**< (asynFloat64, r/w) Memory for arrays in Capture mode in MB; 0=no limit */
+#define NDFileCaptureSpillPathString "CAPTURE_SPILL_PATH"    /**< (asynOctet,   r/w) Directory of the scratch file for arrays beyond the budget; empty=FilePath */
+#define NDFileCaptureMemoryString    "CAPTURE_MEMORY"        /**< (asynFloat64, r/o) MB of captured arrays held in memory */
+#define NDFileCaptureSpilledString   "CAPTURE_SPILLED"       /**< (asynFloat64, r/o) MB of captured arrays written to the scratch file */
+#define NDFileCaptureSpillRateString "CAPTURE_SPILL_RATE"    /**< (asynFloat64, r/o) Write rate to the scratch file in MB/s */
 
 #define NDAttributesFileString  "ND_ATTRIBUTES_FILE" /**< (asynOctet,    r/w) Attributes file name */
 
@@ -90,6 +95,12 @@ typedef enum {
 #define NDPoolFreeBuffersString     "POOL_FREE_BUFFERS"
 #define NDPoolMaxMemoryString       "POOL_MAX_MEMORY"
 #define NDPoolUsedMemoryString      "POOL_USED_MEMORY"
+#define NDPoolSizeClassesString     "POOL_SIZE_CLASSES" /**< (asynInt32,    r/w) Use size-class free lists in the NDArrayPool (0=No, 1=Yes) */
+#define NDPoolHitsString            "POOL_HITS"         /**< (asynInt32,    r/o) Size-class allocations satisfied by a free buffer */
+#define NDPoolMissesString          "POOL_MISSES"       /**< (asynInt32,    r/o) Size-class allocations that needed a new buffer */
+#define NDPoolReallocsString        "POOL_REALLOCS"     /**< (asynInt32,    r/o) Size-class allocations that reallocated a smaller buffer */
+#define NDPoolPreAllocBuffersString "POOL_PREALLOC_BUFFERS" /**< (asynInt32, r/w) Pre-allocate this many arrays of the current size and data type */
+#define NDPoolEmptyFreeListString   "POOL_EMPTY_FREELIST" /**< (asynInt32,    r/w) Free the free arrays of the NDArrayPool and their buffers */
 
 /** This is the class from which NDArray drivers are derived; implements the asynGenericPointer functions 
   * for NDArray objects. 
@@ -107,6 +118,7 @@ public:
                           size_t *nActual);
     virtual asynStatus readGenericPointer(asynUser *pasynUser, void *genericPointer);
     virtual asynStatus writeGenericPointer(asynUser *pasynUser, void *genericPointer);
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
     virtual asynStatus readInt32(asynUser *pasynUser, epicsInt32 *value);
     virtual asynStatus readFloat64(asynUser *pasynUser, epicsFloat64 *value);
     virtual void report(FILE *fp, int details);
@@ -118,6 +130,8 @@ public:
     virtual asynStatus createFileName(int maxChars, char *filePath, char *fileName);
     virtual asynStatus readNDAttributesFile(const char *fileName);
     virtual asynStatus getAttributes(NDAttributeList *pAttributeList);
+    asynStatus setPoolBacking(size_t hugePageSize, int numaNode);
+    asynStatus preAllocatePool(int numArrays, int ndims, size_t *dims, NDDataType_t dataType);
 
 protected:
     int NDPortNameSelf;
@@ -158,6 +172,11 @@ protected:
     int NDFileLazyOpen;
     int NDFileCreateDir;
     int NDFileTempSuffix;
+    int NDFileCaptureBudget;
+    int NDFileCaptureSpillPath;
+    int NDFileCaptureMemory;
+    int NDFileCaptureSpilled;
+    int NDFileCaptureSpillRate;
     int NDAttributesFile;
     int NDArrayData;
     int NDArrayCallbacks;
@@ -166,7 +185,13 @@ protected:
     int NDPoolFreeBuffers;
     int NDPoolMaxMemory;
     int NDPoolUsedMemory;
-    #define LAST_NDARRAY_PARAM NDPoolUsedMemory
+    int NDPoolSizeClasses;
+    int NDPoolHits;
+    int NDPoolMisses;
+    int NDPoolReallocs;
+    int NDPoolPreAllocBuffers;
+    int NDPoolEmptyFreeList;
+    #define LAST_NDARRAY_PARAM NDPoolEmptyFreeList
 
     NDArray **pArrays;             /**< An array of NDArray pointers used to store data in the driver */
     NDArrayPool *pNDArrayPool;     /**< An NDArrayPool object used to allocate and manipulate NDArray objects */
@@ -0,0 +1,219 @@
+/*
+ * NDArrayQueue.cpp
+ *
+ * Bounded queue of NDArray pointers between the driver callback and the plugin threads.
+ * The lock-free ring is based on the bounded multi-producer multi-consumer queue
+ * described by Dmitry Vyukov.
+ *
+ * Created November 2015
+ */
+
+#include <stdlib.h>
+
+#include <epicsVersion.h>
+#include <cantProceed.h>
+#include <epicsExport.h>
+
+/* epicsAtomic is available from EPICS base 3.15 onwards. With older versions the ring is
+ * protected by lock_ instead */
+#if (EPICS_VERSION > 3) || ((EPICS_VERSION == 3) && (EPICS_REVISION >= 15))
+  #define ND_ATOMIC_QUEUE
+  #include <epicsAtomic.h>
+#endif
+
+#include "NDArrayQueue.h"
+
+/** Constructor for NDArrayQueue.
+  * \param[in] capacity Maximum number of arrays that the queue can hold. */
+NDArrayQueue::NDArrayQueue(int capacity)
+  : capacity_(capacity), enqueuePos_(0), dequeuePos_(0), count_(0), highWater_(0),
+    numWaiting_(0), wakeups_(0)
+{
+  size_t size=1, i;
+
+  if (capacity_ < 1) capacity_ = 1;
+  while (size < (size_t)capacity_) size <<= 1;
+  mask_ = size - 1;
+  cells_ = (NDArrayQueueCell *)callocMustSucceed(size, sizeof(NDArrayQueueCell), "NDArrayQueue");
+  for (i=0; i<size; i++) cells_[i].sequence = i;
+  wakeEvent_ = epicsEventMustCreate(epicsEventEmpty);
+  lock_ = epicsMutexMustCreate();
+}
+
+NDArrayQueue::~NDArrayQueue()
+{
+  free(cells_);
+  epicsEventDestroy(wakeEvent_);
+  epicsMutexDestroy(lock_);
+}
+
+/** Adds an array to the queue without blocking.
+  * \param[in] pArray The array to add.
+  * \return 0 if the array was added, -1 if the queue is full. */
+int NDArrayQueue::trySend(NDArray *pArray)
+{
+  NDArrayQueueCell *pCell;
+  size_t pos;
+  int count;
+  int waiting;
+
+#ifdef ND_ATOMIC_QUEUE
+  /* Reserve room first.  This keeps the queue to capacity_ although the ring can be larger, and
+   * guarantees that the cell we claim below is free once its receiver has finished with it. */
+  count = epicsAtomicIncrIntT(&count_);
+  if (count > capacity_) {
+    epicsAtomicDecrIntT(&count_);
+    return -1;
+  }
+  pos = epicsAtomicGetSizeT(&enqueuePos_);
+  while (1) {
+    pCell = &cells_[pos & mask_];
+    if ((epicsAtomicGetSizeT(&pCell->sequence) == pos) &&
+        (epicsAtomicCmpAndSwapSizeT(&enqueuePos_, pos, pos+1) == pos)) break;
+    pos = epicsAtomicGetSizeT(&enqueuePos_);
+  }
+  pCell->pArray = pArray;
+  /* Publish the array to receivers.  This must be a full barrier, so that the store is ordered before
+   * the read of numWaiting_: a receiver increments numWaiting_ (also a full barrier) and then looks at
+   * the queue again, so either it sees this array or we see that it is waiting.  A write barrier would
+   * let the read of numWaiting_ move before the store, and the receiver could sleep through the array.
+   * epicsAtomic has no full fence, but its read-modify-write operations are full barriers, so the
+   * sequence, which nobody else can change now, is set with a compare and swap. */
+  epicsAtomicCmpAndSwapSizeT(&pCell->sequence, pos, pos+1);
+  waiting = epicsAtomicGetIntT(&numWaiting_);
+#else
+  epicsMutexLock(lock_);
+  if (count_ >= capacity_) {
+    epicsMutexUnlock(lock_);
+    return -1;
+  }
+  pCell = &cells_[enqueuePos_ & mask_];
+  pCell->pArray = pArray;
+  enqueuePos_++;
+  count = ++count_;
+  waiting = numWaiting_;
+  epicsMutexUnlock(lock_);
+#endif
+  if (count > highWater_) highWater_ = count;
+  /* Only pay for a wakeup when a receiver is actually waiting */
+  if (waiting > 0) {
+    wakeups_++;
+    epicsEventSignal(wakeEvent_);
+  }
+  return 0;
+}
+
+/** Removes an array from the queue without blocking.
+  * \return The array, or NULL if the queue is empty. */
+NDArray* NDArrayQueue::tryReceive()
+{
+  NDArrayQueueCell *pCell;
+  NDArray *pArray;
+  size_t pos;
+  ptrdiff_t diff;
+
+#ifdef ND_ATOMIC_QUEUE
+  pos = epicsAtomicGetSizeT(&dequeuePos_);
+  while (1) {
+    pCell = &cells_[pos & mask_];
+    diff = (ptrdiff_t)(epicsAtomicGetSizeT(&pCell->sequence) - (pos+1));
+    if (diff < 0) return NULL;
+    if ((diff == 0) && (epicsAtomicCmpAndSwapSizeT(&dequeuePos_, pos, pos+1) == pos)) break;
+    pos = epicsAtomicGetSizeT(&dequeuePos_);
+  }
+  epicsAtomicReadMemoryBarrier();
+  pArray = pCell->pArray;
+  /* Hand the cell back to the senders, one lap of the ring later */
+  epicsAtomicWriteMemoryBarrier();
+  epicsAtomicSetSizeT(&pCell->sequence, pos + mask_ + 1);
+  epicsAtomicDecrIntT(&count_);
+#else
+  epicsMutexLock(lock_);
+  if (count_ == 0) {
+    epicsMutexUnlock(lock_);
+    return NULL;
+  }
+  pos = dequeuePos_++;
+  count_--;
+  pArray = cells_[pos & mask_].pArray;
+  epicsMutexUnlock(lock_);
+  (void)pCell;
+  (void)diff;
+#endif
+  return pArray;
+}
+
+/** Removes an array from the queue, waiting until one is available.
+  * The queue is polled ND_QUEUE_SPIN_COUNT times before the calling thread waits to be woken up.
+  * \return The array. */
+NDArray* NDArrayQueue::receive()
+{
+  NDArray *pArray;
+  int i;
+
+  while (1) {
+    for (i=0; i<ND_QUEUE_SPIN_COUNT; i++) {
+      pArray = tryReceive();
+      if (pArray) return pArray;
+    }
+    /* Announce that we are waiting, then look again so an array sent in between is not missed */
+#ifdef ND_ATOMIC_QUEUE
+    epicsAtomicIncrIntT(&numWaiting_);
+#else
+    epicsMutexLock(lock_);
+    numWaiting_++;
+    epicsMutexUnlock(lock_);
+#endif
+    pArray = tryReceive();
+    if (!pArray) {
+      epicsEventMustWait(wakeEvent_);
+      pArray = tryReceive();
+    }
+#ifdef ND_ATOMIC_QUEUE
+    epicsAtomicDecrIntT(&numWaiting_);
+#else
+    epicsMutexLock(lock_);
+    numWaiting_--;
+    epicsMutexUnlock(lock_);
+#endif
+    if (pArray) {
+      /* The event does not count signals, so pass the wakeup on if arrays remain for other receivers */
+      if ((pending() > 0) && (numWaiting_ > 0)) epicsEventSignal(wakeEvent_);
+      return pArray;
+    }
+  }
+}
+
+/** Returns the maximum number of arrays that the queue can hold */
+int NDArrayQueue::capacity()
+{
+  return capacity_;
+}
+
+/** Returns the number of arrays in the queue */
+int NDArrayQueue::pending()
+{
+#ifdef ND_ATOMIC_QUEUE
+  return epicsAtomicGetIntT(&count_);
+#else
+  return count_;
+#endif
+}
+
+/** Returns the largest number of arrays that have been in the queue since resetHighWater() */
+int NDArrayQueue::highWater()
+{
+  return highWater_;
+}
+
+/** Resets the high-water mark to the current number of arrays in the queue */
+void NDArrayQueue::resetHighWater()
+{
+  highWater_ = pending();
+}
+
+/** Returns the number of times a waiting receiver has been woken up */
+int NDArrayQueue::wakeups()
+{
+  return wakeups_;
+}
@@ -0,0 +1,53 @@
+#ifndef NDArrayQueue_H
+#define NDArrayQueue_H
+
+#include <stddef.h>
+
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+
+#include "NDArray.h"
+
+/** Number of times receive() polls an empty queue before it waits to be woken up */
+#define ND_QUEUE_SPIN_COUNT 100
+
+/** Bounded queue of NDArray pointers that passes arrays from the driver callback to the
+  * processing threads of a plugin.
+  * With EPICS base 3.15 and later it is a lock-free ring that any number of threads can send to
+  * and receive from.  With earlier versions the ring is protected by a mutex.
+  * A receiver that finds the queue empty waits on an event, and senders only signal the event
+  * when a receiver is waiting, so a burst of arrays sent while the receivers are busy costs no
+  * wakeups at all. */
+class epicsShareClass NDArrayQueue {
+public:
+    NDArrayQueue(int capacity);
+    ~NDArrayQueue();
+    int      trySend(NDArray *pArray);
+    NDArray* receive();
+    NDArray* tryReceive();
+    int      capacity();
+    int      pending();
+    int      highWater();
+    void     resetHighWater();
+    int      wakeups();
+
+private:
+    /** One slot in the ring.  sequence tells senders and receivers whose turn it is to use it */
+    struct NDArrayQueueCell {
+        size_t sequence;
+        NDArray *pArray;
+    };
+    NDArrayQueueCell *cells_;   /**< The ring, whose size is capacity_ rounded up to a power of 2 */
+    size_t mask_;               /**< Size of the ring minus 1 */
+    int capacity_;              /**< Maximum number of arrays in the queue */
+    size_t enqueuePos_;         /**< Position the next array will be sent to */
+    size_t dequeuePos_;         /**< Position the next array will be received from */
+    int count_;                 /**< Number of arrays in the queue, including ones being sent */
+    int highWater_;             /**< Largest value of count_ since resetHighWater() */
+    int numWaiting_;            /**< Number of receivers waiting on wakeEvent_ */
+    int wakeups_;               /**< Number of times wakeEvent_ has been signalled */
+    epicsEventId wakeEvent_;    /**< Signalled when an array is sent while a receiver is waiting */
+    epicsMutexId lock_;         /**< Protects the ring when epicsAtomic is not available */
+};
+
+#endif
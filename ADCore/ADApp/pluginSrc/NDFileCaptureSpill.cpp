@@ -0,0 +1,195 @@
+/*
+ * NDFileCaptureSpill.cpp
+ *
+ * Scratch file for the arrays of an NDPluginFile capture that do not fit in the memory budget.
+ *
+ * Created November 2015
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#ifdef _MSC_VER
+/* _read and _write return int */
+typedef int ssize_t;
+#endif
+
+#include <epicsString.h>
+#include <epicsTime.h>
+
+#include "NDFileCaptureSpill.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* Alignment of the buffers, file offsets and transfer sizes for O_DIRECT.
+ * 4096 covers the logical block size of all current disks. */
+#define SPILL_ALIGNMENT 4096
+
+/* Largest transfer passed to one read() or write().  Windows takes the length as an unsigned int
+ * and Linux transfers at most 2 GB less a page per call, so larger records take several calls.
+ * It is a multiple of SPILL_ALIGNMENT, so every transfer stays aligned for O_DIRECT. */
+#define SPILL_MAX_TRANSFER ((size_t)1 << 30)
+
+static const char *driverName="NDFileCaptureSpill";
+
+/** Constructor.
+  * \param[in] pasynUser asynUser used for error messages.
+  * \param[in] arrayBytes Size of the data of each array. */
+NDFileCaptureSpill::NDFileCaptureSpill(asynUser *pasynUser, size_t arrayBytes)
+    : pasynUser_(pasynUser), arrayBytes_(arrayBytes), fd_(-1), direct_(false), fileName_(NULL),
+      numRecords_(0), numRead_(0), writeTime_(0.0)
+{
+    recordBytes_ = ((arrayBytes + SPILL_ALIGNMENT - 1) / SPILL_ALIGNMENT) * SPILL_ALIGNMENT;
+    if (recordBytes_ == 0) recordBytes_ = SPILL_ALIGNMENT;
+}
+
+NDFileCaptureSpill::~NDFileCaptureSpill()
+{
+    this->close();
+}
+
+/** Creates the scratch file, replacing any existing file of the same name.
+  * \param[in] fileName Full path of the scratch file. */
+asynStatus NDFileCaptureSpill::open(const char *fileName)
+{
+    int flags = O_RDWR | O_CREAT | O_TRUNC | O_BINARY;
+    static const char *functionName = "open";
+
+    this->close();
+#ifdef O_DIRECT
+    /* Not all file systems (e.g. tmpfs) support O_DIRECT, fall back to buffered I/O on those */
+    fd_ = ::open(fileName, flags | O_DIRECT, 0600);
+    direct_ = (fd_ >= 0);
+#endif
+    if (fd_ < 0) fd_ = ::open(fileName, flags, 0600);
+    if (fd_ < 0) {
+        asynPrint(pasynUser_, ASYN_TRACE_ERROR,
+            "%s::%s error creating %s: %s\n",
+            driverName, functionName, fileName, strerror(errno));
+        return asynError;
+    }
+    fileName_ = epicsStrDup(fileName);
+    numRecords_ = 0;
+    numRead_ = 0;
+    writeTime_ = 0.0;
+    asynPrint(pasynUser_, ASYN_TRACE_FLOW,
+        "%s::%s created %s, record size=%lu, direct I/O=%d\n",
+        driverName, functionName, fileName, (unsigned long)recordBytes_, direct_);
+    return asynSuccess;
+}
+
+/** Appends one array to the file.
+  * \param[in] pData The array data; a buffer of recordBytes() bytes allocated with allocBuffer. */
+asynStatus NDFileCaptureSpill::writeRecord(const void *pData)
+{
+    epicsTimeStamp tStart, tEnd;
+    size_t done = 0;
+    static const char *functionName = "writeRecord";
+
+    if (fd_ < 0) return asynError;
+    epicsTimeGetCurrent(&tStart);
+    while (done < recordBytes_) {
+        size_t length = recordBytes_ - done;
+        if (length > SPILL_MAX_TRANSFER) length = SPILL_MAX_TRANSFER;
+        ssize_t nWritten = ::write(fd_, (const char *)pData + done, length);
+        if (nWritten <= 0) {
+            if ((nWritten < 0) && (errno == EINTR)) continue;
+            asynPrint(pasynUser_, ASYN_TRACE_ERROR,
+                "%s::%s error writing record %d to %s: %s\n",
+                driverName, functionName, numRecords_, fileName_, strerror(errno));
+            return asynError;
+        }
+        done += (size_t)nWritten;
+    }
+    epicsTimeGetCurrent(&tEnd);
+    writeTime_ += epicsTimeDiffInSeconds(&tEnd, &tStart);
+    numRecords_++;
+    return asynSuccess;
+}
+
+/** Positions the file at the first record for reading. */
+asynStatus NDFileCaptureSpill::rewind()
+{
+    if (fd_ < 0) return asynError;
+    if (::lseek(fd_, 0, SEEK_SET) != 0) return asynError;
+    numRead_ = 0;
+    return asynSuccess;
+}
+
+/** Reads the next record from the file.
+  * \param[out] pData Buffer of recordBytes() bytes allocated with allocBuffer. */
+asynStatus NDFileCaptureSpill::readRecord(void *pData)
+{
+    size_t done = 0;
+    static const char *functionName = "readRecord";
+
+    if ((fd_ < 0) || (numRead_ >= numRecords_)) return asynError;
+    while (done < recordBytes_) {
+        size_t length = recordBytes_ - done;
+        if (length > SPILL_MAX_TRANSFER) length = SPILL_MAX_TRANSFER;
+        ssize_t nRead = ::read(fd_, (char *)pData + done, length);
+        if (nRead <= 0) {
+            if ((nRead < 0) && (errno == EINTR)) continue;
+            asynPrint(pasynUser_, ASYN_TRACE_ERROR,
+                "%s::%s error reading record %d from %s: %s\n",
+                driverName, functionName, numRead_, fileName_, strerror(errno));
+            return asynError;
+        }
+        done += (size_t)nRead;
+    }
+    numRead_++;
+    return asynSuccess;
+}
+
+/** Closes and deletes the scratch file. */
+void NDFileCaptureSpill::close()
+{
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    if (fileName_) {
+        remove(fileName_);
+        free(fileName_);
+        fileName_ = NULL;
+    }
+}
+
+/** Returns the rate in MB/s at which records have been written to the file. */
+double NDFileCaptureSpill::writeRate() const
+{
+    if (writeTime_ <= 0.0) return 0.0;
+    return (double)numRecords_ * recordBytes_ / (1024. * 1024.) / writeTime_;
+}
+
+/** Allocates a buffer that is aligned for O_DIRECT transfers.
+  * The buffer must be freed with freeBuffer.
+  * \param[in] size Size of the buffer in bytes. */
+void *NDFileCaptureSpill::allocBuffer(size_t size)
+{
+    char *pRaw = (char *)calloc(size + SPILL_ALIGNMENT + sizeof(void *), 1);
+    char *pBuffer;
+
+    if (!pRaw) return NULL;
+    pBuffer = pRaw + sizeof(void *);
+    pBuffer += (SPILL_ALIGNMENT - ((size_t)pBuffer % SPILL_ALIGNMENT)) % SPILL_ALIGNMENT;
+    ((void **)pBuffer)[-1] = pRaw;
+    return pBuffer;
+}
+
+/** Frees a buffer allocated with allocBuffer. */
+void NDFileCaptureSpill::freeBuffer(void *pBuffer)
+{
+    if (pBuffer) free(((void **)pBuffer)[-1]);
+}
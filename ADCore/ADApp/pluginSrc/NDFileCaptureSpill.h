@@ -0,0 +1,44 @@
+#ifndef NDFileCaptureSpill_H
+#define NDFileCaptureSpill_H
+
+#include <stddef.h>
+#include <asynDriver.h>
+
+/** Scratch file that holds the oldest arrays of an NDPluginFile capture when the capture buffer
+  * exceeds its memory budget.
+  * Arrays are written and read back sequentially as records of recordBytes() bytes.  Where the
+  * operating system and file system support it the file is opened with O_DIRECT, so the records
+  * bypass the page cache; the buffers passed to writeRecord and readRecord must then be allocated
+  * with allocBuffer. */
+class NDFileCaptureSpill {
+public:
+    NDFileCaptureSpill(asynUser *pasynUser, size_t arrayBytes);
+    ~NDFileCaptureSpill();
+
+    asynStatus open(const char *fileName);
+    asynStatus writeRecord(const void *pData);
+    asynStatus rewind();
+    asynStatus readRecord(void *pData);
+    void close();
+
+    size_t recordBytes() const { return recordBytes_; }
+    int numRecords() const { return numRecords_; }
+    bool isDirect() const { return direct_; }
+    double writeRate() const;
+
+    static void *allocBuffer(size_t size);
+    static void freeBuffer(void *pBuffer);
+
+private:
+    asynUser *pasynUser_;
+    size_t arrayBytes_;         /**< Size of the array data in each record */
+    size_t recordBytes_;        /**< arrayBytes_ rounded up to the O_DIRECT alignment */
+    int fd_;
+    bool direct_;
+    char *fileName_;
+    int numRecords_;            /**< Number of records written */
+    int numRead_;               /**< Number of records read since rewind */
+    double writeTime_;          /**< Seconds spent in write() */
+};
+
+#endif
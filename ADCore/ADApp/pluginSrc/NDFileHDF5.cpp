@@ -17,7 +17,6 @@
 #include <sstream>
 #include <hdf5.h>
 #include <sys/stat.h>
-// #include <hdf5_hl.h> // high level HDF5 API not currently used (requires use of library hdf5_hl)
 
 #include <epicsStdio.h>
 #include <epicsString.h>
@@ -35,7 +34,8 @@
 #define METADATA_NDIMS 1
 #define MAX_LAYOUT_LEN 1048576
 
-enum HDF5Compression_t {HDF5CompressNone=0, HDF5CompressNumBits, HDF5CompressSZip, HDF5CompressZlib};
+enum HDF5Compression_t {HDF5CompressNone=0, HDF5CompressNumBits, HDF5CompressSZip, HDF5CompressZlib,
+                        HDF5CompressLZ4, HDF5CompressBlosc};
 
 #define DIMSREPORTSIZE 512
 #define DIMNAMESIZE 40
@@ -49,6 +49,11 @@ enum HDF5Compression_t {HDF5CompressNone=0, HDF5CompressNumBits, HDF5CompressSZi
   #define MAX_ISTOREK 32767  /* HDF5 Binary Search tree max. */
 #endif
 
+/* Single writer/multiple reader access was added in HDF5 1.10 */
+#if H5_VERSION_GE(1,10,0)
+  #define NDFILEHDF5_HAVE_SWMR
+#endif
+
 static const char *driverName = "NDFileHDF5";
 
 
@@ -65,7 +70,7 @@ static const char *driverName = "NDFileHDF5";
  */
 asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode, NDArray *pArray)
 {
-  int storeAttributes, storePerformance;
+  int storeAttributes, storePerformance, swmrMode;
   static const char *functionName = "openFile";
   int numCapture;
   asynStatus status = asynSuccess;
@@ -77,6 +82,7 @@ asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode,
   getIntegerParam(NDFileNumCapture, &numCapture);
   getIntegerParam(NDFileHDF5_storeAttributes, &storeAttributes);
   getIntegerParam(NDFileHDF5_storePerformance, &storePerformance);
+  getIntegerParam(NDFileHDF5_SWMRMode, &swmrMode);
 
   // We don't support reading yet
   if (openMode & NDFileModeRead) {
@@ -122,6 +128,7 @@ asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode,
 
   epicsTimeGetCurrent(&this->prevts);
   this->opents = this->prevts;
+  this->lastFlush = this->prevts;
   NDArrayInfo_t info;
   pArray->getInfo(&info);
   this->frameSize = (8.0 * info.totalBytes)/(1024.0 * 1024.0);
@@ -181,6 +188,14 @@ asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode,
     return asynError;
   }
 
+  // Start the compression stage if the codec writes pre-compressed chunks
+  if (this->createCompressor()){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+              "%s::%s ERROR Failed to create the chunk compressor\n",
+              driverName, functionName);
+    return asynError;
+  }
+
   if (storeAttributes == 1){
     this->createAttributeDataset();
     this->writeAttributeDataset(hdf5::OnFileOpen);
@@ -204,6 +219,15 @@ asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode,
   hdf5::Root *root = this->layout.get_hdftree();
   this->createHardLinks(root);
 
+  // Readers can open the file once all of its objects exist
+  if (swmrMode && (openMode & NDFileModeMultiple)){
+    if (this->startSWMR()){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+                "%s::%s WARNING Could not start SWMR mode, readers must wait for the file to be closed\n",
+                driverName, functionName);
+    }
+  }
+
   return asynSuccess;
 }
 
@@ -1096,6 +1120,7 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
   herr_t hdfstatus = 0;
   asynStatus status = asynSuccess;
   int storeAttributes, storePerformance, flush;
+  double flushPeriod;
   epicsTimeStamp startts, endts;
   epicsInt32 numCaptured;
   double dt=0.0, period=0.0, runtime = 0.0;
@@ -1114,6 +1139,7 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
   getIntegerParam(NDFileHDF5_storeAttributes, &storeAttributes);
   getIntegerParam(NDFileHDF5_storePerformance, &storePerformance);
   getIntegerParam(NDFileHDF5_flushNthFrame, &flush);
+  getDoubleParam(NDFileHDF5_flushPeriod, &flushPeriod);
   getIntegerParam(NDFileHDF5_nExtraDims, &extradims);
   this->unlock();
 
@@ -1183,14 +1209,29 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
   epicsTimeGetCurrent(&startts);
 
   // For multi frame files we now extend the HDF dataset to fit an additional frame
-  if (this->multiFrameFile) this->detDataMap[destination]->extendDataSet(extradims);
-
-  status = this->detDataMap[destination]->writeFile(pArray, this->datatype, this->dataspace, this->framesize);
+  NDFileHDF5Dataset *pDataset = this->detDataMap[destination];
+  if (this->multiFrameFile) pDataset->extendDataSet(extradims);
+
+  if (this->pCompressor && pDataset->chunkIsFrame(this->framesize)){
+    // Frames that fill a chunk are compressed by the worker threads and written when ready
+    NDArrayInfo_t info;
+    pArray->getInfo(&info);
+    status = this->pCompressor->writeChunk(pArray, pDataset, info.totalBytes);
+    double ratio, compressTime;
+    this->pCompressor->getStatistics(&ratio, &compressTime);
+    this->lock();
+    setDoubleParam(NDFileHDF5_compressRatio, ratio);
+    setDoubleParam(NDFileHDF5_compressTime, compressTime);
+    this->unlock();
+  } else {
+    status = pDataset->writeFile(pArray, this->datatype, this->dataspace, this->framesize);
+  }
   if (status != asynSuccess){
     // If dataset creation fails then close file and abort as all following writes will fail as well
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
               "%s::%s ERROR: could not write to dataset. Aborting\n",
               driverName, functionName);
+    this->deleteCompressor();
     hdfstatus = H5Sclose(this->dataspace);
     if (hdfstatus){
       asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
@@ -1216,7 +1257,9 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
                 driverName, functionName);
     }
     this->file = 0;
+    this->swmrActive = false;
     this->lock();
+    setIntegerParam(NDFileHDF5_SWMRActive, 0);
     setIntegerParam(NDFileCapture, 0);
     setIntegerParam(NDWriteFile, 0);
     this->unlock();
@@ -1247,48 +1290,51 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
     this->performancePtr++;
   }
 
-  if (flush > 0){
-    if (numCaptured % flush == 0) {
-      asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, 
-        "%s::%s flushing metadata (%d)\n", 
-        driverName, functionName, numCaptured);
-      hdfstatus = H5Fflush( this->file, H5F_SCOPE_GLOBAL );
-      if (hdfstatus < 0) {
-        // If flushing fails then close file and abort as all following writes will fail as well
+  // Flush every flushNthFrame frames and when flushPeriod seconds have passed since the last flush
+  epicsTimeGetCurrent(&endts);
+  if (((flush > 0) && (numCaptured % flush == 0)) ||
+      ((flushPeriod > 0.0) && (epicsTimeDiffInSeconds(&endts, &this->lastFlush) >= flushPeriod))) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, 
+      "%s::%s flushing metadata (%d)\n", 
+      driverName, functionName, numCaptured);
+    if (this->flushFile()) {
+      // If flushing fails then close file and abort as all following writes will fail as well
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s ERROR: could not flush file. Aborting\n",
+                driverName, functionName);
+      this->deleteCompressor();
+      hdfstatus = H5Sclose(this->dataspace);
+      if (hdfstatus){
         asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                  "%s::%s ERROR: could not flush file. Aborting\n",
+                  "%s::%s ERROR: Dataspace did not close cleanly.\n",
+                  driverName, functionName);
+      }
+      hdfstatus = H5Pclose(this->cparms);
+      if (hdfstatus){
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                  "%s::%s ERROR: Cparms did not close cleanly.\n",
                   driverName, functionName);
-        hdfstatus = H5Sclose(this->dataspace);
-        if (hdfstatus){
-          asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                    "%s::%s ERROR: Dataspace did not close cleanly.\n",
-                    driverName, functionName);
-        }
-        hdfstatus = H5Pclose(this->cparms);
-        if (hdfstatus){
-          asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                    "%s::%s ERROR: Cparms did not close cleanly.\n",
-                    driverName, functionName);
-        }
-        hdfstatus = H5Tclose(this->datatype);
-        if (hdfstatus){
-          asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                    "%s::%s ERROR: Datatype did not close cleanly.\n",
-                    driverName, functionName);
-        }
-        hdfstatus = H5Fclose(this->file);
-        if (hdfstatus){
-          asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                    "%s::%s ERROR: File did not close cleanly.\n",
-                    driverName, functionName);
-        }
-        this->file = 0;
-        this->lock();
-        setIntegerParam(NDFileCapture, 0);
-        setIntegerParam(NDWriteFile, 0);
-        this->unlock();
-        return asynError;
       }
+      hdfstatus = H5Tclose(this->datatype);
+      if (hdfstatus){
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                  "%s::%s ERROR: Datatype did not close cleanly.\n",
+                  driverName, functionName);
+      }
+      hdfstatus = H5Fclose(this->file);
+      if (hdfstatus){
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                  "%s::%s ERROR: File did not close cleanly.\n",
+                  driverName, functionName);
+      }
+      this->file = 0;
+      this->swmrActive = false;
+      this->lock();
+      setIntegerParam(NDFileHDF5_SWMRActive, 0);
+      setIntegerParam(NDFileCapture, 0);
+      setIntegerParam(NDWriteFile, 0);
+      this->unlock();
+      return asynError;
     }
   }
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, 
@@ -1324,16 +1370,40 @@ asynStatus NDFileHDF5::closeFile()
     return asynSuccess;
   }
 
+  // Write the chunks that are still in the compression stage
+  if (this->pCompressor){
+    if (this->pCompressor->flush()){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+                "%s::%s ERROR writing compressed chunks\n", 
+                driverName, functionName);
+    }
+    double ratio, compressTime;
+    this->pCompressor->getStatistics(&ratio, &compressTime);
+    this->lock();
+    setDoubleParam(NDFileHDF5_compressRatio, ratio);
+    setDoubleParam(NDFileHDF5_compressTime, compressTime);
+    this->unlock();
+    this->deleteCompressor();
+  }
+
   this->lock();
   getIntegerParam(NDFileHDF5_storeAttributes, &storeAttributes);
   getIntegerParam(NDFileHDF5_storePerformance, &storePerformance);
   this->unlock();
+  // A SWMR writer cannot create objects, so the onClose HDF5 attributes and the performance
+  // dataset, which are created now, are left out of files written in SWMR mode
+  if (this->swmrActive && ((storeAttributes == 1) || (storePerformance == 1))){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+              "%s::%s file is in SWMR mode, not storing the onClose attributes and performance dataset\n",
+              driverName, functionName);
+  }
   if (storeAttributes == 1) {
+     this->flushAttributeDataset();
      this->writeAttributeDataset(hdf5::OnFileClose);
-     this->storeOnCloseAttributes();
+     if (!this->swmrActive) this->storeOnCloseAttributes();
      this->closeAttributeDataset();
   }
-  if (storePerformance == 1) this->writePerformanceDataset();
+  if ((storePerformance == 1) && !this->swmrActive) this->writePerformanceDataset();
 
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, 
             "%s::%s closing HDF cparms %d\n", 
@@ -1354,6 +1424,7 @@ asynStatus NDFileHDF5::closeFile()
   // Iterate over the stored detector data sets and close them
   std::map<std::string, NDFileHDF5Dataset *>::iterator it_dset;
   for (it_dset = this->detDataMap.begin(); it_dset != this->detDataMap.end(); ++it_dset){
+    it_dset->second->trimDataSet();
     H5Dclose(it_dset->second->getHandle());
   }
   std::map<std::string, hid_t>::iterator it_hid;
@@ -1385,6 +1456,10 @@ asynStatus NDFileHDF5::closeFile()
   // Close the HDF file
   H5Fclose(this->file);
   this->file = 0;
+  this->swmrActive = false;
+  this->lock();
+  setIntegerParam(NDFileHDF5_SWMRActive, 0);
+  this->unlock();
 
   // Unload the XML layout
   this->layout.unload_xml();
@@ -1499,7 +1574,10 @@ asynStatus NDFileHDF5::writeInt32(asynUser *pasynUser, epicsInt32 value)
       this->calcNumFrames();
     }
   } else if (function == NDFileHDF5_storeAttributes ||
-         function == NDFileHDF5_storePerformance) {
+         function == NDFileHDF5_storePerformance ||
+         function == NDFileHDF5_directChunkWrite ||
+         function == NDFileHDF5_bloscCompressor ||
+         function == NDFileHDF5_bloscShuffle) {
     if (this->file != 0) {
       status = asynError;
       setIntegerParam(function, oldvalue);
@@ -1526,6 +1604,18 @@ asynStatus NDFileHDF5::writeInt32(asynUser *pasynUser, epicsInt32 value)
       case HDF5CompressZlib:
         filterId = H5Z_FILTER_DEFLATE;
         break;
+      case HDF5CompressLZ4:
+      case HDF5CompressBlosc:
+        // These chunks are compressed by the plugin, so the HDF5 library needs no filter
+        filterId = H5Z_FILTER_NONE;
+        if (!NDFileHDF5Compressor::codecAvailable(value == HDF5CompressLZ4 ? NDFileHDF5CodecLZ4 : NDFileHDF5CodecBlosc)){
+          status = asynError;
+          setIntegerParam(function, oldvalue);
+          asynPrint (pasynUser, ASYN_TRACE_ERROR, 
+            "%s::%s ERROR: compression codec (%d) not built into the plugin\n",
+            driverName, functionName, value);
+        }
+        break;
       default:
         filterId = H5Z_FILTER_NONE;
         status = asynError;
@@ -1591,12 +1681,26 @@ asynStatus NDFileHDF5::writeInt32(asynUser *pasynUser, epicsInt32 value)
       status = asynError;
       setIntegerParam(function, oldvalue);
     }
-  } else if (function == NDFileHDF5_zCompressLevel) {
+  } else if (function == NDFileHDF5_zCompressLevel ||
+             function == NDFileHDF5_bloscCompressLevel) {
     if (this->file != 0 || value < 0 || value > 9)
     {
       status = asynError;
       setIntegerParam(function, oldvalue);
     }
+  } else if (function == NDFileHDF5_extendStep ||
+             function == NDFileHDF5_NDAttributeBatch) {
+    if (this->file != 0 || value < 1)
+    {
+      status = asynError;
+      setIntegerParam(function, oldvalue);
+    }
+  } else if (function == NDFileHDF5_numCompressThreads) {
+    if (this->file != 0 || value < 0 || value > 64)
+    {
+      status = asynError;
+      setIntegerParam(function, oldvalue);
+    }
   } else
   {
     if (function < FIRST_NDFILE_HDF5_PARAM)
@@ -1775,6 +1879,20 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   this->createParam(str_NDFileHDF5_layoutErrorMsg,  asynParamOctet,   &NDFileHDF5_layoutErrorMsg);
   this->createParam(str_NDFileHDF5_layoutValid,     asynParamInt32,   &NDFileHDF5_layoutValid);
   this->createParam(str_NDFileHDF5_layoutFilename,  asynParamOctet,   &NDFileHDF5_layoutFilename);
+  this->createParam(str_NDFileHDF5_directChunkWrite,asynParamInt32,   &NDFileHDF5_directChunkWrite);
+  this->createParam(str_NDFileHDF5_extendStep,      asynParamInt32,   &NDFileHDF5_extendStep);
+  this->createParam(str_NDFileHDF5_NDAttributeBatch,asynParamInt32,   &NDFileHDF5_NDAttributeBatch);
+  this->createParam(str_NDFileHDF5_sustainedFrameRate, asynParamFloat64, &NDFileHDF5_sustainedFrameRate);
+  this->createParam(str_NDFileHDF5_sustainedDataRate, asynParamFloat64, &NDFileHDF5_sustainedDataRate);
+  this->createParam(str_NDFileHDF5_numCompressThreads, asynParamInt32, &NDFileHDF5_numCompressThreads);
+  this->createParam(str_NDFileHDF5_bloscCompressor, asynParamInt32,   &NDFileHDF5_bloscCompressor);
+  this->createParam(str_NDFileHDF5_bloscShuffle,    asynParamInt32,   &NDFileHDF5_bloscShuffle);
+  this->createParam(str_NDFileHDF5_bloscCompressLevel, asynParamInt32, &NDFileHDF5_bloscCompressLevel);
+  this->createParam(str_NDFileHDF5_compressRatio,   asynParamFloat64, &NDFileHDF5_compressRatio);
+  this->createParam(str_NDFileHDF5_compressTime,    asynParamFloat64, &NDFileHDF5_compressTime);
+  this->createParam(str_NDFileHDF5_SWMRMode,        asynParamInt32,   &NDFileHDF5_SWMRMode);
+  this->createParam(str_NDFileHDF5_SWMRActive,      asynParamInt32,   &NDFileHDF5_SWMRActive);
+  this->createParam(str_NDFileHDF5_flushPeriod,     asynParamFloat64, &NDFileHDF5_flushPeriod);
 
   setIntegerParam(NDFileHDF5_nRowChunks,      0);
   setIntegerParam(NDFileHDF5_nColChunks,      0);
@@ -1801,6 +1919,20 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   setStringParam (NDFileHDF5_layoutErrorMsg,  "");
   setIntegerParam(NDFileHDF5_layoutValid,     1);
   setStringParam (NDFileHDF5_layoutFilename,  "");
+  setIntegerParam(NDFileHDF5_directChunkWrite,0);
+  setIntegerParam(NDFileHDF5_extendStep,      1);
+  setIntegerParam(NDFileHDF5_NDAttributeBatch,1);
+  setDoubleParam (NDFileHDF5_sustainedFrameRate, 0.0);
+  setDoubleParam (NDFileHDF5_sustainedDataRate,  0.0);
+  setIntegerParam(NDFileHDF5_numCompressThreads, 0);
+  setIntegerParam(NDFileHDF5_bloscCompressor, 0);
+  setIntegerParam(NDFileHDF5_bloscShuffle,    NDFileHDF5ShuffleByte);
+  setIntegerParam(NDFileHDF5_bloscCompressLevel, 5);
+  setDoubleParam (NDFileHDF5_compressRatio,   0.0);
+  setDoubleParam (NDFileHDF5_compressTime,    0.0);
+  setIntegerParam(NDFileHDF5_SWMRMode,        0);
+  setIntegerParam(NDFileHDF5_SWMRActive,      0);
+  setDoubleParam (NDFileHDF5_flushPeriod,     0.0);
 
 
   /* Give the virtual dimensions some human readable names */
@@ -1837,11 +1969,13 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   this->virtualdims  = NULL;
   this->rank         = 0;
   this->file         = 0;
+  this->swmrActive   = false;
   this->ptrFillValue = (void*)calloc(8, sizeof(char));
   this->dimsreport   = (char*)calloc(DIMSREPORTSIZE, sizeof(char));
   this->performanceBuf       = NULL;
   this->performancePtr       = NULL;
   this->numPerformancePoints = 0;
+  this->pCompressor          = NULL;
 
   this->hostname = (char*)calloc(MAXHOSTNAMELEN, sizeof(char));
   gethostname(this->hostname, MAXHOSTNAMELEN);
@@ -1999,7 +2133,11 @@ asynStatus NDFileHDF5::writePerformanceDataset()
 {
   hsize_t dims[2];
   hid_t dataspace_id, dataset_id, group_performance;
+  hid_t attr_dataspace_id, attr_id;
   epicsInt32 numCaptured;
+  double runtime, rates[2] = {0.0, 0.0};
+  const char *rateNames[2] = {"sustained_frames_per_second", "sustained_MB_per_second"};
+  int i;
 
   hdf5::Root *root = this->layout.get_hdftree();
   if (root){
@@ -2059,6 +2197,32 @@ asynStatus NDFileHDF5::writePerformanceDataset()
              H5S_ALL, H5S_ALL,
              H5P_DEFAULT, this->performanceBuf);
 
+    /* The sustained rates are calculated from the runtime of the last recorded frame,
+     * which is the time from the start of the first frame to the end of the last one. */
+    if (dims[0] > 0) {
+      runtime = this->performanceBuf[5*(dims[0]-1) + 2];
+      if (runtime > 0.0) {
+        rates[0] = dims[0] / runtime;
+        rates[1] = dims[0] * this->frameSize / 8.0 / runtime;
+      }
+    }
+    attr_dataspace_id = H5Screate(H5S_SCALAR);
+    for (i=0; i<2; i++) {
+      attr_id = H5Acreate2(dataset_id, rateNames[i], H5T_NATIVE_DOUBLE, attr_dataspace_id,
+                           H5P_DEFAULT, H5P_DEFAULT);
+      if (attr_id < 0) continue;
+      H5Awrite(attr_id, H5T_NATIVE_DOUBLE, &rates[i]);
+      H5Aclose(attr_id);
+    }
+    H5Sclose(attr_dataspace_id);
+    this->lock();
+    setDoubleParam(NDFileHDF5_sustainedFrameRate, rates[0]);
+    setDoubleParam(NDFileHDF5_sustainedDataRate, rates[1]);
+    this->unlock();
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+              "%s::writePerformanceDataset sustained %.1f frames/s %.2f MB/s\n",
+              driverName, rates[0], rates[1]);
+
     /* Close the data space for the second dataset. */
     H5Sclose(dataspace_id);
 
@@ -2085,6 +2249,7 @@ asynStatus NDFileHDF5::createAttributeDataset()
   NDAttrSource_t ndAttrSourceType;
   int extraDims;
   int chunking = 0;
+  int batchSize = 1;
   int fileWriteMode = 0;
   hsize_t maxdims[2] = {H5S_UNLIMITED, H5S_UNLIMITED};
   hid_t groupDefault = -1;
@@ -2096,6 +2261,8 @@ asynStatus NDFileHDF5::createAttributeDataset()
 
   this->lock();
   getIntegerParam(NDFileHDF5_nExtraDims, &extraDims);
+  getIntegerParam(NDFileHDF5_NDAttributeBatch, &batchSize);
+  if (batchSize < 1) batchSize = 1;
   // Check the chunking value
   getIntegerParam(NDFileHDF5_NDAttributeChunk, &chunking);
   // If the chunking is zero then use the number of frames
@@ -2173,6 +2340,13 @@ asynStatus NDFileHDF5::createAttributeDataset()
     }
     H5Pset_fill_value (hdfAttrNode->hdfcparm, hdfAttrNode->hdfdatatype, this->ptrFillValue );
 
+    // OnFrame values are collected in batchBuf and written batchSize at a time
+    hdfAttrNode->batchBuf     = NULL;
+    hdfAttrNode->batchCount   = 0;
+    hdfAttrNode->batchSize    = batchSize;
+    hdfAttrNode->elementBytes = H5Tget_size(hdfAttrNode->hdfdatatype);
+    if (hdfAttrNode->hdfrank == 2) hdfAttrNode->elementBytes *= MAX_ATTRIBUTE_STRING_SIZE;
+
     H5Pset_chunk(hdfAttrNode->hdfcparm, hdfAttrNode->hdfrank, hdfAttrNode->chunk);
 
     hdf5::Dataset *dset = NULL;
@@ -2304,6 +2478,19 @@ asynStatus NDFileHDF5::writeAttributeDataset(hdf5::When_t whenToSave)
         driverName, functionName, ndAttr->getName());
       memset(pDatavalue, 0, MAX_ATTRIBUTE_STRING_SIZE);
     }
+    // Collect the value and only go to the HDF5 library when the batch is full
+    if (hdfAttrNode->batchSize > 1 && whenToSave == hdf5::OnFrame) {
+      if (hdfAttrNode->batchBuf == NULL) {
+        hdfAttrNode->batchBuf = (char *)malloc(hdfAttrNode->batchSize * hdfAttrNode->elementBytes);
+      }
+      memcpy(hdfAttrNode->batchBuf + hdfAttrNode->batchCount * hdfAttrNode->elementBytes,
+             pDatavalue, hdfAttrNode->elementBytes);
+      hdfAttrNode->batchCount++;
+      if (hdfAttrNode->batchCount >= hdfAttrNode->batchSize) {
+        if (this->writeAttributeBatch(hdfAttrNode)) status = asynError;
+      }
+      continue;
+    }
     // Work with HDF5 library to select a suitable hyperslab (one element) and write the new data to it
     H5Dset_extent(hdfAttrNode->hdfdataset, hdfAttrNode->hdfdims);
     hdfAttrNode->hdffilespace = H5Dget_space(hdfAttrNode->hdfdataset);
@@ -2323,6 +2510,60 @@ asynStatus NDFileHDF5::writeAttributeDataset(hdf5::When_t whenToSave)
   return status;
 }
 
+/** Write the values collected in the batch buffer of an attribute dataset
+ *  with a single hyperslab write.
+ */
+asynStatus NDFileHDF5::writeAttributeBatch(HDFAttributeNode *hdfAttrNode)
+{
+  hsize_t dims[2];
+  hsize_t count[2];
+  hid_t memspace;
+  herr_t hdfstatus;
+  static const char *functionName = "writeAttributeBatch";
+
+  if (hdfAttrNode->batchCount == 0) return asynSuccess;
+
+  dims[0]  = hdfAttrNode->offset[0] + hdfAttrNode->batchCount;
+  dims[1]  = hdfAttrNode->hdfdims[1];
+  count[0] = hdfAttrNode->batchCount;
+  count[1] = hdfAttrNode->elementSize[1];
+
+  H5Dset_extent(hdfAttrNode->hdfdataset, dims);
+  hdfAttrNode->hdffilespace = H5Dget_space(hdfAttrNode->hdfdataset);
+  H5Sselect_hyperslab(hdfAttrNode->hdffilespace, H5S_SELECT_SET,
+                      hdfAttrNode->offset, NULL, count, NULL);
+  memspace = H5Screate_simple(hdfAttrNode->hdfrank, count, NULL);
+  hdfstatus = H5Dwrite(hdfAttrNode->hdfdataset, hdfAttrNode->hdfdatatype,
+                       memspace, hdfAttrNode->hdffilespace,
+                       H5P_DEFAULT, hdfAttrNode->batchBuf);
+  H5Sclose(memspace);
+  H5Sclose(hdfAttrNode->hdffilespace);
+
+  hdfAttrNode->offset[0] += hdfAttrNode->batchCount;
+  hdfAttrNode->hdfdims[0] = hdfAttrNode->offset[0] + 1;
+  hdfAttrNode->batchCount = 0;
+
+  if (hdfstatus < 0) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s ERROR writing batch of NDAttribute '%s'\n",
+              driverName, functionName, hdfAttrNode->attrName);
+    return asynError;
+  }
+  return asynSuccess;
+}
+
+/** Write out the values of all attribute datasets that are waiting in batch buffers
+ */
+asynStatus NDFileHDF5::flushAttributeDataset()
+{
+  asynStatus status = asynSuccess;
+
+  for (std::list<HDFAttributeNode *>::iterator it_node = attrList.begin(); it_node != attrList.end(); ++it_node){
+    if (this->writeAttributeBatch(*it_node)) status = asynError;
+  }
+  return status;
+}
+
 /** Close all attribute datasets and clear out memory
  */
 asynStatus NDFileHDF5::closeAttributeDataset()
@@ -2340,6 +2581,7 @@ asynStatus NDFileHDF5::closeAttributeDataset()
     H5Sclose(hdfAttrNode->hdfmemspace);
     H5Sclose(hdfAttrNode->hdfdataspace);
     H5Pclose(hdfAttrNode->hdfcparm);
+    free(hdfAttrNode->batchBuf);
     free(hdfAttrNode->attrName);
     free(hdfAttrNode);
   }
@@ -2407,12 +2649,16 @@ asynStatus NDFileHDF5::configureDatasetDims(NDArray *pArray)
   getIntegerParam(NDFileHDF5_nFramesChunks, &user_chunking[2]);
   getIntegerParam(NDFileHDF5_nRowChunks,    &user_chunking[1]);
   getIntegerParam(NDFileHDF5_nColChunks,    &user_chunking[0]);
+  int directChunk = 0, extendStep = 1;
+  getIntegerParam(NDFileHDF5_directChunkWrite, &directChunk);
+  getIntegerParam(NDFileHDF5_extendStep,       &extendStep);
   this->unlock();
 
   // Iterate over the stored detector data sets and configure the dimensions
   std::map<std::string, NDFileHDF5Dataset *>::iterator it_dset;
   for (it_dset = this->detDataMap.begin(); it_dset != this->detDataMap.end(); ++it_dset){
     it_dset->second->configureDims(pArray, this->multiFrameFile, extradims, numCapture, user_chunking);
+    it_dset->second->setWritePolicy(directChunk != 0, extendStep);
   }
   
   if (numCapture != NULL) free( numCapture );
@@ -2624,10 +2870,110 @@ asynStatus NDFileHDF5::configureCompression()
                 driverName, functionName, zLevel);
       H5Pset_deflate(this->cparms, zLevel);
       break;
+    case HDF5CompressLZ4:
+    case HDF5CompressBlosc:
+      {
+        NDFileHDF5CodecConfig_t config;
+        size_t chunkBytes = this->bytesPerElement;
+        for (int i=0; i<this->rank; i++) chunkBytes *= (size_t)this->chunkdims[i];
+        this->getCodecConfig(&config);
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, 
+                  "%s::%s Setting %s compression filter level=%d\n",
+                  driverName, functionName, (config.codec == NDFileHDF5CodecLZ4) ? "LZ4" : "Blosc", config.level);
+        if (NDFileHDF5Compressor::setFilter(this->cparms, config, chunkBytes)){
+          asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+                    "%s::%s ERROR Unable to set the compression filter\n",
+                    driverName, functionName);
+          status = asynError;
+        }
+      }
+      break;
   }
   return status;
 }
 
+/** Get the codec settings for the compression stage.
+ * Returns false if the compression type does not use the compression stage.
+ * \param[out] pConfig - The codec settings.
+ */
+bool NDFileHDF5::getCodecConfig(NDFileHDF5CodecConfig_t *pConfig)
+{
+  int compressionScheme, numThreads;
+
+  this->lock();
+  getIntegerParam(NDFileHDF5_compressionType, &compressionScheme);
+  getIntegerParam(NDFileHDF5_numCompressThreads, &numThreads);
+  getIntegerParam(NDFileHDF5_bloscCompressor, &pConfig->bloscCompressor);
+  getIntegerParam(NDFileHDF5_bloscShuffle, &pConfig->bloscShuffle);
+  if (compressionScheme == HDF5CompressBlosc){
+    getIntegerParam(NDFileHDF5_bloscCompressLevel, &pConfig->level);
+  } else {
+    getIntegerParam(NDFileHDF5_zCompressLevel, &pConfig->level);
+  }
+  this->unlock();
+  pConfig->typeSize = this->bytesPerElement;
+
+  switch (compressionScheme)
+  {
+    case HDF5CompressZlib:
+      // zlib chunks are only compressed by the plugin when there are threads to do it,
+      // otherwise the HDF5 deflate filter is used
+      pConfig->codec = NDFileHDF5CodecZlib;
+      return (numThreads > 0);
+    case HDF5CompressLZ4:
+      pConfig->codec = NDFileHDF5CodecLZ4;
+      return true;
+    case HDF5CompressBlosc:
+      pConfig->codec = NDFileHDF5CodecBlosc;
+      return true;
+    default:
+      return false;
+  }
+}
+
+/** Create the compression stage for a new file, if the compression type uses it.
+ * Frames are only passed through the stage when a chunk holds exactly one frame;
+ * other chunk layouts are written through the HDF5 filter pipeline.
+ */
+asynStatus NDFileHDF5::createCompressor()
+{
+  NDFileHDF5CodecConfig_t config;
+  int numThreads;
+  static const char * functionName = "createCompressor";
+
+  this->deleteCompressor();
+  this->lock();
+  setDoubleParam(NDFileHDF5_compressRatio, 0.0);
+  setDoubleParam(NDFileHDF5_compressTime, 0.0);
+  getIntegerParam(NDFileHDF5_numCompressThreads, &numThreads);
+  this->unlock();
+  if (!this->getCodecConfig(&config)) return asynSuccess;
+
+  for (int i=0; i<this->rank; i++){
+    if (this->chunkdims[i] != this->framesize[i]){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING, 
+                "%s::%s WARNING chunks do not hold one frame, frames are written through the HDF5 filters\n",
+                driverName, functionName);
+      break;
+    }
+  }
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, 
+            "%s::%s codec=%d threads=%d\n",
+            driverName, functionName, (int)config.codec, numThreads);
+  this->pCompressor = new NDFileHDF5Compressor(this->pasynUserSelf, config, numThreads);
+  return asynSuccess;
+}
+
+/** Stop the compression stage without writing the chunks that are still in it.
+ */
+void NDFileHDF5::deleteCompressor()
+{
+  if (this->pCompressor){
+    delete this->pCompressor;
+    this->pCompressor = NULL;
+  }
+}
+
 /** Translate the NDArray datatype to HDF5 datatypes 
  */
 hid_t NDFileHDF5::typeNd2Hdf(NDDataType_t datatype)
@@ -2861,11 +3207,15 @@ asynStatus NDFileHDF5::createNewFile(const char *fileName)
   herr_t hdfstatus;
   int tempAlign = 0;
   int tempThreshold = 0;
+  int swmrMode = 0;
   static const char *functionName = "createNewFile";
 
   this->lock();
   getIntegerParam(NDFileHDF5_chunkBoundaryAlign, &tempAlign);
   getIntegerParam(NDFileHDF5_chunkBoundaryThreshold, (int*)&tempThreshold);
+  getIntegerParam(NDFileHDF5_SWMRMode, &swmrMode);
+  this->swmrActive = false;
+  setIntegerParam(NDFileHDF5_SWMRActive, 0);
   this->unlock();
 
   /* File access property list: set the alignment boundary to a user defined block size
@@ -2894,6 +3244,13 @@ asynStatus NDFileHDF5::createNewFile(const char *fileName)
     }
   }
 
+  /* SWMR access needs the file format of HDF5 1.10 or later */
+  if (swmrMode && this->multiFrameFile){
+#ifdef NDFILEHDF5_HAVE_SWMR
+    H5Pset_libver_bounds(access_plist, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST);
+#endif
+  }
+
   /* File creation property list: set the i-storek according to HDF group recommendations */
   H5Pset_fclose_degree(access_plist, H5F_CLOSE_STRONG);
   hid_t create_plist = H5Pcreate(H5P_FILE_CREATE);
@@ -2936,6 +3293,74 @@ asynStatus NDFileHDF5::createNewFile(const char *fileName)
   return asynSuccess;
 }
 
+/** Switch the file to single writer/multiple reader (SWMR) access.
+ * Must be called once all groups, datasets and attributes have been created; from then on
+ * readers can open the file with H5F_ACC_SWMR_READ and see the frames written up to the last flush.
+ * No objects can be created after this, so closeFile() does not store the onClose attributes or the
+ * performance dataset.
+ */
+asynStatus NDFileHDF5::startSWMR()
+{
+  static const char *functionName = "startSWMR";
+
+#ifdef NDFILEHDF5_HAVE_SWMR
+  if (H5Fstart_swmr_write(this->file) < 0){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s ERROR Unable to start SWMR write mode\n",
+              driverName, functionName);
+    return asynError;
+  }
+  this->swmrActive = true;
+  this->lock();
+  setIntegerParam(NDFileHDF5_SWMRActive, 1);
+  callParamCallbacks();
+  this->unlock();
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s::%s file is now in SWMR write mode\n",
+            driverName, functionName);
+  return asynSuccess;
+#else
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s ERROR SWMR mode needs HDF5 1.10 or later\n",
+            driverName, functionName);
+  return asynError;
+#endif
+}
+
+/** Make the frames and attributes written so far visible in the file.
+ * In SWMR mode only the datasets are flushed, so that readers see their new extent; the detector
+ * datasets are first trimmed to the frames written, in case they were extended in steps.
+ */
+asynStatus NDFileHDF5::flushFile()
+{
+  asynStatus status = asynSuccess;
+  static const char *functionName = "flushFile";
+
+  if (this->flushAttributeDataset()) status = asynError;
+  if (this->pCompressor && this->pCompressor->flush()) status = asynError;
+  if (this->swmrActive){
+#ifdef NDFILEHDF5_HAVE_SWMR
+    std::map<std::string, NDFileHDF5Dataset *>::iterator it_dset;
+    for (it_dset = this->detDataMap.begin(); it_dset != this->detDataMap.end(); ++it_dset){
+      if (it_dset->second->trimDataSet()) status = asynError;
+      if (H5Dflush(it_dset->second->getHandle()) < 0) status = asynError;
+    }
+    for (std::list<HDFAttributeNode *>::iterator it_node = attrList.begin(); it_node != attrList.end(); ++it_node){
+      if (H5Dflush((*it_node)->hdfdataset) < 0) status = asynError;
+    }
+#endif
+  } else {
+    if (H5Fflush(this->file, H5F_SCOPE_GLOBAL) < 0) status = asynError;
+  }
+  epicsTimeGetCurrent(&this->lastFlush);
+  if (status != asynSuccess){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s ERROR flushing the file\n",
+              driverName, functionName);
+  }
+  return status;
+}
+
 /** Create the output file layout as specified by the XML layout.
  */
 asynStatus NDFileHDF5::createFileLayout(NDArray *pArray)
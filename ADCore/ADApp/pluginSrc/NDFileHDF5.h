@@ -13,6 +13,7 @@
 #include "NDFileHDF5Layout.h"
 #include "NDFileHDF5Dataset.h"
 #include "NDFileHDF5LayoutXML.h"
+#include "NDFileHDF5Compressor.h"
 
 #define str_NDFileHDF5_nRowChunks        "HDF5_nRowChunks"
 #define str_NDFileHDF5_nColChunks        "HDF5_nColChunks"
@@ -42,6 +43,20 @@
 #define str_NDFileHDF5_layoutErrorMsg    "HDF5_layoutErrorMsg"
 #define str_NDFileHDF5_layoutValid       "HDF5_layoutValid"
 #define str_NDFileHDF5_layoutFilename    "HDF5_layoutFilename"
+#define str_NDFileHDF5_directChunkWrite  "HDF5_directChunkWrite"
+#define str_NDFileHDF5_extendStep        "HDF5_extendStep"
+#define str_NDFileHDF5_NDAttributeBatch  "HDF5_NDAttributeBatch"
+#define str_NDFileHDF5_sustainedFrameRate "HDF5_sustainedFrameRate"
+#define str_NDFileHDF5_sustainedDataRate "HDF5_sustainedDataRate"
+#define str_NDFileHDF5_numCompressThreads "HDF5_numCompressThreads"
+#define str_NDFileHDF5_bloscCompressor   "HDF5_bloscCompressor"
+#define str_NDFileHDF5_bloscShuffle      "HDF5_bloscShuffle"
+#define str_NDFileHDF5_bloscCompressLevel "HDF5_bloscCompressLevel"
+#define str_NDFileHDF5_compressRatio     "HDF5_compressRatio"
+#define str_NDFileHDF5_compressTime      "HDF5_compressTime"
+#define str_NDFileHDF5_SWMRMode          "HDF5_SWMRMode"
+#define str_NDFileHDF5_SWMRActive        "HDF5_SWMRActive"
+#define str_NDFileHDF5_flushPeriod       "HDF5_flushPeriod"
 
 /** Defines an attribute node with the NDFileHDF5 plugin.
   */
@@ -59,6 +74,10 @@ typedef struct HDFAttributeNode {
   hsize_t elementSize[2];
   int hdfrank;
   hdf5::When_t whenToSave;
+  char *batchBuf;       /** < Values of OnFrame attributes waiting to be written in one go */
+  hsize_t batchCount;   /** < Number of values in batchBuf */
+  hsize_t batchSize;    /** < Number of values to collect before writing */
+  size_t elementBytes;  /** < Size of one value in batchBuf */
 } HDFAttributeNode;
 
 /** Writes NDArrays in the HDF5 file format; an XML file can control the structure of the HDF5 file.
@@ -142,7 +161,21 @@ class epicsShareClass NDFileHDF5 : public NDPluginFile
     int NDFileHDF5_layoutErrorMsg;
     int NDFileHDF5_layoutValid;
     int NDFileHDF5_layoutFilename;
-    #define LAST_NDFILE_HDF5_PARAM NDFileHDF5_layoutFilename
+    int NDFileHDF5_directChunkWrite;
+    int NDFileHDF5_extendStep;
+    int NDFileHDF5_NDAttributeBatch;
+    int NDFileHDF5_sustainedFrameRate;
+    int NDFileHDF5_sustainedDataRate;
+    int NDFileHDF5_numCompressThreads;
+    int NDFileHDF5_bloscCompressor;
+    int NDFileHDF5_bloscShuffle;
+    int NDFileHDF5_bloscCompressLevel;
+    int NDFileHDF5_compressRatio;
+    int NDFileHDF5_compressTime;
+    int NDFileHDF5_SWMRMode;
+    int NDFileHDF5_SWMRActive;
+    int NDFileHDF5_flushPeriod;
+    #define LAST_NDFILE_HDF5_PARAM NDFileHDF5_flushPeriod
 
   private:
     /* private helper functions */
@@ -150,9 +183,14 @@ class epicsShareClass NDFileHDF5 : public NDPluginFile
     asynStatus configureDatasetDims(NDArray *pArray);
     asynStatus configureDims(NDArray *pArray);
     asynStatus configureCompression();
+    bool getCodecConfig(NDFileHDF5CodecConfig_t *pConfig);
+    asynStatus createCompressor();
+    void deleteCompressor();
     char* getDimsReport();
     asynStatus writeStringAttribute(hid_t element, const char* attrName, const char* attrStrValue);
     asynStatus writeAttributeDataset(hdf5::When_t whenToSave);
+    asynStatus writeAttributeBatch(HDFAttributeNode *hdfAttrNode);
+    asynStatus flushAttributeDataset();
     asynStatus closeAttributeDataset();
     asynStatus configurePerformanceDataset();
     asynStatus writePerformanceDataset();
@@ -165,6 +203,8 @@ class epicsShareClass NDFileHDF5 : public NDPluginFile
     void addDefaultAttributes(NDArray *pArray);
     asynStatus writeDefaultDatasetAttributes(NDArray *pArray);
     asynStatus createNewFile(const char *fileName);
+    asynStatus startSWMR();
+    asynStatus flushFile();
     asynStatus createFileLayout(NDArray *pArray);
     asynStatus createAttributeDataset();
 
@@ -189,14 +229,17 @@ class epicsShareClass NDFileHDF5 : public NDPluginFile
     epicsTimeStamp prevts;
     epicsTimeStamp opents;
     epicsTimeStamp firstFrame;
+    epicsTimeStamp lastFlush;
     double frameSize;  /** < frame size in megabits. For performance measurement. */
     int bytesPerElement;
     char *hostname;
 
     std::list<HDFAttributeNode *> attrList;
+    NDFileHDF5Compressor *pCompressor;  /** < Compresses whole-frame chunks in parallel, NULL if not used */
 
     /* HDF5 handles and references */
     hid_t file;
+    bool swmrActive;        /** < The file is open for single writer/multiple reader access */
     hid_t dataspace;
     hid_t datatype;
     hid_t cparms;
@@ -0,0 +1,422 @@
+/* NDFileHDF5Compressor.cpp
+ * Compresses chunks for the NDFileHDF5 plugin in parallel and writes them
+ * to the file as pre-filtered chunks.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_BLOSC
+#include <blosc.h>
+#endif
+
+#include <epicsThread.h>
+#include <epicsTime.h>
+
+#include "NDFileHDF5Compressor.h"
+
+static const char *fileName = "NDFileHDF5Compressor";
+
+/** Names of the Blosc compressors, in the order of the HDF5_bloscCompressor parameter */
+const char *NDFileHDF5Compressor::bloscCompressorNames[] = {"blosclz", "lz4", "lz4hc", "snappy", "zlib", "zstd", NULL};
+
+/* The Blosc filter plugin version and the Blosc format version stored in the filter parameters */
+#define BLOSC_FILTER_VERSION 2
+#define BLOSC_FORMAT_VERSION 2
+/* The largest block of the LZ4 filter plugin */
+#define LZ4_FILTER_MAX_BLOCK (1 << 30)
+/* Number of chunks that can wait in the pool for each worker thread */
+#define JOBS_PER_THREAD 2
+
+static void compressTaskC(void *drvPvt)
+{
+  NDFileHDF5Compressor *pCompressor = (NDFileHDF5Compressor *)drvPvt;
+  pCompressor->compressTask();
+}
+
+static void putBigEndian(char *pDest, epicsUInt64 value, int numBytes)
+{
+  for (int i=numBytes-1; i>=0; i--){
+    pDest[i] = (char)(value & 0xff);
+    value >>= 8;
+  }
+}
+
+/** Constructor.
+ * \param[in] pAsynUser - asynUser that is used to control debugging output
+ * \param[in] config - The codec and its settings.
+ * \param[in] numThreads - Number of worker threads. With 0 the chunks are compressed in writeChunk.
+ */
+NDFileHDF5Compressor::NDFileHDF5Compressor(asynUser *pAsynUser, const NDFileHDF5CodecConfig_t& config, int numThreads) :
+                                           pAsynUser_(pAsynUser), config_(config), numThreads_(numThreads)
+{
+  char taskName[32];
+
+  if (this->numThreads_ < 0) this->numThreads_ = 0;
+  this->jobs_.resize(this->numThreads_ * JOBS_PER_THREAD + 1);
+  for (size_t i=0; i<this->jobs_.size(); i++){
+    this->jobs_[i].pArray = NULL;
+    this->jobs_[i].done   = false;
+  }
+  this->submitted_         = 0;
+  this->started_           = 0;
+  this->written_           = 0;
+  this->numRunning_        = 0;
+  this->exiting_           = false;
+  this->rawBytes_          = 0.0;
+  this->compressedBytes_   = 0.0;
+  this->totalCompressTime_ = 0.0;
+  this->numCompressed_     = 0.0;
+  this->mutexId_     = epicsMutexCreate();
+  this->workEventId_ = epicsEventCreate(epicsEventEmpty);
+  this->doneEventId_ = epicsEventCreate(epicsEventEmpty);
+  this->exitEventId_ = epicsEventCreate(epicsEventEmpty);
+
+  for (int i=0; i<this->numThreads_; i++){
+    epicsSnprintf(taskName, sizeof(taskName), "HDF5Compress_%d", i);
+    if (epicsThreadCreate(taskName, epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackMedium),
+                          (EPICSTHREADFUNC)compressTaskC, this) == NULL){
+      asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+                "%s::%s ERROR creating compression thread %d\n",
+                fileName, "NDFileHDF5Compressor", i);
+      break;
+    }
+    epicsMutexLock(this->mutexId_);
+    this->numRunning_++;
+    epicsMutexUnlock(this->mutexId_);
+  }
+}
+
+/** Destructor.
+ * Stops the worker threads.  Chunks that have not been written with flush() are discarded.
+ */
+NDFileHDF5Compressor::~NDFileHDF5Compressor()
+{
+  epicsMutexLock(this->mutexId_);
+  this->exiting_ = true;
+  epicsMutexUnlock(this->mutexId_);
+  epicsEventSignal(this->workEventId_);
+  while (true){
+    epicsMutexLock(this->mutexId_);
+    int numRunning = this->numRunning_;
+    epicsMutexUnlock(this->mutexId_);
+    if (numRunning == 0) break;
+    epicsEventWait(this->exitEventId_);
+  }
+  // Release any array that was not compressed because the file was aborted
+  for (size_t i=0; i<this->jobs_.size(); i++){
+    if (this->jobs_[i].pArray) this->jobs_[i].pArray->release();
+  }
+  epicsEventDestroy(this->exitEventId_);
+  epicsEventDestroy(this->doneEventId_);
+  epicsEventDestroy(this->workEventId_);
+  epicsMutexDestroy(this->mutexId_);
+}
+
+/** codecAvailable.
+ * Returns true if this build of the plugin can encode the codec.
+ * \param[in] codec - The codec.
+ */
+bool NDFileHDF5Compressor::codecAvailable(NDFileHDF5Codec_t codec)
+{
+  switch (codec){
+    case NDFileHDF5CodecZlib:
+      return true;
+    case NDFileHDF5CodecLZ4:
+#ifdef HAVE_LZ4
+      return true;
+#else
+      return false;
+#endif
+    case NDFileHDF5CodecBlosc:
+#ifdef HAVE_BLOSC
+      return true;
+#else
+      return false;
+#endif
+  }
+  return false;
+}
+
+/** setFilter.
+ * Add the HDF5 filter that decodes the chunks of a codec to a dataset creation property list.
+ * The LZ4 and Blosc filters are optional filters, so the dataset can be created even if the
+ * filter plugin is not installed on the writing host. Readers need the filter plugin.
+ * \param[in] cparms - The dataset creation property list.
+ * \param[in] config - The codec and its settings.
+ * \param[in] chunkBytes - The size of one uncompressed chunk in bytes.
+ */
+asynStatus NDFileHDF5Compressor::setFilter(hid_t cparms, const NDFileHDF5CodecConfig_t& config, size_t chunkBytes)
+{
+  herr_t hdfstatus = 0;
+  unsigned int cdValues[7];
+
+  switch (config.codec){
+    case NDFileHDF5CodecZlib:
+      hdfstatus = H5Pset_deflate(cparms, config.level);
+      break;
+    case NDFileHDF5CodecLZ4:
+      cdValues[0] = (chunkBytes < LZ4_FILTER_MAX_BLOCK) ? (unsigned int)chunkBytes : LZ4_FILTER_MAX_BLOCK;
+      hdfstatus = H5Pset_filter(cparms, NDFILEHDF5_FILTER_LZ4, H5Z_FLAG_OPTIONAL, 1, cdValues);
+      break;
+    case NDFileHDF5CodecBlosc:
+      cdValues[0] = BLOSC_FILTER_VERSION;
+      cdValues[1] = BLOSC_FORMAT_VERSION;
+      cdValues[2] = config.typeSize;
+      cdValues[3] = (unsigned int)chunkBytes;
+      cdValues[4] = config.level;
+      cdValues[5] = config.bloscShuffle;
+      cdValues[6] = config.bloscCompressor;
+      hdfstatus = H5Pset_filter(cparms, NDFILEHDF5_FILTER_BLOSC, H5Z_FLAG_OPTIONAL, 7, cdValues);
+      break;
+  }
+  return (hdfstatus < 0) ? asynError : asynSuccess;
+}
+
+/** writeChunk.
+ * Compress one frame that fills a whole chunk of a dataset and write it to the file.
+ * The offset of the chunk is taken from the dataset now; the chunk is written later by this
+ * or a following call of writeChunk or flush.  Chunks that were compressed in the meantime
+ * are written as well.
+ * \param[in] pArray - The NDArray with the frame.  It is reserved until it has been compressed.
+ * \param[in] pDataset - The dataset, which has been extended for this frame.
+ * \param[in] size - The size of the frame in bytes.
+ */
+asynStatus NDFileHDF5Compressor::writeChunk(NDArray *pArray, NDFileHDF5Dataset *pDataset, size_t size)
+{
+  Job *pJob;
+  bool inline_;
+
+  epicsMutexLock(this->mutexId_);
+  inline_ = (this->numRunning_ == 0);
+  epicsMutexUnlock(this->mutexId_);
+
+  // Wait for a free slot, writing the oldest chunk when it is ready.  A slot is free once its
+  // chunk has been written, because writeJobs keeps started_ from falling behind written_.
+  if (this->submitted_ - this->written_ == this->jobs_.size()){
+    if (this->writeJobs(true)) return asynError;
+  }
+
+  pJob = &this->jobs_[this->submitted_ % this->jobs_.size()];
+  pJob->pData          = pArray->pData;
+  pJob->rawSize        = size;
+  pJob->pDataset       = pDataset;
+  pJob->compressedSize = 0;
+  pJob->filterMask     = 0;
+  pJob->compressTime   = 0.0;
+  pJob->done           = false;
+  pDataset->reserveRecord(pJob->offset);
+
+  // Arrays that do not belong to a pool cannot be kept, so they are compressed now
+  if (!inline_ && pArray->reserve() != ND_SUCCESS) inline_ = true;
+  if (inline_) this->compress(pJob);
+
+  // The worker threads only look at the job once it has been submitted
+  epicsMutexLock(this->mutexId_);
+  pJob->pArray = inline_ ? NULL : pArray;
+  pJob->done   = inline_;
+  this->submitted_++;
+  epicsMutexUnlock(this->mutexId_);
+  if (!inline_) epicsEventSignal(this->workEventId_);
+
+  return this->writeJobs(false);
+}
+
+/** flush.
+ * Wait for all submitted chunks to be compressed and write them to the file.
+ */
+asynStatus NDFileHDF5Compressor::flush()
+{
+  asynStatus status = asynSuccess;
+
+  while (this->written_ != this->submitted_){
+    if (this->writeJobs(true)) status = asynError;
+  }
+  return status;
+}
+
+/** getStatistics.
+ * Returns the compression ratio and the mean compression time of the chunks written so far.
+ * \param[out] ratio - Uncompressed bytes divided by compressed bytes.
+ * \param[out] compressTime - Mean time to compress one chunk in ms.
+ */
+void NDFileHDF5Compressor::getStatistics(double *ratio, double *compressTime)
+{
+  *ratio = (this->compressedBytes_ > 0.0) ? this->rawBytes_ / this->compressedBytes_ : 0.0;
+  *compressTime = (this->numCompressed_ > 0.0) ? this->totalCompressTime_ / this->numCompressed_ : 0.0;
+}
+
+/** writeJobs.
+ * Write the compressed chunks in the order in which they were submitted.
+ * \param[in] wait - Wait for the oldest chunk to be compressed and write at least that one.
+ */
+asynStatus NDFileHDF5Compressor::writeJobs(bool wait)
+{
+  asynStatus status = asynSuccess;
+  Job *pJob;
+  bool done;
+
+  while (this->written_ != this->submitted_){
+    pJob = &this->jobs_[this->written_ % this->jobs_.size()];
+    epicsMutexLock(this->mutexId_);
+    done = pJob->done;
+    epicsMutexUnlock(this->mutexId_);
+    if (!done){
+      if (!wait) break;
+      epicsEventWait(this->doneEventId_);
+      continue;
+    }
+    if (pJob->compressedSize == 0){
+      status = asynError;
+    } else if (pJob->pDataset->writeChunk(&pJob->offset[0], &pJob->buffer[0], pJob->compressedSize,
+                                          pJob->filterMask)){
+      status = asynError;
+    }
+    this->rawBytes_          += pJob->rawSize;
+    this->compressedBytes_   += pJob->compressedSize;
+    this->totalCompressTime_ += pJob->compressTime;
+    this->numCompressed_     += 1.0;
+    // A chunk compressed in writeChunk may not have been skipped by a worker thread yet.  Skip it
+    // here, so that the slot is not reused while started_ still points at it.
+    epicsMutexLock(this->mutexId_);
+    if (this->started_ == this->written_) this->started_++;
+    this->written_++;
+    epicsMutexUnlock(this->mutexId_);
+    wait = false;
+  }
+  return status;
+}
+
+/** compress.
+ * Compress the data of a job into its buffer in the format of the HDF5 filter of the codec.
+ * Data that does not compress is stored uncompressed with the filter marked as skipped.
+ */
+void NDFileHDF5Compressor::compress(Job *pJob)
+{
+  epicsTimeStamp start, end;
+  static const char *functionName = "compress";
+
+  epicsTimeGetCurrent(&start);
+  switch (this->config_.codec){
+    case NDFileHDF5CodecZlib: {
+      uLongf destLen = compressBound((uLong)pJob->rawSize);
+      if (pJob->buffer.size() < destLen) pJob->buffer.resize(destLen);
+      if (compress2((Bytef *)&pJob->buffer[0], &destLen, (const Bytef *)pJob->pData,
+                    (uLong)pJob->rawSize, this->config_.level) == Z_OK){
+        pJob->compressedSize = destLen;
+      }
+      break;
+    }
+#ifdef HAVE_LZ4
+    case NDFileHDF5CodecLZ4: {
+      // The LZ4 filter format: 8 byte total size and 4 byte block size, then for each block
+      // 4 byte compressed size and the data.  All sizes are big endian.
+      size_t blockSize = (pJob->rawSize < LZ4_FILTER_MAX_BLOCK) ? pJob->rawSize : LZ4_FILTER_MAX_BLOCK;
+      size_t numBlocks = (pJob->rawSize + blockSize - 1) / blockSize;
+      size_t destLen = 12 + numBlocks * (4 + LZ4_compressBound((int)blockSize));
+      if (pJob->buffer.size() < destLen) pJob->buffer.resize(destLen);
+      char *pDest = &pJob->buffer[0];
+      const char *pSrc = (const char *)pJob->pData;
+      size_t remaining = pJob->rawSize;
+      putBigEndian(pDest, pJob->rawSize, 8);
+      putBigEndian(pDest + 8, blockSize, 4);
+      pDest += 12;
+      while (remaining > 0){
+        int thisBlock = (int)((remaining < blockSize) ? remaining : blockSize);
+        int compressed = LZ4_compress_default(pSrc, pDest + 4, thisBlock, LZ4_compressBound(thisBlock));
+        if (compressed <= 0 || compressed >= thisBlock){
+          memcpy(pDest + 4, pSrc, thisBlock);
+          compressed = thisBlock;
+        }
+        putBigEndian(pDest, compressed, 4);
+        pDest += 4 + compressed;
+        pSrc += thisBlock;
+        remaining -= thisBlock;
+      }
+      pJob->compressedSize = pDest - &pJob->buffer[0];
+      break;
+    }
+#endif
+#ifdef HAVE_BLOSC
+    case NDFileHDF5CodecBlosc: {
+      size_t destLen = pJob->rawSize + BLOSC_MAX_OVERHEAD;
+      if (pJob->buffer.size() < destLen) pJob->buffer.resize(destLen);
+      int compressed = blosc_compress_ctx(this->config_.level, this->config_.bloscShuffle, this->config_.typeSize,
+                                          pJob->rawSize, pJob->pData, &pJob->buffer[0], destLen,
+                                          bloscCompressorNames[this->config_.bloscCompressor], 0, 1);
+      if (compressed > 0) pJob->compressedSize = compressed;
+      break;
+    }
+#endif
+    default:
+      break;
+  }
+
+  // Store the chunk uncompressed if it did not get smaller.  The LZ4 and Blosc
+  // formats already do that themselves.
+  if (this->config_.codec == NDFileHDF5CodecZlib &&
+      (pJob->compressedSize == 0 || pJob->compressedSize >= pJob->rawSize)){
+    if (pJob->buffer.size() < pJob->rawSize) pJob->buffer.resize(pJob->rawSize);
+    memcpy(&pJob->buffer[0], pJob->pData, pJob->rawSize);
+    pJob->compressedSize = pJob->rawSize;
+    pJob->filterMask = 1;
+  }
+  if (pJob->compressedSize == 0){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+              "%s::%s ERROR compressing chunk of %d bytes\n",
+              fileName, functionName, (int)pJob->rawSize);
+  }
+  epicsTimeGetCurrent(&end);
+  pJob->compressTime = 1000.0 * epicsTimeDiffInSeconds(&end, &start);
+}
+
+/** compressTask.
+ * Worker thread: compress the submitted jobs in order of submission until the compressor is deleted.
+ * Jobs are claimed under the mutex, and jobs that were compressed in writeChunk are skipped there,
+ * so a job is only ever compressed by one thread.
+ */
+void NDFileHDF5Compressor::compressTask()
+{
+  Job *pJob;
+  bool more;
+
+  while (true){
+    epicsMutexLock(this->mutexId_);
+    pJob = NULL;
+    while (!this->exiting_ && !pJob){
+      if (this->started_ == this->submitted_){
+        epicsMutexUnlock(this->mutexId_);
+        epicsEventWait(this->workEventId_);
+        epicsMutexLock(this->mutexId_);
+        continue;
+      }
+      pJob = &this->jobs_[this->started_ % this->jobs_.size()];
+      this->started_++;
+      // Jobs that were compressed in writeChunk are already done
+      if (!pJob->pArray) pJob = NULL;
+    }
+    if (this->exiting_){
+      this->numRunning_--;
+      epicsMutexUnlock(this->mutexId_);
+      // Wake the next thread so that it exits as well
+      epicsEventSignal(this->workEventId_);
+      epicsEventSignal(this->exitEventId_);
+      return;
+    }
+    more = (this->started_ != this->submitted_);
+    epicsMutexUnlock(this->mutexId_);
+    if (more) epicsEventSignal(this->workEventId_);
+
+    this->compress(pJob);
+    epicsMutexLock(this->mutexId_);
+    pJob->pArray->release();
+    pJob->pArray = NULL;
+    pJob->done = true;
+    epicsMutexUnlock(this->mutexId_);
+    epicsEventSignal(this->doneEventId_);
+  }
+}
@@ -0,0 +1,98 @@
+#ifndef NDFILEHDF5COMPRESSOR_H_
+#define NDFILEHDF5COMPRESSOR_H_
+
+#include <vector>
+#include <hdf5.h>
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include "NDPluginFile.h"
+#include "NDFileHDF5Dataset.h"
+
+/** HDF5 filter numbers registered for the LZ4 and Blosc filter plugins */
+#define NDFILEHDF5_FILTER_LZ4   32004
+#define NDFILEHDF5_FILTER_BLOSC 32001
+
+/** Codecs that NDFileHDF5Compressor can encode */
+typedef enum {
+  NDFileHDF5CodecZlib,
+  NDFileHDF5CodecLZ4,
+  NDFileHDF5CodecBlosc
+} NDFileHDF5Codec_t;
+
+/** Blosc shuffle modes, the same values as BLOSC_NOSHUFFLE, BLOSC_SHUFFLE and BLOSC_BITSHUFFLE */
+typedef enum {
+  NDFileHDF5ShuffleNone,
+  NDFileHDF5ShuffleByte,
+  NDFileHDF5ShuffleBit
+} NDFileHDF5Shuffle_t;
+
+/** Settings of the codec used for the chunks of a file.
+  */
+typedef struct {
+  NDFileHDF5Codec_t codec;
+  int level;               // Compression level for zlib and Blosc
+  int typeSize;            // Size of one data element in bytes
+  int bloscCompressor;     // Index into NDFileHDF5Compressor::bloscCompressorNames
+  int bloscShuffle;        // One of NDFileHDF5Shuffle_t
+} NDFileHDF5CodecConfig_t;
+
+/** Compresses whole-frame chunks for the NDFileHDF5 plugin in a pool of worker threads.
+  * The compressed chunks are written with H5DOwrite_chunk by the thread that calls writeChunk
+  * and flush, in the order in which they were submitted, so the HDF5 library is only ever
+  * called from the plugin thread.  With no worker threads the chunks are compressed in the
+  * calling thread.
+  */
+class NDFileHDF5Compressor
+{
+  public:
+    NDFileHDF5Compressor(asynUser *pAsynUser, const NDFileHDF5CodecConfig_t& config, int numThreads);
+    ~NDFileHDF5Compressor();
+
+    static bool codecAvailable(NDFileHDF5Codec_t codec);
+    static asynStatus setFilter(hid_t cparms, const NDFileHDF5CodecConfig_t& config, size_t chunkBytes);
+    static const char *bloscCompressorNames[];
+
+    asynStatus writeChunk(NDArray *pArray, NDFileHDF5Dataset *pDataset, size_t size);
+    asynStatus flush();
+    void getStatistics(double *ratio, double *compressTime);
+    void compressTask();
+
+  private:
+    /** One chunk on its way through the pool. The buffers are kept when the slot is reused. */
+    struct Job {
+      NDArray *pArray;               // Array to compress, reserved until it has been compressed
+      const void *pData;             // Data to compress
+      size_t rawSize;
+      NDFileHDF5Dataset *pDataset;
+      std::vector<hsize_t> offset;   // Chunk offset in the dataset, claimed when the job was submitted
+      std::vector<char> buffer;      // Compressed chunk
+      size_t compressedSize;
+      epicsUInt32 filterMask;        // Filters that were skipped because the data did not compress
+      double compressTime;
+      bool done;
+    };
+
+    void compress(Job *pJob);
+    asynStatus writeJobs(bool wait);
+
+    asynUser *pAsynUser_;
+    NDFileHDF5CodecConfig_t config_;
+    int numThreads_;
+    std::vector<Job> jobs_;
+    epicsUInt32 submitted_;          // Number of jobs submitted
+    epicsUInt32 started_;            // Number of jobs taken by a worker thread
+    epicsUInt32 written_;            // Number of jobs written to the file
+    int numRunning_;                 // Number of worker threads that have not exited
+    bool exiting_;
+    epicsMutexId mutexId_;
+    epicsEventId workEventId_;
+    epicsEventId doneEventId_;
+    epicsEventId exitEventId_;
+
+    double rawBytes_;                // Statistics of the chunks written so far
+    double compressedBytes_;
+    double totalCompressTime_;
+    double numCompressed_;
+};
+
+#endif
@@ -1,5 +1,5 @@
+#include <hdf5_hl.h>
 #include "NDFileHDF5Dataset.h"
-#include <iostream>
 
 static const char *fileName = "NDFileHDF5Dataset";
 
@@ -16,6 +16,9 @@ NDFileHDF5Dataset::NDFileHDF5Dataset(asynUser *pAsynUser, const std::string& nam
   this->dims_        = NULL;
   this->offset_      = NULL;
   this->virtualdims_ = NULL;
+  this->extentdims_  = NULL;
+  this->directChunk_ = false;
+  this->extendStep_  = 1;
 }
  
 /** configureDims.
@@ -44,12 +47,14 @@ asynStatus NDFileHDF5Dataset::configureDims(NDArray *pArray, bool multiframe, in
     if (this->dims_        != NULL) free(this->dims_);
     if (this->offset_      != NULL) free(this->offset_);
     if (this->virtualdims_ != NULL) free(this->virtualdims_);
+    if (this->extentdims_  != NULL) free(this->extentdims_);
 
     this->maxdims_       = (hsize_t*)calloc(ndims,     sizeof(hsize_t));
     this->chunkdims_     = (hsize_t*)calloc(ndims,     sizeof(hsize_t));
     this->dims_          = (hsize_t*)calloc(ndims,     sizeof(hsize_t));
     this->offset_        = (hsize_t*)calloc(ndims,     sizeof(hsize_t));
     this->virtualdims_   = (hsize_t*)calloc(extradims, sizeof(hsize_t));
+    this->extentdims_    = (hsize_t*)calloc(ndims,     sizeof(hsize_t));
   }
 
   if (multiframe){
@@ -92,9 +97,34 @@ asynStatus NDFileHDF5Dataset::configureDims(NDArray *pArray, bool multiframe, in
     if (user_chunking[i] < 1) user_chunking[i] = max_items;
     this->chunkdims_[hdfdim] = user_chunking[i];
   }
+
+  // The dataset is created with the size of the first frame
+  for (i=0; i<ndims; i++) this->extentdims_[i] = this->dims_[i];
   return status;
 }
 
+/** setWritePolicy.
+ * Select how frames are written to this dataset.
+ * \param[in] directChunk - Write each frame as a chunk with H5DOwrite_chunk, bypassing the HDF5 type
+ *                          conversion and filter pipeline. Only used if a chunk holds exactly one frame
+ *                          and the dataset has no filters.
+ * \param[in] extendStep - Number of records by which the first dimension is extended when it is full.
+ */
+void NDFileHDF5Dataset::setWritePolicy(bool directChunk, int extendStep)
+{
+  int nfilters = -1;
+
+  if (directChunk){
+    hid_t cparms = H5Dget_create_plist(this->dataset_);
+    if (cparms >= 0){
+      nfilters = H5Pget_nfilters(cparms);
+      H5Pclose(cparms);
+    }
+  }
+  this->directChunk_ = directChunk && (nfilters == 0);
+  this->extendStep_  = (extendStep < 1) ? 1 : extendStep;
+}
+
 /** extendDataSet.
  * Extend this dataset as necessary.  If no extra dimensions are specified
  * then the dataset is simply increased in the frame number direction.
@@ -156,22 +186,19 @@ void NDFileHDF5Dataset::extendDataSet(int extradims)
  */
 asynStatus NDFileHDF5Dataset::writeFile(NDArray *pArray, hid_t datatype, hid_t dataspace, hsize_t *framesize)
 {
-  //std::cout<< " it's the NDArrays is ::::::::::::::::"<< pArray->pData <<std::endl; 	
   herr_t hdfstatus;
   static const char *functionName = "writeFile";
 
+  // A frame that fills a whole unfiltered chunk is written as it is, without a hyperslab selection
+  if (this->directChunk_ && this->chunkIsFrame(framesize)){
+    size_t size = H5Tget_size(datatype);
+    for (int i=0; i<this->rank_; i++) size *= (size_t)framesize[i];
+    return this->writeChunk(pArray->pData, size, 0);
+  }
+
   // Increase the size of the dataset
-  asynPrint(this->pAsynUser_, ASYN_TRACE_FLOW,
-            "%s::%s: set_extent dims={%d,%d,%d}\n",
-            fileName, functionName, (int)this->dims_[0], (int)this->dims_[1], (int)this->dims_[2]);
+  if (this->extendExtent() != asynSuccess) return asynError;
 
-  hdfstatus = H5Dset_extent(this->dataset_, this->dims_);
-  if (hdfstatus){
-    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, 
-              "%s::%s ERROR Increasing the size of the dataset [%s] failed\n", 
-              fileName, functionName, this->name_.c_str());
-    return asynError;
-  }
   // Select a hyperslab.
   hid_t fspace = H5Dget_space(this->dataset_);
   if (fspace < 0){
@@ -185,15 +212,16 @@ asynStatus NDFileHDF5Dataset::writeFile(NDArray *pArray, hid_t datatype, hid_t d
     asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, 
               "%s::%s ERROR Unable to select hyperslab\n", 
               fileName, functionName);
+    H5Sclose(fspace);
     return asynError;
   }
   // Write the data to the hyperslab.
   hdfstatus = H5Dwrite(this->dataset_, datatype, dataspace, fspace, H5P_DEFAULT, pArray->pData);
-  std::cout<< " it's the NDArrays is ::::::::::::::::"<< pArray->pData <<std::endl; 
   if (hdfstatus){
     asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, 
               "%s::%s ERROR Unable to write data to hyperslab\n", 
               fileName, functionName);
+    H5Sclose(fspace);
     return asynError;
   }
 
@@ -210,6 +238,132 @@ asynStatus NDFileHDF5Dataset::writeFile(NDArray *pArray, hid_t datatype, hid_t d
   return asynSuccess;
 }
 
+/** writeChunk.
+ * Write one frame as a complete chunk at the current offset with H5DOwrite_chunk.
+ * The data must already be in the file datatype and, if the dataset has filters,
+ * already be passed through them.
+ * \param[in] pData - The chunk data.
+ * \param[in] size - The size of the chunk data in bytes.
+ * \param[in] filterMask - Mask of the dataset filters that were skipped for this chunk (0 for all applied).
+ */
+asynStatus NDFileHDF5Dataset::writeChunk(const void *pData, size_t size, epicsUInt32 filterMask)
+{
+  if (this->writeChunk(this->offset_, pData, size, filterMask) != asynSuccess) return asynError;
+
+  this->nextRecord_++;
+
+  return asynSuccess;
+}
+
+/** writeChunk.
+ * Write a complete chunk at an offset that was claimed earlier with reserveRecord.
+ * The dataset is extended to the current dimensions first.
+ * \param[in] offset - The offset of the chunk in each dimension.
+ * \param[in] pData - The chunk data.
+ * \param[in] size - The size of the chunk data in bytes.
+ * \param[in] filterMask - Mask of the dataset filters that were skipped for this chunk (0 for all applied).
+ */
+asynStatus NDFileHDF5Dataset::writeChunk(const hsize_t *offset, const void *pData, size_t size, epicsUInt32 filterMask)
+{
+  herr_t hdfstatus;
+  static const char *functionName = "writeChunk";
+
+  if (this->extendExtent() != asynSuccess) return asynError;
+
+  hdfstatus = H5DOwrite_chunk(this->dataset_, H5P_DEFAULT, filterMask, offset, size, pData);
+  if (hdfstatus < 0){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, 
+              "%s::%s ERROR Unable to write chunk to dataset [%s]\n", 
+              fileName, functionName, this->name_.c_str());
+    return asynError;
+  }
+
+  return asynSuccess;
+}
+
+/** reserveRecord.
+ * Claim the current offset for a chunk that is written later with writeChunk(offset, ...),
+ * and move on to the next record.
+ * \param[out] offset - The offset of the record in each dimension.
+ */
+void NDFileHDF5Dataset::reserveRecord(std::vector<hsize_t>& offset)
+{
+  offset.assign(this->offset_, this->offset_ + this->rank_);
+  this->nextRecord_++;
+}
+
+/** trimDataSet.
+ * Shrink the dataset to the records that were written.  Must be called before the
+ * dataset is closed when it has been extended in steps.
+ */
+asynStatus NDFileHDF5Dataset::trimDataSet()
+{
+  static const char *functionName = "trimDataSet";
+
+  if (this->extentdims_ == NULL || this->extentdims_[0] == this->dims_[0]) return asynSuccess;
+
+  asynPrint(this->pAsynUser_, ASYN_TRACE_FLOW,
+            "%s::%s: trim dataset [%s] from %d to %d records\n",
+            fileName, functionName, this->name_.c_str(), (int)this->extentdims_[0], (int)this->dims_[0]);
+
+  if (H5Dset_extent(this->dataset_, this->dims_)){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, 
+              "%s::%s ERROR Unable to trim the dataset [%s]\n", 
+              fileName, functionName, this->name_.c_str());
+    return asynError;
+  }
+  for (int i=0; i<this->rank_; i++) this->extentdims_[i] = this->dims_[i];
+  return asynSuccess;
+}
+
+/** extendExtent.
+ * Make sure the dataset in the file is large enough for dims_.  The first dimension
+ * is extended by extendStep_ records at a time when it is unlimited, so that
+ * H5Dset_extent is not called for every frame.
+ */
+asynStatus NDFileHDF5Dataset::extendExtent()
+{
+  int i;
+  bool extend = false;
+  static const char *functionName = "extendExtent";
+
+  for (i=0; i<this->rank_; i++){
+    if (this->dims_[i] > this->extentdims_[i]) extend = true;
+  }
+  if (!extend) return asynSuccess;
+
+  for (i=0; i<this->rank_; i++){
+    if (this->dims_[i] > this->extentdims_[i]) this->extentdims_[i] = this->dims_[i];
+  }
+  if (this->extendStep_ > 1 && this->maxdims_[0] == H5S_UNLIMITED && this->extentdims_[0] == this->dims_[0]){
+    this->extentdims_[0] += this->extendStep_ - 1;
+  }
+
+  asynPrint(this->pAsynUser_, ASYN_TRACE_FLOW,
+            "%s::%s: set_extent dataset [%s] records=%d\n",
+            fileName, functionName, this->name_.c_str(), (int)this->extentdims_[0]);
+
+  if (H5Dset_extent(this->dataset_, this->extentdims_)){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR, 
+              "%s::%s ERROR Increasing the size of the dataset [%s] failed\n", 
+              fileName, functionName, this->name_.c_str());
+    return asynError;
+  }
+  return asynSuccess;
+}
+
+/** chunkIsFrame.
+ * Returns true if one chunk of this dataset holds exactly one frame.
+ * \param[in] framesize - The size of the data to write.
+ */
+bool NDFileHDF5Dataset::chunkIsFrame(hsize_t *framesize)
+{
+  for (int i=0; i<this->rank_; i++){
+    if (this->chunkdims_[i] != framesize[i]) return false;
+  }
+  return true;
+}
+
 /** getHandle.
  * Returns the HDF5 handle to this dataset.
  */
@@ -2,6 +2,7 @@
 #define NDFILEHDF5DATASET_H_
 
 #include <string>
+#include <vector>
 #include <hdf5.h>
 #include "NDPluginFile.h"
 
@@ -15,9 +16,16 @@ class NDFileHDF5Dataset
     asynStatus configureDims(NDArray *pArray, bool multiframe, int extradimensions, int *extra_dims, int *user_chunking);
     void extendDataSet(int extradims);
     asynStatus writeFile(NDArray *pArray, hid_t datatype, hid_t dataspace, hsize_t *framesize);
+    asynStatus writeChunk(const void *pData, size_t size, epicsUInt32 filterMask);
+    asynStatus writeChunk(const hsize_t *offset, const void *pData, size_t size, epicsUInt32 filterMask);
+    void reserveRecord(std::vector<hsize_t>& offset);
+    bool chunkIsFrame(hsize_t *framesize);
+    void setWritePolicy(bool directChunk, int extendStep);
+    asynStatus trimDataSet();
     hid_t getHandle();
 
   private:
+    asynStatus extendExtent();
 
     asynUser    *pAsynUser_;   // Pointer to the asynUser structure
     std::string name_;         // Name of this dataset
@@ -33,6 +41,10 @@ class NDFileHDF5Dataset
     hsize_t     *offset_;      // Array of current offset in each dimension. The frame dimensions always have
                                // 0 offset but additional dimensions may grow as new frames are added.
     hsize_t     *virtualdims_; // The desired sizes of the extra (virtual) dimensions: {Y, X, n}
+    hsize_t     *extentdims_;  // Array of the dimension sizes currently allocated in the file. The first
+                               // dimension can be ahead of dims_ when the dataset is extended in steps.
+    bool        directChunk_;  // Write frames with H5DOwrite_chunk when a chunk holds exactly one frame
+    int         extendStep_;   // Number of records to add to the first dimension at each extension
     char        *ptrDimensionNames[ND_ARRAY_MAX_DIMS]; // Array of strings with human readable names for each dimension
     char        *dimsreport_;  // A string which contain a verbose report of all dimension sizes. The method getDimsReport fill in this
 };
@@ -11,6 +11,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <math.h>
+#include <ctype.h>
 
 #include <epicsString.h>
 #include <epicsMutex.h>
@@ -26,55 +27,584 @@
 
 static const char *driverName="NDPluginCircularBuff";
 
+/* Bits in the calcArgUsage() input mask for the arguments of the trigger calculation */
+#define TRIGGER_ARG_A    (1 << 0)
+#define TRIGGER_ARG_B    (1 << 1)
+#define TRIGGER_ARG_MAX  (1 << 6)
+#define TRIGGER_ARG_SUM  (1 << 7)
+
+/** Computes the maximum and the sum of a rectangular region of an array.
+  * The inner loop keeps four independent accumulators so that successive elements do not
+  * depend on each other, which lets the compiler vectorise it. */
+template <typename epicsType>
+static void regionStatsT(NDArray *pArray, size_t rowStride, size_t minX, size_t sizeX,
+                         size_t minY, size_t sizeY, double *pMax, double *pSum)
+{
+    const epicsType *pRow = (const epicsType *)pArray->pData + minY*rowStride + minX;
+    epicsType max0 = pRow[0], max1 = pRow[0], max2 = pRow[0], max3 = pRow[0];
+    double sum0 = 0., sum1 = 0., sum2 = 0., sum3 = 0.;
+    size_t x, y;
+
+    for (y = 0; y < sizeY; y++, pRow += rowStride) {
+        for (x = 0; x + 4 <= sizeX; x += 4) {
+            max0 = pRow[x]   > max0 ? pRow[x]   : max0;
+            max1 = pRow[x+1] > max1 ? pRow[x+1] : max1;
+            max2 = pRow[x+2] > max2 ? pRow[x+2] : max2;
+            max3 = pRow[x+3] > max3 ? pRow[x+3] : max3;
+            sum0 += pRow[x];
+            sum1 += pRow[x+1];
+            sum2 += pRow[x+2];
+            sum3 += pRow[x+3];
+        }
+        for (; x < sizeX; x++) {
+            max0 = pRow[x] > max0 ? pRow[x] : max0;
+            sum0 += pRow[x];
+        }
+    }
+    if (max1 > max0) max0 = max1;
+    if (max3 > max2) max2 = max3;
+    *pMax = (double)(max2 > max0 ? max2 : max0);
+    *pSum = (sum0 + sum1) + (sum2 + sum3);
+}
+
+/** Computes the maximum and sum of the trigger statistics region of an array.
+  * The region applies to the first 2 dimensions; arrays with more dimensions use all of their elements.
+  * \param[in] pArray  The NDArray from the callback.
+  * \param[in] region  The region minimum and size in X and Y; a size of 0 extends the region to the
+  *            end of the dimension.
+  * \param[out] pMax The maximum value in the region.
+  * \param[out] pSum The sum of the values in the region.
+  */
+static asynStatus regionStats(NDArray *pArray, const int region[4], double *pMax, double *pSum)
+{
+    NDArrayInfo arrayInfo;
+    size_t nx, ny, minX=0, sizeX, minY=0, sizeY;
+
+    pArray->getInfo(&arrayInfo);
+    if (arrayInfo.nElements == 0) return asynError;
+    if ((pArray->ndims == 1) || (pArray->ndims == 2)) {
+        nx = pArray->dims[0].size;
+        ny = (pArray->ndims == 2) ? pArray->dims[1].size : 1;
+        if (region[0] > 0) minX = (size_t)region[0];
+        if (region[2] > 0) minY = (size_t)region[2];
+        if (minX >= nx) minX = nx - 1;
+        if (minY >= ny) minY = ny - 1;
+        sizeX = nx - minX;
+        sizeY = ny - minY;
+        if ((region[1] > 0) && ((size_t)region[1] < sizeX)) sizeX = region[1];
+        if ((region[3] > 0) && ((size_t)region[3] < sizeY)) sizeY = region[3];
+    } else {
+        nx = sizeX = arrayInfo.nElements;
+        sizeY = 1;
+    }
+
+    switch(pArray->dataType) {
+        case NDInt8:
+            regionStatsT<epicsInt8>(pArray, nx, minX, sizeX, minY, sizeY, pMax, pSum);
+            break;
+        case NDUInt8:
+            regionStatsT<epicsUInt8>(pArray, nx, minX, sizeX, minY, sizeY, pMax, pSum);
+            break;
+        case NDInt16:
+            regionStatsT<epicsInt16>(pArray, nx, minX, sizeX, minY, sizeY, pMax, pSum);
+            break;
+        case NDUInt16:
+            regionStatsT<epicsUInt16>(pArray, nx, minX, sizeX, minY, sizeY, pMax, pSum);
+            break;
+        case NDInt32:
+            regionStatsT<epicsInt32>(pArray, nx, minX, sizeX, minY, sizeY, pMax, pSum);
+            break;
+        case NDUInt32:
+            regionStatsT<epicsUInt32>(pArray, nx, minX, sizeX, minY, sizeY, pMax, pSum);
+            break;
+        case NDFloat32:
+            regionStatsT<epicsFloat32>(pArray, nx, minX, sizeX, minY, sizeY, pMax, pSum);
+            break;
+        case NDFloat64:
+            regionStatsT<epicsFloat64>(pArray, nx, minX, sizeX, minY, sizeY, pMax, pSum);
+            break;
+        default:
+            return asynError;
+    }
+    return asynSuccess;
+}
+
+/* Operations of the compiled trigger calculation */
+typedef enum {
+    TRIGGER_OP_CONST,
+    TRIGGER_OP_ARG,
+    TRIGGER_OP_NEG,
+    TRIGGER_OP_NOT,
+    TRIGGER_OP_ABS,
+    TRIGGER_OP_ADD,
+    TRIGGER_OP_SUB,
+    TRIGGER_OP_MUL,
+    TRIGGER_OP_DIV,
+    TRIGGER_OP_LT,
+    TRIGGER_OP_LE,
+    TRIGGER_OP_GT,
+    TRIGGER_OP_GE,
+    TRIGGER_OP_EQ,
+    TRIGGER_OP_NE,
+    TRIGGER_OP_AND,
+    TRIGGER_OP_OR,
+    TRIGGER_OP_MIN,
+    TRIGGER_OP_MAX,
+    TRIGGER_OP_JUMP,
+    TRIGGER_OP_JUMP_FALSE
+} triggerOpcode;
+
+/* Size of the evaluation stack of the compiled trigger calculation */
+#define TRIGGER_STACK_SIZE 20
+
+/** State of the trigger calculation compiler.
+  * The compiler handles numbers, the arguments A-L, unary - + !, * /, + -, the comparisons
+  * < <= > >= = == != #, && ||, ?: and the functions ABS, MIN and MAX.  Any other part of the
+  * calc syntax clears supported, and the calculation is then evaluated with calcPerform.
+  * So does a chain that mixes the relational operators < <= > >= with the equality operators
+  * = == != # without parentheses, so that its result never depends on their relative precedence. */
+typedef struct {
+    const char *pos;
+    NDCircBuffTriggerOp *ops;
+    int numOps;
+    int depth;
+    bool supported;
+} triggerCompiler;
+
+static void triggerCond(triggerCompiler *pComp);
+
+static void triggerSkipSpace(triggerCompiler *pComp)
+{
+    while (isspace((unsigned char)*pComp->pos)) pComp->pos++;
+}
+
+/** Consumes the token if it is next in the expression */
+static bool triggerAccept(triggerCompiler *pComp, const char *token)
+{
+    size_t len = strlen(token);
+
+    triggerSkipSpace(pComp);
+    if (strncmp(pComp->pos, token, len) != 0) return false;
+    pComp->pos += len;
+    return true;
+}
+
+/** Appends an instruction and tracks the depth of the evaluation stack.
+  * \return The index of the instruction, or -1 if the calculation is too long. */
+static int triggerEmit(triggerCompiler *pComp, int opcode, int operand, double value, int depthChange)
+{
+    NDCircBuffTriggerOp *pOp;
+
+    pComp->depth += depthChange;
+    if ((pComp->numOps >= NDCircBuffMaxTriggerOps) || (pComp->depth > TRIGGER_STACK_SIZE)) {
+        pComp->supported = false;
+        return -1;
+    }
+    pOp = &pComp->ops[pComp->numOps];
+    pOp->opcode = opcode;
+    pOp->operand = operand;
+    pOp->value = value;
+    return pComp->numOps++;
+}
+
+static void triggerPrimary(triggerCompiler *pComp)
+{
+    const char *pStart;
+    char *pEnd;
+    char name[4];
+    size_t len;
+    int opcode, nArgs;
+
+    triggerSkipSpace(pComp);
+    pStart = pComp->pos;
+    if (isdigit((unsigned char)*pStart) || (*pStart == '.')) {
+        double value = strtod(pStart, &pEnd);
+        if ((pEnd == pStart) || isalpha((unsigned char)*pEnd)) {
+            pComp->supported = false;
+            return;
+        }
+        pComp->pos = pEnd;
+        triggerEmit(pComp, TRIGGER_OP_CONST, 0, value, 1);
+        return;
+    }
+    if (triggerAccept(pComp, "(")) {
+        triggerCond(pComp);
+        if (!triggerAccept(pComp, ")")) pComp->supported = false;
+        return;
+    }
+    for (len = 0; isalpha((unsigned char)pStart[len]); len++) {
+        if (len < sizeof(name)-1) name[len] = toupper((unsigned char)pStart[len]);
+    }
+    if ((len == 0) || (len >= sizeof(name))) {
+        pComp->supported = false;
+        return;
+    }
+    name[len] = 0;
+    pComp->pos += len;
+    if ((len == 1) && (name[0] - 'A' < CALCPERFORM_NARGS)) {
+        /* Bind the argument to its slot */
+        triggerEmit(pComp, TRIGGER_OP_ARG, name[0] - 'A', 0., 1);
+        return;
+    }
+    if      (strcmp(name, "ABS") == 0) opcode = TRIGGER_OP_ABS;
+    else if (strcmp(name, "MIN") == 0) opcode = TRIGGER_OP_MIN;
+    else if (strcmp(name, "MAX") == 0) opcode = TRIGGER_OP_MAX;
+    else {
+        pComp->supported = false;
+        return;
+    }
+    if (!triggerAccept(pComp, "(")) {
+        pComp->supported = false;
+        return;
+    }
+    nArgs = 0;
+    do {
+        triggerCond(pComp);
+        nArgs++;
+    } while (pComp->supported && triggerAccept(pComp, ","));
+    if (!triggerAccept(pComp, ")") || ((opcode == TRIGGER_OP_ABS) && (nArgs != 1))) {
+        pComp->supported = false;
+        return;
+    }
+    triggerEmit(pComp, opcode, nArgs, 0., 1 - nArgs);
+}
+
+static void triggerUnary(triggerCompiler *pComp)
+{
+    if (triggerAccept(pComp, "-")) {
+        triggerUnary(pComp);
+        triggerEmit(pComp, TRIGGER_OP_NEG, 0, 0., 0);
+    } else if (triggerAccept(pComp, "+")) {
+        triggerUnary(pComp);
+    } else if (triggerAccept(pComp, "!")) {
+        triggerUnary(pComp);
+        triggerEmit(pComp, TRIGGER_OP_NOT, 0, 0., 0);
+    } else {
+        triggerPrimary(pComp);
+    }
+}
+
+static void triggerProduct(triggerCompiler *pComp)
+{
+    triggerUnary(pComp);
+    while (pComp->supported) {
+        if (triggerAccept(pComp, "**")) {
+            pComp->supported = false;
+        } else if (triggerAccept(pComp, "*")) {
+            triggerUnary(pComp);
+            triggerEmit(pComp, TRIGGER_OP_MUL, 0, 0., -1);
+        } else if (triggerAccept(pComp, "/")) {
+            triggerUnary(pComp);
+            triggerEmit(pComp, TRIGGER_OP_DIV, 0, 0., -1);
+        } else {
+            break;
+        }
+    }
+}
+
+static void triggerSum(triggerCompiler *pComp)
+{
+    triggerProduct(pComp);
+    while (pComp->supported) {
+        if (triggerAccept(pComp, "+")) {
+            triggerProduct(pComp);
+            triggerEmit(pComp, TRIGGER_OP_ADD, 0, 0., -1);
+        } else if (triggerAccept(pComp, "-")) {
+            triggerProduct(pComp);
+            triggerEmit(pComp, TRIGGER_OP_SUB, 0, 0., -1);
+        } else {
+            break;
+        }
+    }
+}
+
+static void triggerCompare(triggerCompiler *pComp)
+{
+    int opcode;
+    bool relational = false, equality = false;
+
+    triggerSum(pComp);
+    while (pComp->supported) {
+        /* Longer operators are tested first, shifts and assignment are left to calcPerform */
+        if      (triggerAccept(pComp, "<<") || triggerAccept(pComp, ">>") ||
+                 triggerAccept(pComp, ":=")) { pComp->supported = false; break; }
+        else if (triggerAccept(pComp, "<=")) opcode = TRIGGER_OP_LE;
+        else if (triggerAccept(pComp, ">=")) opcode = TRIGGER_OP_GE;
+        else if (triggerAccept(pComp, "==")) opcode = TRIGGER_OP_EQ;
+        else if (triggerAccept(pComp, "!=")) opcode = TRIGGER_OP_NE;
+        else if (triggerAccept(pComp, "<"))  opcode = TRIGGER_OP_LT;
+        else if (triggerAccept(pComp, ">"))  opcode = TRIGGER_OP_GT;
+        else if (triggerAccept(pComp, "="))  opcode = TRIGGER_OP_EQ;
+        else if (triggerAccept(pComp, "#"))  opcode = TRIGGER_OP_NE;
+        else break;
+        if ((opcode == TRIGGER_OP_EQ) || (opcode == TRIGGER_OP_NE)) equality = true;
+        else relational = true;
+        if (relational && equality) {
+            pComp->supported = false;
+            break;
+        }
+        triggerSum(pComp);
+        triggerEmit(pComp, opcode, 0, 0., -1);
+    }
+}
+
+static void triggerAnd(triggerCompiler *pComp)
+{
+    triggerCompare(pComp);
+    while (pComp->supported && triggerAccept(pComp, "&&")) {
+        triggerCompare(pComp);
+        triggerEmit(pComp, TRIGGER_OP_AND, 0, 0., -1);
+    }
+}
+
+static void triggerOr(triggerCompiler *pComp)
+{
+    triggerAnd(pComp);
+    while (pComp->supported && triggerAccept(pComp, "||")) {
+        triggerAnd(pComp);
+        triggerEmit(pComp, TRIGGER_OP_OR, 0, 0., -1);
+    }
+}
+
+static void triggerCond(triggerCompiler *pComp)
+{
+    int jumpFalse, jump;
+
+    triggerOr(pComp);
+    if (!pComp->supported || !triggerAccept(pComp, "?")) return;
+    jumpFalse = triggerEmit(pComp, TRIGGER_OP_JUMP_FALSE, 0, 0., -1);
+    triggerCond(pComp);
+    if (!triggerAccept(pComp, ":")) {
+        pComp->supported = false;
+        return;
+    }
+    /* Each branch leaves one value on the stack */
+    jump = triggerEmit(pComp, TRIGGER_OP_JUMP, 0, 0., -1);
+    if (jumpFalse >= 0) pComp->ops[jumpFalse].operand = pComp->numOps;
+    triggerCond(pComp);
+    if (jump >= 0) pComp->ops[jump].operand = pComp->numOps;
+}
+
+/** Compiles a trigger calculation into instructions that read the arguments from their slots.
+  * \param[in] infix  The trigger calculation expression, which postfix() has accepted.
+  * \param[out] ops  The instructions.
+  * \return The number of instructions, or 0 if the expression uses syntax the compiler does not handle. */
+int NDPluginCircularBuff::compileTriggerOps(const char *infix, NDCircBuffTriggerOp *ops)
+{
+    triggerCompiler comp;
+
+    comp.pos = infix;
+    comp.ops = ops;
+    comp.numOps = 0;
+    comp.depth = 0;
+    comp.supported = true;
+    triggerCond(&comp);
+    triggerSkipSpace(&comp);
+    if (!comp.supported || (*comp.pos != 0) || (comp.depth != 1)) return 0;
+    return comp.numOps;
+}
+
+/** Truth value of an operand of ! && ||; like calcPerform only the integer part counts */
+static bool triggerTrue(double value)
+{
+    return (value >= 1.) || (value <= -1.);
+}
+
+/** Evaluates a compiled trigger calculation.
+  * \param[in] ops  The instructions.
+  * \param[in] numOps  The number of instructions.
+  * \param[in] args  The argument slots A-L.
+  * \return The result of the calculation. */
+double NDPluginCircularBuff::evaluateTriggerOps(const NDCircBuffTriggerOp *ops, int numOps, const double *args)
+{
+    double stack[TRIGGER_STACK_SIZE];
+    double value;
+    int top = -1;
+    int pc, i;
+
+    for (pc = 0; pc < numOps; pc++) {
+        const NDCircBuffTriggerOp *pOp = &ops[pc];
+        switch (pOp->opcode) {
+            case TRIGGER_OP_CONST:  stack[++top] = pOp->value; break;
+            case TRIGGER_OP_ARG:    stack[++top] = args[pOp->operand]; break;
+            case TRIGGER_OP_NEG:    stack[top] = -stack[top]; break;
+            case TRIGGER_OP_NOT:    stack[top] = !triggerTrue(stack[top]); break;
+            case TRIGGER_OP_ABS:    stack[top] = fabs(stack[top]); break;
+            case TRIGGER_OP_ADD:    top--; stack[top] = stack[top] + stack[top+1]; break;
+            case TRIGGER_OP_SUB:    top--; stack[top] = stack[top] - stack[top+1]; break;
+            case TRIGGER_OP_MUL:    top--; stack[top] = stack[top] * stack[top+1]; break;
+            case TRIGGER_OP_DIV:    top--; stack[top] = stack[top] / stack[top+1]; break;
+            case TRIGGER_OP_LT:     top--; stack[top] = stack[top] <  stack[top+1]; break;
+            case TRIGGER_OP_LE:     top--; stack[top] = stack[top] <= stack[top+1]; break;
+            case TRIGGER_OP_GT:     top--; stack[top] = stack[top] >  stack[top+1]; break;
+            case TRIGGER_OP_GE:     top--; stack[top] = stack[top] >= stack[top+1]; break;
+            case TRIGGER_OP_EQ:     top--; stack[top] = stack[top] == stack[top+1]; break;
+            case TRIGGER_OP_NE:     top--; stack[top] = stack[top] != stack[top+1]; break;
+            case TRIGGER_OP_AND:    top--; stack[top] = triggerTrue(stack[top]) && triggerTrue(stack[top+1]); break;
+            case TRIGGER_OP_OR:     top--; stack[top] = triggerTrue(stack[top]) || triggerTrue(stack[top+1]); break;
+            case TRIGGER_OP_MIN:
+            case TRIGGER_OP_MAX:
+                /* NaN arguments propagate to the result, as in calcPerform */
+                top -= pOp->operand - 1;
+                value = stack[top];
+                for (i = 1; i < pOp->operand; i++) {
+                    if (isnan(stack[top+i]) ||
+                        ((pOp->opcode == TRIGGER_OP_MIN) ? (stack[top+i] < value) : (stack[top+i] > value)))
+                        value = stack[top+i];
+                }
+                stack[top] = value;
+                break;
+            case TRIGGER_OP_JUMP:
+                pc = pOp->operand - 1;
+                break;
+            case TRIGGER_OP_JUMP_FALSE:
+                if (stack[top--] == 0.) pc = pOp->operand - 1;
+                break;
+        }
+    }
+    return stack[0];
+}
+
+/** Compiles the trigger calculation expression.
+  * The expression is checked with postfix() and compiled into instructions that read the
+  * arguments from their slots in triggerCalcArgs_, so calculateTrigger does not run the calc
+  * interpreter for each NDArray.  Expressions that use calc syntax the compiler does not handle
+  * are evaluated with calcPerform.  The arguments the expression uses are recorded so that
+  * calculateTrigger only looks up the trigger attributes and computes the region statistics that
+  * the expression needs.  An expression that uses no arguments is evaluated here, once.
+  * \param[in] infix  The trigger calculation expression.
+  */
+asynStatus NDPluginCircularBuff::compileTrigger(const char *infix)
+{
+    short postfixError;
+    unsigned long stores;
+    double args[CALCPERFORM_NARGS];
+    int i;
+    static const char *functionName="compileTrigger";
+
+    triggerCalcValid_ = false;
+    triggerCalcNumOps_ = 0;
+    triggerCalcInputs_ = 0;
+    triggerCalcConstant_ = false;
+    strncpy(triggerCalcInfix_, infix, sizeof(triggerCalcInfix_));
+    triggerCalcInfix_[sizeof(triggerCalcInfix_)-1] = 0;
+    if (postfix(triggerCalcInfix_, triggerCalcPostfix_, &postfixError)) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error processing infix expression=%s, error=%s\n",
+            driverName, functionName, triggerCalcInfix_, calcErrorStr(postfixError));
+        return asynError;
+    }
+    if (calcArgUsage(triggerCalcPostfix_, &triggerCalcInputs_, &stores)) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error checking arguments of expression=%s\n",
+            driverName, functionName, triggerCalcInfix_);
+        return asynError;
+    }
+    triggerCalcValid_ = true;
+    for (i=0; i<CALCPERFORM_NARGS; i++) triggerCalcArgs_[i] = 0.;
+    if (stores == 0) {
+        triggerCalcNumOps_ = compileTriggerOps(triggerCalcInfix_, triggerCalcOps_);
+    }
+    if (triggerCalcNumOps_ == 0) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+            "%s::%s expression=%s is evaluated with calcPerform\n",
+            driverName, functionName, triggerCalcInfix_);
+    }
+    if ((triggerCalcInputs_ == 0) && (stores == 0)) {
+        for (i=0; i<CALCPERFORM_NARGS; i++) args[i] = 0.;
+        if (triggerCalcNumOps_ > 0) {
+            triggerCalcConstResult_ = evaluateTriggerOps(triggerCalcOps_, triggerCalcNumOps_, args);
+            triggerCalcConstant_ = true;
+        } else if (calcPerform(args, &triggerCalcConstResult_, triggerCalcPostfix_) == 0) {
+            triggerCalcConstant_ = true;
+        }
+    }
+    return asynSuccess;
+}
+
+/** Evaluates the trigger calculation for an array.
+  * The calculation arguments are A and B, the values of the TriggerA and TriggerB attributes,
+  * C to F, the pre-trigger count, post-trigger count, current image and triggered state, and
+  * G and H, the maximum and sum of the statistics region of the array.
+  * \param[in] pArray  The NDArray from the callback.
+  * \param[out] trig  1 if the calculation result is non-zero, otherwise 0.
+  */
 asynStatus NDPluginCircularBuff::calculateTrigger(NDArray *pArray, int *trig)
 {
     NDAttribute *trigger;
-    char triggerString[256];
     double triggerValue;
     double calcResult;
     int status;
     int preTrigger, postTrigger, currentImage, triggered;
+    int region[4];
+    double regionMax, regionSum;
     static const char *functionName="calculateTrigger";
     
     *trig = 0;
-    
-    getIntegerParam(NDCircBuffPreTrigger,   &preTrigger);
-    getIntegerParam(NDCircBuffPostTrigger,  &postTrigger);
-    getIntegerParam(NDCircBuffCurrentImage, &currentImage);
-    getIntegerParam(NDCircBuffTriggered,    &triggered);   
-
-    triggerCalcArgs_[0] = epicsNAN;
-    triggerCalcArgs_[1] = epicsNAN;
-    triggerCalcArgs_[2] = preTrigger;
-    triggerCalcArgs_[3] = postTrigger;
-    triggerCalcArgs_[4] = currentImage;
-    triggerCalcArgs_[5] = triggered;
-
-    getStringParam(NDCircBuffTriggerA, sizeof(triggerString), triggerString);
-    trigger = pArray->pAttributeList->find(triggerString);
-    if (trigger != NULL) {
-        status = trigger->getValue(NDAttrFloat64, &triggerValue);
-        if (status == asynSuccess) {
-            triggerCalcArgs_[0] = triggerValue;
+
+    if (!triggerCalcValid_) return asynError;
+
+    if (triggerCalcConstant_) {
+        calcResult = triggerCalcConstResult_;
+    } else {
+        getIntegerParam(NDCircBuffPreTrigger,   &preTrigger);
+        getIntegerParam(NDCircBuffPostTrigger,  &postTrigger);
+        getIntegerParam(NDCircBuffCurrentImage, &currentImage);
+        getIntegerParam(NDCircBuffTriggered,    &triggered);   
+
+        triggerCalcArgs_[0] = epicsNAN;
+        triggerCalcArgs_[1] = epicsNAN;
+        triggerCalcArgs_[2] = preTrigger;
+        triggerCalcArgs_[3] = postTrigger;
+        triggerCalcArgs_[4] = currentImage;
+        triggerCalcArgs_[5] = triggered;
+        triggerCalcArgs_[6] = epicsNAN;
+        triggerCalcArgs_[7] = epicsNAN;
+
+        if (triggerCalcInputs_ & TRIGGER_ARG_A) {
+            trigger = pArray->pAttributeList->find(triggerAName_);
+            if (trigger != NULL) {
+                status = trigger->getValue(NDAttrFloat64, &triggerValue);
+                if (status == asynSuccess) {
+                    triggerCalcArgs_[0] = triggerValue;
+                }
+            }
+            setDoubleParam(NDCircBuffTriggerAVal, triggerCalcArgs_[0]);
         }
-    }
-    getStringParam(NDCircBuffTriggerB, sizeof(triggerString), triggerString);
-    trigger = pArray->pAttributeList->find(triggerString);
-    if (trigger != NULL) {
-        status = trigger->getValue(NDAttrFloat64, &triggerValue);
-        if (status == asynSuccess) {
-            triggerCalcArgs_[1] = triggerValue;
+        if (triggerCalcInputs_ & TRIGGER_ARG_B) {
+            trigger = pArray->pAttributeList->find(triggerBName_);
+            if (trigger != NULL) {
+                status = trigger->getValue(NDAttrFloat64, &triggerValue);
+                if (status == asynSuccess) {
+                    triggerCalcArgs_[1] = triggerValue;
+                }
+            }
+            setDoubleParam(NDCircBuffTriggerBVal, triggerCalcArgs_[1]);
+        }
+        if (triggerCalcInputs_ & (TRIGGER_ARG_MAX | TRIGGER_ARG_SUM)) {
+            getIntegerParam(NDCircBuffStatDim0Min,  &region[0]);
+            getIntegerParam(NDCircBuffStatDim0Size, &region[1]);
+            getIntegerParam(NDCircBuffStatDim1Min,  &region[2]);
+            getIntegerParam(NDCircBuffStatDim1Size, &region[3]);
+            this->unlock();
+            status = regionStats(pArray, region, &regionMax, &regionSum);
+            this->lock();
+            if (status == asynSuccess) {
+                triggerCalcArgs_[6] = regionMax;
+                triggerCalcArgs_[7] = regionSum;
+            }
+            setDoubleParam(NDCircBuffStatMaxVal, triggerCalcArgs_[6]);
+            setDoubleParam(NDCircBuffStatSumVal, triggerCalcArgs_[7]);
+        }
+
+        if (triggerCalcNumOps_ > 0) {
+            calcResult = evaluateTriggerOps(triggerCalcOps_, triggerCalcNumOps_, triggerCalcArgs_);
+        } else if (calcPerform(triggerCalcArgs_, &calcResult, triggerCalcPostfix_)) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s error evaluating expression=%s\n",
+                driverName, functionName, triggerCalcInfix_);
+            return asynError;
         }
-    }
-    
-    setDoubleParam(NDCircBuffTriggerAVal, triggerCalcArgs_[0]);
-    setDoubleParam(NDCircBuffTriggerBVal, triggerCalcArgs_[1]);
-    status = calcPerform(triggerCalcArgs_, &calcResult, triggerCalcPostfix_);
-    if (status) {
-        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-            "%s::%s error evaluating expression=%s\n",
-            driverName, functionName, calcErrorStr(status));
-        return asynError;
     }
     
     if (!isnan(calcResult) && !isinf(calcResult) && (calcResult != 0)) *trig = 1;
@@ -82,12 +612,36 @@ asynStatus NDPluginCircularBuff::calculateTrigger(NDArray *pArray, int *trig)
 
     return asynSuccess;
 }
+
+/** Checks whether the pre-trigger ring can hold a reference to the driver's NDArray instead of a copy.
+  * Every array held in the ring is unavailable to the driver, so this is only allowed while the
+  * driver's NDArrayPool can still supply NDCircBuffDriverReserve arrays from its free list or
+  * within its maxBuffers and maxMemory limits.
+  * \param[in] pArray  The NDArray from the callback.
+  * \param[in] dataSize  The size of the array data in bytes.
+  */
+bool NDPluginCircularBuff::canHoldDriverArray(NDArray *pArray, size_t dataSize)
+{
+    NDArrayPool *pPool = pArray->pNDArrayPool;
+    int driverReserve;
+    int numNeeded;
+
+    if (!pPool) return false;
+    getIntegerParam(NDCircBuffDriverReserve, &driverReserve);
+    numNeeded = driverReserve - pPool->numFree();
+    if (numNeeded <= 0) return true;
+    if ((pPool->maxBuffers() > 0) && (pPool->numBuffers() + numNeeded > pPool->maxBuffers())) return false;
+    if ((pPool->maxMemory() > 0) && (pPool->memorySize() + numNeeded*dataSize > pPool->maxMemory())) return false;
+    return true;
+}
     
 
 /** Callback function that is called by the NDArray driver with new NDArray data.
   * Stores the number of pre-trigger images prior to the trigger in a ring buffer.
   * Once the trigger has been received stores the number of post-trigger buffers
   * and then exposes the buffers.
+  * In zero-copy mode the ring holds references to the driver's arrays and the post-trigger arrays
+  * are passed straight through, so no data is copied unless the driver's pool runs short.
   * \param[in] pArray  The NDArray from the callback.
   */
 void NDPluginCircularBuff::processCallbacks(NDArray *pArray)
@@ -98,6 +652,7 @@ void NDPluginCircularBuff::processCallbacks(NDArray *pArray)
      */
     int scopeControl, preCount, postCount, currentImage, currentPostCount, softTrigger;
     int presetTriggerCount, actualTriggerCount;
+    int zeroCopy, copyFallbacks;
     NDArray *pArrayCpy = NULL;
     NDArrayInfo arrayInfo;
     int triggered = 0;
@@ -119,6 +674,7 @@ void NDPluginCircularBuff::processCallbacks(NDArray *pArray)
     getIntegerParam(NDCircBuffPresetTriggerCount, &presetTriggerCount);
     getIntegerParam(NDCircBuffPresetTriggerCount, &presetTriggerCount);
     getIntegerParam(NDCircBuffActualTriggerCount, &actualTriggerCount);
+    getIntegerParam(NDCircBuffZeroCopy,           &zeroCopy);
 
     // Are we running?
     if (scopeControl) {
@@ -136,8 +692,19 @@ void NDPluginCircularBuff::processCallbacks(NDArray *pArray)
         }
       }
 
-      // First copy the buffer into our buffer pool so we can release the resource on the driver
-      pArrayCpy = this->pNDArrayPool->copy(pArray, NULL, 1);
+      if (zeroCopy && (triggered || canHoldDriverArray(pArray, arrayInfo.totalBytes))){
+        // Hold a reference to the driver's buffer.  Post-trigger arrays are released as soon as
+        // they have been passed on, so they never count against the driver's reserve.
+        pArray->reserve();
+        pArrayCpy = pArray;
+      } else {
+        if (zeroCopy){
+          getIntegerParam(NDCircBuffCopyFallbacks, &copyFallbacks);
+          setIntegerParam(NDCircBuffCopyFallbacks, ++copyFallbacks);
+        }
+        // Copy the buffer into our buffer pool so we can release the resource on the driver
+        pArrayCpy = this->pNDArrayPool->copy(pArray, NULL, 1);
+      }
 
       if (pArrayCpy){
 
@@ -174,6 +741,9 @@ void NDPluginCircularBuff::processCallbacks(NDArray *pArray)
                 doCallbacksGenericPointer(preBuffer_->readNext(), NDArrayData, 0);
                 this->lock();
               }
+              // Release the pre-trigger arrays so they are not held until the next trigger
+              preBuffer_->clear();
+              setIntegerParam(NDCircBuffCurrentImage, 0);
             }
           }
       
@@ -250,10 +820,15 @@ asynStatus NDPluginCircularBuff::writeInt32(asynUser *pasynUser, epicsInt32 valu
           setIntegerParam(NDCircBuffTriggered, 0);
           setIntegerParam(NDCircBuffPostCount, 0);
           setIntegerParam(NDCircBuffActualTriggerCount, 0);
+          setIntegerParam(NDCircBuffCopyFallbacks, 0);
           setStringParam(NDCircBuffStatus, "Buffer filling");
         } else {
           // Control is turned off, before we have finished
           // Set the trigger value off, reset counter
+          // Release the stored arrays, which may belong to the driver in zero-copy mode
+          if (preBuffer_){
+            preBuffer_->clear();
+          }
           setIntegerParam(NDCircBuffSoftTrigger, 0);
           setIntegerParam(NDCircBuffTriggered, 0);
           setIntegerParam(NDCircBuffCurrentImage, 0);
@@ -314,7 +889,6 @@ asynStatus NDPluginCircularBuff::writeOctet(asynUser *pasynUser, const char *val
   int addr=0;
   int function = pasynUser->reason;
   asynStatus status = asynSuccess;
-  short postfixError;
   const char *functionName = "writeOctet";
 
   status = getAddress(pasynUser, &addr); if (status != asynSuccess) return(status);
@@ -323,15 +897,16 @@ asynStatus NDPluginCircularBuff::writeOctet(asynUser *pasynUser, const char *val
   if (status != asynSuccess) return(status);
 
   if (function == NDCircBuffTriggerCalc){
-    if (nChars > sizeof(triggerCalcInfix_)) nChars = sizeof(triggerCalcInfix_);
-    strncpy(triggerCalcInfix_, value, nChars);
-    status = (asynStatus)postfix(triggerCalcInfix_, triggerCalcPostfix_, &postfixError);
-    if (status) {
-      asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-      "%s::%s error processing infix expression=%s, error=%s\n",
-      driverName, functionName, triggerCalcInfix_, calcErrorStr(postfixError));
-    }
+    status = compileTrigger(value);
   } 
+  else if (function == NDCircBuffTriggerA) {
+    strncpy(triggerAName_, value, sizeof(triggerAName_));
+    triggerAName_[sizeof(triggerAName_)-1] = 0;
+  }
+  else if (function == NDCircBuffTriggerB) {
+    strncpy(triggerBName_, value, sizeof(triggerBName_));
+    triggerBName_[sizeof(triggerBName_)-1] = 0;
+  }
   
   else if (function < FIRST_NDPLUGIN_CIRC_BUFF_PARAM) {
       /* If this parameter belongs to a base class call its method */
@@ -406,6 +981,15 @@ NDPluginCircularBuff::NDPluginCircularBuff(const char *portName, int queueSize,
     createParam(NDCircBuffPostCountString,          asynParamInt32,      &NDCircBuffPostCount);
     createParam(NDCircBuffSoftTriggerString,        asynParamInt32,      &NDCircBuffSoftTrigger);
     createParam(NDCircBuffTriggeredString,          asynParamInt32,      &NDCircBuffTriggered);
+    createParam(NDCircBuffZeroCopyString,           asynParamInt32,      &NDCircBuffZeroCopy);
+    createParam(NDCircBuffDriverReserveString,      asynParamInt32,      &NDCircBuffDriverReserve);
+    createParam(NDCircBuffCopyFallbacksString,      asynParamInt32,      &NDCircBuffCopyFallbacks);
+    createParam(NDCircBuffStatDim0MinString,        asynParamInt32,      &NDCircBuffStatDim0Min);
+    createParam(NDCircBuffStatDim0SizeString,       asynParamInt32,      &NDCircBuffStatDim0Size);
+    createParam(NDCircBuffStatDim1MinString,        asynParamInt32,      &NDCircBuffStatDim1Min);
+    createParam(NDCircBuffStatDim1SizeString,       asynParamInt32,      &NDCircBuffStatDim1Size);
+    createParam(NDCircBuffStatMaxValString,         asynParamFloat64,    &NDCircBuffStatMaxVal);
+    createParam(NDCircBuffStatSumValString,         asynParamFloat64,    &NDCircBuffStatSumVal);
 
     // Set the plugin type string
     setStringParam(NDPluginDriverPluginType, "NDPluginCircularBuff");
@@ -428,8 +1012,22 @@ NDPluginCircularBuff::NDPluginCircularBuff(const char *portName, int queueSize,
     setIntegerParam(NDCircBuffPresetTriggerCount, 1);
     setIntegerParam(NDCircBuffActualTriggerCount, 0);
     
+    // Copy the arrays by default, leave the driver 10 arrays when holding its arrays
+    setIntegerParam(NDCircBuffZeroCopy, 0);
+    setIntegerParam(NDCircBuffDriverReserve, 10);
+    setIntegerParam(NDCircBuffCopyFallbacks, 0);
+
     // Set the trigger calculation to "0" which will not trigger
     setStringParam(NDCircBuffTriggerCalc, "0");
+    compileTrigger("0");
+    triggerAName_[0] = 0;
+    triggerBName_[0] = 0;
+
+    // The statistics region defaults to the whole array
+    setIntegerParam(NDCircBuffStatDim0Min, 0);
+    setIntegerParam(NDCircBuffStatDim0Size, 0);
+    setIntegerParam(NDCircBuffStatDim1Min, 0);
+    setIntegerParam(NDCircBuffStatDim1Size, 0);
 
     // Enable ArrayCallbacks.  
     // This plugin currently ignores this setting and always does callbacks, so make the setting reflect the behavior
@@ -24,7 +24,25 @@
 #define NDCircBuffPostCountString           "CIRC_BUFF_POST_COUNT"            /* (asynInt32,        r/o) Number of the current post count image */
 #define NDCircBuffSoftTriggerString         "CIRC_BUFF_SOFT_TRIGGER"          /* (asynInt32,        r/w) Force a soft trigger */
 #define NDCircBuffTriggeredString           "CIRC_BUFF_TRIGGERED"             /* (asynInt32,        r/o) Have we had a trigger event */
+#define NDCircBuffZeroCopyString            "CIRC_BUFF_ZERO_COPY"             /* (asynInt32,        r/w) Hold the driver's arrays rather than copies */
+#define NDCircBuffDriverReserveString       "CIRC_BUFF_DRIVER_RESERVE"        /* (asynInt32,        r/w) Arrays the driver's pool must keep available */
+#define NDCircBuffCopyFallbacksString       "CIRC_BUFF_COPY_FALLBACKS"        /* (asynInt32,        r/o) Arrays copied in zero-copy mode to protect the driver */
+#define NDCircBuffStatDim0MinString         "CIRC_BUFF_STAT_DIM0_MIN"         /* (asynInt32,        r/w) Start of trigger statistics region in X */
+#define NDCircBuffStatDim0SizeString        "CIRC_BUFF_STAT_DIM0_SIZE"        /* (asynInt32,        r/w) Size of trigger statistics region in X, 0=all */
+#define NDCircBuffStatDim1MinString         "CIRC_BUFF_STAT_DIM1_MIN"         /* (asynInt32,        r/w) Start of trigger statistics region in Y */
+#define NDCircBuffStatDim1SizeString        "CIRC_BUFF_STAT_DIM1_SIZE"        /* (asynInt32,        r/w) Size of trigger statistics region in Y, 0=all */
+#define NDCircBuffStatMaxValString          "CIRC_BUFF_STAT_MAX_VAL"          /* (asynFloat64,      r/o) Maximum in the region, trigger calc input G */
+#define NDCircBuffStatSumValString          "CIRC_BUFF_STAT_SUM_VAL"          /* (asynFloat64,      r/o) Sum of the region, trigger calc input H */
 
+/** Maximum number of instructions in the compiled trigger calculation */
+#define NDCircBuffMaxTriggerOps 100
+
+/** An instruction of the compiled trigger calculation */
+typedef struct {
+    int opcode;         /**< The operation */
+    int operand;        /**< The argument slot, the number of function arguments or the jump target */
+    double value;       /**< The value pushed by a constant */
+} NDCircBuffTriggerOp;
 
 /** Performs a scope like capture.  Records a quantity
   * of pre-trigger and post-trigger images
@@ -39,6 +57,8 @@ public:
     void processCallbacks(NDArray *pArray);
     asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
     asynStatus writeOctet(asynUser *pasynUser, const char *value, size_t nChars, size_t *nActual);
+    static int compileTriggerOps(const char *infix, NDCircBuffTriggerOp *ops);
+    static double evaluateTriggerOps(const NDCircBuffTriggerOp *ops, int numOps, const double *args);
     
     //template <typename epicsType> asynStatus doProcessCircularBuffT(NDArray *pArray);
     //asynStatus doProcessCircularBuff(NDArray *pArray);
@@ -62,12 +82,23 @@ protected:
     int NDCircBuffPostCount;
     int NDCircBuffSoftTrigger;
     int NDCircBuffTriggered;
+    int NDCircBuffZeroCopy;
+    int NDCircBuffDriverReserve;
+    int NDCircBuffCopyFallbacks;
+    int NDCircBuffStatDim0Min;
+    int NDCircBuffStatDim0Size;
+    int NDCircBuffStatDim1Min;
+    int NDCircBuffStatDim1Size;
+    int NDCircBuffStatMaxVal;
+    int NDCircBuffStatSumVal;
 
-    #define LAST_NDPLUGIN_CIRC_BUFF_PARAM NDCircBuffTriggered
+    #define LAST_NDPLUGIN_CIRC_BUFF_PARAM NDCircBuffStatSumVal
                                 
 private:
 
+    asynStatus compileTrigger(const char *infix);
     asynStatus calculateTrigger(NDArray *pArray, int *trig);
+    bool canHoldDriverArray(NDArray *pArray, size_t dataSize);
     NDArrayRing *preBuffer_;
     NDArray *pOldArray_;
     int previousTrigger_;
@@ -75,6 +106,14 @@ private:
     char triggerCalcInfix_[MAX_INFIX_SIZE];
     char triggerCalcPostfix_[MAX_POSTFIX_SIZE];
     double triggerCalcArgs_[CALCPERFORM_NARGS];
+    NDCircBuffTriggerOp triggerCalcOps_[NDCircBuffMaxTriggerOps];
+    int triggerCalcNumOps_;             /**< Number of instructions in triggerCalcOps_, 0 to use calcPerform */
+    char triggerAName_[MAX_ATTRIBUTE_STRING_SIZE];  /**< Name of the TriggerA attribute */
+    char triggerBName_[MAX_ATTRIBUTE_STRING_SIZE];  /**< Name of the TriggerB attribute */
+    unsigned long triggerCalcInputs_;   /**< Mask of the arguments used by the trigger calculation */
+    bool triggerCalcValid_;             /**< The trigger calculation compiled without errors */
+    bool triggerCalcConstant_;          /**< The trigger calculation uses no arguments */
+    double triggerCalcConstResult_;     /**< The result of a constant trigger calculation */
 };
 #define NUM_NDPLUGIN_CIRC_BUFF_PARAMS ((int)(&LAST_NDPLUGIN_CIRC_BUFF_PARAM - &FIRST_NDPLUGIN_CIRC_BUFF_PARAM + 1))
     
@@ -11,7 +11,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include <epicsMutex.h>
 #include <epicsString.h>
@@ -22,478 +26,760 @@
 #include <epicsExport.h>
 #include "NDPluginDriver.h"
 #include "colorMaps.h"
-#ifdef HAVE_PVAPI
-  #include "PvApi.h"
-#endif
 #include "NDPluginColorConvert.h"
 
 static const char *driverName="NDPluginColorConvert";
 
-/* This function returns 1 if it did a conversion, 0 if it did not */
+/** colorConvertSSE2 is a global flag that controls whether the 8 and 16 bit unsigned conversions use
+  * the SSE2 instructions where the compiler supports them.  The default value is 1.  Set it to 0 to
+  * convert with the plain C++ loops, for example to compare the results of the two.
+  */
+volatile int colorConvertSSE2=1;
+extern "C" {epicsExportAddress(int, colorConvertSSE2);}
+
+typedef enum {
+    ColorOpNone,
+    ColorOpCopy,        /* Move the colors to another layout; mono is copied to all 3 colors */
+    ColorOpMono,        /* Average the 3 colors */
+    ColorOpFalseColor,  /* Look up the colors of 8-bit mono data in a false color map */
+    ColorOpBayer        /* Interpolate the 2 missing colors of each pixel of Bayer data */
+} NDColorOp_t;
+
+/** Where the elements of an image are in memory.
+  * Color c of pixel (x,y) is element c*color + x*xStep + y*yStep; color=0 for mono and Bayer images. */
+typedef struct {
+    ptrdiff_t color;
+    ptrdiff_t xStep;
+    ptrdiff_t yStep;
+} NDColorLayout_t;
+
+/** Describes one conversion.  Each stripe converts a range of rows of the image. */
+struct NDColorPlan {
+    const void *pIn;
+    void *pOut;
+    NDColorLayout_t in;
+    NDColorLayout_t out;
+    size_t xSize;
+    size_t ySize;
+    NDColorOp_t op;
+    const unsigned char *colorMap[3];
+    int firstChroma;    /**< Color of the pixels of row 0 that are not green; 0=red, 2=blue */
+    int firstGreen;     /**< x parity of the green pixels of row 0 */
+    bool edgeAware;     /**< Interpolate green along edges rather than averaging all 4 neighbors */
+    int numStripes;
+    void (*rowsFunc)(const NDColorPlan *p, size_t firstRow, size_t lastRow);
+    asynUser *pasynUser; /**< For reporting errors from the stripes */
+};
+
+static void colorLayout(int colorMode, size_t xSize, size_t ySize, NDColorLayout_t *pLayout)
+{
+    switch (colorMode) {
+        case NDColorModeRGB1:
+            pLayout->color = 1;
+            pLayout->xStep = 3;
+            pLayout->yStep = 3*xSize;
+            break;
+        case NDColorModeRGB2:
+            pLayout->color = xSize;
+            pLayout->xStep = 1;
+            pLayout->yStep = 3*xSize;
+            break;
+        case NDColorModeRGB3:
+            pLayout->color = xSize*ySize;
+            pLayout->xStep = 1;
+            pLayout->yStep = xSize;
+            break;
+        default:
+            pLayout->color = 0;
+            pLayout->xStep = 1;
+            pLayout->yStep = xSize;
+            break;
+    }
+}
+
+template <typename epicsType>
+static void interleavePixels(const epicsType *pRed, const epicsType *pGreen, const epicsType *pBlue,
+                             epicsType *pOut, size_t first, size_t n)
+{
+    for (size_t j=first; j<n; j++) {
+        pOut[3*j]   = pRed[j];
+        pOut[3*j+1] = pGreen[j];
+        pOut[3*j+2] = pBlue[j];
+    }
+}
+
+template <typename epicsType>
+static void deinterleavePixels(const epicsType *pIn, epicsType *pRed, epicsType *pGreen, epicsType *pBlue,
+                               size_t first, size_t n)
+{
+    for (size_t j=first; j<n; j++) {
+        pRed[j]   = pIn[3*j];
+        pGreen[j] = pIn[3*j+1];
+        pBlue[j]  = pIn[3*j+2];
+    }
+}
+
+/* The mono value is the average of the colors, truncated towards zero.  For the 8 and 16 bit types
+ * this is done with integer arithmetic, which gives the same result */
+template <typename epicsType>
+static inline epicsType monoPixel(epicsType red, epicsType green, epicsType blue)
+{
+    double value = (red + green + blue)/3.;
+    return (epicsType)value;
+}
+static inline epicsInt8 monoPixel(epicsInt8 red, epicsInt8 green, epicsInt8 blue)
+    { return (epicsInt8)(((int)red + green + blue)/3); }
+static inline epicsUInt8 monoPixel(epicsUInt8 red, epicsUInt8 green, epicsUInt8 blue)
+    { return (epicsUInt8)(((int)red + green + blue)/3); }
+static inline epicsInt16 monoPixel(epicsInt16 red, epicsInt16 green, epicsInt16 blue)
+    { return (epicsInt16)(((int)red + green + blue)/3); }
+static inline epicsUInt16 monoPixel(epicsUInt16 red, epicsUInt16 green, epicsUInt16 blue)
+    { return (epicsUInt16)(((int)red + green + blue)/3); }
+
+template <int step, typename epicsType>
+static void monoPixels(const epicsType *pRed, const epicsType *pGreen, const epicsType *pBlue,
+                       epicsType *pOut, size_t first, size_t n)
+{
+    for (size_t j=first; j<n; j++) {
+        pOut[j] = monoPixel(pRed[j*step], pGreen[j*step], pBlue[j*step]);
+    }
+}
+
+template <typename epicsType>
+static void interleaveRow(const epicsType *pRed, const epicsType *pGreen, const epicsType *pBlue,
+                          epicsType *pOut, size_t n)
+{
+    interleavePixels(pRed, pGreen, pBlue, pOut, 0, n);
+}
+
+template <typename epicsType>
+static void deinterleaveRow(const epicsType *pIn, epicsType *pRed, epicsType *pGreen, epicsType *pBlue,
+                            size_t n)
+{
+    deinterleavePixels(pIn, pRed, pGreen, pBlue, 0, n);
+}
+
+/** Mono row from the colors of RGB1 (step=3) or RGB2 and RGB3 (step=1) rows */
+template <typename epicsType>
+static void monoRow(const epicsType *pRed, const epicsType *pGreen, const epicsType *pBlue, ptrdiff_t step,
+                    epicsType *pOut, size_t n)
+{
+    if (step == 1) monoPixels<1>(pRed, pGreen, pBlue, pOut, 0, n);
+    else           monoPixels<3>(pRed, pGreen, pBlue, pOut, 0, n);
+}
+
+#ifdef __SSE2__
+/* SSE2 versions for the 8 and 16 bit unsigned types.  SSE2 has no byte shuffle, so the 3 colors are
+ * interleaved in 2 steps: each pair of neighboring pixels is first packed into 3 elements of twice
+ * the size, RG of the first pixel, B of the first and R of the second, and GB of the second, and these
+ * are then interleaved with 32-bit shuffles. */
+#define PICK2(a, i, b, j) _mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(j, j, i, i))
+#define PICK4(x, y)       _mm_castps_si128(_mm_shuffle_ps(x, y, _MM_SHUFFLE(2, 0, 2, 0)))
+
+/* Interleaves the 32-bit elements of a, b and c into 3 registers */
+static inline void interleave32x3(__m128i a, __m128i b, __m128i c, __m128i *pOut)
+{
+    _mm_storeu_si128(pOut,   PICK4(PICK2(a, 0, b, 0), PICK2(c, 0, a, 1)));
+    _mm_storeu_si128(pOut+1, PICK4(PICK2(b, 1, c, 1), PICK2(a, 2, b, 2)));
+    _mm_storeu_si128(pOut+2, PICK4(PICK2(c, 2, a, 3), PICK2(b, 3, c, 3)));
+}
+
+static inline void deinterleave32x3(const __m128i *pIn, __m128i *pA, __m128i *pB, __m128i *pC)
+{
+    __m128i v0 = _mm_loadu_si128(pIn);
+    __m128i v1 = _mm_loadu_si128(pIn+1);
+    __m128i v2 = _mm_loadu_si128(pIn+2);
+    *pA = PICK4(PICK2(v0, 0, v0, 3), PICK2(v1, 2, v2, 1));
+    *pB = PICK4(PICK2(v0, 1, v1, 0), PICK2(v1, 3, v2, 2));
+    *pC = PICK4(PICK2(v0, 2, v1, 1), PICK2(v2, 0, v2, 3));
+}
+
+/* Packs pairs of 16-bit pixels into the 32-bit elements RG, BR and GB, and back */
+static inline void pairPixels16(__m128i r, __m128i g, __m128i b, __m128i *pRG, __m128i *pBR, __m128i *pGB)
+{
+    const __m128i low = _mm_set1_epi32(0x0000FFFF);
+    *pRG = _mm_or_si128(_mm_and_si128(r, low), _mm_slli_epi32(g, 16));
+    *pBR = _mm_or_si128(_mm_and_si128(b, low), _mm_andnot_si128(low, r));
+    *pGB = _mm_or_si128(_mm_srli_epi32(g, 16), _mm_andnot_si128(low, b));
+}
+
+static inline void unpairPixels16(__m128i rg, __m128i br, __m128i gb, __m128i *pR, __m128i *pG, __m128i *pB)
+{
+    const __m128i low = _mm_set1_epi32(0x0000FFFF);
+    *pR = _mm_or_si128(_mm_and_si128(rg, low), _mm_andnot_si128(low, br));
+    *pG = _mm_or_si128(_mm_srli_epi32(rg, 16), _mm_slli_epi32(gb, 16));
+    *pB = _mm_or_si128(_mm_and_si128(br, low), _mm_andnot_si128(low, gb));
+}
+
+/* The same for 8-bit pixels and 16-bit elements */
+static inline void pairPixels8(__m128i r, __m128i g, __m128i b, __m128i *pRG, __m128i *pBR, __m128i *pGB)
+{
+    const __m128i low = _mm_set1_epi16(0x00FF);
+    *pRG = _mm_or_si128(_mm_and_si128(r, low), _mm_slli_epi16(g, 8));
+    *pBR = _mm_or_si128(_mm_and_si128(b, low), _mm_andnot_si128(low, r));
+    *pGB = _mm_or_si128(_mm_srli_epi16(g, 8), _mm_andnot_si128(low, b));
+}
+
+static inline void unpairPixels8(__m128i rg, __m128i br, __m128i gb, __m128i *pR, __m128i *pG, __m128i *pB)
+{
+    const __m128i low = _mm_set1_epi16(0x00FF);
+    *pR = _mm_or_si128(_mm_and_si128(rg, low), _mm_andnot_si128(low, br));
+    *pG = _mm_or_si128(_mm_srli_epi16(rg, 8), _mm_slli_epi16(gb, 8));
+    *pB = _mm_or_si128(_mm_and_si128(br, low), _mm_andnot_si128(low, gb));
+}
+
+/* Loads 8 RGB1 pixels of 16 bits, or 16 of 8 bits, as 3 color registers */
+static inline void loadRGB16(const epicsUInt16 *pIn, __m128i *pR, __m128i *pG, __m128i *pB)
+{
+    __m128i rg, br, gb;
+    deinterleave32x3((const __m128i *)pIn, &rg, &br, &gb);
+    unpairPixels16(rg, br, gb, pR, pG, pB);
+}
+
+static inline void loadRGB8(const epicsUInt8 *pIn, __m128i *pR, __m128i *pG, __m128i *pB)
+{
+    __m128i rg, br, gb;
+    loadRGB16((const epicsUInt16 *)pIn, &rg, &br, &gb);
+    unpairPixels8(rg, br, gb, pR, pG, pB);
+}
+
+template <>
+void interleaveRow<epicsUInt16>(const epicsUInt16 *pRed, const epicsUInt16 *pGreen, const epicsUInt16 *pBlue,
+                                epicsUInt16 *pOut, size_t n)
+{
+    __m128i rg, br, gb;
+    size_t j, vectorEnd = colorConvertSSE2 ? n : 0;
+    for (j=0; j+8<=vectorEnd; j+=8) {
+        pairPixels16(_mm_loadu_si128((const __m128i *)(pRed + j)), _mm_loadu_si128((const __m128i *)(pGreen + j)),
+                     _mm_loadu_si128((const __m128i *)(pBlue + j)), &rg, &br, &gb);
+        interleave32x3(rg, br, gb, (__m128i *)(pOut + 3*j));
+    }
+    interleavePixels(pRed, pGreen, pBlue, pOut, j, n);
+}
+
+template <>
+void interleaveRow<epicsUInt8>(const epicsUInt8 *pRed, const epicsUInt8 *pGreen, const epicsUInt8 *pBlue,
+                               epicsUInt8 *pOut, size_t n)
+{
+    __m128i rg, br, gb, rgbr, brgb, gbrg;
+    size_t j, vectorEnd = colorConvertSSE2 ? n : 0;
+    for (j=0; j+16<=vectorEnd; j+=16) {
+        pairPixels8(_mm_loadu_si128((const __m128i *)(pRed + j)), _mm_loadu_si128((const __m128i *)(pGreen + j)),
+                    _mm_loadu_si128((const __m128i *)(pBlue + j)), &rg, &br, &gb);
+        pairPixels16(rg, br, gb, &rgbr, &brgb, &gbrg);
+        interleave32x3(rgbr, brgb, gbrg, (__m128i *)(pOut + 3*j));
+    }
+    interleavePixels(pRed, pGreen, pBlue, pOut, j, n);
+}
+
+template <>
+void deinterleaveRow<epicsUInt16>(const epicsUInt16 *pIn, epicsUInt16 *pRed, epicsUInt16 *pGreen,
+                                  epicsUInt16 *pBlue, size_t n)
+{
+    __m128i r, g, b;
+    size_t j, vectorEnd = colorConvertSSE2 ? n : 0;
+    for (j=0; j+8<=vectorEnd; j+=8) {
+        loadRGB16(pIn + 3*j, &r, &g, &b);
+        _mm_storeu_si128((__m128i *)(pRed + j), r);
+        _mm_storeu_si128((__m128i *)(pGreen + j), g);
+        _mm_storeu_si128((__m128i *)(pBlue + j), b);
+    }
+    deinterleavePixels(pIn, pRed, pGreen, pBlue, j, n);
+}
+
+template <>
+void deinterleaveRow<epicsUInt8>(const epicsUInt8 *pIn, epicsUInt8 *pRed, epicsUInt8 *pGreen,
+                                 epicsUInt8 *pBlue, size_t n)
+{
+    __m128i r, g, b;
+    size_t j, vectorEnd = colorConvertSSE2 ? n : 0;
+    for (j=0; j+16<=vectorEnd; j+=16) {
+        loadRGB8(pIn + 3*j, &r, &g, &b);
+        _mm_storeu_si128((__m128i *)(pRed + j), r);
+        _mm_storeu_si128((__m128i *)(pGreen + j), g);
+        _mm_storeu_si128((__m128i *)(pBlue + j), b);
+    }
+    deinterleavePixels(pIn, pRed, pGreen, pBlue, j, n);
+}
+
+/* (r+g+b)/3 of 16 8-bit pixels; x/3 = (x*0xAAAB)>>17 for all 16-bit x */
+static inline __m128i mono8(__m128i r, __m128i g, __m128i b)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i third = _mm_set1_epi16((short)0xAAAB);
+    __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(r, zero), _mm_unpacklo_epi8(g, zero)),
+                               _mm_unpacklo_epi8(b, zero));
+    __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(r, zero), _mm_unpackhi_epi8(g, zero)),
+                               _mm_unpackhi_epi8(b, zero));
+    lo = _mm_srli_epi16(_mm_mulhi_epu16(lo, third), 1);
+    hi = _mm_srli_epi16(_mm_mulhi_epu16(hi, third), 1);
+    return _mm_packus_epi16(lo, hi);
+}
+
+/* (r+g+b)/3 of 8 16-bit pixels.  The sums have up to 18 bits, they are divided in single precision,
+ * which is exact when 1/2 is added first, and packed back to 16 bits with a signed pack of x-32768. */
+static inline __m128i mono16(__m128i r, __m128i g, __m128i b)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi32(32768);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 third = _mm_set1_ps(1.f/3.f);
+    __m128i lo = _mm_add_epi32(_mm_add_epi32(_mm_unpacklo_epi16(r, zero), _mm_unpacklo_epi16(g, zero)),
+                               _mm_unpacklo_epi16(b, zero));
+    __m128i hi = _mm_add_epi32(_mm_add_epi32(_mm_unpackhi_epi16(r, zero), _mm_unpackhi_epi16(g, zero)),
+                               _mm_unpackhi_epi16(b, zero));
+    lo = _mm_cvttps_epi32(_mm_mul_ps(_mm_add_ps(_mm_cvtepi32_ps(lo), half), third));
+    hi = _mm_cvttps_epi32(_mm_mul_ps(_mm_add_ps(_mm_cvtepi32_ps(hi), half), third));
+    return _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(lo, bias), _mm_sub_epi32(hi, bias)),
+                         _mm_set1_epi16((short)0x8000));
+}
+
+template <>
+void monoRow<epicsUInt8>(const epicsUInt8 *pRed, const epicsUInt8 *pGreen, const epicsUInt8 *pBlue, ptrdiff_t step,
+                         epicsUInt8 *pOut, size_t n)
+{
+    __m128i r, g, b;
+    size_t j, vectorEnd = colorConvertSSE2 ? n : 0;
+    for (j=0; j+16<=vectorEnd; j+=16) {
+        if (step == 1) {
+            r = _mm_loadu_si128((const __m128i *)(pRed + j));
+            g = _mm_loadu_si128((const __m128i *)(pGreen + j));
+            b = _mm_loadu_si128((const __m128i *)(pBlue + j));
+        } else {
+            loadRGB8(pRed + 3*j, &r, &g, &b);
+        }
+        _mm_storeu_si128((__m128i *)(pOut + j), mono8(r, g, b));
+    }
+    if (step == 1) monoPixels<1>(pRed, pGreen, pBlue, pOut, j, n);
+    else           monoPixels<3>(pRed, pGreen, pBlue, pOut, j, n);
+}
+
+template <>
+void monoRow<epicsUInt16>(const epicsUInt16 *pRed, const epicsUInt16 *pGreen, const epicsUInt16 *pBlue, ptrdiff_t step,
+                          epicsUInt16 *pOut, size_t n)
+{
+    __m128i r, g, b;
+    size_t j, vectorEnd = colorConvertSSE2 ? n : 0;
+    for (j=0; j+8<=vectorEnd; j+=8) {
+        if (step == 1) {
+            r = _mm_loadu_si128((const __m128i *)(pRed + j));
+            g = _mm_loadu_si128((const __m128i *)(pGreen + j));
+            b = _mm_loadu_si128((const __m128i *)(pBlue + j));
+        } else {
+            loadRGB16(pRed + 3*j, &r, &g, &b);
+        }
+        _mm_storeu_si128((__m128i *)(pOut + j), mono16(r, g, b));
+    }
+    if (step == 1) monoPixels<1>(pRed, pGreen, pBlue, pOut, j, n);
+    else           monoPixels<3>(pRed, pGreen, pBlue, pOut, j, n);
+}
+#endif
+
+/* Average of 2 values, rounded up for the integer types.  The interpolation of 4 values is done as the
+ * average of 2 averages, which is what the SSE2 pavgb and pavgw instructions compute. */
+template <typename epicsType>
+static inline epicsType bayerAvg(epicsType a, epicsType b)
+{
+    return (epicsType)floor((a + (double)b + 1.) * 0.5);
+}
+template <>
+inline epicsFloat32 bayerAvg(epicsFloat32 a, epicsFloat32 b)
+{
+    return (epicsFloat32)((a + (double)b) * 0.5);
+}
+template <>
+inline epicsFloat64 bayerAvg(epicsFloat64 a, epicsFloat64 b)
+{
+    return (a + b) * 0.5;
+}
+
+/** Green at a red or blue pixel.  Bilinear interpolation averages the 4 neighbors; edge-aware
+  * interpolation uses the pair of neighbors with the smaller difference, which does not smear
+  * color across horizontal and vertical edges. */
+template <typename epicsType>
+static inline epicsType bayerGreen(epicsType left, epicsType right, epicsType up, epicsType down,
+                                   epicsType horizontal, epicsType vertical, bool edgeAware)
+{
+    if (edgeAware) {
+        double dH = fabs((double)left - right);
+        double dV = fabs((double)up - down);
+        if (dH < dV) return horizontal;
+        if (dV < dH) return vertical;
+    }
+    return bayerAvg(horizontal, vertical);
+}
+
+/** Interpolates pixels first to last-1 of a row of Bayer data.  pChroma receives the color of the
+  * row that is not green, pOther the other one; the outputs of successive pixels are step elements
+  * apart.  Pixels beyond the edges of the image are the mirror images of the pixels inside it, which
+  * have the same color. */
+template <typename epicsType>
+static void bayerPixels(const epicsType *pUp, const epicsType *pCur, const epicsType *pDown, size_t n,
+                        int greenParity, bool edgeAware, epicsType *pChroma, epicsType *pGreen,
+                        epicsType *pOther, size_t first, size_t last, ptrdiff_t step = 1)
+{
+    for (size_t x=first; x<last; x++) {
+        size_t xl = (x > 0) ? x-1 : 1;
+        size_t xr = (x+1 < n) ? x+1 : n-2;
+        epicsType horizontal = bayerAvg(pCur[xl], pCur[xr]);
+        epicsType vertical = bayerAvg(pUp[x], pDown[x]);
+        if ((int)(x & 1) == greenParity) {
+            pChroma[x*step] = horizontal;
+            pGreen[x*step]  = pCur[x];
+            pOther[x*step]  = vertical;
+        } else {
+            pChroma[x*step] = pCur[x];
+            pGreen[x*step]  = bayerGreen(pCur[xl], pCur[xr], pUp[x], pDown[x], horizontal, vertical, edgeAware);
+            pOther[x*step]  = bayerAvg(bayerAvg(pUp[xl], pUp[xr]), bayerAvg(pDown[xl], pDown[xr]));
+        }
+    }
+}
+
+template <typename epicsType>
+static void bayerRow(const epicsType *pUp, const epicsType *pCur, const epicsType *pDown, size_t n,
+                     int greenParity, bool edgeAware, epicsType *pChroma, epicsType *pGreen, epicsType *pOther)
+{
+    bayerPixels(pUp, pCur, pDown, n, greenParity, edgeAware, pChroma, pGreen, pOther, 0, n);
+}
+
+#ifdef __SSE2__
+/* The SSE2 operations for 8 and 16 bit unsigned Bayer data */
+struct NDBayerSSE2UInt8 {
+    typedef epicsUInt8 type;
+    enum { lanes = 16 };
+    static __m128i avg(__m128i a, __m128i b)  { return _mm_avg_epu8(a, b); }
+    static __m128i subs(__m128i a, __m128i b) { return _mm_subs_epu8(a, b); }
+    static __m128i isZero(__m128i a)          { return _mm_cmpeq_epi8(a, _mm_setzero_si128()); }
+    static __m128i evenLanes()                { return _mm_set1_epi16(0x00FF); }
+};
+
+struct NDBayerSSE2UInt16 {
+    typedef epicsUInt16 type;
+    enum { lanes = 8 };
+    static __m128i avg(__m128i a, __m128i b)  { return _mm_avg_epu16(a, b); }
+    static __m128i subs(__m128i a, __m128i b) { return _mm_subs_epu16(a, b); }
+    static __m128i isZero(__m128i a)          { return _mm_cmpeq_epi16(a, _mm_setzero_si128()); }
+    static __m128i evenLanes()                { return _mm_set1_epi32(0x0000FFFF); }
+};
+
+/* Selects a where mask is set and b elsewhere */
+static inline __m128i blend(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+/** Interpolates the pixels of a row from pixel 1, all the colors of a whole register at a time.
+  * All of the interpolations are computed for every pixel, and the green mask selects the ones that
+  * apply to each.  Returns the first pixel that was not done. */
+template <class ops>
+static size_t bayerRowSSE2(const typename ops::type *pUp, const typename ops::type *pCur,
+                           const typename ops::type *pDown, size_t n, int greenParity, bool edgeAware,
+                           typename ops::type *pChroma, typename ops::type *pGreen, typename ops::type *pOther)
+{
+    /* Lane k holds pixel 1+k, so the even lanes hold the pixels with odd x */
+    __m128i greenMask = ops::evenLanes();
+    size_t x;
+
+    if (greenParity == 0) greenMask = _mm_xor_si128(greenMask, _mm_set1_epi32(-1));
+    for (x=1; x+ops::lanes < n; x+=ops::lanes) {
+        __m128i left   = _mm_loadu_si128((const __m128i *)(pCur + x - 1));
+        __m128i center = _mm_loadu_si128((const __m128i *)(pCur + x));
+        __m128i right  = _mm_loadu_si128((const __m128i *)(pCur + x + 1));
+        __m128i up     = _mm_loadu_si128((const __m128i *)(pUp + x));
+        __m128i down   = _mm_loadu_si128((const __m128i *)(pDown + x));
+        __m128i diagUp   = ops::avg(_mm_loadu_si128((const __m128i *)(pUp + x - 1)),
+                                    _mm_loadu_si128((const __m128i *)(pUp + x + 1)));
+        __m128i diagDown = ops::avg(_mm_loadu_si128((const __m128i *)(pDown + x - 1)),
+                                    _mm_loadu_si128((const __m128i *)(pDown + x + 1)));
+        __m128i horizontal = ops::avg(left, right);
+        __m128i vertical   = ops::avg(up, down);
+        __m128i green      = ops::avg(horizontal, vertical);
+        if (edgeAware) {
+            __m128i dH = _mm_or_si128(ops::subs(left, right), ops::subs(right, left));
+            __m128i dV = _mm_or_si128(ops::subs(up, down), ops::subs(down, up));
+            /* hNotLarger is set where dH<=dV, vNotLarger where dV<=dH */
+            __m128i hNotLarger = ops::isZero(ops::subs(dH, dV));
+            __m128i vNotLarger = ops::isZero(ops::subs(dV, dH));
+            green = blend(hNotLarger, blend(vNotLarger, green, horizontal), vertical);
+        }
+        _mm_storeu_si128((__m128i *)(pChroma + x), blend(greenMask, horizontal, center));
+        _mm_storeu_si128((__m128i *)(pGreen + x),  blend(greenMask, center, green));
+        _mm_storeu_si128((__m128i *)(pOther + x),  blend(greenMask, vertical, ops::avg(diagUp, diagDown)));
+    }
+    return x;
+}
+
+template <>
+void bayerRow<epicsUInt8>(const epicsUInt8 *pUp, const epicsUInt8 *pCur, const epicsUInt8 *pDown, size_t n,
+                          int greenParity, bool edgeAware, epicsUInt8 *pChroma, epicsUInt8 *pGreen,
+                          epicsUInt8 *pOther)
+{
+    size_t x;
+    bayerPixels(pUp, pCur, pDown, n, greenParity, edgeAware, pChroma, pGreen, pOther, 0, 1);
+    x = colorConvertSSE2 ?
+        bayerRowSSE2<NDBayerSSE2UInt8>(pUp, pCur, pDown, n, greenParity, edgeAware, pChroma, pGreen, pOther) : 1;
+    bayerPixels(pUp, pCur, pDown, n, greenParity, edgeAware, pChroma, pGreen, pOther, x, n);
+}
+
+template <>
+void bayerRow<epicsUInt16>(const epicsUInt16 *pUp, const epicsUInt16 *pCur, const epicsUInt16 *pDown, size_t n,
+                           int greenParity, bool edgeAware, epicsUInt16 *pChroma, epicsUInt16 *pGreen,
+                           epicsUInt16 *pOther)
+{
+    size_t x;
+    bayerPixels(pUp, pCur, pDown, n, greenParity, edgeAware, pChroma, pGreen, pOther, 0, 1);
+    x = colorConvertSSE2 ?
+        bayerRowSSE2<NDBayerSSE2UInt16>(pUp, pCur, pDown, n, greenParity, edgeAware, pChroma, pGreen, pOther) : 1;
+    bayerPixels(pUp, pCur, pDown, n, greenParity, edgeAware, pChroma, pGreen, pOther, x, n);
+}
+#endif
+
+/** Converts rows firstRow to lastRow-1 of the image */
+template <typename epicsType>
+static void convertRows(const NDColorPlan *p, size_t firstRow, size_t lastRow)
+{
+    const epicsType *pIn = (const epicsType *)p->pIn;
+    epicsType *pOut = (epicsType *)p->pOut;
+    const epicsType *pSrc[3];
+    epicsType *pDst[3];
+    epicsType *pScratch = NULL;
+    size_t n = p->xSize;
+    size_t y, j;
+    int c;
+    static const char *functionName = "convertRows";
+
+    /* Bayer rows are interpolated into separate color rows, which are then interleaved for RGB1.
+     * Without the scratch rows the pixels are interpolated one at a time straight into the output. */
+    if ((p->op == ColorOpBayer) && (p->out.xStep != 1)) {
+        pScratch = (epicsType *)malloc(3 * n * sizeof(epicsType));
+        if (!pScratch) {
+            asynPrint(p->pasynUser, ASYN_TRACE_ERROR,
+                "%s::%s error allocating Bayer row buffers, interpolating pixel by pixel\n",
+                driverName, functionName);
+        }
+    }
+    for (y=firstRow; y<lastRow; y++) {
+        for (c=0; c<3; c++) {
+            pSrc[c] = pIn + c*p->in.color + y*p->in.yStep;
+            pDst[c] = pOut + c*p->out.color + y*p->out.yStep;
+        }
+        switch (p->op) {
+            case ColorOpCopy:
+                if ((p->in.xStep == 1) && (p->out.xStep == 1)) {
+                    for (c=0; c<3; c++) memcpy(pDst[c], pSrc[c], n * sizeof(epicsType));
+                } else if (p->out.xStep == 1) {
+                    deinterleaveRow(pSrc[0], pDst[0], pDst[1], pDst[2], n);
+                } else {
+                    interleaveRow(pSrc[0], pSrc[1], pSrc[2], pDst[0], n);
+                }
+                break;
+            case ColorOpMono:
+                monoRow(pSrc[0], pSrc[1], pSrc[2], p->in.xStep, pDst[0], n);
+                break;
+            case ColorOpFalseColor:
+                for (c=0; c<3; c++) {
+                    const unsigned char *colorMap = p->colorMap[c];
+                    epicsType *pD = pDst[c];
+                    for (j=0; j<n; j++) pD[j*p->out.xStep] = (epicsType)colorMap[(unsigned char)pSrc[0][j]];
+                }
+                break;
+            case ColorOpBayer: {
+                size_t up   = (y > 0) ? y-1 : 1;
+                size_t down = (y+1 < p->ySize) ? y+1 : p->ySize-2;
+                int chroma = (y & 1) ? 2 - p->firstChroma : p->firstChroma;
+                int greenParity = p->firstGreen ^ (int)(y & 1);
+                if (p->out.xStep == 1) {
+                    bayerRow(pIn + up*p->in.yStep, pSrc[0], pIn + down*p->in.yStep, n, greenParity, p->edgeAware,
+                             pDst[chroma], pDst[1], pDst[2-chroma]);
+                } else if (pScratch) {
+                    for (c=0; c<3; c++) pDst[c] = pScratch + c*n;
+                    bayerRow(pIn + up*p->in.yStep, pSrc[0], pIn + down*p->in.yStep, n, greenParity, p->edgeAware,
+                             pDst[chroma], pDst[1], pDst[2-chroma]);
+                    interleaveRow(pDst[0], pDst[1], pDst[2], pOut + y*p->out.yStep, n);
+                } else {
+                    bayerPixels(pIn + up*p->in.yStep, pSrc[0], pIn + down*p->in.yStep, n, greenParity, p->edgeAware,
+                                pDst[chroma], pDst[1], pDst[2-chroma], 0, n, p->out.xStep);
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    free(pScratch);
+}
+
+static void convertStripe(void *pvt, int stripe)
+{
+    NDColorPlan *p = (NDColorPlan *)pvt;
+    size_t rowsPerStripe = (p->ySize + p->numStripes - 1) / p->numStripes;
+    size_t firstRow = stripe * rowsPerStripe;
+    size_t lastRow = firstRow + rowsPerStripe;
+
+    if (lastRow > p->ySize) lastRow = p->ySize;
+    if (firstRow < lastRow) p->rowsFunc(p, firstRow, lastRow);
+}
+
+/** Converts the color mode of pArray into pArrayOut, which has already been allocated */
+template <typename epicsType>
+static void convertNDArray(NDArray *pArray, NDArray *pArrayOut, NDColorPlan *p,
+                           NDStripeWorkers *pWorkers, int numThreads)
+{
+    p->pIn = pArray->pData;
+    p->pOut = pArrayOut->pData;
+    p->rowsFunc = convertRows<epicsType>;
+    p->numStripes = NDStripeWorkers::numStripes(numThreads, p->xSize * p->ySize, p->ySize);
+    if (p->numStripes <= 1) {
+        p->rowsFunc(p, 0, p->ySize);
+    } else {
+        pWorkers->run(p->numStripes, convertStripe, p);
+    }
+}
+
 template <typename epicsType>
 void NDPluginColorConvert::convertColor(NDArray *pArray)
 {
     NDColorMode_t colorModeOut;
     static const char* functionName = "convertColor";
-    size_t i, j;
-    epicsType *pIn, *pRedIn, *pGreenIn, *pBlueIn;
-    epicsType *pOut, *pRedOut, *pGreenOut, *pBlueOut;
-    epicsType *pDataIn  = (epicsType *)pArray->pData;
-    epicsType *pDataOut;
     NDArray *pArrayOut=NULL;
-    size_t imageSize, rowSize, numRows;
+    NDColorPlan plan, *p=&plan;
+    NDDimension_t xDim, yDim, colorDim, dimsOut[3];
     size_t dims[3];
-    NDDimension_t tmpDim;
-    #ifdef HAVE_PVAPI
-    tPvFrame PvFrame, *pFrame=&PvFrame;
-    int ndims;
-    #endif
-    double value;
+    int ndimsOut, i;
     int colorMode=NDColorModeMono, bayerPattern=NDBayerRGGB;
     int falseColor=0;
+    int bayerMode=0;
+    int computeThreads=1;
     int changedColorMode=0;
-    const unsigned char *colorMapR=NULL;
-    const unsigned char *colorMapG=NULL;
-    const unsigned char *colorMapB=NULL;        
-    const unsigned char *colorMapRGB=NULL;     
     NDAttribute *pAttribute;
-     
+
+    memset(p, 0, sizeof(*p));
+    p->pasynUser = this->pasynUserSelf;
     getIntegerParam(NDPluginColorConvertColorModeOut, (int *)&colorModeOut);
+    getIntegerParam(NDPluginColorConvertBayerMode, &bayerMode);
+    getIntegerParam(NDPluginColorConvertComputeThreads, &computeThreads);
     pAttribute = pArray->pAttributeList->find("ColorMode");
     if (pAttribute) pAttribute->getValue(NDAttrInt32, &colorMode);
     pAttribute = pArray->pAttributeList->find("BayerPattern");
     if (pAttribute) pAttribute->getValue(NDAttrInt32, &bayerPattern);
-    
+
     /* if we have int8 data then check for false color */
     if (pArray->dataType == NDInt8 || pArray->dataType == NDUInt8) {
-        getIntegerParam(NDPluginColorConvertFalseColor, &falseColor);            
+        getIntegerParam(NDPluginColorConvertFalseColor, &falseColor);
         switch (falseColor) {
         case 1:
-            colorMapR = RainbowColorR;
-            colorMapG = RainbowColorG;
-            colorMapB = RainbowColorB;
-            colorMapRGB = RainbowColorRGB;      
+            p->colorMap[0] = RainbowColorR;
+            p->colorMap[1] = RainbowColorG;
+            p->colorMap[2] = RainbowColorB;
             break;
         case 2:
-            colorMapR = IronColorR;
-            colorMapG = IronColorG;
-            colorMapB = IronColorB;
-            colorMapRGB = IronColorRGB;                        
+            p->colorMap[0] = IronColorR;
+            p->colorMap[1] = IronColorG;
+            p->colorMap[2] = IronColorB;
             break;
         default:
             falseColor = 0;
         }
-    }     
+    }
     /* This function is called with the lock taken, and it must be set when we exit.
      * The following code can be exected without the mutex because we are not accessing elements of
      * pPvt that other threads can access. */
     this->unlock();
+    /* A mono or Bayer image has no color dimension, the output gets a new one */
+    memset(&colorDim, 0, sizeof(colorDim));
+    colorDim.size = 3;
+    colorDim.binning = 1;
     switch (colorMode) {
         case NDColorModeMono:
-            if (pArray->ndims != 2) break;
-            rowSize   = pArray->dims[0].size;
-            numRows   = pArray->dims[1].size;
-            imageSize = rowSize * numRows;
-            switch (colorModeOut) {
-                case NDColorModeRGB1:
-                    dims[0] = 3;
-                    dims[1] = rowSize;
-                    dims[2] = numRows;
-                    pArrayOut = this->pNDArrayPool->alloc(3, dims, pArray->dataType, 0, NULL);
-                    tmpDim = pArrayOut->dims[0];
-                    /* Copy everything except the data, e.g. uniqueId and timeStamp, attributes. */
-                    this->pNDArrayPool->copy(pArray, pArrayOut, 0);
-                    /* That replaced the dimensions in the output array, need to fix. */
-                    pArrayOut->ndims = 3;
-                    pArrayOut->dims[2] = pArrayOut->dims[1];
-                    pArrayOut->dims[1] = pArrayOut->dims[0];
-                    pArrayOut->dims[0] = tmpDim;
-                    pDataOut = (epicsType *)pArrayOut->pData;
-                    pOut = pDataOut;
-                    pIn  = pDataIn;
-                    if (falseColor) {
-                        for (i=0; i<imageSize; i++) {
-                            memcpy(pOut, colorMapRGB + 3 * ((unsigned char)*pIn++), 3);
-                            pOut+=3;
-                        }                                       
-                    } else {
-                        for (i=0; i<imageSize; i++) {
-                            *pOut++ = *pIn;
-                            *pOut++ = *pIn;
-                            *pOut++ = *pIn++;
-                        }
-                    }
-                    changedColorMode = 1;
-                    break;
-                case NDColorModeRGB2:
-                    /* Make a new 3-D array */
-                    dims[0] = rowSize;
-                    dims[1] = 3;
-                    dims[2] = numRows;
-                    pArrayOut = this->pNDArrayPool->alloc(3, dims, pArray->dataType, 0, NULL);
-                    tmpDim = pArrayOut->dims[1];
-                    /* Copy everything except the data, e.g. uniqueId and timeStamp, attributes. */
-                    this->pNDArrayPool->copy(pArray, pArrayOut, 0);
-                    /* That replaced the dimensions in the output array, need to fix. */
-                    pArrayOut->ndims = 3;
-                    pArrayOut->dims[2] = pArrayOut->dims[1];
-                    pArrayOut->dims[1] = tmpDim;
-                    pDataOut = (epicsType *)pArrayOut->pData;
-                    pIn  = pDataIn;
-                    if (falseColor) {
-                        for (i=0; i<numRows; i++) {
-                            pRedOut   = pDataOut + 3*i*rowSize;
-                            pGreenOut = pRedOut + rowSize;
-                            pBlueOut  = pRedOut + 2*rowSize;
-                            for (j=0; j<rowSize; j++) {
-                                *pRedOut++   = colorMapR[(unsigned char)*pIn];
-                                *pGreenOut++ = colorMapG[(unsigned char)*pIn];
-                                *pBlueOut++  = colorMapB[(unsigned char)*pIn++];
-                            }
-                        }                                
-                    } else {
-                        for (i=0; i<numRows; i++) {
-                            pRedOut   = pDataOut + 3*i*rowSize;
-                            pGreenOut = pRedOut + rowSize;
-                            pBlueOut  = pRedOut + 2*rowSize;
-                            for (j=0; j<rowSize; j++) {
-                                *pRedOut++   = *pIn;
-                                *pGreenOut++ = *pIn;
-                                *pBlueOut++  = *pIn++;
-                            }
-                        }
-                    }                    
-                    changedColorMode = 1;
-                    break;
-                case NDColorModeRGB3:
-                    /* Make a new 3-D array */
-                    dims[0] = rowSize;
-                    dims[1] = numRows;
-                    dims[2] = 3;
-                    pArrayOut = this->pNDArrayPool->alloc(3, dims, pArray->dataType, 0, NULL);
-                    tmpDim = pArrayOut->dims[2];
-                    /* Copy everything except the data, e.g. uniqueId and timeStamp, attributes. */
-                    this->pNDArrayPool->copy(pArray, pArrayOut, 0);
-                    /* That replaced the dimensions in the output array, need to fix. */
-                    pArrayOut->ndims = 3;
-                    pArrayOut->dims[2] = tmpDim;
-                    pDataOut = (epicsType *)pArrayOut->pData;
-                    pRedOut   = pDataOut;
-                    pGreenOut = pDataOut + imageSize;
-                    pBlueOut  = pDataOut + 2*imageSize;
-                    pIn  = pDataIn;
-                    if (falseColor) {  
-                        for (i=0; i<imageSize; i++) {                    
-                            *pRedOut++   = colorMapR[(unsigned char)*pIn];
-                            *pGreenOut++ = colorMapG[(unsigned char)*pIn];
-                            *pBlueOut++  = colorMapB[(unsigned char)*pIn++];
-                        }                                                   
-                    } else {                                      
-                        for (i=0; i<imageSize; i++) {
-                            *pRedOut++   = *pIn;
-                            *pGreenOut++ = *pIn;
-                            *pBlueOut++  = *pIn++;
-                        }
-                    }                        
-                    changedColorMode = 1;
-                    break;
-                default:
-                    break;
-            }
-            break;
-        #ifdef HAVE_PVAPI
         case NDColorModeBayer:
             if (pArray->ndims != 2) break;
-            switch (colorModeOut) {
-                case NDColorModeRGB1:
-                case NDColorModeRGB2:
-                case NDColorModeRGB3:
-                    rowSize   = pArray->dims[0].size;
-                    numRows   = pArray->dims[1].size;
-                    imageSize = rowSize * numRows;
-                    ndims = 3;
-                    dims[0] = 3;
-                    dims[1] = rowSize;
-                    dims[2] = numRows;
-                    /* There is a problem: the uniqueId and timeStamp are not preserved! */
-                    pArrayOut = this->pNDArrayPool->alloc(ndims, dims, pArray->dataType, 0, NULL);
-                    pArrayOut->uniqueId = pArray->uniqueId;
-                    pArrayOut->epicsTS = pArray->epicsTS;
-                    pArrayOut->timeStamp = pArray->timeStamp;
-                    pDataOut = (epicsType *)pArrayOut->pData;
-                    /* For now we use the Prosilica library functions to convert Bayer to RGB */
-                    /* This requires creating their tPvFrame data structure */
-                    memset(pFrame, 0, sizeof(tPvFrame));
-                    pFrame->Width = (unsigned long)pArray->dims[0].size;
-                    pFrame->Height = (unsigned long)pArray->dims[1].size;
-                    pFrame->RegionX = (unsigned long)pArray->dims[0].offset;
-                    pFrame->RegionY = (unsigned long)pArray->dims[1].offset;
-                    pFrame->ImageBuffer = pArray->pData;
-                    pFrame->ImageBufferSize = (unsigned long)pArray->dataSize;
-                    pFrame->ImageSize = pFrame->ImageBufferSize;
-                    pFrame->BayerPattern = (tPvBayerPattern)bayerPattern;
-                    switch(pArray->dataType) {
-                        case NDInt8:
-                        case NDUInt8:
-                            pFrame->Format = ePvFmtBayer8;
-                            pFrame->BitDepth = 8;
-                            break;
-                        case NDInt16:
-                        case NDUInt16:
-                            pFrame->Format = ePvFmtBayer16;
-                            pFrame->BitDepth = 16;
-                            break;
-                        default:
-                            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                                "%s:%s: error unsupported data type=%d\n",
-                                driverName, functionName, pArray->dataType);
-                            break;
-                    }
-                    break;
-                default: 
-                    break;
-            }
-            switch (colorModeOut) {
-                case NDColorModeRGB1:
-                    PvUtilityColorInterpolate(pFrame, pDataOut, pDataOut+1, pDataOut+2, 2, 0);
-                    pArrayOut->dims[0].size = 3;
-                    memcpy(&pArrayOut->dims[1], &pArray->dims[0], sizeof(NDDimension_t));
-                    memcpy(&pArrayOut->dims[2], &pArray->dims[1], sizeof(NDDimension_t));
-                    changedColorMode = 1;
-                    break;
-                
-                case NDColorModeRGB2:
-                    PvUtilityColorInterpolate(pFrame, pDataOut,  pDataOut+rowSize, pDataOut+2*rowSize, 
-                                              0, (unsigned long)(2*rowSize));
-                    memcpy(&pArrayOut->dims[0], &pArray->dims[0], sizeof(NDDimension_t));
-                    pArrayOut->dims[1].size = 3;
-                    memcpy(&pArrayOut->dims[2], &pArray->dims[1], sizeof(NDDimension_t));
-                    changedColorMode = 1;
-                    break;
-
-                case NDColorModeRGB3:
-                    PvUtilityColorInterpolate(pFrame, pDataOut,  pDataOut+imageSize, pDataOut+2*imageSize, 0, 0);
-                    memcpy(&pArrayOut->dims[0], &pArray->dims[0], sizeof(NDDimension_t));
-                    memcpy(&pArrayOut->dims[1], &pArray->dims[1], sizeof(NDDimension_t));
-                    pArrayOut->dims[2].size = 3;
-                    changedColorMode = 1;
-                    break;
-                default:
-                    break;
+            xDim = pArray->dims[0];
+            yDim = pArray->dims[1];
+            if ((colorModeOut != NDColorModeRGB1) && (colorModeOut != NDColorModeRGB2) &&
+                (colorModeOut != NDColorModeRGB3)) break;
+            if (colorMode == NDColorModeMono) {
+                p->op = falseColor ? ColorOpFalseColor : ColorOpCopy;
+            } else if ((xDim.size >= 2) && (yDim.size >= 2)) {
+                p->op = ColorOpBayer;
+                switch (bayerPattern) {
+                    case NDBayerGBRG: p->firstChroma = 2; p->firstGreen = 0; break;
+                    case NDBayerGRBG: p->firstChroma = 0; p->firstGreen = 0; break;
+                    case NDBayerBGGR: p->firstChroma = 2; p->firstGreen = 1; break;
+                    default:          p->firstChroma = 0; p->firstGreen = 1; break;
+                }
+                p->edgeAware = (bayerMode != 0);
             }
             break;
-        #endif
         case NDColorModeRGB1:
-            if (pArray->ndims != 3) break;
-            rowSize   = pArray->dims[1].size;
-            numRows   = pArray->dims[2].size;
-            imageSize = rowSize * numRows;
-            switch (colorModeOut) {
-                case NDColorModeMono:
-                    /* Make a new 2-D array */
-                    dims[0] = rowSize;
-                    dims[1] = numRows;
-                    pArrayOut = this->pNDArrayPool->alloc(2, dims, pArray->dataType, 0, NULL);
-                    /* Copy everything except the data, e.g. uniqueId and timeStamp, attributes. */
-                    this->pNDArrayPool->copy(pArray, pArrayOut, 0);
-                    /* That replaced the dimensions in the output array, need to fix. */
-                    pArrayOut->ndims = 2;
-                    pArrayOut->dims[0] = pArrayOut->dims[1];
-                    pArrayOut->dims[1] = pArrayOut->dims[2];
-                    pDataOut = (epicsType *)pArrayOut->pData;
-                    pOut = pDataOut;
-                    pIn = pDataIn;
-                    for (i=0; i<imageSize; i++) {
-                        value  = (*pIn + *(pIn+1) + *(pIn+2))/3.;
-                        *pOut++ = (epicsType)value;
-                        pIn += 3;
-                    }
-                    changedColorMode = 1;
-                    break;
-                case NDColorModeRGB2:
-                    pArrayOut = this->pNDArrayPool->copy(pArray, NULL, 0);
-                    pDataOut = (epicsType *)pArrayOut->pData;
-                    pIn = pDataIn;
-                    for (i=0; i<numRows; i++) {
-                        pRedOut   = pDataOut + 3*i*rowSize;
-                        pGreenOut = pRedOut + rowSize;
-                        pBlueOut  = pRedOut + 2*rowSize;
-                        for (j=0; j<rowSize; j++) {
-                            *pRedOut++   = *pIn++;
-                            *pGreenOut++ = *pIn++;
-                            *pBlueOut++  = *pIn++;
-                        }
-                    }
-                    memcpy(&pArrayOut->dims[0], &pArray->dims[1], sizeof(NDDimension_t));
-                    memcpy(&pArrayOut->dims[1], &pArray->dims[0], sizeof(NDDimension_t));
-                    memcpy(&pArrayOut->dims[2], &pArray->dims[2], sizeof(NDDimension_t));
-                    changedColorMode = 1;
-                    break;
-                case NDColorModeRGB3:
-                    pArrayOut = this->pNDArrayPool->copy(pArray, NULL, 0);
-                    pDataOut = (epicsType *)pArrayOut->pData;
-                    pIn = pDataIn;
-                    pRedOut   = pDataOut;
-                    pGreenOut = pDataOut + imageSize;
-                    pBlueOut  = pDataOut + 2*imageSize;
-                    for (i=0; i<imageSize; i++) {
-                        *pRedOut++   = *pIn++;
-                        *pGreenOut++ = *pIn++;
-                        *pBlueOut++  = *pIn++;
-                    }
-                    memcpy(&pArrayOut->dims[0], &pArray->dims[1], sizeof(NDDimension_t));
-                    memcpy(&pArrayOut->dims[1], &pArray->dims[2], sizeof(NDDimension_t));
-                    memcpy(&pArrayOut->dims[2], &pArray->dims[0], sizeof(NDDimension_t));
-                    changedColorMode = 1;
-                    break;
-                default:
-                    break;
-            }        
-            break;
         case NDColorModeRGB2:
-            if (pArray->ndims != 3) break;
-            rowSize   = pArray->dims[0].size;
-            numRows   = pArray->dims[2].size;
-            imageSize = rowSize * numRows;
-            switch (colorModeOut) {
-                case NDColorModeMono:
-                    /* Make a new 2-D array */
-                    dims[0] = rowSize;
-                    dims[1] = numRows;
-                    pArrayOut = this->pNDArrayPool->alloc(2, dims, pArray->dataType, 0, NULL);
-                    /* Copy everything except the data, e.g. uniqueId and timeStamp, attributes. */
-                    this->pNDArrayPool->copy(pArray, pArrayOut, 0);
-                    /* That replaced the dimensions in the output array, need to fix. */
-                    pArrayOut->ndims = 2;
-                    pArrayOut->dims[1] = pArrayOut->dims[2];
-                    pDataOut = (epicsType *)pArrayOut->pData;
-                    pOut = pDataOut;
-                    for (i=0; i<numRows; i++) {
-                        pRedIn   = pDataIn + 3*i*rowSize;
-                        pGreenIn = pRedIn + rowSize;
-                        pBlueIn  = pRedIn + 2*rowSize;
-                        for (j=0; j<rowSize; j++) {
-                            value = (*pRedIn++ + *pGreenIn++ + *pBlueIn++)/3.;
-                            *pOut++ = (epicsType)value;
-                        }
-                    }
-                    changedColorMode = 1;
-                    break;
-                case NDColorModeRGB1:
-                    pArrayOut = this->pNDArrayPool->copy(pArray, NULL, 0);
-                    pDataOut = (epicsType *)pArrayOut->pData;
-                    pOut = pDataOut;
-                    for (i=0; i<numRows; i++) {
-                        pRedIn   = pDataIn + 3*i*rowSize;
-                        pGreenIn = pRedIn + rowSize;
-                        pBlueIn  = pRedIn + 2*rowSize;
-                        for (j=0; j<rowSize; j++) {
-                            *pOut++  = *pRedIn++;
-                            *pOut++  = *pGreenIn++;
-                            *pOut++  = *pBlueIn++;
-                        }
-                    }
-                    memcpy(&pArrayOut->dims[0], &pArray->dims[1], sizeof(NDDimension_t));
-                    memcpy(&pArrayOut->dims[1], &pArray->dims[0], sizeof(NDDimension_t));
-                    memcpy(&pArrayOut->dims[2], &pArray->dims[2], sizeof(NDDimension_t));
-                    changedColorMode = 1;
-                    break;
-                case NDColorModeRGB3:
-                    pArrayOut = this->pNDArrayPool->copy(pArray, NULL, 0);
-                    pDataOut = (epicsType *)pArrayOut->pData;
-                    pRedOut   = pDataOut;
-                    pGreenOut = pDataOut + imageSize;
-                    pBlueOut  = pDataOut + 2*imageSize;
-                    for (i=0; i<numRows; i++) {
-                        pRedIn   = pDataIn + 3*i*rowSize;
-                        pGreenIn = pRedIn + rowSize;
-                        pBlueIn  = pRedIn + 2*rowSize;
-                        for (j=0; j<rowSize; j++) {
-                            *pRedOut++   = *pRedIn++;
-                            *pGreenOut++ = *pGreenIn++;
-                            *pBlueOut++  = *pBlueIn++;
-                        }
-                    }
-                    memcpy(&pArrayOut->dims[0], &pArray->dims[0], sizeof(NDDimension_t));
-                    memcpy(&pArrayOut->dims[1], &pArray->dims[2], sizeof(NDDimension_t));
-                    memcpy(&pArrayOut->dims[2], &pArray->dims[1], sizeof(NDDimension_t));
-                    changedColorMode = 1;
-                    break;
-                default:
-                    break;
-            }        
-            break;
         case NDColorModeRGB3:
             if (pArray->ndims != 3) break;
-            rowSize   = pArray->dims[0].size;
-            numRows   = pArray->dims[1].size;
-            imageSize = rowSize * numRows;
-            switch (colorModeOut) {
-                case NDColorModeMono:
-                    /* Make a new 2-D array */
-                    dims[0] = rowSize;
-                    dims[1] = numRows;
-                    pArrayOut = this->pNDArrayPool->alloc(2, dims, pArray->dataType, 0, NULL);
-                    /* Copy everything except the data, e.g. uniqueId and timeStamp, attributes. */
-                    this->pNDArrayPool->copy(pArray, pArrayOut, 0);
-                    /* That replaced the dimensions in the output array, need to fix. */
-                    pArrayOut->ndims = 2;
-                    pDataOut = (epicsType *)pArrayOut->pData;
-                    pOut = pDataOut;
-                    pRedIn   = pDataIn;
-                    pGreenIn = pDataIn + imageSize;
-                    pBlueIn  = pDataIn + 2*imageSize;
-                    for (i=0; i<imageSize; i++) {
-                        value = (*pRedIn++ + *pGreenIn++ + *pBlueIn++)/3.;
-                        *pOut++ = (epicsType)value;
-                    }
-                    changedColorMode = 1;
-                    break;
-                case NDColorModeRGB1:
-                    pArrayOut = this->pNDArrayPool->copy(pArray, NULL, 0);
-                    pDataOut = (epicsType *)pArrayOut->pData;
-                    pRedIn   = pDataIn;
-                    pGreenIn = pDataIn + imageSize;
-                    pBlueIn  = pDataIn + 2*imageSize;
-                    pOut = pDataOut;
-                    for (i=0; i<imageSize; i++) {
-                        *pOut++ = *pRedIn++;
-                        *pOut++ = *pGreenIn++;
-                        *pOut++ = *pBlueIn++;
-                    }
-                    memcpy(&pArrayOut->dims[0], &pArray->dims[2], sizeof(NDDimension_t));
-                    memcpy(&pArrayOut->dims[1], &pArray->dims[0], sizeof(NDDimension_t));
-                    memcpy(&pArrayOut->dims[2], &pArray->dims[1], sizeof(NDDimension_t));
-                    changedColorMode = 1;
-                    break;
-                case NDColorModeRGB2:
-                    pArrayOut = this->pNDArrayPool->copy(pArray, NULL, 0);
-                    pDataOut = (epicsType *)pArrayOut->pData;
-                    pRedIn   = pDataIn;
-                    pGreenIn = pDataIn + imageSize;
-                    pBlueIn  = pDataIn + 2*imageSize;
-                    for (i=0; i<numRows; i++) {
-                        pRedOut   = pDataOut + 3*i*rowSize;
-                        pGreenOut = pRedOut + rowSize;
-                        pBlueOut  = pRedOut + 2*rowSize;
-                        for (j=0; j<rowSize; j++) {
-                            *pRedOut++   = *pRedIn++;
-                            *pGreenOut++ = *pGreenIn++;
-                            *pBlueOut++  = *pBlueIn++;
-                        }
-                    }
-                    memcpy(&pArrayOut->dims[0], &pArray->dims[0], sizeof(NDDimension_t));
-                    memcpy(&pArrayOut->dims[1], &pArray->dims[2], sizeof(NDDimension_t));
-                    memcpy(&pArrayOut->dims[2], &pArray->dims[1], sizeof(NDDimension_t));
-                    changedColorMode = 1;
-                    break;
-                default:
-                    break;
+            if (colorMode == NDColorModeRGB1) {
+                colorDim = pArray->dims[0];
+                xDim     = pArray->dims[1];
+                yDim     = pArray->dims[2];
+            } else if (colorMode == NDColorModeRGB2) {
+                xDim     = pArray->dims[0];
+                colorDim = pArray->dims[1];
+                yDim     = pArray->dims[2];
+            } else {
+                xDim     = pArray->dims[0];
+                yDim     = pArray->dims[1];
+                colorDim = pArray->dims[2];
+            }
+            if (colorModeOut == NDColorModeMono) {
+                p->op = ColorOpMono;
+            } else if (((colorModeOut == NDColorModeRGB1) || (colorModeOut == NDColorModeRGB2) ||
+                        (colorModeOut == NDColorModeRGB3)) && ((int)colorModeOut != colorMode)) {
+                p->op = ColorOpCopy;
             }
             break;
         default:
             break;
     }
+    if (p->op != ColorOpNone) {
+        switch (colorModeOut) {
+            case NDColorModeRGB1:
+                dimsOut[0] = colorDim;
+                dimsOut[1] = xDim;
+                dimsOut[2] = yDim;
+                break;
+            case NDColorModeRGB2:
+                dimsOut[0] = xDim;
+                dimsOut[1] = colorDim;
+                dimsOut[2] = yDim;
+                break;
+            case NDColorModeRGB3:
+                dimsOut[0] = xDim;
+                dimsOut[1] = yDim;
+                dimsOut[2] = colorDim;
+                break;
+            default:
+                dimsOut[0] = xDim;
+                dimsOut[1] = yDim;
+                break;
+        }
+        ndimsOut = (colorModeOut == NDColorModeMono) ? 2 : 3;
+        for (i=0; i<ndimsOut; i++) dims[i] = dimsOut[i].size;
+        pArrayOut = this->pNDArrayPool->alloc(ndimsOut, dims, pArray->dataType, 0, NULL);
+        if (pArrayOut) {
+            /* Copy everything except the data, e.g. uniqueId and timeStamp, attributes. */
+            this->pNDArrayPool->copy(pArray, pArrayOut, 0);
+            /* That replaced the dimensions in the output array, need to fix. */
+            pArrayOut->ndims = ndimsOut;
+            for (i=0; i<ndimsOut; i++) pArrayOut->dims[i] = dimsOut[i];
+            p->xSize = xDim.size;
+            p->ySize = yDim.size;
+            colorLayout(colorMode, p->xSize, p->ySize, &p->in);
+            colorLayout(colorModeOut, p->xSize, p->ySize, &p->out);
+            convertNDArray<epicsType>(pArray, pArrayOut, p, this->pStripeWorkers, computeThreads);
+            changedColorMode = 1;
+        } else {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s: error allocating output array\n",
+                driverName, functionName);
+        }
+    }
     /* If the output array pointer is null then no conversion was done, copy the input to the output */
     if (!pArrayOut) pArrayOut = this->pNDArrayPool->copy(pArray, NULL, 1);
     this->lock();
@@ -502,7 +788,7 @@ void NDPluginColorConvert::convertColor(NDArray *pArray)
     /* If we changed the color mode then set the attribute */
     if (changedColorMode) pArrayOut->pAttributeList->add("ColorMode", "Color Mode", NDAttrInt32, &colorModeOut);
     this->pArrays[0] = pArrayOut;
-    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, 
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
               "%s:%s: pArray->colorMode=%d, colorModeOut=%d, pArrayOut=%p\n",
               driverName, functionName, colorMode, colorModeOut, pArrayOut);
 }
@@ -612,11 +898,17 @@ NDPluginColorConvert::NDPluginColorConvert(const char *portName, int queueSize,
 
     createParam(NDPluginColorConvertColorModeOutString, asynParamInt32, &NDPluginColorConvertColorModeOut);
     createParam(NDPluginColorConvertFalseColorString,   asynParamInt32, &NDPluginColorConvertFalseColor);    
+    createParam(NDPluginColorConvertBayerModeString,    asynParamInt32, &NDPluginColorConvertBayerMode);
+    createParam(NDPluginColorConvertComputeThreadsString, asynParamInt32, &NDPluginColorConvertComputeThreads);
+
+    this->pStripeWorkers = new NDStripeWorkers(portName);
 
     /* Set the plugin type string */    
     setStringParam(NDPluginDriverPluginType, "NDPluginColorConvert");
     
     setIntegerParam(NDPluginColorConvertColorModeOut, NDColorModeMono);
+    setIntegerParam(NDPluginColorConvertBayerMode, 0);
+    setIntegerParam(NDPluginColorConvertComputeThreads, 1);
 
     // Enable ArrayCallbacks.  
     // This plugin currently ignores this setting and always does callbacks, so make the setting reflect the behavior
@@ -626,6 +918,11 @@ NDPluginColorConvert::NDPluginColorConvert(const char *portName, int queueSize,
     connectToArrayPort();
 }
 
+NDPluginColorConvert::~NDPluginColorConvert()
+{
+    delete this->pStripeWorkers;
+}
+
 extern "C" int NDColorConvertConfigure(const char *portName, int queueSize, int blockingCallbacks, 
                                           const char *NDArrayPort, int NDArrayAddr, 
                                           int maxBuffers, size_t maxMemory,
@@ -4,9 +4,12 @@
 #include <epicsTypes.h>
 
 #include "NDPluginDriver.h"
+#include "NDStripeWorkers.h"
 
 #define NDPluginColorConvertColorModeOutString  "COLOR_MODE_OUT" /* (NDColorMode_t r/w) Output color mode */
 #define NDPluginColorConvertFalseColorString    "FALSE_COLOR"    /* (NDColorMode_t r/w) Output color mode */
+#define NDPluginColorConvertBayerModeString     "BAYER_MODE"     /* (asynInt32, r/w) Bayer interpolation, 0=bilinear, 1=edge-aware */
+#define NDPluginColorConvertComputeThreadsString "COMPUTE_THREADS" /* (asynInt32, r/w) Number of threads converting each array */
 
 /** Convert NDArrays from one NDColorMode to another.
   * This plugin is as source of NDArray callbacks, passing the (possibly converted) NDArray
@@ -15,20 +18,22 @@
   * <ul>
   *  <li> Mono to RGB1, RGB2 or RGB3 </li>
   *  <li> RGB1, RGB2 or RGB3 to mono</li>
-  *  <li> Bayer color to RGB1, RGB2 or RGB3 (Windows and Linux only)</li>
+  *  <li> Bayer color to RGB1, RGB2 or RGB3, with bilinear or edge-aware interpolation</li>
   *  <li> RGB1 to RGB2 or RGB3 </li> 
   *  <li> RGB2 to RGB1 or RGB3 </li> 
   *  <li> RGB3 to RGB1 or RGB2 </li> 
   * </ul> 
   * It also applies a false color map if requested for 8 bit data  
   * If the conversion required by the input color mode and output color mode are not
-  * in this supported list then the NDArray is passed on without conversion. */
+  * in this supported list then the NDArray is passed on without conversion.
+  * Images of 65536 pixels or more are divided into ComputeThreads stripes of rows that are converted in parallel. */
 class epicsShareClass NDPluginColorConvert : public NDPluginDriver {
 public:
     NDPluginColorConvert(const char *portName, int queueSize, int blockingCallbacks, 
                          const char *NDArrayPort, int NDArrayAddr,
                          int maxBuffers, size_t maxMemory,
                          int priority, int stackSize);
+    ~NDPluginColorConvert();
 
     /* These methods override the virtual methods in the base class */
     void processCallbacks(NDArray *pArray);
@@ -36,11 +41,17 @@ protected:
     int NDPluginColorConvertColorModeOut;
     #define FIRST_NDPLUGIN_COLOR_CONVERT_PARAM NDPluginColorConvertColorModeOut
     int NDPluginColorConvertFalseColor;    
-    #define LAST_NDPLUGIN_COLOR_CONVERT_PARAM NDPluginColorConvertFalseColor
+    int NDPluginColorConvertBayerMode;
+    int NDPluginColorConvertComputeThreads;
+    #define LAST_NDPLUGIN_COLOR_CONVERT_PARAM NDPluginColorConvertComputeThreads
 private:
     /* These methods are just for this class */
     template <typename epicsType> void convertColor(NDArray *pArray);
+    NDStripeWorkers *pStripeWorkers;
 };
 #define NUM_NDPLUGIN_COLOR_CONVERT_PARAMS ((int)(&LAST_NDPLUGIN_COLOR_CONVERT_PARAM - &FIRST_NDPLUGIN_COLOR_CONVERT_PARAM + 1))
+
+/** 0 converts with the plain C++ loops instead of the SSE2 instructions */
+epicsShareExtern volatile int colorConvertSSE2;
  
 #endif
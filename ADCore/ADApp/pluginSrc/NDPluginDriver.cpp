@@ -18,7 +18,6 @@
 #include <epicsTimer.h>
 #include <epicsMutex.h>
 #include <epicsEvent.h>
-#include <epicsMessageQueue.h>
 #include <cantProceed.h>
 
 #include <asynCommonSyncIO.h>
@@ -29,6 +28,19 @@
 
 static const char *driverName="NDPluginDriver";
 
+/** State for a thread that executes processCallbacks.  There is one for each worker thread,
+  * and one is created for any other thread that calls threadScratch(), for example the driver thread
+  * when NDPluginDriverBlockingCallbacks=1 */
+struct NDPluginThread {
+    NDPluginDriver *pPlugin;
+    epicsThreadPrivateId privateId;
+    int index;                  /**< Worker thread number, -1 if this is not a worker thread */
+    epicsEventId wakeEvent;     /**< Signalled when NDPluginDriverNumThreads changes */
+    void *pScratch;
+    size_t scratchSize;
+    NDPluginThread *pNext;
+};
+
 /** Method that is normally called at the beginning of the processCallbacks
   * method in derived classes.
   * \param[in] pArray  The NDArray from the callback.
@@ -41,6 +53,7 @@ static const char *driverName="NDPluginDriver";
     int arrayCounter;
     int i, dimsChanged;
     int size;
+    size_t dims[ND_ARRAY_MAX_DIMS];
     NDAttribute *pAttribute;
     int colorMode=NDColorModeMono, bayerPattern=NDBayerRGGB;
     
@@ -62,9 +75,9 @@ static const char *driverName="NDPluginDriver";
     setIntegerParam(NDEpicsTSSec, pArray->epicsTS.secPastEpoch);
     setIntegerParam(NDEpicsTSNsec, pArray->epicsTS.nsec);
     /* See if the array dimensions have changed.  If so then do callbacks on them. */
+    getDimensions(pArray, dims);
     for (i=0, dimsChanged=0; i<ND_ARRAY_MAX_DIMS; i++) {
-        size = (int)pArray->dims[i].size;
-        if (i >= pArray->ndims) size = 0;
+        size = (i < pArray->ndims) ? (int)dims[i] : 0;
         if (size != this->dimsPrev[i]) {
             this->dimsPrev[i] = size;
             dimsChanged = 1;
@@ -75,6 +88,16 @@ static const char *driverName="NDPluginDriver";
     }
 }
 
+/** Returns the dimensions of an array that processCallbacks reports in NDDimensions.
+  * The default is the dimensions of the array itself. Plugins that pass on arrays of a different size
+  * can override this to report that size instead.
+  * \param[in] pArray  The NDArray from the callback.
+  * \param[out] dims The size of each of the pArray->ndims dimensions. */
+void NDPluginDriver::getDimensions(NDArray *pArray, size_t *dims)
+{
+    for (int i=0; i<pArray->ndims; i++) dims[i] = pArray->dims[i].size;
+}
+
 extern "C" {static void driverCallback(void *drvPvt, asynUser *pasynUser, void *genericPointer)
 {
     NDPluginDriver *pNDPluginDriver = (NDPluginDriver *)drvPvt;
@@ -82,30 +105,45 @@ extern "C" {static void driverCallback(void *drvPvt, asynUser *pasynUser, void *
 }}
 
 /** Method that is called from the driver with a new NDArray.
-  * It calls the processCallbacks function, which typically is implemented in the
-  * derived class.
-  * It can either do the callbacks directly (if NDPluginDriverBlockingCallbacks=1) or by queueing
-  * the arrays to be processed by a background task (if NDPluginDriverBlockingCallbacks=0).
-  * In the latter case arrays can be dropped if the queue is full.  This method should really
+  * If NDPluginDriverSortSize>0 the array is first put in uniqueId order by resequenceArray(),
+  * otherwise it is passed directly to dispatchArray().  This method should really
   * be private, but it must be called from a C-linkage callback function, so it must be public.
   * \param[in] pasynUser  The pasynUser from the asyn client.
   * \param[in] genericPointer The pointer to the NDArray */ 
 void NDPluginDriver::driverCallback(asynUser *pasynUser, void *genericPointer)
 {
-     
     NDArray *pArray = (NDArray *)genericPointer;
+    int sortSize;
+
+    this->lock();
+    getIntegerParam(NDPluginDriverSortSize, &sortSize);
+    if (sortSize > 0) {
+        resequenceArray(pArray, sortSize);
+    } else {
+        dispatchArray(pArray);
+    }
+    callParamCallbacks();
+    this->unlock();
+}
+
+/** Passes an input array on to processCallbacks.
+  * It can either do the callbacks directly (if NDPluginDriverBlockingCallbacks=1) or by queueing
+  * the arrays to be processed by a background task (if NDPluginDriverBlockingCallbacks=0).
+  * In the latter case arrays can be dropped if the queue is full.
+  * Arrays are ignored if they arrive less than NDPluginDriverMinCallbackTime after the previous one.
+  * This method is called with the lock taken.
+  * \param[in] pArray The input array. */
+void NDPluginDriver::dispatchArray(NDArray *pArray)
+{
     epicsTimeStamp tNow;
     double minCallbackTime, deltaTime;
     int status=0;
     int blockingCallbacks;
-    int arrayCounter, droppedArrays, queueSize, queueFree;
-    static const char *functionName = "driverCallback";
-
-    this->lock();
+    int arrayCounter, droppedArrays;
+    static const char *functionName = "dispatchArray";
 
     status |= getDoubleParam(NDPluginDriverMinCallbackTime, &minCallbackTime);
     status |= getIntegerParam(NDPluginDriverBlockingCallbacks, &blockingCallbacks);
-    status |= getIntegerParam(NDPluginDriverQueueSize, &queueSize);
     
     epicsTimeGetCurrent(&tNow);
     deltaTime = epicsTimeDiffInSeconds(&tNow, &this->lastProcessTime);
@@ -127,24 +165,133 @@ void NDPluginDriver::driverCallback(asynUser *pasynUser, void *genericPointer)
             /* Increase the reference count again on this array
              * It will be released in the background task when processing is done */
             pArray->reserve();
-            /* Try to put this array on the message queue.  If there is no room then return
+            /* If output arrays are being sorted this array is pending until it has been processed */
+            if (this->sortMode && (this->numThreads > 1)) {
+                epicsMutexLock(this->sortLock);
+                this->pendingIds.insert(pArray->uniqueId);
+                epicsMutexUnlock(this->sortLock);
+            }
+            /* Try to put this array on the queue.  If there is no room then return
              * immediately. */
-            status = epicsMessageQueueTrySend(this->msgQId, &pArray, sizeof(&pArray));
-            queueFree = queueSize - epicsMessageQueuePending(this->msgQId);
-            setIntegerParam(NDPluginDriverQueueFree, queueFree);
+            status = this->pQueue->trySend(pArray);
+            setIntegerParam(NDPluginDriverQueueFree, this->pQueue->capacity() - this->pQueue->pending());
+            setIntegerParam(NDPluginDriverQueueHighWater, this->pQueue->highWater());
+            setIntegerParam(NDPluginDriverQueueWakeups, this->pQueue->wakeups());
             if (status) {
                 status |= getIntegerParam(NDArrayCounter, &arrayCounter);
                 status |= getIntegerParam(NDPluginDriverDroppedArrays, &droppedArrays);
-                asynPrint(pasynUser, ASYN_TRACE_FLOW, 
+                asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, 
                     "%s:%s message queue full, dropped array %d\n",
                     driverName, functionName, arrayCounter);
                 droppedArrays++;
                 status |= setIntegerParam(NDPluginDriverDroppedArrays, droppedArrays);
+                removePending(pArray);
                 /* This buffer needs to be released */
                 pArray->release();
             }
         }
     }
+}
+
+extern "C" {static void sortTimerCallback(void *drvPvt)
+{
+    NDPluginDriver *pNDPluginDriver = (NDPluginDriver *)drvPvt;
+    pNDPluginDriver->sortTimerCallback();
+}}
+
+/** Puts input arrays back in uniqueId order before they are passed to dispatchArray().
+  * Arrays are held in a list of up to sortSize arrays.  The array with the lowest uniqueId is passed
+  * on when it is the one after the last array that was passed on, when it has waited
+  * NDPluginDriverSortTime seconds, or as soon as the list holds sortSize arrays.
+  * An array that arrives after one with a larger uniqueId was passed on is late; it is passed on
+  * immediately or dropped, depending on NDPluginDriverSortDropLate.  An array whose uniqueId is more
+  * than sortSize below the last one passed on is taken to be the start of a new acquisition.
+  * This method is called with the lock taken.
+  * \param[in] pArray The input array.
+  * \param[in] sortSize The maximum number of arrays to hold. */
+void NDPluginDriver::resequenceArray(NDArray *pArray, int sortSize)
+{
+    NDPluginSortElement element;
+    int dropLate, counter;
+
+    if (this->haveSentId && (pArray->uniqueId <= this->lastSentId)) {
+        if (pArray->uniqueId < this->lastSentId - sortSize) {
+            /* Pass on everything from the previous acquisition and start again */
+            flushInputList(1);
+            this->haveSentId = false;
+        } else {
+            getIntegerParam(NDPluginDriverSortDropLate, &dropLate);
+            if (dropLate) {
+                getIntegerParam(NDPluginDriverLateDropped, &counter);
+                setIntegerParam(NDPluginDriverLateDropped, counter+1);
+            } else {
+                getIntegerParam(NDPluginDriverLateArrays, &counter);
+                setIntegerParam(NDPluginDriverLateArrays, counter+1);
+                dispatchArray(pArray);
+            }
+            return;
+        }
+    }
+    if (this->inputList.size() > 0) {
+        if (pArray->uniqueId < this->inputList.rbegin()->pArray->uniqueId) {
+            getIntegerParam(NDPluginDriverDisorderedArrays, &counter);
+            setIntegerParam(NDPluginDriverDisorderedArrays, counter+1);
+        }
+    }
+    /* Make room if the list is already full, e.g. because sortSize has been reduced */
+    if ((int)this->inputList.size() >= sortSize) flushInputList(0);
+    /* The array is released when it leaves the list */
+    pArray->reserve();
+    element.pArray = pArray;
+    element.addr = 0;
+    epicsTimeGetCurrent(&element.insertTime);
+    this->inputList.insert(element);
+    flushInputList(0);
+}
+
+/** Passes on the arrays at the head of the input sort list that are ready, and restarts the sort
+  * timer for the next one.  This method is called with the lock taken.
+  * \param[in] flushAll 1 to pass on all of the arrays in the list. */
+void NDPluginDriver::flushInputList(int flushAll)
+{
+    std::multiset<NDPluginSortElement>::iterator it;
+    epicsTimeStamp tNow;
+    double sortTime, waited=0.;
+    int sortSize;
+    NDArray *pArray;
+    bool ready;
+
+    getIntegerParam(NDPluginDriverSortSize, &sortSize);
+    getDoubleParam(NDPluginDriverSortTime, &sortTime);
+    epicsTimeGetCurrent(&tNow);
+    while (!this->inputList.empty()) {
+        it = this->inputList.begin();
+        pArray = it->pArray;
+        waited = epicsTimeDiffInSeconds(&tNow, &it->insertTime);
+        ready = flushAll ||
+                (this->haveSentId && (pArray->uniqueId == this->lastSentId+1)) ||
+                (waited >= sortTime) ||
+                ((int)this->inputList.size() >= sortSize);
+        if (!ready) break;
+        this->inputList.erase(it);
+        this->lastSentId = pArray->uniqueId;
+        this->haveSentId = true;
+        dispatchArray(pArray);
+        pArray->release();
+    }
+    setIntegerParam(NDPluginDriverSortFree, sortSize - (int)this->inputList.size());
+    if (!this->inputList.empty()) {
+        epicsTimerStartDelay(this->sortTimerId, sortTime - waited);
+    }
+}
+
+/** Called from the private timer queue of the plugin when the array at the head of the input sort
+  * list has waited for NDPluginDriverSortTime.  This method should really be private, but it must be called from a 
+  * C-linkage callback function, so it must be public. */ 
+void NDPluginDriver::sortTimerCallback(void)
+{
+    this->lock();
+    flushInputList(0);
     callParamCallbacks();
     this->unlock();
 }
@@ -153,44 +300,166 @@ void NDPluginDriver::driverCallback(asynUser *pasynUser, void *genericPointer)
 
 void processTask(void *drvPvt)
 {
-    NDPluginDriver *pPvt = (NDPluginDriver *)drvPvt;
+    NDPluginThread *pThread = (NDPluginThread *)drvPvt;
     
-    pPvt->processTask();
+    epicsThreadPrivateSet(pThread->privateId, pThread);
+    pThread->pPlugin->processTask();
 }
 
 /** Method runs as a separate thread, waiting for NDArrays to arrive in a message queue
   * and processing them.
-  * This thread is used when NDPluginDriverBlockingCallbacks=0.
+  * These threads are used when NDPluginDriverBlockingCallbacks=0.  There are maxThreads of them,
+  * of which NDPluginDriverNumThreads take arrays from the queue.  When there is more than one
+  * processCallbacks is called from several threads, so it only runs concurrently while derived
+  * classes have released the lock.
   * This method should really be private, but it must be called from a 
   * C-linkage callback function, so it must be public. */ 
 void NDPluginDriver::processTask(void)
 {
     /* This thread processes a new array when it arrives */
-    int queueSize, queueFree;
+    NDPluginThread *pThread = getThread();
 
     /* Loop forever */
     NDArray *pArray;
     
     while (1) {
+        /* Threads beyond NDPluginDriverNumThreads wait until it is increased */
+        while (pThread->index >= this->numThreads) {
+            epicsEventMustWait(pThread->wakeEvent);
+        }
         /* Wait for an array to arrive from the queue */    
-        epicsMessageQueueReceive(this->msgQId, &pArray, sizeof(&pArray));
+        pArray = this->pQueue->receive();
         
         /* Take the lock.  The function we are calling must release the lock
          * during time-consuming operations when it does not need it. */
         this->lock();
-        getIntegerParam(NDPluginDriverQueueSize, &queueSize);
-        queueFree = queueSize - epicsMessageQueuePending(this->msgQId);
-        setIntegerParam(NDPluginDriverQueueFree, queueFree);
+        setIntegerParam(NDPluginDriverQueueFree, this->pQueue->capacity() - this->pQueue->pending());
 
         /* Call the function that does the business of this callback */
         processCallbacks(pArray); 
         this->unlock();
         
+        /* Output arrays that were waiting for this one can now be sent */
+        removePending(pArray);
+        flushSortList();
+
         /* We are done with this array buffer */
         pArray->release();
     }
 }
 
+/** Does the NDArray callbacks for an output array of the plugin.
+  * Derived classes that can have more than one thread executing processCallbacks should call this
+  * rather than doCallbacksGenericPointer, and must call it with the lock released.
+  * If NDPluginDriverSortMode=1 and NDPluginDriverNumThreads>1 the array is held until all input
+  * arrays with smaller uniqueId have been processed, so that the output arrays are in uniqueId order.
+  * \param[in] pArray The output array.
+  * \param[in] addr The asyn address to do the callbacks on. */
+void NDPluginDriver::doArrayCallbacks(NDArray *pArray, int addr)
+{
+    NDPluginSortElement element;
+
+    if (!this->sortMode || (this->numThreads <= 1)) {
+        doCallbacksGenericPointer(pArray, NDArrayData, addr);
+        return;
+    }
+    /* The array is released when it leaves the sort list */
+    pArray->reserve();
+    element.pArray = pArray;
+    element.addr = addr;
+    epicsMutexLock(this->sortLock);
+    this->sortList.insert(element);
+    epicsMutexUnlock(this->sortLock);
+    flushSortList();
+}
+
+/** Removes an input array from the list of pending arrays.
+  * \param[in] pArray The input array. */
+void NDPluginDriver::removePending(NDArray *pArray)
+{
+    std::multiset<int>::iterator it;
+
+    epicsMutexLock(this->sortLock);
+    it = this->pendingIds.find(pArray->uniqueId);
+    if (it != this->pendingIds.end()) this->pendingIds.erase(it);
+    epicsMutexUnlock(this->sortLock);
+}
+
+/** Sends the arrays at the head of the sort list whose uniqueId is not greater than that of any
+  * pending input array.  Sends all of the arrays if sorting has been turned off.
+  * Only one thread at a time sends arrays, so that they are sent in order, but the sort lock is
+  * released during the downstream callbacks.  A thread that finds another thread sending leaves
+  * its arrays to that thread, which checks the sort list again after each callback. */
+void NDPluginDriver::flushSortList(void)
+{
+    std::multiset<NDPluginSortElement>::iterator it;
+    NDArray *pArray;
+    int addr;
+    bool sorting;
+
+    epicsMutexLock(this->sortLock);
+    if (this->sortFlushing) {
+        epicsMutexUnlock(this->sortLock);
+        return;
+    }
+    this->sortFlushing = true;
+    while (1) {
+        sorting = this->sortMode && (this->numThreads > 1);
+        if (!sorting) this->pendingIds.clear();
+        if (this->sortList.empty()) break;
+        it = this->sortList.begin();
+        if (sorting && !this->pendingIds.empty() &&
+            (it->pArray->uniqueId > *this->pendingIds.begin())) break;
+        pArray = it->pArray;
+        addr = it->addr;
+        this->sortList.erase(it);
+        epicsMutexUnlock(this->sortLock);
+        doCallbacksGenericPointer(pArray, NDArrayData, addr);
+        pArray->release();
+        epicsMutexLock(this->sortLock);
+    }
+    this->sortFlushing = false;
+    epicsMutexUnlock(this->sortLock);
+}
+
+/** Returns the NDPluginThread for the calling thread, creating it if the calling thread is not
+  * one of the worker threads and has not called this before. */
+NDPluginThread *NDPluginDriver::getThread(void)
+{
+    NDPluginThread *pThread;
+
+    pThread = (NDPluginThread *)epicsThreadPrivateGet(this->threadPrivateId);
+    if (pThread) return pThread;
+    pThread = (NDPluginThread *)callocMustSucceed(1, sizeof(NDPluginThread), "NDPluginDriver::getThread");
+    pThread->pPlugin = this;
+    pThread->privateId = this->threadPrivateId;
+    pThread->index = -1;
+    epicsMutexLock(this->sortLock);
+    pThread->pNext = this->pOtherThreads;
+    this->pOtherThreads = pThread;
+    epicsMutexUnlock(this->sortLock);
+    epicsThreadPrivateSet(this->threadPrivateId, pThread);
+    return pThread;
+}
+
+/** Returns a scratch buffer that belongs to the calling thread.
+  * Derived classes that run with NDPluginDriverNumThreads>1 can use this for temporary storage in
+  * processCallbacks without taking the lock.  The buffer is kept between calls and only reallocated
+  * when a larger size is requested, so its contents are undefined.
+  * \param[in] size The number of bytes needed.
+  * \return A pointer to the buffer, or NULL if it could not be allocated. */
+void *NDPluginDriver::threadScratch(size_t size)
+{
+    NDPluginThread *pThread = getThread();
+
+    if (size > pThread->scratchSize) {
+        free(pThread->pScratch);
+        pThread->pScratch = malloc(size);
+        pThread->scratchSize = pThread->pScratch ? size : 0;
+    }
+    return pThread->pScratch;
+}
+
 /** Register or unregister to receive asynGenericPointer (NDArray) callbacks from the driver.
   * Note: this function must be called with the lock released, otherwise a deadlock can occur
   * in the call to cancelInterruptUser.
@@ -291,6 +560,7 @@ asynStatus NDPluginDriver::writeInt32(asynUser *pasynUser, epicsInt32 value)
     int function = pasynUser->reason;
     int addr=0;
     asynStatus status = asynSuccess;
+    int i;
     static const char* functionName = "writeInt32";
 
     status = getAddress(pasynUser, &addr); if (status != asynSuccess) return(status);
@@ -318,6 +588,32 @@ asynStatus NDPluginDriver::writeInt32(asynUser *pasynUser, epicsInt32 value)
         this->unlock();
         status = connectToArrayPort();
         this->lock();
+    } else if (function == NDPluginDriverNumThreads) {
+        if (value < 1) value = 1;
+        if (value > this->maxThreads) value = this->maxThreads;
+        setIntegerParam(addr, function, value);
+        this->numThreads = value;
+        for (i=0; i<this->maxThreads; i++) {
+            epicsEventSignal(this->pThreads[i].wakeEvent);
+        }
+        this->unlock();
+        flushSortList();
+        this->lock();
+    } else if (function == NDPluginDriverQueueHighWater) {
+        this->pQueue->resetHighWater();
+        setIntegerParam(addr, function, this->pQueue->highWater());
+    } else if (function == NDPluginDriverSortSize) {
+        if (value <= 0) {
+            flushInputList(1);
+            this->haveSentId = false;
+        } else {
+            flushInputList(0);
+        }
+    } else if (function == NDPluginDriverSortMode) {
+        this->sortMode = value;
+        this->unlock();
+        flushSortList();
+        this->lock();
     } else {
         /* If this parameter belongs to a base class call its method */
         if (function < FIRST_NDPLUGIN_PARAM) 
@@ -446,11 +742,14 @@ asynStatus NDPluginDriver::readInt32Array(asynUser *pasynUser, epicsInt32 *value
   * \param[in] autoConnect The autoConnect flag for the asyn port driver.
   * \param[in] priority The thread priority for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
   * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  * \param[in] maxThreads The number of threads that can execute processCallbacks when 
+  *            NDPluginDriverBlockingCallbacks=0.  Derived classes must only pass a value greater than 1
+  *            if their processCallbacks can run in several threads at once.
   */
 NDPluginDriver::NDPluginDriver(const char *portName, int queueSize, int blockingCallbacks, 
                                const char *NDArrayPort, int NDArrayAddr, int maxAddr, int numParams,
                                int maxBuffers, size_t maxMemory, int interfaceMask, int interruptMask,
-                               int asynFlags, int autoConnect, int priority, int stackSize)
+                               int asynFlags, int autoConnect, int priority, int stackSize, int maxThreads)
 
     : asynNDArrayDriver(portName, maxAddr, numParams+NUM_NDPLUGIN_PARAMS, maxBuffers, maxMemory,
           interfaceMask | asynInt32Mask | asynFloat64Mask | asynOctetMask | asynInt32ArrayMask | asynDrvUserMask,
@@ -461,6 +760,8 @@ NDPluginDriver::NDPluginDriver(const char *portName, int queueSize, int blocking
     static const char *functionName = "NDPluginDriver";
     char taskName[256];
     asynUser *pasynUser;
+    NDPluginThread *pThread;
+    int i;
 
     /* Initialize some members to 0 */
     memset(&this->lastProcessTime, 0, sizeof(this->lastProcessTime));
@@ -469,6 +770,21 @@ NDPluginDriver::NDPluginDriver(const char *portName, int queueSize, int blocking
     this->asynGenericPointerPvt = NULL;
     this->asynGenericPointerInterruptPvt = NULL;
     this->connectedToArrayPort = false;
+    if (maxThreads < 1) maxThreads = 1;
+    this->maxThreads = maxThreads;
+    this->numThreads = maxThreads;
+    this->sortMode = 1;
+    this->sortFlushing = false;
+    this->pOtherThreads = NULL;
+    this->sortLock = epicsMutexMustCreate();
+    this->threadPrivateId = epicsThreadPrivateCreate();
+    this->lastSentId = 0;
+    this->haveSentId = false;
+    /* The timer queue is not shared, because its callback passes arrays on, which can take a while
+     * with blocking callbacks, and would hold up the timers of other plugins and drivers */
+    this->sortTimerQueueId = epicsTimerQueueAllocate(0, epicsThreadPriorityMedium);
+    this->sortTimerId = epicsTimerQueueCreateTimer(this->sortTimerQueueId, ::sortTimerCallback, this);
+    this->pThreads = (NDPluginThread *)callocMustSucceed(maxThreads, sizeof(NDPluginThread), functionName);
        
     /* Create asynUser for communicating with NDArray port */
     pasynUser = pasynManager->createAsynUser(0, 0);
@@ -476,27 +792,30 @@ NDPluginDriver::NDPluginDriver(const char *portName, int queueSize, int blocking
     this->pasynUserGenericPointer = pasynUser;
     this->pasynUserGenericPointer->reason = NDArrayData;
 
-    /* Create the message queue for the input arrays */
-    this->msgQId = epicsMessageQueueCreate(queueSize, sizeof(NDArray*));
-    if (!this->msgQId) {
-        printf("%s:%s: epicsMessageQueueCreate failure\n", driverName, functionName);
-        return;
-    }
+    /* Create the queue for the input arrays */
+    this->pQueue = new NDArrayQueue(queueSize);
     
     /* We use the same stack size for our callback thread as for the port thread */
     if (stackSize <= 0) stackSize = epicsThreadGetStackSize(epicsThreadStackMedium);
 
-    strcpy(taskName, portName);
-    strcat(taskName, "_Plugin");
-    /* Create the thread that handles the NDArray callbacks */
-    status = (asynStatus)(epicsThreadCreate(taskName,
-                          epicsThreadPriorityMedium,
-                          stackSize,
-                          (EPICSTHREADFUNC)::processTask,
-                          this) == NULL);
-    if (status) {
-        printf("%s:%s: epicsThreadCreate failure\n", driverName, functionName);
-        return;
+    /* Create the threads that handle the NDArray callbacks */
+    for (i=0; i<maxThreads; i++) {
+        pThread = &this->pThreads[i];
+        pThread->pPlugin = this;
+        pThread->privateId = this->threadPrivateId;
+        pThread->index = i;
+        pThread->wakeEvent = epicsEventMustCreate(epicsEventEmpty);
+        if (i == 0) epicsSnprintf(taskName, sizeof(taskName), "%s_Plugin", portName);
+        else        epicsSnprintf(taskName, sizeof(taskName), "%s_Plugin_%d", portName, i);
+        status = (asynStatus)(epicsThreadCreate(taskName,
+                              epicsThreadPriorityMedium,
+                              stackSize,
+                              (EPICSTHREADFUNC)::processTask,
+                              pThread) == NULL);
+        if (status) {
+            printf("%s:%s: epicsThreadCreate failure\n", driverName, functionName);
+            return;
+        }
     }
     createParam(NDPluginDriverArrayPortString,         asynParamOctet, &NDPluginDriverArrayPort);
     createParam(NDPluginDriverArrayAddrString,         asynParamInt32, &NDPluginDriverArrayAddr);
@@ -507,6 +826,18 @@ NDPluginDriver::NDPluginDriver(const char *portName, int queueSize, int blocking
     createParam(NDPluginDriverEnableCallbacksString,   asynParamInt32, &NDPluginDriverEnableCallbacks);
     createParam(NDPluginDriverBlockingCallbacksString, asynParamInt32, &NDPluginDriverBlockingCallbacks);
     createParam(NDPluginDriverMinCallbackTimeString,   asynParamFloat64, &NDPluginDriverMinCallbackTime);
+    createParam(NDPluginDriverMaxThreadsString,        asynParamInt32, &NDPluginDriverMaxThreads);
+    createParam(NDPluginDriverNumThreadsString,        asynParamInt32, &NDPluginDriverNumThreads);
+    createParam(NDPluginDriverSortModeString,          asynParamInt32, &NDPluginDriverSortMode);
+    createParam(NDPluginDriverQueueHighWaterString,    asynParamInt32, &NDPluginDriverQueueHighWater);
+    createParam(NDPluginDriverQueueWakeupsString,      asynParamInt32, &NDPluginDriverQueueWakeups);
+    createParam(NDPluginDriverSortSizeString,          asynParamInt32, &NDPluginDriverSortSize);
+    createParam(NDPluginDriverSortTimeString,          asynParamFloat64, &NDPluginDriverSortTime);
+    createParam(NDPluginDriverSortFreeString,          asynParamInt32, &NDPluginDriverSortFree);
+    createParam(NDPluginDriverSortDropLateString,      asynParamInt32, &NDPluginDriverSortDropLate);
+    createParam(NDPluginDriverDisorderedArraysString,  asynParamInt32, &NDPluginDriverDisorderedArrays);
+    createParam(NDPluginDriverLateArraysString,        asynParamInt32, &NDPluginDriverLateArrays);
+    createParam(NDPluginDriverLateDroppedString,       asynParamInt32, &NDPluginDriverLateDropped);
 
     /* Here we set the values of read-only parameters and of read/write parameters that cannot
      * or should not get their values from the database.  Note that values set here will override
@@ -520,5 +851,17 @@ NDPluginDriver::NDPluginDriver(const char *portName, int queueSize, int blocking
     setIntegerParam(NDPluginDriverDroppedArrays, 0);
     setIntegerParam(NDPluginDriverQueueSize, queueSize);
     setIntegerParam(NDPluginDriverQueueFree, queueSize);
+    setIntegerParam(NDPluginDriverMaxThreads, maxThreads);
+    setIntegerParam(NDPluginDriverNumThreads, maxThreads);
+    setIntegerParam(NDPluginDriverSortMode, 1);
+    setIntegerParam(NDPluginDriverQueueHighWater, 0);
+    setIntegerParam(NDPluginDriverQueueWakeups, 0);
+    setIntegerParam(NDPluginDriverSortSize, 0);
+    setDoubleParam (NDPluginDriverSortTime, 0.1);
+    setIntegerParam(NDPluginDriverSortFree, 0);
+    setIntegerParam(NDPluginDriverSortDropLate, 0);
+    setIntegerParam(NDPluginDriverDisorderedArrays, 0);
+    setIntegerParam(NDPluginDriverLateArrays, 0);
+    setIntegerParam(NDPluginDriverLateDropped, 0);
 }
 
@@ -2,10 +2,14 @@
 #define NDPluginDriver_H
 
 #include <epicsTypes.h>
-#include <epicsMessageQueue.h>
 #include <epicsTime.h>
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsTimer.h>
+#include <set>
 
 #include "asynNDArrayDriver.h"
+#include "NDArrayQueue.h"
 
 #define NDPluginDriverArrayPortString           "NDARRAY_PORT"          /**< (asynOctet,    r/w) The port for the NDArray interface */
 #define NDPluginDriverArrayAddrString           "NDARRAY_ADDR"          /**< (asynInt32,    r/w) The address on the port */
@@ -13,10 +17,34 @@
 #define NDPluginDriverDroppedArraysString       "DROPPED_ARRAYS"        /**< (asynInt32,    r/w) Number of dropped arrays */
 #define NDPluginDriverQueueSizeString           "QUEUE_SIZE"            /**< (asynInt32,    r/w) Total queue elements */ 
 #define NDPluginDriverQueueFreeString           "QUEUE_FREE"            /**< (asynInt32,    r/w) Free queue elements */
+#define NDPluginDriverQueueHighWaterString      "QUEUE_HIGH_WATER"      /**< (asynInt32,    r/w) Maximum queue elements used, write to reset */
+#define NDPluginDriverQueueWakeupsString        "QUEUE_WAKEUPS"         /**< (asynInt32,    r/o) Number of times a waiting plugin thread was woken up */
 #define NDPluginDriverEnableCallbacksString     "ENABLE_CALLBACKS"      /**< (asynInt32,    r/w) Enable callbacks from driver (1=Yes, 0=No) */
 #define NDPluginDriverBlockingCallbacksString   "BLOCKING_CALLBACKS"    /**< (asynInt32,    r/w) Callbacks block (1=Yes, 0=No) */
 #define NDPluginDriverMinCallbackTimeString     "MIN_CALLBACK_TIME"     /**< (asynFloat64,  r/w) Minimum time between calling processCallbacks 
                                                                          *  to execute plugin code */
+#define NDPluginDriverMaxThreadsString          "MAX_THREADS"           /**< (asynInt32,    r/o) Maximum number of threads that can execute processCallbacks */
+#define NDPluginDriverNumThreadsString          "NUM_THREADS"           /**< (asynInt32,    r/w) Number of threads executing processCallbacks */
+#define NDPluginDriverSortModeString            "SORT_MODE"             /**< (asynInt32,    r/w) Output arrays in uniqueId order when NumThreads>1 (0=No, 1=Yes) */
+#define NDPluginDriverSortSizeString            "SORT_SIZE"             /**< (asynInt32,    r/w) Number of input arrays held to restore uniqueId order, 0=disabled */
+#define NDPluginDriverSortTimeString            "SORT_TIME"             /**< (asynFloat64,  r/w) Maximum time an input array waits for earlier arrays */
+#define NDPluginDriverSortFreeString            "SORT_FREE"             /**< (asynInt32,    r/o) Free elements in the input sort list */
+#define NDPluginDriverSortDropLateString        "SORT_DROP_LATE"        /**< (asynInt32,    r/w) Drop arrays that arrive too late to be sorted (0=No, 1=Yes) */
+#define NDPluginDriverDisorderedArraysString    "DISORDERED_ARRAYS"     /**< (asynInt32,    r/w) Number of input arrays that arrived out of order */
+#define NDPluginDriverLateArraysString          "LATE_ARRAYS"           /**< (asynInt32,    r/w) Number of input arrays that arrived too late to be sorted and were passed on */
+#define NDPluginDriverLateDroppedString         "LATE_DROPPED"          /**< (asynInt32,    r/w) Number of input arrays that arrived too late to be sorted and were dropped */
+
+struct NDPluginThread;
+
+/** An array waiting in one of the sort lists, ordered by uniqueId */
+typedef struct NDPluginSortElement {
+    NDArray *pArray;    /**< The array */
+    int addr;           /**< The asyn address to do callbacks on for output arrays */
+    epicsTimeStamp insertTime; /**< The time the array was put in the list */
+    bool operator<(const NDPluginSortElement& other) const {
+        return pArray->uniqueId < other.pArray->uniqueId;
+    }
+} NDPluginSortElement;
 
 /** Class from which actual plugin drivers are derived; derived from asynNDArrayDriver */
 class epicsShareClass NDPluginDriver : public asynNDArrayDriver {
@@ -24,7 +52,7 @@ public:
     NDPluginDriver(const char *portName, int queueSize, int blockingCallbacks, 
                    const char *NDArrayPort, int NDArrayAddr, int maxAddr, int numParams,
                    int maxBuffers, size_t maxMemory, int interfaceMask, int interruptMask,
-                   int asynFlags, int autoConnect, int priority, int stackSize);
+                   int asynFlags, int autoConnect, int priority, int stackSize, int maxThreads=1);
                  
     /* These are the methods that we override from asynNDArrayDriver */
     virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
@@ -36,10 +64,14 @@ public:
     /* These are the methods that are new to this class */
     virtual void driverCallback(asynUser *pasynUser, void *genericPointer);
     virtual void processTask(void);
+    void sortTimerCallback(void);
 
 protected:
     virtual void processCallbacks(NDArray *pArray);
     virtual asynStatus connectToArrayPort(void);    
+    virtual void getDimensions(NDArray *pArray, size_t *dims);
+    void doArrayCallbacks(NDArray *pArray, int addr=0);
+    void *threadScratch(size_t size);
 
 protected:
     int NDPluginDriverArrayPort;
@@ -52,10 +84,28 @@ protected:
     int NDPluginDriverEnableCallbacks;
     int NDPluginDriverBlockingCallbacks;
     int NDPluginDriverMinCallbackTime;
-    #define LAST_NDPLUGIN_PARAM NDPluginDriverMinCallbackTime
+    int NDPluginDriverMaxThreads;
+    int NDPluginDriverNumThreads;
+    int NDPluginDriverSortMode;
+    int NDPluginDriverSortSize;
+    int NDPluginDriverSortTime;
+    int NDPluginDriverSortFree;
+    int NDPluginDriverSortDropLate;
+    int NDPluginDriverDisorderedArrays;
+    int NDPluginDriverLateArrays;
+    int NDPluginDriverLateDropped;
+    int NDPluginDriverQueueHighWater;
+    int NDPluginDriverQueueWakeups;
+    #define LAST_NDPLUGIN_PARAM NDPluginDriverQueueWakeups
 
 private:
     virtual asynStatus setArrayInterrupt(int connect);
+    void dispatchArray(NDArray *pArray);
+    void resequenceArray(NDArray *pArray, int sortSize);
+    void flushInputList(int flushAll);
+    NDPluginThread *getThread(void);
+    void removePending(NDArray *pArray);
+    void flushSortList(void);
     
     /* The asyn interfaces we access as a client */
     void *asynGenericPointerInterruptPvt;
@@ -65,9 +115,24 @@ private:
     void *asynGenericPointerPvt;                /**< Handle for connecting to NDArray driver */
     asynGenericPointer *pasynGenericPointer;    /**< asyn interface for connecting to NDArray driver */
     bool connectedToArrayPort;
-    epicsMessageQueueId msgQId;
+    NDArrayQueue *pQueue;                       /**< Queue of input arrays for the worker threads */
     epicsTimeStamp lastProcessTime;
     int dimsPrev[ND_ARRAY_MAX_DIMS];
+    int maxThreads;                             /**< Number of worker threads created */
+    int numThreads;                             /**< Number of worker threads taking arrays from the queue */
+    int sortMode;                               /**< 1 if output arrays are sorted when numThreads>1 */
+    bool sortFlushing;                          /**< true while a thread is sending arrays from the sort list */
+    NDPluginThread *pThreads;                   /**< The worker threads */
+    NDPluginThread *pOtherThreads;              /**< Scratch state for other threads that call processCallbacks */
+    epicsThreadPrivateId threadPrivateId;       /**< Finds the NDPluginThread of the calling thread */
+    epicsMutexId sortLock;                      /**< Protects the sort list and the list of pending input arrays */
+    std::multiset<NDPluginSortElement> sortList; /**< Output arrays waiting for earlier arrays to be processed */
+    std::multiset<int> pendingIds;              /**< uniqueIds of input arrays queued or being processed */
+    std::multiset<NDPluginSortElement> inputList; /**< Input arrays waiting to be passed on in uniqueId order */
+    epicsTimerQueueId sortTimerQueueId;         /**< Private timer queue of sortTimerId */
+    epicsTimerId sortTimerId;                   /**< Passes on input arrays that have waited NDPluginDriverSortTime */
+    int lastSentId;                             /**< uniqueId of the last input array passed on from inputList */
+    bool haveSentId;                            /**< false until an array has been passed on from inputList */
 };
 #define NUM_NDPLUGIN_PARAMS ((int)(&LAST_NDPLUGIN_PARAM - &FIRST_NDPLUGIN_PARAM + 1))
 
@@ -27,6 +27,7 @@
 #include <epicsExport.h>
 #include <NDPluginDriver.h>
 #include "NDPluginFile.h"
+#include "NDFileCaptureSpill.h"
 
 
 static const char *driverName="NDPluginFile";
@@ -198,6 +199,8 @@ asynStatus NDPluginFile::writeFileBase()
     bool doLazyOpen;
     int deleteDriverFile;
     NDArray *pArray;
+    void *pSpillData = NULL;
+    bool spilled;
     NDAttribute *pAttribute;
     char driverFileName[MAX_FILENAME_LEN];
     char errorMessage[256];
@@ -265,11 +268,24 @@ asynStatus NDPluginFile::writeFileBase()
             }
             setIntegerParam(NDWriteFile, 1);
             callParamCallbacks();
-            if (this->supportsMultipleArrays)
+            /* The oldest arrays are read back from the scratch file, into a single buffer */
+            if (this->pCaptureSpill && (this->pCaptureSpill->numRecords() > 0)) {
+                pSpillData = NDFileCaptureSpill::allocBuffer(this->pCaptureSpill->recordBytes());
+                if (!pSpillData || this->pCaptureSpill->rewind()) {
+                    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                        "%s:%s: ERROR, cannot read capture scratch file\n",
+                        driverName, functionName);
+                    setIntegerParam(NDFileWriteStatus, NDFileWriteError);
+                    setStringParam(NDFileWriteMessage, "ERROR, cannot read capture scratch file");
+                    status = asynError;
+                }
+            }
+            if ((status == asynSuccess) && this->supportsMultipleArrays)
                 status = this->openFileBase(NDFileModeWrite | NDFileModeMultiple, this->pArrays[0]);
             if (status == asynSuccess) {
                 for (i=0; i<numCaptured; i++) {
                     pArray = this->pCapture[i];
+                    spilled = (pArray->pData == NULL);
                     if (!this->supportsMultipleArrays)
                         status = this->openFileBase(NDFileModeWrite, pArray);
                     else
@@ -277,10 +293,18 @@ asynStatus NDPluginFile::writeFileBase()
                     if (status == asynSuccess) {
                         this->unlock();
                         epicsMutexLock(this->fileMutexId);
-                        status = this->writeFile(pArray);
+                        if (spilled) {
+                            status = this->pCaptureSpill->readRecord(pSpillData);
+                            pArray->pData = pSpillData;
+                        }
+                        if (status == asynSuccess)
+                            status = this->writeFile(pArray);
                         epicsMutexUnlock(this->fileMutexId);
                         this->lock();
-                        doNDArrayCallbacks(pArray);
+                        if (status == asynSuccess)
+                            doNDArrayCallbacks(pArray);
+                        if (spilled)
+                            pArray->pData = NULL;
                         if (status) {
                             epicsSnprintf(errorMessage, sizeof(errorMessage)-1, 
                                 "Error writing file, status=%d", status);
@@ -296,7 +320,8 @@ asynStatus NDPluginFile::writeFileBase()
                     }
                 }
             }
-            freeCaptureBuffer(numCapture);
+            NDFileCaptureSpill::freeBuffer(pSpillData);
+            freeCaptureBuffer();
             if ((status == asynSuccess) && this->supportsMultipleArrays) 
                 status = this->closeFileBase();
             this->registerInitFrameInfo(NULL);
@@ -369,20 +394,151 @@ asynStatus NDPluginFile::writeFileBase()
     return((asynStatus)status);
 }
 
-void NDPluginFile::freeCaptureBuffer(int numCapture)
+/** Allocates the capture buffer for a new capture.
+  * One array is created for each frame to capture, but only as many data buffers as fit in NDFileCaptureBudget
+  * are allocated.  When the budget does not hold all of the frames a scratch file is created in
+  * NDFileCaptureSpillPath (or NDFilePath if that is empty) for the oldest frames.
+  * \param[in] pArray An array with the dimensions and data type of the frames to capture.
+  * \param[in] numCapture The number of frames to capture. */
+asynStatus NDPluginFile::allocCaptureBuffer(NDArray *pArray, int numCapture)
 {
+    NDArrayInfo_t arrayInfo;
+    double budget;
+    size_t bufferBytes;
+    char spillPath[MAX_FILENAME_LEN];
+    char spillFile[MAX_FILENAME_LEN];
+    int len;
     int i;
-    NDArray *pArray;
-    
-    if (!this->pCapture) return;
-    /* Free the capture buffer */
+    static const char* functionName = "allocCaptureBuffer";
+
+    /* Free the buffer of a capture that was stopped without being written */
+    freeCaptureBuffer();
+
+    pArray->getInfo(&arrayInfo);
+    getDoubleParam(NDFileCaptureBudget, &budget);
+    this->captureBufferSize = numCapture;
+    if ((budget > 0.) && (arrayInfo.totalBytes > 0)) {
+        double numFit = budget * 1024. * 1024. / arrayInfo.totalBytes;
+        if (numFit < numCapture) this->captureBufferSize = (numFit < 1.) ? 1 : (int)numFit;
+    }
+
+    bufferBytes = arrayInfo.totalBytes;
+    if (this->captureBufferSize < numCapture) {
+        getStringParam(NDFileCaptureSpillPath, sizeof(spillPath), spillPath);
+        if (strlen(spillPath) == 0) getStringParam(NDFilePath, sizeof(spillPath), spillPath);
+        len = (int)strlen(spillPath);
+        epicsSnprintf(spillFile, sizeof(spillFile), "%s%s%s.capture", spillPath,
+                      ((len > 0) && (spillPath[len-1] != '/') && (spillPath[len-1] != '\\')) ? "/" : "",
+                      this->portName);
+        this->pCaptureSpill = new NDFileCaptureSpill(this->pasynUserSelf, arrayInfo.totalBytes);
+        if (this->pCaptureSpill->open(spillFile)) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s ERROR: cannot create capture scratch file %s\n",
+                driverName, functionName, spillFile);
+            freeCaptureBuffer();
+            return(asynError);
+        }
+        /* The buffers are written to the scratch file, so they must have the size of its records */
+        bufferBytes = this->pCaptureSpill->recordBytes();
+    }
+
+    this->pCapture = (NDArray **)calloc(numCapture, sizeof(NDArray *));
+    this->pCaptureData = (void **)calloc(this->captureBufferSize, sizeof(void *));
+    if (!this->pCapture || !this->pCaptureData) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s ERROR: cannot allocate capture buffer\n",
+            driverName, functionName);
+        freeCaptureBuffer();
+        return(asynError);
+    }
+    this->captureNumArrays = numCapture;
     for (i=0; i<numCapture; i++) {
-        pArray = this->pCapture[i];
-        if (!pArray) break;
-        delete pArray;
+        this->pCapture[i] = new NDArray;
+        this->pCapture[i]->dataSize = arrayInfo.totalBytes;
+        this->pCapture[i]->ndims = pArray->ndims;
+    }
+    for (i=0; i<this->captureBufferSize; i++) {
+        this->pCaptureData[i] = NDFileCaptureSpill::allocBuffer(bufferBytes);
+        if (!this->pCaptureData[i]) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s ERROR: cannot allocate capture array for buffer %d\n",
+                driverName, functionName, i);
+            freeCaptureBuffer();
+            return(asynError);
+        }
     }
-    free(this->pCapture);
-    this->pCapture = NULL;
+    setDoubleParam(NDFileCaptureMemory, 0.);
+    setDoubleParam(NDFileCaptureSpilled, 0.);
+    setDoubleParam(NDFileCaptureSpillRate, 0.);
+    return(asynSuccess);
+}
+
+/** Copies an array into the capture buffer.
+  * When all of the data buffers are in use the oldest array held in memory is first written to the
+  * scratch file, and its buffer is reused.
+  * \param[in] pArray The array to capture.
+  * \param[in] index The index of the array in the capture. */
+asynStatus NDPluginFile::captureArray(NDArray *pArray, int index)
+{
+    NDArray *pOldest;
+    int numSpilled = 0;
+    double arrayMB;
+    static const char* functionName = "captureArray";
+
+    if (index >= this->captureBufferSize) {
+        pOldest = this->pCapture[index - this->captureBufferSize];
+        if (!this->pCaptureSpill || this->pCaptureSpill->writeRecord(pOldest->pData)) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s:%s ERROR: cannot write array %d to capture scratch file\n",
+                driverName, functionName, index - this->captureBufferSize);
+            setIntegerParam(NDFileWriteStatus, NDFileWriteError);
+            setStringParam(NDFileWriteMessage, "ERROR, cannot write capture scratch file");
+            return(asynError);
+        }
+        pOldest->pData = NULL;
+    }
+    this->pCapture[index]->pData = this->pCaptureData[index % this->captureBufferSize];
+    this->pNDArrayPool->copy(pArray, this->pCapture[index], 1);
+
+    arrayMB = this->pCapture[index]->dataSize / (1024. * 1024.);
+    if (this->pCaptureSpill) {
+        numSpilled = this->pCaptureSpill->numRecords();
+        setDoubleParam(NDFileCaptureSpillRate, this->pCaptureSpill->writeRate());
+    }
+    setDoubleParam(NDFileCaptureMemory, (index + 1 - numSpilled) * arrayMB);
+    setDoubleParam(NDFileCaptureSpilled, numSpilled * arrayMB);
+    return(asynSuccess);
+}
+
+/** Frees the capture buffer and deletes the capture scratch file. */
+void NDPluginFile::freeCaptureBuffer()
+{
+    int i;
+    
+    if (this->pCapture) {
+        for (i=0; i<this->captureNumArrays; i++) {
+            if (!this->pCapture[i]) break;
+            /* The data belongs to pCaptureData */
+            this->pCapture[i]->pData = NULL;
+            delete this->pCapture[i];
+        }
+        free(this->pCapture);
+        this->pCapture = NULL;
+    }
+    this->captureNumArrays = 0;
+    if (this->pCaptureData) {
+        for (i=0; i<this->captureBufferSize; i++) {
+            NDFileCaptureSpill::freeBuffer(this->pCaptureData[i]);
+        }
+        free(this->pCaptureData);
+        this->pCaptureData = NULL;
+    }
+    this->captureBufferSize = 0;
+    if (this->pCaptureSpill) {
+        delete this->pCaptureSpill;
+        this->pCaptureSpill = NULL;
+    }
+    setDoubleParam(NDFileCaptureMemory, 0.);
 }
 
 /** Handles the logic for when NDFileCapture changes state, starting or stopping capturing or streaming NDArrays
@@ -394,8 +550,6 @@ asynStatus NDPluginFile::doCapture(int capture)
     asynStatus status = asynSuccess;
     int fileWriteMode;
     NDArray *pArray = this->pArrays[0];
-    NDArrayInfo_t arrayInfo;
-    int i;
     int numCapture;
     static const char* functionName = "doCapture";
 
@@ -431,38 +585,11 @@ asynStatus NDPluginFile::doCapture(int capture)
                         driverName, functionName);
                     return(asynError);
                 }
-                pArray->getInfo(&arrayInfo);
                 this->registerInitFrameInfo(pArray);
-                this->pCapture = (NDArray **)calloc(numCapture, sizeof(NDArray *));
-                if (!this->pCapture) {
-                    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                        "%s:%s ERROR: cannot allocate capture buffer\n",
-                        driverName, functionName);
+                if (this->allocCaptureBuffer(pArray, numCapture)) {
                     setIntegerParam(NDFileCapture, 0);
                     return(asynError);
                 }
-                for (i=0; i<numCapture; i++) {
-                    pCapture[i] = new NDArray;
-                    if (!this->pCapture[i]) {
-                        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                            "%s:%s ERROR: cannot allocate capture buffer %d\n",
-                            driverName, functionName, i);
-                        setIntegerParam(NDFileCapture, 0);
-                        freeCaptureBuffer(numCapture);
-                        return(asynError);
-                    }
-                    this->pCapture[i]->dataSize = arrayInfo.totalBytes;
-                    this->pCapture[i]->pData = malloc(arrayInfo.totalBytes);
-                    this->pCapture[i]->ndims = pArray->ndims;
-                    if (!this->pCapture[i]->pData) {
-                        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                            "%s:%s ERROR: cannot allocate capture array for buffer %d\n",
-                            driverName, functionName, i);
-                        setIntegerParam(NDFileCapture, 0);
-                        freeCaptureBuffer(numCapture);
-                        return(asynError);
-                    }
-                }
             } else {
                 /* Stop capturing, nothing to do, setting the parameter is all that is needed */
             }
@@ -722,7 +849,13 @@ void NDPluginFile::processCallbacks(NDArray *pArray)
         case NDFileModeCapture:
             if (capture) {
                 if (numCaptured < numCapture && this->isFrameValid(pArray)) {
-                    this->pNDArrayPool->copy(pArray, this->pCapture[numCaptured++], 1);
+                    if (this->captureArray(pArray, numCaptured)) {
+                        /* The scratch file is full or broken; keep the arrays captured so far */
+                        capture = 0;
+                        setIntegerParam(NDFileCapture, capture);
+                        break;
+                    }
+                    numCaptured++;
                     arrayCounter++;
                     setIntegerParam(NDFileNumCaptured, numCaptured);
                 } 
@@ -915,7 +1048,7 @@ NDPluginFile::NDPluginFile(const char *portName, int queueSize, int blockingCall
                      NDArrayPort, NDArrayAddr, maxAddr, numParams+NUM_NDPLUGIN_FILE_PARAMS, maxBuffers, maxMemory, 
                      asynGenericPointerMask, asynGenericPointerMask,
                      asynFlags, autoConnect, priority, stackSize),
-    pCapture(NULL), captureBufferSize(0)
+    pCapture(NULL), captureNumArrays(0), pCaptureData(NULL), captureBufferSize(0), pCaptureSpill(NULL)
 {
     //static const char *functionName = "NDPluginFile";
 
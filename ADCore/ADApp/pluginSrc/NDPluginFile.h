@@ -16,6 +16,8 @@
 #define NDFileModeMultiple 0x08
 typedef int NDFileOpenMode_t;
 
+class NDFileCaptureSpill;
+
 #define FILEPLUGIN_NAME        "FilePluginFileName"
 #define FILEPLUGIN_NUMBER      "FilePluginFileNumber"
 #define FILEPLUGIN_DESTINATION "FilePluginDestination"
@@ -70,7 +72,9 @@ private:
     asynStatus writeFileBase();
     asynStatus closeFileBase();
     asynStatus doCapture(int capture);
-    void       freeCaptureBuffer(int numCapture);
+    asynStatus allocCaptureBuffer(NDArray *pArray, int numCapture);
+    asynStatus captureArray(NDArray *pArray, int index);
+    void       freeCaptureBuffer();
     void       doNDArrayCallbacks(NDArray *pArray);
     asynStatus attrFileNameCheck();
     asynStatus attrFileNameSet();
@@ -78,8 +82,11 @@ private:
     void registerInitFrameInfo(NDArray *pArray); /**< Grab a copy of the NDArrayInfo_t structure for future reference */
     bool isFrameValid(NDArray *pArray); /**< Compare pArray dimensions and datatype against latched NDArrayInfo_t structure */
 
-    NDArray **pCapture;
-    int captureBufferSize;
+    NDArray **pCapture;         /**< One array for each frame to capture; only captureBufferSize of them hold data */
+    int captureNumArrays;       /**< Number of arrays in pCapture */
+    void **pCaptureData;        /**< The data buffers of the captured arrays that are held in memory */
+    int captureBufferSize;      /**< Number of buffers in pCaptureData, limited by NDFileCaptureBudget */
+    NDFileCaptureSpill *pCaptureSpill; /**< Scratch file for the oldest captured arrays when the buffers are full */
     epicsMutexId fileMutexId;
     bool useAttrFilePrefix;
     bool lazyOpen;
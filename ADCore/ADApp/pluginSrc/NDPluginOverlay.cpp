@@ -29,116 +29,116 @@
 
 //static const char *driverName="NDPluginOverlay";
 
-template <typename epicsType>
-void NDPluginOverlay::setPixel(epicsType *pValue, NDOverlay_t *pOverlay)
+/** Adds count pixels starting at pixel (ix, iy) to the spans of an overlay.
+  * A span that continues the previous one is merged with it; overlapping spans are kept, so that
+  * pixels drawn twice in NDOverlayXOR mode are still drawn twice.
+  */
+void NDPluginOverlay::addSpan(NDOverlayCache_t *pCache, size_t ix, size_t iy, size_t count)
 {
-    if ((this->arrayInfo.colorMode == NDColorModeRGB1) ||
-        (this->arrayInfo.colorMode == NDColorModeRGB2) ||
-        (this->arrayInfo.colorMode == NDColorModeRGB3)) {
-        if (pOverlay->drawMode == NDOverlaySet) {
-            *pValue = (epicsType)pOverlay->red;
-            pValue += this->arrayInfo.colorStride;
-            *pValue = (epicsType)pOverlay->green;
-            pValue += this->arrayInfo.colorStride;
-            *pValue = (epicsType)pOverlay->blue;
-        } else if (pOverlay->drawMode == NDOverlayXOR) {
-            *pValue = (epicsType)((int)*pValue ^ (int)pOverlay->red);
-            pValue += this->arrayInfo.colorStride;
-            *pValue = (epicsType)((int)*pValue ^ (int)pOverlay->green);
-            pValue += this->arrayInfo.colorStride;
-            *pValue = (epicsType)((int)*pValue ^ (int)pOverlay->blue);
+    size_t offset = iy*this->arrayInfo.yStride + ix*this->arrayInfo.xStride;
+    NDOverlaySpan_t *pSpan;
+
+    if (count == 0) return;
+    if (pCache->numSpans > 0) {
+        pSpan = &pCache->pSpans[pCache->numSpans-1];
+        if (pSpan->offset + pSpan->count*this->arrayInfo.xStride == offset) {
+            pSpan->count += count;
+            return;
         }
     }
-    else {
-        if (pOverlay->drawMode == NDOverlaySet)
-            *pValue = (epicsType)pOverlay->green;
-        else if (pOverlay->drawMode == NDOverlayXOR)
-            *pValue = (epicsType)((int)*pValue ^ (int)pOverlay->green);
+    if (pCache->numSpans == pCache->maxSpans) {
+        pCache->maxSpans = (pCache->maxSpans == 0) ? 64 : 2*pCache->maxSpans;
+        pCache->pSpans = (NDOverlaySpan_t *)realloc(pCache->pSpans, pCache->maxSpans*sizeof(NDOverlaySpan_t));
     }
+    pSpan = &pCache->pSpans[pCache->numSpans++];
+    pSpan->offset = offset;
+    pSpan->count = count;
 }
 
-
-template <typename epicsType>
-void NDPluginOverlay::doOverlayT(NDArray *pArray, NDOverlay_t *pOverlay)
+/** Renders an overlay into the spans of its cache for the geometry in arrayInfo.
+  * This draws the same pixels as drawing the overlay pixel by pixel, but it is only done when the
+  * overlay, the array geometry or the text change. Lines are clipped at the edges of the array.
+  */
+void NDPluginOverlay::renderOverlay(NDOverlay_t *pOverlay, NDOverlayCache_t *pCache)
 {
     size_t xmin, xmax, ymin, ymax, ix, iy, ii, jj, ib;
-    size_t xwide, ywide, xwidemax_line, xwidemin_line;
-    epicsType *pRow;
-    char textOutStr[512];                    // our string, maybe with a time stamp, to place into the image array
-    char *cp;                                // character pointer to current character being rendered
+    size_t xwide, ywide, xline, yline, xlast;
+    const char *cp;                          // character pointer to current character being rendered
     int bmc;                                 // current byte in the font bitmap
     int mask;                                // selects the bit in bmc to look at
-    char tstr[64];                           // Used to build the time string
     NDPluginOverlayTextFontBitmapType *bmp;  // pointer to our font information (bitmap pointer, perhaps misnamed)
     int bpc;                                 // bytes per char, ie, 1 for 6x13 font, 2 for 9x15 font
     int sbc;                                 // "sub" byte counter to keep track of which byte we are looking at for multi byte fonts
-    
+    size_t xSize = this->arrayInfo.xSize;
+    size_t ySize = this->arrayInfo.ySize;
+
     asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER,
-        "NDPluginOverlay::DoOverlayT, shape=%d, Xpos=%ld, Ypos=%ld, Xsize=%ld, Ysize=%ld\n",
-        pOverlay->shape, (long)pOverlay->PositionX, (long)pOverlay->PositionY, 
+        "NDPluginOverlay::renderOverlay, shape=%d, Xpos=%ld, Ypos=%ld, Xsize=%ld, Ysize=%ld\n",
+        pOverlay->shape, (long)pOverlay->PositionX, (long)pOverlay->PositionY,
         (long)pOverlay->SizeX, (long)pOverlay->SizeY);
 
+    pCache->numSpans = 0;
+    pCache->xSize = xSize;
+    pCache->ySize = ySize;
+    pCache->xStride = this->arrayInfo.xStride;
+    pCache->yStride = this->arrayInfo.yStride;
+    pCache->valid = 1;
+    if ((xSize == 0) || (ySize == 0)) return;
+
     switch(pOverlay->shape) {
         case NDOverlayCross:
             xmin = 0;
             if (pOverlay->PositionX > pOverlay->SizeX)
                 xmin = pOverlay->PositionX - pOverlay->SizeX;
             xmax = pOverlay->PositionX + pOverlay->SizeX;
-            xmax = MIN(xmax, this->arrayInfo.xSize-1);
+            xmax = MIN(xmax, xSize-1);
             ymin = 0;
             if (pOverlay->PositionY > pOverlay->SizeY)
                 ymin = pOverlay->PositionY - pOverlay->SizeY;
             ymax = pOverlay->PositionY + pOverlay->SizeY;
-            ymax = MIN(ymax, this->arrayInfo.ySize-1);
+            ymax = MIN(ymax, ySize-1);
             xwide = (pOverlay->WidthX == 1) ? 0 : pOverlay->WidthX / 2;
             ywide = (pOverlay->WidthY == 1) ? 0 : pOverlay->WidthY / 2;
             xwide = MIN(xwide, pOverlay->SizeX-1);
             ywide = MIN(ywide, pOverlay->SizeY);
+            // First and last pixel of the vertical line and first row of the horizontal line
+            xline = (pOverlay->PositionX > xwide) ? pOverlay->PositionX - xwide : 0;
+            xlast = pOverlay->PositionX + xwide;
+            xlast = MIN(xlast, xSize-1);
+            yline = (pOverlay->PositionY > ywide) ? pOverlay->PositionY - ywide : 0;
 
             for (iy=ymin; iy<ymax; iy++) {
-                pRow = (epicsType *)pArray->pData + iy*this->arrayInfo.yStride;
-                if ((iy >= (pOverlay->PositionY - ywide)) && (iy <= (pOverlay->PositionY + ywide))) {
-                    for (ix=xmin; ix<xmax; ++ix) {
-                        setPixel(&pRow[ix*this->arrayInfo.xStride], pOverlay);
-                    }
+                if ((iy >= yline) && (iy <= (pOverlay->PositionY + ywide))) {
+                    addSpan(pCache, xmin, iy, xmax - xmin);
                 } else {
-                    xwidemin_line = pOverlay->PositionX - xwide;
-                    xwidemax_line = pOverlay->PositionX + xwide;
-                    for (size_t line=xwidemin_line; line<=xwidemax_line; ++line) {
-                        setPixel(&pRow[line*this->arrayInfo.xStride], pOverlay);
-                    }
+                    addSpan(pCache, xline, iy, xlast - xline + 1);
                 }
             }
             break;
 
         case NDOverlayRectangle:
             xmin = pOverlay->PositionX;
-            xmin = MAX(xmin, 0);
             xmax = pOverlay->PositionX + pOverlay->SizeX;
-            xmax = MIN(xmax, this->arrayInfo.xSize);
+            xmax = MIN(xmax, xSize);
             ymin = pOverlay->PositionY;
-            ymin = MAX(ymin, 0);
             ymax = pOverlay->PositionY + pOverlay->SizeY;
-            ymax = MIN(ymax, this->arrayInfo.ySize);
+            ymax = MIN(ymax, ySize);
             xwide = (pOverlay->WidthX == 1) ? 0 : pOverlay->WidthX / 2;
             ywide = (pOverlay->WidthY == 1) ? 0 : pOverlay->WidthY / 2;
             xwide = MIN(xwide, pOverlay->SizeX-1);
             ywide = MIN(ywide, pOverlay->SizeY);
+            // Last pixel of the left edge and first pixel of the right edge
+            xlast = xmin + xwide;
+            xlast = MIN(xlast, xSize-1);
+            xline = (xmax > xwide) ? xmax - xwide - 1 : 0;
 
             //For non-zero width, grow the rectangle towards the center.
             for (iy=ymin; iy<ymax; iy++) {
-                pRow = (epicsType *)pArray->pData + iy*arrayInfo.yStride;
-                if ((iy >= ymin) && (iy <= (ymin + ywide))) {
-                    for (ix=xmin; ix<xmax; ix++) setPixel(&pRow[ix*this->arrayInfo.xStride], pOverlay);
-                } else if ((iy >= (ymax-1 - ywide)) && (iy <= ymax-1)) {
-                    for (ix=xmin; ix<xmax; ix++) setPixel(&pRow[ix*this->arrayInfo.xStride], pOverlay);
+                if ((iy <= (ymin + ywide)) || ((iy + ywide) >= (ymax-1))) {
+                    addSpan(pCache, xmin, iy, xmax - xmin);
                 } else {
-                    for (size_t line=xmin; line<=xmin+xwide; ++line) {
-                        setPixel(&pRow[line*this->arrayInfo.xStride], pOverlay);
-                    }
-                    for (size_t line=(xmax-xwide); line<=xmax; ++line) {
-                        setPixel(&pRow[(line-1)*this->arrayInfo.xStride], pOverlay);
-                    }
+                    addSpan(pCache, xmin, iy, xlast - xmin + 1);
+                    addSpan(pCache, xline, iy, xmax - xline);
                 }
             }
             break;
@@ -153,28 +153,17 @@ void NDPluginOverlay::doOverlayT(NDArray *pArray, NDOverlay_t *pOverlay)
 
             bpc = bmp->width / 8 + 1;
 
-            if (strlen(pOverlay->TimeStampFormat) > 0) {
-                epicsTimeToStrftime(tstr, sizeof(tstr)-1, pOverlay->TimeStampFormat, &pArray->epicsTS);
-                epicsSnprintf(textOutStr, sizeof(textOutStr)-1, "%s%s", pOverlay->DisplayText, tstr);
-            } else {
-                epicsSnprintf(textOutStr, sizeof(textOutStr)-1, "%s", pOverlay->DisplayText);
-            }
-            textOutStr[sizeof(textOutStr)-1] = 0;
-
-            cp   = textOutStr;
+            cp   = pCache->text;
             xmin = pOverlay->PositionX;
-            xmin = MAX(xmin, 0);
-            xmax = pOverlay->PositionX + pOverlay->SizeX;
-            xmax = MAX(xmax, this->arrayInfo.xSize);
+            // Text is only clipped at the edge of the array, not at SizeX
+            xmax = xSize;
             ymin = pOverlay->PositionY;
-            ymin = MAX(ymin, 0);
             ymax = pOverlay->PositionY + pOverlay->SizeY;
             ymax = MIN(ymax, pOverlay->PositionY + bmp->height);
-            ymax = MIN(ymax, this->arrayInfo.ySize);
+            ymax = MIN(ymax, ySize);
 
             // Loop over vertical lines
             for (jj=0, iy=ymin; iy<ymax; jj++, iy++) {
-                pRow = (epicsType *)pArray->pData + iy*arrayInfo.yStride;
 
                 // Loop over characters
                 for (ii=0; cp[ii]!=0; ii++) {
@@ -193,7 +182,8 @@ void NDPluginOverlay::doOverlayT(NDArray *pArray, NDOverlay_t *pOverlay)
                         if (ix >= xmax)
                             break;
                         if (mask & bmc) {
-                            setPixel( &pRow[ix*this->arrayInfo.xStride], pOverlay);
+                            // Neighbouring pixels are merged into one span
+                            addSpan(pCache, ix, iy, 1);
                         }
                         mask >>= 1;
                         if (!mask) {
@@ -209,32 +199,104 @@ void NDPluginOverlay::doOverlayT(NDArray *pArray, NDOverlay_t *pOverlay)
     }
 }
 
-int NDPluginOverlay::doOverlay(NDArray *pArray, NDOverlay_t *pOverlay)
+/** Draws the spans of an overlay on the array.
+  * Mono spans are contiguous, so the Set and XOR loops over them vectorize. */
+template <typename epicsType>
+void NDPluginOverlay::doOverlayT(NDArray *pArray, NDOverlay_t *pOverlay, NDOverlayCache_t *pCache)
+{
+    epicsType *pData = (epicsType *)pArray->pData;
+    size_t step = this->arrayInfo.xStride;
+    int values[3];
+    int numColors = 1;
+    int color;
+    size_t span, i;
+
+    if ((this->arrayInfo.colorMode == NDColorModeRGB1) ||
+        (this->arrayInfo.colorMode == NDColorModeRGB2) ||
+        (this->arrayInfo.colorMode == NDColorModeRGB3)) {
+        numColors = 3;
+        values[0] = pOverlay->red;
+        values[1] = pOverlay->green;
+        values[2] = pOverlay->blue;
+    } else {
+        values[0] = pOverlay->green;
+    }
+
+    for (color=0; color<numColors; color++) {
+        epicsType *pColor = pData + color*this->arrayInfo.colorStride;
+        int value = values[color];
+        for (span=0; span<pCache->numSpans; span++) {
+            epicsType *pValue = pColor + pCache->pSpans[span].offset;
+            size_t count = pCache->pSpans[span].count;
+            if (pOverlay->drawMode == NDOverlaySet) {
+                epicsType setValue = (epicsType)value;
+                if (step == 1) {
+                    for (i=0; i<count; i++) pValue[i] = setValue;
+                } else {
+                    for (i=0; i<count; i++) pValue[i*step] = setValue;
+                }
+            } else if (pOverlay->drawMode == NDOverlayXOR) {
+                if (step == 1) {
+                    for (i=0; i<count; i++) pValue[i] = (epicsType)((int)pValue[i] ^ value);
+                } else {
+                    for (i=0; i<count; i++) pValue[i*step] = (epicsType)((int)pValue[i*step] ^ value);
+                }
+            }
+        }
+    }
+}
+
+/** Draws an overlay on the array, rendering its spans again first if the overlay, the array
+  * geometry or the text to display have changed since they were rendered. */
+int NDPluginOverlay::doOverlay(NDArray *pArray, NDOverlay_t *pOverlay, NDOverlayCache_t *pCache)
 {
+    char text[sizeof(pCache->text)];
+    char tstr[64];                           // Used to build the time string
+
+    if (pOverlay->shape == NDOverlayText) {
+        if (strlen(pOverlay->TimeStampFormat) > 0) {
+            epicsTimeToStrftime(tstr, sizeof(tstr)-1, pOverlay->TimeStampFormat, &pArray->epicsTS);
+            epicsSnprintf(text, sizeof(text)-1, "%s%s", pOverlay->DisplayText, tstr);
+        } else {
+            epicsSnprintf(text, sizeof(text)-1, "%s", pOverlay->DisplayText);
+        }
+        text[sizeof(text)-1] = 0;
+    } else {
+        text[0] = 0;
+    }
+
+    if (!pCache->valid ||
+        (pCache->xSize != this->arrayInfo.xSize) || (pCache->ySize != this->arrayInfo.ySize) ||
+        (pCache->xStride != this->arrayInfo.xStride) || (pCache->yStride != this->arrayInfo.yStride) ||
+        (strcmp(pCache->text, text) != 0)) {
+        strcpy(pCache->text, text);
+        renderOverlay(pOverlay, pCache);
+    }
+
     switch(pArray->dataType) {
         case NDInt8:
-            doOverlayT<epicsInt8>(pArray, pOverlay);
+            doOverlayT<epicsInt8>(pArray, pOverlay, pCache);
             break;
         case NDUInt8:
-            doOverlayT<epicsUInt8>(pArray, pOverlay);
+            doOverlayT<epicsUInt8>(pArray, pOverlay, pCache);
             break;
         case NDInt16:
-            doOverlayT<epicsInt16>(pArray, pOverlay);
+            doOverlayT<epicsInt16>(pArray, pOverlay, pCache);
             break;
         case NDUInt16:
-            doOverlayT<epicsUInt16>(pArray, pOverlay);
+            doOverlayT<epicsUInt16>(pArray, pOverlay, pCache);
             break;
         case NDInt32:
-            doOverlayT<epicsInt32>(pArray, pOverlay);
+            doOverlayT<epicsInt32>(pArray, pOverlay, pCache);
             break;
         case NDUInt32:
-            doOverlayT<epicsUInt32>(pArray, pOverlay);
+            doOverlayT<epicsUInt32>(pArray, pOverlay, pCache);
             break;
         case NDFloat32:
-            doOverlayT<epicsFloat32>(pArray, pOverlay);
+            doOverlayT<epicsFloat32>(pArray, pOverlay, pCache);
             break;
         case NDFloat64:
-            doOverlayT<epicsFloat64>(pArray, pOverlay);
+            doOverlayT<epicsFloat64>(pArray, pOverlay, pCache);
             break;
         default:
             return(ND_ERROR);
@@ -243,7 +305,37 @@ int NDPluginOverlay::doOverlay(NDArray *pArray, NDOverlay_t *pOverlay)
     return(ND_SUCCESS);
 }
 
-
+/** Reads the parameters of an overlay into pOverlays.
+  * This is only done when they have been written since they were last read. It is called with the mutex locked.
+  */
+void NDPluginOverlay::readOverlay(int overlay)
+{
+    NDOverlay_t *pOverlay = &this->pOverlays[overlay];
+    NDOverlayCache_t *pCache = &this->pCaches[overlay];
+    int itemp;
+
+    getIntegerParam(overlay, NDPluginOverlayUse,        &pCache->use);
+    getIntegerParam(overlay, NDPluginOverlayPositionX,  &itemp); pOverlay->PositionX = itemp;
+    getIntegerParam(overlay, NDPluginOverlayPositionY,  &itemp); pOverlay->PositionY = itemp;
+    getIntegerParam(overlay, NDPluginOverlaySizeX,      &itemp); pOverlay->SizeX = itemp;
+    getIntegerParam(overlay, NDPluginOverlaySizeY,      &itemp); pOverlay->SizeY = itemp;
+    getIntegerParam(overlay, NDPluginOverlayWidthX,     &itemp); pOverlay->WidthX = itemp;
+    getIntegerParam(overlay, NDPluginOverlayWidthY,     &itemp); pOverlay->WidthY = itemp;
+    getIntegerParam(overlay, NDPluginOverlayShape,      &itemp); pOverlay->shape = (NDOverlayShape_t)itemp;
+    getIntegerParam(overlay, NDPluginOverlayDrawMode,   &itemp); pOverlay->drawMode = (NDOverlayDrawMode_t)itemp;
+    getIntegerParam(overlay, NDPluginOverlayRed,        &pOverlay->red);
+    getIntegerParam(overlay, NDPluginOverlayGreen,      &pOverlay->green);
+    getIntegerParam(overlay, NDPluginOverlayBlue,       &pOverlay->blue);
+    getStringParam( overlay, NDPluginOverlayTimeStampFormat, sizeof(pOverlay->TimeStampFormat), pOverlay->TimeStampFormat);
+    getIntegerParam(overlay, NDPluginOverlayFont,       &pOverlay->Font);
+    getStringParam( overlay, NDPluginOverlayDisplayText, sizeof(pOverlay->DisplayText), pOverlay->DisplayText);
+
+    pOverlay->DisplayText[sizeof(pOverlay->DisplayText)-1] = 0;
+    pCache->changed = 0;
+    pCache->valid = 0;
+}
+
+
 /** Callback function that is called by the NDArray driver with new NDArray data.
   * Draws overlays on top of the array.
   * \param[in] pArray  The NDArray from the callback.
@@ -255,9 +347,9 @@ void NDPluginOverlay::processCallbacks(NDArray *pArray)
      * structures don't need to be protected.
      */
 
-    int use;
-    int itemp;
     int overlay;
+    int inPlace;
+    NDOverlay_t clipped;
     NDArray *pOutput;
     //static const char* functionName = "processCallbacks";
 
@@ -269,52 +361,41 @@ void NDPluginOverlay::processCallbacks(NDArray *pArray)
     if (this->pArrays[0]) {
         this->pArrays[0]->release();
     }
-    /* Copy the input array so we can modify it. */
-    this->pArrays[0] = this->pNDArrayPool->copy(pArray, NULL, 1);
+    getIntegerParam(NDPluginOverlayInPlace, &inPlace);
+    if (inPlace) {
+        /* Draw on the input array itself. Other plugins that receive this array will see the overlays. */
+        pArray->reserve();
+        this->pArrays[0] = pArray;
+    } else {
+        /* Copy the input array so we can modify it. */
+        this->pArrays[0] = this->pNDArrayPool->copy(pArray, NULL, 1);
+    }
     pOutput = this->pArrays[0];
     
     /* Get information about the array needed later */
     pOutput->getInfo(&this->arrayInfo);
     setIntegerParam(NDPluginOverlayMaxSizeX, (int)arrayInfo.xSize);
     setIntegerParam(NDPluginOverlayMaxSizeY, (int)arrayInfo.ySize);
-   
-    /* Loop over the overlays in this driver */
+
+    /* Only the overlays whose parameters were written since the last array are read again */
     for (overlay=0; overlay<this->maxOverlays; overlay++) {
-        pOverlay = &this->pOverlays[overlay];
-        getIntegerParam(overlay, NDPluginOverlayUse, &use);
-        asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER,
-            "NDPluginOverlay::processCallbacks, overlay=%d, use=%d\n",
-            overlay, use);
-        if (!use) continue;
-        /* Need to fetch all of these parameters while we still have the mutex */
-        getIntegerParam(overlay, NDPluginOverlayPositionX,  &itemp); pOverlay->PositionX = itemp;
-        pOverlay->PositionX = MAX(pOverlay->PositionX, 0);
-        pOverlay->PositionX = MIN(pOverlay->PositionX, this->arrayInfo.xSize-1);
-        getIntegerParam(overlay, NDPluginOverlayPositionY,  &itemp); pOverlay->PositionY = itemp;
-        pOverlay->PositionY = MAX(pOverlay->PositionY, 0);
-        pOverlay->PositionY = MIN(pOverlay->PositionY, this->arrayInfo.ySize-1);
-        getIntegerParam(overlay, NDPluginOverlaySizeX,      &itemp); pOverlay->SizeX = itemp;
-        getIntegerParam(overlay, NDPluginOverlaySizeY,      &itemp); pOverlay->SizeY = itemp;
-        getIntegerParam(overlay, NDPluginOverlayWidthX,     &itemp); pOverlay->WidthX = itemp;
-        getIntegerParam(overlay, NDPluginOverlayWidthY,     &itemp); pOverlay->WidthY = itemp;
-        getIntegerParam(overlay, NDPluginOverlayShape,      &itemp); pOverlay->shape = (NDOverlayShape_t)itemp;
-        getIntegerParam(overlay, NDPluginOverlayDrawMode,   &itemp); pOverlay->drawMode = (NDOverlayDrawMode_t)itemp;
-        getIntegerParam(overlay, NDPluginOverlayRed,        &pOverlay->red);
-        getIntegerParam(overlay, NDPluginOverlayGreen,      &pOverlay->green);
-        getIntegerParam(overlay, NDPluginOverlayBlue,       &pOverlay->blue);
-        getStringParam( overlay, NDPluginOverlayTimeStampFormat, sizeof(pOverlay->TimeStampFormat), pOverlay->TimeStampFormat);
-        getIntegerParam(overlay, NDPluginOverlayFont,       &pOverlay->Font);
-        getStringParam( overlay, NDPluginOverlayDisplayText, sizeof(pOverlay->DisplayText), pOverlay->DisplayText);
-
-        pOverlay->DisplayText[sizeof(pOverlay->DisplayText)-1] = 0;
-
-        /* This function is called with the lock taken, and it must be set when we exit.
-         * The following code can be exected without the mutex because we are not accessing memory
-         * that other threads can access. */
-        this->unlock();
-        this->doOverlay(pOutput, pOverlay);
-        this->lock();
+        if (this->pCaches[overlay].changed) readOverlay(overlay);
     }
+
+    /* This function is called with the lock taken, and it must be set when we exit.
+     * The following code can be exected without the mutex because the overlays and their
+     * caches are only written by this thread; writeInt32 and writeOctet only set the changed flag. */
+    this->unlock();
+    for (overlay=0; overlay<this->maxOverlays; overlay++) {
+        if (!this->pCaches[overlay].use) continue;
+        /* The position is clipped to this array, so work on a copy of the overlay */
+        clipped = this->pOverlays[overlay];
+        clipped.PositionX = MIN(clipped.PositionX, this->arrayInfo.xSize-1);
+        clipped.PositionY = MIN(clipped.PositionY, this->arrayInfo.ySize-1);
+        this->doOverlay(pOutput, &clipped, &this->pCaches[overlay]);
+    }
+    this->lock();
+
     /* Get the attributes for this driver */
     this->getAttributes(this->pArrays[0]->pAttributeList);
     /* Call any clients who have registered for NDArray callbacks */
@@ -324,8 +405,53 @@ void NDPluginOverlay::processCallbacks(NDArray *pArray)
     callParamCallbacks();
 }
 
-
-
+/** Called when asyn clients call pasynInt32->write().
+  * This calls NDPluginDriver::writeInt32 to set the parameter, and marks the overlay as changed if
+  * the parameter is one of its settings, so that processCallbacks reads them again.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value The value to write.
+  * \return asynStatus
+  */
+asynStatus NDPluginOverlay::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+    int addr = 0;
+    asynStatus status;
+
+    status = NDPluginDriver::writeInt32(pasynUser, value);
+    if ((function >= NDPluginOverlayUse) && (function <= LAST_NDPLUGIN_OVERLAY_PARAM)) {
+        getAddress(pasynUser, &addr);
+        if ((addr >= 0) && (addr < this->maxOverlays)) this->pCaches[addr].changed = 1;
+    }
+    return status;
+}
+
+/** Called when asyn clients call pasynOctet->write().
+  * This calls NDPluginDriver::writeOctet to set the parameter, and marks the overlay as changed if
+  * the parameter is its text or time stamp format.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Address of the string to write.
+  * \param[in] nChars Number of characters to write.
+  * \param[out] nActual Number of characters actually written.
+  * \return asynStatus
+  */
+asynStatus NDPluginOverlay::writeOctet(asynUser *pasynUser, const char *value,
+                                       size_t nChars, size_t *nActual)
+{
+    int function = pasynUser->reason;
+    int addr = 0;
+    asynStatus status;
+
+    status = NDPluginDriver::writeOctet(pasynUser, value, nChars, nActual);
+    if ((function >= NDPluginOverlayUse) && (function <= LAST_NDPLUGIN_OVERLAY_PARAM)) {
+        getAddress(pasynUser, &addr);
+        if ((addr >= 0) && (addr < this->maxOverlays)) this->pCaches[addr].changed = 1;
+    }
+    return status;
+}
+
+
+
 /** Constructor for NDPluginOverlay; most parameters are simply passed to NDPluginDriver::NDPluginDriver.
   * After calling the base class constructor this method sets reasonable default values for all of the
   * ROI parameters.
@@ -362,9 +488,12 @@ NDPluginOverlay::NDPluginOverlay(const char *portName, int queueSize, int blocki
 
     this->maxOverlays = maxOverlays;
     this->pOverlays = (NDOverlay_t *)callocMustSucceed(maxOverlays, sizeof(*this->pOverlays), functionName);
+    this->pCaches = (NDOverlayCache_t *)callocMustSucceed(maxOverlays, sizeof(*this->pCaches), functionName);
+    for (int overlay=0; overlay<maxOverlays; overlay++) this->pCaches[overlay].changed = 1;
 
     createParam(NDPluginOverlayMaxSizeXString,      asynParamInt32, &NDPluginOverlayMaxSizeX);
     createParam(NDPluginOverlayMaxSizeYString,      asynParamInt32, &NDPluginOverlayMaxSizeY);
+    createParam(NDPluginOverlayInPlaceString,       asynParamInt32, &NDPluginOverlayInPlace);
     createParam(NDPluginOverlayNameString,          asynParamOctet, &NDPluginOverlayName);
     createParam(NDPluginOverlayUseString,           asynParamInt32, &NDPluginOverlayUse);
     createParam(NDPluginOverlayPositionXString,     asynParamInt32, &NDPluginOverlayPositionX);
@@ -388,11 +517,19 @@ NDPluginOverlay::NDPluginOverlay(const char *portName, int queueSize, int blocki
     // Enable ArrayCallbacks.  
     // This plugin currently ignores this setting and always does callbacks, so make the setting reflect the behavior
     setIntegerParam(NDArrayCallbacks, 1);
+    setIntegerParam(NDPluginOverlayInPlace, 0);
 
     /* Try to connect to the array port */
     connectToArrayPort();
 }
 
+NDPluginOverlay::~NDPluginOverlay()
+{
+    for (int overlay=0; overlay<this->maxOverlays; overlay++) free(this->pCaches[overlay].pSpans);
+    free(this->pCaches);
+    free(this->pOverlays);
+}
+
 /** Configuration command */
 extern "C" int NDOverlayConfigure(const char *portName, int queueSize, int blockingCallbacks,
                                  const char *NDArrayPort, int NDArrayAddr, int maxOverlays,
@@ -32,9 +32,33 @@ typedef struct NDOverlay {
     char DisplayText[256];
 } NDOverlay_t;
 
+/** A run of overlay pixels, xStride elements apart in the array */
+typedef struct NDOverlaySpan {
+    size_t offset;      /* Offset of the first pixel in elements */
+    size_t count;       /* Number of pixels */
+} NDOverlaySpan_t;
+
+/** The pixels of an overlay rendered for one array geometry.
+  * The spans are only rendered again when the overlay parameters, the array geometry
+  * or the text to display change. */
+typedef struct NDOverlayCache {
+    int changed;        /* Overlay parameters were written since processCallbacks last read them */
+    int use;
+    int valid;          /* The spans are rendered for the geometry and text below */
+    size_t xSize;
+    size_t ySize;
+    size_t xStride;
+    size_t yStride;
+    char text[512];     /* Text including the time stamp, for NDOverlayText */
+    NDOverlaySpan_t *pSpans;
+    size_t numSpans;
+    size_t maxSpans;
+} NDOverlayCache_t;
+
 
 #define NDPluginOverlayMaxSizeXString           "MAX_SIZE_X"            /* (asynInt32,   r/o) Maximum size of overlay in X dimension */
 #define NDPluginOverlayMaxSizeYString           "MAX_SIZE_Y"            /* (asynInt32,   r/o) Maximum size of overlay in Y dimension */
+#define NDPluginOverlayInPlaceString            "OVERLAY_IN_PLACE"      /* (asynInt32,   r/w) Draw on the input array rather than a copy */
 #define NDPluginOverlayNameString               "NAME"                  /* (asynOctet,   r/w) Name of this overlay */
 #define NDPluginOverlayUseString                "USE"                   /* (asynInt32,   r/w) Use this overlay? */
 #define NDPluginOverlayPositionXString          "OVERLAY_POSITION_X"    /* (asynInt32,   r/o) X position of overlay */
@@ -59,16 +83,20 @@ public:
                  const char *NDArrayPort, int NDArrayAddr, int maxOverlays, 
                  int maxBuffers, size_t maxMemory,
                  int priority, int stackSize);
+    ~NDPluginOverlay();
     /* These methods override the virtual methods in the base class */
     void processCallbacks(NDArray *pArray);
-    template <typename epicsType> void doOverlayT(NDArray *pArray, NDOverlay_t *pOverlay);
-    int doOverlay(NDArray *pArray, NDOverlay_t *pOverlay);
-    template <typename epicsType> void setPixel(epicsType *pValue, NDOverlay_t *pOverlay);
+    asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+    asynStatus writeOctet(asynUser *pasynUser, const char *value, size_t maxChars,
+                          size_t *nActual);
+    template <typename epicsType> void doOverlayT(NDArray *pArray, NDOverlay_t *pOverlay, NDOverlayCache_t *pCache);
+    int doOverlay(NDArray *pArray, NDOverlay_t *pOverlay, NDOverlayCache_t *pCache);
 
 protected:
     int NDPluginOverlayMaxSizeX;
     #define FIRST_NDPLUGIN_OVERLAY_PARAM NDPluginOverlayMaxSizeX
     int NDPluginOverlayMaxSizeY;
+    int NDPluginOverlayInPlace;
     int NDPluginOverlayName;
     int NDPluginOverlayUse;
     int NDPluginOverlayPositionX;
@@ -88,10 +116,13 @@ protected:
     #define LAST_NDPLUGIN_OVERLAY_PARAM NDPluginOverlayDisplayText
                                 
 private:
+    void readOverlay(int overlay);
+    void renderOverlay(NDOverlay_t *pOverlay, NDOverlayCache_t *pCache);
+    void addSpan(NDOverlayCache_t *pCache, size_t ix, size_t iy, size_t count);
     int maxOverlays;
     NDArrayInfo arrayInfo;
     NDOverlay_t *pOverlays;    /* Array of NDOverlay structures */
-    NDOverlay_t *pOverlay;
+    NDOverlayCache_t *pCaches; /* Rendered pixels of each overlay */
 };
 #define NUM_NDPLUGIN_OVERLAY_PARAMS ((int)(&LAST_NDPLUGIN_OVERLAY_PARAM - &FIRST_NDPLUGIN_OVERLAY_PARAM + 1))
     
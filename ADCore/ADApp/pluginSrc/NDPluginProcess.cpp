@@ -25,6 +25,211 @@
 static const char *driverName="NDPluginProcess";
 
 
+/* Number of elements processed at a time; the working copy of a chunk stays in the L1 cache */
+#define PROCESS_CHUNK_ELEMENTS 1024
+/* Maximum number of threads processing one array */
+#define NDPROCESS_MAX_STRIPES 64
+
+/** Settings and buffers of the processing pipeline for the array being processed.
+  * processCallbacks fills this in, then each stripe of elements is processed in chunks by
+  * processStripe, which takes each chunk through all of the enabled stages before storing it.
+  * Stages that are disabled are skipped for the whole array. */
+struct NDProcessPipeline {
+    void *pIn;
+    NDDataType_t inType;
+    void *pOut;                 /**< NULL when there are no callbacks for this array */
+    NDDataType_t outType;
+    void *pBackground;
+    NDDataType_t backgroundType;
+    void *pFlatField;
+    NDDataType_t flatFieldType;
+    double scaleFlatField;
+    int enableOffsetScale;
+    double offset, scale;
+    int enableLowClip, enableHighClip;
+    double lowClip, highClip;
+    int autoOffsetScale;
+    double *pFilter;            /**< NULL when the filter is disabled */
+    int initFilter;             /**< The filter array is new, so it starts as a copy of the processed data */
+    int resetFilter;
+    double rOffset, rc1, rc2;
+    double oOffset, fOffset, O1, O2, F1, F2;
+    size_t nElements;
+    int numStripes;
+    double minValue[NDPROCESS_MAX_STRIPES];
+    double maxValue[NDPROCESS_MAX_STRIPES];
+};
+
+static void processStripeC(void *drvPvt, int stripe)
+{
+    NDPluginProcess *pPlugin = (NDPluginProcess *)drvPvt;
+    pPlugin->processStripe(stripe);
+}
+
+/** Background and flat field arrays are stored as NDFloat32 when that holds the saved array exactly,
+  * which halves the memory they take and the bandwidth needed to read them for each array */
+static NDDataType_t referenceDataType(NDDataType_t dataType)
+{
+    switch (dataType) {
+        case NDInt8:
+        case NDUInt8:
+        case NDInt16:
+        case NDUInt16:
+        case NDFloat32:
+            return NDFloat32;
+        default:
+            return NDFloat64;
+    }
+}
+
+template <typename epicsType>
+static void loadChunkT(const void *pData, size_t first, size_t n, double *pChunk)
+{
+    const epicsType *pIn = (const epicsType *)pData + first;
+    for (size_t i=0; i<n; i++) pChunk[i] = (double)pIn[i];
+}
+
+template <typename epicsType>
+static void storeChunkT(const double *pChunk, size_t n, void *pData, size_t first)
+{
+    epicsType *pOut = (epicsType *)pData + first;
+    for (size_t i=0; i<n; i++) pOut[i] = (epicsType)pChunk[i];
+}
+
+template <typename epicsType>
+static void subtractBackgroundT(const void *pBackground, size_t first, size_t n, double *pChunk)
+{
+    const epicsType *pBgd = (const epicsType *)pBackground + first;
+    for (size_t i=0; i<n; i++) pChunk[i] -= pBgd[i];
+}
+
+template <typename epicsType>
+static void divideFlatFieldT(const void *pFlatField, size_t first, size_t n, double scaleFlatField, double *pChunk)
+{
+    const epicsType *pFlat = (const epicsType *)pFlatField + first;
+    for (size_t i=0; i<n; i++) {
+        double flat = (double)pFlat[i];
+        pChunk[i] = (flat != 0.) ? pChunk[i] * (scaleFlatField / flat) : scaleFlatField;
+    }
+}
+
+static void loadChunk(NDDataType_t dataType, const void *pData, size_t first, size_t n, double *pChunk)
+{
+    switch (dataType) {
+        case NDInt8:    loadChunkT<epicsInt8>   (pData, first, n, pChunk); break;
+        case NDUInt8:   loadChunkT<epicsUInt8>  (pData, first, n, pChunk); break;
+        case NDInt16:   loadChunkT<epicsInt16>  (pData, first, n, pChunk); break;
+        case NDUInt16:  loadChunkT<epicsUInt16> (pData, first, n, pChunk); break;
+        case NDInt32:   loadChunkT<epicsInt32>  (pData, first, n, pChunk); break;
+        case NDUInt32:  loadChunkT<epicsUInt32> (pData, first, n, pChunk); break;
+        case NDFloat32: loadChunkT<epicsFloat32>(pData, first, n, pChunk); break;
+        case NDFloat64: loadChunkT<epicsFloat64>(pData, first, n, pChunk); break;
+        default: break;
+    }
+}
+
+static void storeChunk(const double *pChunk, size_t n, NDDataType_t dataType, void *pData, size_t first)
+{
+    switch (dataType) {
+        case NDInt8:    storeChunkT<epicsInt8>   (pChunk, n, pData, first); break;
+        case NDUInt8:   storeChunkT<epicsUInt8>  (pChunk, n, pData, first); break;
+        case NDInt16:   storeChunkT<epicsInt16>  (pChunk, n, pData, first); break;
+        case NDUInt16:  storeChunkT<epicsUInt16> (pChunk, n, pData, first); break;
+        case NDInt32:   storeChunkT<epicsInt32>  (pChunk, n, pData, first); break;
+        case NDUInt32:  storeChunkT<epicsUInt32> (pChunk, n, pData, first); break;
+        case NDFloat32: storeChunkT<epicsFloat32>(pChunk, n, pData, first); break;
+        case NDFloat64: storeChunkT<epicsFloat64>(pChunk, n, pData, first); break;
+        default: break;
+    }
+}
+
+/** Processes one stripe of the array described by pPipeline.
+  * The elements are converted to double one chunk at a time, each enabled stage is applied to the
+  * chunk, and the chunk is converted straight to the output data type, so there is no full size
+  * NDFloat64 copy of the array. The arithmetic is the same as converting the whole array to
+  * NDFloat64 first, so the results do not change.
+  * \param[in] stripe The stripe to process. */
+void NDPluginProcess::processStripe(int stripe)
+{
+    NDProcessPipeline *p = this->pPipeline;
+    double chunk[PROCESS_CHUNK_ELEMENTS];
+    size_t stripeSize = (p->nElements + p->numStripes - 1) / p->numStripes;
+    size_t first = stripe * stripeSize;
+    size_t last = first + stripeSize;
+    size_t i, n;
+    double minValue=HUGE_VAL, maxValue=-HUGE_VAL;
+
+    if (last > p->nElements) last = p->nElements;
+    if (first < last) {
+        loadChunk(p->inType, p->pIn, first, 1, &minValue);
+        maxValue = minValue;
+    }
+
+    for (; first<last; first+=n) {
+        n = last - first;
+        if (n > PROCESS_CHUNK_ELEMENTS) n = PROCESS_CHUNK_ELEMENTS;
+        loadChunk(p->inType, p->pIn, first, n, chunk);
+        if (p->autoOffsetScale) {
+            for (i=0; i<n; i++) {
+                minValue = chunk[i] < minValue ? chunk[i] : minValue;
+                maxValue = chunk[i] > maxValue ? chunk[i] : maxValue;
+            }
+        }
+        if (p->pBackground) {
+            if (p->backgroundType == NDFloat32)
+                subtractBackgroundT<epicsFloat32>(p->pBackground, first, n, chunk);
+            else
+                subtractBackgroundT<epicsFloat64>(p->pBackground, first, n, chunk);
+        }
+        if (p->pFlatField) {
+            if (p->flatFieldType == NDFloat32)
+                divideFlatFieldT<epicsFloat32>(p->pFlatField, first, n, p->scaleFlatField, chunk);
+            else
+                divideFlatFieldT<epicsFloat64>(p->pFlatField, first, n, p->scaleFlatField, chunk);
+        }
+        if (p->enableOffsetScale) {
+            const double offset = p->offset, scale = p->scale;
+            for (i=0; i<n; i++) chunk[i] = (chunk[i] + offset)*scale;
+        }
+        if (p->enableHighClip) {
+            const double highClip = p->highClip;
+            for (i=0; i<n; i++) chunk[i] = (chunk[i] > highClip) ? highClip : chunk[i];
+        }
+        if (p->enableLowClip) {
+            const double lowClip = p->lowClip;
+            for (i=0; i<n; i++) chunk[i] = (chunk[i] < lowClip) ? lowClip : chunk[i];
+        }
+        if (p->pFilter) {
+            double *filter = p->pFilter + first;
+            if (p->initFilter) memcpy(filter, chunk, n*sizeof(double));
+            if (p->resetFilter) {
+                const double rOffset = p->rOffset, rc1 = p->rc1, rc2 = p->rc2;
+                for (i=0; i<n; i++) {
+                    double newFilter = rOffset;
+                    if (rc1) newFilter += rc1*filter[i];
+                    if (rc2) newFilter += rc2*chunk[i];
+                    filter[i] = newFilter;
+                }
+            }
+            const double oOffset = p->oOffset, fOffset = p->fOffset;
+            const double O1 = p->O1, O2 = p->O2, F1 = p->F1, F2 = p->F2;
+            for (i=0; i<n; i++) {
+                double newData   = oOffset;
+                double newFilter = fOffset;
+                if (O1) newData += O1 * filter[i];
+                if (O2) newData += O2 * chunk[i];
+                if (F1) newFilter += F1 * filter[i];
+                if (F2) newFilter += F2 * chunk[i];
+                chunk[i] = newData;
+                filter[i] = newFilter;
+            }
+        }
+        if (p->pOut) storeChunk(chunk, n, p->outType, p->pOut, first);
+    }
+    p->minValue[stripe] = minValue;
+    p->maxValue[stripe] = maxValue;
+}
+
 /** Callback function that is called by the NDArray driver with new NDArray data.
   * Does image processing.
   * \param[in] pArray  The NDArray from the callback.
@@ -35,29 +240,28 @@ void NDPluginProcess::processCallbacks(NDArray *pArray)
      * It is called with the mutex already locked.  It unlocks it during long calculations when private
      * structures don't need to be protected.
      */
-    size_t i;
-    NDArray *pScratch=NULL;
-    double  *data, newData, newFilter;
+    NDProcessPipeline *p = this->pPipeline;
     NDArrayInfo arrayInfo;
-    double  *background=NULL, *flatField=NULL, *filter=NULL;
-    double  value;
     size_t  nElements;
+    size_t  dims[ND_ARRAY_MAX_DIMS];
     int     saveBackground, enableBackground, validBackground;
     int     saveFlatField,  enableFlatField,  validFlatField;
     double  scaleFlatField;
     int     enableOffsetScale, autoOffsetScale;
-    double  offset, scale, minValue, maxValue;
+    double  offset=0, scale=1, minValue, maxValue;
     double  lowClip=0, highClip=0;
     int     enableLowClip, enableHighClip;
     int     resetFilter, autoResetFilter, filterCallbacks, doCallbacks=1;
     int     enableFilter, numFilter;
     int     dataType;
+    int     computeThreads;
     int     anyProcess;
+    int     initFilter=0;
+    int     i;
     double  oOffset, fOffset, rOffset, oScale, fScale;
     double  oc1, oc2, oc3, oc4;
     double  fc1, fc2, fc3, fc4;
     double  rc1, rc2;
-    double  F1, F2, O1, O2;
 
     NDArray *pArrayOut = NULL;
     static const char* functionName = "processCallbacks";
@@ -80,6 +284,7 @@ void NDPluginProcess::processCallbacks(NDArray *pArray)
     getIntegerParam(NDPluginProcessResetFilter,         &resetFilter);
     getIntegerParam(NDPluginProcessAutoResetFilter,     &autoResetFilter);
     getIntegerParam(NDPluginProcessFilterCallbacks,     &filterCallbacks);
+    getIntegerParam(NDPluginProcessComputeThreads,      &computeThreads);
 
     if (enableOffsetScale) {
         getDoubleParam (NDPluginProcessScale,           &scale);
@@ -126,11 +331,6 @@ void NDPluginProcess::processCallbacks(NDArray *pArray)
     if (this->pFlatField && (nElements == this->nFlatFieldElements)) validFlatField = 1;
     setIntegerParam(NDPluginProcessValidFlatField, validFlatField);
 
-    if (validBackground && enableBackground)
-        background = (double *)this->pBackground->pData;
-    if (validFlatField && enableFlatField)
-        flatField = (double *)this->pFlatField->pData;
-
     anyProcess = ((enableBackground && validBackground) ||
                   (enableFlatField && validFlatField)   ||
                    enableOffsetScale                    ||
@@ -144,43 +344,9 @@ void NDPluginProcess::processCallbacks(NDArray *pArray)
         this->pNDArrayPool->convert(pArray, &pArrayOut, (NDDataType_t)dataType);
         goto doCallbacks;
     }
-    
-    /* Make a copy of the array converted to double, because we cannot modify the input array */
-    this->pNDArrayPool->convert(pArray, &pScratch, NDFloat64);
-    if (NULL == pScratch) {
-        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
-            "%s:%s Processing aborted; cannot allocate an NDArray for storage of temporary data.\n", 
-            driverName, functionName);
-        goto doCallbacks;
-    }
-    data = (double *)pScratch->pData;
 
-    if (nElements > 0) {
-        minValue = data[0];
-        maxValue = data[0];
-    } else {
-        minValue = 0;
-        maxValue = 1;
-    }
-    for (i=0; i<nElements; i++) {
-        value = data[i];
-        if (autoOffsetScale) {
-            if (data[i] < minValue) minValue = data[i];
-            if (data[i] > maxValue) maxValue = data[i];
-        }
-        if (background) value -= background[i];
-        if (flatField) {
-            if (flatField[i] != 0.) 
-                value *= scaleFlatField / flatField[i];
-            else
-                value = scaleFlatField;
-        }
-        if (enableOffsetScale) value = (value + offset)*scale;
-        if (enableHighClip && (value > highClip)) value = highClip;
-        if (enableLowClip  && (value < lowClip))  value = lowClip;
-        data[i] = value;
-    }
-    
+    for (i=0; i<pArray->ndims; i++) dims[i] = pArray->dims[i].size;
+
     if (enableFilter) {
         if (this->pFilter) {
             this->pFilter->getInfo(&arrayInfo);
@@ -190,53 +356,92 @@ void NDPluginProcess::processCallbacks(NDArray *pArray)
             }
         }
         if (!this->pFilter) {
-            /* There is not a current filter array */
-            /* Make a copy of the current array, converted to double type */
-            this->pNDArrayPool->convert(pScratch, &this->pFilter, NDFloat64);
+            /* There is not a current filter array; it starts as a copy of the processed array */
+            this->pFilter = this->pNDArrayPool->alloc(pArray->ndims, dims, NDFloat64, 0, NULL);
             if (NULL == this->pFilter) {
                 asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
                     "%s:%s Processing aborted; cannot allocate an NDArray to store the filter.\n", 
                     driverName,functionName);
                 goto doCallbacks;
             }
+            initFilter = 1;
             resetFilter = 1;
         }
         if ((this->numFiltered >= numFilter) && autoResetFilter)
           resetFilter = 1;
-        if (resetFilter) {
-            filter = (double *)this->pFilter->pData;
-            for (i=0; i<nElements; i++) {
-                newFilter = rOffset;
-                if (rc1) newFilter += rc1*filter[i];
-                if (rc2) newFilter += rc2*data[i];
-                filter[i] = newFilter;
-            }           
-            this->numFiltered = 0;
-        }
-        /* Do the filtering */
+        if (resetFilter) this->numFiltered = 0;
         if (this->numFiltered < numFilter) this->numFiltered++;
-        filter = (double *)this->pFilter->pData;
-        O1 = oScale * (oc1 + oc2/this->numFiltered);
-        O2 = oScale * (oc3 + oc4/this->numFiltered);
-        F1 = fScale * (fc1 + fc2/this->numFiltered);
-        F2 = fScale * (fc3 + fc4/this->numFiltered);
-        for (i=0; i<nElements; i++) {
-            newData   = oOffset;
-            if (O1) newData += O1 * filter[i];
-            if (O2) newData += O2 * data[i];
-            newFilter = fOffset;
-            if (F1) newFilter += F1 * filter[i];
-            if (F2) newFilter += F2 * data[i];
-            data[i] = newData;
-            filter[i] = newFilter;
-        }
         if ((this->numFiltered != numFilter) && filterCallbacks)
           doCallbacks = 0;
     }
 
     if (doCallbacks) {
-      /* Convert the array to the desired output data type */
-      this->pNDArrayPool->convert(pScratch, &pArrayOut, (NDDataType_t)dataType);
+        /* The output array is written directly in the desired output data type */
+        pArrayOut = this->pNDArrayPool->alloc(pArray->ndims, dims, (NDDataType_t)dataType, 0, NULL);
+        if (NULL == pArrayOut) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+                "%s:%s Processing aborted; cannot allocate an NDArray for the output.\n", 
+                driverName, functionName);
+            goto doCallbacks;
+        }
+        pArrayOut->timeStamp = pArray->timeStamp;
+        pArrayOut->epicsTS = pArray->epicsTS;
+        pArrayOut->uniqueId = pArray->uniqueId;
+        memcpy(pArrayOut->dims, pArray->dims, pArray->ndims*sizeof(NDDimension_t));
+        pArray->pAttributeList->copy(pArrayOut->pAttributeList);
+    }
+
+    p->pIn = pArray->pData;
+    p->inType = pArray->dataType;
+    p->pOut = pArrayOut ? pArrayOut->pData : NULL;
+    p->outType = (NDDataType_t)dataType;
+    p->pBackground = NULL;
+    if (validBackground && enableBackground) {
+        p->pBackground = this->pBackground->pData;
+        p->backgroundType = this->pBackground->dataType;
+    }
+    p->pFlatField = NULL;
+    if (validFlatField && enableFlatField) {
+        p->pFlatField = this->pFlatField->pData;
+        p->flatFieldType = this->pFlatField->dataType;
+    }
+    p->scaleFlatField = scaleFlatField;
+    p->enableOffsetScale = enableOffsetScale;
+    p->offset = offset;
+    p->scale = scale;
+    p->enableLowClip = enableLowClip;
+    p->lowClip = lowClip;
+    p->enableHighClip = enableHighClip;
+    p->highClip = highClip;
+    p->autoOffsetScale = autoOffsetScale;
+    p->pFilter = NULL;
+    if (enableFilter) {
+        p->pFilter = (double *)this->pFilter->pData;
+        p->initFilter = initFilter;
+        p->resetFilter = resetFilter;
+        p->rOffset = rOffset;
+        p->rc1 = rc1;
+        p->rc2 = rc2;
+        p->oOffset = oOffset;
+        p->fOffset = fOffset;
+        p->O1 = oScale * (oc1 + oc2/this->numFiltered);
+        p->O2 = oScale * (oc3 + oc4/this->numFiltered);
+        p->F1 = fScale * (fc1 + fc2/this->numFiltered);
+        p->F2 = fScale * (fc3 + fc4/this->numFiltered);
+    }
+    p->nElements = nElements;
+    p->numStripes = NDStripeWorkers::numStripes(computeThreads, nElements, NDPROCESS_MAX_STRIPES);
+    this->pStripeWorkers->run(p->numStripes, processStripeC, this);
+
+    minValue = 0;
+    maxValue = 1;
+    if (nElements > 0) {
+        minValue = p->minValue[0];
+        maxValue = p->maxValue[0];
+        for (i=1; i<p->numStripes; i++) {
+            if (p->minValue[i] < minValue) minValue = p->minValue[i];
+            if (p->maxValue[i] > maxValue) maxValue = p->maxValue[i];
+        }
     }
 
     if (autoOffsetScale && (NULL != pArrayOut)) {
@@ -267,8 +472,6 @@ void NDPluginProcess::processCallbacks(NDArray *pArray)
         this->pArrays[0] = pArrayOut;
     }
 
-    if (NULL != pScratch) pScratch->release();
-
     setIntegerParam(NDPluginProcessNumFiltered, this->numFiltered);
     callParamCallbacks();
     if (autoOffsetScale && this->pArrays[0] != NULL) {
@@ -301,8 +504,9 @@ asynStatus NDPluginProcess::writeInt32(asynUser *pasynUser, epicsInt32 value)
         this->pBackground = NULL;
         setIntegerParam(NDPluginProcessValidBackground, 0);
         if (this->pArrays[0]) {
-            /* Make a copy of the current array, converted to double type */
-            this->pNDArrayPool->convert(this->pArrays[0], &this->pBackground, NDFloat64);
+            /* Make a copy of the current array, converted to floating point */
+            this->pNDArrayPool->convert(this->pArrays[0], &this->pBackground,
+                                        referenceDataType(this->pArrays[0]->dataType));
             this->pBackground->getInfo(&arrayInfo);
             this->nBackgroundElements = arrayInfo.nElements;
             setIntegerParam(NDPluginProcessValidBackground, 1);
@@ -313,8 +517,9 @@ asynStatus NDPluginProcess::writeInt32(asynUser *pasynUser, epicsInt32 value)
         this->pFlatField = NULL;
         setIntegerParam(NDPluginProcessValidFlatField, 0);
         if (this->pArrays[0]) {
-            /* Make a copy of the current array, converted to double type */
-            this->pNDArrayPool->convert(this->pArrays[0], &this->pFlatField, NDFloat64);
+            /* Make a copy of the current array, converted to floating point */
+            this->pNDArrayPool->convert(this->pArrays[0], &this->pFlatField,
+                                        referenceDataType(this->pArrays[0]->dataType));
             this->pFlatField->getInfo(&arrayInfo);
             this->nFlatFieldElements = arrayInfo.nElements;
             setIntegerParam(NDPluginProcessValidFlatField, 1);
@@ -422,9 +627,16 @@ NDPluginProcess::NDPluginProcess(const char *portName, int queueSize, int blocki
     /* Output data type */
     createParam(NDPluginProcessDataTypeString,          asynParamInt32,     &NDPluginProcessDataType);   
 
+    /* Threads processing each array */
+    createParam(NDPluginProcessComputeThreadsString,    asynParamInt32,     &NDPluginProcessComputeThreads);
+
     this->pBackground = NULL;
     this->pFlatField  = NULL;
     this->pFilter     = NULL;
+    this->numFiltered = 0;
+    this->pPipeline   = new NDProcessPipeline;
+    this->pStripeWorkers = new NDStripeWorkers(portName);
+    setIntegerParam(NDPluginProcessComputeThreads, 1);
     setIntegerParam(NDPluginProcessValidBackground, 0);
     setIntegerParam(NDPluginProcessValidFlatField, 0);
     setIntegerParam(NDPluginProcessAutoOffsetScale, 0);
@@ -440,6 +652,15 @@ NDPluginProcess::NDPluginProcess(const char *portName, int queueSize, int blocki
     connectToArrayPort();
 }
 
+NDPluginProcess::~NDPluginProcess()
+{
+    delete this->pStripeWorkers;
+    delete this->pPipeline;
+    if (this->pBackground) this->pBackground->release();
+    if (this->pFlatField)  this->pFlatField->release();
+    if (this->pFilter)     this->pFilter->release();
+}
+
 /** Configuration command */
 extern "C" int NDProcessConfigure(const char *portName, int queueSize, int blockingCallbacks,
                                  const char *NDArrayPort, int NDArrayAddr,
@@ -3,6 +3,7 @@
 
 #include <epicsTypes.h>
 #include "NDPluginDriver.h"
+#include "NDStripeWorkers.h"
 
 /* Background array subtraction */
 #define NDPluginProcessSaveBackgroundString     "SAVE_BACKGROUND"   /* (asynInt32,   r/w) Save the current frame as background */
@@ -52,6 +53,9 @@
 
 /* Output data type */
 #define NDPluginProcessDataTypeString           "PROCESS_DATA_TYPE" /* (asynInt32,   r/w) Output type.  -1 means automatic. */
+
+/* Threads */
+#define NDPluginProcessComputeThreadsString     "COMPUTE_THREADS"   /* (asynInt32,   r/w) Number of threads processing each array */
    
 
 /** Does image processing operations.  These include
@@ -60,15 +64,19 @@
   * Low clipping
   * High clipping
   * Frame averaging */
+struct NDProcessPipeline;
+
 class epicsShareClass NDPluginProcess : public NDPluginDriver {
 public:
     NDPluginProcess(const char *portName, int queueSize, int blockingCallbacks, 
                  const char *NDArrayPort, int NDArrayAddr,
                  int maxBuffers, size_t maxMemory,
                  int priority, int stackSize);
+    ~NDPluginProcess();
     /* These methods override the virtual methods in the base class */
     void processCallbacks(NDArray *pArray);
     asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+    void processStripe(int stripe);
     
 protected:
     /* Background array subtraction */
@@ -121,7 +129,10 @@ protected:
     /* Output data type */
     int NDPluginProcessDataType;
 
-    #define LAST_NDPLUGIN_PROCESS_PARAM NDPluginProcessDataType
+    /* Threads */
+    int NDPluginProcessComputeThreads;
+
+    #define LAST_NDPLUGIN_PROCESS_PARAM NDPluginProcessComputeThreads
                                 
 private:
     NDArray *pBackground;
@@ -130,6 +141,8 @@ private:
     size_t  nFlatFieldElements;
     NDArray *pFilter;
     int  numFiltered;
+    NDStripeWorkers *pStripeWorkers;
+    NDProcessPipeline *pPipeline;   /**< Settings of the array being processed, for processStripe */
 };
 #define NUM_NDPLUGIN_PROCESS_PARAMS ((int)(&LAST_NDPLUGIN_PROCESS_PARAM - &FIRST_NDPLUGIN_PROCESS_PARAM + 1))
     
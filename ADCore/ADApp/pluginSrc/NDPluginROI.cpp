@@ -47,12 +47,11 @@ void NDPluginROI::processCallbacks(NDArray *pArray)
     int dim;
     NDDimension_t dims[ND_ARRAY_MAX_DIMS], tempDim, *pDim;
     size_t userDims[ND_ARRAY_MAX_DIMS];
-    NDArrayInfo arrayInfo, scratchInfo;
-    NDArray *pScratch, *pOutput;
+    NDArrayInfo arrayInfo;
+    NDArray *pOutput;
     NDColorMode_t colorMode;
-    double *pData;
     int enableScale, enableDim[3], autoSize[3];
-    size_t i;
+    int computeThreads;
     double scale;
     //static const char* functionName = "processCallbacks";
     
@@ -74,17 +73,11 @@ void NDPluginROI::processCallbacks(NDArray *pArray)
     getIntegerParam(NDPluginROIDataType,     &dataType);
     getIntegerParam(NDPluginROIEnableScale,  &enableScale);
     getDoubleParam(NDPluginROIScale, &scale);
+    getIntegerParam(NDPluginROIComputeThreads, &computeThreads);
 
     /* Call the base class method */
     NDPluginDriver::processCallbacks(pArray);
 
-    /* We always keep the last array so read() can use it.
-     * Release previous one. Reserve new one below. */
-    if (this->pArrays[0]) {
-        this->pArrays[0]->release();
-        this->pArrays[0] = NULL;
-    }
-    
     /* Get information about the array */
     pArray->getInfo(&arrayInfo);
     
@@ -147,7 +140,8 @@ void NDPluginROI::processCallbacks(NDArray *pArray)
 
     /* This function is called with the lock taken, and it must be set when we exit.
      * The following code can be exected without the mutex because we are not accessing memory
-     * that other threads can access. */
+     * that other threads can access.  Several threads can be executing it at once, so the output
+     * array is only stored in this->pArrays[0] after we take the lock again. */
     this->unlock();
 
     /* Extract this ROI from the input array.  The convert() function allocates
@@ -168,23 +162,13 @@ void NDPluginROI::processCallbacks(NDArray *pArray)
         dims[2] = tempDim;
     }
     
-    if (enableScale && (scale != 0) && (scale != 1)) {
-        /* This is tricky.  We want to do the operation to avoid errors due to integer truncation.
-         * For example, if an image with all pixels=1 is binned 3x3 with scale=9 (divide by 9), then
-         * the output should also have all pixels=1. 
-         * We do this by extracting the ROI and converting to double, do the scaling, then convert
-         * to the desired data type. */
-        this->pNDArrayPool->convert(pArray, &pScratch, NDFloat64, dims);
-        pScratch->getInfo(&scratchInfo);
-        pData = (double *)pScratch->pData;
-        for (i=0; i<scratchInfo.nElements; i++) pData[i] = pData[i]/scale;
-        this->pNDArrayPool->convert(pScratch, &this->pArrays[0], (NDDataType_t)dataType);
-        pScratch->release();
-    } 
-    else {        
-        this->pNDArrayPool->convert(pArray, &this->pArrays[0], (NDDataType_t)dataType, dims);
-    }
-    pOutput = this->pArrays[0];
+    /* When scaling, the binned values are summed in double and divided by the scale before they are
+     * converted to the output data type, to avoid errors due to integer truncation.
+     * For example, if an image with all pixels=1 is binned 3x3 with scale=9 (divide by 9), then
+     * the output should also have all pixels=1. */
+    if (!enableScale) scale = 1.;
+    this->pNDArrayPool->convert(pArray, &pOutput, (NDDataType_t)dataType, dims, scale,
+                                this->pStripeWorkers, computeThreads);
 
     /* If we selected just one color from the array, then we need to change the
      * dimensions and the color mode */
@@ -214,19 +198,26 @@ void NDPluginROI::processCallbacks(NDArray *pArray)
     }
     this->lock();
 
+    /* We always keep the last array so read() can use it.
+     * Release previous one, and reserve this one again while we do the callbacks without the lock. */
+    if (this->pArrays[0]) this->pArrays[0]->release();
+    this->pArrays[0] = pOutput;
+    pOutput->reserve();
+
     /* Set the image size of the ROI image data */
     setIntegerParam(NDArraySizeX, 0);
     setIntegerParam(NDArraySizeY, 0);
     setIntegerParam(NDArraySizeZ, 0);
-    if (pOutput->ndims > 0) setIntegerParam(NDArraySizeX, (int)this->pArrays[0]->dims[userDims[0]].size);
-    if (pOutput->ndims > 1) setIntegerParam(NDArraySizeY, (int)this->pArrays[0]->dims[userDims[1]].size);
-    if (pOutput->ndims > 2) setIntegerParam(NDArraySizeZ, (int)this->pArrays[0]->dims[userDims[2]].size);
+    if (pOutput->ndims > 0) setIntegerParam(NDArraySizeX, (int)pOutput->dims[userDims[0]].size);
+    if (pOutput->ndims > 1) setIntegerParam(NDArraySizeY, (int)pOutput->dims[userDims[1]].size);
+    if (pOutput->ndims > 2) setIntegerParam(NDArraySizeZ, (int)pOutput->dims[userDims[2]].size);
 
     /* Get the attributes for this driver */
-    this->getAttributes(this->pArrays[0]->pAttributeList);
+    this->getAttributes(pOutput->pAttributeList);
     /* Call any clients who have registered for NDArray callbacks */
     this->unlock();
-    doCallbacksGenericPointer(this->pArrays[0], NDArrayData, 0);
+    doArrayCallbacks(pOutput, 0);
+    pOutput->release();
     /* We must enter the loop and exit with the mutex locked */
     this->lock();
     callParamCallbacks();
@@ -299,17 +290,18 @@ asynStatus NDPluginROI::writeInt32(asynUser *pasynUser, epicsInt32 value)
   *            allowed to allocate. Set this to -1 to allow an unlimited amount of memory.
   * \param[in] priority The thread priority for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
   * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  * \param[in] maxThreads The maximum number of threads that execute processCallbacks.
   */
 NDPluginROI::NDPluginROI(const char *portName, int queueSize, int blockingCallbacks,
                          const char *NDArrayPort, int NDArrayAddr,
                          int maxBuffers, size_t maxMemory,
-                         int priority, int stackSize)
+                         int priority, int stackSize, int maxThreads)
     /* Invoke the base class constructor */
     : NDPluginDriver(portName, queueSize, blockingCallbacks,
                    NDArrayPort, NDArrayAddr, 1, NUM_NDPLUGIN_ROI_PARAMS, maxBuffers, maxMemory,
                    asynInt32ArrayMask | asynFloat64ArrayMask | asynGenericPointerMask,
                    asynInt32ArrayMask | asynFloat64ArrayMask | asynGenericPointerMask,
-                   ASYN_MULTIDEVICE, 1, priority, stackSize)
+                   ASYN_MULTIDEVICE, 1, priority, stackSize, maxThreads)
 {
     //static const char *functionName = "NDPluginROI";
 
@@ -341,6 +333,10 @@ NDPluginROI::NDPluginROI(const char *portName, int queueSize, int blockingCallba
     createParam(NDPluginROIDataTypeString,          asynParamInt32, &NDPluginROIDataType);
     createParam(NDPluginROIEnableScaleString,       asynParamInt32, &NDPluginROIEnableScale);
     createParam(NDPluginROIScaleString,             asynParamFloat64, &NDPluginROIScale);
+    createParam(NDPluginROIComputeThreadsString,    asynParamInt32, &NDPluginROIComputeThreads);
+
+    this->pStripeWorkers = new NDStripeWorkers(portName);
+    setIntegerParam(NDPluginROIComputeThreads, 1);
 
     /* Set the plugin type string */
     setStringParam(NDPluginDriverPluginType, "NDPluginROI");
@@ -353,14 +349,19 @@ NDPluginROI::NDPluginROI(const char *portName, int queueSize, int blockingCallba
     connectToArrayPort();
 }
 
+NDPluginROI::~NDPluginROI()
+{
+    delete this->pStripeWorkers;
+}
+
 /** Configuration command */
 extern "C" int NDROIConfigure(const char *portName, int queueSize, int blockingCallbacks,
                                  const char *NDArrayPort, int NDArrayAddr,
                                  int maxBuffers, size_t maxMemory,
-                                 int priority, int stackSize)
+                                 int priority, int stackSize, int maxThreads)
 {
     new NDPluginROI(portName, queueSize, blockingCallbacks, NDArrayPort, NDArrayAddr,
-                    maxBuffers, maxMemory, priority, stackSize);
+                    maxBuffers, maxMemory, priority, stackSize, maxThreads);
     return(asynSuccess);
 }
 
@@ -374,6 +375,7 @@ static const iocshArg initArg5 = { "maxBuffers",iocshArgInt};
 static const iocshArg initArg6 = { "maxMemory",iocshArgInt};
 static const iocshArg initArg7 = { "priority",iocshArgInt};
 static const iocshArg initArg8 = { "stackSize",iocshArgInt};
+static const iocshArg initArg9 = { "maxThreads",iocshArgInt};
 static const iocshArg * const initArgs[] = {&initArg0,
                                             &initArg1,
                                             &initArg2,
@@ -382,13 +384,15 @@ static const iocshArg * const initArgs[] = {&initArg0,
                                             &initArg5,
                                             &initArg6,
                                             &initArg7,
-                                            &initArg8};
-static const iocshFuncDef initFuncDef = {"NDROIConfigure",9,initArgs};
+                                            &initArg8,
+                                            &initArg9};
+static const iocshFuncDef initFuncDef = {"NDROIConfigure",10,initArgs};
 static void initCallFunc(const iocshArgBuf *args)
 {
     NDROIConfigure(args[0].sval, args[1].ival, args[2].ival,
                    args[3].sval, args[4].ival, args[5].ival,
-                   args[6].ival, args[7].ival, args[8].ival);
+                   args[6].ival, args[7].ival, args[8].ival,
+                   args[9].ival);
 }
 
 extern "C" void NDROIRegister(void)
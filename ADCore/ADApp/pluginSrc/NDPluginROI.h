@@ -2,6 +2,7 @@
 #define NDPluginROI_H
 
 #include "NDPluginDriver.h"
+#include "NDStripeWorkers.h"
 
 /* ROI general parameters */
 #define NDPluginROINameString               "NAME"                /* (asynOctet,   r/w) Name of this ROI */
@@ -31,6 +32,7 @@
 #define NDPluginROIDataTypeString           "ROI_DATA_TYPE"     /* (asynInt32,   r/w) Data type for ROI.  -1 means automatic. */
 #define NDPluginROIEnableScaleString        "ENABLE_SCALE"      /* (asynInt32,   r/w) Disable/Enable scaling */
 #define NDPluginROIScaleString              "SCALE_VALUE"       /* (asynFloat64, r/w) Scaling value, used as divisor */
+#define NDPluginROIComputeThreadsString     "COMPUTE_THREADS"   /* (asynInt32,   r/w) Number of threads extracting each ROI */
 
 /** Extract Regions-Of-Interest (ROI) from NDArray data; the plugin can be a source of NDArray callbacks for
   * other plugins, passing these sub-arrays. 
@@ -40,7 +42,8 @@ public:
     NDPluginROI(const char *portName, int queueSize, int blockingCallbacks, 
                  const char *NDArrayPort, int NDArrayAddr,
                  int maxBuffers, size_t maxMemory,
-                 int priority, int stackSize);
+                 int priority, int stackSize, int maxThreads=1);
+    ~NDPluginROI();
     /* These methods override the virtual methods in the base class */
     void processCallbacks(NDArray *pArray);
     asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
@@ -75,12 +78,14 @@ protected:
     int NDPluginROIDataType;
     int NDPluginROIEnableScale;
     int NDPluginROIScale;
+    int NDPluginROIComputeThreads;
 
-    #define LAST_NDPLUGIN_ROI_PARAM NDPluginROIScale
+    #define LAST_NDPLUGIN_ROI_PARAM NDPluginROIComputeThreads
                                 
 private:
     int requestedSize_[3];
     int requestedOffset_[3];
+    NDStripeWorkers *pStripeWorkers;
 };
 #define NUM_NDPLUGIN_ROI_PARAMS ((int)(&LAST_NDPLUGIN_ROI_PARAM - &FIRST_NDPLUGIN_ROI_PARAM + 1))
     
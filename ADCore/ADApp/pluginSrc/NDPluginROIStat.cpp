@@ -13,6 +13,9 @@
 #include <string.h>
 #include <stdio.h>
 #include <math.h>
+#include <stddef.h>
+
+#include <vector>
 
 #include <epicsString.h>
 #include <epicsMutex.h>
@@ -24,170 +27,260 @@
 
 #include "NDArray.h"
 #include "NDPluginROIStat.h"
+#include "NDStatsTraits.h"
 
 #define MAX(A,B) (A)>(B)?(A):(B)
 #define MIN(A,B) (A)<(B)?(A):(B)
 
 #define DEFAULT_NUM_TSPOINTS 2048
   
+/* Work counted for each row of a band in addition to the ROI elements in that row */
+#define ROW_OVERHEAD 16
+
+/** Clamped geometry of one ROI. 1-D arrays are a single row with no background rows. */
+typedef struct {
+  size_t offsetX;
+  size_t sizeX;
+  size_t offsetY;
+  size_t sizeY;
+  size_t bgdWidthX;
+  size_t bgdWidthY;
+} NDROIStatRegion_t;
+
+/** Results of one ROI accumulated over the rows of one band */
+typedef struct {
+  double min;
+  double max;
+  double total;
+  double bgd;
+  size_t nBgd;
+  bool valid;
+} NDROIStatPartial_t;
+
+/** Everything the bands of one array need; built in computeROIStatistics */
+typedef struct NDROIStatPlan {
+  const void *pData;
+  size_t rowLength;
+  int numROIs;
+  const NDROIStatRegion_t *pRegions;
+  NDROIStatPartial_t *pPartials;    /* numROIs partials for each band */
+  const size_t *pBandStart;         /* numStripes+1 row boundaries */
+  int numStripes;
+  void (*bandFunc)(const struct NDROIStatPlan *pPlan, int stripe);
+} NDROIStatPlan_t;
+
+/** Returns the sum of n elements */
+template <typename epicsType>
+static typename NDStatsTraits<epicsType>::sum_t sumElements(const epicsType *pData, size_t n)
+{
+  typename NDStatsTraits<epicsType>::sum_t sum = 0;
+  for (size_t i=0; i<n; i++) sum += pData[i];
+  return sum;
+}
+
+/** Returns the sum of n elements and updates the minimum and maximum with them */
+template <typename epicsType>
+static typename NDStatsTraits<epicsType>::sum_t sumMinMax(const epicsType *pData, size_t n,
+                                                             epicsType *pMin, epicsType *pMax)
+{
+  typename NDStatsTraits<epicsType>::sum_t sum = 0;
+  epicsType lo = *pMin;
+  epicsType hi = *pMax;
+  for (size_t i=0; i<n; i++) {
+    epicsType value = pData[i];
+    lo = (value < lo) ? value : lo;
+    hi = (value > hi) ? value : hi;
+    sum += value;
+  }
+  *pMin = lo;
+  *pMax = hi;
+  return sum;
+}
+
 /**
- * Templated function to calculate statistics on different NDArray data types.
- * \param[in] NDArray The pointer to the NDArray object
- * \param[in] NDROI The pointer to the NDROI object
- * \return asynStatus
+ * Accumulates every ROI that intersects each row of one band. Each row is read from memory once
+ * and stays in the cache while all of the ROIs in it are summed.
+ * The background of a ROI is its first and last bgdWidthY rows, plus the first and last bgdWidthX
+ * elements of the rows in between. Rows that are in both the first and the last bgdWidthY rows, and
+ * elements that are in both the first and the last bgdWidthX, are counted twice.
+ * \param[in] pPlan The plan of the array
+ * \param[in] stripe The band to compute
  */
 template <typename epicsType>
-asynStatus NDPluginROIStat::doComputeStatisticsT(NDArray *pArray, NDROI *pROI)
+static void computeBand(const NDROIStatPlan_t *pPlan, int stripe)
 {
-  epicsType *pData = (epicsType *)pArray->pData;
-  double value = 0;
-  double bgd = 0;
-  size_t sizeX = pROI->size[0];
-  size_t sizeY = pROI->size[1];
-  size_t offsetX = pROI->offset[0];
-  size_t offsetY = pROI->offset[1];
-  size_t x = 0;
-  size_t y = 0;
-  size_t nElements = 0;
-  size_t nBgd = 0;
-  size_t bgdWidthX = MIN(pROI->bgdWidth, sizeX);
-  size_t bgdWidthY = MIN(pROI->bgdWidth, sizeY);
-  bool initial = true;
-  size_t yOffset = 0;
-
-  pROI->min = 0;
-  pROI->max = 0;
-  pROI->total = 0;
-  pROI->mean = 0;
-  pROI->net = 0;
-
-  if (pArray->ndims == 1) {
-    nElements = sizeX;
-    for (x=offsetX; x<offsetX+sizeX; ++x) {
-      value = (double)pData[x];
-      if (initial) {
-        pROI->min = value;
-        pROI->max = value;
-        initial = false;
-      }  
-      if (value < pROI->min) pROI->min = value;
-      if (value > pROI->max) pROI->max = value;
-      pROI->total += value;
-    }
-    if (pROI->bgdWidth > 0) {
-      for (x=offsetX; x<offsetX+bgdWidthX; ++x) {
-        nBgd++;
-        bgd += (double)pData[x];
-      }
-      for (x=offsetX+sizeX-bgdWidthX; x<offsetX+sizeX; ++x) {
-        nBgd++;
-        bgd += (double)pData[x];
-      }
-    }    
-  } else if (pArray->ndims == 2) {
-    nElements = sizeX * sizeY;
-    for (y=offsetY; y<offsetY+sizeY; ++y) {
-      yOffset = y*pROI->arraySize[0];
-      for (x=offsetX; x<offsetX+sizeX; ++x) {
-        value = (double)pData[x+yOffset];
-        if (initial) {
-          pROI->min = value;
-          pROI->max = value;
-          initial = false;
-        } 
-        if (value < pROI->min) pROI->min = value;
-        if (value > pROI->max) pROI->max = value;
-        pROI->total += value;
-      }
-    }
-    if (pROI->bgdWidth > 0) {
-      // Compute total counts in the bgdWidthY rows at the top
-      for (y=offsetY; y<offsetY+bgdWidthY; ++y) {
-        yOffset = y*pROI->arraySize[0];
-        for (x=offsetX; x<offsetX+sizeX; ++x) {
-          nBgd++;
-          bgd += (double)pData[x+yOffset];
-        }
-      }
-      // Compute total counts in the bgdWidthY rows at the bottom
-      for (y=offsetY+sizeY-bgdWidthY; y<offsetY+sizeY; ++y) {
-        yOffset = y*pROI->arraySize[0];
-        for (x=offsetX; x<offsetX+sizeX; ++x) {
-          nBgd++;
-          bgd += (double)pData[x+yOffset];
-        }
-      }
-      // Compute total counts in the bgdWidthX columns left and right
-      for (y=offsetY+bgdWidthY; y<offsetY+sizeY-bgdWidthY; ++y) {
-        yOffset = y*pROI->arraySize[0];
-        for (x=offsetX; x<offsetX+bgdWidthX; ++x) {
-          nBgd++;
-          bgd += (double)pData[x+yOffset];
-        }
-        for (x=offsetX+sizeX-bgdWidthX; x<offsetX+sizeX; ++x) {
-          nBgd++;
-          bgd += (double)pData[x+yOffset];
-        }
+  const epicsType *pData = (const epicsType *)pPlan->pData;
+  NDROIStatPartial_t *pPartials = pPlan->pPartials + (size_t)stripe*pPlan->numROIs;
+
+  for (size_t y=pPlan->pBandStart[stripe]; y<pPlan->pBandStart[stripe+1]; y++) {
+    const epicsType *pRow = pData + y*pPlan->rowLength;
+    for (int roi=0; roi<pPlan->numROIs; roi++) {
+      const NDROIStatRegion_t *pRegion = &pPlan->pRegions[roi];
+      NDROIStatPartial_t *pPartial = &pPartials[roi];
+      /* An empty ROI has no element to seed min and max with; it keeps the results of 0 */
+      if ((pRegion->sizeX == 0) || (y < pRegion->offsetY) || (y >= pRegion->offsetY + pRegion->sizeY)) continue;
+
+      const epicsType *pStart = pRow + pRegion->offsetX;
+      epicsType lo = pPartial->valid ? (epicsType)pPartial->min : pStart[0];
+      epicsType hi = pPartial->valid ? (epicsType)pPartial->max : pStart[0];
+      double rowTotal = (double)sumMinMax(pStart, pRegion->sizeX, &lo, &hi);
+      pPartial->min = lo;
+      pPartial->max = hi;
+      pPartial->total += rowTotal;
+      pPartial->valid = true;
+
+      int bgdRows = ((y < pRegion->offsetY + pRegion->bgdWidthY) ? 1 : 0) +
+                    ((y >= pRegion->offsetY + pRegion->sizeY - pRegion->bgdWidthY) ? 1 : 0);
+      if (bgdRows > 0) {
+        pPartial->bgd += bgdRows * rowTotal;
+        pPartial->nBgd += bgdRows * pRegion->sizeX;
+      } else if (pRegion->bgdWidthX > 0) {
+        pPartial->bgd += (double)sumElements(pStart, pRegion->bgdWidthX);
+        pPartial->bgd += (double)sumElements(pStart + pRegion->sizeX - pRegion->bgdWidthX, pRegion->bgdWidthX);
+        pPartial->nBgd += 2 * pRegion->bgdWidthX;
       }
     }
   }
+}
 
-  if (nBgd > 0) {
-    bgd = bgd/nBgd * nElements;
-  }
-  pROI->net = pROI->total - bgd;
-
-  if (nElements > 0) {
-    pROI->mean = pROI->total / nElements;
-  }
-
-  return asynSuccess;
-
+static void computeBandC(void *pvt, int stripe)
+{
+  const NDROIStatPlan_t *pPlan = (const NDROIStatPlan_t *)pvt;
+  pPlan->bandFunc(pPlan, stripe);
 }
 
-     
 /**
- * Call the templated doComputeStatistics so we can cast correctly. 
- * \param[in] NDArray The pointer to the NDArray object
- * \param[in] NDROI The pointer to the NDROI object
- * \return asynStatus
+ * Computes the statistics of all of the ROIs in a single sweep over the array.
+ * The rows that contain ROIs are divided into bands with about the same number of ROI elements,
+ * and the bands are computed in parallel. Each band keeps its own partial results for every ROI,
+ * which are combined in band order at the end.
+ * \param[in] pArray The 1-D or 2-D array
+ * \param[in,out] ppROIs The ROIs to compute, with their offsets and sizes already clamped to the array
+ * \param[in] numROIs Number of ROIs in ppROIs
+ * \param[in] pWorkers Threads to compute the bands with
+ * \param[in] numThreads Maximum number of bands to compute in parallel
+ * \return asynError if the data type is not supported
  */
-asynStatus NDPluginROIStat::doComputeStatistics(NDArray *pArray, NDROI *pROI)
+static asynStatus computeROIStatistics(NDArray *pArray, NDROI_t **ppROIs, int numROIs,
+                                       NDStripeWorkers *pWorkers, int numThreads)
 {
-  asynStatus status = asynSuccess;
-  
+  std::vector<NDROIStatRegion_t> regions(numROIs);
+  NDROIStatPlan_t plan;
+  size_t numRows = 0;
+  size_t firstRow = 0;
+  size_t lastRow = 0;
+  size_t totalWork = 0;
+  int roi;
+
+  for (roi=0; roi<numROIs; roi++) {
+    NDROI_t *pROI = ppROIs[roi];
+    pROI->min = 0;
+    pROI->max = 0;
+    pROI->total = 0;
+    pROI->mean = 0;
+    pROI->net = 0;
+  }
+  if ((numROIs == 0) || (pArray->ndims < 1) || (pArray->ndims > 2)) return asynSuccess;
+
+  memset(&plan, 0, sizeof(plan));
   switch(pArray->dataType) {
-  case NDInt8:
-    status = doComputeStatisticsT<epicsInt8>(pArray, pROI);
-    break;
-  case NDUInt8:
-    status = doComputeStatisticsT<epicsUInt8>(pArray, pROI);
-    break;
-  case NDInt16:
-    status = doComputeStatisticsT<epicsInt16>(pArray, pROI);
-    break;
-  case NDUInt16:
-    status = doComputeStatisticsT<epicsUInt16>(pArray, pROI);
-    break;
-  case NDInt32:
-    status = doComputeStatisticsT<epicsInt32>(pArray, pROI);
-    break;
-  case NDUInt32:
-    status = doComputeStatisticsT<epicsUInt32>(pArray, pROI);
-    break;
-  case NDFloat32:
-    status = doComputeStatisticsT<epicsFloat32>(pArray, pROI);
-    break;
-  case NDFloat64:
-    status = doComputeStatisticsT<epicsFloat64>(pArray, pROI);
-    break;
-  default:
-    return asynError;
-    break;
+    case NDInt8:    plan.bandFunc = computeBand<epicsInt8>;    break;
+    case NDUInt8:   plan.bandFunc = computeBand<epicsUInt8>;   break;
+    case NDInt16:   plan.bandFunc = computeBand<epicsInt16>;   break;
+    case NDUInt16:  plan.bandFunc = computeBand<epicsUInt16>;  break;
+    case NDInt32:   plan.bandFunc = computeBand<epicsInt32>;   break;
+    case NDUInt32:  plan.bandFunc = computeBand<epicsUInt32>;  break;
+    case NDFloat32: plan.bandFunc = computeBand<epicsFloat32>; break;
+    case NDFloat64: plan.bandFunc = computeBand<epicsFloat64>; break;
+    default:
+      return asynError;
+  }
+
+  numRows = (pArray->ndims > 1) ? pArray->dims[1].size : 1;
+  firstRow = numRows;
+  for (roi=0; roi<numROIs; roi++) {
+    NDROI_t *pROI = ppROIs[roi];
+    NDROIStatRegion_t *pRegion = &regions[roi];
+    pRegion->offsetX = pROI->offset[0];
+    pRegion->sizeX = pROI->size[0];
+    pRegion->bgdWidthX = MIN(pROI->bgdWidth, pRegion->sizeX);
+    if (pArray->ndims > 1) {
+      pRegion->offsetY = pROI->offset[1];
+      pRegion->sizeY = pROI->size[1];
+      pRegion->bgdWidthY = MIN(pROI->bgdWidth, pRegion->sizeY);
+    } else {
+      pRegion->offsetY = 0;
+      pRegion->sizeY = 1;
+      pRegion->bgdWidthY = 0;
+    }
+    firstRow = MIN(firstRow, pRegion->offsetY);
+    lastRow = MAX(lastRow, pRegion->offsetY + pRegion->sizeY);
   }
-  return status;
-}
 
+  /* The work in each row is the number of ROI elements in it, found from the changes at the
+   * top and bottom of each ROI */
+  std::vector<ptrdiff_t> rowWork(lastRow - firstRow + 1, 0);
+  for (roi=0; roi<numROIs; roi++) {
+    rowWork[regions[roi].offsetY - firstRow] += regions[roi].sizeX;
+    rowWork[regions[roi].offsetY + regions[roi].sizeY - firstRow] -= regions[roi].sizeX;
+  }
+  for (size_t row=1; row<rowWork.size(); row++) rowWork[row] += rowWork[row-1];
+  for (size_t row=0; row<rowWork.size()-1; row++) {
+    rowWork[row] += ROW_OVERHEAD;
+    totalWork += rowWork[row];
+  }
+
+  plan.numStripes = NDStripeWorkers::numStripes(numThreads, totalWork, lastRow - firstRow);
+
+  std::vector<size_t> bandStart(plan.numStripes + 1, lastRow);
+  size_t work = 0;
+  size_t row = firstRow;
+  for (int stripe=0; stripe<plan.numStripes; stripe++) {
+    bandStart[stripe] = row;
+    size_t bandEnd = totalWork * (stripe+1) / plan.numStripes;
+    while ((row < lastRow) && (work < bandEnd)) work += rowWork[row++ - firstRow];
+  }
+
+  std::vector<NDROIStatPartial_t> partials((size_t)plan.numStripes * numROIs);
+  memset(&partials[0], 0, partials.size()*sizeof(NDROIStatPartial_t));
+  plan.pData = pArray->pData;
+  plan.rowLength = pArray->dims[0].size;
+  plan.numROIs = numROIs;
+  plan.pRegions = &regions[0];
+  plan.pPartials = &partials[0];
+  plan.pBandStart = &bandStart[0];
+  pWorkers->run(plan.numStripes, computeBandC, &plan);
+
+  for (roi=0; roi<numROIs; roi++) {
+    NDROI_t *pROI = ppROIs[roi];
+    double bgd = 0;
+    size_t nBgd = 0;
+    size_t nElements = regions[roi].sizeX * regions[roi].sizeY;
+    bool initial = true;
+    for (int stripe=0; stripe<plan.numStripes; stripe++) {
+      NDROIStatPartial_t *pPartial = &partials[(size_t)stripe*numROIs + roi];
+      if (!pPartial->valid) continue;
+      if (initial) {
+        pROI->min = pPartial->min;
+        pROI->max = pPartial->max;
+        initial = false;
+      }
+      if (pPartial->min < pROI->min) pROI->min = pPartial->min;
+      if (pPartial->max > pROI->max) pROI->max = pPartial->max;
+      pROI->total += pPartial->total;
+      bgd += pPartial->bgd;
+      nBgd += pPartial->nBgd;
+    }
+    if (nBgd > 0) {
+      bgd = bgd/nBgd * nElements;
+    }
+    pROI->net = pROI->total - bgd;
+    if (nElements > 0) {
+      pROI->mean = pROI->total / nElements;
+    }
+  }
+  return asynSuccess;
+}
 
 /** 
  * Callback function that is called by the NDArray driver with new NDArray data.
@@ -207,6 +300,8 @@ void NDPluginROIStat::processCallbacks(NDArray *pArray)
   asynStatus status = asynSuccess;
   NDROI *pROI;
   int TSAcquiring;
+  int computeThreads = 1;
+  int numActive = 0;
   const char* functionName = "NDPluginROIStat::processCallbacks";
 
   /* Call the base class method */
@@ -224,8 +319,10 @@ void NDPluginROIStat::processCallbacks(NDArray *pArray)
   if (pArray->ndims > 1) setIntegerParam(NDArraySizeY, (int)pArray->dims[1].size);
 
   getIntegerParam(NDPluginROIStatTSAcquiring,        &TSAcquiring);
+  getIntegerParam(NDPluginROIStatComputeThreads,     &computeThreads);
 
   /* Loop over the ROIs in this driver */
+  numActive = 0;
   for (int roi=0; roi<maxROIs_; ++roi) {
     
     pROI = &pROIs_[roi];
@@ -262,21 +359,28 @@ void NDPluginROIStat::processCallbacks(NDArray *pArray)
       setIntegerParam(roi, NDPluginROIStatDim1Min,  (int)pROI->offset[1]);
       setIntegerParam(roi, NDPluginROIStatDim1Size, (int)pROI->size[1]);
     }
-        
-    /* This function is called with the lock taken, and it must be set when we exit.
-     * The following code can be exected without the mutex because we are not accessing elements of
-     * pPvt that other threads can access. */
-    this->unlock();
-    
-    status = doComputeStatistics(pArray, pROI);
-    if (status != asynSuccess) {
-      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
-        "%s: doComputeStatistics failed. status=%d\n", 
-        functionName, status);
-    }
+    activeROIs_[numActive] = roi;
+    pActiveROIs_[numActive] = pROI;
+    numActive++;
+  }
+
+  /* This function is called with the lock taken, and it must be set when we exit.
+   * The following code can be exected without the mutex because we are not accessing elements of
+   * pPvt that other threads can access. */
+  this->unlock();
+
+  /* All of the ROIs are computed in one sweep over the array */
+  status = computeROIStatistics(pArray, pActiveROIs_, numActive, this->pStripeWorkers, computeThreads);
+  if (status != asynSuccess) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, 
+      "%s: computeROIStatistics failed. status=%d\n", 
+      functionName, status);
+  }
 
-    if (TSAcquiring) {
-      double *pData = timeSeries_ + (roi * MAX_TIME_SERIES_TYPES * numTSPoints_);
+  if (TSAcquiring) {
+    for (int i=0; i<numActive; ++i) {
+      pROI = pActiveROIs_[i];
+      double *pData = timeSeries_ + (activeROIs_[i] * MAX_TIME_SERIES_TYPES * numTSPoints_);
       pData[TSMinValue*numTSPoints_ + currentTSPoint_]  = pROI->min;
       pData[TSMaxValue*numTSPoints_ + currentTSPoint_]  = pROI->max;
       pData[TSMeanValue*numTSPoints_ + currentTSPoint_] = pROI->mean;
@@ -284,9 +388,13 @@ void NDPluginROIStat::processCallbacks(NDArray *pArray)
       pData[TSNet*numTSPoints_ + currentTSPoint_]       = pROI->net;
       pData[TSTimestamp*numTSPoints_ + currentTSPoint_] = pArray->timeStamp;
     }
+  }
 
-    /* We must enter the loop and exit with the mutex locked */
-    this->lock();
+  /* We must exit with the mutex locked */
+  this->lock();
+  for (int i=0; i<numActive; ++i) {
+    int roi = activeROIs_[i];
+    pROI = pActiveROIs_[i];
     setDoubleParam(roi, NDPluginROIStatMinValue,    pROI->min);
     setDoubleParam(roi, NDPluginROIStatMaxValue,    pROI->max);
     setDoubleParam(roi, NDPluginROIStatMeanValue,   pROI->mean);
@@ -492,6 +600,8 @@ NDPluginROIStat::NDPluginROIStat(const char *portName, int queueSize, int blocki
   maxROIs_ = maxROIs;
   pROIs_ = new NDROI[maxROIs];
   if(!pROIs_) {cantProceed(functionName);}
+  pActiveROIs_ = new NDROI_t*[maxROIs];
+  activeROIs_ = new int[maxROIs];
   
   /* ROI general parameters */
   createParam(NDPluginROIStatFirstString,             asynParamInt32, &NDPluginROIStatFirst);
@@ -531,6 +641,8 @@ NDPluginROIStat::NDPluginROIStat(const char *portName, int queueSize, int blocki
   createParam(NDPluginROIStatTSNetString,        asynParamFloat64Array, &NDPluginROIStatTSNet);
   createParam(NDPluginROIStatTSTimestampString,  asynParamFloat64Array, &NDPluginROIStatTSTimestamp);
 
+  createParam(NDPluginROIStatComputeThreadsString,    asynParamInt32, &NDPluginROIStatComputeThreads);
+
   createParam(NDPluginROIStatLastString,              asynParamInt32, &NDPluginROIStatLast);
   
   //Note: params set to a default value here will overwrite a default database value
@@ -567,6 +679,9 @@ NDPluginROIStat::NDPluginROIStat(const char *portName, int queueSize, int blocki
   numTSPoints_ = DEFAULT_NUM_TSPOINTS;
   setIntegerParam(NDPluginROIStatTSNumPoints, numTSPoints_);
   timeSeries_ = (double *)calloc(MAX_TIME_SERIES_TYPES*maxROIs_*numTSPoints_, sizeof(double));
+
+  setIntegerParam(NDPluginROIStatComputeThreads, 1);
+  this->pStripeWorkers = new NDStripeWorkers(portName);
   
   /* Try to connect to the array port */
   connectToArrayPort();
@@ -575,6 +690,15 @@ NDPluginROIStat::NDPluginROIStat(const char *portName, int queueSize, int blocki
   
 }
 
+NDPluginROIStat::~NDPluginROIStat()
+{
+  delete this->pStripeWorkers;
+  delete [] activeROIs_;
+  delete [] pActiveROIs_;
+  delete [] pROIs_;
+  free(timeSeries_);
+}
+
 /** Configuration command */
 extern "C" int NDROIStatConfigure(const char *portName, int queueSize, int blockingCallbacks,
                                  const char *NDArrayPort, int NDArrayAddr, int maxROIs,
@@ -8,12 +8,14 @@
 #include <epicsTypes.h>
 
 #include "NDPluginDriver.h"
+#include "NDStripeWorkers.h"
 
 /* ROI general parameters */
 #define NDPluginROIStatFirstString              "ROISTAT_FIRST"
 #define NDPluginROIStatLastString               "ROISTAT_LAST"
 #define NDPluginROIStatNameString               "ROISTAT_NAME"              /* (asynOctet, r/w) Name of this ROI */
 #define NDPluginROIStatResetAllString           "ROISTAT_RESETALL"          /* (asynInt32, r/w) Reset ROI data for all ROIs. */
+#define NDPluginROIStatComputeThreadsString     "COMPUTE_THREADS"           /* (asynInt32, r/w) Number of threads computing the ROIs of each array */
 
 /* ROI definition */
 #define NDPluginROIStatUseString                "ROISTAT_USE"               /* (asynInt32, r/w) Use this ROI? */
@@ -79,13 +81,16 @@ typedef struct NDROI {
 } NDROI_t;
 
 
-/** Compute statistics on ROIs in an array */
+/** Compute statistics on ROIs in an array.
+  * All of the ROIs are computed in one sweep over the rows of the array. When the ROIs cover 65536
+  * elements or more the rows are divided into up to ComputeThreads bands that are computed in parallel. */
 class epicsShareClass NDPluginROIStat : public NDPluginDriver {
 public:
     NDPluginROIStat(const char *portName, int queueSize, int blockingCallbacks, 
                  const char *NDArrayPort, int NDArrayAddr, int maxROIs, 
                  int maxBuffers, size_t maxMemory,
                  int priority, int stackSize);
+    ~NDPluginROIStat();
     
     //These methods override the virtual methods in the base class
     void processCallbacks(NDArray *pArray);
@@ -131,22 +136,25 @@ protected:
     int NDPluginROIStatTSTotal;
     int NDPluginROIStatTSNet;
     int NDPluginROIStatTSTimestamp;
+
+    int NDPluginROIStatComputeThreads;
     
     int NDPluginROIStatLast;
     #define LAST_NDPLUGIN_ROISTAT_PARAM NDPluginROIStatLast
                                 
 private:
 
-    template <typename epicsType> asynStatus doComputeStatisticsT(NDArray *pArray, NDROI_t *pROI);
-    asynStatus doComputeStatistics(NDArray *pArray, NDROI_t *pStats);
     asynStatus clear(epicsUInt32 roi);
     void doTimeSeriesCallbacks();
 
     NDROI_t *pROIs_;    /* Array of NDROI structures */
+    NDROI_t **pActiveROIs_;  /* ROIs in use for the current array */
+    int *activeROIs_;        /* Numbers of the ROIs in pActiveROIs_ */
     int maxROIs_;
     int numTSPoints_;
     int currentTSPoint_;
     double  *timeSeries_;
+    NDStripeWorkers *pStripeWorkers;
 };
 
 #define NUM_NDPLUGIN_ROISTAT_PARAMS (int)(&LAST_NDPLUGIN_ROISTAT_PARAM - &FIRST_NDPLUGIN_ROISTAT_PARAM + 1)
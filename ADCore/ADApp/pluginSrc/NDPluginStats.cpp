@@ -12,6 +12,7 @@
 #include <stdio.h>
 #include <math.h>
 #include <iostream>
+#include <vector>
 #include <epicsString.h>
 #include <epicsMutex.h>
 #include <iocsh.h>
@@ -21,270 +22,429 @@
 #include <epicsExport.h>
 #include "NDPluginDriver.h"
 #include "NDPluginStats.h"
+#include "NDStatsTraits.h"
 
 #define MAX(A,B) (A)>(B)?(A):(B)
 #define MIN(A,B) (A)<(B)?(A):(B)
 
 static const char *driverName="NDPluginStats";
 
+/** Partial results of the fused kernel for one stripe of rows */
+struct NDStatsStripe {
+    size_t firstRow;
+    size_t numRows;
+    double min;
+    size_t minIndex;
+    double max;
+    size_t maxIndex;
+    double total;
+    double sumSquares;
+    double sigmaXY;
+    std::vector<double> profileAverageX;
+    std::vector<double> profileThresholdX;
+    std::vector<double> profileThresholdXY;
+    std::vector<double> histogram;
+    std::vector<epicsUInt32> rawCounts;
+};
+
+static void computeStripeC(void *drvPvt, int stripe)
+{
+    NDPluginStats *pPlugin = (NDPluginStats *)drvPvt;
+    pPlugin->computeStripe(stripe);
+}
+
+/** Computes the statistics, centroid sums and histogram of one stripe of rows in a single sweep.
+  * Each row is read once for each of the computations that is enabled, while it is in the L1 cache.
+  * The Y profiles are written directly, because each row belongs to one stripe; the X profiles and
+  * the histogram are accumulated in the stripe and added together in doComputeFused.
+  * \param[in] pStripe The stripe to compute. */
 template <typename epicsType>
-asynStatus NDPluginStats::doComputeHistogramT(NDArray *pArray)
+void NDPluginStats::computeStripeT(NDStatsStripe *pStripe)
 {
-    epicsType *pData = (epicsType *)pArray->pData;
-    size_t i;
-    double scale, entropy;
-    int bin;
-    size_t nElements;
-    double value, counts;
-    NDArrayInfo arrayInfo;
-    ////std::cout << "it's my soul0:::"<<std::endl; 
-    this->unlock();
-    if (this->histSizeNew != this->histogramSize) {
-        free(this->histogram);
-        this->histogramSize = this->histSizeNew;
-        this->histogram = (double *)calloc(this->histogramSize, sizeof(double));
+    typedef typename NDStatsTraits<epicsType>::sum_t sum_t;
+    typedef typename NDStatsTraits<epicsType>::sum2_t sum2_t;
+    const size_t rowLength = this->fusedRowLength;
+    const epicsType *pRow = (const epicsType *)this->pFusedArray->pData + pStripe->firstRow*rowLength;
+    const double threshold = this->centroidThreshold;
+    const double histMin = this->histMin;
+    const double scale = this->histogramSize / (this->histMax - this->histMin);
+    const int histSize = (int)this->histogramSize;
+    const bool doStatistics = (this->fusedFlags & NDStatsComputeStatistics) != 0;
+    const bool doCentroid   = (this->fusedFlags & NDStatsComputeCentroid) != 0;
+    const bool doHistogram  = (this->fusedFlags & NDStatsComputeHistogram) != 0;
+    double *pAverageX   = doCentroid  ? &pStripe->profileAverageX[0] : NULL;
+    double *pThresholdX = doCentroid  ? &pStripe->profileThresholdX[0] : NULL;
+    double *pThresholdXY = doCentroid ? &pStripe->profileThresholdXY[0] : NULL;
+    double *pHistogram  = (doHistogram && !this->fusedRawCounts) ? &pStripe->histogram[0] : NULL;
+    epicsUInt32 *pRawCounts = (doHistogram && this->fusedRawCounts) ? &pStripe->rawCounts[0] : NULL;
+    size_t ix, iy;
+
+    pStripe->total = 0.;
+    pStripe->sumSquares = 0.;
+    pStripe->sigmaXY = 0.;
+    if (doCentroid) {
+        memset(pAverageX,   0, rowLength*sizeof(double));
+        memset(pThresholdX, 0, rowLength*sizeof(double));
+        memset(pThresholdXY, 0, rowLength*sizeof(double));
     }
-    memset(this->histogram, 0, this->histogramSize*sizeof(double));
-    pArray->getInfo(&arrayInfo);
-    nElements = arrayInfo.nElements;
-    scale = this->histogramSize / (histMax - histMin);
+    if (pHistogram) memset(pHistogram, 0, histSize*sizeof(double));
+    if (pRawCounts) memset(pRawCounts, 0, NDStatsTraits<epicsType>::rawValues*sizeof(epicsUInt32));
 
-    for (i=0; i<nElements; i++) {
-        value = (double)pData[i];
-        bin = (int)(((value - histMin) * scale) + 0.5);
-        if ((bin >= 0) && (bin < (int)this->histogramSize)) this->histogram[bin]++;
+    for (iy=pStripe->firstRow; iy<pStripe->firstRow+pStripe->numRows; iy++, pRow+=rowLength) {
+        if (doStatistics) {
+            epicsType rowMin = pRow[0], rowMax = pRow[0];
+            sum_t rowSum = 0;
+            sum2_t rowSumSquares = 0;
+            for (ix=0; ix<rowLength; ix++) {
+                epicsType value = pRow[ix];
+                rowMin = value < rowMin ? value : rowMin;
+                rowMax = value > rowMax ? value : rowMax;
+                rowSum += value;
+                rowSumSquares += (sum2_t)value * value;
+            }
+            /* Only rows with a new minimum or maximum are searched for its position */
+            if ((iy == pStripe->firstRow) || (rowMin < pStripe->min)) {
+                for (ix=0; (ix<rowLength-1) && !(pRow[ix] == rowMin); ix++);
+                pStripe->min = (double)rowMin;
+                pStripe->minIndex = iy*rowLength + ix;
+            }
+            if ((iy == pStripe->firstRow) || (rowMax > pStripe->max)) {
+                for (ix=0; (ix<rowLength-1) && !(pRow[ix] == rowMax); ix++);
+                pStripe->max = (double)rowMax;
+                pStripe->maxIndex = iy*rowLength + ix;
+            }
+            pStripe->total += (double)rowSum;
+            pStripe->sumSquares += (double)rowSumSquares;
+        }
+        if (doCentroid) {
+            /* The sum of X*Y is accumulated per column and weighted by X after the last row, and the row
+             * sums use two accumulators, so that the loop does not depend on one serial sum */
+            const double y = (double)iy;
+            double rowSum[2] = {0., 0.}, rowThreshold[2] = {0., 0.};
+            for (ix=0; ix+1<rowLength; ix+=2) {
+                double value0 = (double)pRow[ix];
+                double value1 = (double)pRow[ix+1];
+                double thresholded0 = (value0 >= threshold) ? value0 : 0.;
+                double thresholded1 = (value1 >= threshold) ? value1 : 0.;
+                pAverageX[ix]      += value0;
+                pAverageX[ix+1]    += value1;
+                pThresholdX[ix]    += thresholded0;
+                pThresholdX[ix+1]  += thresholded1;
+                pThresholdXY[ix]   += thresholded0 * y;
+                pThresholdXY[ix+1] += thresholded1 * y;
+                rowSum[0]       += value0;
+                rowSum[1]       += value1;
+                rowThreshold[0] += thresholded0;
+                rowThreshold[1] += thresholded1;
+            }
+            if (ix < rowLength) {
+                double value = (double)pRow[ix];
+                double thresholded = (value >= threshold) ? value : 0.;
+                pAverageX[ix]    += value;
+                pThresholdX[ix]  += thresholded;
+                pThresholdXY[ix] += thresholded * y;
+                rowSum[0]       += value;
+                rowThreshold[0] += thresholded;
+            }
+            this->profileY[profAverage][iy]   = rowSum[0] + rowSum[1];
+            this->profileY[profThreshold][iy] = rowThreshold[0] + rowThreshold[1];
+        }
+        if (pRawCounts) {
+            for (ix=0; ix<rowLength; ix++) {
+                pRawCounts[NDStatsTraits<epicsType>::index(pRow[ix])]++;
+            }
+        } else if (pHistogram) {
+            for (ix=0; ix<rowLength; ix++) {
+                int bin = (int)((((double)pRow[ix] - histMin) * scale) + 0.5);
+                if ((bin >= 0) && (bin < histSize)) pHistogram[bin]++;
+            }
+        }
+    }
+    if (doCentroid) {
+        for (ix=0; ix<rowLength; ix++) pStripe->sigmaXY += pThresholdXY[ix] * ix;
     }
+}
+
+/** Adds the raw value counts of the stripes to the histogram */
+template <typename epicsType>
+void NDPluginStats::addRawCountsT(int numStripes)
+{
+    const double scale = this->histogramSize / (this->histMax - this->histMin);
+    size_t i;
+    int stripe;
 
-    entropy = 0;
-    for (i=0; i<this->histogramSize; i++) {
-        counts = this->histogram[i];
-        if (counts <= 0) counts = 1;
-        entropy += counts * log(counts);
+    for (i=0; i<(size_t)NDStatsTraits<epicsType>::rawValues; i++) {
+        double counts = 0.;
+        for (stripe=0; stripe<numStripes; stripe++) counts += this->stripes[stripe].rawCounts[i];
+        if (counts == 0.) continue;
+        int bin = (int)(((NDStatsTraits<epicsType>::value(i) - this->histMin) * scale) + 0.5);
+        if ((bin >= 0) && (bin < (int)this->histogramSize)) this->histogram[bin] += counts;
     }
-    entropy = -entropy / nElements;
-    this->histEntropy = entropy;
-    
-    this->lock();
-    return(asynSuccess);
 }
 
-asynStatus NDPluginStats::doComputeHistogram(NDArray *pArray)
+/** Computes one stripe of pFusedArray; called from the NDStripeWorkers threads */
+void NDPluginStats::computeStripe(int stripe)
 {
-    asynStatus status;
-    
-    switch(pArray->dataType) {
+    NDStatsStripe *pStripe = &this->stripes[stripe];
+
+    switch(this->pFusedArray->dataType) {
         case NDInt8:
-            status = doComputeHistogramT<epicsInt8>(pArray);
+            computeStripeT<epicsInt8>(pStripe);
             break;
         case NDUInt8:
-            status = doComputeHistogramT<epicsUInt8>(pArray);
+            computeStripeT<epicsUInt8>(pStripe);
             break;
         case NDInt16:
-            status = doComputeHistogramT<epicsInt16>(pArray);
+            computeStripeT<epicsInt16>(pStripe);
             break;
         case NDUInt16:
-            status = doComputeHistogramT<epicsUInt16>(pArray);
+            computeStripeT<epicsUInt16>(pStripe);
             break;
         case NDInt32:
-            status = doComputeHistogramT<epicsInt32>(pArray);
+            computeStripeT<epicsInt32>(pStripe);
             break;
         case NDUInt32:
-            status = doComputeHistogramT<epicsUInt32>(pArray);
+            computeStripeT<epicsUInt32>(pStripe);
             break;
         case NDFloat32:
-            status = doComputeHistogramT<epicsFloat32>(pArray);
+            computeStripeT<epicsFloat32>(pStripe);
             break;
         case NDFloat64:
-            status = doComputeHistogramT<epicsFloat64>(pArray);
+            computeStripeT<epicsFloat64>(pStripe);
             break;
         default:
-            status = asynError;
         break;
     }
-    return(status);
 }
 
-template <typename epicsType>
-void NDPluginStats::doComputeStatisticsT(NDArray *pArray, NDStats_t *pStats)
+/** Computes the statistics, the centroid and profiles, and the histogram of an array in one sweep.
+  * The array is divided into stripes of rows that are computed in parallel by ComputeThreads threads.
+  * It is called with the mutex locked, and unlocks it during the computation.
+  * \param[in] pArray  The NDArray to compute.
+  * \param[in] flags  Mask of NDStatsComputeStatistics, NDStatsComputeCentroid and NDStatsComputeHistogram.
+  * \param[out] pStats  The statistics, if NDStatsComputeStatistics is set.
+  */
+asynStatus NDPluginStats::doComputeFused(NDArray *pArray, int flags, NDStats_t *pStats)
 {
-    size_t i, imin, imax;
-    epicsType *pData = (epicsType *)pArray->pData;
     NDArrayInfo arrayInfo;
-    double value;
+    size_t numRows, rowsPerStripe, extraRows, row, i;
+    int computeThreads, numStripes, stripe;
+    int itemp;
+    double counts, entropy;
+    asynStatus status = asynSuccess;
 
-    this->unlock();
+    switch(pArray->dataType) {
+        case NDInt8: case NDUInt8: case NDInt16: case NDUInt16:
+        case NDInt32: case NDUInt32: case NDFloat32: case NDFloat64:
+            break;
+        default:
+            return(asynError);
+    }
     pArray->getInfo(&arrayInfo);
-    pStats->nElements = arrayInfo.nElements;
-    pStats->min = (double) pData[0];
-    imin = 0;
-    pStats->max = (double) pData[0];
-    imax = 0;
-    pStats->total = 0.;
-    pStats->sigma = 0.;
-    ////std::cout << "it's my soul1:::"<<std::endl; 
-    for (i=0; i<pStats->nElements; i++) {
-        value = (double)pData[i];
-        if (value < pStats->min) {
-            pStats->min = value;
-            imin = i;
-        }
-        if (value > pStats->max) {
-            pStats->max = value;
-            imax = i; 
+    if (arrayInfo.nElements == 0) return(asynError);
+
+    /* 1-D and 2-D arrays are swept by rows, other arrays as a single row */
+    if ((pArray->ndims == 1) || (pArray->ndims == 2)) {
+        this->fusedRowLength = pArray->dims[0].size;
+    } else {
+        this->fusedRowLength = arrayInfo.nElements;
+    }
+    numRows = arrayInfo.nElements / this->fusedRowLength;
+
+    /* The centroid needs the profile arrays, which are sized for the last array processed */
+    if ((flags & NDStatsComputeCentroid) &&
+        ((pArray->ndims > 2) || (this->fusedRowLength != this->profileSizeX) || (numRows != this->profileSizeY))) {
+        flags &= ~NDStatsComputeCentroid;
+        status = asynError;
+    }
+    if (flags & NDStatsComputeCentroid) {
+        getDoubleParam(NDPluginStatsCentroidThreshold, &this->centroidThreshold);
+    }
+    if (flags & NDStatsComputeHistogram) {
+        if (this->histSizeNew != this->histogramSize) {
+            free(this->histogram);
+            this->histogramSize = this->histSizeNew;
+            this->histogram = (double *)calloc(this->histogramSize, sizeof(double));
         }
-        pStats->total += value;
-        pStats->sigma += value * value;
-    }
-    pStats->minX = imin % arrayInfo.xSize;
-    pStats->minY = imin / arrayInfo.xSize;
-    pStats->maxX = imax % arrayInfo.xSize;
-    pStats->maxY = imax / arrayInfo.xSize;
-    pStats->net = pStats->total;
-    pStats->mean = pStats->total / pStats->nElements;
-    pStats->sigma = sqrt((pStats->sigma / pStats->nElements) - (pStats->mean * pStats->mean));
-    this->lock();
-}
+        memset(this->histogram, 0, this->histogramSize*sizeof(double));
+    }
 
-int NDPluginStats::doComputeStatistics(NDArray *pArray, NDStats_t *pStats)
-{
+    getIntegerParam(NDPluginStatsComputeThreads, &computeThreads);
+    numStripes = NDStripeWorkers::numStripes(computeThreads, arrayInfo.nElements, numRows);
+    if (numStripes > this->numStripesAlloc) {
+        delete [] this->stripes;
+        this->stripes = new NDStatsStripe[numStripes];
+        this->numStripesAlloc = numStripes;
+    }
 
+    this->pFusedArray = pArray;
+    this->fusedFlags = flags;
     switch(pArray->dataType) {
-        case NDInt8:
-            doComputeStatisticsT<epicsInt8>(pArray, pStats);
-            break;
-        case NDUInt8:
-            doComputeStatisticsT<epicsUInt8>(pArray, pStats);
-            break;
-        case NDInt16:
-            doComputeStatisticsT<epicsInt16>(pArray, pStats);
+        case NDInt8: case NDUInt8:
+            itemp = 256;
             break;
-        case NDUInt16:
-            doComputeStatisticsT<epicsUInt16>(pArray, pStats);
-            break;
-        case NDInt32:
-            doComputeStatisticsT<epicsInt32>(pArray, pStats);
-            break;
-        case NDUInt32:
-            doComputeStatisticsT<epicsUInt32>(pArray, pStats);
-            break;
-        case NDFloat32:
-            doComputeStatisticsT<epicsFloat32>(pArray, pStats);
-            break;
-        case NDFloat64:
-            doComputeStatisticsT<epicsFloat64>(pArray, pStats);
+        case NDInt16: case NDUInt16:
+            itemp = 65536;
             break;
         default:
-            return(ND_ERROR);
-        break;
+            itemp = 0;
+            break;
+    }
+    this->fusedRawCounts = (itemp > 0) && (arrayInfo.nElements >= (size_t)itemp*4);
+    rowsPerStripe = numRows / numStripes;
+    extraRows = numRows % numStripes;
+    row = 0;
+    for (stripe=0; stripe<numStripes; stripe++) {
+        NDStatsStripe *pStripe = &this->stripes[stripe];
+        pStripe->firstRow = row;
+        pStripe->numRows = rowsPerStripe + (((size_t)stripe < extraRows) ? 1 : 0);
+        row += pStripe->numRows;
+        if (flags & NDStatsComputeCentroid) {
+            pStripe->profileAverageX.resize(this->fusedRowLength);
+            pStripe->profileThresholdX.resize(this->fusedRowLength);
+            pStripe->profileThresholdXY.resize(this->fusedRowLength);
+        }
+        if (flags & NDStatsComputeHistogram) {
+            if (this->fusedRawCounts) pStripe->rawCounts.resize(itemp);
+            else pStripe->histogram.resize(this->histogramSize);
+        }
     }
-    return(ND_SUCCESS);
-}
-
-template <typename epicsType>
-asynStatus NDPluginStats::doComputeCentroidT(NDArray *pArray)
-{
-    //std::cout << "it's my soul2:::"<<std::endl; 
-    epicsType *pData = (epicsType *)pArray->pData;
-    double value, *pValue, *pThresh, centroidTotal;
-    size_t ix, iy;
 
-    if (pArray->ndims > 2) return(asynError);
-    
-    getDoubleParam (NDPluginStatsCentroidThreshold,  &this->centroidThreshold);
     this->unlock();
-    this->centroidX = 0;
-    this->centroidY = 0;
-    this->sigmaX = 0;
-    this->sigmaY = 0;
-    this->sigmaXY = 0;
-    memset(this->profileX[profAverage], 0, this->profileSizeX*sizeof(double));  
-    memset(this->profileY[profAverage], 0, this->profileSizeY*sizeof(double));
-    memset(this->profileX[profThreshold], 0, this->profileSizeX*sizeof(double));  
-    memset(this->profileY[profThreshold], 0, this->profileSizeY*sizeof(double));
+    this->pStripeWorkers->run(numStripes, computeStripeC, this);
 
-    for (iy=0; iy<this->profileSizeY; iy++) {
+    if (flags & NDStatsComputeStatistics) {
+        NDStatsStripe *pStripe = &this->stripes[0];
+        pStats->nElements = arrayInfo.nElements;
+        pStats->min = pStripe->min;
+        pStats->max = pStripe->max;
+        i = pStripe->minIndex;
+        row = pStripe->maxIndex;
+        pStats->total = 0.;
+        pStats->sigma = 0.;
+        for (stripe=0; stripe<numStripes; stripe++) {
+            pStripe = &this->stripes[stripe];
+            if (pStripe->min < pStats->min) {
+                pStats->min = pStripe->min;
+                i = pStripe->minIndex;
+            }
+            if (pStripe->max > pStats->max) {
+                pStats->max = pStripe->max;
+                row = pStripe->maxIndex;
+            }
+            pStats->total += pStripe->total;
+            pStats->sigma += pStripe->sumSquares;
+        }
+        pStats->minX = i % arrayInfo.xSize;
+        pStats->minY = i / arrayInfo.xSize;
+        pStats->maxX = row % arrayInfo.xSize;
+        pStats->maxY = row / arrayInfo.xSize;
+        pStats->net = pStats->total;
+        pStats->mean = pStats->total / pStats->nElements;
+        pStats->sigma = sqrt((pStats->sigma / pStats->nElements) - (pStats->mean * pStats->mean));
+    }
+
+    if (flags & NDStatsComputeCentroid) {
+        double *pValue, *pThresh, centroidTotal;
+        size_t ix, iy;
+
+        this->sigmaXY = 0;
+        for (stripe=0; stripe<numStripes; stripe++) this->sigmaXY += this->stripes[stripe].sigmaXY;
+        pValue  = this->profileX[profAverage];
+        pThresh = this->profileX[profThreshold];
         for (ix=0; ix<this->profileSizeX; ix++) {
-            value = (double)*pData++;
-            this->profileX[profAverage][ix] += value;
-            this->profileY[profAverage][iy] += value;
-            if (value >= this->centroidThreshold) {
-                this->profileX[profThreshold][ix] += value;
-                this->profileY[profThreshold][iy] += value;
-                this->sigmaXY += value * ix * iy;
+            pValue[ix]  = this->stripes[0].profileAverageX[ix];
+            pThresh[ix] = this->stripes[0].profileThresholdX[ix];
+        }
+        for (stripe=1; stripe<numStripes; stripe++) {
+            for (ix=0; ix<this->profileSizeX; ix++) {
+                pValue[ix]  += this->stripes[stripe].profileAverageX[ix];
+                pThresh[ix] += this->stripes[stripe].profileThresholdX[ix];
             }
         }
+
+        /* Normalize the average profiles and compute the centroid from them */
+        this->centroidX = 0;
+        this->sigmaX = 0;
+        centroidTotal = 0;
+        for (ix=0; ix<this->profileSizeX; ix++, pValue++, pThresh++) {
+            this->centroidX += *pThresh * ix;
+            this->sigmaX    += *pThresh * ix * ix;
+            centroidTotal   += *pThresh;
+            *pValue  /= this->profileSizeY;
+            *pThresh /= this->profileSizeY;
+        }
+        this->centroidY = 0;
+        this->sigmaY = 0;
+        pValue  = this->profileY[profAverage];
+        pThresh = this->profileY[profThreshold];
+        for (iy=0; iy<this->profileSizeY; iy++, pValue++, pThresh++) {
+            this->centroidY += *pThresh * iy;
+            this->sigmaY    += *pThresh * iy * iy;
+            *pValue  /= this->profileSizeX;
+            *pThresh /= this->profileSizeX;
+        }
+        if (centroidTotal > 0.) {
+            this->centroidX /= centroidTotal;
+            this->centroidY /= centroidTotal;
+            this->sigmaX  = sqrt((this->sigmaX  / centroidTotal) - (this->centroidX * this->centroidX));
+            this->sigmaY  = sqrt((this->sigmaY  / centroidTotal) - (this->centroidY * this->centroidY));
+            this->sigmaXY =      (this->sigmaXY / centroidTotal) - (this->centroidX * this->centroidY);
+            if ((this->sigmaX !=0) && (this->sigmaY != 0)) 
+                this->sigmaXY /= (this->sigmaX * this->sigmaY);
+        }
     }
 
-    /* Normalize the average profiles and compute the centroid from them */
-    this->centroidX = 0;
-    this->sigmaX = 0;
-    centroidTotal = 0;
-    pValue  = this->profileX[profAverage];
-    pThresh = this->profileX[profThreshold];
-    for (ix=0; ix<this->profileSizeX; ix++, pValue++, pThresh++) {
-        this->centroidX += *pThresh * ix;
-        this->sigmaX    += *pThresh * ix * ix;
-        centroidTotal   += *pThresh;
-        *pValue  /= this->profileSizeY;
-        *pThresh /= this->profileSizeY;
-    }
-    this->centroidY = 0;
-    this->sigmaY = 0;
-    pValue  = this->profileY[profAverage];
-    pThresh = this->profileY[profThreshold];
-    for (iy=0; iy<this->profileSizeY; iy++, pValue++, pThresh++) {
-        this->centroidY += *pThresh * iy;
-        this->sigmaY    += *pThresh * iy * iy;
-        *pValue  /= this->profileSizeX;
-        *pThresh /= this->profileSizeX;
-   }
-   if (centroidTotal > 0.) {
-        this->centroidX /= centroidTotal;
-        this->centroidY /= centroidTotal;
-        this->sigmaX  = sqrt((this->sigmaX  / centroidTotal) - (this->centroidX * this->centroidX));
-        this->sigmaY  = sqrt((this->sigmaY  / centroidTotal) - (this->centroidY * this->centroidY));
-        this->sigmaXY =      (this->sigmaXY / centroidTotal) - (this->centroidX * this->centroidY);
-        if ((this->sigmaX !=0) && (this->sigmaY != 0)) 
-            this->sigmaXY /= (this->sigmaX * this->sigmaY);
+    if (flags & NDStatsComputeHistogram) {
+        if (this->fusedRawCounts) {
+            switch(pArray->dataType) {
+                case NDInt8:
+                    addRawCountsT<epicsInt8>(numStripes);
+                    break;
+                case NDUInt8:
+                    addRawCountsT<epicsUInt8>(numStripes);
+                    break;
+                case NDInt16:
+                    addRawCountsT<epicsInt16>(numStripes);
+                    break;
+                case NDUInt16:
+                    addRawCountsT<epicsUInt16>(numStripes);
+                    break;
+                default:
+                    break;
+            }
+        } else {
+            for (stripe=0; stripe<numStripes; stripe++) {
+                for (i=0; i<this->histogramSize; i++) this->histogram[i] += this->stripes[stripe].histogram[i];
+            }
+        }
+        entropy = 0;
+        for (i=0; i<this->histogramSize; i++) {
+            counts = this->histogram[i];
+            if (counts <= 0) counts = 1;
+            entropy += counts * log(counts);
+        }
+        entropy = -entropy / arrayInfo.nElements;
+        this->histEntropy = entropy;
     }
     this->lock();
-    return(asynSuccess);
+    return(status);
 }
 
-asynStatus NDPluginStats::doComputeCentroid(NDArray *pArray)
+asynStatus NDPluginStats::doComputeHistogram(NDArray *pArray)
 {
-    asynStatus status;
+    return doComputeFused(pArray, NDStatsComputeHistogram, NULL);
+}
 
-    switch(pArray->dataType) {
-        case NDInt8:
-            status = doComputeCentroidT<epicsInt8>(pArray);
-            break;
-        case NDUInt8:
-            status = doComputeCentroidT<epicsUInt8>(pArray);
-            break;
-        case NDInt16:
-            status = doComputeCentroidT<epicsInt16>(pArray);
-            break;
-        case NDUInt16:
-            status = doComputeCentroidT<epicsUInt16>(pArray);
-            break;
-        case NDInt32:
-            status = doComputeCentroidT<epicsInt32>(pArray);
-            break;
-        case NDUInt32:
-            status = doComputeCentroidT<epicsUInt32>(pArray);
-            break;
-        case NDFloat32:
-            status = doComputeCentroidT<epicsFloat32>(pArray);
-            break;
-        case NDFloat64:
-            status = doComputeCentroidT<epicsFloat64>(pArray);
-            break;
-        default:
-            status = asynError;
-        break;
-    }
-    return(status);
+int NDPluginStats::doComputeStatistics(NDArray *pArray, NDStats_t *pStats)
+{
+    if (doComputeFused(pArray, NDStatsComputeStatistics, pStats)) return(ND_ERROR);
+    return(ND_SUCCESS);
+}
+
+asynStatus NDPluginStats::doComputeCentroid(NDArray *pArray)
+{
+    return doComputeFused(pArray, NDStatsComputeCentroid, NULL);
 }
 
 template <typename epicsType>
@@ -422,6 +582,7 @@ void NDPluginStats::processCallbacks(NDArray *pArray)
     double bgdCounts, avgBgd;
     NDArray *pBgdArray=NULL;
     int computeStatistics, computeCentroid, computeProfiles, computeHistogram;
+    int computeFlags=0;
     size_t sizeX=0, sizeY=0;
     int i;
     int itemp;
@@ -459,9 +620,19 @@ void NDPluginStats::processCallbacks(NDArray *pArray)
         }
     }
 
+    /* The statistics, centroid and histogram are computed together in one sweep through the array */
+    if (computeStatistics) computeFlags |= NDStatsComputeStatistics;
+    if (computeCentroid)   computeFlags |= NDStatsComputeCentroid;
+    if (computeHistogram) {
+        computeFlags |= NDStatsComputeHistogram;
+        getIntegerParam(NDPluginStatsHistSize, &itemp); this->histSizeNew = itemp;
+        getDoubleParam (NDPluginStatsHistMin,  &this->histMin);
+        getDoubleParam (NDPluginStatsHistMax,  &this->histMax);
+    }
+    if (computeFlags) doComputeFused(pArray, computeFlags, pStats);
+
     if (computeStatistics) {
         getIntegerParam(NDPluginStatsBgdWidth, &bgdWidth);
-        doComputeStatistics(pArray, pStats);
         /* If there is a non-zero background width then compute the background counts */
         // Note that the following algorithm is general in N-dimensions but does have a slight inaccuracy.
         // It computes the background region such that the pixels at the corners are counted twice.
@@ -527,7 +698,6 @@ void NDPluginStats::processCallbacks(NDArray *pArray)
     }
 
     if (computeCentroid) {
-        doComputeCentroid(pArray);
         setDoubleParam(NDPluginStatsCentroidX,   this->centroidX);
         setDoubleParam(NDPluginStatsCentroidY,   this->centroidY);
         setDoubleParam(NDPluginStatsSigmaX,      this->sigmaX);
@@ -540,10 +710,6 @@ void NDPluginStats::processCallbacks(NDArray *pArray)
     }
     
     if (computeHistogram) {
-        getIntegerParam(NDPluginStatsHistSize, &itemp); this->histSizeNew = itemp;
-        getDoubleParam (NDPluginStatsHistMin,  &this->histMin);
-        getDoubleParam (NDPluginStatsHistMax,  &this->histMax);
-        doComputeHistogram(pArray);
         setDoubleParam(NDPluginStatsHistEntropy, this->histEntropy);
         doCallbacksFloat64Array(this->histogram, this->histogramSize, NDPluginStatsHistArray, 0);
     }
@@ -825,6 +991,8 @@ NDPluginStats::NDPluginStats(const char *portName, int queueSize, int blockingCa
     createParam(NDPluginStatsHistEntropyString,       asynParamFloat64,       &NDPluginStatsHistEntropy);
     createParam(NDPluginStatsHistArrayString,         asynParamFloat64Array,  &NDPluginStatsHistArray);
 
+    createParam(NDPluginStatsComputeThreadsString,    asynParamInt32,         &NDPluginStatsComputeThreads);
+
     memset(this->profileX, 0, sizeof(this->profileX));
     memset(this->profileY, 0, sizeof(this->profileY));
     // If we uncomment the following line then we can't set numTSPoints from database at initialisation
@@ -834,7 +1002,14 @@ NDPluginStats::NDPluginStats(const char *portName, int queueSize, int blockingCa
     for (i=0; i<MAX_TIME_SERIES_TYPES; i++) {
         timeSeries[i] = (double *)calloc(numTSPoints, sizeof(double));
     }
+    this->profileSizeX = 0;
+    this->profileSizeY = 0;
     this->histogram = NULL;
+    this->histogramSize = 0;
+    this->stripes = NULL;
+    this->numStripesAlloc = 0;
+    this->pStripeWorkers = new NDStripeWorkers(portName);
+    setIntegerParam(NDPluginStatsComputeThreads, 1);
 
     /* Set the plugin type string */
     setStringParam(NDPluginDriverPluginType, "NDPluginStats");
@@ -843,6 +1018,22 @@ NDPluginStats::NDPluginStats(const char *portName, int queueSize, int blockingCa
     connectToArrayPort();
 }
 
+NDPluginStats::~NDPluginStats()
+{
+    int i;
+
+    delete this->pStripeWorkers;
+    delete [] this->stripes;
+    for (i=0; i<MAX_PROFILE_TYPES; i++) {
+        free(this->profileX[i]);
+        free(this->profileY[i]);
+    }
+    for (i=0; i<MAX_TIME_SERIES_TYPES; i++) {
+        free(this->timeSeries[i]);
+    }
+    free(this->histogram);
+}
+
 /** Configuration command */
 extern "C" int NDStatsConfigure(const char *portName, int queueSize, int blockingCallbacks,
                                  const char *NDArrayPort, int NDArrayAddr,
@@ -4,6 +4,7 @@
 #include <epicsTypes.h>
 
 #include "NDPluginDriver.h"
+#include "NDStripeWorkers.h"
 
 typedef struct NDStats {
     size_t  nElements;
@@ -47,6 +48,13 @@ typedef enum {
 } NDStatTSType;
 #define MAX_TIME_SERIES_TYPES TSTimestamp+1
 
+/** Computations done by NDPluginStats::doComputeFused */
+#define NDStatsComputeStatistics 0x01
+#define NDStatsComputeCentroid   0x02
+#define NDStatsComputeHistogram  0x04
+
+struct NDStatsStripe;
+
 typedef enum {
     TSEraseStart,
     TSStart,
@@ -127,6 +135,8 @@ typedef enum {
 /* Arrays of total and net counts for MCA or waveform record */   
 #define NDPluginStatsCallbackPeriodString     "CALLBACK_PERIOD"     /* (asynFloat64,      r/w) Callback period */
 
+#define NDPluginStatsComputeThreadsString     "COMPUTE_THREADS"     /* (asynInt32,        r/w) Number of threads computing each array */
+
 /** Does image statistics.  These include
   * Min, max, mean, sigma
   * X and Y centroid and sigma
@@ -138,19 +148,19 @@ public:
                  const char *NDArrayPort, int NDArrayAddr,
                  int maxBuffers, size_t maxMemory,
                  int priority, int stackSize);
+    ~NDPluginStats();
     /* These methods override the virtual methods in the base class */
     void processCallbacks(NDArray *pArray);
     asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
     asynStatus writeFloat64(asynUser *pasynUser, epicsFloat64 value);
     
-    template <typename epicsType> void doComputeStatisticsT(NDArray *pArray, NDStats_t *pStats);
+    asynStatus doComputeFused(NDArray *pArray, int flags, NDStats_t *pStats);
     int doComputeStatistics(NDArray *pArray, NDStats_t *pStats);
-    template <typename epicsType> asynStatus doComputeCentroidT(NDArray *pArray);
     asynStatus doComputeCentroid(NDArray *pArray);
     template <typename epicsType> asynStatus doComputeProfilesT(NDArray *pArray);
     asynStatus doComputeProfiles(NDArray *pArray);
-    template <typename epicsType> asynStatus doComputeHistogramT(NDArray *pArray);
     asynStatus doComputeHistogram(NDArray *pArray);
+    void computeStripe(int stripe);
    
 protected:
     int NDPluginStatsComputeStatistics;
@@ -222,7 +232,9 @@ protected:
     int NDPluginStatsHistEntropy;
     int NDPluginStatsHistArray;
 
-    #define LAST_NDPLUGIN_STATS_PARAM NDPluginStatsHistArray
+    int NDPluginStatsComputeThreads;
+
+    #define LAST_NDPLUGIN_STATS_PARAM NDPluginStatsComputeThreads
                                 
 private:
     double  centroidThreshold;
@@ -246,6 +258,15 @@ private:
     double histMin;
     double histMax;
     double histEntropy;
+    NDStripeWorkers *pStripeWorkers;
+    NDStatsStripe *stripes;     /**< Partial results of each stripe of the array in doComputeFused */
+    int numStripesAlloc;
+    NDArray *pFusedArray;       /**< The array being computed by doComputeFused */
+    int fusedFlags;
+    size_t fusedRowLength;
+    bool fusedRawCounts;        /**< The histogram is built from counts of each raw value */
+    template <typename epicsType> void computeStripeT(NDStatsStripe *pStripe);
+    template <typename epicsType> void addRawCountsT(int numStripes);
     void doTimeSeriesCallbacks();
 };
 #define NUM_NDPLUGIN_STATS_PARAMS ((int)(&LAST_NDPLUGIN_STATS_PARAM - &FIRST_NDPLUGIN_STATS_PARAM + 1))
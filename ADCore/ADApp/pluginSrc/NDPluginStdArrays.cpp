@@ -18,6 +18,7 @@
 #include <epicsTimer.h>
 #include <epicsMutex.h>
 #include <epicsEvent.h>
+#include <epicsTime.h>
 #include <epicsMessageQueue.h>
 #include <cantProceed.h>
 #include <iocsh.h>
@@ -26,13 +27,121 @@
 
 #include <epicsExport.h>
 #include "NDPluginDriver.h"
+#include "NDArrayRegion.h"
 #include "NDPluginStdArrays.h"
 
+#define MIN(A,B) (A)<(B)?(A):(B)
+
 static const char *driverName="NDPluginStdArrays";
 
+/** Returns true if data of type dataType can be passed to clients of type signedType without conversion.
+  * That is the case when the types are the same, and for integer types that only differ in their sign,
+  * because converting those does not change the bits. */
+static bool sameRepresentation(NDDataType_t dataType, NDDataType_t signedType)
+{
+    if (dataType == signedType) return true;
+    switch (signedType) {
+        case NDInt8:  return dataType == NDUInt8;
+        case NDInt16: return dataType == NDUInt16;
+        case NDInt32: return dataType == NDUInt32;
+        default:      return false;
+    }
+}
+
+/** Computes the region of an array to send so that it has no more than maxElements elements.
+  * The same binning is used for every dimension except the color dimension of RGB arrays, so that a
+  * preview image keeps its aspect ratio. Dimensions that are smaller than the binning are binned to 1 element.
+  * The binning is only searched for when maxElements or the dimensions of the arrays change.
+  * It must be called with the mutex locked.
+  * \param[in] pArray The array
+  * \param[in] maxElements Maximum number of elements to send; 0 for the whole array
+  * \param[out] dims The region of pArray to pass to NDArrayPool::convert or NDArrayRegionCopy
+  * \param[out] pScale Number of array elements in each element sent, which they are averaged over
+  * \param[out] pNumElements Number of elements sent
+  * \return The binning; 1 if the whole array is sent */
+int NDPluginStdArrays::previewDimensions(NDArray *pArray, int maxElements, NDDimension_t *dims, double *pScale,
+                                         size_t *pNumElements)
+{
+    NDAttribute *pAttribute;
+    int colorMode = NDColorModeMono;
+    int colorDim = -1;
+    size_t maxSize = 1;
+    size_t binning, bin, numElements;
+    bool changed;
+    int i;
+
+    pAttribute = pArray->pAttributeList->find("ColorMode");
+    if (pAttribute) pAttribute->getValue(NDAttrInt32, &colorMode);
+    if (pArray->ndims == 3) {
+        if      (colorMode == NDColorModeRGB1) colorDim = 0;
+        else if (colorMode == NDColorModeRGB2) colorDim = 1;
+        else if (colorMode == NDColorModeRGB3) colorDim = 2;
+    }
+
+    changed = (maxElements != this->cachedMaxElements_) || (colorDim != this->cachedColorDim_) ||
+              (pArray->ndims != this->cachedNDims_);
+    for (i=0; (i<pArray->ndims) && !changed; i++) changed = (pArray->dims[i].size != this->cachedSizes_[i]);
+    if (changed) {
+        for (i=0; i<pArray->ndims; i++) {
+            if ((i != colorDim) && (pArray->dims[i].size > maxSize)) maxSize = pArray->dims[i].size;
+            this->cachedSizes_[i] = pArray->dims[i].size;
+        }
+        for (binning=1; ; binning++) {
+            numElements = 1;
+            for (i=0; i<pArray->ndims; i++) {
+                bin = (i == colorDim) ? 1 : MIN(binning, pArray->dims[i].size);
+                numElements *= pArray->dims[i].size / bin;
+            }
+            if ((maxElements <= 0) || (numElements <= (size_t)maxElements) || (binning >= maxSize)) break;
+        }
+        this->cachedMaxElements_ = maxElements;
+        this->cachedColorDim_ = colorDim;
+        this->cachedNDims_ = pArray->ndims;
+        this->cachedBinning_ = binning;
+    }
+    binning = this->cachedBinning_;
+
+    *pScale = 1.;
+    *pNumElements = 1;
+    for (i=0; i<pArray->ndims; i++) {
+        bin = (i == colorDim) ? 1 : MIN(binning, pArray->dims[i].size);
+        dims[i].size    = (pArray->dims[i].size / bin) * bin;
+        dims[i].offset  = 0;
+        dims[i].binning = (int)bin;
+        dims[i].reverse = 0;
+        *pScale *= bin;
+        *pNumElements *= pArray->dims[i].size / bin;
+    }
+    return (int)binning;
+}
+
+/** Returns true if a client is registered for the array data on one of the asynXXXArray interfaces */
+template <typename interruptType>
+bool NDPluginStdArrays::hasClients(void *interruptPvt)
+{
+    ELLLIST *pclientList;
+    interruptNode *pnode;
+    bool found = false;
+
+    pasynManager->interruptStart(interruptPvt, &pclientList);
+    for (pnode = (interruptNode *)ellFirst(pclientList); pnode && !found; pnode = (interruptNode *)ellNext(&pnode->node)) {
+        interruptType *pInterrupt = (interruptType *)pnode->drvPvt;
+        if (pInterrupt->pasynUser->reason == NDPluginStdArraysData) found = true;
+    }
+    pasynManager->interruptEnd(interruptPvt);
+    return found;
+}
+
+/** Passes the array to the clients on one of the asynXXXArray interfaces, converting it to the type
+  * of that interface and binning it to the preview region if necessary.
+  * \param[in] pDims The region of the array to send, from previewDimensions
+  * \param[in] scale Number of elements averaged into each element sent
+  * \param[in] binning The binning of the region; 1 if it is the whole array
+  * \return The number of elements passed to the clients, 0 if there were no clients */
 template <typename epicsType, typename interruptType>
-void NDPluginStdArrays::arrayInterruptCallback(NDArray *pArray, NDArrayPool *pNDArrayPool, 
-                            void *interruptPvt, int *initialized, NDDataType_t signedType)
+size_t NDPluginStdArrays::arrayInterruptCallback(NDArray *pArray, NDArrayPool *pNDArrayPool, 
+                            void *interruptPvt, int *initialized, NDDataType_t signedType,
+                            NDDimension_t *pDims, double scale, int binning)
 {
     ELLLIST *pclientList;
     interruptNode *pnode;
@@ -41,6 +150,7 @@ void NDPluginStdArrays::arrayInterruptCallback(NDArray *pArray, NDArrayPool *pND
     NDArray *pOutput=NULL;
     NDArrayInfo_t arrayInfo;
 
+    arrayInfo.nElements = 0;
     pasynManager->interruptStart(interruptPvt, &pclientList);
     pnode = (interruptNode *)ellFirst(pclientList);
     while (pnode) {
@@ -49,14 +159,22 @@ void NDPluginStdArrays::arrayInterruptCallback(NDArray *pArray, NDArrayPool *pND
             if (!*initialized) {
                 *initialized = 1;
                 pArray->getInfo(&arrayInfo);
-                status = pNDArrayPool->convert(pArray, &pOutput, signedType);
-                if (status) {
-                    asynPrint(pInterrupt->pasynUser, ASYN_TRACE_ERROR,
-                              "%s::arrayInterruptCallback: error allocating array in convert()\n",
-                               driverName);
-                    break;
+                if ((binning == 1) && sameRepresentation(pArray->dataType, signedType)) {
+                    /* The clients get the data of the array itself, which does not change while we hold it */
+                    pData = (epicsType *)pArray->pData;
+                } else {
+                    /* The binning and the type conversion are done in a single pass over the array */
+                    status = pNDArrayPool->convert(pArray, &pOutput, signedType, pDims, scale);
+                    if (status) {
+                        asynPrint(pInterrupt->pasynUser, ASYN_TRACE_ERROR,
+                                  "%s::arrayInterruptCallback: error allocating array in convert()\n",
+                                   driverName);
+                        arrayInfo.nElements = 0;
+                        break;
+                    }
+                    pOutput->getInfo(&arrayInfo);
+                    pData = (epicsType *)pOutput->pData;
                 }
-                pData = (epicsType *)pOutput->pData;
             }
             pInterrupt->pasynUser->timestamp = pArray->epicsTS;
             pInterrupt->callback(pInterrupt->userPvt,
@@ -67,6 +185,7 @@ void NDPluginStdArrays::arrayInterruptCallback(NDArray *pArray, NDArrayPool *pND
     }
     pasynManager->interruptEnd(interruptPvt);
     if (pOutput) pOutput->release();
+    return arrayInfo.nElements;
 }
 
 template <typename epicsType> 
@@ -75,7 +194,11 @@ asynStatus NDPluginStdArrays::readArray(asynUser *pasynUser, epicsType *value, s
     int command = pasynUser->reason;
     asynStatus status = asynSuccess;
     NDArray *pOutput, *myArray;
-    NDArrayInfo_t arrayInfo;
+    NDDimension_t dims[ND_ARRAY_MAX_DIMS];
+    int preview, previewSize=0;
+    int binning;
+    double scale;
+    size_t numElements;
 
     myArray = this->pArrays[0];
     if (command == NDPluginStdArraysData) {
@@ -85,23 +208,35 @@ asynStatus NDPluginStdArrays::readArray(asynUser *pasynUser, epicsType *value, s
             status = asynError;
             goto done;
         }
-        myArray->getInfo(&arrayInfo);
-        if (arrayInfo.nElements > nElements) {
+        getIntegerParam(NDPluginStdArraysPreview, &preview);
+        if (preview) getIntegerParam(NDPluginStdArraysPreviewSize, &previewSize);
+        binning = previewDimensions(myArray, previewSize, dims, &scale, &numElements);
+        *nIn = numElements;
+        if (numElements > nElements) {
             /* We have been requested fewer pixels than we have.
              * Just pass the first nElements. */
-             arrayInfo.nElements = nElements;
+             *nIn = nElements;
         }
-        status = (asynStatus)this->pNDArrayPool->convert(myArray, &pOutput, outputType);
-        if (status) {
-            asynPrint(pasynUser, ASYN_TRACE_ERROR,
-                      "%s::readArray: error allocating array in convert()\n",
-                       driverName);
-           goto done;
+        if ((binning == 1) && sameRepresentation(myArray->dataType, outputType)) {
+            memcpy(value, myArray->pData, *nIn*sizeof(epicsType));
+        } else if (*nIn == numElements) {
+            /* The whole array or preview fits, so convert it straight into the client's buffer.
+             * NDArrayRegionCopy takes the output size of each dimension rather than the input size that
+             * convert() takes, so divide by the binning as convert() does */
+            for (int i=0; i<myArray->ndims; i++) dims[i].size /= dims[i].binning;
+            NDArrayRegionCopy(myArray, dims, outputType, value, scale);
+        } else {
+            status = (asynStatus)this->pNDArrayPool->convert(myArray, &pOutput, outputType, dims, scale);
+            if (status) {
+                asynPrint(pasynUser, ASYN_TRACE_ERROR,
+                          "%s::readArray: error allocating array in convert()\n",
+                           driverName);
+               goto done;
+            }
+            /* Copy the data */
+            memcpy(value, pOutput->pData, *nIn*sizeof(epicsType));
+            pOutput->release();
         }
-        /* Copy the data */
-        *nIn = arrayInfo.nElements;
-        memcpy(value, pOutput->pData, *nIn*sizeof(epicsType));
-        pOutput->release();
         /* Set the timestamp */
         pasynUser->timestamp = myArray->epicsTS;
     } else {
@@ -116,10 +251,20 @@ asynStatus NDPluginStdArrays::readArray(asynUser *pasynUser, epicsType *value, s
 
 
 
+/** Returns the dimensions of the arrays that are sent to the clients, which are those of the preview
+  * in preview mode.
+  * \param[in] pArray  The NDArray from the callback.
+  * \param[out] dims The size of each dimension. */
+void NDPluginStdArrays::getDimensions(NDArray *pArray, size_t *dims)
+{
+    for (int i=0; i<pArray->ndims; i++) dims[i] = this->previewDims_[i].size / this->previewDims_[i].binning;
+}
+
 /** Callback function that is called by the NDArray driver with new NDArray data.
   * It does callbacks with the array data to any registered asyn clients on any
   * of the asynXXXArray interfaces.  It converts the array data to the type required for that
-  * interface.
+  * interface. In preview mode the array is binned in the same pass, and arrays that arrive sooner than
+  * 1/PreviewRate seconds after the last one that was sent are not sent.
   * \param[in] pArray  The NDArray from the callback.
   */ 
 void NDPluginStdArrays::processCallbacks(NDArray *pArray)
@@ -134,46 +279,98 @@ void NDPluginStdArrays::processCallbacks(NDArray *pArray)
     int int32Initialized=0;
     int float32Initialized=0;
     int float64Initialized=0;
+    int preview, previewSize=0;
+    double previewRate, elapsed;
+    size_t numElements, numSent;
+    size_t clientBytes=0, savedBytes=0;
+    NDDimension_t dims[ND_ARRAY_MAX_DIMS];
+    double scale;
+    int binning;
+    epicsTimeStamp now;
     NDArrayInfo_t arrayInfo;
     asynStandardInterfaces *pInterfaces = this->getAsynStdInterfaces();
     /* static const char* functionName = "processCallbacks"; */
 
+    getIntegerParam(NDPluginStdArraysPreview, &preview);
+    if (preview) getIntegerParam(NDPluginStdArraysPreviewSize, &previewSize);
+    getDoubleParam(NDPluginStdArraysPreviewRate, &previewRate);
+    this->previewBinning_ = previewDimensions(pArray, previewSize, this->previewDims_, &this->previewScale_, &numElements);
+    setIntegerParam(NDPluginStdArraysPreviewBinning, this->previewBinning_);
+
     /* Call the base class method */
     NDPluginDriver::processCallbacks(pArray);
     
     pArray->getInfo(&arrayInfo);
- 
-    /* This function is called with the lock taken, and it must be set when we exit.
-     * The following code can be exected without the mutex because we are not accessing pPvt */
-    this->unlock();
-
-    /* Pass interrupts for int8Array data*/
-    arrayInterruptCallback<epicsInt8, asynInt8ArrayInterrupt>(pArray, this->pNDArrayPool, 
-                             pInterfaces->int8ArrayInterruptPvt,
-                             &int8Initialized, NDInt8);
-    
-    /* Pass interrupts for int16Array data*/
-    arrayInterruptCallback<epicsInt16,  asynInt16ArrayInterrupt>(pArray, this->pNDArrayPool, 
-                             pInterfaces->int16ArrayInterruptPvt,
-                             &int16Initialized, NDInt16);
-    
-    /* Pass interrupts for int32Array data*/
-    arrayInterruptCallback<epicsInt32, asynInt32ArrayInterrupt>(pArray, this->pNDArrayPool, 
-                             pInterfaces->int32ArrayInterruptPvt,
-                             &int32Initialized, NDInt32);
-    
-    /* Pass interrupts for float32Array data*/
-    arrayInterruptCallback<epicsFloat32, asynFloat32ArrayInterrupt>(pArray, this->pNDArrayPool, 
-                             pInterfaces->float32ArrayInterruptPvt,
-                             &float32Initialized, NDFloat32);
-    
-    /* Pass interrupts for float64Array data*/
-    arrayInterruptCallback<epicsFloat64, asynFloat64ArrayInterrupt>(pArray, this->pNDArrayPool, 
-                             pInterfaces->float64ArrayInterruptPvt,
-                             &float64Initialized, NDFloat64);
 
-    /* We must exit with the mutex locked */
-    this->lock();
+    /* Bytes per element of all of the interfaces that have clients. Arrays are only converted if there are any. */
+    if (hasClients<asynInt8ArrayInterrupt>   (pInterfaces->int8ArrayInterruptPvt))    clientBytes += sizeof(epicsInt8);
+    if (hasClients<asynInt16ArrayInterrupt>  (pInterfaces->int16ArrayInterruptPvt))   clientBytes += sizeof(epicsInt16);
+    if (hasClients<asynInt32ArrayInterrupt>  (pInterfaces->int32ArrayInterruptPvt))   clientBytes += sizeof(epicsInt32);
+    if (hasClients<asynFloat32ArrayInterrupt>(pInterfaces->float32ArrayInterruptPvt)) clientBytes += sizeof(epicsFloat32);
+    if (hasClients<asynFloat64ArrayInterrupt>(pInterfaces->float64ArrayInterruptPvt)) clientBytes += sizeof(epicsFloat64);
+
+    epicsTimeGetCurrent(&now);
+    if (clientBytes == 0) {
+        /* Nothing to do */
+    } else if (preview && (previewRate > 0.) && (epicsTimeDiffInSeconds(&now, &this->lastPreviewTime_) < 1./previewRate)) {
+        /* Too soon after the last preview, so none of the array is sent */
+        savedBytes = arrayInfo.nElements * clientBytes;
+    } else {
+        if (preview) this->lastPreviewTime_ = now;
+        binning = this->previewBinning_;
+        scale = this->previewScale_;
+        memcpy(dims, this->previewDims_, sizeof(dims));
+        /* This function is called with the lock taken, and it must be set when we exit.
+         * The following code can be exected without the mutex because we are not accessing pPvt */
+        this->unlock();
+
+        /* Pass interrupts for int8Array data*/
+        numSent = arrayInterruptCallback<epicsInt8, asynInt8ArrayInterrupt>(pArray, this->pNDArrayPool, 
+                                 pInterfaces->int8ArrayInterruptPvt,
+                                 &int8Initialized, NDInt8,
+                                 dims, scale, binning);
+        if (numSent) savedBytes += (arrayInfo.nElements - numSent) * sizeof(epicsInt8);
+        
+        /* Pass interrupts for int16Array data*/
+        numSent = arrayInterruptCallback<epicsInt16,  asynInt16ArrayInterrupt>(pArray, this->pNDArrayPool, 
+                                 pInterfaces->int16ArrayInterruptPvt,
+                                 &int16Initialized, NDInt16,
+                                 dims, scale, binning);
+        if (numSent) savedBytes += (arrayInfo.nElements - numSent) * sizeof(epicsInt16);
+        
+        /* Pass interrupts for int32Array data*/
+        numSent = arrayInterruptCallback<epicsInt32, asynInt32ArrayInterrupt>(pArray, this->pNDArrayPool, 
+                                 pInterfaces->int32ArrayInterruptPvt,
+                                 &int32Initialized, NDInt32,
+                                 dims, scale, binning);
+        if (numSent) savedBytes += (arrayInfo.nElements - numSent) * sizeof(epicsInt32);
+        
+        /* Pass interrupts for float32Array data*/
+        numSent = arrayInterruptCallback<epicsFloat32, asynFloat32ArrayInterrupt>(pArray, this->pNDArrayPool, 
+                                 pInterfaces->float32ArrayInterruptPvt,
+                                 &float32Initialized, NDFloat32,
+                                 dims, scale, binning);
+        if (numSent) savedBytes += (arrayInfo.nElements - numSent) * sizeof(epicsFloat32);
+        
+        /* Pass interrupts for float64Array data*/
+        numSent = arrayInterruptCallback<epicsFloat64, asynFloat64ArrayInterrupt>(pArray, this->pNDArrayPool, 
+                                 pInterfaces->float64ArrayInterruptPvt,
+                                 &float64Initialized, NDFloat64,
+                                 dims, scale, binning);
+        if (numSent) savedBytes += (arrayInfo.nElements - numSent) * sizeof(epicsFloat64);
+
+        /* We must exit with the mutex locked */
+        this->lock();
+    }
+
+    /* The bytes saved are averaged over at least 1 second */
+    this->bytesSaved_ += savedBytes;
+    elapsed = epicsTimeDiffInSeconds(&now, &this->bytesSavedTime_);
+    if (elapsed >= 1.) {
+        setDoubleParam(NDPluginStdArraysBytesSaved, this->bytesSaved_ / elapsed);
+        this->bytesSaved_ = 0.;
+        this->bytesSavedTime_ = now;
+    }
     /* We always keep the last array so read() can use it.  
      * Release previous one, reserve new one */
     if (this->pArrays[0]) this->pArrays[0]->release();
@@ -287,7 +484,28 @@ NDPluginStdArrays::NDPluginStdArrays(const char *portName, int queueSize, int bl
 {
     //static const char *functionName = "NDPluginStdArrays";
     
-    createParam(NDPluginStdArraysDataString, asynParamGenericPointer, &NDPluginStdArraysData);
+    createParam(NDPluginStdArraysDataString,           asynParamGenericPointer, &NDPluginStdArraysData);
+    createParam(NDPluginStdArraysPreviewString,        asynParamInt32,          &NDPluginStdArraysPreview);
+    createParam(NDPluginStdArraysPreviewSizeString,    asynParamInt32,          &NDPluginStdArraysPreviewSize);
+    createParam(NDPluginStdArraysPreviewRateString,    asynParamFloat64,        &NDPluginStdArraysPreviewRate);
+    createParam(NDPluginStdArraysPreviewBinningString, asynParamInt32,          &NDPluginStdArraysPreviewBinning);
+    createParam(NDPluginStdArraysBytesSavedString,     asynParamFloat64,        &NDPluginStdArraysBytesSaved);
+
+    setIntegerParam(NDPluginStdArraysPreview,        0);
+    setIntegerParam(NDPluginStdArraysPreviewSize,    1048576);
+    setDoubleParam (NDPluginStdArraysPreviewRate,    10.);
+    setIntegerParam(NDPluginStdArraysPreviewBinning, 1);
+    setDoubleParam (NDPluginStdArraysBytesSaved,     0.);
+    this->previewBinning_ = 1;
+    this->cachedMaxElements_ = -1;
+    this->cachedColorDim_ = -1;
+    this->cachedNDims_ = 0;
+    this->cachedBinning_ = 1;
+    this->previewScale_ = 1.;
+    memset(this->previewDims_, 0, sizeof(this->previewDims_));
+    this->bytesSaved_ = 0.;
+    epicsTimeGetCurrent(&this->bytesSavedTime_);
+    this->lastPreviewTime_ = this->bytesSavedTime_;
 
     /* Set the plugin type string */    
     setStringParam(NDPluginDriverPluginType, "NDPluginStdArrays");
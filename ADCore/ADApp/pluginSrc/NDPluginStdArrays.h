@@ -2,15 +2,24 @@
 #define NDPluginStdArrays_H
 
 #include <epicsTypes.h>
+#include <epicsTime.h>
 
 #include "NDPluginDriver.h"
 
-#define NDPluginStdArraysDataString "STD_ARRAY_DATA"           /* (asynXXXArray, r/w) Array data waveform */
+#define NDPluginStdArraysDataString           "STD_ARRAY_DATA"            /* (asynXXXArray, r/w) Array data waveform */
+#define NDPluginStdArraysPreviewString        "STD_ARRAY_PREVIEW"         /* (asynInt32,    r/w) Send a binned preview instead of the whole array */
+#define NDPluginStdArraysPreviewSizeString    "STD_ARRAY_PREVIEW_SIZE"    /* (asynInt32,    r/w) Maximum number of elements in the preview */
+#define NDPluginStdArraysPreviewRateString    "STD_ARRAY_PREVIEW_RATE"    /* (asynFloat64,  r/w) Maximum number of previews per second, 0=no limit */
+#define NDPluginStdArraysPreviewBinningString "STD_ARRAY_PREVIEW_BINNING" /* (asynInt32,    r/o) Binning of the preview */
+#define NDPluginStdArraysBytesSavedString     "STD_ARRAY_BYTES_SAVED"     /* (asynFloat64,  r/o) Bytes per second the preview did not convert and send */
 
 /** Converts NDArray callback data into standard asyn arrays (asynInt8Array, asynInt16Array, asynInt32Array,
   * asynFloat32Array or asynFloat64Array); normally used for putting NDArray data in EPICS waveform records.
   * It handles the data type conversion if the NDArray data type differs from the data type of the asyn interface.
-  * It flattens the NDArrays to a single dimension because asyn and EPICS do not support multi-dimensional arrays. */
+  * It flattens the NDArrays to a single dimension because asyn and EPICS do not support multi-dimensional arrays.
+  * In preview mode it instead sends a copy of each array that is binned down to no more than PreviewSize
+  * elements, at no more than PreviewRate arrays per second, and reports the bytes per second this saves.
+  * Arrays are only converted when there are clients for them. */
 class epicsShareClass NDPluginStdArrays : public NDPluginDriver {
 public:
     NDPluginStdArrays(const char *portName, int queueSize, int blockingCallbacks, 
@@ -30,17 +39,39 @@ public:
     virtual asynStatus readFloat64Array(asynUser *pasynUser, epicsFloat64 *value,
                                         size_t nElements, size_t *nIn);
 protected:
+    void getDimensions(NDArray *pArray, size_t *dims);
     int NDPluginStdArraysData;
     #define FIRST_NDPLUGIN_STDARRAYS_PARAM NDPluginStdArraysData
-    #define LAST_NDPLUGIN_STDARRAYS_PARAM NDPluginStdArraysData
+    int NDPluginStdArraysPreview;
+    int NDPluginStdArraysPreviewSize;
+    int NDPluginStdArraysPreviewRate;
+    int NDPluginStdArraysPreviewBinning;
+    int NDPluginStdArraysBytesSaved;
+    #define LAST_NDPLUGIN_STDARRAYS_PARAM NDPluginStdArraysBytesSaved
 private:
     /* These methods are just for this class */
     template <typename epicsType> asynStatus readArray(asynUser *pasynUser, epicsType *value, 
                                         size_t nElements, size_t *nIn, NDDataType_t outputType);
-    template <typename epicsType, typename interruptType> void arrayInterruptCallback(NDArray *pArray, 
+    template <typename epicsType, typename interruptType> size_t arrayInterruptCallback(NDArray *pArray, 
                             NDArrayPool *pNDArrayPool, 
-                            void *interruptPvt, int *initialized, NDDataType_t signedType);
-                                        
+                            void *interruptPvt, int *initialized, NDDataType_t signedType,
+                            NDDimension_t *pDims, double scale, int binning);
+    template <typename interruptType> bool hasClients(void *interruptPvt);
+    int previewDimensions(NDArray *pArray, int maxElements, NDDimension_t *dims, double *pScale,
+                          size_t *pNumElements);
+
+    int previewBinning_;                            /**< Binning of the array being processed, 1 for the whole array */
+    NDDimension_t previewDims_[ND_ARRAY_MAX_DIMS];  /**< Region of the array being processed that is sent */
+    double previewScale_;                           /**< Number of elements averaged into each element sent */
+    epicsTimeStamp lastPreviewTime_;
+    epicsTimeStamp bytesSavedTime_;                 /**< Start of the period bytesSaved_ is counted over */
+    double bytesSaved_;
+    /* The binning that previewDimensions found, and the preview size and array dimensions it is for */
+    int cachedMaxElements_;
+    int cachedColorDim_;
+    int cachedNDims_;
+    size_t cachedSizes_[ND_ARRAY_MAX_DIMS];
+    size_t cachedBinning_;
 };
 
 #define NUM_NDPLUGIN_STDARRAYS_PARAMS ((int)(&LAST_NDPLUGIN_STDARRAYS_PARAM - &FIRST_NDPLUGIN_STDARRAYS_PARAM + 1))
@@ -1,666 +1,491 @@
-/*
- * NDPluginTransform.cpp
- *
- * Transform plugin
- * Author: John Hammonds, Chris Roehrig, Mark Rivers
- *
- * Created Oct. 28, 2009
- *
- * Change Log:
- *
- * 27 April 2014 
- */
-
-#include <stdlib.h>
-#include <string.h>
-#include <stdio.h>
-#include <math.h>
-
-#include <epicsString.h>
-#include <epicsMutex.h>
-#include <iocsh.h>
-
-#include <asynDriver.h>
-
-#include <epicsExport.h>
-#include "NDPluginDriver.h"
-#include "NDPluginTransform.h"
-
-/* Enums to describe the types of transformations */
-typedef enum {
-  TransformNone,
-  TransformRotate90,
-  TransformRotate180,
-  TransformRotate270,
-  TransformMirror,
-  TransformRotate90Mirror,
-  TransformRotate180Mirror,
-  TransformRotate270Mirror,
-} NDPluginTransformType_t;
-
-/** Perform the move of the pixels to the new orientation. */
-template <typename epicsType>
-void transformNDArray(NDArray *inArray, NDArray *outArray, int transformType, int colorMode, NDArrayInfo_t *arrayInfo)
-{
-  epicsType *inData = (epicsType *)inArray->pData;
-  epicsType *outData = (epicsType *)outArray->pData;
-  int x, y, color;
-  int xSize, ySize, colorSize;
-  int xStride, yStride, colorStride;
-  int elementSize;
-
-  xSize = (int)arrayInfo->xSize;
-  ySize = (int)arrayInfo->ySize;
-  if (arrayInfo->colorSize > 0)
-    colorSize = (int)arrayInfo->colorSize;
-  else
-    colorSize = 1;
-
-  xStride = (int)arrayInfo->xStride;
-  yStride = (int)arrayInfo->yStride;
-  colorStride = (int)arrayInfo->colorStride;
-  elementSize = arrayInfo->bytesPerElement;
-
-  // Assume output array is same dimensions as input.  Handle rotation cases below.
-  outArray->dims[arrayInfo->xDim].size = inArray->dims[arrayInfo->xDim].size;
-  outArray->dims[arrayInfo->yDim].size = inArray->dims[arrayInfo->yDim].size;
-  if (inArray->ndims > 2) outArray->dims[arrayInfo->colorDim].size = inArray->dims[arrayInfo->colorDim].size;
-
-  switch (transformType)
-  {
-    case (TransformNone):
-
-      // Nothing to do, since the input array has already been copied to the output array
-      break;
-
-    case (TransformRotate90):
-
-      outArray->dims[arrayInfo->xDim].size = inArray->dims[arrayInfo->yDim].size;
-      outArray->dims[arrayInfo->yDim].size = inArray->dims[arrayInfo->xDim].size;
-
-      if (colorMode == NDColorModeMono)
-      {      
-        for (x = 0; x < xSize; x++)
-        {
-          for (y = (ySize - 1); y >= 0; y--)
-          {
-            outData[(((ySize-1) - y) * xStride) + (x * ySize)] = inData[(y * yStride) + (x * xStride)];
-          }
-        }          
-      }
-
-      if (colorMode == NDColorModeRGB3)
-      {      
-        for (x = 0; x < xSize; x++)
-        {
-          for (y = (ySize - 1); y >= 0; y--)
-          {
-            /** Copy three values for each iteration of the inner loop.  This moves the red, green, and blue information. */
-            outData[(((ySize-1) - y) * xStride) + (x * ySize)] = inData[(y * yStride) + (x * xStride)];
-            outData[(((ySize-1) - y) * xStride) + (x * ySize) + colorStride] = inData[(y * yStride) + (x * xStride) + colorStride];
-            outData[(((ySize-1) - y) * xStride) + (x * ySize) + (2 * colorStride)] = inData[(y * yStride) + (x * xStride) + (2 * colorStride)];
-          }
-        }          
-      }
-
-      if (colorMode == NDColorModeRGB2)
-      {
-        /** The values of colorStride and yStride need to change
-          because the dimensions of the image may have changed.
-        */
-        int newColorStride = ySize;
-        int newYStride = newColorStride * colorSize;
-
-        for (y = (ySize - 1); y >= 0; y--)
-        {
-          for (x = (xSize - 1); x >= 0; x--)
-          {
-            /** Copy three values for each iteration of the inner loop.  This moves the red, green, and blue information. */
-            outData[(((ySize - 1) - y) * xStride) + (x * newYStride)] = inData[(y * yStride) + (x * xStride)];
-            outData[(((ySize - 1) - y) * xStride) + (x * newYStride) + newColorStride] = inData[(y * yStride) + (x * xStride) + colorStride];
-            outData[(((ySize - 1) - y) * xStride) + (x * newYStride) + (2 * newColorStride)] = inData[(y * yStride) + (x * xStride) + (2 * colorStride)];
-          }
-        }
-      }
-
-      if (colorMode == NDColorModeRGB1)
-      {
-        int source_offset;
-        int target_offset;
-
-        /** Calculate a new value for the Y stride. */
-        int newStride = colorSize * ySize;
-
-        for (y = (ySize - 1); y >= 0; y--)
-        {
-          for (x = (xSize - 1); x >= 0; x--)
-          {
-            source_offset = (x * xStride) + (y * yStride);
-            target_offset = (((ySize - 1) - y) * xStride) + (x * (newStride));
-            outData[target_offset + 0] = inData[source_offset + 0];;
-            outData[target_offset + 1] = inData[source_offset + 1];;
-            outData[target_offset + 2] = inData[source_offset + 2];;
-          }
-        }
-      }
-
-      break;
-
-    case (TransformRotate180):
-
-      if (colorMode == NDColorModeMono)
-      {
-        for (y = (ySize - 1); y >= 0; y--)
-        {
-          for (x = (xSize - 1); x >= 0; x--)
-          {
-            outData[(((xSize - 1) - x) * xStride) + (((ySize - 1) - y) * yStride)] = inData[(y * yStride) + (x * xStride)];
-          }
-        }
-      }
-      else
-      {
-        for (y = (ySize - 1); y >= 0; y--)
-        {
-          for (x = (xSize - 1); x >= 0; x--)
-          {
-            /** Copy three values for each iteration of the inner loop.  This moves the red, green, and blue information. */
-            outData[(((xSize - 1) - x) * xStride) + (((ySize - 1) - y) * yStride)] = inData[(y * yStride) + (x * xStride)];
-            outData[(((xSize - 1) - x) * xStride) + (((ySize - 1) - y) * yStride) + colorStride] = inData[(y * yStride) + (x * xStride) + colorStride];
-            outData[(((xSize - 1) - x) * xStride) + (((ySize - 1) - y) * yStride) + (2 * colorStride)] = inData[(y * yStride) + (x * xStride) + (2 * colorStride)];
-          }
-        }
-      }  
-      break;
-
-    case (TransformRotate270):
-
-      outArray->dims[arrayInfo->xDim].size = inArray->dims[arrayInfo->yDim].size;
-      outArray->dims[arrayInfo->yDim].size = inArray->dims[arrayInfo->xDim].size;
-
-      if (colorMode == NDColorModeMono)
-      {
-        for (x = (xSize - 1); x >= 0; x--)
-        {
-          for (y = 0; y < ySize; y++)
-          {
-            outData[(y * xStride) + (((xSize - 1) - x) * ySize)] = inData[(y * yStride) + (x * xStride)];
-          }
-        }
-      }
-
-      if (colorMode == NDColorModeRGB3)
-      {
-        for (x = (xSize - 1); x >= 0; x--)
-        {
-          for (y = 0; y < ySize; y++)
-          {
-            /** Copy three values for each iteration of the inner loop.  This moves the red, green, and blue information. */
-            outData[(y * xStride) + (((xSize - 1) - x) * ySize)]           = inData[(y * yStride) + (x * xStride)];
-            outData[(y * xStride) + (((xSize - 1) - x) * ySize) + colorStride]     = inData[(y * yStride) + (x * xStride) + colorStride];
-            outData[(y * xStride) + (((xSize - 1) - x) * ySize) + (2 * colorStride)] = inData[(y * yStride) + (x * xStride) + (2 * colorStride)];
-          }
-        }
-      }
-
-      if (colorMode == NDColorModeRGB2)
-      {
-        /** The values of colorStride and yStride need to change
-          because the dimensions of the image may have changed.
-        */
-        int newColorStride = ySize;
-        int newYStride = newColorStride * colorSize;
-
-        for (y = 0; y < ySize; y++)
-        {
-          for (x = (xSize - 1); x >= 0; x--)
-          {
-            /** Copy three values for each iteration of the inner loop.  This moves the red, green, and blue information. */
-            outData[(y * xStride) + (((xSize - 1) - x) * newYStride)]            = inData[(y * yStride) + (x * xStride)];
-            outData[(y * xStride) + (((xSize - 1) - x) * newYStride) + newColorStride]     = inData[(y * yStride) + (x * xStride) + colorStride];
-            outData[(y * xStride) + (((xSize - 1) - x) * newYStride) + (2 * newColorStride)] = inData[(y * yStride) + (x * xStride) + (2 * colorStride)];
-          }
-        }
-      }
-
-      if (colorMode == NDColorModeRGB1)
-      {
-        int source_offset;
-        int target_offset;
-
-        /** Calculate a new value for the Y stride. */
-        int newStride = colorSize * ySize;
-
-        for (y = 0; y < ySize; y++)
-        {
-          for (x = (xSize - 1); x >= 0; x--)
-          {
-            source_offset = (x * xStride) + (y * yStride);
-            target_offset = (y * xStride) + (((xSize-1) - x) * (newStride));
-            outData[target_offset + 0] = inData[source_offset + 0];;
-            outData[target_offset + 1] = inData[source_offset + 1];;
-            outData[target_offset + 2] = inData[source_offset + 2];;
-          }
-        }
-      }
-
-      break;
-
-    case (TransformRotate90Mirror):
-
-      outArray->dims[arrayInfo->xDim].size = inArray->dims[arrayInfo->yDim].size;
-      outArray->dims[arrayInfo->yDim].size = inArray->dims[arrayInfo->xDim].size;
-
-      if (colorMode == NDColorModeMono)
-      {
-        for (x = 0; x < xSize; x++)
-        {
-          for (y = 0; y < ySize; y++)
-          {
-            outData[(y * xStride) + (x * ySize)] = inData[(y * yStride) + (x * xStride)];
-          }
-        }
-      }
-
-      if (colorMode == NDColorModeRGB3)
-      {
-        for (x = 0; x < xSize; x++)
-        {
-          for (y = 0; y < ySize; y++)
-          {
-            /** Copy three values for each iteration of the inner loop.  This moves the red, green, and blue information. */
-            outData[(y * xStride) + (x * ySize)] = inData[(y * yStride) + (x * xStride)];
-            outData[(y * xStride) + (x * ySize) + colorStride] = inData[(y * yStride) + (x * xStride) + colorStride];
-            outData[(y * xStride) + (x * ySize) + (2 * colorStride)] = inData[(y * yStride) + (x * xStride) + (2 * colorStride)];
-          }
-        }
-      }
-
-      if (colorMode == NDColorModeRGB2)
-      {
-        /** The values of colorStride and yStride need to change
-          because the dimensions of the image may have changed.
-        */
-        int newColorStride = ySize;
-        int newYStride = newColorStride * colorSize;
-
-        for (y = 0; y < ySize; y++)
-        {
-          for (x = 0; x < xSize; x++)
-          {
-            /** Copy three values for each iteration of the inner loop.  This moves the red, green, and blue information. */
-            outData[(y * xStride) + (x * newYStride)] = inData[(y * yStride) + (x * xStride)];
-            outData[(y * xStride) + (x * newYStride) + newColorStride] = inData[(y * yStride) + (x * xStride) + colorStride];
-            outData[(y * xStride) + (x * newYStride) + (2 * newColorStride)] = inData[(y * yStride) + (x * xStride) + (2 * colorStride)];
-          }
-        }
-      }
-
-      if (colorMode == NDColorModeRGB1)
-      {
-        int source_offset;
-        int target_offset;
-
-        /** Calculate a new value for the Y stride. */
-        int newStride = colorSize * ySize;
-
-        for (y = 0; y < ySize; y++)
-        {
-          for (x = (xSize - 1); x >= 0; x--)
-          {
-            source_offset = (x * xStride) + (y * yStride);
-            target_offset = (y * xStride) + (x * (newStride));
-            outData[target_offset + 0] = inData[source_offset + 0];;
-            outData[target_offset + 1] = inData[source_offset + 1];;
-            outData[target_offset + 2] = inData[source_offset + 2];;
-          }
-        }
-      }
-
-      break;
-
-    case (TransformRotate270Mirror):
-
-      outArray->dims[arrayInfo->xDim].size = inArray->dims[arrayInfo->yDim].size;
-      outArray->dims[arrayInfo->yDim].size = inArray->dims[arrayInfo->xDim].size;
-
-      if (colorMode == NDColorModeMono)
-      {
-        for (x = (xSize - 1); x >= 0; x--)
-        {
-          for (y = (ySize - 1); y >= 0; y--)
-          {
-            outData[(((ySize - 1) - y) * xStride) + (((xSize - 1) - x) * ySize)] = inData[(y * yStride) + (x * xStride)];
-          }
-        }
-      }
-
-      if (colorMode == NDColorModeRGB3)
-      {
-        for (x = (xSize - 1); x >= 0; x--)
-        {
-          for (y = (ySize - 1); y >= 0; y--)
-          {
-            /** Copy three values for each iteration of the inner loop.  This moves the red, green, and blue information. */
-            outData[(((ySize - 1) - y) * xStride) + (((xSize - 1) - x) * ySize)] = inData[(y * yStride) + (x * xStride)];
-            outData[(((ySize - 1) - y) * xStride) + (((xSize - 1) - x) * ySize) + colorStride] = inData[(y * yStride) + (x * xStride) + colorStride];
-            outData[(((ySize - 1) - y) * xStride) + (((xSize - 1) - x) * ySize) + (2 * colorStride)] = inData[(y * yStride) + (x * xStride) + (2 * colorStride)];
-          }
-        }
-      }
-
-      if (colorMode == NDColorModeRGB2)
-      {
-        /** The values of colorStride and yStride need to change
-          because the dimensions of the image may have changed.
-        */
-        int newColorStride = ySize;
-        int newYStride = newColorStride * colorSize;
-
-        for (y = (ySize - 1); y >= 0; y--)
-        {
-          for (x = (xSize - 1); x >= 0; x--)
-          {
-            /** Copy three values for each iteration of the inner loop.  This moves the red, green, and blue information. */
-            outData[(((ySize - 1) - y) * xStride) + (((xSize - 1) - x) * newYStride)] = inData[(y * yStride) + (x * xStride)];
-            outData[(((ySize - 1) - y) * xStride) + (((xSize - 1) - x) * newYStride) + newColorStride] = inData[(y * yStride) + (x * xStride) + colorStride];
-            outData[(((ySize - 1) - y) * xStride) + (((xSize - 1) - x) * newYStride) + (2 * newColorStride)] = inData[(y * yStride) + (x * xStride) + (2 * colorStride)];
-          }
-        }
-      }
-
-      if (colorMode == NDColorModeRGB1)
-      {
-        int source_offset;
-        int target_offset;
-
-        /** Calculate a new value for the Y stride. */
-        int newStride = colorSize * ySize;
-
-        for (y = (ySize - 1); y >= 0; y--)
-        {
-          for (x = (xSize - 1); x >= 0; x--)
-          {
-            source_offset = (((xSize - 1) - x) * xStride) + (((ySize - 1) - y) * yStride);
-            target_offset = (y * xStride) + (x * (newStride));
-            outData[target_offset + 0] = inData[source_offset + 0];;
-            outData[target_offset + 1] = inData[source_offset + 1];;
-            outData[target_offset + 2] = inData[source_offset + 2];;
-          }
-        }
-      }
-
-      break;
-
-    case (TransformMirror):
-
-      if (colorMode == NDColorModeMono)
-      {
-        for (y = 0; y < ySize; y++)
-        {
-          for (x = (xSize - 1); x >= 0; x--)
-          {
-            outData[(((xSize - 1) - x) * xStride) + (y * yStride)] = inData[(y * yStride) + (x * xStride)];
-          }
-        }
-      }
-      else
-      {
-        for (y = 0; y < ySize; y++)
-        {
-          for (x = (xSize - 1); x >= 0; x--)
-          {
-            /** Copy three values for each iteration of the inner loop.  This moves the red, green, and blue information. */
-            outData[(((xSize - 1) - x) * xStride) + (y * yStride)] = inData[(y * yStride) + (x * xStride)];
-            outData[(((xSize - 1) - x) * xStride) + (y * yStride) + colorStride] = inData[(y * yStride) + (x * xStride) + colorStride];
-            outData[(((xSize - 1) - x) * xStride) + (y * yStride) + (2 * colorStride)] = inData[(y * yStride) + (x * xStride) + (2 * colorStride)];
-          }
-        }
-      }
-      break;
-
-    case (TransformRotate180Mirror):
-
-      int source_offset;
-      int target_offset;
-
-      /** In this mode, we are moving an entire row at once.  First all of the red rows are moved.
-        Next, all of the green rows are moved.  Lastly, all of the blue rows are moved.  In mono
-        mode, the outer loop only executes once.*/
-      if (colorMode == NDColorModeMono || colorMode == NDColorModeRGB3)
-      {
-        for (color = 0; color < colorSize; color++)
-        {          
-          for (y = 0; y < ySize; y++)
-          {
-            source_offset = (y * yStride) + (color * colorStride);
-            target_offset = (((ySize-1) - y) * yStride) + (color * colorStride);
-
-            memcpy(outData + target_offset, inData + source_offset, (yStride * elementSize));
-          }
-
-        }
-      }
-
-      /** In this mode, we are moving three rows at a time. All the red, green, and blue
-        information for each for are moved at once. */
-      if (colorMode == NDColorModeRGB2)
-      {
-        for (y = 0; y < ySize; y++)
-        {
-          source_offset = (y * yStride);
-          target_offset = (((ySize-1) - y) * yStride);
-
-          memcpy(outData + target_offset, inData + source_offset, (yStride * elementSize));
-        }
-      }
-
-      if (colorMode == NDColorModeRGB1)
-      {
-        for (y = 0; y < ySize; y++)
-        {
-          for (x = 0; x < xSize; x++)
-          {
-            source_offset = (x * xStride) + (y * yStride);
-            target_offset = (x * xStride) + (((ySize-1) - y) * yStride);
-            outData[target_offset + 0] = inData[source_offset + 0];;
-            outData[target_offset + 1] = inData[source_offset + 1];;
-            outData[target_offset + 2] = inData[source_offset + 2];;
-          }
-        }
-      }
-
-      break;
-
-    default:
-      break;
-  }
-
-  return;
-}
-
-/** Callback function that is called by the NDArray driver with new NDArray data.
-  * Grabs the current NDArray and applies the selected transforms to the data.  Apply the transforms in order.
-  * \param[in] pArray  The NDArray from the callback.
-  */
-void NDPluginTransform::processCallbacks(NDArray *pArray){
-  NDArray *transformedArray;
-  NDArrayInfo_t arrayInfo;
-  static const char* functionName = "processCallbacks";
-
-  /* Call the base class method */
-  NDPluginDriver::processCallbacks(pArray);
-
-  /** Create a pointer to a structure of type NDArrayInfo_t and use it to get information about
-    the input array.
-  */
-  pArray->getInfo(&arrayInfo);
-
-  this->userDims_[0] = arrayInfo.xDim;
-  this->userDims_[1] = arrayInfo.yDim;
-  this->userDims_[2] = arrayInfo.colorDim;
-
-  /* Previous version of the array was held in memory.  Release it and reserve a new one. */
-  if (this->pArrays[0]) {
-    this->pArrays[0]->release();
-    this->pArrays[0] = NULL;
-  }
-
-  /* Release the lock; this is computationally intensive and does not access any shared data */
-  this->unlock();
-  /* Copy the information from the current array */
-  this->pArrays[0] = this->pNDArrayPool->copy(pArray, NULL, 1);
-  transformedArray = this->pArrays[0];
-
-  if ( pArray->ndims <=3 )
-    this->transformImage(pArray, transformedArray, &arrayInfo);
-  else {
-    asynPrint( this->pasynUserSelf, ASYN_TRACE_ERROR, "%s::%s, this method is meant to transform 2Dimages when the number of dimensions is <= 3\n",
-          pluginName, functionName);
-  }
-  this->lock();
-
-  this->getAttributes(transformedArray->pAttributeList);
-  doCallbacksGenericPointer(transformedArray, NDArrayData,0);
-  callParamCallbacks();
-}
-
-
-/** Transform the image according to the selected choice.*/  
-void NDPluginTransform::transformImage(NDArray *inArray, NDArray *outArray, NDArrayInfo_t *arrayInfo)
-{
-  //static const char *functionName = "transformNDArray";
-  int colorMode;
-  int transformType;
-
-  colorMode = NDColorModeMono;
-  getIntegerParam(NDColorMode, &colorMode);
-  getIntegerParam(NDPluginTransformType_, &transformType);
-
-  switch (inArray->dataType) {
-    case NDInt8:
-      transformNDArray<epicsInt8>(inArray, outArray, transformType, colorMode, arrayInfo);
-      break;
-    case NDUInt8:
-      transformNDArray<epicsUInt8>(inArray, outArray, transformType, colorMode, arrayInfo);
-      break;
-    case NDInt16:
-      transformNDArray<epicsInt16>(inArray, outArray, transformType, colorMode, arrayInfo);
-      break;
-    case NDUInt16:
-      transformNDArray<epicsUInt16>(inArray, outArray, transformType, colorMode, arrayInfo);
-      break;
-    case NDInt32:
-      transformNDArray<epicsInt32>(inArray, outArray, transformType, colorMode, arrayInfo);
-      break;
-    case NDUInt32:
-      transformNDArray<epicsUInt32>(inArray, outArray, transformType, colorMode, arrayInfo);
-      break;
-    case NDFloat32:
-      transformNDArray<epicsFloat32>(inArray, outArray, transformType, colorMode, arrayInfo);
-      break;
-    case NDFloat64:
-      transformNDArray<epicsFloat64>(inArray, outArray, transformType, colorMode, arrayInfo);
-      break;
-  }
-
-  return;
-}
-
-
-/** Constructor for NDPluginTransform; most parameters are simply passed to NDPluginDriver::NDPluginDriver.
-  * After calling the base class constructor this method sets reasonable default values for all of the
-  * Transform parameters.
-  * \param[in] portName The name of the asyn port driver to be created.
-  * \param[in] queueSize The number of NDArrays that the input queue for this plugin can hold when
-  *      NDPluginDriverBlockingCallbacks=0.  Larger queues can decrease the number of dropped arrays,
-  *      at the expense of more NDArray buffers being allocated from the underlying driver's NDArrayPool.
-  * \param[in] blockingCallbacks Initial setting for the NDPluginDriverBlockingCallbacks flag.
-  *      0=callbacks are queued and executed by the callback thread; 1 callbacks execute in the thread
-  *      of the driver doing the callbacks.
-  * \param[in] NDArrayPort Name of asyn port driver for initial source of NDArray callbacks.
-  * \param[in] NDArrayAddr asyn port driver address for initial source of NDArray callbacks.
-  * \param[in] maxBuffers The maximum number of NDArray buffers that the NDArrayPool for this driver is
-  *      allowed to allocate. Set this to -1 to allow an unlimited number of buffers.
-  * \param[in] maxMemory The maximum amount of memory that the NDArrayPool for this driver is
-  *      allowed to allocate. Set this to -1 to allow an unlimited amount of memory.
-  * \param[in] priority The thread priority for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
-  * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
-  */
-NDPluginTransform::NDPluginTransform(const char *portName, int queueSize, int blockingCallbacks,
-             const char *NDArrayPort, int NDArrayAddr, int maxBuffers, size_t maxMemory,
-             int priority, int stackSize)
-  /* Invoke the base class constructor */
-  : NDPluginDriver(portName, queueSize, blockingCallbacks,
-                   NDArrayPort, NDArrayAddr, 1, NUM_TRANSFORM_PARAMS, maxBuffers, maxMemory,
-                   asynInt32ArrayMask | asynFloat64ArrayMask | asynGenericPointerMask,
-                   asynInt32ArrayMask | asynFloat64ArrayMask | asynGenericPointerMask,
-                   ASYN_MULTIDEVICE, 1, priority, stackSize)
-{
-  //static const char *functionName = "NDPluginTransform";
-  int i;
-
-  createParam(NDPluginTransformTypeString, asynParamInt32, &NDPluginTransformType_);
-
-  for (i = 0; i < ND_ARRAY_MAX_DIMS; i++) {
-    this->userDims_[i] = i;
-  }
-  
-  /* Set the plugin type string */
-  setStringParam(NDPluginDriverPluginType, "NDPluginTransform");
-  setIntegerParam(NDPluginTransformType_, TransformNone);
-
-  // Enable ArrayCallbacks.  
-  // This plugin currently ignores this setting and always does callbacks, so make the setting reflect the behavior
-  setIntegerParam(NDArrayCallbacks, 1);
-
-  /* Try to connect to the array port */
-  connectToArrayPort();
-}
-
-/** Configuration command */
-extern "C" int NDTransformConfigure(const char *portName, int queueSize, int blockingCallbacks,
-                                    const char *NDArrayPort, int NDArrayAddr,
-                                    int maxBuffers, size_t maxMemory,
-                                    int priority, int stackSize)
-{
-  new NDPluginTransform(portName, queueSize, blockingCallbacks, NDArrayPort, NDArrayAddr,
-              maxBuffers, maxMemory, priority, stackSize);
-  return(asynSuccess);
-}
-
-/* EPICS iocsh shell commands */
-static const iocshArg initArg0 = { "portName",iocshArgString};
-static const iocshArg initArg1 = { "frame queue size",iocshArgInt};
-static const iocshArg initArg2 = { "blocking callbacks",iocshArgInt};
-static const iocshArg initArg3 = { "NDArrayPort",iocshArgString};
-static const iocshArg initArg4 = { "NDArrayAddr",iocshArgInt};
-static const iocshArg initArg5 = { "maxBuffers",iocshArgInt};
-static const iocshArg initArg6 = { "maxMemory",iocshArgInt};
-static const iocshArg initArg7 = { "priority",iocshArgInt};
-static const iocshArg initArg8 = { "stackSize",iocshArgInt};
-static const iocshArg * const initArgs[] = {&initArg0,
-                                            &initArg1,
-                                            &initArg2,
-                                            &initArg3,
-                                            &initArg4,
-                                            &initArg5,
-                                            &initArg6,
-                                            &initArg7,
-                                            &initArg8};
-static const iocshFuncDef initFuncDef = {"NDTransformConfigure",9,initArgs};
-static void initCallFunc(const iocshArgBuf *args)
-{
-  NDTransformConfigure(args[0].sval, args[1].ival, args[2].ival,
-                       args[3].sval, args[4].ival, args[5].ival,
-                       args[6].ival, args[7].ival, args[8].ival);
-}
-
-extern "C" void NDTransformRegister(void)
-{
-  iocshRegister(&initFuncDef,initCallFunc);
-}
-
-extern "C" {
-epicsExportRegistrar(NDTransformRegister);
-}
+/*
+ * NDPluginTransform.cpp
+ *
+ * Transform plugin
+ * Author: John Hammonds, Chris Roehrig, Mark Rivers
+ *
+ * Created Oct. 28, 2009
+ *
+ * Change Log:
+ *
+ * 27 April 2014 
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <epicsString.h>
+#include <epicsMutex.h>
+#include <iocsh.h>
+
+#include <asynDriver.h>
+
+#include <epicsExport.h>
+#include "NDPluginDriver.h"
+#include "NDPluginTransform.h"
+
+/* Enums to describe the types of transformations */
+typedef enum {
+  TransformNone,
+  TransformRotate90,
+  TransformRotate180,
+  TransformRotate270,
+  TransformMirror,
+  TransformRotate90Mirror,
+  TransformRotate180Mirror,
+  TransformRotate270Mirror,
+} NDPluginTransformType_t;
+
+/** All of the colors of one RGB1 pixel, so that a pixel is moved with a single copy */
+template <typename epicsType>
+struct NDTransformPixel3 {
+  epicsType color[3];
+};
+
+/** Describes where each pixel of the output image comes from.
+  * The steps and offsets are in pixels of the type the image is moved with, which is a single element,
+  * or all 3 colors of a pixel for RGB1 images. */
+struct NDTransformPlan {
+  const char *pIn;          /**< Input pixel of output pixel (0,0) of the first color plane */
+  char *pOut;
+  ptrdiff_t inDx;           /**< Input step for one output pixel in x */
+  ptrdiff_t inDy;           /**< Input step for one output pixel in y */
+  ptrdiff_t outDx;
+  ptrdiff_t outDy;
+  ptrdiff_t inPlane;        /**< Input offset between color planes */
+  ptrdiff_t outPlane;       /**< Output offset between color planes */
+  int numPlanes;
+  size_t outXSize;
+  size_t outYSize;
+  bool transpose;           /**< Output rows are input columns */
+  size_t bandRows;          /**< Number of output rows that are transposed together */
+  int numStripes;
+  void (*rowsFunc)(const NDTransformPlan *p, size_t firstRow, size_t lastRow);
+};
+
+/** transformSSE2 is a global flag that controls whether the rotations of 8 and 16 bit data transpose
+  * 8x8 blocks with the SSE2 instructions where the compiler supports them.  The default value is 1.
+  * Set it to 0 to move the blocks with the plain C++ loops, for example to compare the results of the two.
+  */
+volatile int transformSSE2=1;
+extern "C" {epicsExportAddress(int, transformSSE2);}
+
+/** Transposes an 8x8 block of pixels with the SSE2 instructions.
+  * Returns false if there is no such version for this pixel type, and the block is moved one pixel at a time. */
+template <typename pixelType>
+static bool transposeBlock(const pixelType *pIn, ptrdiff_t inDx, ptrdiff_t inDy, pixelType *pOut, ptrdiff_t outDy)
+{
+  return false;
+}
+
+#ifdef __SSE2__
+/* In the blocks below the input pixels (ox, oy), oy=0..7, are contiguous, in order when inDy=1 and
+ * in reverse order when inDy=-1. Each of the 8 columns is loaded from its lowest address, so after the
+ * transpose row k of the block belongs to output row k, or 7-k when inDy=-1 */
+template <>
+bool transposeBlock<epicsUInt16>(const epicsUInt16 *pIn, ptrdiff_t inDx, ptrdiff_t inDy,
+                                 epicsUInt16 *pOut, ptrdiff_t outDy)
+{
+  __m128i v[8], a[8], b[8];
+  int j;
+
+  if (!transformSSE2) return false;
+  if (inDy < 0) pIn -= 7;
+  for (j=0; j<8; j++) v[j] = _mm_loadu_si128((const __m128i *)(pIn + j*inDx));
+  for (j=0; j<8; j+=2) {
+    a[j]   = _mm_unpacklo_epi16(v[j], v[j+1]);
+    a[j+1] = _mm_unpackhi_epi16(v[j], v[j+1]);
+  }
+  for (j=0; j<8; j+=4) {
+    b[j]   = _mm_unpacklo_epi32(a[j],   a[j+2]);
+    b[j+1] = _mm_unpackhi_epi32(a[j],   a[j+2]);
+    b[j+2] = _mm_unpacklo_epi32(a[j+1], a[j+3]);
+    b[j+3] = _mm_unpackhi_epi32(a[j+1], a[j+3]);
+  }
+  for (j=0; j<4; j++) {
+    int row = (inDy > 0) ? 2*j : 7-2*j;
+    _mm_storeu_si128((__m128i *)(pOut + row*outDy), _mm_unpacklo_epi64(b[j], b[j+4]));
+    row = (inDy > 0) ? 2*j+1 : 6-2*j;
+    _mm_storeu_si128((__m128i *)(pOut + row*outDy), _mm_unpackhi_epi64(b[j], b[j+4]));
+  }
+  return true;
+}
+
+template <>
+bool transposeBlock<epicsUInt8>(const epicsUInt8 *pIn, ptrdiff_t inDx, ptrdiff_t inDy,
+                                epicsUInt8 *pOut, ptrdiff_t outDy)
+{
+  __m128i v[8], a[4], b[4], c[4];
+  int j;
+
+  if (!transformSSE2) return false;
+  if (inDy < 0) pIn -= 7;
+  for (j=0; j<8; j++) v[j] = _mm_loadl_epi64((const __m128i *)(pIn + j*inDx));
+  for (j=0; j<4; j++) a[j] = _mm_unpacklo_epi8(v[2*j], v[2*j+1]);
+  b[0] = _mm_unpacklo_epi16(a[0], a[1]);
+  b[1] = _mm_unpackhi_epi16(a[0], a[1]);
+  b[2] = _mm_unpacklo_epi16(a[2], a[3]);
+  b[3] = _mm_unpackhi_epi16(a[2], a[3]);
+  c[0] = _mm_unpacklo_epi32(b[0], b[2]);
+  c[1] = _mm_unpackhi_epi32(b[0], b[2]);
+  c[2] = _mm_unpacklo_epi32(b[1], b[3]);
+  c[3] = _mm_unpackhi_epi32(b[1], b[3]);
+  for (j=0; j<4; j++) {
+    int row = (inDy > 0) ? 2*j : 7-2*j;
+    _mm_storel_epi64((__m128i *)(pOut + row*outDy), c[j]);
+    row = (inDy > 0) ? 2*j+1 : 6-2*j;
+    _mm_storel_epi64((__m128i *)(pOut + row*outDy), _mm_srli_si128(c[j], 8));
+  }
+  return true;
+}
+#endif
+
+/** Moves output rows firstRow to lastRow-1 of all color planes.
+  * Rotations by 90 and 270 degrees read the input by columns. They are done in bands of bandRows output
+  * rows, so that each input cache line is used for a whole block of output rows before it is evicted,
+  * and the bands are moved in blocks of 8x8 pixels. */
+template <typename pixelType>
+static void transformRows(const NDTransformPlan *p, size_t firstRow, size_t lastRow)
+{
+  const ptrdiff_t inDx = p->inDx, inDy = p->inDy, outDx = p->outDx, outDy = p->outDy;
+  const size_t outXSize = p->outXSize;
+  size_t ox, oy, ox0, oy0, oyBlock, ox1, oy1, oyBlockEnd;
+  bool blocks = (outDx == 1) && ((inDy == 1) || (inDy == -1));
+
+  for (int plane=0; plane<p->numPlanes; plane++) {
+    const pixelType *pIn = (const pixelType *)p->pIn + plane*p->inPlane;
+    pixelType *pOut = (pixelType *)p->pOut + plane*p->outPlane;
+
+    if (!p->transpose) {
+      for (oy=firstRow; oy<lastRow; oy++) {
+        const pixelType *pInRow = pIn + oy*inDy;
+        pixelType *pOutRow = pOut + oy*outDy;
+        if ((inDx == 1) && (outDx == 1)) {
+          memcpy(pOutRow, pInRow, outXSize*sizeof(pixelType));
+        } else if ((inDx == -1) && (outDx == 1)) {
+          /* Separate loop for mirrored rows, so the compiler can reverse them with vector instructions */
+          pInRow -= outXSize - 1;
+          for (ox=0; ox<outXSize; ox++) pOutRow[ox] = pInRow[outXSize-1-ox];
+        } else {
+          for (ox=0; ox<outXSize; ox++) pOutRow[ox*outDx] = pInRow[ox*inDx];
+        }
+      }
+      continue;
+    }
+    for (oy0=firstRow; oy0<lastRow; oy0+=p->bandRows) {
+      oy1 = oy0 + p->bandRows;
+      if (oy1 > lastRow) oy1 = lastRow;
+      for (ox0=0; ox0<outXSize; ox0+=8) {
+        ox1 = ox0 + 8;
+        if (ox1 > outXSize) ox1 = outXSize;
+        for (oyBlock=oy0; oyBlock<oy1; oyBlock+=8) {
+          oyBlockEnd = oyBlock + 8;
+          if (oyBlockEnd > oy1) oyBlockEnd = oy1;
+          if (blocks && (ox1 - ox0 == 8) && (oyBlockEnd - oyBlock == 8) &&
+              transposeBlock<pixelType>(pIn + ox0*inDx + oyBlock*inDy, inDx, inDy,
+                                        pOut + oyBlock*outDy + ox0, outDy)) continue;
+          for (oy=oyBlock; oy<oyBlockEnd; oy++) {
+            const pixelType *pInRow = pIn + oy*inDy;
+            pixelType *pOutRow = pOut + oy*outDy;
+            for (ox=ox0; ox<ox1; ox++) pOutRow[ox*outDx] = pInRow[ox*inDx];
+          }
+        }
+      }
+    }
+  }
+}
+
+/** Moves one stripe of output rows; called from the NDStripeWorkers threads */
+static void transformStripe(void *pvt, int stripe)
+{
+  NDTransformPlan *p = (NDTransformPlan *)pvt;
+  size_t rowsPerStripe = (p->outYSize + p->numStripes - 1) / p->numStripes;
+  size_t firstRow, lastRow;
+
+  /* Stripes start on a band boundary */
+  rowsPerStripe = (rowsPerStripe + p->bandRows - 1) / p->bandRows * p->bandRows;
+  firstRow = stripe * rowsPerStripe;
+  lastRow = firstRow + rowsPerStripe;
+  if (lastRow > p->outYSize) lastRow = p->outYSize;
+  if (firstRow < lastRow) p->rowsFunc(p, firstRow, lastRow);
+}
+
+template <typename pixelType>
+static void setPixelType(NDTransformPlan *p)
+{
+  p->rowsFunc = transformRows<pixelType>;
+  p->bandRows = 64 / sizeof(pixelType) / 8 * 8;
+  if (p->bandRows < 8) p->bandRows = 8;
+}
+
+/** Perform the move of the pixels to the new orientation.
+  * The output array must have the same dimensions as the input array; the sizes of the x and y dimensions
+  * are exchanged here for the rotations by 90 and 270 degrees.
+  * \param[in] inArray The input array.
+  * \param[out] outArray The output array.
+  * \param[in] transformType One of the NDPluginTransformType_t values.
+  * \param[in] arrayInfo Information about inArray.
+  * \param[in] pWorkers Threads to move the pixels with.
+  * \param[in] numThreads Maximum number of threads to use. */
+static void transformNDArray(NDArray *inArray, NDArray *outArray, int transformType, NDArrayInfo_t *arrayInfo,
+                             NDStripeWorkers *pWorkers, int numThreads)
+{
+  NDTransformPlan plan, *p=&plan;
+  ptrdiff_t xSize = arrayInfo->xSize, ySize = arrayInfo->ySize;
+  ptrdiff_t sx, sy, inStart, elementsPerPixel = 1;
+  int elementSize = arrayInfo->bytesPerElement;
+  int colorMode = arrayInfo->colorMode;
+  int colorSize = 1;
+
+  if (inArray->ndims == 3) colorSize = (int)arrayInfo->colorSize;
+  p->numPlanes = 1;
+  p->inPlane = 0;
+  p->outPlane = 0;
+  p->transpose = (transformType == TransformRotate90)       || (transformType == TransformRotate270) ||
+                 (transformType == TransformRotate90Mirror) || (transformType == TransformRotate270Mirror);
+  p->outXSize = p->transpose ? ySize : xSize;
+  p->outYSize = p->transpose ? xSize : ySize;
+  if (p->transpose) {
+    outArray->dims[arrayInfo->xDim].size = inArray->dims[arrayInfo->yDim].size;
+    outArray->dims[arrayInfo->yDim].size = inArray->dims[arrayInfo->xDim].size;
+  }
+
+  /* Work out the steps of the layout in pixels, and the color planes */
+  sx = 1;
+  sy = arrayInfo->yStride;
+  p->outDx = 1;
+  p->outDy = p->outXSize;
+  if ((inArray->ndims == 3) && (colorMode == NDColorModeRGB1) && (colorSize == 3)) {
+    elementsPerPixel = 3;
+    sy = xSize;
+  } else if ((inArray->ndims == 3) && (colorMode == NDColorModeRGB1)) {
+    p->numPlanes = colorSize;
+    p->inPlane = p->outPlane = 1;
+    sx = colorSize;
+    p->outDx = colorSize;
+    p->outDy = p->outXSize * colorSize;
+  } else if ((inArray->ndims == 3) && (colorMode == NDColorModeRGB2)) {
+    p->numPlanes = colorSize;
+    p->inPlane = xSize;
+    p->outPlane = p->outXSize;
+    p->outDy = p->outXSize * colorSize;
+  } else if (inArray->ndims == 3) {
+    p->numPlanes = colorSize;
+    p->inPlane = p->outPlane = xSize * ySize;
+  }
+
+  switch (transformType) {
+    case TransformRotate90:
+      inStart = (ySize-1)*sy;             p->inDx = -sy; p->inDy = sx;  break;
+    case TransformRotate180:
+      inStart = (xSize-1)*sx + (ySize-1)*sy; p->inDx = -sx; p->inDy = -sy; break;
+    case TransformRotate270:
+      inStart = (xSize-1)*sx;             p->inDx = sy;  p->inDy = -sx; break;
+    case TransformMirror:
+      inStart = (xSize-1)*sx;             p->inDx = -sx; p->inDy = sy;  break;
+    case TransformRotate90Mirror:
+      inStart = 0;                        p->inDx = sy;  p->inDy = sx;  break;
+    case TransformRotate180Mirror:
+      inStart = (ySize-1)*sy;             p->inDx = sx;  p->inDy = -sy; break;
+    case TransformRotate270Mirror:
+      inStart = (xSize-1)*sx + (ySize-1)*sy; p->inDx = -sy; p->inDy = -sx; break;
+    default:
+      return;
+  }
+  p->pIn = (const char *)inArray->pData + inStart*elementsPerPixel*elementSize;
+  p->pOut = (char *)outArray->pData;
+
+  switch (elementSize * elementsPerPixel) {
+    case 1:  setPixelType<epicsUInt8>(p);                       break;
+    case 2:  setPixelType<epicsUInt16>(p);                      break;
+    case 4:  setPixelType<epicsUInt32>(p);                      break;
+    case 8:  setPixelType<epicsFloat64>(p);                     break;
+    case 3:  setPixelType<NDTransformPixel3<epicsUInt8> >(p);   break;
+    case 6:  setPixelType<NDTransformPixel3<epicsUInt16> >(p);  break;
+    case 12: setPixelType<NDTransformPixel3<epicsUInt32> >(p);  break;
+    case 24: setPixelType<NDTransformPixel3<epicsFloat64> >(p); break;
+    default: return;
+  }
+
+  p->numStripes = NDStripeWorkers::numStripes(numThreads, p->outXSize * p->outYSize * colorSize,
+                                              (p->outYSize + p->bandRows - 1) / p->bandRows);
+  if (p->numStripes <= 1) {
+    p->rowsFunc(p, 0, p->outYSize);
+  } else {
+    pWorkers->run(p->numStripes, transformStripe, p);
+  }
+}
+
+/** Callback function that is called by the NDArray driver with new NDArray data.
+  * Grabs the current NDArray and applies the selected transforms to the data.  Apply the transforms in order.
+  * \param[in] pArray  The NDArray from the callback.
+  */
+void NDPluginTransform::processCallbacks(NDArray *pArray){
+  NDArray *transformedArray;
+  NDArrayInfo_t arrayInfo;
+  int transformType, computeThreads;
+  static const char* functionName = "processCallbacks";
+
+  /* Call the base class method */
+  NDPluginDriver::processCallbacks(pArray);
+
+  getIntegerParam(NDPluginTransformType_, &transformType);
+  getIntegerParam(NDPluginTransformComputeThreads_, &computeThreads);
+
+  /** Create a pointer to a structure of type NDArrayInfo_t and use it to get information about
+    the input array.
+  */
+  pArray->getInfo(&arrayInfo);
+
+  this->userDims_[0] = arrayInfo.xDim;
+  this->userDims_[1] = arrayInfo.yDim;
+  this->userDims_[2] = arrayInfo.colorDim;
+
+  /* Previous version of the array was held in memory.  Release it and reserve a new one. */
+  if (this->pArrays[0]) {
+    this->pArrays[0]->release();
+    this->pArrays[0] = NULL;
+  }
+
+  /* Release the lock; this is computationally intensive and does not access any shared data */
+  this->unlock();
+  /* Copy the information from the current array.  The data are only copied when they are
+   * not going to be moved, i.e. when there is no transform or the array is not an image */
+  this->pArrays[0] = this->pNDArrayPool->copy(pArray, NULL,
+                                              (transformType == TransformNone) ||
+                                              (pArray->ndims < 2) || (pArray->ndims > 3));
+  transformedArray = this->pArrays[0];
+
+  if (pArray->ndims > 3) {
+    asynPrint( this->pasynUserSelf, ASYN_TRACE_ERROR, "%s::%s, this method is meant to transform 2Dimages when the number of dimensions is <= 3\n",
+          pluginName, functionName);
+  }
+  else if (pArray->ndims >= 2)
+    this->transformImage(pArray, transformedArray, &arrayInfo, transformType, computeThreads);
+  this->lock();
+
+  this->getAttributes(transformedArray->pAttributeList);
+  doCallbacksGenericPointer(transformedArray, NDArrayData,0);
+  callParamCallbacks();
+}
+
+
+/** Transform the image according to the selected choice.*/  
+void NDPluginTransform::transformImage(NDArray *inArray, NDArray *outArray, NDArrayInfo_t *arrayInfo,
+                                       int transformType, int computeThreads)
+{
+  transformNDArray(inArray, outArray, transformType, arrayInfo, this->pStripeWorkers, computeThreads);
+}
+
+
+/** Constructor for NDPluginTransform; most parameters are simply passed to NDPluginDriver::NDPluginDriver.
+  * After calling the base class constructor this method sets reasonable default values for all of the
+  * Transform parameters.
+  * \param[in] portName The name of the asyn port driver to be created.
+  * \param[in] queueSize The number of NDArrays that the input queue for this plugin can hold when
+  *      NDPluginDriverBlockingCallbacks=0.  Larger queues can decrease the number of dropped arrays,
+  *      at the expense of more NDArray buffers being allocated from the underlying driver's NDArrayPool.
+  * \param[in] blockingCallbacks Initial setting for the NDPluginDriverBlockingCallbacks flag.
+  *      0=callbacks are queued and executed by the callback thread; 1 callbacks execute in the thread
+  *      of the driver doing the callbacks.
+  * \param[in] NDArrayPort Name of asyn port driver for initial source of NDArray callbacks.
+  * \param[in] NDArrayAddr asyn port driver address for initial source of NDArray callbacks.
+  * \param[in] maxBuffers The maximum number of NDArray buffers that the NDArrayPool for this driver is
+  *      allowed to allocate. Set this to -1 to allow an unlimited number of buffers.
+  * \param[in] maxMemory The maximum amount of memory that the NDArrayPool for this driver is
+  *      allowed to allocate. Set this to -1 to allow an unlimited amount of memory.
+  * \param[in] priority The thread priority for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  */
+NDPluginTransform::NDPluginTransform(const char *portName, int queueSize, int blockingCallbacks,
+             const char *NDArrayPort, int NDArrayAddr, int maxBuffers, size_t maxMemory,
+             int priority, int stackSize)
+  /* Invoke the base class constructor */
+  : NDPluginDriver(portName, queueSize, blockingCallbacks,
+                   NDArrayPort, NDArrayAddr, 1, NUM_TRANSFORM_PARAMS, maxBuffers, maxMemory,
+                   asynInt32ArrayMask | asynFloat64ArrayMask | asynGenericPointerMask,
+                   asynInt32ArrayMask | asynFloat64ArrayMask | asynGenericPointerMask,
+                   ASYN_MULTIDEVICE, 1, priority, stackSize)
+{
+  //static const char *functionName = "NDPluginTransform";
+  int i;
+
+  createParam(NDPluginTransformTypeString, asynParamInt32, &NDPluginTransformType_);
+  createParam(NDPluginTransformComputeThreadsString, asynParamInt32, &NDPluginTransformComputeThreads_);
+
+  this->pStripeWorkers = new NDStripeWorkers(portName);
+
+  for (i = 0; i < ND_ARRAY_MAX_DIMS; i++) {
+    this->userDims_[i] = i;
+  }
+  
+  /* Set the plugin type string */
+  setStringParam(NDPluginDriverPluginType, "NDPluginTransform");
+  setIntegerParam(NDPluginTransformType_, TransformNone);
+  setIntegerParam(NDPluginTransformComputeThreads_, 1);
+
+  // Enable ArrayCallbacks.  
+  // This plugin currently ignores this setting and always does callbacks, so make the setting reflect the behavior
+  setIntegerParam(NDArrayCallbacks, 1);
+
+  /* Try to connect to the array port */
+  connectToArrayPort();
+}
+
+NDPluginTransform::~NDPluginTransform()
+{
+  delete this->pStripeWorkers;
+}
+
+/** Configuration command */
+extern "C" int NDTransformConfigure(const char *portName, int queueSize, int blockingCallbacks,
+                                    const char *NDArrayPort, int NDArrayAddr,
+                                    int maxBuffers, size_t maxMemory,
+                                    int priority, int stackSize)
+{
+  new NDPluginTransform(portName, queueSize, blockingCallbacks, NDArrayPort, NDArrayAddr,
+              maxBuffers, maxMemory, priority, stackSize);
+  return(asynSuccess);
+}
+
+/* EPICS iocsh shell commands */
+static const iocshArg initArg0 = { "portName",iocshArgString};
+static const iocshArg initArg1 = { "frame queue size",iocshArgInt};
+static const iocshArg initArg2 = { "blocking callbacks",iocshArgInt};
+static const iocshArg initArg3 = { "NDArrayPort",iocshArgString};
+static const iocshArg initArg4 = { "NDArrayAddr",iocshArgInt};
+static const iocshArg initArg5 = { "maxBuffers",iocshArgInt};
+static const iocshArg initArg6 = { "maxMemory",iocshArgInt};
+static const iocshArg initArg7 = { "priority",iocshArgInt};
+static const iocshArg initArg8 = { "stackSize",iocshArgInt};
+static const iocshArg * const initArgs[] = {&initArg0,
+                                            &initArg1,
+                                            &initArg2,
+                                            &initArg3,
+                                            &initArg4,
+                                            &initArg5,
+                                            &initArg6,
+                                            &initArg7,
+                                            &initArg8};
+static const iocshFuncDef initFuncDef = {"NDTransformConfigure",9,initArgs};
+static void initCallFunc(const iocshArgBuf *args)
+{
+  NDTransformConfigure(args[0].sval, args[1].ival, args[2].ival,
+                       args[3].sval, args[4].ival, args[5].ival,
+                       args[6].ival, args[7].ival, args[8].ival);
+}
+
+extern "C" void NDTransformRegister(void)
+{
+  iocshRegister(&initFuncDef,initCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(NDTransformRegister);
+}
@@ -5,10 +5,12 @@
 #include <asynStandardInterfaces.h>
 
 #include "NDPluginDriver.h"
+#include "NDStripeWorkers.h"
 
 /** Map parameter enums to strings that will be used to set up EPICS databases
   */
 #define NDPluginTransformTypeString  "TRANSFORM_TYPE"
+#define NDPluginTransformComputeThreadsString  "COMPUTE_THREADS"  /* (asynInt32, r/w) Number of threads transforming each array */
 
 static const char* pluginName = "NDPluginTransform";
 
@@ -19,18 +21,25 @@ public:
                  const char *NDArrayPort, int NDArrayAddr,
                  int maxBuffers, size_t maxMemory,
                  int priority, int stackSize);
+    ~NDPluginTransform();
     /* These methods override the virtual methods in the base class */
     void processCallbacks(NDArray *pArray);
 
 protected:
     int NDPluginTransformType_;
     #define FIRST_TRANSFORM_PARAM NDPluginTransformType_
-    #define LAST_TRANSFORM_PARAM NDPluginTransformType_
+    int NDPluginTransformComputeThreads_;
+    #define LAST_TRANSFORM_PARAM NDPluginTransformComputeThreads_
 
 private:
     size_t userDims_[ND_ARRAY_MAX_DIMS];
-    void transformImage(NDArray *inArray, NDArray *outArray, NDArrayInfo_t *arrayInfo);
+    void transformImage(NDArray *inArray, NDArray *outArray, NDArrayInfo_t *arrayInfo,
+                        int transformType, int computeThreads);
+    NDStripeWorkers *pStripeWorkers;
 };
 #define NUM_TRANSFORM_PARAMS ((int)(&LAST_TRANSFORM_PARAM - &FIRST_TRANSFORM_PARAM + 1))
 
+/** 0 transposes with the plain C++ loops instead of the SSE2 instructions */
+epicsShareExtern volatile int transformSSE2;
+
 #endif
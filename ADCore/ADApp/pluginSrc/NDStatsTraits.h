@@ -0,0 +1,62 @@
+#ifndef NDStatsTraits_H
+#define NDStatsTraits_H
+
+#include <stddef.h>
+
+#include <epicsTypes.h>
+
+/** Accumulator types of the statistics kernels of NDPluginStats and NDPluginROIStat for each data type.
+  * The sums of the integer types are accumulated in integers, which is exact and lets the compiler
+  * vectorise the loops.  NDPluginStats histograms 8 and 16 bit data by counting each raw value first
+  * (rawValues entries), so the bin of each value only needs to be computed once per array. */
+template <typename epicsType> struct NDStatsTraits {
+    typedef double sum_t;
+    typedef double sum2_t;
+    enum {rawValues = 0};
+    static size_t index(epicsType value) { return 0; }
+    static double value(size_t index) { return 0.; }
+};
+template <> struct NDStatsTraits<epicsInt8> {
+    typedef epicsInt64 sum_t;
+    typedef epicsInt64 sum2_t;
+    enum {rawValues = 256};
+    static size_t index(epicsInt8 value) { return (epicsUInt8)value; }
+    static double value(size_t index) { return (epicsInt8)(epicsUInt8)index; }
+};
+template <> struct NDStatsTraits<epicsUInt8> {
+    typedef epicsInt64 sum_t;
+    typedef epicsInt64 sum2_t;
+    enum {rawValues = 256};
+    static size_t index(epicsUInt8 value) { return value; }
+    static double value(size_t index) { return (epicsUInt8)index; }
+};
+template <> struct NDStatsTraits<epicsInt16> {
+    typedef epicsInt64 sum_t;
+    typedef epicsInt64 sum2_t;
+    enum {rawValues = 65536};
+    static size_t index(epicsInt16 value) { return (epicsUInt16)value; }
+    static double value(size_t index) { return (epicsInt16)(epicsUInt16)index; }
+};
+template <> struct NDStatsTraits<epicsUInt16> {
+    typedef epicsInt64 sum_t;
+    typedef epicsInt64 sum2_t;
+    enum {rawValues = 65536};
+    static size_t index(epicsUInt16 value) { return value; }
+    static double value(size_t index) { return (epicsUInt16)index; }
+};
+template <> struct NDStatsTraits<epicsInt32> {
+    typedef epicsInt64 sum_t;
+    typedef double sum2_t;
+    enum {rawValues = 0};
+    static size_t index(epicsInt32 value) { return 0; }
+    static double value(size_t index) { return 0.; }
+};
+template <> struct NDStatsTraits<epicsUInt32> {
+    typedef epicsInt64 sum_t;
+    typedef double sum2_t;
+    enum {rawValues = 0};
+    static size_t index(epicsUInt32 value) { return 0; }
+    static double value(size_t index) { return 0.; }
+};
+
+#endif
@@ -0,0 +1,77 @@
+/**
+ * Benchmark of NDArray reserve/release.
+ *
+ * Each thread reserves and releases its own NDArray from a shared pool, as the
+ * plugins of a driver do, and the throughput is reported for 1 to 8 threads.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsTime.h>
+#include <NDArray.h>
+
+#define NUM_RESERVE_RELEASE 1000000
+#define MAX_THREADS 8
+
+struct ReserveReleaseBenchThread
+{
+    NDArray *pArray;
+    epicsEventId startEvent;
+    epicsEventId doneEvent;
+};
+
+static void reserveReleaseBenchTask(void *drvPvt)
+{
+    ReserveReleaseBenchThread *pThread = (ReserveReleaseBenchThread *)drvPvt;
+
+    epicsEventWait(pThread->startEvent);
+    for (int i = 0; i < NUM_RESERVE_RELEASE; i++) {
+        pThread->pArray->reserve();
+        pThread->pArray->release();
+    }
+    epicsEventSignal(pThread->doneEvent);
+}
+
+BOOST_AUTO_TEST_SUITE(NDArrayPoolBenchmarks)
+
+BOOST_AUTO_TEST_CASE(bench_ReserveReleaseScaling)
+{
+    NDArrayPool arrayPool(100, 0);
+    ReserveReleaseBenchThread threads[MAX_THREADS];
+    size_t dims[2] = {64, 64};
+    epicsTimeStamp start, end;
+    char name[20];
+
+    for (int i = 0; i < MAX_THREADS; i++) {
+        threads[i].pArray = arrayPool.alloc(2, dims, NDUInt16, 0, NULL);
+        BOOST_REQUIRE(threads[i].pArray != NULL);
+        threads[i].startEvent = epicsEventCreate(epicsEventEmpty);
+        threads[i].doneEvent = epicsEventCreate(epicsEventEmpty);
+    }
+    for (int numThreads = 1; numThreads <= MAX_THREADS; numThreads *= 2) {
+        for (int i = 0; i < numThreads; i++) {
+            sprintf(name, "reserveRelease%d", i);
+            epicsThreadCreate(name, epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackMedium),
+                              reserveReleaseBenchTask, &threads[i]);
+        }
+        epicsTimeGetCurrent(&start);
+        for (int i = 0; i < numThreads; i++) epicsEventSignal(threads[i].startEvent);
+        for (int i = 0; i < numThreads; i++) epicsEventWait(threads[i].doneEvent);
+        epicsTimeGetCurrent(&end);
+        BOOST_TEST_MESSAGE("reserve/release with " << numThreads << " threads: "
+                           << numThreads * (double)NUM_RESERVE_RELEASE / epicsTimeDiffInSeconds(&end, &start) / 1e6
+                           << " million/s");
+    }
+    for (int i = 0; i < MAX_THREADS; i++) {
+        threads[i].pArray->release();
+        epicsEventDestroy(threads[i].startEvent);
+        epicsEventDestroy(threads[i].doneEvent);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
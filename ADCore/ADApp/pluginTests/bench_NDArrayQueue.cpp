@@ -0,0 +1,99 @@
+/**
+ * Benchmark of NDArrayQueue, the queue between NDPluginDriver::driverCallback and
+ * the plugin threads.
+ *
+ * The arrays are sent to 1 to 4 receiving threads through the queue and through
+ * the epicsMessageQueue it replaced. The queue only passes pointers around, so
+ * small integers cast to NDArray pointers are sent rather than real arrays.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsMessageQueue.h>
+#include <epicsTime.h>
+#include <NDArrayQueue.h>
+
+#define NUM_ARRAYS 200000
+#define NUM_RECEIVERS 4
+#define QUEUE_SIZE 20
+#define STOP_MARKER ((NDArray *)(size_t)(NUM_ARRAYS + 1))
+
+struct QueueBenchReceiver
+{
+    NDArrayQueue *pQueue;
+    epicsMessageQueueId msgQId;
+    epicsEventId doneEvent;
+};
+
+// Receives from the queue until it gets the stop marker
+static void queueBenchReceiveTask(void *drvPvt)
+{
+    QueueBenchReceiver *pReceiver = (QueueBenchReceiver *)drvPvt;
+    NDArray *pArray;
+
+    do {
+        if (pReceiver->pQueue) {
+            pArray = pReceiver->pQueue->receive();
+        } else {
+            epicsMessageQueueReceive(pReceiver->msgQId, &pArray, sizeof(pArray));
+        }
+    } while (pArray != STOP_MARKER);
+    epicsEventSignal(pReceiver->doneEvent);
+}
+
+// Sends NUM_ARRAYS arrays to numReceivers threads, through pQueue if it is not NULL and
+// through msgQId otherwise, and returns the number of arrays per second
+static double runQueue(int numReceivers, NDArrayQueue *pQueue, epicsMessageQueueId msgQId)
+{
+    QueueBenchReceiver receivers[NUM_RECEIVERS];
+    epicsTimeStamp start, end;
+    NDArray *pArray;
+    char name[20];
+    int i, status;
+
+    for (i = 0; i < numReceivers; i++) {
+        receivers[i].pQueue = pQueue;
+        receivers[i].msgQId = msgQId;
+        receivers[i].doneEvent = epicsEventCreate(epicsEventEmpty);
+        sprintf(name, "queueBench%d", i);
+        epicsThreadCreate(name, epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackMedium),
+                          queueBenchReceiveTask, &receivers[i]);
+    }
+    epicsTimeGetCurrent(&start);
+    for (i = 0; i < NUM_ARRAYS + numReceivers; i++) {
+        // Every receiver gets one stop marker
+        pArray = (i < NUM_ARRAYS) ? (NDArray *)(size_t)(i + 1) : STOP_MARKER;
+        do {
+            if (pQueue) status = pQueue->trySend(pArray);
+            else        status = epicsMessageQueueTrySend(msgQId, &pArray, sizeof(pArray));
+            if (status) epicsThreadSleep(0.);
+        } while (status);
+    }
+    for (i = 0; i < numReceivers; i++) epicsEventWait(receivers[i].doneEvent);
+    epicsTimeGetCurrent(&end);
+    for (i = 0; i < numReceivers; i++) epicsEventDestroy(receivers[i].doneEvent);
+    return NUM_ARRAYS / epicsTimeDiffInSeconds(&end, &start);
+}
+
+BOOST_AUTO_TEST_SUITE(NDArrayQueueBenchmarks)
+
+BOOST_AUTO_TEST_CASE(bench_QueueThroughput)
+{
+    for (int numReceivers = 1; numReceivers <= NUM_RECEIVERS; numReceivers *= 2) {
+        NDArrayQueue queue(QUEUE_SIZE);
+        epicsMessageQueueId msgQId = epicsMessageQueueCreate(QUEUE_SIZE, sizeof(NDArray *));
+        double queueRate = runQueue(numReceivers, &queue, NULL);
+        double msgQRate = runQueue(numReceivers, NULL, msgQId);
+        BOOST_TEST_MESSAGE(numReceivers << " receivers: NDArrayQueue " << queueRate/1e6
+                           << " million arrays/s, epicsMessageQueue " << msgQRate/1e6
+                           << " million arrays/s");
+        epicsMessageQueueDestroy(msgQId);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
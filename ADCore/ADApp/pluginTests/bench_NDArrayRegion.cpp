@@ -0,0 +1,139 @@
+/**
+ * Benchmark of NDArrayRegionCopy, the engine behind NDArrayPool::convert.
+ *
+ * Some typical NDPluginROI regions of a 2048x2048 UInt16 array are copied with
+ * NDArrayPool::convert, with and without threads, and with convertDim, the
+ * recursive element-by-element copy that NDArrayPool::convert used before.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "boost/test/unit_test.hpp"
+
+#include <epicsTime.h>
+#include <NDArray.h>
+#include <NDStripeWorkers.h>
+
+#define NUM_LOOPS 20
+
+/* The recursive copy that NDArrayPool::convert used before NDArrayRegionCopy.
+ * The output must be zeroed first; each output element is the sum of its input elements. */
+template <typename dataTypeIn, typename dataTypeOut>
+static void convertDim(NDArray *pIn, NDArray *pOut, void *pDataIn, void *pDataOut, int dim)
+{
+    dataTypeOut *pDOut = (dataTypeOut *)pDataOut;
+    dataTypeIn *pDIn = (dataTypeIn *)pDataIn;
+    size_t inStep = 1, outStep = 1, inOffset = pOut->dims[dim].offset;
+    int inDir = 1;
+
+    for (int i=0; i<dim; i++) {
+        inStep  *= pIn->dims[i].size;
+        outStep *= pOut->dims[i].size;
+    }
+    if (pOut->dims[dim].reverse) {
+        inOffset += pOut->dims[dim].size * pOut->dims[dim].binning - 1;
+        inDir = -1;
+    }
+    pDIn += inOffset*inStep;
+    for (size_t out=0; out<pOut->dims[dim].size; out++) {
+        for (int bin=0; bin<pOut->dims[dim].binning; bin++) {
+            if (dim > 0) {
+                convertDim<dataTypeIn, dataTypeOut>(pIn, pOut, pDIn, pDOut, dim-1);
+            } else {
+                *pDOut += (dataTypeOut)*pDIn;
+            }
+            pDIn += inDir * (ptrdiff_t)inStep;
+        }
+        pDOut += outStep;
+    }
+}
+
+/* Copies the region of the UInt16 pIn described by pOut->dims into pOut the old way */
+static void referenceCopy(NDArray *pIn, NDArray *pOut)
+{
+    NDArrayInfo_t arrayInfo;
+
+    pOut->getInfo(&arrayInfo);
+    memset(pOut->pData, 0, arrayInfo.totalBytes);
+    switch (pOut->dataType) {
+        case NDUInt16:  convertDim<epicsUInt16, epicsUInt16> (pIn, pOut, pIn->pData, pOut->pData, pIn->ndims-1); break;
+        case NDUInt32:  convertDim<epicsUInt16, epicsUInt32> (pIn, pOut, pIn->pData, pOut->pData, pIn->ndims-1); break;
+        case NDFloat32: convertDim<epicsUInt16, epicsFloat32>(pIn, pOut, pIn->pData, pOut->pData, pIn->ndims-1); break;
+        default: break;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(NDArrayRegionBenchmarks)
+
+BOOST_AUTO_TEST_CASE(bench_RegionThroughput)
+{
+    NDArrayPool pool(10, 0);
+    NDStripeWorkers workers("regionBench");
+    size_t dims[2] = {2048, 2048};
+    NDArray *pIn = pool.alloc(2, dims, NDUInt16, 0, NULL);
+    struct {
+        const char *name;
+        size_t offset, size;
+        int binning, reverse;
+        NDDataType_t dataTypeOut;
+    } regions[] = {
+        {"1024x1024 region",          512, 1024, 1, 0, NDUInt16},
+        {"UInt16 to Float32",           0, 2048, 1, 0, NDFloat32},
+        {"2x2 binning to UInt32",       0, 2048, 2, 0, NDUInt32},
+        {"4x4 binning reversed",        0, 2048, 4, 1, NDUInt16},
+    };
+
+    BOOST_REQUIRE(pIn != NULL);
+    for (size_t i=0; i<dims[0]*dims[1]; i++) ((epicsUInt16 *)pIn->pData)[i] = rand() % 100;
+
+    for (size_t r=0; r<sizeof(regions)/sizeof(regions[0]); r++) {
+        NDDimension_t dimsOut[2];
+        NDArray *pOut;
+        epicsTimeStamp start, end;
+        double regionTime, threadsTime, convertDimTime;
+
+        memset(dimsOut, 0, sizeof(dimsOut));
+        for (int dim=0; dim<2; dim++) {
+            dimsOut[dim].offset = regions[r].offset;
+            dimsOut[dim].size = regions[r].size;
+            dimsOut[dim].binning = regions[r].binning;
+            dimsOut[dim].reverse = regions[r].reverse;
+        }
+        epicsTimeGetCurrent(&start);
+        for (int loop=0; loop<NUM_LOOPS; loop++) {
+            pool.convert(pIn, &pOut, regions[r].dataTypeOut, dimsOut);
+            pOut->release();
+        }
+        epicsTimeGetCurrent(&end);
+        regionTime = epicsTimeDiffInSeconds(&end, &start) / NUM_LOOPS;
+
+        epicsTimeGetCurrent(&start);
+        for (int loop=0; loop<NUM_LOOPS; loop++) {
+            pool.convert(pIn, &pOut, regions[r].dataTypeOut, dimsOut, 1., &workers, 4);
+            pOut->release();
+        }
+        epicsTimeGetCurrent(&end);
+        threadsTime = epicsTimeDiffInSeconds(&end, &start) / NUM_LOOPS;
+
+        pool.convert(pIn, &pOut, regions[r].dataTypeOut, dimsOut);
+        for (int dim=0; dim<2; dim++) {
+            pOut->dims[dim].offset = dimsOut[dim].offset;
+            pOut->dims[dim].binning = dimsOut[dim].binning;
+            pOut->dims[dim].reverse = dimsOut[dim].reverse;
+        }
+        epicsTimeGetCurrent(&start);
+        for (int loop=0; loop<NUM_LOOPS; loop++) referenceCopy(pIn, pOut);
+        epicsTimeGetCurrent(&end);
+        convertDimTime = epicsTimeDiffInSeconds(&end, &start) / NUM_LOOPS;
+        pOut->release();
+
+        BOOST_TEST_MESSAGE(regions[r].name << ": NDArrayRegionCopy " << regionTime*1e3
+                           << " ms, 4 threads " << threadsTime*1e3
+                           << " ms, convertDim " << convertDimTime*1e3 << " ms");
+    }
+    pIn->release();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,136 @@
+/**
+ * Benchmark of NDPluginColorConvert.
+ *
+ * Reports the megapixels per second of each conversion of a 5 MP UInt8 and UInt16 image,
+ * with 1 and 4 ComputeThreads.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD and asyn dependencies
+#include <NDPluginColorConvert.h>
+#include <asynPortDriver.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+#include <asynPortClient.h>
+#include <epicsTime.h>
+
+#include "testingutilities.h"
+
+#define BENCH_X 2448
+#define BENCH_Y 2048
+#define NUM_LOOPS 10
+
+struct ColorConvertBenchFixture
+{
+    NDArrayPool *arrayPool;
+    asynPortDriver *dummy_driver;
+    NDPluginColorConvert *cc;
+    TestingPlugin *ds;
+    asynInt32Client *colorModeOut;
+    asynInt32Client *bayerMode;
+    asynInt32Client *computeThreads;
+
+    ColorConvertBenchFixture()
+    {
+        arrayPool = new NDArrayPool(100, 0);
+
+        std::string dummy_port("simPort"), testport("testPort");
+        uniqueAsynPortName(dummy_port);
+        uniqueAsynPortName(testport);
+
+        // The upstream driver is never used; arrays are passed by calling processCallbacks directly.
+        dummy_driver = new asynPortDriver(dummy_port.c_str(), 0, 1, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 2000000);
+
+        cc = new NDPluginColorConvert(testport.c_str(), 50, 0, dummy_port.c_str(), 0, 0, 0, 0, 2000000);
+
+        // This is the mock downstream plugin
+        ds = new TestingPlugin(testport.c_str(), 0);
+
+        colorModeOut = new asynInt32Client(testport.c_str(), 0, NDPluginColorConvertColorModeOutString);
+        bayerMode = new asynInt32Client(testport.c_str(), 0, NDPluginColorConvertBayerModeString);
+        computeThreads = new asynInt32Client(testport.c_str(), 0, NDPluginColorConvertComputeThreadsString);
+    }
+    ~ColorConvertBenchFixture()
+    {
+        delete computeThreads;
+        delete bayerMode;
+        delete colorModeOut;
+        delete cc;
+        delete dummy_driver;
+        delete arrayPool;
+    }
+    void ccProcess(NDArray *pArray)
+    {
+        cc->lock();
+        cc->processCallbacks(pArray);
+        cc->unlock();
+    }
+    // Allocates an array in the given color mode, with the dimensions in the order of that mode
+    NDArray *makeArray(int colorMode, size_t xSize, size_t ySize, NDDataType_t dataType)
+    {
+        size_t dims[3];
+        int ndims = 3;
+        switch (colorMode) {
+            case NDColorModeRGB1: dims[0] = 3;     dims[1] = xSize; dims[2] = ySize; break;
+            case NDColorModeRGB2: dims[0] = xSize; dims[1] = 3;     dims[2] = ySize; break;
+            case NDColorModeRGB3: dims[0] = xSize; dims[1] = ySize; dims[2] = 3;     break;
+            default:              dims[0] = xSize; dims[1] = ySize; ndims = 2;       break;
+        }
+        NDArray *pArray = arrayPool->alloc(ndims, dims, dataType, 0, NULL);
+        pArray->pAttributeList->add("ColorMode", "Color mode", NDAttrInt32, &colorMode);
+        return pArray;
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(ColorConvertBenchmarks, ColorConvertBenchFixture)
+
+BOOST_AUTO_TEST_CASE(bench_ConversionThroughput)
+{
+    struct {
+        const char *name;
+        int colorModeIn, colorModeOut, bayerMode;
+    } conversions[] = {
+        {"Bayer to RGB1 bilinear",   NDColorModeBayer, NDColorModeRGB1, 0},
+        {"Bayer to RGB1 edge-aware", NDColorModeBayer, NDColorModeRGB1, 1},
+        {"Bayer to RGB3 bilinear",   NDColorModeBayer, NDColorModeRGB3, 0},
+        {"Mono to RGB1",             NDColorModeMono,  NDColorModeRGB1, 0},
+        {"RGB1 to Mono",             NDColorModeRGB1,  NDColorModeMono, 0},
+        {"RGB1 to RGB3",             NDColorModeRGB1,  NDColorModeRGB3, 0},
+        {"RGB3 to RGB1",             NDColorModeRGB3,  NDColorModeRGB1, 0},
+        {"RGB2 to Mono",             NDColorModeRGB2,  NDColorModeMono, 0},
+    };
+    NDDataType_t dataTypes[] = {NDUInt8, NDUInt16};
+    int threads[] = {1, 4};
+
+    for (int d=0; d<2; d++) {
+        for (size_t k=0; k<sizeof(conversions)/sizeof(conversions[0]); k++) {
+            NDArray *pArray = makeArray(conversions[k].colorModeIn, BENCH_X, BENCH_Y, dataTypes[d]);
+            NDArrayInfo_t arrayInfo;
+            double rate[2];
+            int pattern = NDBayerRGGB;
+
+            pArray->getInfo(&arrayInfo);
+            for (size_t i=0; i<arrayInfo.totalBytes; i++) ((epicsUInt8 *)pArray->pData)[i] = (epicsUInt8)(i*13 + i/4099);
+            pArray->pAttributeList->add("BayerPattern", "Bayer pattern", NDAttrInt32, &pattern);
+            colorModeOut->write(conversions[k].colorModeOut);
+            bayerMode->write(conversions[k].bayerMode);
+            for (int t=0; t<2; t++) {
+                epicsTimeStamp start, end;
+                computeThreads->write(threads[t]);
+                ccProcess(pArray);
+                epicsTimeGetCurrent(&start);
+                for (int loop=0; loop<NUM_LOOPS; loop++) ccProcess(pArray);
+                epicsTimeGetCurrent(&end);
+                rate[t] = (double)BENCH_X * BENCH_Y * NUM_LOOPS / epicsTimeDiffInSeconds(&end, &start) / 1e6;
+            }
+            BOOST_TEST_MESSAGE((dataTypes[d] == NDUInt8 ? "UInt8 " : "UInt16 ") << conversions[k].name << ": "
+                               << rate[0] << " MP/s, 4 threads " << rate[1] << " MP/s");
+            pArray->release();
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
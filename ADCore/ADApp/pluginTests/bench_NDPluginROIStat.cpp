@@ -0,0 +1,122 @@
+/**
+ * Benchmark of NDPluginROIStat.
+ *
+ * Reports the arrays per second for 1, 4 and 16 overlapping ROIs of a 2048x2048 UInt16
+ * array, with 1 and 4 ComputeThreads.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD and asyn dependencies
+#include <NDPluginROIStat.h>
+#include <asynPortDriver.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+#include <asynPortClient.h>
+#include <epicsTime.h>
+
+#include "testingutilities.h"
+
+#define BENCH_SIZE 2048
+#define NUM_ROIS 16
+#define NUM_LOOPS 10
+
+struct ROIStatBenchFixture
+{
+    NDArrayPool *arrayPool;
+    asynPortDriver *dummy_driver;
+    NDPluginROIStat *roiStat;
+    asynInt32Client *computeThreads;
+    asynInt32Client *use[NUM_ROIS];
+    asynInt32Client *dim0Min[NUM_ROIS];
+    asynInt32Client *dim0Size[NUM_ROIS];
+    asynInt32Client *dim1Min[NUM_ROIS];
+    asynInt32Client *dim1Size[NUM_ROIS];
+    asynInt32Client *bgdWidth[NUM_ROIS];
+
+    ROIStatBenchFixture()
+    {
+        arrayPool = new NDArrayPool(100, 0);
+
+        std::string dummy_port("simPort"), testport("testPort");
+        uniqueAsynPortName(dummy_port);
+        uniqueAsynPortName(testport);
+
+        // The upstream driver is never used; arrays are passed by calling processCallbacks directly.
+        dummy_driver = new asynPortDriver(dummy_port.c_str(), 0, 1, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 2000000);
+
+        roiStat = new NDPluginROIStat(testport.c_str(), 50, 0, dummy_port.c_str(), 0, NUM_ROIS, 0, 0, 0, 2000000);
+
+        computeThreads = new asynInt32Client(testport.c_str(), 0, NDPluginROIStatComputeThreadsString);
+        for (int roi=0; roi<NUM_ROIS; roi++) {
+            use[roi] = new asynInt32Client(testport.c_str(), roi, NDPluginROIStatUseString);
+            dim0Min[roi] = new asynInt32Client(testport.c_str(), roi, NDPluginROIStatDim0MinString);
+            dim0Size[roi] = new asynInt32Client(testport.c_str(), roi, NDPluginROIStatDim0SizeString);
+            dim1Min[roi] = new asynInt32Client(testport.c_str(), roi, NDPluginROIStatDim1MinString);
+            dim1Size[roi] = new asynInt32Client(testport.c_str(), roi, NDPluginROIStatDim1SizeString);
+            bgdWidth[roi] = new asynInt32Client(testport.c_str(), roi, NDPluginROIStatBgdWidthString);
+        }
+    }
+    ~ROIStatBenchFixture()
+    {
+        for (int roi=0; roi<NUM_ROIS; roi++) {
+            delete bgdWidth[roi];
+            delete dim1Size[roi];
+            delete dim1Min[roi];
+            delete dim0Size[roi];
+            delete dim0Min[roi];
+            delete use[roi];
+        }
+        delete computeThreads;
+        delete roiStat;
+        delete dummy_driver;
+        delete arrayPool;
+    }
+    void roiStatProcess(NDArray *pArray)
+    {
+        roiStat->lock();
+        roiStat->processCallbacks(pArray);
+        roiStat->unlock();
+    }
+    void setROI(int roi, int x, int sizeX, int y, int sizeY, int width)
+    {
+        dim0Min[roi]->write(x);
+        dim0Size[roi]->write(sizeX);
+        dim1Min[roi]->write(y);
+        dim1Size[roi]->write(sizeY);
+        bgdWidth[roi]->write(width);
+        use[roi]->write(1);
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(ROIStatBenchmarks, ROIStatBenchFixture)
+
+BOOST_AUTO_TEST_CASE(bench_ROIThroughput)
+{
+    size_t dims[2] = {BENCH_SIZE, BENCH_SIZE};
+    NDArray *pArray = arrayPool->alloc(2, dims, NDUInt16, 0, NULL);
+    epicsUInt16 *pData = (epicsUInt16 *)pArray->pData;
+    int threads[] = {1, 4};
+
+    for (size_t i=0; i<(size_t)BENCH_SIZE*BENCH_SIZE; i++) pData[i] = (epicsUInt16)(i*13 + i/4099);
+    for (int numROIs=1; numROIs<=NUM_ROIS; numROIs*=4) {
+        double rate[2];
+        // 1024x1024 ROIs on a 4x4 grid with 300 pixel spacing, so that neighbouring ROIs overlap
+        for (int roi=0; roi<numROIs; roi++) setROI(roi, (roi%4)*300, 1024, (roi/4)*300, 1024, 4);
+        for (int t=0; t<2; t++) {
+            epicsTimeStamp start, end;
+            computeThreads->write(threads[t]);
+            roiStatProcess(pArray);
+            epicsTimeGetCurrent(&start);
+            for (int loop=0; loop<NUM_LOOPS; loop++) roiStatProcess(pArray);
+            epicsTimeGetCurrent(&end);
+            rate[t] = (double)NUM_LOOPS / epicsTimeDiffInSeconds(&end, &start);
+        }
+        BOOST_TEST_MESSAGE(numROIs << " ROIs: " << rate[0] << " arrays/s, 4 threads " << rate[1] << " arrays/s");
+    }
+    pArray->release();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
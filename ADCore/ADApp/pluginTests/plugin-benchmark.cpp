@@ -0,0 +1,11 @@
+/** plugin-benchmark.cpp
+ * 
+ *  This file defines the basic level of the boost unittest system for the
+ *  plugin benchmarks. The benchmarks only report timings, they do not check
+ *  them, so they are kept out of plugin-test and run on request.
+ */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE "NDPlugin Benchmarks"
+#include <boost/test/unit_test.hpp>
+
@@ -0,0 +1,99 @@
+/**
+ * Stress tests for NDArrayPool reference counting.
+ *
+ * Several threads reserve and release NDArrays concurrently, as plugins do
+ * when one driver fans out to many plugins. The tests check that no reference
+ * is lost.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <NDArray.h>
+
+#define NUM_RESERVE_RELEASE 1000000
+#define MAX_THREADS 8
+
+struct ReserveReleaseThread
+{
+    NDArray *pArray;
+    int numLoops;
+    epicsEventId startEvent;
+    epicsEventId doneEvent;
+};
+
+static void reserveReleaseTask(void *drvPvt)
+{
+    ReserveReleaseThread *pThread = (ReserveReleaseThread *)drvPvt;
+
+    epicsEventWait(pThread->startEvent);
+    for (int i = 0; i < pThread->numLoops; i++) {
+        pThread->pArray->reserve();
+        pThread->pArray->release();
+    }
+    epicsEventSignal(pThread->doneEvent);
+}
+
+struct NDArrayPoolFixture
+{
+    NDArrayPool *arrayPool;
+    ReserveReleaseThread threads[MAX_THREADS];
+
+    NDArrayPoolFixture()
+    {
+        arrayPool = new NDArrayPool(100, 0);
+        for (int i = 0; i < MAX_THREADS; i++) {
+            threads[i].startEvent = epicsEventCreate(epicsEventEmpty);
+            threads[i].doneEvent = epicsEventCreate(epicsEventEmpty);
+        }
+    }
+    ~NDArrayPoolFixture()
+    {
+        for (int i = 0; i < MAX_THREADS; i++) {
+            epicsEventDestroy(threads[i].startEvent);
+            epicsEventDestroy(threads[i].doneEvent);
+        }
+        delete arrayPool;
+    }
+
+    // Runs numThreads threads that each reserve and release pArrays[thread] numLoops times
+    void run(int numThreads, NDArray **pArrays, int numLoops)
+    {
+        char name[20];
+
+        for (int i = 0; i < numThreads; i++) {
+            threads[i].pArray = pArrays[i];
+            threads[i].numLoops = numLoops;
+            sprintf(name, "reserveRelease%d", i);
+            epicsThreadCreate(name, epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackMedium),
+                              reserveReleaseTask, &threads[i]);
+        }
+        for (int i = 0; i < numThreads; i++) epicsEventSignal(threads[i].startEvent);
+        for (int i = 0; i < numThreads; i++) epicsEventWait(threads[i].doneEvent);
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDArrayPoolTests, NDArrayPoolFixture)
+
+BOOST_AUTO_TEST_CASE(test_SharedArrayReferenceCount)
+{
+    size_t dims[2] = {64, 64};
+    NDArray *pArray = arrayPool->alloc(2, dims, NDUInt16, 0, NULL);
+    NDArray *pArrays[MAX_THREADS];
+    BOOST_REQUIRE(pArray != NULL);
+
+    for (int i = 0; i < MAX_THREADS; i++) pArrays[i] = pArray;
+    run(MAX_THREADS, pArrays, NUM_RESERVE_RELEASE/MAX_THREADS);
+
+    // The only remaining reference is the one from alloc(), so releasing it must
+    // put the array back on the free list
+    int numFree = arrayPool->numFree();
+    pArray->release();
+    BOOST_CHECK_EQUAL(numFree + 1, arrayPool->numFree());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
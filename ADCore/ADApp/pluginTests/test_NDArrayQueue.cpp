@@ -0,0 +1,141 @@
+/**
+ * Tests for NDArrayQueue, the queue between NDPluginDriver::driverCallback and
+ * the plugin threads.
+ *
+ * The queue only passes pointers around, so the tests use small integers cast to
+ * NDArray pointers rather than real arrays.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "boost/test/unit_test.hpp"
+
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <NDArrayQueue.h>
+
+#define NUM_ARRAYS 200000
+#define NUM_RECEIVERS 4
+#define QUEUE_SIZE 20
+
+static NDArray *toArray(int i)
+{
+    return (NDArray *)(size_t)(i + 1);
+}
+
+static int fromArray(NDArray *pArray)
+{
+    return (int)(size_t)pArray - 1;
+}
+
+struct QueueReceiver
+{
+    NDArrayQueue *pQueue;
+    int *counts;
+    epicsEventId doneEvent;
+};
+
+// Receives from the queue until it gets the stop marker, counting each array it receives
+static void queueReceiveTask(void *drvPvt)
+{
+    QueueReceiver *pReceiver = (QueueReceiver *)drvPvt;
+    NDArray *pArray;
+    int i;
+
+    while (1) {
+        pArray = pReceiver->pQueue->receive();
+        i = fromArray(pArray);
+        if (i == NUM_ARRAYS) break;
+        __sync_fetch_and_add(&pReceiver->counts[i], 1);
+    }
+    epicsEventSignal(pReceiver->doneEvent);
+}
+
+struct NDArrayQueueFixture
+{
+    int *counts;
+    QueueReceiver receivers[NUM_RECEIVERS];
+
+    NDArrayQueueFixture()
+    {
+        counts = new int[NUM_ARRAYS];
+        memset(counts, 0, NUM_ARRAYS*sizeof(int));
+        for (int i = 0; i < NUM_RECEIVERS; i++) {
+            receivers[i].counts = counts;
+            receivers[i].doneEvent = epicsEventCreate(epicsEventEmpty);
+        }
+    }
+    ~NDArrayQueueFixture()
+    {
+        for (int i = 0; i < NUM_RECEIVERS; i++) epicsEventDestroy(receivers[i].doneEvent);
+        delete [] counts;
+    }
+
+    // Sends NUM_ARRAYS arrays through pQueue to numReceivers threads
+    void run(int numReceivers, NDArrayQueue *pQueue)
+    {
+        NDArray *pArray;
+        char name[20];
+        int i, status;
+
+        for (i = 0; i < numReceivers; i++) {
+            receivers[i].pQueue = pQueue;
+            sprintf(name, "queueReceive%d", i);
+            epicsThreadCreate(name, epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackMedium),
+                              queueReceiveTask, &receivers[i]);
+        }
+        for (i = 0; i < NUM_ARRAYS + numReceivers; i++) {
+            // Every receiver gets one stop marker
+            pArray = toArray(i < NUM_ARRAYS ? i : NUM_ARRAYS);
+            do {
+                status = pQueue->trySend(pArray);
+                if (status) epicsThreadSleep(0.);
+            } while (status);
+        }
+        for (i = 0; i < numReceivers; i++) epicsEventWait(receivers[i].doneEvent);
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDArrayQueueTests, NDArrayQueueFixture)
+
+BOOST_AUTO_TEST_CASE(test_CapacityAndOrder)
+{
+    // The capacity is not a power of 2, so the ring is larger than the queue
+    NDArrayQueue queue(5);
+    int i;
+
+    for (i = 0; i < 5; i++) BOOST_CHECK_EQUAL(0, queue.trySend(toArray(i)));
+    BOOST_CHECK_EQUAL(-1, queue.trySend(toArray(5)));
+    BOOST_CHECK_EQUAL(5, queue.pending());
+    BOOST_CHECK_EQUAL(5, queue.highWater());
+    for (i = 0; i < 5; i++) BOOST_CHECK_EQUAL(i, fromArray(queue.receive()));
+    BOOST_CHECK(queue.tryReceive() == NULL);
+    BOOST_CHECK_EQUAL(0, queue.pending());
+    queue.resetHighWater();
+    BOOST_CHECK_EQUAL(0, queue.highWater());
+
+    // Wrap around the ring several times
+    for (i = 0; i < 100; i++) {
+        BOOST_CHECK_EQUAL(0, queue.trySend(toArray(i)));
+        BOOST_CHECK_EQUAL(i, fromArray(queue.tryReceive()));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_MultipleReceivers)
+{
+    NDArrayQueue queue(QUEUE_SIZE);
+
+    run(NUM_RECEIVERS, &queue);
+    // Every array must have been received exactly once
+    int numWrong = 0;
+    for (int i = 0; i < NUM_ARRAYS; i++) {
+        if (counts[i] != 1) numWrong++;
+    }
+    BOOST_CHECK_EQUAL(0, numWrong);
+    BOOST_CHECK_EQUAL(0, queue.pending());
+    BOOST_TEST_MESSAGE("wakeups for " << NUM_ARRAYS << " arrays: " << queue.wakeups());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
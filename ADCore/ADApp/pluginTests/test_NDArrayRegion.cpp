@@ -0,0 +1,236 @@
+/**
+ * Tests for NDArrayRegionCopy, the engine behind NDArrayPool::convert.
+ *
+ * The regions are compared with convertDim, the recursive element-by-element
+ * copy that NDArrayPool::convert used before, for random sizes, offsets, binning,
+ * reversal, data types and scales, with and without threads.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "boost/test/unit_test.hpp"
+
+#include <NDArray.h>
+#include <NDArrayRegion.h>
+#include <NDStripeWorkers.h>
+
+#define NUM_REGIONS 500
+
+/* The recursive copy that NDArrayPool::convert used before NDArrayRegionCopy.
+ * The output must be zeroed first; each output element is the sum of its input elements. */
+template <typename dataTypeIn, typename dataTypeOut>
+static void convertDim(NDArray *pIn, NDArray *pOut, void *pDataIn, void *pDataOut, int dim)
+{
+    dataTypeOut *pDOut = (dataTypeOut *)pDataOut;
+    dataTypeIn *pDIn = (dataTypeIn *)pDataIn;
+    size_t inStep = 1, outStep = 1, inOffset = pOut->dims[dim].offset;
+    int inDir = 1;
+
+    for (int i=0; i<dim; i++) {
+        inStep  *= pIn->dims[i].size;
+        outStep *= pOut->dims[i].size;
+    }
+    if (pOut->dims[dim].reverse) {
+        inOffset += pOut->dims[dim].size * pOut->dims[dim].binning - 1;
+        inDir = -1;
+    }
+    pDIn += inOffset*inStep;
+    for (size_t out=0; out<pOut->dims[dim].size; out++) {
+        for (int bin=0; bin<pOut->dims[dim].binning; bin++) {
+            if (dim > 0) {
+                convertDim<dataTypeIn, dataTypeOut>(pIn, pOut, pDIn, pDOut, dim-1);
+            } else {
+                *pDOut += (dataTypeOut)*pDIn;
+            }
+            pDIn += inDir * (ptrdiff_t)inStep;
+        }
+        pDOut += outStep;
+    }
+}
+
+template <typename dataTypeOut>
+static void convertDimSwitch(NDArray *pIn, NDArray *pOut)
+{
+    switch (pIn->dataType) {
+        case NDInt8:    convertDim<epicsInt8,    dataTypeOut>(pIn, pOut, pIn->pData, pOut->pData, pIn->ndims-1); break;
+        case NDUInt8:   convertDim<epicsUInt8,   dataTypeOut>(pIn, pOut, pIn->pData, pOut->pData, pIn->ndims-1); break;
+        case NDInt16:   convertDim<epicsInt16,   dataTypeOut>(pIn, pOut, pIn->pData, pOut->pData, pIn->ndims-1); break;
+        case NDUInt16:  convertDim<epicsUInt16,  dataTypeOut>(pIn, pOut, pIn->pData, pOut->pData, pIn->ndims-1); break;
+        case NDInt32:   convertDim<epicsInt32,   dataTypeOut>(pIn, pOut, pIn->pData, pOut->pData, pIn->ndims-1); break;
+        case NDUInt32:  convertDim<epicsUInt32,  dataTypeOut>(pIn, pOut, pIn->pData, pOut->pData, pIn->ndims-1); break;
+        case NDFloat32: convertDim<epicsFloat32, dataTypeOut>(pIn, pOut, pIn->pData, pOut->pData, pIn->ndims-1); break;
+        case NDFloat64: convertDim<epicsFloat64, dataTypeOut>(pIn, pOut, pIn->pData, pOut->pData, pIn->ndims-1); break;
+        default: break;
+    }
+}
+
+/* Copies the region of pIn described by pOut->dims into pOut the old way */
+static void referenceCopy(NDArray *pIn, NDArray *pOut)
+{
+    NDArrayInfo_t arrayInfo;
+
+    pOut->getInfo(&arrayInfo);
+    memset(pOut->pData, 0, arrayInfo.totalBytes);
+    switch (pOut->dataType) {
+        case NDInt8:    convertDimSwitch<epicsInt8>   (pIn, pOut); break;
+        case NDUInt8:   convertDimSwitch<epicsUInt8>  (pIn, pOut); break;
+        case NDInt16:   convertDimSwitch<epicsInt16>  (pIn, pOut); break;
+        case NDUInt16:  convertDimSwitch<epicsUInt16> (pIn, pOut); break;
+        case NDInt32:   convertDimSwitch<epicsInt32>  (pIn, pOut); break;
+        case NDUInt32:  convertDimSwitch<epicsUInt32> (pIn, pOut); break;
+        case NDFloat32: convertDimSwitch<epicsFloat32>(pIn, pOut); break;
+        case NDFloat64: convertDimSwitch<epicsFloat64>(pIn, pOut); break;
+        default: break;
+    }
+}
+
+static double getValue(NDArray *pArray, size_t i)
+{
+    switch (pArray->dataType) {
+        case NDInt8:    return ((epicsInt8 *)   pArray->pData)[i];
+        case NDUInt8:   return ((epicsUInt8 *)  pArray->pData)[i];
+        case NDInt16:   return ((epicsInt16 *)  pArray->pData)[i];
+        case NDUInt16:  return ((epicsUInt16 *) pArray->pData)[i];
+        case NDInt32:   return ((epicsInt32 *)  pArray->pData)[i];
+        case NDUInt32:  return ((epicsUInt32 *) pArray->pData)[i];
+        case NDFloat32: return ((epicsFloat32 *)pArray->pData)[i];
+        default:        return ((epicsFloat64 *)pArray->pData)[i];
+    }
+}
+
+/* Converts a double to dataType and back, as storing it in an array of that type would */
+static double castValue(double value, NDDataType_t dataType)
+{
+    switch (dataType) {
+        case NDInt8:    return (epicsInt8)value;
+        case NDUInt8:   return (epicsUInt8)value;
+        case NDInt16:   return (epicsInt16)value;
+        case NDUInt16:  return (epicsUInt16)value;
+        case NDInt32:   return (epicsInt32)value;
+        case NDUInt32:  return (epicsUInt32)value;
+        case NDFloat32: return (epicsFloat32)value;
+        default:        return value;
+    }
+}
+
+static NDArray *makeArray(NDArrayPool *pPool, int ndims, size_t *dims, NDDataType_t dataType)
+{
+    NDArray *pArray = pPool->alloc(ndims, dims, dataType, 0, NULL);
+    NDArrayInfo_t arrayInfo;
+
+    pArray->getInfo(&arrayInfo);
+    for (size_t i=0; i<arrayInfo.nElements; i++) {
+        double value = rand() % 100;
+        if ((dataType == NDFloat32) || (dataType == NDFloat64)) value += 0.25;
+        switch (dataType) {
+            case NDInt8:    ((epicsInt8 *)   pArray->pData)[i] = (epicsInt8)value;    break;
+            case NDUInt8:   ((epicsUInt8 *)  pArray->pData)[i] = (epicsUInt8)value;   break;
+            case NDInt16:   ((epicsInt16 *)  pArray->pData)[i] = (epicsInt16)value;   break;
+            case NDUInt16:  ((epicsUInt16 *) pArray->pData)[i] = (epicsUInt16)value;  break;
+            case NDInt32:   ((epicsInt32 *)  pArray->pData)[i] = (epicsInt32)value;   break;
+            case NDUInt32:  ((epicsUInt32 *) pArray->pData)[i] = (epicsUInt32)value;  break;
+            case NDFloat32: ((epicsFloat32 *)pArray->pData)[i] = (epicsFloat32)value; break;
+            default:        ((epicsFloat64 *)pArray->pData)[i] = value;               break;
+        }
+    }
+    return pArray;
+}
+
+BOOST_AUTO_TEST_SUITE(NDArrayRegionTests)
+
+BOOST_AUTO_TEST_CASE(test_RegionMatchesConvertDim)
+{
+    NDArrayPool pool(10, 0);
+    NDStripeWorkers workers("regionTest");
+    int numWrong = 0;
+
+    srand(1);
+    for (int region=0; region<NUM_REGIONS; region++) {
+        int ndims = 1 + rand()%3;
+        size_t dims[3];
+        NDDimension_t dimsOut[3];
+        for (int dim=0; dim<ndims; dim++) dims[dim] = 1 + rand()%(dim == 0 ? 70 : 40);
+        if (rand()%4 == 0) dims[0] = 3;
+        /* Some regions are large enough to be divided between threads */
+        if ((ndims > 1) && (rand()%5 == 0)) {
+            dims[0] = 300 + rand()%200;
+            dims[1] = 200 + rand()%200;
+        }
+        NDDataType_t dataTypeIn = (NDDataType_t)(rand()%8);
+        NDDataType_t dataTypeOut = (NDDataType_t)(rand()%8);
+        double scale = (rand()%3 == 0) ? 0.5 + rand()%4 : 1.;
+        int numThreads = 1 + rand()%4;
+
+        memset(dimsOut, 0, sizeof(dimsOut));
+        for (int dim=0; dim<ndims; dim++) {
+            size_t offset = rand() % dims[dim];
+            size_t size = 1 + rand() % (dims[dim] - offset);
+            int binning = 1 + rand()%3;
+            if (rand()%3 == 0) {
+                offset = 0;
+                size = dims[dim];
+            }
+            if (size < (size_t)binning) binning = 1;
+            dimsOut[dim].offset = offset;
+            dimsOut[dim].size = size;
+            dimsOut[dim].binning = binning;
+            dimsOut[dim].reverse = (rand()%4 == 0);
+        }
+
+        NDArray *pIn = makeArray(&pool, ndims, dims, dataTypeIn);
+        NDArray *pOut, *pRef;
+        pool.convert(pIn, &pOut, dataTypeOut, dimsOut, scale, &workers, numThreads);
+        BOOST_REQUIRE(pOut != NULL);
+        /* The reference sums in double when scaling, then divides and converts */
+        pool.convert(pIn, &pRef, (scale != 1.) ? NDFloat64 : dataTypeOut, dimsOut);
+        for (int dim=0; dim<ndims; dim++) {
+            pRef->dims[dim].offset = dimsOut[dim].offset;
+            pRef->dims[dim].binning = dimsOut[dim].binning;
+            pRef->dims[dim].reverse = dimsOut[dim].reverse;
+        }
+        referenceCopy(pIn, pRef);
+
+        NDArrayInfo_t arrayInfo;
+        pOut->getInfo(&arrayInfo);
+        for (size_t i=0; i<arrayInfo.nElements; i++) {
+            double expected = getValue(pRef, i);
+            if (scale != 1.) expected = castValue(expected/scale, dataTypeOut);
+            if (getValue(pOut, i) != expected) numWrong++;
+        }
+        pIn->release();
+        pOut->release();
+        pRef->release();
+    }
+    BOOST_CHECK_EQUAL(0, numWrong);
+}
+
+BOOST_AUTO_TEST_CASE(test_ScaleAvoidsTruncation)
+{
+    NDArrayPool pool(10, 0);
+    size_t dims[2] = {30, 30};
+    NDDimension_t dimsOut[2];
+    NDArray *pIn = pool.alloc(2, dims, NDUInt8, 0, NULL);
+    NDArray *pOut;
+
+    memset(pIn->pData, 1, 30*30);
+    memset(dimsOut, 0, sizeof(dimsOut));
+    for (int dim=0; dim<2; dim++) {
+        dimsOut[dim].size = 30;
+        dimsOut[dim].binning = 3;
+    }
+    /* All pixels=1 binned 3x3 and divided by 9 must still be 1 */
+    pool.convert(pIn, &pOut, NDUInt8, dimsOut, 9.);
+    BOOST_REQUIRE_EQUAL((size_t)10, pOut->dims[0].size);
+    BOOST_REQUIRE_EQUAL((size_t)10, pOut->dims[1].size);
+    int numWrong = 0;
+    for (int i=0; i<100; i++) {
+        if (((epicsUInt8 *)pOut->pData)[i] != 1) numWrong++;
+    }
+    BOOST_CHECK_EQUAL(0, numWrong);
+    pIn->release();
+    pOut->release();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
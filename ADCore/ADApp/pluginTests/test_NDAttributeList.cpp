@@ -0,0 +1,184 @@
+/**
+ * Tests for the hash index and the attribute pool of NDAttributeList.
+ *
+ * The copy tests check that copying a list into a cleared list again reuses the
+ * attributes of the previous copy, which is what NDArrayPool::copy does for every frame,
+ * and that a reused attribute takes the description and source of the one copied.
+ */
+
+#include <stdio.h>
+#include <string>
+
+#include "boost/test/unit_test.hpp"
+
+#include <epicsTime.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <NDAttributeList.h>
+
+#define NUM_ATTRIBUTES 200
+#define NUM_COPIES 10000
+
+struct NDAttributeListFixture
+{
+    NDAttributeList *pSource;
+
+    NDAttributeListFixture()
+    {
+        char name[20];
+        pSource = new NDAttributeList();
+        for (int i = 0; i < NUM_ATTRIBUTES; i++) {
+            epicsFloat64 value = i;
+            sprintf(name, "Attribute%d", i);
+            pSource->add(name, "", NDAttrFloat64, &value);
+        }
+    }
+    ~NDAttributeListFixture()
+    {
+        delete pSource;
+    }
+};
+
+struct CopyThread
+{
+    NDAttributeList *pFrom;
+    NDAttributeList *pTo;
+    epicsEventId doneEvent;
+};
+
+static void copyTask(void *drvPvt)
+{
+    CopyThread *pThread = (CopyThread *)drvPvt;
+
+    for (int copy = 0; copy < NUM_COPIES; copy++) {
+        pThread->pFrom->copy(pThread->pTo);
+    }
+    epicsEventSignal(pThread->doneEvent);
+}
+
+BOOST_FIXTURE_TEST_SUITE(NDAttributeListTests, NDAttributeListFixture)
+
+BOOST_AUTO_TEST_CASE(test_FindAndRemove)
+{
+    char name[20];
+    epicsFloat64 value;
+    int numWrong = 0;
+
+    BOOST_CHECK_EQUAL(NUM_ATTRIBUTES, pSource->count());
+    for (int i = 0; i < NUM_ATTRIBUTES; i++) {
+        sprintf(name, "Attribute%d", i);
+        NDAttribute *pAttribute = pSource->find(name);
+        if (!pAttribute) {
+            numWrong++;
+            continue;
+        }
+        pAttribute->getValue(NDAttrFloat64, &value);
+        if (value != i) numWrong++;
+    }
+    BOOST_CHECK_EQUAL(0, numWrong);
+    BOOST_CHECK(pSource->find("attribute1") == NULL);
+
+    BOOST_CHECK_EQUAL(ND_SUCCESS, pSource->remove("Attribute7"));
+    BOOST_CHECK_EQUAL(ND_ERROR, pSource->remove("Attribute7"));
+    BOOST_CHECK(pSource->find("Attribute7") == NULL);
+    BOOST_CHECK(pSource->find("Attribute8") != NULL);
+    BOOST_CHECK_EQUAL(NUM_ATTRIBUTES-1, pSource->count());
+
+    // Adding the attribute again takes it from the pool with its new properties
+    value = -1.;
+    pSource->add("Attribute7", "Again", NDAttrFloat64, &value);
+    NDAttribute *pAttribute = pSource->find("Attribute7");
+    BOOST_REQUIRE(pAttribute != NULL);
+    BOOST_CHECK_EQUAL(std::string("Again"), pAttribute->getDescription());
+    pAttribute->getValue(NDAttrFloat64, &value);
+    BOOST_CHECK_EQUAL(-1., value);
+
+    pSource->clear();
+    BOOST_CHECK_EQUAL(0, pSource->count());
+    BOOST_CHECK(pSource->find("Attribute8") == NULL);
+}
+
+BOOST_AUTO_TEST_CASE(test_CopyReusesAttributes)
+{
+    NDAttributeList output;
+    NDAttribute *firstCopy[NUM_ATTRIBUTES];
+    NDAttribute *pAttribute;
+    epicsTimeStamp start, end;
+    int i, numReused = 0;
+
+    pSource->copy(&output);
+    BOOST_CHECK_EQUAL(NUM_ATTRIBUTES, output.count());
+    for (i = 0, pAttribute = output.next(NULL); pAttribute; pAttribute = output.next(pAttribute)) {
+        firstCopy[i++] = pAttribute;
+    }
+
+    epicsTimeGetCurrent(&start);
+    for (int copy = 0; copy < NUM_COPIES; copy++) {
+        output.clear();
+        pSource->copy(&output);
+    }
+    epicsTimeGetCurrent(&end);
+
+    BOOST_CHECK_EQUAL(NUM_ATTRIBUTES, output.count());
+    for (i = 0, pAttribute = output.next(NULL); pAttribute; pAttribute = output.next(pAttribute)) {
+        if (pAttribute == firstCopy[i++]) numReused++;
+    }
+    BOOST_CHECK_EQUAL(NUM_ATTRIBUTES, numReused);
+    BOOST_TEST_MESSAGE("clear and copy of " << NUM_ATTRIBUTES << " attributes: "
+                       << epicsTimeDiffInSeconds(&end, &start) / NUM_COPIES * 1e6 << " us");
+}
+
+BOOST_AUTO_TEST_CASE(test_CopyReplacesPooledProperties)
+{
+    NDAttributeList first, second, output;
+    NDAttrSource_t sourceType;
+    epicsFloat64 value = 1.;
+
+    // Two attributes with the same name but a different description and source
+    first.add(new NDAttribute("Shared", "First", NDAttrSourceEPICSPV, "PV:First", NDAttrFloat64, &value));
+    value = 2.;
+    second.add(new NDAttribute("Shared", "Second", NDAttrSourceParam, "SECOND", NDAttrFloat64, &value));
+
+    first.copy(&output);
+    NDAttribute *pPooled = output.find("Shared");
+    BOOST_REQUIRE(pPooled != NULL);
+    output.clear();
+
+    // The copy takes the attribute from the pool, and must give it the properties of the new one
+    second.copy(&output);
+    NDAttribute *pAttribute = output.find("Shared");
+    BOOST_REQUIRE(pAttribute != NULL);
+    BOOST_CHECK(pAttribute == pPooled);
+    BOOST_CHECK_EQUAL(std::string("Second"), pAttribute->getDescription());
+    BOOST_CHECK_EQUAL(std::string("SECOND"), pAttribute->getSource());
+    BOOST_CHECK_EQUAL(std::string("NDAttrSourceParam"), pAttribute->getSourceInfo(&sourceType));
+    BOOST_CHECK_EQUAL(NDAttrSourceParam, sourceType);
+    pAttribute->getValue(NDAttrFloat64, &value);
+    BOOST_CHECK_EQUAL(2., value);
+}
+
+BOOST_AUTO_TEST_CASE(test_CopyBothWays)
+{
+    NDAttributeList other;
+    CopyThread threads[2];
+
+    // Copies in opposite directions between the same two lists must not deadlock
+    threads[0].pFrom = pSource;
+    threads[0].pTo = &other;
+    threads[1].pFrom = &other;
+    threads[1].pTo = pSource;
+    for (int i = 0; i < 2; i++) {
+        threads[i].doneEvent = epicsEventCreate(epicsEventEmpty);
+        epicsThreadCreate(i ? "copyBack" : "copyForward", epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackMedium),
+                          copyTask, &threads[i]);
+    }
+    for (int i = 0; i < 2; i++) {
+        BOOST_REQUIRE_EQUAL(epicsEventWaitOK, epicsEventWaitWithTimeout(threads[i].doneEvent, 60.0));
+        epicsEventDestroy(threads[i].doneEvent);
+    }
+    BOOST_CHECK_EQUAL(NUM_ATTRIBUTES, other.count());
+    BOOST_CHECK_EQUAL(NUM_ATTRIBUTES, pSource->count());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -19,6 +19,12 @@ using namespace std;
 #include "testingutilities.h"
 #include "asynPortDriver.h"
 #include "HDF5PluginWrapper.h"
+#include <hdf5.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
 
 struct NDFileHDF5TestFixture
 {
@@ -110,5 +116,307 @@ BOOST_AUTO_TEST_CASE(test_Capture)
 
 }
 
+BOOST_AUTO_TEST_CASE(test_DirectChunkAndBatching)
+{
+  size_t tmpdims[] = {4,6};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+  const int numFrames = 10;
+
+  // Create some test arrays, each filled with its own frame number
+  std::vector<NDArray*>arrays(numFrames);
+  fillNDArraysWithFrameNumber(dims, NDUInt32, arrays);
+
+  // Configure the HDF5 plugin for direct chunk writes, extending the dataset 4 frames at a time
+  // and writing the NDAttributes 3 frames at a time
+  setup_hdf_stream();
+  hdf5->write(NDFileNameString, "testing_direct");
+  hdf5->write(str_NDFileHDF5_directChunkWrite, 1);
+  hdf5->write(str_NDFileHDF5_extendStep, 4);
+  hdf5->write(str_NDFileHDF5_NDAttributeBatch, 3);
+
+  // Initialise the HDF5 plugin with a dummy frame
+  hdf5->processCallbacks(arrays[0]);
+
+  // Start capture to disk, the file is closed after the last frame
+  hdf5->write(NDFileNumCaptureString, numFrames);
+  hdf5->write(NDFileCaptureString, 1);
+  for (int i = 0; i < numFrames; i++)
+  {
+    hdf5->lock();
+    BOOST_CHECK_NO_THROW(hdf5->processCallbacks(arrays[i]));
+    hdf5->unlock();
+  }
+  BOOST_REQUIRE_EQUAL(hdf5->readInt(NDFileNumCapturedString), numFrames);
+  BOOST_CHECK(hdf5->readDouble(str_NDFileHDF5_sustainedFrameRate) > 0.0);
+
+  // The datasets must have been trimmed to the number of frames and hold the frames in order
+  std::string fileName = hdf5->readString(NDFullFileNameString);
+  hid_t file = H5Fopen(fileName.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+  BOOST_REQUIRE(file >= 0);
+
+  hsize_t fileDims[3] = {0, 0, 0};
+  hid_t dataset = H5Dopen(file, "/entry/instrument/detector/data", H5P_DEFAULT);
+  hid_t dataspace = H5Dget_space(dataset);
+  BOOST_REQUIRE_EQUAL(H5Sget_simple_extent_ndims(dataspace), 3);
+  H5Sget_simple_extent_dims(dataspace, fileDims, NULL);
+  BOOST_CHECK_EQUAL(fileDims[0], (hsize_t)numFrames);
+  BOOST_CHECK_EQUAL(fileDims[1], tmpdims[1]);
+  BOOST_CHECK_EQUAL(fileDims[2], tmpdims[0]);
+  std::vector<epicsUInt32> data(numFrames * tmpdims[0] * tmpdims[1]);
+  H5Dread(dataset, H5T_NATIVE_UINT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, &data[0]);
+  int numWrong = 0;
+  for (size_t j = 0; j < data.size(); j++)
+  {
+    if (data[j] != j / (tmpdims[0] * tmpdims[1])) numWrong++;
+  }
+  BOOST_CHECK_EQUAL(numWrong, 0);
+  H5Sclose(dataspace);
+  H5Dclose(dataset);
+
+  dataset = H5Dopen(file, "/entry/instrument/NDAttributes/NDArrayUniqueId", H5P_DEFAULT);
+  dataspace = H5Dget_space(dataset);
+  H5Sget_simple_extent_dims(dataspace, fileDims, NULL);
+  BOOST_CHECK_EQUAL(fileDims[0], (hsize_t)numFrames);
+  std::vector<epicsInt32> uniqueIds(numFrames);
+  H5Dread(dataset, H5T_NATIVE_INT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, &uniqueIds[0]);
+  for (int i = 0; i < numFrames; i++)
+  {
+    BOOST_CHECK_EQUAL(uniqueIds[i], i);
+  }
+  H5Sclose(dataspace);
+  H5Dclose(dataset);
+
+  dataset = H5Dopen(file, "/entry/instrument/performance/timestamp", H5P_DEFAULT);
+  BOOST_CHECK(H5Aexists(dataset, "sustained_frames_per_second") > 0);
+  BOOST_CHECK(H5Aexists(dataset, "sustained_MB_per_second") > 0);
+  H5Dclose(dataset);
+  H5Fclose(file);
+}
+
+
+BOOST_AUTO_TEST_CASE(test_CompressionThreads)
+{
+  size_t tmpdims[] = {64,48};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+  const int numFrames = 12;
+
+  // Create some compressible test arrays, each filled with its own frame number
+  std::vector<NDArray*>arrays(numFrames);
+  fillNDArraysWithFrameNumber(dims, NDUInt16, arrays);
+
+  // Configure zlib compression in the plugin's compression threads
+  setup_hdf_stream();
+  hdf5->write(NDFileNameString, "testing_compress");
+  hdf5->write(str_NDFileHDF5_compressionType, 3);
+  hdf5->write(str_NDFileHDF5_zCompressLevel, 6);
+  hdf5->write(str_NDFileHDF5_numCompressThreads, 2);
+
+  // Initialise the HDF5 plugin with a dummy frame
+  hdf5->processCallbacks(arrays[0]);
+
+  hdf5->write(NDFileNumCaptureString, numFrames);
+  hdf5->write(NDFileCaptureString, 1);
+  for (int i = 0; i < numFrames; i++)
+  {
+    hdf5->lock();
+    BOOST_CHECK_NO_THROW(hdf5->processCallbacks(arrays[i]));
+    hdf5->unlock();
+  }
+  BOOST_REQUIRE_EQUAL(hdf5->readInt(NDFileNumCapturedString), numFrames);
+  BOOST_CHECK(hdf5->readDouble(str_NDFileHDF5_compressRatio) > 1.0);
+
+  // The chunks are written with the deflate filter, so the HDF5 library can read them back
+  std::string fileName = hdf5->readString(NDFullFileNameString);
+  hid_t file = H5Fopen(fileName.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+  BOOST_REQUIRE(file >= 0);
+  hid_t dataset = H5Dopen(file, "/entry/instrument/detector/data", H5P_DEFAULT);
+  hid_t cparms = H5Dget_create_plist(dataset);
+  BOOST_CHECK_EQUAL(H5Pget_nfilters(cparms), 1);
+  H5Pclose(cparms);
+  std::vector<epicsUInt16> data(numFrames * tmpdims[0] * tmpdims[1]);
+  BOOST_REQUIRE(H5Dread(dataset, H5T_NATIVE_UINT16, H5S_ALL, H5S_ALL, H5P_DEFAULT, &data[0]) >= 0);
+  int numWrong = 0;
+  for (size_t j = 0; j < data.size(); j++)
+  {
+    if (data[j] != j / (tmpdims[0] * tmpdims[1])) numWrong++;
+  }
+  BOOST_CHECK_EQUAL(numWrong, 0);
+  H5Dclose(dataset);
+  H5Fclose(file);
+}
+
+
+BOOST_AUTO_TEST_CASE(test_CaptureSpill)
+{
+  size_t tmpdims[] = {64,48};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+  const int numFrames = 12;
+
+  // Create some test arrays, each filled with its own frame number
+  std::vector<NDArray*>arrays(numFrames);
+  fillNDArraysWithFrameNumber(dims, NDUInt16, arrays);
+
+  // Capture mode with a memory budget of 3 frames, the other frames go to the scratch file
+  setup_hdf_stream();
+  hdf5->write(NDFileWriteModeString, NDFileModeCapture);
+  hdf5->write(NDFileNameString, "testing_spill");
+  hdf5->write(NDAutoSaveString, 1);
+  hdf5->write(NDFileCaptureBudgetString, 3.5 * 64 * 48 * 2 / (1024. * 1024.));
+
+  // Initialise the HDF5 plugin with a dummy frame
+  hdf5->processCallbacks(arrays[0]);
+
+  hdf5->write(NDFileNumCaptureString, numFrames);
+  hdf5->write(NDFileCaptureString, 1);
+  for (int i = 0; i < numFrames - 1; i++)
+  {
+    hdf5->lock();
+    BOOST_CHECK_NO_THROW(hdf5->processCallbacks(arrays[i]));
+    hdf5->unlock();
+  }
+  BOOST_REQUIRE_EQUAL(hdf5->readInt(NDFileNumCapturedString), numFrames - 1);
+  BOOST_CHECK_CLOSE(hdf5->readDouble(NDFileCaptureSpilledString), 8 * 64 * 48 * 2 / (1024. * 1024.), 1e-6);
+  BOOST_CHECK_CLOSE(hdf5->readDouble(NDFileCaptureMemoryString), 3 * 64 * 48 * 2 / (1024. * 1024.), 1e-6);
+
+  // The last frame completes the capture, which is then saved from memory and the scratch file
+  hdf5->lock();
+  BOOST_CHECK_NO_THROW(hdf5->processCallbacks(arrays[numFrames - 1]));
+  hdf5->unlock();
+  BOOST_REQUIRE_EQUAL(hdf5->readInt(NDFileNumCapturedString), numFrames);
+  BOOST_CHECK_EQUAL(hdf5->readDouble(NDFileCaptureMemoryString), 0.0);
+
+  std::string fileName = hdf5->readString(NDFullFileNameString);
+  hid_t file = H5Fopen(fileName.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+  BOOST_REQUIRE(file >= 0);
+  hid_t dataset = H5Dopen(file, "/entry/instrument/detector/data", H5P_DEFAULT);
+  std::vector<epicsUInt16> data(numFrames * tmpdims[0] * tmpdims[1]);
+  BOOST_REQUIRE(H5Dread(dataset, H5T_NATIVE_UINT16, H5S_ALL, H5S_ALL, H5P_DEFAULT, &data[0]) >= 0);
+  int numWrong = 0;
+  for (size_t j = 0; j < data.size(); j++)
+  {
+    if (data[j] != j / (tmpdims[0] * tmpdims[1])) numWrong++;
+  }
+  BOOST_CHECK_EQUAL(numWrong, 0);
+  H5Dclose(dataset);
+  H5Fclose(file);
+}
+
+#if !defined(_WIN32) && H5_VERSION_GE(1,10,0)
+// Opens the file with SWMR read access, or refreshes the dataset once it is open, and checks that
+// it holds numFrames frames, each filled with its frame number.
+static int readSWMRFrames(const std::string &fileName, hsize_t numFrames, size_t frameElements,
+                          hid_t *pFile, hid_t *pDataset)
+{
+  if (*pDataset < 0) {
+    *pFile = H5Fopen(fileName.c_str(), H5F_ACC_RDONLY | H5F_ACC_SWMR_READ, H5P_DEFAULT);
+    if (*pFile < 0) return 1;
+    *pDataset = H5Dopen(*pFile, "/entry/instrument/detector/data", H5P_DEFAULT);
+    if (*pDataset < 0) return 2;
+  } else if (H5Drefresh(*pDataset) < 0) {
+    return 3;
+  }
+  hsize_t fileDims[3] = {0, 0, 0};
+  hid_t dataspace = H5Dget_space(*pDataset);
+  H5Sget_simple_extent_dims(dataspace, fileDims, NULL);
+  H5Sclose(dataspace);
+  if (fileDims[0] != numFrames) return 4;
+  std::vector<epicsUInt16> data(numFrames * frameElements);
+  if (H5Dread(*pDataset, H5T_NATIVE_UINT16, H5S_ALL, H5S_ALL, H5P_DEFAULT, &data[0]) < 0) return 5;
+  for (size_t j = 0; j < data.size(); j++)
+  {
+    if (data[j] != j / frameElements) return 6;
+  }
+  return 0;
+}
+
+BOOST_AUTO_TEST_CASE(test_SWMRConcurrentRead)
+{
+  size_t tmpdims[] = {64,48};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+  const int numFrames = 10;
+  const size_t frameElements = tmpdims[0] * tmpdims[1];
+
+  // Create some test arrays, each filled with its own frame number
+  std::vector<NDArray*>arrays(numFrames);
+  fillNDArraysWithFrameNumber(dims, NDUInt16, arrays);
+
+  // SWMR mode, flushing every 4 frames; the extend step must not be visible to the reader
+  const int flushFrames = 4;
+  setup_hdf_stream();
+  hdf5->write(NDFileNameString, "testing_swmr");
+  hdf5->write(str_NDFileHDF5_SWMRMode, 1);
+  hdf5->write(str_NDFileHDF5_flushNthFrame, flushFrames);
+  hdf5->write(str_NDFileHDF5_extendStep, 8);
+
+  // Initialise the HDF5 plugin with a dummy frame
+  hdf5->processCallbacks(arrays[0]);
+
+  // The reader process checks the file after each flush while it is still being written; the pipes
+  // are used to take turns. It is started before the file is created, so that its copy of the HDF5
+  // library does not share the writer's open file.
+  int toReader[2], toWriter[2];
+  BOOST_REQUIRE_EQUAL(pipe(toReader), 0);
+  BOOST_REQUIRE_EQUAL(pipe(toWriter), 0);
+  pid_t pid = fork();
+  BOOST_REQUIRE(pid >= 0);
+  if (pid == 0)
+  {
+    hid_t file = -1, dataset = -1;
+    char readerFileName[MAX_FILENAME_LEN];
+    char c;
+    int result = 0;
+    if (read(toReader[0], readerFileName, sizeof(readerFileName)) != sizeof(readerFileName)) _exit(10);
+    for (int n = flushFrames; n < numFrames && result == 0; n += flushFrames)
+    {
+      if (read(toReader[0], &c, 1) != 1) _exit(10);
+      result = readSWMRFrames(readerFileName, n, frameElements, &file, &dataset);
+      if (write(toWriter[1], &c, 1) != 1) _exit(11);
+    }
+    _exit(result);
+  }
+
+  hdf5->write(NDFileNumCaptureString, numFrames);
+  hdf5->write(NDFileCaptureString, 1);
+  BOOST_REQUIRE_EQUAL(hdf5->readInt(str_NDFileHDF5_SWMRActive), 1);
+  std::string fileName = hdf5->readString(NDFullFileNameString);
+  char writerFileName[MAX_FILENAME_LEN] = "";
+  strncpy(writerFileName, fileName.c_str(), sizeof(writerFileName) - 1);
+  BOOST_REQUIRE_EQUAL(write(toReader[1], writerFileName, sizeof(writerFileName)), (ssize_t)sizeof(writerFileName));
+
+  char c = 0;
+  for (int i = 0; i < numFrames; i++)
+  {
+    hdf5->lock();
+    BOOST_CHECK_NO_THROW(hdf5->processCallbacks(arrays[i]));
+    hdf5->unlock();
+    if ((i + 1) % flushFrames == 0 && i + 1 < numFrames)
+    {
+      BOOST_REQUIRE_EQUAL(write(toReader[1], &c, 1), (ssize_t)1);
+      BOOST_REQUIRE_EQUAL(read(toWriter[0], &c, 1), (ssize_t)1);
+    }
+  }
+  int childStatus = -1;
+  waitpid(pid, &childStatus, 0);
+  close(toReader[0]); close(toReader[1]);
+  close(toWriter[0]); close(toWriter[1]);
+  BOOST_REQUIRE(WIFEXITED(childStatus));
+  BOOST_CHECK_EQUAL(WEXITSTATUS(childStatus), 0);
+  BOOST_CHECK_EQUAL(hdf5->readInt(str_NDFileHDF5_SWMRActive), 0);
+
+  // The closed file holds all frames. A SWMR writer cannot create objects, so closing the file
+  // must not have added the performance dataset.
+  hid_t file = -1, dataset = -1;
+  BOOST_CHECK_EQUAL(readSWMRFrames(fileName, numFrames, frameElements, &file, &dataset), 0);
+  if (dataset >= 0) H5Dclose(dataset);
+  if (file >= 0) H5Fclose(file);
+  file = H5Fopen(fileName.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+  BOOST_REQUIRE(file >= 0);
+  htri_t exists = H5Lexists(file, "/entry/instrument/performance", H5P_DEFAULT);
+  if (exists > 0) exists = H5Lexists(file, "/entry/instrument/performance/timestamp", H5P_DEFAULT);
+  BOOST_CHECK_EQUAL(exists, 0);
+  H5Fclose(file);
+}
+#endif
+
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -34,6 +34,11 @@ struct PluginFixture
     asynOctetClient *cbTrigA;
     asynOctetClient *cbTrigB;
     asynOctetClient *cbCalc;
+    asynInt32Client *cbZeroCopy;
+    asynInt32Client *cbDriverReserve;
+    asynInt32Client *cbCopyFallbacks;
+    asynInt32Client *cbStatDim0Min;
+    asynInt32Client *cbStatDim0Size;
 
     PluginFixture()
     {
@@ -66,10 +71,20 @@ struct PluginFixture
         cbTrigA = new asynOctetClient(testport.c_str(), 0, NDCircBuffTriggerAString);
         cbTrigB = new asynOctetClient(testport.c_str(), 0, NDCircBuffTriggerBString);
         cbCalc = new asynOctetClient(testport.c_str(), 0, NDCircBuffTriggerCalcString);
+        cbZeroCopy = new asynInt32Client(testport.c_str(), 0, NDCircBuffZeroCopyString);
+        cbDriverReserve = new asynInt32Client(testport.c_str(), 0, NDCircBuffDriverReserveString);
+        cbCopyFallbacks = new asynInt32Client(testport.c_str(), 0, NDCircBuffCopyFallbacksString);
+        cbStatDim0Min = new asynInt32Client(testport.c_str(), 0, NDCircBuffStatDim0MinString);
+        cbStatDim0Size = new asynInt32Client(testport.c_str(), 0, NDCircBuffStatDim0SizeString);
 
     }
     ~PluginFixture()
     {
+        delete cbStatDim0Size;
+        delete cbStatDim0Min;
+        delete cbCopyFallbacks;
+        delete cbDriverReserve;
+        delete cbZeroCopy;
         delete cbCalc;
         delete cbTrigB;
         delete cbTrigA;
@@ -184,4 +199,246 @@ BOOST_AUTO_TEST_CASE(test_PreBufferOrder)
     BOOST_CHECK_EQUAL(3, ((uint8_t *)ds->arrays[3]->pData)[0]);
 }
 
+BOOST_AUTO_TEST_CASE(test_ZeroCopy)
+{
+    size_t gotbytes;
+    int copyFallbacks;
+    cbCalc->write("0", 2, &gotbytes);
+
+    cbZeroCopy->write(1);
+    cbPreTrigger->write(3);
+    cbControl->write(1);
+
+    size_t dims = 3;
+    NDArray *testArrays[4];
+    for (int i = 0; i < 4; i++) {
+        testArrays[i] = arrayPool->alloc(1,&dims,NDUInt8,0,NULL);
+        memset(testArrays[i]->pData, i, 3);
+    }
+
+    for (int i = 0; i < 3; i++) {
+        cbProcess(testArrays[i]);
+    }
+    cbSoftTrigger->write(1);
+    cbProcess(testArrays[3]);
+
+    // The driver's arrays should have been passed on in order without being copied
+    BOOST_REQUIRE_EQUAL((size_t)4, ds->arrays.size());
+    for (int i = 0; i < 4; i++) {
+        BOOST_CHECK_EQUAL(testArrays[i], ds->arrays[i]);
+    }
+    cbCopyFallbacks->read(&copyFallbacks);
+    BOOST_CHECK_EQUAL(0, copyFallbacks);
+}
+
+BOOST_AUTO_TEST_CASE(test_ZeroCopyDriverReserve)
+{
+    size_t gotbytes;
+    int copyFallbacks;
+    cbCalc->write("0", 2, &gotbytes);
+
+    // The driver's pool can allocate 100 arrays, so holding any of them would leave fewer than 99 available
+    cbZeroCopy->write(1);
+    cbDriverReserve->write(99);
+    cbPreTrigger->write(3);
+    cbControl->write(1);
+
+    size_t dims = 3;
+    NDArray *testArrays[4];
+    for (int i = 0; i < 4; i++) {
+        testArrays[i] = arrayPool->alloc(1,&dims,NDUInt8,0,NULL);
+        memset(testArrays[i]->pData, i, 3);
+    }
+
+    for (int i = 0; i < 3; i++) {
+        cbProcess(testArrays[i]);
+    }
+    cbSoftTrigger->write(1);
+    cbProcess(testArrays[3]);
+
+    // The pre-trigger arrays must have been copied, the post-trigger array is passed straight through
+    BOOST_REQUIRE_EQUAL((size_t)4, ds->arrays.size());
+    for (int i = 0; i < 3; i++) {
+        BOOST_CHECK_NE(testArrays[i], ds->arrays[i]);
+        BOOST_CHECK_EQUAL(i, ((uint8_t *)ds->arrays[i]->pData)[0]);
+    }
+    BOOST_CHECK_EQUAL(testArrays[3], ds->arrays[3]);
+    cbCopyFallbacks->read(&copyFallbacks);
+    BOOST_CHECK_EQUAL(3, copyFallbacks);
+}
+
+BOOST_AUTO_TEST_CASE(test_ConstantTrigger)
+{
+    size_t gotbytes;
+    cbCalc->write("1", 2, &gotbytes);
+
+    cbPreTrigger->write(3);
+    cbPostTrigger->write(2);
+    cbControl->write(1);
+
+    size_t dims = 3;
+    NDArray *testArray = arrayPool->alloc(1,&dims,NDUInt8,0,NULL);
+
+    // Every array satisfies the trigger, so only the post-trigger arrays are output
+    for (int i = 0; i < 5; i++)
+        cbProcess(testArray);
+
+    BOOST_CHECK_EQUAL((size_t)2, ds->arrays.size());
+}
+
+BOOST_AUTO_TEST_CASE(test_RegionStatsTrigger)
+{
+    size_t gotbytes;
+    // Trigger on the maximum of the statistics region
+    cbCalc->write("G>=5", 5, &gotbytes);
+
+    cbPreTrigger->write(2);
+    cbPostTrigger->write(1);
+    cbControl->write(1);
+
+    size_t dims[2] = {7,4};
+    NDArray *testArrays[6];
+    for (int i = 0; i < 6; i++) {
+        testArrays[i] = arrayPool->alloc(2,dims,NDUInt16,0,NULL);
+        for (int j = 0; j < 7*4; j++)
+            ((uint16_t *)testArrays[i]->pData)[j] = i;
+    }
+
+    for (int i = 0; i < 6; i++)
+        cbProcess(testArrays[i]);
+
+    // Arrays 3 and 4 are the pre-trigger arrays for the trigger on array 5
+    BOOST_REQUIRE_EQUAL((size_t)3, ds->arrays.size());
+    for (int i = 0; i < 3; i++) {
+        BOOST_CHECK_EQUAL(i+3, ((uint16_t *)ds->arrays[i]->pData)[0]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_RegionStatsTriggerRegion)
+{
+    size_t gotbytes;
+    // Trigger on the sum of column 2 only
+    cbCalc->write("H>0", 4, &gotbytes);
+    cbStatDim0Min->write(2);
+    cbStatDim0Size->write(1);
+
+    cbPreTrigger->write(2);
+    cbPostTrigger->write(1);
+    cbControl->write(1);
+
+    size_t dims[2] = {7,4};
+    NDArray *testArrays[2];
+    for (int i = 0; i < 2; i++) {
+        testArrays[i] = arrayPool->alloc(2,dims,NDFloat32,0,NULL);
+        memset(testArrays[i]->pData, 0, 7*4*sizeof(float));
+    }
+    // The first array is non-zero outside the region, the second inside it
+    ((float *)testArrays[0]->pData)[7*3 + 3] = 1.f;
+    ((float *)testArrays[1]->pData)[7*3 + 2] = 1.f;
+
+    cbProcess(testArrays[0]);
+    BOOST_CHECK_EQUAL((size_t)0, ds->arrays.size());
+    cbProcess(testArrays[1]);
+    BOOST_CHECK_EQUAL((size_t)2, ds->arrays.size());
+}
+
+BOOST_AUTO_TEST_CASE(test_CompiledTrigger)
+{
+    size_t gotbytes;
+    // Operators, functions and a conditional handled by the trigger compiler
+    const char *calc = "(MAX(G,1) >= 4) && !(H < 0) ? ABS(-1) : 0";
+    cbCalc->write(calc, strlen(calc)+1, &gotbytes);
+
+    cbPreTrigger->write(2);
+    cbPostTrigger->write(1);
+    cbControl->write(1);
+
+    size_t dims[2] = {7,4};
+    NDArray *testArrays[5];
+    for (int i = 0; i < 5; i++) {
+        testArrays[i] = arrayPool->alloc(2,dims,NDUInt16,0,NULL);
+        for (int j = 0; j < 7*4; j++)
+            ((uint16_t *)testArrays[i]->pData)[j] = i;
+    }
+
+    for (int i = 0; i < 5; i++)
+        cbProcess(testArrays[i]);
+
+    // Arrays 2 and 3 are the pre-trigger arrays for the trigger on array 4
+    BOOST_REQUIRE_EQUAL((size_t)3, ds->arrays.size());
+    for (int i = 0; i < 3; i++) {
+        BOOST_CHECK_EQUAL(i+2, ((uint16_t *)ds->arrays[i]->pData)[0]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_CompiledMatchesCalcPerform)
+{
+    // Every operator and function the trigger compiler handles, and combinations whose result
+    // depends on precedence and associativity
+    const char *compiled[] = {
+        "A+B", "A-B", "A*B", "A/B", "-A", "+A", "!A", "!C",
+        "A<B", "A<=D", "A>B", "A>=D", "A=D", "A==B", "A!=D", "A#B",
+        "A&&B", "A&&C", "A||C", "C||C", "ABS(B)", "MIN(A,B,E)", "MAX(A,B,E)", "A?B:E", "C?B:E",
+        "A+B*E", "A-B-E", "A/B/E", "A*B+E*F", "-A*B", "!A+B", "A-B+E",
+        "A<B+E", "A+B>E", "A<B<E", "A>=B>=C", "A=B=C", "A#B=C", "(A=B)>C", "A<(B=C)",
+        "A>B&&E<F", "A||B&&C", "A&&B||C", "!A||B", "C?A:B?E:F", "A>B?A+E:B*F",
+        "MAX(A,B)-MIN(E,F)*2", "ABS(A-B)/2>=1.5"
+    };
+    // Chains that mix the relational and equality operators are left to calcPerform
+    const char *mixed[] = {"A=B>1", "A<B=C", "A#B<=E", "A>B==C", "A+1>=B!=C"};
+    double args[][CALCPERFORM_NARGS] = {
+        { 3, -2.5, 0, 3,  4,  1.5, 2, -1, 7, 5, 1, 2},
+        {-4,  2,   1, 1,  0, -3,   5,  5, 0, 2, 3, 4},
+        { 1,  1,   0, 2, -2,  2,   0,  0, 1, 1, 1, 1},
+    };
+    NDCircBuffTriggerOp ops[NDCircBuffMaxTriggerOps];
+    char postfixed[MAX_POSTFIX_SIZE];
+    short error;
+    double expected;
+
+    for (size_t e = 0; e < sizeof(compiled)/sizeof(compiled[0]); e++) {
+        BOOST_REQUIRE_EQUAL(0, postfix(compiled[e], postfixed, &error));
+        int numOps = NDPluginCircularBuff::compileTriggerOps(compiled[e], ops);
+        BOOST_CHECK_MESSAGE(numOps > 0, compiled[e] << " was not compiled");
+        if (numOps == 0) continue;
+        for (size_t a = 0; a < sizeof(args)/sizeof(args[0]); a++) {
+            BOOST_REQUIRE_EQUAL(0, calcPerform(args[a], &expected, postfixed));
+            BOOST_CHECK_MESSAGE(NDPluginCircularBuff::evaluateTriggerOps(ops, numOps, args[a]) == expected,
+                                compiled[e] << " with argument set " << a << " differs from calcPerform");
+        }
+    }
+    for (size_t e = 0; e < sizeof(mixed)/sizeof(mixed[0]); e++) {
+        BOOST_CHECK_MESSAGE(NDPluginCircularBuff::compileTriggerOps(mixed[e], ops) == 0,
+                            mixed[e] << " was compiled");
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_CalcPerformTrigger)
+{
+    size_t gotbytes;
+    // SQRT is not handled by the trigger compiler, so this is evaluated with calcPerform
+    const char *calc = "SQRT(G) >= 2";
+    cbCalc->write(calc, strlen(calc)+1, &gotbytes);
+
+    cbPreTrigger->write(2);
+    cbPostTrigger->write(1);
+    cbControl->write(1);
+
+    size_t dims[2] = {7,4};
+    NDArray *testArrays[5];
+    for (int i = 0; i < 5; i++) {
+        testArrays[i] = arrayPool->alloc(2,dims,NDUInt16,0,NULL);
+        for (int j = 0; j < 7*4; j++)
+            ((uint16_t *)testArrays[i]->pData)[j] = i;
+    }
+
+    for (int i = 0; i < 5; i++)
+        cbProcess(testArrays[i]);
+
+    BOOST_REQUIRE_EQUAL((size_t)3, ds->arrays.size());
+    for (int i = 0; i < 3; i++) {
+        BOOST_CHECK_EQUAL(i+2, ((uint16_t *)ds->arrays[i]->pData)[0]);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
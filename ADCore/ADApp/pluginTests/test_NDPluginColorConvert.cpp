@@ -0,0 +1,307 @@
+/**
+ * Tests for NDPluginColorConvert.
+ *
+ * The RGB1, RGB2, RGB3 and mono conversions are checked element by element, Bayer images of a
+ * single color must give that color for every Bayer pattern, and edge-aware interpolation must
+ * keep green exact along a vertical edge.  The SSE2 versions of the 8 and 16 bit conversions
+ * must give the same data as the plain C++ loops.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD and asyn dependencies
+#include <NDPluginColorConvert.h>
+#include <asynPortDriver.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+#include <asynPortClient.h>
+
+#include "testingutilities.h"
+
+using namespace std;
+
+#define SIZE_X 410
+#define SIZE_Y 290
+
+struct ColorConvertPluginFixture
+{
+    NDArrayPool *arrayPool;
+    asynPortDriver *dummy_driver;
+    NDPluginColorConvert *cc;
+    TestingPlugin *ds;
+    asynInt32Client *colorModeOut;
+    asynInt32Client *bayerMode;
+    asynInt32Client *computeThreads;
+
+    ColorConvertPluginFixture()
+    {
+        arrayPool = new NDArrayPool(100, 0);
+
+        std::string dummy_port("simPort"), testport("testPort");
+        uniqueAsynPortName(dummy_port);
+        uniqueAsynPortName(testport);
+
+        // The upstream driver is never used; arrays are passed by calling processCallbacks directly.
+        dummy_driver = new asynPortDriver(dummy_port.c_str(), 0, 1, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 2000000);
+
+        cc = new NDPluginColorConvert(testport.c_str(), 50, 0, dummy_port.c_str(), 0, 0, 0, 0, 2000000);
+
+        // This is the mock downstream plugin
+        ds = new TestingPlugin(testport.c_str(), 0);
+
+        colorModeOut = new asynInt32Client(testport.c_str(), 0, NDPluginColorConvertColorModeOutString);
+        bayerMode = new asynInt32Client(testport.c_str(), 0, NDPluginColorConvertBayerModeString);
+        computeThreads = new asynInt32Client(testport.c_str(), 0, NDPluginColorConvertComputeThreadsString);
+    }
+    ~ColorConvertPluginFixture()
+    {
+        delete computeThreads;
+        delete bayerMode;
+        delete colorModeOut;
+        delete cc;
+        delete dummy_driver;
+        delete arrayPool;
+    }
+    void ccProcess(NDArray *pArray)
+    {
+        cc->lock();
+        cc->processCallbacks(pArray);
+        cc->unlock();
+    }
+    // Allocates an array in the given color mode, with the dimensions in the order of that mode
+    NDArray *makeArray(int colorMode, size_t xSize, size_t ySize, NDDataType_t dataType)
+    {
+        size_t dims[3];
+        int ndims = 3;
+        switch (colorMode) {
+            case NDColorModeRGB1: dims[0] = 3;     dims[1] = xSize; dims[2] = ySize; break;
+            case NDColorModeRGB2: dims[0] = xSize; dims[1] = 3;     dims[2] = ySize; break;
+            case NDColorModeRGB3: dims[0] = xSize; dims[1] = ySize; dims[2] = 3;     break;
+            default:              dims[0] = xSize; dims[1] = ySize; ndims = 2;       break;
+        }
+        NDArray *pArray = arrayPool->alloc(ndims, dims, dataType, 0, NULL);
+        pArray->pAttributeList->add("ColorMode", "Color mode", NDAttrInt32, &colorMode);
+        return pArray;
+    }
+};
+
+// Element index of color c of pixel (x,y) in each color mode
+static size_t colorIndex(int colorMode, int c, size_t x, size_t y, size_t xSize, size_t ySize)
+{
+    switch (colorMode) {
+        case NDColorModeRGB1: return (y*xSize + x)*3 + c;
+        case NDColorModeRGB2: return (y*3 + c)*xSize + x;
+        case NDColorModeRGB3: return (c*ySize + y)*xSize + x;
+        default:              return y*xSize + x;
+    }
+}
+
+// Color of the Bayer pixel (x,y), 0=red, 1=green, 2=blue, for each NDBayerPattern_t
+static int bayerColor(int pattern, size_t x, size_t y)
+{
+    static const int colors[4][2][2] = {{{0, 1}, {1, 2}},   // RGGB
+                                        {{1, 2}, {0, 1}},   // GBRG
+                                        {{1, 0}, {2, 1}},   // GRBG
+                                        {{2, 1}, {1, 0}}};  // BGGR
+    return colors[pattern][y & 1][x & 1];
+}
+
+static epicsUInt16 pixelValue(int c, size_t x, size_t y)
+{
+    return (epicsUInt16)(c*20000 + x*37 + y*101);
+}
+
+BOOST_FIXTURE_TEST_SUITE(ColorConvertTests, ColorConvertPluginFixture)
+
+BOOST_AUTO_TEST_CASE(test_RGBConversions)
+{
+    int modes[] = {NDColorModeRGB1, NDColorModeRGB2, NDColorModeRGB3};
+    int threads[] = {1, 3};
+
+    for (int t=0; t<2; t++) {
+        computeThreads->write(threads[t]);
+        for (int in=0; in<3; in++) {
+            NDArray *pArray = makeArray(modes[in], SIZE_X, SIZE_Y, NDUInt16);
+            epicsUInt16 *pIn = (epicsUInt16 *)pArray->pData;
+            for (size_t y=0; y<SIZE_Y; y++)
+                for (size_t x=0; x<SIZE_X; x++)
+                    for (int c=0; c<3; c++)
+                        pIn[colorIndex(modes[in], c, x, y, SIZE_X, SIZE_Y)] = pixelValue(c, x, y);
+            int outModes[] = {NDColorModeMono, NDColorModeRGB1, NDColorModeRGB2, NDColorModeRGB3};
+            for (int out=0; out<4; out++) {
+                if (outModes[out] == modes[in]) continue;
+                colorModeOut->write(outModes[out]);
+                ccProcess(pArray);
+                NDArray *pOut = ds->arrays.back();
+                BOOST_REQUIRE_EQUAL(outModes[out] == NDColorModeMono ? 2 : 3, pOut->ndims);
+                epicsUInt16 *pData = (epicsUInt16 *)pOut->pData;
+                int mismatches = 0;
+                for (size_t y=0; y<SIZE_Y; y++) {
+                    for (size_t x=0; x<SIZE_X; x++) {
+                        if (outModes[out] == NDColorModeMono) {
+                            int sum = pixelValue(0, x, y) + pixelValue(1, x, y) + pixelValue(2, x, y);
+                            if (pData[y*SIZE_X + x] != sum/3) mismatches++;
+                            continue;
+                        }
+                        for (int c=0; c<3; c++) {
+                            if (pData[colorIndex(outModes[out], c, x, y, SIZE_X, SIZE_Y)] != pixelValue(c, x, y))
+                                mismatches++;
+                        }
+                    }
+                }
+                BOOST_CHECK_MESSAGE(mismatches == 0, "color mode " << modes[in] << " to " << outModes[out] << " with "
+                                    << threads[t] << " threads has " << mismatches << " wrong values");
+            }
+            pArray->release();
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_MonoToRGB)
+{
+    NDArray *pArray = makeArray(NDColorModeMono, SIZE_X, SIZE_Y, NDUInt8);
+    epicsUInt8 *pIn = (epicsUInt8 *)pArray->pData;
+    int outModes[] = {NDColorModeRGB1, NDColorModeRGB2, NDColorModeRGB3};
+
+    for (size_t i=0; i<SIZE_X*SIZE_Y; i++) pIn[i] = (epicsUInt8)(i * 7 + i / 301);
+    computeThreads->write(2);
+    for (int out=0; out<3; out++) {
+        colorModeOut->write(outModes[out]);
+        ccProcess(pArray);
+        epicsUInt8 *pData = (epicsUInt8 *)ds->arrays.back()->pData;
+        int mismatches = 0;
+        for (size_t y=0; y<SIZE_Y; y++)
+            for (size_t x=0; x<SIZE_X; x++)
+                for (int c=0; c<3; c++)
+                    if (pData[colorIndex(outModes[out], c, x, y, SIZE_X, SIZE_Y)] != pIn[y*SIZE_X + x]) mismatches++;
+        BOOST_CHECK_MESSAGE(mismatches == 0, "mono to " << outModes[out] << " has " << mismatches << " wrong values");
+    }
+    pArray->release();
+}
+
+template <typename epicsType>
+static void checkBayerFlatColor(ColorConvertPluginFixture *f, NDDataType_t dataType, int pattern, int mode)
+{
+    NDArray *pArray = f->makeArray(NDColorModeBayer, SIZE_X, SIZE_Y, dataType);
+    epicsType *pIn = (epicsType *)pArray->pData;
+    epicsType color[3] = {(epicsType)200, (epicsType)30, (epicsType)120};
+
+    pArray->pAttributeList->add("BayerPattern", "Bayer pattern", NDAttrInt32, &pattern);
+    for (size_t y=0; y<SIZE_Y; y++)
+        for (size_t x=0; x<SIZE_X; x++)
+            pIn[y*SIZE_X + x] = color[bayerColor(pattern, x, y)];
+    f->ccProcess(pArray);
+    NDArray *pOut = f->ds->arrays.back();
+    BOOST_REQUIRE_EQUAL(3, pOut->ndims);
+    BOOST_REQUIRE_EQUAL((size_t)3, pOut->dims[0].size);
+    epicsType *pData = (epicsType *)pOut->pData;
+    int mismatches = 0;
+    for (size_t i=0; i<SIZE_X*SIZE_Y; i++)
+        for (int c=0; c<3; c++)
+            if (pData[3*i + c] != color[c]) mismatches++;
+    BOOST_CHECK_MESSAGE(mismatches == 0, "data type " << dataType << " pattern " << pattern << " mode " << mode
+                        << " has " << mismatches << " wrong values");
+    pArray->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_BayerFlatColor)
+{
+    colorModeOut->write(NDColorModeRGB1);
+    computeThreads->write(3);
+    for (int mode=0; mode<2; mode++) {
+        bayerMode->write(mode);
+        for (int pattern=0; pattern<4; pattern++) {
+            checkBayerFlatColor<epicsUInt8>(this, NDUInt8, pattern, mode);
+            checkBayerFlatColor<epicsUInt16>(this, NDUInt16, pattern, mode);
+            checkBayerFlatColor<epicsFloat32>(this, NDFloat32, pattern, mode);
+        }
+    }
+}
+
+// A vertical edge between 2 colors: edge-aware interpolation takes green from the pixels above and
+// below, which are on the same side of the edge, bilinear interpolation mixes the 2 sides.
+BOOST_AUTO_TEST_CASE(test_BayerEdge)
+{
+    NDArray *pArray = makeArray(NDColorModeBayer, SIZE_X, SIZE_Y, NDUInt16);
+    epicsUInt16 *pIn = (epicsUInt16 *)pArray->pData;
+    epicsUInt16 colors[2][3] = {{100, 200, 300}, {4000, 3000, 2000}};
+    int pattern = NDBayerGRBG;
+    int mismatches[2];
+
+    pArray->pAttributeList->add("BayerPattern", "Bayer pattern", NDAttrInt32, &pattern);
+    for (size_t y=0; y<SIZE_Y; y++)
+        for (size_t x=0; x<SIZE_X; x++)
+            pIn[y*SIZE_X + x] = colors[x >= SIZE_X/2 + 1][bayerColor(pattern, x, y)];
+    colorModeOut->write(NDColorModeRGB3);
+    computeThreads->write(1);
+    for (int mode=0; mode<2; mode++) {
+        bayerMode->write(mode);
+        ccProcess(pArray);
+        epicsUInt16 *pGreen = (epicsUInt16 *)ds->arrays.back()->pData + SIZE_X*SIZE_Y;
+        mismatches[mode] = 0;
+        for (size_t y=0; y<SIZE_Y; y++)
+            for (size_t x=0; x<SIZE_X; x++)
+                if (pGreen[y*SIZE_X + x] != colors[x >= SIZE_X/2 + 1][1]) mismatches[mode]++;
+    }
+    BOOST_CHECK(mismatches[0] > 0);
+    BOOST_CHECK_EQUAL(mismatches[1], 0);
+    pArray->release();
+}
+
+// The 8 and 16 bit conversions use SSE2 instructions for most of each row; they must give the same
+// data as the plain C++ loops for values over the whole range of the data type
+template <typename epicsType>
+static void checkSSE2MatchesScalar(ColorConvertPluginFixture *f, NDDataType_t dataType)
+{
+    struct {
+        int in, out, bayerMode;
+    } conversions[] = {
+        {NDColorModeRGB1,  NDColorModeMono, 0},
+        {NDColorModeRGB2,  NDColorModeMono, 0},
+        {NDColorModeRGB1,  NDColorModeRGB3, 0},
+        {NDColorModeRGB3,  NDColorModeRGB1, 0},
+        {NDColorModeBayer, NDColorModeRGB1, 0},
+        {NDColorModeBayer, NDColorModeRGB1, 1},
+    };
+    int pattern = NDBayerGBRG;
+
+    for (size_t i=0; i<sizeof(conversions)/sizeof(conversions[0]); i++) {
+        NDArray *pArray = f->makeArray(conversions[i].in, SIZE_X, SIZE_Y, dataType);
+        NDArrayInfo_t arrayInfo;
+        epicsType *pIn = (epicsType *)pArray->pData;
+
+        pArray->pAttributeList->add("BayerPattern", "Bayer pattern", NDAttrInt32, &pattern);
+        pArray->getInfo(&arrayInfo);
+        for (size_t j=0; j<arrayInfo.nElements; j++) pIn[j] = (epicsType)rand();
+        f->colorModeOut->write(conversions[i].out);
+        f->bayerMode->write(conversions[i].bayerMode);
+        colorConvertSSE2 = 1;
+        f->ccProcess(pArray);
+        // The plugin releases its output when it processes the next array, so keep this one for the comparison
+        NDArray *pSSE2 = f->ds->arrays.back();
+        pSSE2->reserve();
+        colorConvertSSE2 = 0;
+        f->ccProcess(pArray);
+        NDArray *pScalar = f->ds->arrays.back();
+        pScalar->getInfo(&arrayInfo);
+        BOOST_CHECK_MESSAGE(memcmp(pSSE2->pData, pScalar->pData, arrayInfo.totalBytes) == 0,
+                            "color mode " << conversions[i].in << " to " << conversions[i].out << " of data type "
+                            << dataType << " differs without SSE2");
+        pSSE2->release();
+        pArray->release();
+    }
+    colorConvertSSE2 = 1;
+}
+
+BOOST_AUTO_TEST_CASE(test_SSE2MatchesScalar)
+{
+    computeThreads->write(2);
+    checkSSE2MatchesScalar<epicsUInt8>(this, NDUInt8);
+    checkSSE2MatchesScalar<epicsUInt16>(this, NDUInt16);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
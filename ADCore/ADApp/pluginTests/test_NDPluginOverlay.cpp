@@ -0,0 +1,229 @@
+/**
+ * Tests for NDPluginOverlay.
+ *
+ * Overlays are rendered into cached spans of pixels, which are only rendered again when the
+ * overlay parameters, the array geometry or the text change. The tests check the pixels of a
+ * rectangle before and after it is moved, that a time stamp text follows the array time stamp,
+ * and that InPlace draws on the input array instead of a copy.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD and asyn dependencies
+#include <NDPluginOverlay.h>
+#include <asynPortDriver.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+#include <asynPortClient.h>
+
+#include "testingutilities.h"
+
+using namespace std;
+
+#define SIZE_X 200
+#define SIZE_Y 150
+#define NUM_OVERLAYS 2
+
+struct OverlayPluginFixture
+{
+    NDArrayPool *arrayPool;
+    asynPortDriver *dummy_driver;
+    NDPluginOverlay *overlay;
+    TestingPlugin *ds;
+    asynInt32Client *inPlace;
+    asynInt32Client *use[NUM_OVERLAYS];
+    asynInt32Client *positionX[NUM_OVERLAYS];
+    asynInt32Client *positionY[NUM_OVERLAYS];
+    asynInt32Client *sizeX[NUM_OVERLAYS];
+    asynInt32Client *sizeY[NUM_OVERLAYS];
+    asynInt32Client *widthX[NUM_OVERLAYS];
+    asynInt32Client *widthY[NUM_OVERLAYS];
+    asynInt32Client *shape[NUM_OVERLAYS];
+    asynInt32Client *drawMode[NUM_OVERLAYS];
+    asynInt32Client *green[NUM_OVERLAYS];
+    asynInt32Client *font[NUM_OVERLAYS];
+    asynOctetClient *timeStampFormat[NUM_OVERLAYS];
+    asynOctetClient *displayText[NUM_OVERLAYS];
+
+    OverlayPluginFixture()
+    {
+        arrayPool = new NDArrayPool(100, 0);
+
+        std::string dummy_port("simPort"), testport("testPort");
+        uniqueAsynPortName(dummy_port);
+        uniqueAsynPortName(testport);
+
+        // The upstream driver is never used; arrays are passed by calling processCallbacks directly.
+        dummy_driver = new asynPortDriver(dummy_port.c_str(), 0, 1, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 2000000);
+
+        overlay = new NDPluginOverlay(testport.c_str(), 50, 0, dummy_port.c_str(), 0, NUM_OVERLAYS, 0, 0, 0, 2000000);
+
+        // This is the mock downstream plugin
+        ds = new TestingPlugin(testport.c_str(), 0);
+
+        inPlace = new asynInt32Client(testport.c_str(), 0, NDPluginOverlayInPlaceString);
+        for (int i=0; i<NUM_OVERLAYS; i++) {
+            use[i] = new asynInt32Client(testport.c_str(), i, NDPluginOverlayUseString);
+            positionX[i] = new asynInt32Client(testport.c_str(), i, NDPluginOverlayPositionXString);
+            positionY[i] = new asynInt32Client(testport.c_str(), i, NDPluginOverlayPositionYString);
+            sizeX[i] = new asynInt32Client(testport.c_str(), i, NDPluginOverlaySizeXString);
+            sizeY[i] = new asynInt32Client(testport.c_str(), i, NDPluginOverlaySizeYString);
+            widthX[i] = new asynInt32Client(testport.c_str(), i, NDPluginOverlayWidthXString);
+            widthY[i] = new asynInt32Client(testport.c_str(), i, NDPluginOverlayWidthYString);
+            shape[i] = new asynInt32Client(testport.c_str(), i, NDPluginOverlayShapeString);
+            drawMode[i] = new asynInt32Client(testport.c_str(), i, NDPluginOverlayDrawModeString);
+            green[i] = new asynInt32Client(testport.c_str(), i, NDPluginOverlayGreenString);
+            font[i] = new asynInt32Client(testport.c_str(), i, NDPluginOverlayFontString);
+            timeStampFormat[i] = new asynOctetClient(testport.c_str(), i, NDPluginOverlayTimeStampFormatString);
+            displayText[i] = new asynOctetClient(testport.c_str(), i, NDPluginOverlayDisplayTextString);
+        }
+    }
+    ~OverlayPluginFixture()
+    {
+        for (int i=0; i<NUM_OVERLAYS; i++) {
+            delete displayText[i];
+            delete timeStampFormat[i];
+            delete font[i];
+            delete green[i];
+            delete drawMode[i];
+            delete shape[i];
+            delete widthY[i];
+            delete widthX[i];
+            delete sizeY[i];
+            delete sizeX[i];
+            delete positionY[i];
+            delete positionX[i];
+            delete use[i];
+        }
+        delete inPlace;
+        delete overlay;
+        delete dummy_driver;
+        delete arrayPool;
+    }
+    void overlayProcess(NDArray *pArray)
+    {
+        overlay->lock();
+        overlay->processCallbacks(pArray);
+        overlay->unlock();
+    }
+    NDArray *makeArray()
+    {
+        size_t dims[2] = {SIZE_X, SIZE_Y};
+        NDArray *pArray = arrayPool->alloc(2, dims, NDUInt8, 0, NULL);
+        memset(pArray->pData, 0, SIZE_X*SIZE_Y);
+        return pArray;
+    }
+    void setRectangle(int i, int x, int y, int sx, int sy)
+    {
+        positionX[i]->write(x);
+        positionY[i]->write(y);
+        sizeX[i]->write(sx);
+        sizeY[i]->write(sy);
+        widthX[i]->write(1);
+        widthY[i]->write(1);
+        shape[i]->write(NDOverlayRectangle);
+        drawMode[i]->write(NDOverlaySet);
+        green[i]->write(255);
+        use[i]->write(1);
+    }
+};
+
+// Counts the pixels of the output that differ from a 1 pixel wide rectangle outline
+static int rectangleMismatches(const epicsUInt8 *pData, int x0, int y0, int sx, int sy)
+{
+    int mismatches = 0;
+    for (int y=0; y<SIZE_Y; y++) {
+        for (int x=0; x<SIZE_X; x++) {
+            bool inside = (x >= x0) && (x < x0+sx) && (y >= y0) && (y < y0+sy);
+            bool edge = inside && ((x == x0) || (x == x0+sx-1) || (y == y0) || (y == y0+sy-1));
+            if (pData[y*SIZE_X + x] != (edge ? 255 : 0)) mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+BOOST_FIXTURE_TEST_SUITE(OverlayTests, OverlayPluginFixture)
+
+BOOST_AUTO_TEST_CASE(test_RectangleMoved)
+{
+    NDArray *pArray = makeArray();
+
+    setRectangle(0, 20, 30, 50, 40);
+    overlayProcess(pArray);
+    BOOST_CHECK_EQUAL(rectangleMismatches((epicsUInt8 *)ds->arrays.back()->pData, 20, 30, 50, 40), 0);
+
+    // The spans must be rendered again after the overlay moves, and the input is not modified
+    positionX[0]->write(100);
+    overlayProcess(pArray);
+    BOOST_CHECK_EQUAL(rectangleMismatches((epicsUInt8 *)ds->arrays.back()->pData, 100, 30, 50, 40), 0);
+    BOOST_CHECK_EQUAL(rectangleMismatches((epicsUInt8 *)pArray->pData, 0, 0, 0, 0), 0);
+
+    // A rectangle past the edge of the array is clipped
+    positionX[0]->write(180);
+    overlayProcess(pArray);
+    BOOST_CHECK_EQUAL(((epicsUInt8 *)ds->arrays.back()->pData)[30*SIZE_X + SIZE_X-1], 255);
+    pArray->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_TimeStampText)
+{
+    NDArray *pArray = makeArray();
+    const char *text = "T=";
+    const char *format = "%S";
+    size_t nActual;
+    epicsUInt8 *first = new epicsUInt8[SIZE_X*SIZE_Y];
+    int differences = 0;
+
+    positionX[1]->write(10);
+    positionY[1]->write(10);
+    sizeX[1]->write(100);
+    sizeY[1]->write(20);
+    shape[1]->write(NDOverlayText);
+    drawMode[1]->write(NDOverlaySet);
+    green[1]->write(255);
+    font[1]->write(0);
+    displayText[1]->write(text, strlen(text), &nActual);
+    timeStampFormat[1]->write(format, strlen(format), &nActual);
+    use[1]->write(1);
+
+    pArray->epicsTS.secPastEpoch = 100;
+    pArray->epicsTS.nsec = 0;
+    overlayProcess(pArray);
+    memcpy(first, ds->arrays.back()->pData, SIZE_X*SIZE_Y);
+
+    // The same time stamp gives the same text
+    overlayProcess(pArray);
+    BOOST_CHECK_EQUAL(memcmp(first, ds->arrays.back()->pData, SIZE_X*SIZE_Y), 0);
+
+    // A new time stamp changes the seconds digits but not "T="
+    pArray->epicsTS.secPastEpoch = 103;
+    overlayProcess(pArray);
+    epicsUInt8 *pData = (epicsUInt8 *)ds->arrays.back()->pData;
+    for (int y=10; y<23; y++) {
+        for (int x=10; x<22; x++) BOOST_CHECK_EQUAL(first[y*SIZE_X + x], pData[y*SIZE_X + x]);
+        for (int x=22; x<34; x++) if (first[y*SIZE_X + x] != pData[y*SIZE_X + x]) differences++;
+    }
+    BOOST_CHECK(differences > 0);
+    delete [] first;
+    pArray->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_InPlace)
+{
+    NDArray *pArray = makeArray();
+
+    setRectangle(0, 20, 30, 50, 40);
+    inPlace->write(1);
+    overlayProcess(pArray);
+    BOOST_CHECK(ds->arrays.back() == pArray);
+    BOOST_CHECK_EQUAL(rectangleMismatches((epicsUInt8 *)pArray->pData, 20, 30, 50, 40), 0);
+    inPlace->write(0);
+    overlayProcess(pArray);
+    BOOST_CHECK(ds->arrays.back() != pArray);
+    pArray->release();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,182 @@
+/**
+ * Tests for NDPluginProcess.
+ *
+ * The arrays are processed in chunks that are converted straight to the output data
+ * type, divided into stripes when ComputeThreads is more than 1. The tests compare the
+ * output with the values computed directly from the input.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD and asyn dependencies
+#include <NDPluginProcess.h>
+#include <asynPortDriver.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+#include <asynPortClient.h>
+
+#include "testingutilities.h"
+
+using namespace std;
+
+#define SIZE_X 300
+#define SIZE_Y 300
+
+struct ProcessPluginFixture
+{
+    NDArrayPool *arrayPool;
+    asynPortDriver *dummy_driver;
+    NDPluginProcess *proc;
+    TestingPlugin *ds;
+    asynInt32Client *dataType;
+    asynInt32Client *computeThreads;
+    asynInt32Client *saveBackground;
+    asynInt32Client *enableBackground;
+    asynInt32Client *enableOffsetScale;
+    asynFloat64Client *offset;
+    asynFloat64Client *scale;
+    asynInt32Client *enableLowClip;
+    asynFloat64Client *lowClip;
+    asynInt32Client *enableHighClip;
+    asynFloat64Client *highClip;
+
+    ProcessPluginFixture()
+    {
+        arrayPool = new NDArrayPool(100, 0);
+
+        std::string dummy_port("simPort"), testport("testPort");
+        uniqueAsynPortName(dummy_port);
+        uniqueAsynPortName(testport);
+
+        // The upstream driver is never used; arrays are passed by calling processCallbacks directly.
+        dummy_driver = new asynPortDriver(dummy_port.c_str(), 0, 1, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 2000000);
+
+        proc = new NDPluginProcess(testport.c_str(), 50, 0, dummy_port.c_str(), 0, 0, 0, 0, 2000000);
+
+        // This is the mock downstream plugin
+        ds = new TestingPlugin(testport.c_str(), 0);
+
+        dataType = new asynInt32Client(testport.c_str(), 0, NDPluginProcessDataTypeString);
+        computeThreads = new asynInt32Client(testport.c_str(), 0, NDPluginProcessComputeThreadsString);
+        saveBackground = new asynInt32Client(testport.c_str(), 0, NDPluginProcessSaveBackgroundString);
+        enableBackground = new asynInt32Client(testport.c_str(), 0, NDPluginProcessEnableBackgroundString);
+        enableOffsetScale = new asynInt32Client(testport.c_str(), 0, NDPluginProcessEnableOffsetScaleString);
+        offset = new asynFloat64Client(testport.c_str(), 0, NDPluginProcessOffsetString);
+        scale = new asynFloat64Client(testport.c_str(), 0, NDPluginProcessScaleString);
+        enableLowClip = new asynInt32Client(testport.c_str(), 0, NDPluginProcessEnableLowClipString);
+        lowClip = new asynFloat64Client(testport.c_str(), 0, NDPluginProcessLowClipString);
+        enableHighClip = new asynInt32Client(testport.c_str(), 0, NDPluginProcessEnableHighClipString);
+        highClip = new asynFloat64Client(testport.c_str(), 0, NDPluginProcessHighClipString);
+
+        dataType->write(-1);
+    }
+    ~ProcessPluginFixture()
+    {
+        delete highClip;
+        delete enableHighClip;
+        delete lowClip;
+        delete enableLowClip;
+        delete scale;
+        delete offset;
+        delete enableOffsetScale;
+        delete enableBackground;
+        delete saveBackground;
+        delete computeThreads;
+        delete dataType;
+        delete proc;
+        delete dummy_driver;
+        delete arrayPool;
+    }
+    void procProcess(NDArray *pArray)
+    {
+        proc->lock();
+        proc->processCallbacks(pArray);
+        proc->unlock();
+    }
+};
+
+// Fills a UInt16 array with values that depend on the position and the seed
+static NDArray *makeArray(NDArrayPool *arrayPool, int seed)
+{
+    size_t dims[2] = {SIZE_X, SIZE_Y};
+    NDArray *pArray = arrayPool->alloc(2, dims, NDUInt16, 0, NULL);
+    epicsUInt16 *pData = (epicsUInt16 *)pArray->pData;
+
+    for (size_t i=0; i<SIZE_X*SIZE_Y; i++) {
+        pData[i] = (epicsUInt16)((i * 7 + seed * 13) % 1000 + 100);
+    }
+    return pArray;
+}
+
+BOOST_FIXTURE_TEST_SUITE(ProcessTests, ProcessPluginFixture)
+
+BOOST_AUTO_TEST_CASE(test_OffsetScaleClip)
+{
+    NDArray *pArray = makeArray(arrayPool, 1);
+    epicsUInt16 *pIn = (epicsUInt16 *)pArray->pData;
+    int threads[] = {1, 4};
+
+    dataType->write(NDUInt8);
+    enableOffsetScale->write(1);
+    offset->write(-100.);
+    scale->write(0.5);
+    enableLowClip->write(1);
+    lowClip->write(20.);
+    enableHighClip->write(1);
+    highClip->write(250.);
+
+    for (int t=0; t<2; t++) {
+        computeThreads->write(threads[t]);
+        procProcess(pArray);
+        BOOST_REQUIRE_EQUAL((size_t)(t+1), ds->arrays.size());
+        NDArray *pOut = ds->arrays.back();
+        BOOST_REQUIRE_EQUAL(NDUInt8, pOut->dataType);
+        BOOST_CHECK_EQUAL(pArray->uniqueId, pOut->uniqueId);
+        epicsUInt8 *pData = (epicsUInt8 *)pOut->pData;
+        int mismatches = 0;
+        for (size_t i=0; i<SIZE_X*SIZE_Y; i++) {
+            double value = ((double)pIn[i] - 100.) * 0.5;
+            if (value > 250.) value = 250.;
+            if (value < 20.) value = 20.;
+            if (pData[i] != (epicsUInt8)value) mismatches++;
+        }
+        BOOST_CHECK_EQUAL(0, mismatches);
+    }
+    pArray->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_BackgroundSubtraction)
+{
+    NDArray *pBackground = makeArray(arrayPool, 1);
+    NDArray *pArray = makeArray(arrayPool, 2);
+    epicsUInt16 *pBgd = (epicsUInt16 *)pBackground->pData;
+    epicsUInt16 *pIn = (epicsUInt16 *)pArray->pData;
+    int threads[] = {1, 3};
+
+    // Keep the background below the smallest value of the array, so the differences are positive
+    for (size_t i=0; i<SIZE_X*SIZE_Y; i++) pBgd[i] = (epicsUInt16)(i % 90);
+
+    // The background is saved from the last output array
+    procProcess(pBackground);
+    saveBackground->write(1);
+    enableBackground->write(1);
+
+    for (int t=0; t<2; t++) {
+        computeThreads->write(threads[t]);
+        procProcess(pArray);
+        NDArray *pOut = ds->arrays.back();
+        BOOST_REQUIRE_EQUAL(NDUInt16, pOut->dataType);
+        epicsUInt16 *pData = (epicsUInt16 *)pOut->pData;
+        int mismatches = 0;
+        for (size_t i=0; i<SIZE_X*SIZE_Y; i++) {
+            if (pData[i] != pIn[i] - pBgd[i]) mismatches++;
+        }
+        BOOST_CHECK_EQUAL(0, mismatches);
+    }
+    pArray->release();
+    pBackground->release();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
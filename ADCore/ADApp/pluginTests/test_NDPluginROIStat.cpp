@@ -0,0 +1,231 @@
+/**
+ * Tests for NDPluginROIStat.
+ *
+ * All of the ROIs are computed in one sweep over the array, divided into bands of rows when
+ * ComputeThreads is more than 1. The tests compare the results of overlapping ROIs with
+ * values computed directly from the array, for 1 and several threads, and check that the time
+ * series advance with each array.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD and asyn dependencies
+#include <NDPluginROIStat.h>
+#include <asynPortDriver.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+#include <asynPortClient.h>
+
+#include "testingutilities.h"
+
+using namespace std;
+
+#define SIZE_X 410
+#define SIZE_Y 290
+#define NUM_ROIS 16
+
+struct ROIStatReference
+{
+    double min, max, total, mean, net;
+};
+
+struct ROIStatPluginFixture
+{
+    NDArrayPool *arrayPool;
+    asynPortDriver *dummy_driver;
+    NDPluginROIStat *roiStat;
+    asynInt32Client *computeThreads;
+    asynInt32Client *tsControl;
+    asynInt32Client *tsCurrentPoint;
+    asynInt32Client *use[NUM_ROIS];
+    asynInt32Client *dim0Min[NUM_ROIS];
+    asynInt32Client *dim0Size[NUM_ROIS];
+    asynInt32Client *dim1Min[NUM_ROIS];
+    asynInt32Client *dim1Size[NUM_ROIS];
+    asynInt32Client *bgdWidth[NUM_ROIS];
+    asynFloat64Client *minValue[NUM_ROIS];
+    asynFloat64Client *maxValue[NUM_ROIS];
+    asynFloat64Client *meanValue[NUM_ROIS];
+    asynFloat64Client *total[NUM_ROIS];
+    asynFloat64Client *net[NUM_ROIS];
+
+    ROIStatPluginFixture()
+    {
+        arrayPool = new NDArrayPool(100, 0);
+
+        std::string dummy_port("simPort"), testport("testPort");
+        uniqueAsynPortName(dummy_port);
+        uniqueAsynPortName(testport);
+
+        // The upstream driver is never used; arrays are passed by calling processCallbacks directly.
+        dummy_driver = new asynPortDriver(dummy_port.c_str(), 0, 1, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 2000000);
+
+        roiStat = new NDPluginROIStat(testport.c_str(), 50, 0, dummy_port.c_str(), 0, NUM_ROIS, 0, 0, 0, 2000000);
+
+        computeThreads = new asynInt32Client(testport.c_str(), 0, NDPluginROIStatComputeThreadsString);
+        tsControl = new asynInt32Client(testport.c_str(), 0, NDPluginROIStatTSControlString);
+        tsCurrentPoint = new asynInt32Client(testport.c_str(), 0, NDPluginROIStatTSCurrentPointString);
+        for (int roi=0; roi<NUM_ROIS; roi++) {
+            use[roi] = new asynInt32Client(testport.c_str(), roi, NDPluginROIStatUseString);
+            dim0Min[roi] = new asynInt32Client(testport.c_str(), roi, NDPluginROIStatDim0MinString);
+            dim0Size[roi] = new asynInt32Client(testport.c_str(), roi, NDPluginROIStatDim0SizeString);
+            dim1Min[roi] = new asynInt32Client(testport.c_str(), roi, NDPluginROIStatDim1MinString);
+            dim1Size[roi] = new asynInt32Client(testport.c_str(), roi, NDPluginROIStatDim1SizeString);
+            bgdWidth[roi] = new asynInt32Client(testport.c_str(), roi, NDPluginROIStatBgdWidthString);
+            minValue[roi] = new asynFloat64Client(testport.c_str(), roi, NDPluginROIStatMinValueString);
+            maxValue[roi] = new asynFloat64Client(testport.c_str(), roi, NDPluginROIStatMaxValueString);
+            meanValue[roi] = new asynFloat64Client(testport.c_str(), roi, NDPluginROIStatMeanValueString);
+            total[roi] = new asynFloat64Client(testport.c_str(), roi, NDPluginROIStatTotalString);
+            net[roi] = new asynFloat64Client(testport.c_str(), roi, NDPluginROIStatNetString);
+        }
+    }
+    ~ROIStatPluginFixture()
+    {
+        for (int roi=0; roi<NUM_ROIS; roi++) {
+            delete net[roi];
+            delete total[roi];
+            delete meanValue[roi];
+            delete maxValue[roi];
+            delete minValue[roi];
+            delete bgdWidth[roi];
+            delete dim1Size[roi];
+            delete dim1Min[roi];
+            delete dim0Size[roi];
+            delete dim0Min[roi];
+            delete use[roi];
+        }
+        delete tsCurrentPoint;
+        delete tsControl;
+        delete computeThreads;
+        delete roiStat;
+        delete dummy_driver;
+        delete arrayPool;
+    }
+    void roiStatProcess(NDArray *pArray)
+    {
+        roiStat->lock();
+        roiStat->processCallbacks(pArray);
+        roiStat->unlock();
+    }
+    void setROI(int roi, int x, int sizeX, int y, int sizeY, int width)
+    {
+        dim0Min[roi]->write(x);
+        dim0Size[roi]->write(sizeX);
+        dim1Min[roi]->write(y);
+        dim1Size[roi]->write(sizeY);
+        bgdWidth[roi]->write(width);
+        use[roi]->write(1);
+    }
+    void checkResults(int roi, const ROIStatReference &ref)
+    {
+        double value;
+
+        minValue[roi]->read(&value);  BOOST_CHECK_CLOSE(value, ref.min, 1e-9);
+        maxValue[roi]->read(&value);  BOOST_CHECK_CLOSE(value, ref.max, 1e-9);
+        total[roi]->read(&value);     BOOST_CHECK_CLOSE(value, ref.total, 1e-9);
+        meanValue[roi]->read(&value); BOOST_CHECK_CLOSE(value, ref.mean, 1e-9);
+        net[roi]->read(&value);       BOOST_CHECK_CLOSE(value, ref.net, 1e-9);
+    }
+};
+
+// Computes the statistics of one ROI directly. The background is the first and last width rows
+// and the first and last width elements of the rows in between, counting overlaps twice.
+static void computeReference(const epicsUInt16 *pData, size_t x0, size_t sizeX, size_t y0, size_t sizeY,
+                             size_t width, ROIStatReference *pRef)
+{
+    size_t widthX = width < sizeX ? width : sizeX;
+    size_t widthY = width < sizeY ? width : sizeY;
+    double bgd = 0.;
+    size_t nBgd = 0;
+
+    pRef->min = 1e300;
+    pRef->max = -1e300;
+    pRef->total = 0.;
+    for (size_t y=y0; y<y0+sizeY; y++) {
+        for (size_t x=x0; x<x0+sizeX; x++) {
+            double v = pData[y*SIZE_X + x];
+            if (v < pRef->min) pRef->min = v;
+            if (v > pRef->max) pRef->max = v;
+            pRef->total += v;
+            int count = 0;
+            if (y < y0+widthY) count++;
+            if (y >= y0+sizeY-widthY) count++;
+            if (count == 0) {
+                if (x < x0+widthX) count++;
+                if (x >= x0+sizeX-widthX) count++;
+            }
+            bgd += count * v;
+            nBgd += count;
+        }
+    }
+    if (nBgd > 0) bgd = bgd / nBgd * (sizeX*sizeY);
+    pRef->mean = pRef->total / (sizeX*sizeY);
+    pRef->net = pRef->total - bgd;
+}
+
+BOOST_FIXTURE_TEST_SUITE(ROIStatTests, ROIStatPluginFixture)
+
+BOOST_AUTO_TEST_CASE(test_OverlappingROIs)
+{
+    size_t dims[2] = {SIZE_X, SIZE_Y};
+    NDArray *pArray = arrayPool->alloc(2, dims, NDUInt16, 0, NULL);
+    epicsUInt16 *pData = (epicsUInt16 *)pArray->pData;
+    struct {
+        int x, sizeX, y, sizeY, width;
+    } rois[] = {
+        {  0, SIZE_X,   0, SIZE_Y,  0},
+        { 10,    300,  20,    200,  5},
+        {100,    200, 100,    150, 20},
+        {405,     20, 280,     20,  3},   // Clipped at the corner of the array
+        { 50,      6,  10,    250, 10},   // Background columns overlap
+        { 60,    300, 150,      3,  2},   // Background rows overlap
+    };
+    int numROIs = sizeof(rois)/sizeof(rois[0]);
+    int threads[] = {1, 3, 8};
+
+    for (size_t i=0; i<SIZE_X*SIZE_Y; i++) pData[i] = (epicsUInt16)((i * 2654435761u) >> 20);
+    for (int roi=0; roi<numROIs; roi++) {
+        setROI(roi, rois[roi].x, rois[roi].sizeX, rois[roi].y, rois[roi].sizeY, rois[roi].width);
+    }
+
+    for (int t=0; t<3; t++) {
+        computeThreads->write(threads[t]);
+        roiStatProcess(pArray);
+        for (int roi=0; roi<numROIs; roi++) {
+            size_t sizeX = rois[roi].sizeX, sizeY = rois[roi].sizeY;
+            ROIStatReference ref;
+            if (rois[roi].x + sizeX > SIZE_X) sizeX = SIZE_X - rois[roi].x;
+            if (rois[roi].y + sizeY > SIZE_Y) sizeY = SIZE_Y - rois[roi].y;
+            computeReference(pData, rois[roi].x, sizeX, rois[roi].y, sizeY, rois[roi].width, &ref);
+            BOOST_TEST_MESSAGE("ROI " << roi << " with " << threads[t] << " threads");
+            checkResults(roi, ref);
+        }
+    }
+    pArray->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_TimeSeries)
+{
+    size_t dims[2] = {SIZE_X, SIZE_Y};
+    NDArray *pArray = arrayPool->alloc(2, dims, NDUInt16, 0, NULL);
+    int currentPoint;
+
+    memset(pArray->pData, 0, SIZE_X*SIZE_Y*sizeof(epicsUInt16));
+    setROI(0, 0, 100, 0, 100, 0);
+    setROI(1, 50, 100, 50, 100, 0);
+    tsControl->write(TSEraseStart);
+    for (int i=0; i<5; i++) roiStatProcess(pArray);
+    tsCurrentPoint->read(&currentPoint);
+    BOOST_CHECK_EQUAL(currentPoint, 5);
+    tsControl->write(TSStop);
+    roiStatProcess(pArray);
+    tsCurrentPoint->read(&currentPoint);
+    BOOST_CHECK_EQUAL(currentPoint, 5);
+    pArray->release();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
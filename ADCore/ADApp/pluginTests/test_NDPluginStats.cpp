@@ -0,0 +1,235 @@
+/**
+ * Tests for NDPluginStats.
+ *
+ * The statistics, centroid and histogram are computed in one sweep over the array,
+ * divided into stripes of rows when ComputeThreads is more than 1. The tests compare
+ * the results with values computed directly from the array, for 1 and several threads.
+ */
+
+#include <stdio.h>
+#include <math.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD and asyn dependencies
+#include <NDPluginStats.h>
+#include <asynPortDriver.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+#include <asynPortClient.h>
+
+#include "testingutilities.h"
+
+using namespace std;
+
+#define SIZE_X 400
+#define SIZE_Y 300
+#define HIST_SIZE 64
+#define HIST_MIN 0.
+#define HIST_MAX 1000.
+#define THRESHOLD 200.
+
+struct StatsReference
+{
+    double min, max, total, mean, sigma;
+    double centroidX, centroidY;
+    double entropy;
+};
+
+struct StatsPluginFixture
+{
+    NDArrayPool *arrayPool;
+    asynPortDriver *dummy_driver;
+    NDPluginStats *stats;
+    asynInt32Client *computeStatistics;
+    asynInt32Client *computeCentroid;
+    asynInt32Client *computeHistogram;
+    asynInt32Client *computeThreads;
+    asynInt32Client *histSize;
+    asynFloat64Client *histMin;
+    asynFloat64Client *histMax;
+    asynFloat64Client *centroidThreshold;
+    asynFloat64Client *minValue;
+    asynFloat64Client *maxValue;
+    asynFloat64Client *total;
+    asynFloat64Client *meanValue;
+    asynFloat64Client *sigmaValue;
+    asynFloat64Client *centroidX;
+    asynFloat64Client *centroidY;
+    asynFloat64Client *histEntropy;
+
+    StatsPluginFixture()
+    {
+        arrayPool = new NDArrayPool(100, 0);
+
+        std::string dummy_port("simPort"), testport("testPort");
+        uniqueAsynPortName(dummy_port);
+        uniqueAsynPortName(testport);
+
+        // The upstream driver is never used; arrays are passed by calling processCallbacks directly.
+        dummy_driver = new asynPortDriver(dummy_port.c_str(), 0, 1, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 2000000);
+
+        stats = new NDPluginStats(testport.c_str(), 50, 0, dummy_port.c_str(), 0, 0, 0, 0, 2000000);
+
+        computeStatistics = new asynInt32Client(testport.c_str(), 0, NDPluginStatsComputeStatisticsString);
+        computeCentroid = new asynInt32Client(testport.c_str(), 0, NDPluginStatsComputeCentroidString);
+        computeHistogram = new asynInt32Client(testport.c_str(), 0, NDPluginStatsComputeHistogramString);
+        computeThreads = new asynInt32Client(testport.c_str(), 0, NDPluginStatsComputeThreadsString);
+        histSize = new asynInt32Client(testport.c_str(), 0, NDPluginStatsHistSizeString);
+        histMin = new asynFloat64Client(testport.c_str(), 0, NDPluginStatsHistMinString);
+        histMax = new asynFloat64Client(testport.c_str(), 0, NDPluginStatsHistMaxString);
+        centroidThreshold = new asynFloat64Client(testport.c_str(), 0, NDPluginStatsCentroidThresholdString);
+        minValue = new asynFloat64Client(testport.c_str(), 0, NDPluginStatsMinValueString);
+        maxValue = new asynFloat64Client(testport.c_str(), 0, NDPluginStatsMaxValueString);
+        total = new asynFloat64Client(testport.c_str(), 0, NDPluginStatsTotalString);
+        meanValue = new asynFloat64Client(testport.c_str(), 0, NDPluginStatsMeanValueString);
+        sigmaValue = new asynFloat64Client(testport.c_str(), 0, NDPluginStatsSigmaValueString);
+        centroidX = new asynFloat64Client(testport.c_str(), 0, NDPluginStatsCentroidXString);
+        centroidY = new asynFloat64Client(testport.c_str(), 0, NDPluginStatsCentroidYString);
+        histEntropy = new asynFloat64Client(testport.c_str(), 0, NDPluginStatsHistEntropyString);
+
+        computeStatistics->write(1);
+        computeCentroid->write(1);
+        computeHistogram->write(1);
+        histSize->write(HIST_SIZE);
+        histMin->write(HIST_MIN);
+        histMax->write(HIST_MAX);
+        centroidThreshold->write(THRESHOLD);
+    }
+    ~StatsPluginFixture()
+    {
+        delete histEntropy;
+        delete centroidY;
+        delete centroidX;
+        delete sigmaValue;
+        delete meanValue;
+        delete total;
+        delete maxValue;
+        delete minValue;
+        delete centroidThreshold;
+        delete histMax;
+        delete histMin;
+        delete histSize;
+        delete computeThreads;
+        delete computeHistogram;
+        delete computeCentroid;
+        delete computeStatistics;
+        delete stats;
+        delete dummy_driver;
+        delete arrayPool;
+    }
+    void statsProcess(NDArray *pArray)
+    {
+        stats->lock();
+        stats->processCallbacks(pArray);
+        stats->unlock();
+    }
+    void checkResults(const StatsReference &ref)
+    {
+        double value;
+
+        minValue->read(&value);    BOOST_CHECK_CLOSE(value, ref.min, 1e-9);
+        maxValue->read(&value);    BOOST_CHECK_CLOSE(value, ref.max, 1e-9);
+        total->read(&value);       BOOST_CHECK_CLOSE(value, ref.total, 1e-9);
+        meanValue->read(&value);   BOOST_CHECK_CLOSE(value, ref.mean, 1e-9);
+        sigmaValue->read(&value);  BOOST_CHECK_CLOSE(value, ref.sigma, 1e-6);
+        centroidX->read(&value);   BOOST_CHECK_CLOSE(value, ref.centroidX, 1e-9);
+        centroidY->read(&value);   BOOST_CHECK_CLOSE(value, ref.centroidY, 1e-9);
+        histEntropy->read(&value); BOOST_CHECK_CLOSE(value, ref.entropy, 1e-9);
+    }
+};
+
+// Fills the array with a spot on a sloping background, so that the minimum, maximum and centroid
+// are each at a single known position
+template <typename epicsType>
+static NDArray *makeSpotArray(NDArrayPool *arrayPool, NDDataType_t dataType, StatsReference *pRef)
+{
+    size_t dims[2] = {SIZE_X, SIZE_Y};
+    NDArray *pArray = arrayPool->alloc(2, dims, dataType, 0, NULL);
+    epicsType *pData = (epicsType *)pArray->pData;
+    double histogram[HIST_SIZE] = {0};
+    double sum2 = 0., thresholdSum = 0., sumX = 0., sumY = 0.;
+    size_t nElements = SIZE_X * SIZE_Y;
+    size_t ix, iy;
+    int i;
+
+    pRef->min = 1e300;
+    pRef->max = -1e300;
+    pRef->total = 0.;
+    for (iy=0; iy<SIZE_Y; iy++) {
+        for (ix=0; ix<SIZE_X; ix++) {
+            double dx = (double)ix - 250., dy = (double)iy - 100.;
+            epicsType value = (epicsType)((ix + iy) / 10 + 900. * exp(-(dx*dx + dy*dy) / 200.));
+            double v = (double)value;
+            *pData++ = value;
+            if (v < pRef->min) pRef->min = v;
+            if (v > pRef->max) pRef->max = v;
+            pRef->total += v;
+            sum2 += v * v;
+            if (v >= THRESHOLD) {
+                thresholdSum += v;
+                sumX += v * ix;
+                sumY += v * iy;
+            }
+            int bin = (int)(((v - HIST_MIN) * HIST_SIZE / (HIST_MAX - HIST_MIN)) + 0.5);
+            if ((bin >= 0) && (bin < HIST_SIZE)) histogram[bin]++;
+        }
+    }
+    pRef->mean = pRef->total / nElements;
+    pRef->sigma = sqrt(sum2 / nElements - pRef->mean * pRef->mean);
+    pRef->centroidX = sumX / thresholdSum;
+    pRef->centroidY = sumY / thresholdSum;
+    pRef->entropy = 0.;
+    for (i=0; i<HIST_SIZE; i++) {
+        double counts = histogram[i] > 0 ? histogram[i] : 1;
+        pRef->entropy += counts * log(counts);
+    }
+    pRef->entropy = -pRef->entropy / nElements;
+    return pArray;
+}
+
+BOOST_FIXTURE_TEST_SUITE(StatsTests, StatsPluginFixture)
+
+BOOST_AUTO_TEST_CASE(test_StatisticsUInt16)
+{
+    StatsReference ref;
+    NDArray *pArray = makeSpotArray<epicsUInt16>(arrayPool, NDUInt16, &ref);
+    int threads[] = {1, 3, 8};
+
+    for (int i=0; i<3; i++) {
+        computeThreads->write(threads[i]);
+        statsProcess(pArray);
+        checkResults(ref);
+    }
+    pArray->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_StatisticsFloat32)
+{
+    StatsReference ref;
+    NDArray *pArray = makeSpotArray<epicsFloat32>(arrayPool, NDFloat32, &ref);
+    int threads[] = {1, 4};
+
+    for (int i=0; i<2; i++) {
+        computeThreads->write(threads[i]);
+        statsProcess(pArray);
+        checkResults(ref);
+    }
+    pArray->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_StatisticsInt32)
+{
+    StatsReference ref;
+    NDArray *pArray = makeSpotArray<epicsInt32>(arrayPool, NDInt32, &ref);
+    int threads[] = {1, 4};
+
+    for (int i=0; i<2; i++) {
+        computeThreads->write(threads[i]);
+        statsProcess(pArray);
+        checkResults(ref);
+    }
+    pArray->release();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
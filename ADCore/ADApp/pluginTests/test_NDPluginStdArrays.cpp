@@ -0,0 +1,158 @@
+/**
+ * Tests for NDPluginStdArrays.
+ *
+ * Reads the waveform data of the last array with preview mode disabled and enabled, and checks
+ * that the preview is the array averaged over the binning, with the preview dimensions reported,
+ * and that reading the preview writes no more than the preview elements.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD and asyn dependencies
+#include <NDPluginStdArrays.h>
+#include <asynPortDriver.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+#include <asynPortClient.h>
+
+#include "testingutilities.h"
+
+using namespace std;
+
+#define SIZE_X 400
+#define SIZE_Y 300
+
+struct StdArraysPluginFixture
+{
+    NDArrayPool *arrayPool;
+    asynPortDriver *dummy_driver;
+    NDPluginStdArrays *stdArrays;
+    asynInt32Client *preview;
+    asynInt32Client *previewSize;
+    asynInt32Client *previewBinning;
+    asynInt16ArrayClient *arrayData;
+    asynInt32ArrayClient *dimensions;
+    epicsInt16 *buffer;
+
+    StdArraysPluginFixture()
+    {
+        arrayPool = new NDArrayPool(100, 0);
+
+        std::string dummy_port("simPort"), testport("testPort");
+        uniqueAsynPortName(dummy_port);
+        uniqueAsynPortName(testport);
+
+        // The upstream driver is never used; arrays are passed by calling processCallbacks directly.
+        dummy_driver = new asynPortDriver(dummy_port.c_str(), 0, 1, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 2000000);
+
+        stdArrays = new NDPluginStdArrays(testport.c_str(), 50, 0, dummy_port.c_str(), 0, 0, 0, 2000000);
+
+        preview = new asynInt32Client(testport.c_str(), 0, NDPluginStdArraysPreviewString);
+        previewSize = new asynInt32Client(testport.c_str(), 0, NDPluginStdArraysPreviewSizeString);
+        previewBinning = new asynInt32Client(testport.c_str(), 0, NDPluginStdArraysPreviewBinningString);
+        arrayData = new asynInt16ArrayClient(testport.c_str(), 0, NDPluginStdArraysDataString);
+        dimensions = new asynInt32ArrayClient(testport.c_str(), 0, NDDimensionsString);
+        buffer = new epicsInt16[SIZE_X*SIZE_Y];
+    }
+    ~StdArraysPluginFixture()
+    {
+        delete [] buffer;
+        delete dimensions;
+        delete arrayData;
+        delete previewBinning;
+        delete previewSize;
+        delete preview;
+        delete stdArrays;
+        delete dummy_driver;
+        delete arrayPool;
+    }
+    void stdArraysProcess(NDArray *pArray)
+    {
+        stdArrays->lock();
+        stdArrays->processCallbacks(pArray);
+        stdArrays->unlock();
+    }
+    // Makes an array whose value at each element (x, y) is x + 100*y, so that no two rows are the same
+    NDArray *makeArray()
+    {
+        size_t dims[2] = {SIZE_X, SIZE_Y};
+        NDArray *pArray = arrayPool->alloc(2, dims, NDUInt16, 0, NULL);
+        epicsUInt16 *pData = (epicsUInt16 *)pArray->pData;
+        for (size_t i=0; i<SIZE_X*SIZE_Y; i++) pData[i] = (epicsUInt16)(i % SIZE_X + 100*(i / SIZE_X));
+        return pArray;
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(StdArraysTests, StdArraysPluginFixture)
+
+BOOST_AUTO_TEST_CASE(test_FullArray)
+{
+    NDArray *pArray = makeArray();
+    size_t nIn = 0;
+    int binning;
+
+    preview->write(0);
+    stdArraysProcess(pArray);
+    previewBinning->read(&binning);
+    BOOST_CHECK_EQUAL(binning, 1);
+    arrayData->read(buffer, SIZE_X*SIZE_Y, &nIn);
+    BOOST_REQUIRE_EQUAL(nIn, (size_t)(SIZE_X*SIZE_Y));
+    int mismatches = 0;
+    for (size_t i=0; i<nIn; i++) if (buffer[i] != (epicsInt16)(i % SIZE_X + 100*(i / SIZE_X))) mismatches++;
+    BOOST_CHECK_EQUAL(mismatches, 0);
+    pArray->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_Preview)
+{
+    NDArray *pArray = makeArray();
+    epicsInt32 dims[ND_ARRAY_MAX_DIMS];
+    const size_t previewX = SIZE_X/4, previewY = SIZE_Y/4;
+    const epicsInt16 canary = 0x5A5A;
+    size_t nIn = 0;
+    int binning;
+
+    // 400x300 binned by 3 is still more than 10000 elements, binned by 4 it is 100x75
+    preview->write(1);
+    previewSize->write(10000);
+    stdArraysProcess(pArray);
+    previewBinning->read(&binning);
+    BOOST_CHECK_EQUAL(binning, 4);
+    dimensions->read(dims, ND_ARRAY_MAX_DIMS, &nIn);
+    BOOST_CHECK_EQUAL(dims[0], SIZE_X/4);
+    BOOST_CHECK_EQUAL(dims[1], SIZE_Y/4);
+
+    // Read into a buffer of exactly the preview size, followed by a canary that must not be overwritten
+    buffer[previewX*previewY] = canary;
+    arrayData->read(buffer, previewX*previewY, &nIn);
+    BOOST_REQUIRE_EQUAL(nIn, previewX*previewY);
+    BOOST_CHECK_EQUAL(buffer[previewX*previewY], canary);
+    // Each element is the average of X=4*x...4*x+3 and Y=4*y...4*y+3, which is 4*x+1.5 + 100*(4*y+1.5) truncated
+    int mismatches = 0;
+    for (size_t y=0; y<previewY; y++) {
+        for (size_t x=0; x<previewX; x++) {
+            if (buffer[y*previewX + x] != (epicsInt16)(4*x + 400*y + 151)) mismatches++;
+        }
+    }
+    BOOST_CHECK_EQUAL(mismatches, 0);
+
+    // The binning is kept between arrays, but a new PreviewSize or new dimensions must change it
+    previewSize->write(SIZE_X*SIZE_Y);
+    stdArraysProcess(pArray);
+    previewBinning->read(&binning);
+    BOOST_CHECK_EQUAL(binning, 1);
+    previewSize->write(10000);
+    stdArraysProcess(pArray);
+    previewBinning->read(&binning);
+    BOOST_CHECK_EQUAL(binning, 4);
+    pArray->dims[1].size = SIZE_Y/2;
+    stdArraysProcess(pArray);
+    previewBinning->read(&binning);
+    BOOST_CHECK_EQUAL(binning, 3);
+    pArray->dims[1].size = SIZE_Y;
+    pArray->release();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
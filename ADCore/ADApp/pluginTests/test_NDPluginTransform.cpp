@@ -0,0 +1,222 @@
+/**
+ * Tests for NDPluginTransform.
+ *
+ * Every transform is checked against the input pixel that each output pixel should
+ * come from, for mono and RGB1 arrays, with one thread and with the image divided
+ * between several ComputeThreads, and the SSE2 block transpose is checked against
+ * the plain C++ loops.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD and asyn dependencies
+#include <NDPluginTransform.h>
+#include <asynPortDriver.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+#include <asynPortClient.h>
+
+#include "testingutilities.h"
+
+using namespace std;
+
+#define SIZE_X 410
+#define SIZE_Y 290
+#define NUM_TRANSFORMS 8
+
+struct TransformPluginFixture
+{
+    NDArrayPool *arrayPool;
+    asynPortDriver *dummy_driver;
+    NDPluginTransform *trans;
+    TestingPlugin *ds;
+    asynInt32Client *transformType;
+    asynInt32Client *computeThreads;
+
+    TransformPluginFixture()
+    {
+        arrayPool = new NDArrayPool(100, 0);
+
+        std::string dummy_port("simPort"), testport("testPort");
+        uniqueAsynPortName(dummy_port);
+        uniqueAsynPortName(testport);
+
+        // The upstream driver is never used; arrays are passed by calling processCallbacks directly.
+        dummy_driver = new asynPortDriver(dummy_port.c_str(), 0, 1, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 2000000);
+
+        trans = new NDPluginTransform(testport.c_str(), 50, 0, dummy_port.c_str(), 0, 0, 0, 0, 2000000);
+
+        // This is the mock downstream plugin
+        ds = new TestingPlugin(testport.c_str(), 0);
+
+        transformType = new asynInt32Client(testport.c_str(), 0, NDPluginTransformTypeString);
+        computeThreads = new asynInt32Client(testport.c_str(), 0, NDPluginTransformComputeThreadsString);
+    }
+    ~TransformPluginFixture()
+    {
+        delete computeThreads;
+        delete transformType;
+        delete trans;
+        delete dummy_driver;
+        delete arrayPool;
+    }
+    void transProcess(NDArray *pArray)
+    {
+        trans->lock();
+        trans->processCallbacks(pArray);
+        trans->unlock();
+    }
+};
+
+// Finds the input pixel (ix, iy) of output pixel (ox, oy) for each transform type
+static void sourcePixel(int transform, size_t ox, size_t oy, size_t *ix, size_t *iy)
+{
+    switch (transform) {
+        case 1:  *ix = oy;              *iy = SIZE_Y-1 - ox; break;  // Rot90
+        case 2:  *ix = SIZE_X-1 - ox;   *iy = SIZE_Y-1 - oy; break;  // Rot180
+        case 3:  *ix = SIZE_X-1 - oy;   *iy = ox;            break;  // Rot270
+        case 4:  *ix = SIZE_X-1 - ox;   *iy = oy;            break;  // Mirror
+        case 5:  *ix = oy;              *iy = ox;            break;  // Rot90Mirror
+        case 6:  *ix = ox;              *iy = SIZE_Y-1 - oy; break;  // Rot180Mirror
+        case 7:  *ix = SIZE_X-1 - oy;   *iy = SIZE_Y-1 - ox; break;  // Rot270Mirror
+        default: *ix = ox;              *iy = oy;            break;  // None
+    }
+}
+
+BOOST_FIXTURE_TEST_SUITE(TransformTests, TransformPluginFixture)
+
+BOOST_AUTO_TEST_CASE(test_MonoTransforms)
+{
+    size_t dims[2] = {SIZE_X, SIZE_Y};
+    NDArray *pArray = arrayPool->alloc(2, dims, NDUInt16, 0, NULL);
+    epicsUInt16 *pIn = (epicsUInt16 *)pArray->pData;
+    int threads[] = {1, 3};
+
+    for (size_t i=0; i<SIZE_X*SIZE_Y; i++) pIn[i] = (epicsUInt16)(i * 7);
+
+    for (int t=0; t<2; t++) {
+        computeThreads->write(threads[t]);
+        for (int transform=0; transform<NUM_TRANSFORMS; transform++) {
+            transformType->write(transform);
+            transProcess(pArray);
+            NDArray *pOut = ds->arrays.back();
+            bool swapped = (transform == 1) || (transform == 3) || (transform == 5) || (transform == 7);
+            size_t outX = swapped ? SIZE_Y : SIZE_X;
+            size_t outY = swapped ? SIZE_X : SIZE_Y;
+            BOOST_REQUIRE_EQUAL(outX, pOut->dims[0].size);
+            BOOST_REQUIRE_EQUAL(outY, pOut->dims[1].size);
+            epicsUInt16 *pData = (epicsUInt16 *)pOut->pData;
+            int mismatches = 0;
+            for (size_t oy=0; oy<outY; oy++) {
+                for (size_t ox=0; ox<outX; ox++) {
+                    size_t ix, iy;
+                    sourcePixel(transform, ox, oy, &ix, &iy);
+                    if (pData[oy*outX + ox] != pIn[iy*SIZE_X + ix]) mismatches++;
+                }
+            }
+            BOOST_CHECK_MESSAGE(mismatches == 0, "transform " << transform << " with " << threads[t]
+                                << " threads has " << mismatches << " wrong pixels");
+        }
+    }
+    pArray->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_RGB1Transforms)
+{
+    size_t dims[3] = {3, SIZE_X, SIZE_Y};
+    NDArray *pArray = arrayPool->alloc(3, dims, NDUInt8, 0, NULL);
+    epicsUInt8 *pIn = (epicsUInt8 *)pArray->pData;
+    int colorMode = NDColorModeRGB1;
+
+    pArray->pAttributeList->add("ColorMode", "Color mode", NDAttrInt32, &colorMode);
+    for (size_t i=0; i<3*SIZE_X*SIZE_Y; i++) pIn[i] = (epicsUInt8)(i * 13 + i / 251);
+
+    computeThreads->write(2);
+    for (int transform=1; transform<NUM_TRANSFORMS; transform++) {
+        transformType->write(transform);
+        transProcess(pArray);
+        NDArray *pOut = ds->arrays.back();
+        bool swapped = (transform == 1) || (transform == 3) || (transform == 5) || (transform == 7);
+        size_t outX = swapped ? SIZE_Y : SIZE_X;
+        size_t outY = swapped ? SIZE_X : SIZE_Y;
+        BOOST_REQUIRE_EQUAL((size_t)3, pOut->dims[0].size);
+        BOOST_REQUIRE_EQUAL(outX, pOut->dims[1].size);
+        BOOST_REQUIRE_EQUAL(outY, pOut->dims[2].size);
+        epicsUInt8 *pData = (epicsUInt8 *)pOut->pData;
+        int mismatches = 0;
+        for (size_t oy=0; oy<outY; oy++) {
+            for (size_t ox=0; ox<outX; ox++) {
+                size_t ix, iy;
+                sourcePixel(transform, ox, oy, &ix, &iy);
+                for (int color=0; color<3; color++) {
+                    if (pData[(oy*outX + ox)*3 + color] != pIn[(iy*SIZE_X + ix)*3 + color]) mismatches++;
+                }
+            }
+        }
+        BOOST_CHECK_MESSAGE(mismatches == 0, "transform " << transform << " has " << mismatches << " wrong values");
+    }
+    pArray->release();
+}
+
+// The rotations transpose 8x8 blocks of 8 and 16 bit data with SSE2 instructions; they must give the
+// same data as the plain C++ loops
+template <typename epicsType>
+static void checkSSE2MatchesScalar(TransformPluginFixture *f, NDDataType_t dataType)
+{
+    size_t dims[2] = {SIZE_X, SIZE_Y};
+    NDArray *pArray = f->arrayPool->alloc(2, dims, dataType, 0, NULL);
+    epicsType *pIn = (epicsType *)pArray->pData;
+    size_t nBytes = SIZE_X*SIZE_Y*sizeof(epicsType);
+
+    for (size_t i=0; i<SIZE_X*SIZE_Y; i++) pIn[i] = (epicsType)rand();
+    for (int transform=1; transform<NUM_TRANSFORMS; transform++) {
+        f->transformType->write(transform);
+        transformSSE2 = 1;
+        f->transProcess(pArray);
+        // The plugin releases its output when it processes the next array, so keep this one for the comparison
+        NDArray *pSSE2 = f->ds->arrays.back();
+        pSSE2->reserve();
+        transformSSE2 = 0;
+        f->transProcess(pArray);
+        NDArray *pScalar = f->ds->arrays.back();
+        BOOST_CHECK_MESSAGE(memcmp(pSSE2->pData, pScalar->pData, nBytes) == 0,
+                            "transform " << transform << " of data type " << dataType << " differs without SSE2");
+        pSSE2->release();
+    }
+    transformSSE2 = 1;
+    pArray->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_SSE2MatchesScalar)
+{
+    computeThreads->write(2);
+    checkSSE2MatchesScalar<epicsUInt8>(this, NDUInt8);
+    checkSSE2MatchesScalar<epicsUInt16>(this, NDUInt16);
+}
+
+BOOST_AUTO_TEST_CASE(test_FourDimensionsPassedThrough)
+{
+    size_t dims[4] = {4, 5, 6, 7};
+    NDArray *pArray = arrayPool->alloc(4, dims, NDUInt16, 0, NULL);
+    epicsUInt16 *pIn = (epicsUInt16 *)pArray->pData;
+    size_t nElements = 4*5*6*7;
+
+    // Arrays with more than 3 dimensions are not transformed but their data are still passed on
+    for (size_t i=0; i<nElements; i++) pIn[i] = (epicsUInt16)(i * 3);
+    transformType->write(1);
+    transProcess(pArray);
+    NDArray *pOut = ds->arrays.back();
+    BOOST_REQUIRE_EQUAL(4, pOut->ndims);
+    int mismatches = 0;
+    for (size_t i=0; i<nElements; i++) {
+        if (((epicsUInt16 *)pOut->pData)[i] != pIn[i]) mismatches++;
+    }
+    BOOST_CHECK_EQUAL(0, mismatches);
+    pArray->release();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -42,6 +42,42 @@ void fillNDArrays(const std::vector<size_t>& dimensions,
 }
 
 
+template <typename epicsType>
+static void fillFrameNumber(NDArray *parr, size_t frame)
+{
+  epicsType *pData = (epicsType *)parr->pData;
+  size_t nElements = parr->dataSize / sizeof(epicsType);
+  for (size_t i = 0; i < nElements; i++) pData[i] = (epicsType)frame;
+}
+
+/** Create the arrays like fillNDArrays, but with every element of each array and
+ * its uniqueId set to the index of the array, so that the frames can be told apart
+ * when they are read back.
+ */
+void fillNDArraysWithFrameNumber(const std::vector<size_t>& dimensions,
+                                 NDDataType_t dataType,
+                                 std::vector<NDArray*>& arrays)
+{
+  fillNDArrays(dimensions, dataType, arrays);
+  for (size_t frame = 0; frame < arrays.size(); frame++)
+  {
+    NDArray* parr = arrays[frame];
+    switch (dataType)
+    {
+      case NDInt8:    fillFrameNumber<epicsInt8>(parr, frame);    break;
+      case NDUInt8:   fillFrameNumber<epicsUInt8>(parr, frame);   break;
+      case NDInt16:   fillFrameNumber<epicsInt16>(parr, frame);   break;
+      case NDUInt16:  fillFrameNumber<epicsUInt16>(parr, frame);  break;
+      case NDInt32:   fillFrameNumber<epicsInt32>(parr, frame);   break;
+      case NDUInt32:  fillFrameNumber<epicsUInt32>(parr, frame);  break;
+      case NDFloat32: fillFrameNumber<epicsFloat32>(parr, frame); break;
+      case NDFloat64: fillFrameNumber<epicsFloat64>(parr, frame); break;
+      default: break;
+    }
+    parr->uniqueId = (int)frame;
+  }
+}
+
 /** Append a unique code at the end of the string name
  * To be used to generate unique asyn port names. Currently only
  * implemented with a basic static counter.
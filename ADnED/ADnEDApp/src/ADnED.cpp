@@ -102,7 +102,7 @@ ADnED::ADnED(const char *portName, int maxBuffers, size_t maxMemory, int debug)
              1, /* Autoconnect */
              0, /* default priority */
              0), /* Default stack size*/
-    m_debug(debug),single_file_num(0),capture_file_num(0),pulse_id_dim(1), capture_group_num(0),storageFlag(1),stream_group_num(0),start_every_slap(0),slab_start{0}, slab_size{0},common_aChar_len(256),pulse_num_per_file(45000)
+    m_debug(debug),single_file_num(0),capture_file_num(0),pulse_id_dim(1), capture_group_num(0),storageFlag(1),stream_group_num(0),start_every_slap(0),common_aChar_len(256),pulse_num_per_file(45000)
 {
 
   int status = asynSuccess;
@@ -223,6 +223,16 @@ ADnED::ADnED(const char *portName, int maxBuffers, size_t maxMemory, int debug)
   createParam(ADnEDHdfGasContentMessageParamString,        asynParamOctet,    &ADnEDHdfGasContentMessageParam);
 
   createParam(ADnEDHdfNumPulsePerFileParamString,        asynParamInt32,    &ADnEDHdfNumPulsePerFileParam);
+  createParam(ADnEDHdfBatchSizeParamString,        asynParamInt32,    &ADnEDHdfBatchSizeParam);
+  createParam(ADnEDHdfFlushPeriodParamString,      asynParamFloat64,  &ADnEDHdfFlushPeriodParam);
+  createParam(ADnEDHdfCompressionParamString,      asynParamInt32,    &ADnEDHdfCompressionParam);
+  createParam(ADnEDHdfQueueUsedParamString,        asynParamInt32,    &ADnEDHdfQueueUsedParam);
+  createParam(ADnEDHdfDroppedPulsesParamString,    asynParamInt32,    &ADnEDHdfDroppedPulsesParam);
+  createParam(ADnEDHdfWriteRateParamString,        asynParamFloat64,  &ADnEDHdfWriteRateParam);
+
+  createParam(ADnEDHistThreadsParamString,        asynParamInt32,    &ADnEDHistThreadsParam);
+  createParam(ADnEDHistParallelMinParamString,    asynParamInt32,    &ADnEDHistParallelMinParam);
+  createParam(ADnEDHistEventRateParamString,      asynParamFloat64,  &ADnEDHistEventRateParam);
 
   // warning  don't access
   createParam(ADnEDLastParamString,               asynParamInt32,    &ADnEDLastParam);
@@ -416,6 +426,15 @@ ADnED::ADnED(const char *portName, int maxBuffers, size_t maxMemory, int debug)
   paramStatus = ((setIntegerParam(ADnEDTOFMaxParam, 0) == asynSuccess) && paramStatus);
   paramStatus = ((setIntegerParam(ADnEDAllocSpaceParam, 0) == asynSuccess) && paramStatus);
   paramStatus = ((setIntegerParam(ADnEDAllocSpaceStatusParam, s_ADNED_ALLOC_STATUS_OK) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDHistThreadsParam, ADNED_HIST_DEFAULT_THREADS) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDHistParallelMinParam, ADNED_HIST_DEFAULT_PARALLEL_MIN) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(ADnEDHistEventRateParam, 0.0) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDHdfBatchSizeParam, ADNED_HDF_DEFAULT_BATCH_SIZE) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(ADnEDHdfFlushPeriodParam, ADNED_HDF_DEFAULT_FLUSH_PERIOD) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDHdfCompressionParam, 0) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDHdfQueueUsedParam, 0) == asynSuccess) && paramStatus);
+  paramStatus = ((setIntegerParam(ADnEDHdfDroppedPulsesParam, 0) == asynSuccess) && paramStatus);
+  paramStatus = ((setDoubleParam(ADnEDHdfWriteRateParam, 0.0) == asynSuccess) && paramStatus);
 
   paramStatus = ((setStringParam (ADManufacturer, "CSNS") == asynSuccess) && paramStatus);
   paramStatus = ((setStringParam (ADModel, "nED areaDetector") == asynSuccess) && paramStatus);
@@ -432,6 +451,14 @@ ADnED::ADnED(const char *portName, int maxBuffers, size_t maxMemory, int debug)
     p_Transform[det] = new ADnEDTransform();
   }
 
+  //Event histogramming engine, with its worker threads
+  p_Histogram = new ADnEDHistogram(ADNED_HIST_MAX_THREADS);
+  memset(m_histDetConfig, 0, sizeof(m_histDetConfig));
+
+  //Event file writer, with its writer thread
+  p_EventWriter = new ADnEDEventWriter(ADNED_HDF_QUEUE_SIZE);
+  memset(&m_eventFileInfo, 0, sizeof(m_eventFileInfo));
+
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s End Of Constructor.\n", functionName);
 
   epicsThreadSleep(1);
@@ -443,9 +470,8 @@ ADnED::ADnED(const char *portName, int maxBuffers, size_t maxMemory, int debug)
  */
 ADnED::~ADnED()
 {
-  NXclose (&capture_file_id);
-  NXclosegroup (stream_file_id);
-  NXclose (&stream_file_id);
+  //Writes the queued pulses and closes the event file.
+  delete p_EventWriter;
   asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "ADnED::~ADnED Called.\n");
 
 
@@ -484,6 +510,8 @@ void ADnED::report(FILE *fp, int details)
   fprintf(fp, "ADnED port=%s\n", this->portName);
   if (details > 0) {
     fprintf(fp, "ADnED driver details...\n");
+    p_Histogram->report(fp, details);
+    p_EventWriter->report(fp, details);
   }
 
   fprintf(fp, "ADnED finished.\n");
@@ -1332,6 +1360,19 @@ void ADnED::resetTOFArray(epicsUInt32 det)
   }
 }
 
+/**
+ * Copy the name and metadata of the next event file into m_eventFileInfo,
+ * from hdfFilePath and the metadata messages.
+ */
+void ADnED::setEventFileInfo(void)
+{
+  memset(&m_eventFileInfo, 0, sizeof(m_eventFileInfo));
+  strncpy(m_eventFileInfo.filePath, hdfFilePath, sizeof(m_eventFileInfo.filePath)-1);
+  strncpy(m_eventFileInfo.hv1Message, hdfHV1Message, sizeof(m_eventFileInfo.hv1Message)-1);
+  strncpy(m_eventFileInfo.hv2Message, hdfHV2Message, sizeof(m_eventFileInfo.hv2Message)-1);
+  strncpy(m_eventFileInfo.gasMessage, hdfGasContentMessage, sizeof(m_eventFileInfo.gasMessage)-1);
+}
+
 /**
  * Event handler callback for monitor
  */
@@ -1345,6 +1386,12 @@ void ADnED::eventHandler(shared_ptr<epics::pvData::PVStructure> const &pv_struct
   double timeDiffSecs = 0.0;
   epicsUInt32 eventRate = 0;
   int numChanOrDet = 0;
+  int histThreads = ADNED_HIST_DEFAULT_THREADS;
+  int histParallelMin = ADNED_HIST_DEFAULT_PARALLEL_MIN;
+  int hdfBatchSize = 0;
+  double hdfFlushPeriod = 0.0;
+  int hdfCompression = 0;
+  ADnEDEventWriterStats writerStats;
   const char* functionName = "ADnED::eventHandler";
 
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s Event Handler. Channel ID %d\n", functionName, channelID);
@@ -1507,27 +1554,10 @@ void ADnED::eventHandler(shared_ptr<epics::pvData::PVStructure> const &pv_struct
 
 
 
-    m_threeAttribute[0] = mT0;
-    m_threeAttribute[1] = pulseID;
-    m_threeAttribute[2] = pixelsLength;
-    cout << m_threeAttribute[0] <<"   " << m_threeAttribute[1] << "   "<<  m_threeAttribute[2] << endl;
-    //new stucture para
-
-    size_t everyPulsePixelData[pixelsLength];
-    size_t everyPulseTOFData[pixelsLength];
-    size_t everyPulseEventNum[1];
-    everyPulseEventNum[0] = pixelsLength;
-
-    // size_t pixelsDataCopy[pixelsLength];
-    // size_t tofDataCopy[pixelsLength];
-    // size_t pulseIDCopy[1];
-    // pulseIDCopy[0]=pulseID;
-    /* the pixel raw data array */
-    for(int list_num_pixel = 0; list_num_pixel<pixelsLength; list_num_pixel++){
-          everyPulsePixelData[list_num_pixel] = pixelsData[list_num_pixel];
-          everyPulseTOFData[list_num_pixel] = tofData[list_num_pixel];
-        }
-    int dim = static_cast<int>(pixelsLength);
+    /*  the events are written to file by the event writer thread  */
+    epics::pvData::uint32 numEvents = std::min(pixelsLength, tofLength);
+    const ADnEDEventFileInfo *pNewFile = NULL;
+    bool closeFile = false;
 
     /* the fullname */
     getStringParam(ADnEDHdfFullFileNameParam, sizeof(hdfFullFileName), hdfFullFileName);
@@ -1541,6 +1571,9 @@ void ADnED::eventHandler(shared_ptr<epics::pvData::PVStructure> const &pv_struct
     getIntegerParam(ADnEDHdfPauseParam, &storageFlag);
     getIntegerParam(ADnEDHdfNumPulsePerFileParam, &time_per_file);
     pulse_num_per_file = time_per_file*25;
+    if (pulse_num_per_file < 1) {
+      pulse_num_per_file = 1;
+    }
     /* the write mode : single , capture , stream  */
     if(storageFlag==0) {getIntegerParam(ADnEDHdfWriteModeParam, &hdfFileWriteMode);
             setStringParam(ADnEDHdfStatusMessageParam, "Storing Data");
@@ -1552,6 +1585,12 @@ void ADnED::eventHandler(shared_ptr<epics::pvData::PVStructure> const &pv_struct
 
     getStringParam(ADnEDHdfFilePathParam, sizeof(hdfFilePath), hdfFilePath);
 
+    /* batching, flushing and compression policy of the event writer */
+    getIntegerParam(ADnEDHdfBatchSizeParam, &hdfBatchSize);
+    getDoubleParam(ADnEDHdfFlushPeriodParam, &hdfFlushPeriod);
+    getIntegerParam(ADnEDHdfCompressionParam, &hdfCompression);
+    p_EventWriter->setPolicy(std::max(hdfBatchSize, 1), hdfFlushPeriod, std::max(hdfCompression, 0));
+
     switch(hdfFileWriteMode){
       case 0:
         // NXclose (&capture_file_id);//
@@ -1599,166 +1638,28 @@ void ADnED::eventHandler(shared_ptr<epics::pvData::PVStructure> const &pv_struct
         strcat(hdfFullFileName,hdfFileTemplate);
         sprintf(single_hdf_file_name, hdfFullFileName, capture_file_num);
         strcat(hdfFilePath,single_hdf_file_name);
-
-        // get the current time
-        time_t t;
-        cout << " the current time is " << time(&t) << "    "  <<asctime(localtime(&t))<<endl;
-
-        nxstat = NXopen (hdfFilePath, NXACC_CREATE5, &capture_file_id);
-        if (nxstat == NX_ERROR) {
-             asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-            "Error cannot open HDF file\n");
-             }
-
-        NXmakegroup (capture_file_id, "entry", "NXentry")  ;
-        NXopengroup (capture_file_id, "entry", "NXentry")  ;
-
-        NXmakedata (capture_file_id, "GEM_HV_1", NX_CHAR, 1, &common_aChar_len);
-        NXopendata (capture_file_id, "GEM_HV_1");
-        NXputdata (capture_file_id, hdfHV1Message);
-        NXclosedata (capture_file_id);
-
-        NXmakedata (capture_file_id, "GEM_HV_2", NX_CHAR, 1, &common_aChar_len);
-        NXopendata (capture_file_id, "GEM_HV_2");
-        NXputdata (capture_file_id, hdfHV2Message);
-        NXclosedata (capture_file_id);
-
-        NXmakedata (capture_file_id, "GEM_gas", NX_CHAR, 1, &common_aChar_len);
-        NXopendata (capture_file_id, "GEM_gas");
-        NXputdata (capture_file_id, hdfGasContentMessage);
-        NXclosedata (capture_file_id);
+        setEventFileInfo();
+        pNewFile = &m_eventFileInfo;
         capture_file_num++;
-        NXmakegroup (capture_file_id, "data", "NXdata");
-        NXopengroup (capture_file_id, "data", "NXdata");
-
-        NXmakedata (capture_file_id, "event_pixel_id", NX_INT64, 2, unlimited_dims);
-        NXopendata (capture_file_id, "event_pixel_id");
-        NXclosedata (capture_file_id);
-        //  NXflush (&capture_file_id);
-
-        NXmakedata (capture_file_id, "event_tof_of_flight", NX_INT64, 2, unlimited_dims);
-        NXopendata (capture_file_id, "event_tof_of_flight");
-        NXclosedata (capture_file_id);
-        // NXflush (&capture_file_id);
-
-        NXmakedata (capture_file_id, "T0_PusleID_EventNum", NX_UINT64, 2, unlimited_dims_three);
-        NXopendata (capture_file_id, "T0_PusleID_EventNum");
-        NXclosedata (capture_file_id);
         }
+        closeFile = (capture_group_num % pulse_num_per_file == (pulse_num_per_file-1));
 
-
-            NXopenpath (capture_file_id,"/entry/data");
-            NXopendata (capture_file_id, "event_pixel_id");
-            slab_start[0] = capture_group_num % pulse_num_per_file; slab_size[0] = 1;
-            slab_start[1] = 0; slab_size[1] = static_cast<int>(pixelsLength);
-           // // cout << start_every_slap << "      "  << pixelsLength << endl;
-            NXputslab (capture_file_id, everyPulsePixelData, slab_start,slab_size);
-            NXclosedata (capture_file_id);
-           // NXflush (&capture_file_id);
-
-
-            NXopenpath (capture_file_id,"/entry/data");
-            NXopendata (capture_file_id, "event_tof_of_flight");
-            NXputslab (capture_file_id, everyPulseTOFData, slab_start,slab_size);
-            NXputattr (capture_file_id, "units", "microseconds", 12, NX_CHAR);
-            NXclosedata (capture_file_id);
-           // NXflush (&capture_file_id);
-            //cout<< "I'm running::: " <<endl;
-            NXopenpath (capture_file_id,"/entry/data");
-            NXopendata (capture_file_id, "T0_PusleID_EventNum");
-            slab_size[1] = 3;
-            NXputslab (capture_file_id, m_threeAttribute, slab_start,slab_size);
-            NXclosedata (capture_file_id);
-            NXflush (&capture_file_id);
-
-
-          NXclosegroup (capture_file_id);
-          if(capture_group_num % pulse_num_per_file == (pulse_num_per_file-1))
-           {
-              NXclosegroup (capture_file_id);
-              NXclose (&capture_file_id);
-            }
-          capture_group_num++;
+        p_EventWriter->writePulse(pNewFile, closeFile, mT0, pulseID, pixelsData.data(), tofData.data(), numEvents);
+        capture_group_num++;
 
           break;
 
       // stream mode
       case 2:
-        cout<< "I'm running::: " << stream_group_num <<endl;
         if(stream_group_num ==0)
         {
           strcat(hdfFullFileName,".h5");
           strcat(hdfFilePath,hdfFullFileName);
-          nxstat = NXopen (hdfFilePath, NXACC_CREATE5, &stream_file_id);
-
-          if (nxstat == NX_ERROR) {
-             asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-            "Error cannot open file NXfile.h5\n");
-             }
-           NXmakegroup (stream_file_id, "entry", "NXentry");
-           NXopengroup (stream_file_id, "entry", "NXentry");
-
-           NXmakedata (stream_file_id, "GEM_HV_1", NX_CHAR, 1, &common_aChar_len);
-           NXopendata (stream_file_id, "GEM_HV_1");
-           NXputdata (stream_file_id, hdfHV1Message);
-           NXclosedata (stream_file_id);
-
-           NXmakedata (stream_file_id, "GEM_HV_2", NX_CHAR, 1, &common_aChar_len);
-           NXopendata (stream_file_id, "GEM_HV_2");
-           NXputdata (stream_file_id, hdfHV2Message);
-           NXclosedata (stream_file_id);
-
-           NXmakedata (stream_file_id, "GEM_gas", NX_CHAR, 1, &common_aChar_len);
-           NXopendata (stream_file_id, "GEM_gas");
-           NXputdata (stream_file_id, hdfGasContentMessage);
-           NXclosedata (stream_file_id);
-
-           NXmakegroup (stream_file_id, "data", "NXdata");
-           NXopengroup (stream_file_id, "data", "NXdata");
-
-          NXmakedata (stream_file_id, "event_pixel_id", NX_INT64, 2, unlimited_dims);
-          NXopendata (stream_file_id, "event_pixel_id");
-          NXclosedata (stream_file_id);
-          //  NXflush (&stream_file_id);
-
-          NXmakedata (stream_file_id, "event_tof_of_flight", NX_INT64, 2, unlimited_dims);
-          NXopendata (stream_file_id, "event_tof_of_flight");
-          NXclosedata (stream_file_id);
-          // NXflush (&stream_file_id);
-
-          NXmakedata (stream_file_id, "T0_PusleID_EventNum", NX_UINT64, 2, unlimited_dims_three);
-          NXopendata (stream_file_id, "T0_PusleID_EventNum");
-          NXclosedata (stream_file_id);
-
-         }
-
-            NXopenpath (stream_file_id,"/entry/data");
-            NXopendata (stream_file_id, "event_pixel_id");
-            slab_start[0] = stream_group_num % pulse_num_per_file; slab_size[0] = 1;
-            slab_start[1] = 0; slab_size[1] = static_cast<int>(pixelsLength);
-            cout << slab_start[0] << "      "  << pixelsLength << endl;
-            NXputslab (stream_file_id, everyPulsePixelData, slab_start,slab_size);
-            NXclosedata (stream_file_id);
-            NXflush (&stream_file_id);
-
-
-            NXopenpath (stream_file_id,"/entry/data");
-            NXopendata (stream_file_id, "event_tof_of_flight");
-            NXputslab (stream_file_id, everyPulseTOFData, slab_start,slab_size);
-            NXputattr (stream_file_id, "units", "microseconds", 12, NX_CHAR);
-            NXclosedata (stream_file_id);
-            NXflush (&stream_file_id);
-
-            NXopenpath (stream_file_id,"/entry/data");
-            NXopendata (stream_file_id, "T0_PusleID_EventNum");
-            slab_size[1] = 3;
-            NXputslab (stream_file_id, m_threeAttribute, slab_start,slab_size);
-            NXclosedata (stream_file_id);
-            NXflush (&stream_file_id);
-
-
-        NXclosegroup (stream_file_id);
+          setEventFileInfo();
+          pNewFile = &m_eventFileInfo;
+        }
 
+        p_EventWriter->writePulse(pNewFile, closeFile, mT0, pulseID, pixelsData.data(), tofData.data(), numEvents);
         stream_group_num++ ;
         break;
 
@@ -1780,129 +1681,65 @@ void ADnED::eventHandler(shared_ptr<epics::pvData::PVStructure> const &pv_struct
 
     if (!paused) {
 
-    int mappedPixelIndex = 0;
-    epicsFloat64 tof = 0.0;
-    epicsUInt32 tofInt = 0;
+    //Copy the detector configuration for the histogramming engine. This is done while
+    //locked because the pixel maps and p_Data are only reallocated while locked.
     int plotType = 0;
     int tofBins = 0;
-    epicsUInt32 x_pos = 0;
-    epicsUInt32 y_pos = 0;
-    int tofIndex = 0;
-    for (size_t i=0; i<pixelsLength; ++i) {
-      for (int det=1; det<=numDet; det++) {
-
-        //Dtermine if this pixel ID is in this DET range.
-        if ((pixelsData[i] >= static_cast<epicsUInt32>(m_detStartValues[det]))
-            && (pixelsData[i] <= static_cast<epicsUInt32>(m_detEndValues[det]))) {
-
-          //Offset pixel ID here so this detector pixel ID range starts at 0
-          mappedPixelIndex = pixelsData[i] - m_detStartValues[det];
-          //cout << "the mappedPixelIndex is ::" << mappedPixelIndex <<"    "<<pixelsData[i]<< "   " <<m_detStartValues[det]<<endl;
-          tof = static_cast<epicsFloat64>(tofData[i]);
-          // cout << "the tof is ::" << tof << endl;
-          //
-          //If enabled, do TOF tranformation (to d-space for example).
-          if (m_detTOFTransType[det] != 0) {
-            tof = p_Transform[det]->calculate(m_detTOFTransType[det], mappedPixelIndex, tofData[i]);
-
-            //Apply scale and offset. This is used to rebin into the available TOF array.
-            if (m_detTOFTransScale[det] >=0) {
-              tof = (tof * m_detTOFTransScale[det]) + m_detTOFTransOffset[det];
-            }
-          }
-
-          //Do pixel ID mapping if enabled
-          if (m_detPixelMappingEnabled[det]) {
-            if ((m_PixelMapSize[det] > 0) && (p_PixelMap[det])) {
-              mappedPixelIndex = (p_PixelMap[det])[pixelsData[i] - m_detStartValues[det]];
-            }
-          }
-
-	  tofInt = static_cast<epicsUInt32>(floor(tof));
-    // I'm here //   diffrence type
-    //cout << "the tofInt is ::" << tofInt << endl;
-	  //Read type of 2-D plot and TOF binning
-	  getIntegerParam(det, ADnEDDet2DTypeParam, &plotType);
-	  getIntegerParam(det, ADnEDDetTOFNumBinsParam, &tofBins);
-    //cout << "the ADnEDDet2DTypeParam is ::" << ADnEDDet2DTypeParam << endl;
-    //e ADnEDDet2DTypeParam is ::106
-	  //cout << "the ADnEDDetTOFNumBinsParam is ::" << tofBins << endl;
-    // the ADnEDDetTOFNumBinsParam is :: 1
-    if (tofBins < 1) {
-	    tofBins = 1;
-	  } else if (static_cast<epicsUInt32>(tofBins) > m_tofMax) {
-	    tofBins = m_tofMax;
-	  }
-
-          //Integrate Pixel ID Data, optionally filtering on TOF ROI filter (for X/Y plot only).
-          if (m_detTOFROIEnabled[det]) {
-            if ((tof >= static_cast<epicsFloat64>(m_detTOFROIStartValues[det]))
-                && (tof < static_cast<epicsFloat64>(m_detTOFROIStartValues[det] + m_detTOFROISizeValues[det]))) {
-              p_Data[m_NDArrayStartValues[det]+mappedPixelIndex]++;
-
-            }
-          } else { //No TOF ROI filter enabled. Choose which 2-D plot to produce.
-	    if (static_cast<epicsUInt32>(plotType) == s_ADNED_2D_PLOT_XY) {
-	      //Standard X/Y plot
-	      p_Data[m_NDArrayStartValues[det]+mappedPixelIndex]++;
-       //<mine >  here stasic  the XY data
-       // cout << m_NDArrayStartValues[det]+mappedPixelIndex<< " **** " <<  p_Data[m_NDArrayStartValues[det]+mappedPixelIndex]++<<endl;
-
-	    } else {
-	      if ((tof <= m_tofMax) && (tof >= 0)) {
-		if (static_cast<epicsUInt32>(plotType) == s_ADNED_2D_PLOT_XTOF) {
-		  // X/TOF plot
-		  x_pos = mappedPixelIndex % m_detPixelSizeX[det];
-		  tofIndex = (x_pos * tofBins) + int(floor(tof / (m_tofMax / tofBins)));
-		} else if (static_cast<epicsUInt32>(plotType) == s_ADNED_2D_PLOT_YTOF) {
-		  // Y/TOF plot
-		  y_pos = int(floor(mappedPixelIndex / m_detPixelSizeX[det]));
-		  tofIndex = (y_pos * tofBins) + int(floor(tof / (m_tofMax / tofBins)));
-		} else if (static_cast<epicsUInt32>(plotType) == s_ADNED_2D_PLOT_PIXELIDTOF) {
-		  // PixelID/TOF plot
-		  tofIndex = (mappedPixelIndex * tofBins) + int(floor(tof / (m_tofMax / tofBins)));
-		}
-		if (tofIndex < (m_detSizeValues[det] - 1)) {
-		  p_Data[m_NDArrayStartValues[det] + tofIndex]++;
-		}
-	      }
-	    }
-          }
-
-          //Integrate TOF/D-Space, optionally filtering on Pixel ID X/Y ROI
-          if ((tof <= m_tofMax) && (tof >= 0)) {
-            if (m_detPixelROIEnable[det]) {
-              //If pixel mapping is not enabled, this is meaningless, so just integrate as normal.
-              if (!m_detPixelMappingEnabled[det]) {
-                p_Data[m_NDArrayTOFStartValues[det]+tofInt]++;
-              } else {
-                //Only integrate TOF if we are inside pixel ID XY ROI.
-                //ROI is assumed to start from 0,0 (not from whatever is the pixel ID range).
-                //So we need to offset, but this has already been done by the pixel mapping above.
-		if (m_detPixelSizeX[det] > 0) {
-		  if (((mappedPixelIndex % m_detPixelSizeX[det]) >= m_detPixelROIStartX[det]) &&
-		      ((mappedPixelIndex % m_detPixelSizeX[det]) < (m_detPixelROIStartX[det] + m_detPixelROISizeX[det]))) {
-		    if ((mappedPixelIndex >= (m_detPixelROIStartY[det] * m_detPixelSizeX[det])) &&
-			((mappedPixelIndex < ((m_detPixelROIStartY[det] + m_detPixelROISizeY[det]) * m_detPixelSizeX[det])))) {
-		      p_Data[m_NDArrayTOFStartValues[det]+tofInt]++;
-
-		    }
-		  }
-		}
-              }
-            } else {
-              p_Data[m_NDArrayTOFStartValues[det]+tofInt]++;
-            }
-          }
+    epicsUInt32 detEvents[ADNED_MAX_DETS+1] = {0};
+    for (int det=1; det<=numDet; det++) {
+      ADnEDHistDetConfig &config = m_histDetConfig[det];
+      getIntegerParam(det, ADnEDDet2DTypeParam, &plotType);
+      getIntegerParam(det, ADnEDDetTOFNumBinsParam, &tofBins);
+      if (tofBins < 1) {
+        tofBins = 1;
+      } else if (static_cast<epicsUInt32>(tofBins) > m_tofMax) {
+        tofBins = m_tofMax;
+      }
+      config.pixelStart = m_detStartValues[det];
+      config.pixelEnd = m_detEndValues[det];
+      config.size = m_detSizeValues[det];
+      config.arrayStart = m_NDArrayStartValues[det];
+      config.tofArrayStart = m_NDArrayTOFStartValues[det];
+      config.plotType = plotType;
+      config.tofBins = tofBins;
+      config.tofROIEnable = m_detTOFROIEnabled[det];
+      config.tofROIStart = m_detTOFROIStartValues[det];
+      config.tofROISize = m_detTOFROISizeValues[det];
+      config.pixelMapEnable = m_detPixelMappingEnabled[det];
+      config.pPixelMap = p_PixelMap[det];
+      config.pixelMapSize = m_PixelMapSize[det];
+      config.tofTransType = m_detTOFTransType[det];
+      config.tofTransScale = m_detTOFTransScale[det];
+      config.tofTransOffset = m_detTOFTransOffset[det];
+      config.pTransform = p_Transform[det];
+      config.pixelROIEnable = m_detPixelROIEnable[det];
+      config.pixelROIStartX = m_detPixelROIStartX[det];
+      config.pixelROISizeX = m_detPixelROISizeX[det];
+      config.pixelROIStartY = m_detPixelROIStartY[det];
+      config.pixelROISizeY = m_detPixelROISizeY[det];
+      config.pixelSizeX = m_detPixelSizeX[det];
+    }
+    getIntegerParam(ADnEDHistThreadsParam, &histThreads);
+    getIntegerParam(ADnEDHistParallelMinParam, &histParallelMin);
+    if (histThreads < 1) {
+      histThreads = 1;
+    }
+    if (histParallelMin < 0) {
+      histParallelMin = 0;
+    }
 
-          //Count events to calculate event rate
-          m_detEventsSinceLastUpdate[det]++;
-          //Count total events
-          m_detTotalEvents[det]++;
-        }
+    //Histogram the events into p_Data (pixel ID and TOF arrays for each detector).
+    p_Histogram->setBuffer(p_Data, m_bufferMaxSize, m_tofMax);
+    p_Histogram->setDetectors(numDet, m_histDetConfig);
+    p_Histogram->setThreads(histThreads, histParallelMin);
+    p_Histogram->process(pixelsData.data(), tofData.data(), pixelsLength, detEvents);
 
-      }
-      }
+    for (int det=1; det<=numDet; det++) {
+      //Count events to calculate event rate
+      m_detEventsSinceLastUpdate[det] += detEvents[det];
+      //Count total events
+      m_detTotalEvents[det] += detEvents[det];
+    }
 
     if (newPulse) {
       //m_pChargeInt += pChargePtr->get();
@@ -1926,6 +1763,11 @@ void ADnED::eventHandler(shared_ptr<epics::pvData::PVStructure> const &pv_struct
       eventRate = static_cast<epicsUInt32>(floor(m_eventsSinceLastUpdate/timeDiffSecs));
       setIntegerParam(ADnEDEventRateParam, eventRate);
       m_eventsSinceLastUpdate = 0;
+      setDoubleParam(ADnEDHistEventRateParam, p_Histogram->getEventRate());
+      p_EventWriter->getStats(&writerStats);
+      setIntegerParam(ADnEDHdfQueueUsedParam, writerStats.queueUsed);
+      setIntegerParam(ADnEDHdfDroppedPulsesParam, writerStats.droppedPulses);
+      setDoubleParam(ADnEDHdfWriteRateParam, writerStats.writeRate / 1.0e6);
       for (int det=1; det<=numDet; det++) {
         eventRate = static_cast<epicsUInt32>(floor(m_detEventsSinceLastUpdate[det]/timeDiffSecs));
         setIntegerParam(det, ADnEDDetEventRateParam, eventRate);
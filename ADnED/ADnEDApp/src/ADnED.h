@@ -40,6 +40,8 @@
 #include "ADDriver.h"
 #include "nEDChannel.h"
 #include "ADnEDTransform.h"
+#include "ADnEDHistogram.h"
+#include "ADnEDEventWriter.h"
 #include "ADnEDGlobals.h"
 
 /* These are the drvInfo strings that are used to identify the parameters.
@@ -137,6 +139,16 @@
 #define ADnEDHdfGasContentMessageParamString "ADNED_HDF_GAS_CONTENT_MESSAGE"
 
 #define ADnEDHdfNumPulsePerFileParamString "ADNED_HDF_NUM_PULSE_PER_FILE"
+#define ADnEDHdfBatchSizeParamString "ADNED_HDF_BATCH_SIZE"
+#define ADnEDHdfFlushPeriodParamString "ADNED_HDF_FLUSH_PERIOD"
+#define ADnEDHdfCompressionParamString "ADNED_HDF_COMPRESSION"
+#define ADnEDHdfQueueUsedParamString "ADNED_HDF_QUEUE_USED"
+#define ADnEDHdfDroppedPulsesParamString "ADNED_HDF_DROPPED_PULSES"
+#define ADnEDHdfWriteRateParamString "ADNED_HDF_WRITE_RATE"
+
+#define ADnEDHistThreadsParamString "ADNED_HIST_THREADS"
+#define ADnEDHistParallelMinParamString "ADNED_HIST_PARALLEL_MIN"
+#define ADnEDHistEventRateParamString "ADNED_HIST_EVENT_RATE"
 
 
 
@@ -187,18 +199,14 @@ class ADnED : public ADDriver {
   char pixel_name[MAX_FILENAME_LEN],tof_name[MAX_FILENAME_LEN];
   // new structure para
   int start_every_slap;  
-  int slab_start[2], slab_size[2];
-  int unlimited_dims[2]={NX_UNLIMITED,NX_UNLIMITED};
-  int unlimited_dims_three[2]={NX_UNLIMITED,3};
 
 
   
   // nexus file write param
   int pulse_id_dim; 
   NXhandle file_id;
-  NXhandle capture_file_id,capture_clone_fileid;
-  NXhandle stream_file_id,stream_clone_fileid;
-  NXstatus nxstat;
+  ADnEDEventWriter *p_EventWriter;
+  ADnEDEventFileInfo m_eventFileInfo;
   
   // PV param
   int common_aChar_len;
@@ -213,7 +221,6 @@ class ADnED : public ADDriver {
   char hdfGasContentMessage[MAX_FILENAME_LEN];
 
 
-  size_t m_threeAttribute[3]; 
 
   // storage flag
   int storageFlag;
@@ -238,6 +245,7 @@ class ADnED : public ADDriver {
   bool matchTransInt(const int asynParam, epicsUInt32 &transIndex);
   bool matchTransFloat(const int asynParam, epicsUInt32 &transIndex);
   void resetTOFArray(epicsUInt32 det);
+  void setEventFileInfo(void);
  
   //Put private static data members here
   static const epicsInt32 s_ADNED_MAX_STRING_SIZE;
@@ -301,6 +309,9 @@ class ADnED : public ADDriver {
 
   ADnEDTransform *p_Transform[ADNED_MAX_DETS+1];
 
+  ADnEDHistogram *p_Histogram;
+  ADnEDHistDetConfig m_histDetConfig[ADNED_MAX_DETS+1];
+
   //Constructor parameters.
   const epicsUInt32 m_debug;
 
@@ -401,6 +412,15 @@ class ADnED : public ADDriver {
   int ADnEDHdfHV2MessageParam;
   int ADnEDHdfGasContentMessageParam;
   int ADnEDHdfNumPulsePerFileParam;
+  int ADnEDHdfBatchSizeParam;
+  int ADnEDHdfFlushPeriodParam;
+  int ADnEDHdfCompressionParam;
+  int ADnEDHdfQueueUsedParam;
+  int ADnEDHdfDroppedPulsesParam;
+  int ADnEDHdfWriteRateParam;
+  int ADnEDHistThreadsParam;
+  int ADnEDHistParallelMinParam;
+  int ADnEDHistEventRateParam;
   int ADnEDLastParam;
   
  
@@ -0,0 +1,512 @@
+/**
+ * @brief Asynchronous NeXus event file writer for ADnED.
+ *
+ *        ADnED::eventHandler passes each pulse to writePulse, which copies the
+ *        events into a bounded queue and returns. A writer thread takes the pulses
+ *        off the queue and collects them into a batch, which is appended to the
+ *        file with one hyperslab per dataset and then flushed. A batch is written
+ *        when it has batchEvents events, when flushPeriod seconds have passed since
+ *        its first pulse, or when the file is closed. Disk I/O therefore never
+ *        blocks the monitor callback threads. If the queue is full, the events of
+ *        the pulse are dropped and counted, but a request to open or close a file
+ *        is still queued.
+ *
+ *        Each file has an entry group with the metadata strings and a data group
+ *        with three datasets:
+ *          event_pixel_id       - pixel IDs of all the events (uint32)
+ *          event_tof_of_flight  - TOF of all the events (uint32)
+ *          T0_PusleID_EventNum  - T0, pulse ID and number of events of each pulse (uint64)
+ *        The events of a pulse follow those of the previous pulse, so the event
+ *        count column is used to find the events of each pulse. The datasets stay
+ *        open while the file is open, each on its own clone of the file handle,
+ *        and are optionally deflate compressed.
+ *
+ * @date Nov 2016
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <epicsThread.h>
+
+#include "ADnEDEventWriter.h"
+
+//Definitions of static class data members
+//Spare queue slots for pulses that only open or close a file
+const epicsUInt32 ADnEDEventWriter::s_ADNED_EVENT_WRITER_COMMAND_SLOTS = 4;
+//Chunk size of the event datasets, in events
+const epicsUInt32 ADnEDEventWriter::s_ADNED_EVENT_WRITER_CHUNK = 65536;
+//Chunk size of the pulse dataset, in pulses
+const epicsUInt32 ADnEDEventWriter::s_ADNED_EVENT_WRITER_PULSE_CHUNK = 1024;
+//Length of the metadata strings
+const epicsUInt32 ADnEDEventWriter::s_ADNED_EVENT_WRITER_STRING_SIZE = ADNED_MAX_STRING_SIZE;
+
+//C Function prototypes to tie in with EPICS
+static void ADnEDEventWriterTaskC(void *drvPvt);
+
+/**
+ * Constructor. This starts the writer thread.
+ * @param queueSize The maximum number of pulses waiting to be written.
+ */
+ADnEDEventWriter::ADnEDEventWriter(epicsUInt32 queueSize)
+  : p_Queue(NULL), m_queueSize(queueSize), m_queueHead(0), m_queueCount(0),
+    m_pendingNewFile(false), m_exiting(false),
+    m_batchEvents(1048576), m_flushPeriod(1.0), m_compression(0),
+    m_droppedPulses(0), m_writeRate(0.0), m_fileOpen(false), m_fileError(false),
+    m_fileID(NULL), m_pixelFileID(NULL), m_tofFileID(NULL),
+    m_fileEvents(0), m_filePulses(0)
+{
+  if (m_queueSize < 1) {
+    m_queueSize = 1;
+  }
+  m_queueSlots = m_queueSize + s_ADNED_EVENT_WRITER_COMMAND_SLOTS;
+  p_Queue = new Pulse[m_queueSlots];
+  memset(&m_pendingFileInfo, 0, sizeof(m_pendingFileInfo));
+  epicsTimeGetCurrent(&m_batchStart);
+
+  p_Mutex = epicsMutexMustCreate();
+  p_WakeEvent = epicsEventMustCreate(epicsEventEmpty);
+  p_DoneEvent = epicsEventMustCreate(epicsEventEmpty);
+
+  if (epicsThreadCreate("ADnEDEventWriter",
+                        epicsThreadPriorityMedium,
+                        epicsThreadGetStackSize(epicsThreadStackMedium),
+                        (EPICSTHREADFUNC)ADnEDEventWriterTaskC,
+                        this) == NULL) {
+    printf("ADnEDEventWriter: epicsThreadCreate failure for writer thread.\n");
+    epicsEventSignal(p_DoneEvent);
+  }
+}
+
+/**
+ * Destructor. The writer thread writes the pulses that are still queued and
+ * closes the file before it exits.
+ */
+ADnEDEventWriter::~ADnEDEventWriter()
+{
+  epicsMutexLock(p_Mutex);
+  m_exiting = true;
+  epicsMutexUnlock(p_Mutex);
+  epicsEventSignal(p_WakeEvent);
+  epicsEventWait(p_DoneEvent);
+
+  epicsEventDestroy(p_WakeEvent);
+  epicsEventDestroy(p_DoneEvent);
+  epicsMutexDestroy(p_Mutex);
+  delete [] p_Queue;
+}
+
+/**
+ * Queue a pulse to be written. This copies the events, so the caller can release
+ * them when this returns.
+ * @param pNewFile If not NULL, close the current file and open this one before writing the pulse.
+ * @param closeFile Close the file after writing the pulse.
+ * @param t0 The T0 value of the pulse.
+ * @param pulseID The pulse ID.
+ * @param pPixels The pixel ID of each event.
+ * @param pTOF The TOF of each event.
+ * @param numEvents The number of events.
+ * @return false if the events were dropped because the queue was full.
+ */
+bool ADnEDEventWriter::writePulse(const ADnEDEventFileInfo *pNewFile, bool closeFile, uint64_t t0, uint64_t pulseID,
+                                  const epicsUInt32 *pPixels, const epicsUInt32 *pTOF, epicsUInt32 numEvents)
+{
+  bool hasEvents = true;
+  Pulse *pPulse = NULL;
+
+  epicsMutexLock(p_Mutex);
+  if (m_queueCount >= m_queueSize) {
+    //Drop the events, but still queue a file command if there is a spare slot.
+    hasEvents = false;
+    ++m_droppedPulses;
+    if (((pNewFile == NULL) && (!closeFile) && (!m_pendingNewFile)) || (m_queueCount >= m_queueSlots)) {
+      //Remember a new file, so that the next pulse that is queued opens it.
+      if (pNewFile) {
+        m_pendingNewFile = true;
+        m_pendingFileInfo = *pNewFile;
+      }
+      epicsMutexUnlock(p_Mutex);
+      return false;
+    }
+  }
+
+  //The writer thread does not touch the slots after the last queued pulse.
+  pPulse = &p_Queue[(m_queueHead + m_queueCount) % m_queueSlots];
+  pPulse->newFile = false;
+  if (pNewFile) {
+    pPulse->newFile = true;
+    pPulse->fileInfo = *pNewFile;
+  } else if (m_pendingNewFile) {
+    pPulse->newFile = true;
+    pPulse->fileInfo = m_pendingFileInfo;
+  }
+  m_pendingNewFile = false;
+  pPulse->closeFile = closeFile;
+  pPulse->hasEvents = hasEvents;
+  pPulse->t0 = t0;
+  pPulse->pulseID = pulseID;
+  pPulse->numEvents = 0;
+  if (hasEvents) {
+    pPulse->numEvents = numEvents;
+    pPulse->pixels.assign(pPixels, pPixels + numEvents);
+    pPulse->tof.assign(pTOF, pTOF + numEvents);
+  }
+  ++m_queueCount;
+  epicsMutexUnlock(p_Mutex);
+
+  epicsEventSignal(p_WakeEvent);
+
+  return hasEvents;
+}
+
+/**
+ * Set the batching, flushing and compression policy.
+ * @param batchEvents Write the batch when it has at least this many events.
+ * @param flushPeriod Write the batch when its first pulse is this many seconds old.
+ * @param compression Deflate level (1-9) of the datasets, or 0 for no compression.
+ *                    This is used for the next file that is opened.
+ */
+void ADnEDEventWriter::setPolicy(epicsUInt32 batchEvents, epicsFloat64 flushPeriod, epicsUInt32 compression)
+{
+  epicsMutexLock(p_Mutex);
+  m_batchEvents = batchEvents;
+  m_flushPeriod = flushPeriod;
+  m_compression = compression;
+  if (m_compression > 9) {
+    m_compression = 9;
+  }
+  epicsMutexUnlock(p_Mutex);
+}
+
+/**
+ * Get the writer statistics.
+ * @param pStats Filled in with the statistics.
+ */
+void ADnEDEventWriter::getStats(ADnEDEventWriterStats *pStats)
+{
+  epicsMutexLock(p_Mutex);
+  pStats->queueUsed = m_queueCount;
+  pStats->queueSize = m_queueSize;
+  pStats->droppedPulses = m_droppedPulses;
+  pStats->writeRate = m_writeRate;
+  pStats->fileOpen = m_fileOpen;
+  pStats->fileError = m_fileError;
+  epicsMutexUnlock(p_Mutex);
+}
+
+/**
+ * Print the state of the writer.
+ */
+void ADnEDEventWriter::report(FILE *fp, int details)
+{
+  epicsMutexLock(p_Mutex);
+  fprintf(fp, "ADnEDEventWriter: queue: %d of %d pulses, dropped pulses: %d\n",
+          m_queueCount, m_queueSize, m_droppedPulses);
+  fprintf(fp, "ADnEDEventWriter: batch events: %d, flush period: %f s, compression: %d\n",
+          m_batchEvents, m_flushPeriod, m_compression);
+  fprintf(fp, "ADnEDEventWriter: file open: %d, file error: %d\n", m_fileOpen, m_fileError);
+  if (details > 1) {
+    fprintf(fp, "ADnEDEventWriter: queue slots: %d, queue head: %d, pending new file: %d\n",
+            m_queueSlots, m_queueHead, m_pendingNewFile);
+  }
+  epicsMutexUnlock(p_Mutex);
+}
+
+/**
+ * Writer thread. Takes the pulses off the queue and writes the batches.
+ */
+void ADnEDEventWriter::writerTask(void)
+{
+  epicsTimeStamp nowTime;
+  epicsFloat64 flushPeriod = 0.0;
+  epicsFloat64 waitTime = 0.0;
+  epicsFloat64 batchAge = 0.0;
+  bool exiting = false;
+  Pulse *pPulse = NULL;
+
+  while (1) {
+    epicsMutexLock(p_Mutex);
+    flushPeriod = m_flushPeriod;
+    exiting = m_exiting;
+    epicsMutexUnlock(p_Mutex);
+
+    //Sleep until a pulse is queued, or the batch is due to be written.
+    //With nothing in the batch there is nothing to time out, whatever the flush period.
+    if (!exiting) {
+      if (m_batchPulses.empty()) {
+        epicsEventWait(p_WakeEvent);
+      } else {
+        epicsTimeGetCurrent(&nowTime);
+        waitTime = flushPeriod - epicsTimeDiffInSeconds(&nowTime, &m_batchStart);
+        if (waitTime > 0.0) {
+          epicsEventWaitWithTimeout(p_WakeEvent, waitTime);
+        }
+      }
+    }
+
+    while (1) {
+      epicsMutexLock(p_Mutex);
+      if (m_queueCount == 0) {
+        epicsMutexUnlock(p_Mutex);
+        break;
+      }
+      pPulse = &p_Queue[m_queueHead];
+      epicsMutexUnlock(p_Mutex);
+
+      processPulse(pPulse);
+
+      epicsMutexLock(p_Mutex);
+      m_queueHead = (m_queueHead + 1) % m_queueSlots;
+      --m_queueCount;
+      epicsMutexUnlock(p_Mutex);
+    }
+
+    if (!m_batchPulses.empty()) {
+      epicsTimeGetCurrent(&nowTime);
+      batchAge = epicsTimeDiffInSeconds(&nowTime, &m_batchStart);
+      if ((batchAge >= flushPeriod) || exiting) {
+        writeBatch();
+      }
+    }
+
+    if (exiting) {
+      closeFile();
+      break;
+    }
+  }
+
+  epicsEventSignal(p_DoneEvent);
+}
+
+/**
+ * Carry out the file commands of a pulse and add its events to the batch.
+ */
+void ADnEDEventWriter::processPulse(Pulse *pPulse)
+{
+  epicsUInt32 batchEvents = 0;
+
+  if (pPulse->newFile) {
+    writeBatch();
+    closeFile();
+    openFile(&pPulse->fileInfo);
+  }
+
+  if (pPulse->hasEvents) {
+    if (m_fileOpen) {
+      appendPulse(pPulse);
+    } else {
+      epicsMutexLock(p_Mutex);
+      ++m_droppedPulses;
+      epicsMutexUnlock(p_Mutex);
+    }
+  }
+
+  epicsMutexLock(p_Mutex);
+  batchEvents = m_batchEvents;
+  epicsMutexUnlock(p_Mutex);
+  if (m_batchPixels.size() >= batchEvents) {
+    writeBatch();
+  }
+
+  if (pPulse->closeFile) {
+    writeBatch();
+    closeFile();
+  }
+}
+
+/**
+ * Add the events of a pulse to the batch.
+ */
+void ADnEDEventWriter::appendPulse(const Pulse *pPulse)
+{
+  if (m_batchPulses.empty()) {
+    epicsTimeGetCurrent(&m_batchStart);
+  }
+  m_batchPixels.insert(m_batchPixels.end(), pPulse->pixels.begin(), pPulse->pixels.begin() + pPulse->numEvents);
+  m_batchTOF.insert(m_batchTOF.end(), pPulse->tof.begin(), pPulse->tof.begin() + pPulse->numEvents);
+  m_batchPulses.push_back(pPulse->t0);
+  m_batchPulses.push_back(pPulse->pulseID);
+  m_batchPulses.push_back(pPulse->numEvents);
+}
+
+/**
+ * Append the batch to the datasets and flush the file.
+ */
+void ADnEDEventWriter::writeBatch(void)
+{
+  epicsTimeStamp startTime;
+  epicsTimeStamp endTime;
+  epicsFloat64 writeTime = 0.0;
+  int64_t numEvents = m_batchPixels.size();
+  int64_t numPulses = m_batchPulses.size() / 3;
+  int64_t eventStart[1] = {m_fileEvents};
+  int64_t eventSize[1] = {numEvents};
+  int64_t pulseStart[2] = {m_filePulses, 0};
+  int64_t pulseSize[2] = {numPulses, 3};
+  bool status = true;
+
+  if ((numPulses == 0) || (!m_fileOpen)) {
+    return;
+  }
+
+  epicsTimeGetCurrent(&startTime);
+  if (numEvents > 0) {
+    status = ((NXputslab64(m_pixelFileID, &m_batchPixels[0], eventStart, eventSize) == NX_OK) && status);
+    status = ((NXputslab64(m_tofFileID, &m_batchTOF[0], eventStart, eventSize) == NX_OK) && status);
+  }
+  status = ((NXputslab64(m_fileID, &m_batchPulses[0], pulseStart, pulseSize) == NX_OK) && status);
+  status = ((NXflush(&m_fileID) == NX_OK) && status);
+  epicsTimeGetCurrent(&endTime);
+  writeTime = epicsTimeDiffInSeconds(&endTime, &startTime);
+
+  if (status) {
+    m_fileEvents += numEvents;
+    m_filePulses += numPulses;
+  } else {
+    printf("ADnEDEventWriter: failed to write %d pulses.\n", static_cast<int>(numPulses));
+  }
+
+  epicsMutexLock(p_Mutex);
+  if (status) {
+    if (writeTime > 0.0) {
+      m_writeRate = ((numEvents * 2 * sizeof(epicsUInt32)) + (numPulses * 3 * sizeof(uint64_t))) / writeTime;
+    }
+  } else {
+    m_droppedPulses += numPulses;
+    m_fileError = true;
+  }
+  epicsMutexUnlock(p_Mutex);
+
+  //clear() keeps the memory for the next batch.
+  m_batchPixels.clear();
+  m_batchTOF.clear();
+  m_batchPulses.clear();
+}
+
+/**
+ * Create a file with the metadata and the empty datasets, and leave the datasets open.
+ */
+void ADnEDEventWriter::openFile(const ADnEDEventFileInfo *pFileInfo)
+{
+  int64_t eventDims[1] = {NX_UNLIMITED};
+  int64_t eventChunk[1] = {s_ADNED_EVENT_WRITER_CHUNK};
+  int64_t pulseDims[2] = {NX_UNLIMITED, 3};
+  int64_t pulseChunk[2] = {s_ADNED_EVENT_WRITER_PULSE_CHUNK, 3};
+  bool status = true;
+
+  m_fileEvents = 0;
+  m_filePulses = 0;
+
+  if (NXopen(pFileInfo->filePath, NXACC_CREATE5, &m_fileID) != NX_OK) {
+    printf("ADnEDEventWriter: cannot create file %s\n", pFileInfo->filePath);
+    m_fileID = NULL;
+    epicsMutexLock(p_Mutex);
+    m_fileError = true;
+    epicsMutexUnlock(p_Mutex);
+    return;
+  }
+
+  status = ((NXmakegroup(m_fileID, "entry", "NXentry") == NX_OK) && status);
+  status = ((NXopengroup(m_fileID, "entry", "NXentry") == NX_OK) && status);
+  status = (makeStringData("GEM_HV_1", pFileInfo->hv1Message) && status);
+  status = (makeStringData("GEM_HV_2", pFileInfo->hv2Message) && status);
+  status = (makeStringData("GEM_gas", pFileInfo->gasMessage) && status);
+
+  status = ((NXmakegroup(m_fileID, "data", "NXdata") == NX_OK) && status);
+  status = ((NXopengroup(m_fileID, "data", "NXdata") == NX_OK) && status);
+  status = (makeEventData("event_pixel_id", NX_UINT32, 1, eventDims, eventChunk) && status);
+  status = (makeEventData("event_tof_of_flight", NX_UINT32, 1, eventDims, eventChunk) && status);
+  status = (makeEventData("T0_PusleID_EventNum", NX_UINT64, 2, pulseDims, pulseChunk) && status);
+  status = ((NXopendata(m_fileID, "T0_PusleID_EventNum") == NX_OK) && status);
+
+  //NeXus handles have only one open dataset, so open the others on clones of the handle.
+  if (status) {
+    status = ((NXreopen(m_fileID, &m_pixelFileID) == NX_OK) && status);
+    status = ((NXopenpath(m_pixelFileID, "/entry/data/event_pixel_id") == NX_OK) && status);
+  }
+  if (status) {
+    status = ((NXreopen(m_fileID, &m_tofFileID) == NX_OK) && status);
+    status = ((NXopenpath(m_tofFileID, "/entry/data/event_tof_of_flight") == NX_OK) && status);
+    status = ((NXputattr(m_tofFileID, "units", "microseconds", 12, NX_CHAR) == NX_OK) && status);
+  }
+
+  if (!status) {
+    printf("ADnEDEventWriter: cannot create the datasets in file %s\n", pFileInfo->filePath);
+    closeFile();
+    epicsMutexLock(p_Mutex);
+    m_fileError = true;
+    epicsMutexUnlock(p_Mutex);
+    return;
+  }
+
+  epicsMutexLock(p_Mutex);
+  m_fileOpen = true;
+  m_fileError = false;
+  epicsMutexUnlock(p_Mutex);
+}
+
+/**
+ * Close the datasets, groups and handles of the current file, if there is one.
+ */
+void ADnEDEventWriter::closeFile(void)
+{
+  NXhandle *handles[3] = {&m_pixelFileID, &m_tofFileID, &m_fileID};
+
+  for (int i=0; i<3; ++i) {
+    if (*handles[i] != NULL) {
+      //Opening the root closes the open dataset and groups.
+      NXopenpath(*handles[i], "/");
+      NXclose(handles[i]);
+      *handles[i] = NULL;
+    }
+  }
+  epicsMutexLock(p_Mutex);
+  m_fileOpen = false;
+  epicsMutexUnlock(p_Mutex);
+}
+
+/**
+ * Write a metadata string dataset in the current group.
+ */
+bool ADnEDEventWriter::makeStringData(const char *name, const char *value)
+{
+  char buffer[s_ADNED_EVENT_WRITER_STRING_SIZE];
+  int length = s_ADNED_EVENT_WRITER_STRING_SIZE;
+  bool status = true;
+
+  memset(buffer, 0, sizeof(buffer));
+  strncpy(buffer, value, sizeof(buffer)-1);
+  status = ((NXmakedata(m_fileID, name, NX_CHAR, 1, &length) == NX_OK) && status);
+  status = ((NXopendata(m_fileID, name) == NX_OK) && status);
+  status = ((NXputdata(m_fileID, buffer) == NX_OK) && status);
+  status = ((NXclosedata(m_fileID) == NX_OK) && status);
+
+  return status;
+}
+
+/**
+ * Create an extendible, chunked dataset in the current group, compressed if enabled.
+ */
+bool ADnEDEventWriter::makeEventData(const char *name, int dataType, int rank, int64_t *pDims, int64_t *pChunk)
+{
+  int compressionType = NX_COMP_NONE;
+  epicsUInt32 compression = 0;
+
+  epicsMutexLock(p_Mutex);
+  compression = m_compression;
+  epicsMutexUnlock(p_Mutex);
+  if (compression > 0) {
+    compressionType = (100 * NX_COMP_LZW) + compression;
+  }
+
+  return (NXcompmakedata64(m_fileID, name, dataType, rank, pDims, compressionType, pChunk) == NX_OK);
+}
+
+/**
+ * C function to run the writer thread.
+ */
+static void ADnEDEventWriterTaskC(void *drvPvt)
+{
+  ADnEDEventWriter *pWriter = static_cast<ADnEDEventWriter *>(drvPvt);
+  pWriter->writerTask();
+}
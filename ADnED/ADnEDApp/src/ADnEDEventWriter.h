@@ -0,0 +1,121 @@
+//Documentation in ADnEDEventWriter.cpp file
+
+#ifndef ADNED_EVENT_WRITER_H
+#define ADNED_EVENT_WRITER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+
+#include <napi.h>
+#include <epicsTypes.h>
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+
+#include "ADnEDGlobals.h"
+
+/**
+ * Name and metadata of a new event file.
+ */
+struct ADnEDEventFileInfo {
+  char filePath[ADNED_MAX_STRING_SIZE];
+  char hv1Message[ADNED_MAX_STRING_SIZE];
+  char hv2Message[ADNED_MAX_STRING_SIZE];
+  char gasMessage[ADNED_MAX_STRING_SIZE];
+};
+
+/**
+ * Statistics of the event writer, for the parameter library.
+ */
+struct ADnEDEventWriterStats {
+  epicsUInt32 queueUsed;          //Pulses waiting to be written
+  epicsUInt32 queueSize;
+  epicsUInt32 droppedPulses;      //Pulses that were not written (queue full or no file)
+  epicsFloat64 writeRate;         //Bytes per second of write time of the last batch
+  bool fileOpen;
+  bool fileError;                 //The last file could not be created or written
+};
+
+class ADnEDEventWriter {
+
+ public:
+  ADnEDEventWriter(epicsUInt32 queueSize);
+  virtual ~ADnEDEventWriter();
+
+  bool writePulse(const ADnEDEventFileInfo *pNewFile, bool closeFile, uint64_t t0, uint64_t pulseID,
+                  const epicsUInt32 *pPixels, const epicsUInt32 *pTOF, epicsUInt32 numEvents);
+  void setPolicy(epicsUInt32 batchEvents, epicsFloat64 flushPeriod, epicsUInt32 compression);
+  void getStats(ADnEDEventWriterStats *pStats);
+  void report(FILE *fp, int details);
+
+  void writerTask(void);
+
+ private:
+
+  //One pulse in the queue. The event vectors keep their memory when the slot is reused.
+  struct Pulse {
+    bool newFile;
+    ADnEDEventFileInfo fileInfo;
+    bool closeFile;
+    bool hasEvents;               //False if the events were dropped because the queue was full
+    uint64_t t0;
+    uint64_t pulseID;
+    epicsUInt32 numEvents;
+    std::vector<epicsUInt32> pixels;
+    std::vector<epicsUInt32> tof;
+  };
+
+  //Private functions
+  void processPulse(Pulse *pPulse);
+  void appendPulse(const Pulse *pPulse);
+  void writeBatch(void);
+  void openFile(const ADnEDEventFileInfo *pFileInfo);
+  void closeFile(void);
+  bool makeStringData(const char *name, const char *value);
+  bool makeEventData(const char *name, int dataType, int rank, int64_t *pDims, int64_t *pChunk);
+
+  //Private dynamic
+  epicsMutexId p_Mutex;
+  epicsEventId p_WakeEvent;
+  epicsEventId p_DoneEvent;
+  Pulse *p_Queue;
+  epicsUInt32 m_queueSize;        //Maximum number of pulses with events in the queue
+  epicsUInt32 m_queueSlots;       //Size of p_Queue, which has spare slots for file commands
+  epicsUInt32 m_queueHead;
+  epicsUInt32 m_queueCount;
+  bool m_pendingNewFile;          //A pulse that opens a file was dropped
+  ADnEDEventFileInfo m_pendingFileInfo;
+  bool m_exiting;
+
+  //Policy, set by ADnED
+  epicsUInt32 m_batchEvents;
+  epicsFloat64 m_flushPeriod;
+  epicsUInt32 m_compression;
+
+  //Statistics
+  epicsUInt32 m_droppedPulses;
+  epicsFloat64 m_writeRate;
+  bool m_fileOpen;
+  bool m_fileError;
+
+  //Only used by the writer thread
+  NXhandle m_fileID;              //Has the pulse dataset open
+  NXhandle m_pixelFileID;         //Clone of m_fileID with the pixel ID dataset open
+  NXhandle m_tofFileID;           //Clone of m_fileID with the TOF dataset open
+  int64_t m_fileEvents;
+  int64_t m_filePulses;
+  std::vector<epicsUInt32> m_batchPixels;
+  std::vector<epicsUInt32> m_batchTOF;
+  std::vector<uint64_t> m_batchPulses;  //T0, pulse ID and number of events of each pulse
+  epicsTimeStamp m_batchStart;
+
+  //Private static const
+  static const epicsUInt32 s_ADNED_EVENT_WRITER_COMMAND_SLOTS;
+  static const epicsUInt32 s_ADNED_EVENT_WRITER_CHUNK;
+  static const epicsUInt32 s_ADNED_EVENT_WRITER_PULSE_CHUNK;
+  static const epicsUInt32 s_ADNED_EVENT_WRITER_STRING_SIZE;
+
+};
+
+#endif //ADNED_EVENT_WRITER_H
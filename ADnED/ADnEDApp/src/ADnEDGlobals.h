@@ -3,6 +3,16 @@
 #define ADNED_MAX_DETS 4
 #define ADNED_MAX_CHANNELS 4
 
+//ADnEDHistogram params. Used in ADnED.cpp.
+#define ADNED_HIST_MAX_THREADS 8
+#define ADNED_HIST_DEFAULT_THREADS 1
+#define ADNED_HIST_DEFAULT_PARALLEL_MIN 100000
+
+//ADnEDEventWriter params. Used in ADnED.cpp.
+#define ADNED_HDF_QUEUE_SIZE 250
+#define ADNED_HDF_DEFAULT_BATCH_SIZE 1048576
+#define ADNED_HDF_DEFAULT_FLUSH_PERIOD 1.0
+
 //ADnEDTransform params.
 #define ADNED_MAX_TRANSFORM_PARAMS 6
 #define ADNED_TRANSFORM_TYPE0 0
@@ -0,0 +1,612 @@
+/**
+ * @brief Event histogramming engine for ADnED.
+ *
+ *        Integrates neutron events (pixel ID and TOF pairs) into the pixel and TOF
+ *        arrays of each detector in the ADnED data buffer.
+ *
+ *        The detector configuration is passed in once per packet with setDetectors,
+ *        which also builds a lookup table from pixel ID to detector number. Each event
+ *        then costs one table lookup instead of a scan over the detector pixel ranges.
+ *        The table is only rebuilt when the pixel ranges change. If the ranges overlap,
+ *        or span too many pixel IDs, the engine falls back to scanning the ranges.
+ *        Without a TOF transformation the TOF binning is done in integer arithmetic.
+ *
+ *        Packets of at least minParallelEvents events are split between the calling
+ *        thread and up to numThreads-1 worker threads. The calling thread counts
+ *        directly into the data buffer. The workers count into private histograms,
+ *        and flag each block of the histogram that they touch, so that only those
+ *        blocks need to be added into the data buffer when the packet is finished.
+ *
+ *        The class is not thread safe. ADnED only uses it with the driver locked.
+ *
+ * @date Nov 2016
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <epicsStdio.h>
+
+#include "ADnEDHistogram.h"
+
+//Definitions of static class data members
+//Private histograms are merged in blocks of 2^12 bins
+const epicsUInt32 ADnEDHistogram::s_ADNED_HIST_BLOCK_SHIFT = 12;
+//Largest pixel ID range that the lookup table covers
+const epicsUInt32 ADnEDHistogram::s_ADNED_HIST_MAX_LOOKUP = 16*1024*1024;
+
+//These 2D plot options need to match the mbbo record that uses ADNED_DET_2D_TYPE parameter.
+static const epicsUInt32 s_ADNED_HIST_PLOT_XY = 0;
+static const epicsUInt32 s_ADNED_HIST_PLOT_XTOF = 1;
+static const epicsUInt32 s_ADNED_HIST_PLOT_YTOF = 2;
+static const epicsUInt32 s_ADNED_HIST_PLOT_PIXELIDTOF = 3;
+
+//C Function prototypes to tie in with EPICS
+static void ADnEDHistogramWorkerC(void *drvPvt);
+
+/**
+ * Constructor. This starts the worker threads.
+ * @param maxThreads The maximum number of threads, including the calling thread, that
+ *                   process() can use.
+ */
+ADnEDHistogram::ADnEDHistogram(epicsUInt32 maxThreads)
+  : p_Data(NULL), m_dataSize(0), m_tofMax(0), m_numDet(0),
+    p_Lookup(NULL), m_lookupStart(0), m_lookupSize(0), m_scanDets(false),
+    m_maxThreads(maxThreads), m_numThreads(1), m_minParallelEvents(0), p_Workers(NULL),
+    m_exiting(false), m_eventCount(0.0), m_processTime(0.0), m_lastEventRate(0.0)
+{
+  char threadName[ADNED_MAX_STRING_SIZE];
+
+  if (m_maxThreads < 1) {
+    m_maxThreads = 1;
+  }
+  memset(m_det, 0, sizeof(m_det));
+  for (int det=0; det<=ADNED_MAX_DETS; ++det) {
+    m_tofBinWidth[det] = 1;
+    m_tofROILow[det] = 0;
+    m_tofROIHigh[det] = 0;
+  }
+
+  //Worker 0 is the calling thread, so it has no thread of its own.
+  p_Workers = new Worker[m_maxThreads];
+  memset(p_Workers, 0, m_maxThreads * sizeof(Worker));
+  for (epicsUInt32 i=1; i<m_maxThreads; ++i) {
+    p_Workers[i].pHistogram = this;
+    p_Workers[i].index = i;
+    p_Workers[i].startEvent = epicsEventMustCreate(epicsEventEmpty);
+    p_Workers[i].doneEvent = epicsEventMustCreate(epicsEventEmpty);
+    epicsSnprintf(threadName, sizeof(threadName), "ADnEDHist%d", i);
+    if (epicsThreadCreate(threadName,
+                          epicsThreadPriorityHigh,
+                          epicsThreadGetStackSize(epicsThreadStackMedium),
+                          (EPICSTHREADFUNC)ADnEDHistogramWorkerC,
+                          &p_Workers[i]) == NULL) {
+      printf("ADnEDHistogram: epicsThreadCreate failure for %s.\n", threadName);
+      m_maxThreads = i;
+      break;
+    }
+  }
+}
+
+/**
+ * Destructor. This stops the worker threads and frees the memory.
+ */
+ADnEDHistogram::~ADnEDHistogram()
+{
+  m_exiting = true;
+  for (epicsUInt32 i=1; i<m_maxThreads; ++i) {
+    epicsEventSignal(p_Workers[i].startEvent);
+    epicsEventWait(p_Workers[i].doneEvent);
+    epicsEventDestroy(p_Workers[i].startEvent);
+    epicsEventDestroy(p_Workers[i].doneEvent);
+  }
+  freeWorkerBuffers();
+  delete [] p_Workers;
+  free(p_Lookup);
+}
+
+/**
+ * Set the data buffer that events are counted into. The buffer is owned by the caller.
+ * @param pData The data buffer.
+ * @param dataSize The number of bins in the data buffer.
+ * @param tofMax The maximum TOF. Each detector TOF array has tofMax+1 bins.
+ */
+void ADnEDHistogram::setBuffer(epicsUInt32 *pData, epicsUInt32 dataSize, epicsUInt32 tofMax)
+{
+  if (dataSize != m_dataSize) {
+    freeWorkerBuffers();
+  }
+  p_Data = pData;
+  m_dataSize = dataSize;
+  if (tofMax != m_tofMax) {
+    m_tofMax = tofMax;
+    //Recalculate the TOF bin widths, which depend on tofMax.
+    setDetectors(m_numDet, m_det);
+  }
+}
+
+/**
+ * Set the configuration of the detectors. The lookup table from pixel ID to detector
+ * is only rebuilt if the pixel ID ranges have changed.
+ * @param numDet The number of detectors.
+ * @param pConfig Array of configurations, indexed by detector number (1 based).
+ */
+void ADnEDHistogram::setDetectors(epicsUInt32 numDet, const ADnEDHistDetConfig *pConfig)
+{
+  bool rangesChanged = false;
+  epicsUInt32 tofBins = 0;
+
+  if (numDet > ADNED_MAX_DETS) {
+    numDet = ADNED_MAX_DETS;
+  }
+  if (numDet != m_numDet) {
+    rangesChanged = true;
+  }
+  for (epicsUInt32 det=1; det<=numDet; ++det) {
+    if ((pConfig[det].pixelStart != m_det[det].pixelStart) ||
+        (pConfig[det].pixelEnd != m_det[det].pixelEnd)) {
+      rangesChanged = true;
+    }
+    if (&pConfig[det] != &m_det[det]) {
+      m_det[det] = pConfig[det];
+    }
+
+    //The TOF bin width is an integer, as it always was with the old epicsUInt32 division.
+    tofBins = m_det[det].tofBins;
+    if (tofBins < 1) {
+      tofBins = 1;
+    } else if (tofBins > m_tofMax) {
+      tofBins = m_tofMax;
+    }
+    m_det[det].tofBins = tofBins;
+    m_tofBinWidth[det] = (tofBins > 0) ? (m_tofMax / tofBins) : 1;
+    if (m_tofBinWidth[det] < 1) {
+      m_tofBinWidth[det] = 1;
+    }
+
+    //Integer TOF ROI [low, high), clipped to the TOF values that can occur.
+    int roiEnd = m_det[det].tofROIStart + m_det[det].tofROISize;
+    m_tofROILow[det] = (m_det[det].tofROIStart > 0) ? m_det[det].tofROIStart : 0;
+    m_tofROIHigh[det] = (roiEnd > 0) ? roiEnd : 0;
+  }
+  m_numDet = numDet;
+
+  if (rangesChanged) {
+    buildLookup();
+  }
+}
+
+/**
+ * Build the lookup table from pixel ID to detector number.
+ */
+void ADnEDHistogram::buildLookup(void)
+{
+  epicsUInt32 lowest = 0;
+  epicsUInt32 highest = 0;
+  bool found = false;
+
+  m_scanDets = false;
+  m_lookupStart = 0;
+  m_lookupSize = 0;
+
+  for (epicsUInt32 det=1; det<=m_numDet; ++det) {
+    if (m_det[det].pixelStart > m_det[det].pixelEnd) {
+      continue;
+    }
+    if (!found || (m_det[det].pixelStart < lowest)) {
+      lowest = m_det[det].pixelStart;
+    }
+    if (!found || (m_det[det].pixelEnd > highest)) {
+      highest = m_det[det].pixelEnd;
+    }
+    found = true;
+  }
+  if (!found) {
+    return;
+  }
+  if ((highest - lowest) >= s_ADNED_HIST_MAX_LOOKUP) {
+    m_scanDets = true;
+    return;
+  }
+
+  epicsUInt8 *pLookup = static_cast<epicsUInt8 *>(realloc(p_Lookup, highest - lowest + 1));
+  if (!pLookup) {
+    m_scanDets = true;
+    return;
+  }
+  p_Lookup = pLookup;
+  m_lookupStart = lowest;
+  m_lookupSize = highest - lowest + 1;
+  memset(p_Lookup, 0, m_lookupSize);
+
+  for (epicsUInt32 det=1; det<=m_numDet; ++det) {
+    if (m_det[det].pixelStart > m_det[det].pixelEnd) {
+      continue;
+    }
+    for (epicsUInt32 pixel=m_det[det].pixelStart; pixel<=m_det[det].pixelEnd; ++pixel) {
+      if (p_Lookup[pixel - m_lookupStart] != 0) {
+        //An event can count in more than one detector, which the table cannot express.
+        m_scanDets = true;
+        return;
+      }
+      p_Lookup[pixel - m_lookupStart] = static_cast<epicsUInt8>(det);
+      if (pixel == m_det[det].pixelEnd) {
+        break; //In case pixelEnd is the largest epicsUInt32
+      }
+    }
+  }
+}
+
+/**
+ * Set how many threads are used for large packets.
+ * @param numThreads The number of threads, including the calling thread.
+ * @param minParallelEvents Packets with fewer events than this are processed by the calling thread only.
+ */
+void ADnEDHistogram::setThreads(epicsUInt32 numThreads, epicsUInt32 minParallelEvents)
+{
+  if (numThreads < 1) {
+    numThreads = 1;
+  } else if (numThreads > m_maxThreads) {
+    numThreads = m_maxThreads;
+  }
+  m_numThreads = numThreads;
+  m_minParallelEvents = minParallelEvents;
+}
+
+/**
+ * Return the number of threads that process() can use.
+ */
+epicsUInt32 ADnEDHistogram::getNumThreads(void) const
+{
+  return m_numThreads;
+}
+
+/**
+ * Count one pixel or TOF bin, flagging its block if this is a private histogram.
+ */
+static inline void countBin(epicsUInt32 *pHist, epicsUInt8 *pDirty, epicsUInt32 bin, epicsUInt32 size, epicsUInt32 blockShift)
+{
+  if (bin < size) {
+    pHist[bin]++;
+    if (pDirty) {
+      pDirty[bin >> blockShift] = 1;
+    }
+  }
+}
+
+//TOF helpers for the integer (untransformed) and floating point (transformed) TOF
+static inline bool tofInRange(epicsUInt32 tof, epicsUInt32 tofMax)
+{
+  return (tof <= tofMax);
+}
+
+static inline bool tofInRange(epicsFloat64 tof, epicsUInt32 tofMax)
+{
+  return ((tof <= tofMax) && (tof >= 0));
+}
+
+static inline bool tofInROI(epicsUInt32 tof, const ADnEDHistDetConfig &det, epicsUInt32 low, epicsUInt32 high)
+{
+  return ((tof >= low) && (tof < high));
+}
+
+static inline bool tofInROI(epicsFloat64 tof, const ADnEDHistDetConfig &det, epicsUInt32 low, epicsUInt32 high)
+{
+  return ((tof >= static_cast<epicsFloat64>(det.tofROIStart))
+          && (tof < static_cast<epicsFloat64>(det.tofROIStart + det.tofROISize)));
+}
+
+static inline epicsUInt32 tofBin(epicsUInt32 tof, epicsUInt32 binWidth)
+{
+  return tof / binWidth;
+}
+
+static inline epicsUInt32 tofBin(epicsFloat64 tof, epicsUInt32 binWidth)
+{
+  return static_cast<epicsUInt32>(floor(tof / binWidth));
+}
+
+static inline epicsUInt32 tofFloor(epicsUInt32 tof)
+{
+  return tof;
+}
+
+static inline epicsUInt32 tofFloor(epicsFloat64 tof)
+{
+  return static_cast<epicsUInt32>(floor(tof));
+}
+
+/**
+ * Count one event that belongs to a detector.
+ * @param det The detector configuration.
+ * @param detIndex The detector number (1 based).
+ * @param pixel The pixel ID of the event.
+ * @param tof The TOF of the event, transformed if the detector has a TOF transformation.
+ * @param pHist The histogram to count into.
+ * @param pDirty The block flags of pHist if it is a private histogram, otherwise NULL.
+ */
+template <typename tofType>
+void ADnEDHistogram::histogramEvent(const ADnEDHistDetConfig &det, epicsUInt32 detIndex,
+                                    epicsUInt32 pixel, tofType tof, epicsUInt32 *pHist,
+                                    epicsUInt8 *pDirty) const
+{
+  //Offset pixel ID here so this detector pixel ID range starts at 0
+  epicsUInt32 mappedPixelIndex = pixel - det.pixelStart;
+  epicsUInt32 tofIndex = 0;
+  bool validIndex = false;
+  bool inRange = tofInRange(tof, m_tofMax);
+
+  //Do pixel ID mapping if enabled
+  if (det.pixelMapEnable && det.pPixelMap && (mappedPixelIndex < det.pixelMapSize)) {
+    mappedPixelIndex = det.pPixelMap[mappedPixelIndex];
+  }
+
+  //Integrate Pixel ID Data, optionally filtering on TOF ROI filter (for X/Y plot only).
+  if (det.tofROIEnable) {
+    if (tofInROI(tof, det, m_tofROILow[detIndex], m_tofROIHigh[detIndex])) {
+      countBin(pHist, pDirty, det.arrayStart + mappedPixelIndex, m_dataSize, s_ADNED_HIST_BLOCK_SHIFT);
+    }
+  } else if (det.plotType == s_ADNED_HIST_PLOT_XY) {
+    countBin(pHist, pDirty, det.arrayStart + mappedPixelIndex, m_dataSize, s_ADNED_HIST_BLOCK_SHIFT);
+  } else if (inRange) {
+    epicsUInt32 bin = tofBin(tof, m_tofBinWidth[detIndex]);
+    if (det.plotType == s_ADNED_HIST_PLOT_XTOF) {
+      if (det.pixelSizeX > 0) {
+        tofIndex = ((mappedPixelIndex % det.pixelSizeX) * det.tofBins) + bin;
+        validIndex = true;
+      }
+    } else if (det.plotType == s_ADNED_HIST_PLOT_YTOF) {
+      if (det.pixelSizeX > 0) {
+        tofIndex = ((mappedPixelIndex / det.pixelSizeX) * det.tofBins) + bin;
+        validIndex = true;
+      }
+    } else if (det.plotType == s_ADNED_HIST_PLOT_PIXELIDTOF) {
+      tofIndex = (mappedPixelIndex * det.tofBins) + bin;
+      validIndex = true;
+    }
+    if (validIndex && (tofIndex + 1 < det.size)) {
+      countBin(pHist, pDirty, det.arrayStart + tofIndex, m_dataSize, s_ADNED_HIST_BLOCK_SHIFT);
+    }
+  }
+
+  //Integrate TOF/D-Space, optionally filtering on Pixel ID X/Y ROI
+  if (inRange) {
+    epicsUInt32 tofBinIndex = det.tofArrayStart + tofFloor(tof);
+    //If pixel mapping is not enabled the pixel ROI is meaningless, so just integrate as normal.
+    if (!det.pixelROIEnable || !det.pixelMapEnable) {
+      countBin(pHist, pDirty, tofBinIndex, m_dataSize, s_ADNED_HIST_BLOCK_SHIFT);
+    } else if (det.pixelSizeX > 0) {
+      //ROI is assumed to start from 0,0, which the pixel mapping above has already done.
+      int x = mappedPixelIndex % det.pixelSizeX;
+      int index = mappedPixelIndex;
+      if ((x >= det.pixelROIStartX) && (x < (det.pixelROIStartX + det.pixelROISizeX)) &&
+          (index >= (det.pixelROIStartY * det.pixelSizeX)) &&
+          (index < ((det.pixelROIStartY + det.pixelROISizeY) * det.pixelSizeX))) {
+        countBin(pHist, pDirty, tofBinIndex, m_dataSize, s_ADNED_HIST_BLOCK_SHIFT);
+      }
+    }
+  }
+}
+
+/**
+ * Count a range of events into a histogram.
+ * @param pPixels The pixel IDs.
+ * @param pTOF The TOF values.
+ * @param numEvents The number of events.
+ * @param pHist The histogram to count into.
+ * @param pDirty The block flags of pHist if it is a private histogram, otherwise NULL.
+ * @param pDetEvents Array indexed by detector number, incremented for each event in that detector.
+ */
+void ADnEDHistogram::histogram(const epicsUInt32 *pPixels, const epicsUInt32 *pTOF, epicsUInt32 numEvents,
+                               epicsUInt32 *pHist, epicsUInt8 *pDirty, epicsUInt32 *pDetEvents) const
+{
+  epicsUInt32 pixel = 0;
+  epicsUInt32 firstDet = 0;
+  epicsUInt32 lastDet = 0;
+
+  for (epicsUInt32 i=0; i<numEvents; ++i) {
+    pixel = pPixels[i];
+    if (!m_scanDets) {
+      epicsUInt32 offset = pixel - m_lookupStart;
+      if ((offset >= m_lookupSize) || (p_Lookup[offset] == 0)) {
+        continue;
+      }
+      firstDet = lastDet = p_Lookup[offset];
+    } else {
+      firstDet = 1;
+      lastDet = m_numDet;
+    }
+    for (epicsUInt32 det=firstDet; det<=lastDet; ++det) {
+      const ADnEDHistDetConfig &config = m_det[det];
+      if ((pixel < config.pixelStart) || (pixel > config.pixelEnd)) {
+        continue;
+      }
+      if (config.tofTransType == 0) {
+        histogramEvent<epicsUInt32>(config, det, pixel, pTOF[i], pHist, pDirty);
+      } else {
+        //Do TOF tranformation (to d-space for example).
+        epicsFloat64 tof = 0.0;
+        if (config.pTransform) {
+          tof = config.pTransform->calculate(config.tofTransType, pixel - config.pixelStart, pTOF[i]);
+        }
+        //Apply scale and offset. This is used to rebin into the available TOF array.
+        if (config.tofTransScale >= 0) {
+          tof = (tof * config.tofTransScale) + config.tofTransOffset;
+        }
+        histogramEvent<epicsFloat64>(config, det, pixel, tof, pHist, pDirty);
+      }
+      pDetEvents[det]++;
+    }
+  }
+}
+
+/**
+ * Count the events of a packet into the data buffer.
+ * @param pPixels The pixel IDs.
+ * @param pTOF The TOF values.
+ * @param numEvents The number of events.
+ * @param pDetEvents Array of ADNED_MAX_DETS+1 elements, indexed by detector number. The number of
+ *                   events counted in each detector is added to it.
+ */
+void ADnEDHistogram::process(const epicsUInt32 *pPixels, const epicsUInt32 *pTOF, epicsUInt32 numEvents,
+                             epicsUInt32 *pDetEvents)
+{
+  epicsTimeStamp startTime;
+  epicsTimeStamp endTime;
+  epicsUInt32 numWorkers = 1;
+  epicsUInt32 chunk = numEvents;
+  epicsUInt32 numBlocks = 0;
+
+  if ((p_Data == NULL) || (m_dataSize == 0) || (m_numDet == 0) || (numEvents == 0)) {
+    return;
+  }
+  epicsTimeGetCurrent(&startTime);
+
+  if ((m_numThreads > 1) && (numEvents >= m_minParallelEvents)) {
+    numWorkers = m_numThreads;
+    numBlocks = ((m_dataSize - 1) >> s_ADNED_HIST_BLOCK_SHIFT) + 1;
+    for (epicsUInt32 i=1; i<numWorkers; ++i) {
+      Worker *pWorker = &p_Workers[i];
+      if (!pWorker->pHist || !pWorker->pDirty) {
+        free(pWorker->pHist);
+        free(pWorker->pDirty);
+        pWorker->pHist = static_cast<epicsUInt32 *>(calloc(m_dataSize, sizeof(epicsUInt32)));
+        pWorker->pDirty = static_cast<epicsUInt8 *>(calloc(numBlocks, sizeof(epicsUInt8)));
+        if (!pWorker->pHist || !pWorker->pDirty) {
+          printf("ADnEDHistogram::process: failed to allocate histogram for thread %d.\n", i);
+          numWorkers = i;
+          break;
+        }
+      }
+    }
+    chunk = numEvents / numWorkers;
+    for (epicsUInt32 i=1; i<numWorkers; ++i) {
+      Worker *pWorker = &p_Workers[i];
+      pWorker->pPixels = pPixels + (i * chunk);
+      pWorker->pTOF = pTOF + (i * chunk);
+      pWorker->numEvents = (i == numWorkers-1) ? (numEvents - (i * chunk)) : chunk;
+      epicsEventSignal(pWorker->startEvent);
+    }
+  }
+
+  histogram(pPixels, pTOF, chunk, p_Data, NULL, pDetEvents);
+
+  for (epicsUInt32 i=1; i<numWorkers; ++i) {
+    epicsEventWait(p_Workers[i].doneEvent);
+    mergeWorker(&p_Workers[i]);
+    for (epicsUInt32 det=1; det<=m_numDet; ++det) {
+      pDetEvents[det] += p_Workers[i].detEvents[det];
+    }
+  }
+
+  epicsTimeGetCurrent(&endTime);
+  m_processTime += epicsTimeDiffInSeconds(&endTime, &startTime);
+  m_eventCount += numEvents;
+}
+
+/**
+ * Add the blocks of a private histogram that were touched into the data buffer, and clear them.
+ */
+void ADnEDHistogram::mergeWorker(Worker *pWorker)
+{
+  epicsUInt32 numBlocks = ((m_dataSize - 1) >> s_ADNED_HIST_BLOCK_SHIFT) + 1;
+  epicsUInt32 blockSize = 1 << s_ADNED_HIST_BLOCK_SHIFT;
+
+  for (epicsUInt32 block=0; block<numBlocks; ++block) {
+    if (!pWorker->pDirty[block]) {
+      continue;
+    }
+    epicsUInt32 start = block << s_ADNED_HIST_BLOCK_SHIFT;
+    epicsUInt32 end = (start + blockSize < m_dataSize) ? (start + blockSize) : m_dataSize;
+    for (epicsUInt32 bin=start; bin<end; ++bin) {
+      p_Data[bin] += pWorker->pHist[bin];
+    }
+    memset(pWorker->pHist + start, 0, (end - start) * sizeof(epicsUInt32));
+    pWorker->pDirty[block] = 0;
+  }
+}
+
+/**
+ * Free the private histograms, which are reallocated at the new size when next needed.
+ */
+void ADnEDHistogram::freeWorkerBuffers(void)
+{
+  for (epicsUInt32 i=1; i<m_maxThreads; ++i) {
+    free(p_Workers[i].pHist);
+    free(p_Workers[i].pDirty);
+    p_Workers[i].pHist = NULL;
+    p_Workers[i].pDirty = NULL;
+  }
+}
+
+/**
+ * Worker thread. Waits to be given a range of events, and counts them into its private histogram.
+ * @param index The worker number (1 based).
+ */
+void ADnEDHistogram::workerTask(epicsUInt32 index)
+{
+  Worker *pWorker = &p_Workers[index];
+
+  while (1) {
+    epicsEventWait(pWorker->startEvent);
+    if (m_exiting) {
+      epicsEventSignal(pWorker->doneEvent);
+      return;
+    }
+    memset(pWorker->detEvents, 0, sizeof(pWorker->detEvents));
+    histogram(pWorker->pPixels, pWorker->pTOF, pWorker->numEvents,
+              pWorker->pHist, pWorker->pDirty, pWorker->detEvents);
+    epicsEventSignal(pWorker->doneEvent);
+  }
+}
+
+/**
+ * Return the number of events processed per second of processing time since the last call.
+ * This is the throughput of the engine itself, independent of the incoming event rate.
+ */
+epicsFloat64 ADnEDHistogram::getEventRate(void)
+{
+  if ((m_eventCount > 0) && (m_processTime > 0)) {
+    m_lastEventRate = m_eventCount / m_processTime;
+  } else {
+    m_lastEventRate = 0.0;
+  }
+  m_eventCount = 0.0;
+  m_processTime = 0.0;
+  return m_lastEventRate;
+}
+
+/**
+ * Print the state of the engine.
+ */
+void ADnEDHistogram::report(FILE *fp, int details) const
+{
+  fprintf(fp, "ADnEDHistogram: threads: %d (max %d), min parallel events: %d\n",
+          m_numThreads, m_maxThreads, m_minParallelEvents);
+  fprintf(fp, "ADnEDHistogram: detectors: %d, data size: %d, tofMax: %d\n",
+          m_numDet, m_dataSize, m_tofMax);
+  if (m_scanDets) {
+    fprintf(fp, "ADnEDHistogram: pixel ranges overlap or are too large, scanning detectors.\n");
+  } else {
+    fprintf(fp, "ADnEDHistogram: pixel lookup table start: %d, size: %d\n", m_lookupStart, m_lookupSize);
+  }
+  fprintf(fp, "ADnEDHistogram: last event rate: %f events/s\n", m_lastEventRate);
+  if (details > 1) {
+    for (epicsUInt32 det=1; det<=m_numDet; ++det) {
+      fprintf(fp, "  det %d: pixels %d-%d, plot type %d, TOF bins %d (width %d), TOF transform %d\n",
+              det, m_det[det].pixelStart, m_det[det].pixelEnd, m_det[det].plotType,
+              m_det[det].tofBins, m_tofBinWidth[det], m_det[det].tofTransType);
+    }
+  }
+}
+
+//Global C utility functions to tie in with EPICS
+static void ADnEDHistogramWorkerC(void *drvPvt)
+{
+  ADnEDHistogram::Worker *pWorker = static_cast<ADnEDHistogram::Worker *>(drvPvt);
+
+  pWorker->pHistogram->workerTask(pWorker->index);
+}
@@ -0,0 +1,114 @@
+//Documentation in ADnEDHistogram.cpp file
+
+#ifndef ADNED_HISTOGRAM_H
+#define ADNED_HISTOGRAM_H
+
+#include <stdio.h>
+
+#include <epicsTypes.h>
+#include <epicsEvent.h>
+
+#include "ADnEDGlobals.h"
+#include "ADnEDTransform.h"
+
+/**
+ * Configuration of one detector, copied from the parameter library once per packet.
+ */
+struct ADnEDHistDetConfig {
+  epicsUInt32 pixelStart;         //First pixel ID of the detector
+  epicsUInt32 pixelEnd;           //Last pixel ID of the detector
+  epicsUInt32 size;               //Size of the pixel (or X/TOF, Y/TOF, PixelID/TOF) array
+  epicsUInt32 arrayStart;         //Start of the pixel array in the data buffer
+  epicsUInt32 tofArrayStart;      //Start of the TOF array in the data buffer
+  epicsUInt32 plotType;           //Type of 2-D plot
+  epicsUInt32 tofBins;            //Number of TOF bins for the X/TOF, Y/TOF and PixelID/TOF plots
+  int tofROIEnable;               //Only count pixels whose TOF is inside the TOF ROI
+  int tofROIStart;
+  int tofROISize;
+  int pixelMapEnable;             //Map pixel IDs with pPixelMap
+  const epicsUInt32 *pPixelMap;
+  epicsUInt32 pixelMapSize;
+  epicsUInt32 tofTransType;       //TOF transformation type, 0 for none
+  epicsFloat64 tofTransScale;
+  epicsFloat64 tofTransOffset;
+  const ADnEDTransform *pTransform;
+  int pixelROIEnable;             //Only count TOF for pixels inside the X/Y pixel ROI
+  int pixelROIStartX;
+  int pixelROISizeX;
+  int pixelROIStartY;
+  int pixelROISizeY;
+  int pixelSizeX;                 //X size of the detector, used for the X/Y pixel ROI and plots
+};
+
+class ADnEDHistogram {
+
+ public:
+  ADnEDHistogram(epicsUInt32 maxThreads);
+  virtual ~ADnEDHistogram();
+
+  void setBuffer(epicsUInt32 *pData, epicsUInt32 dataSize, epicsUInt32 tofMax);
+  void setDetectors(epicsUInt32 numDet, const ADnEDHistDetConfig *pConfig);
+  void setThreads(epicsUInt32 numThreads, epicsUInt32 minParallelEvents);
+  void process(const epicsUInt32 *pPixels, const epicsUInt32 *pTOF, epicsUInt32 numEvents,
+               epicsUInt32 *pDetEvents);
+  epicsFloat64 getEventRate(void);
+  epicsUInt32 getNumThreads(void) const;
+  void report(FILE *fp, int details) const;
+
+  void workerTask(epicsUInt32 index);
+
+  //State of a worker thread, which is passed to the thread function
+  struct Worker {
+    ADnEDHistogram *pHistogram;
+    epicsUInt32 index;
+    epicsEventId startEvent;
+    epicsEventId doneEvent;
+    const epicsUInt32 *pPixels;
+    const epicsUInt32 *pTOF;
+    epicsUInt32 numEvents;
+    epicsUInt32 *pHist;           //Private histogram, the same size as the data buffer
+    epicsUInt8 *pDirty;           //One flag per block of the private histogram
+    epicsUInt32 detEvents[ADNED_MAX_DETS+1];
+  };
+
+ private:
+
+  //Private functions
+  void buildLookup(void);
+  void histogram(const epicsUInt32 *pPixels, const epicsUInt32 *pTOF, epicsUInt32 numEvents,
+                 epicsUInt32 *pHist, epicsUInt8 *pDirty, epicsUInt32 *pDetEvents) const;
+  template <typename tofType> void histogramEvent(const ADnEDHistDetConfig &det, epicsUInt32 detIndex,
+                                                  epicsUInt32 pixel, tofType tof, epicsUInt32 *pHist,
+                                                  epicsUInt8 *pDirty) const;
+  void mergeWorker(Worker *pWorker);
+  void freeWorkerBuffers(void);
+
+  //Private dynamic
+  epicsUInt32 *p_Data;
+  epicsUInt32 m_dataSize;
+  epicsUInt32 m_tofMax;
+  epicsUInt32 m_numDet;
+  ADnEDHistDetConfig m_det[ADNED_MAX_DETS+1];
+  epicsUInt32 m_tofBinWidth[ADNED_MAX_DETS+1];
+  epicsUInt8 *p_Lookup;           //Detector number for each pixel ID from m_lookupStart, 0 for none
+  epicsUInt32 m_lookupStart;
+  epicsUInt32 m_lookupSize;
+  bool m_scanDets;                //Find the detector by scanning the pixel ID ranges, not with p_Lookup
+  epicsUInt32 m_tofROILow[ADNED_MAX_DETS+1];   //Integer TOF ROI of each detector
+  epicsUInt32 m_tofROIHigh[ADNED_MAX_DETS+1];
+  epicsUInt32 m_maxThreads;
+  epicsUInt32 m_numThreads;
+  epicsUInt32 m_minParallelEvents;
+  Worker *p_Workers;
+  bool m_exiting;
+  epicsFloat64 m_eventCount;
+  epicsFloat64 m_processTime;
+  epicsFloat64 m_lastEventRate;
+
+  //Private static const
+  static const epicsUInt32 s_ADNED_HIST_BLOCK_SHIFT;
+  static const epicsUInt32 s_ADNED_HIST_MAX_LOOKUP;
+
+};
+
+#endif //ADNED_HISTOGRAM_H
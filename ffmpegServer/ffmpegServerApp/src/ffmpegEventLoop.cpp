@@ -0,0 +1,435 @@
+/* local includes */
+#include "ffmpegEventLoop.h"
+
+#ifdef FFMPEG_EVENT_LOOP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+/* EPICS includes */
+#include <epicsThread.h>
+
+/** maximum number of events handled by each call to epoll_wait */
+#define MAX_EVENTS 64
+/** seconds a snapshot waits for a frame before it is sent "No Data" */
+#define SNAPSHOT_TIMEOUT 10.0
+
+static const char *driverName = "ffmpegEventLoop";
+
+/** Sent after each jpeg of an mjpg stream */
+static const char boundary[] = "\r\n--BOUNDARY\r\n";
+
+/** Sent to a snapshot that timed out waiting for a frame */
+static const char noData[] =
+    "HTTP/1.0 200 OK\r\nConnection: close\r\nCache-Control: no-cache\r\n"
+    "Content-Type: text/html\r\nContent-Length: 100\r\n\r\n"
+    "<HTML><HEAD><TITLE>200 No Data</TITLE></HEAD>\n"
+    "<BODY><H1>No Data</H1>No jpeg available</BODY></HTML>\n";
+
+/** c function that runs the event loop thread */
+static void c_run(void *pvt) {
+    ((ffmpegEventLoop *) pvt)->run();
+}
+
+ffmpegEventLoop::ffmpegEventLoop() {
+    this->mutex = epicsMutexMustCreate();
+    this->epfd = -1;
+    this->wakeFds[0] = -1;
+    this->wakeFds[1] = -1;
+    this->stopping = 0;
+    this->pending = NULL;
+    this->clients = NULL;
+    epicsTimeGetCurrent(&this->lastRates);
+}
+
+/** Close the epoll instance and the wakeup pipe. Only an event loop whose
+thread was never started, because start() failed, may be deleted */
+ffmpegEventLoop::~ffmpegEventLoop() {
+    if (this->epfd >= 0) close(this->epfd);
+    if (this->wakeFds[0] >= 0) close(this->wakeFds[0]);
+    if (this->wakeFds[1] >= 0) close(this->wakeFds[1]);
+    epicsMutexDestroy(this->mutex);
+}
+
+/** Create the epoll instance and the pipe used to wake it up, then start the
+event loop thread. Returns 0 on success */
+int ffmpegEventLoop::start() {
+    struct epoll_event ev;
+    this->epfd = epoll_create(MAX_EVENTS);
+    if (this->epfd < 0 || pipe(this->wakeFds) < 0) {
+        printf("%s:start: could not create epoll instance: %s\n",
+                driverName, strerror(errno));
+        return -1;
+    }
+    fcntl(this->wakeFds[0], F_SETFL, O_NONBLOCK);
+    fcntl(this->wakeFds[1], F_SETFL, O_NONBLOCK);
+    /* the wakeup pipe is the only event with a NULL pointer */
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(this->epfd, EPOLL_CTL_ADD, this->wakeFds[0], &ev);
+    if (epicsThreadCreate("ffmpegEventLoop",
+            epicsThreadPriorityMedium,
+            epicsThreadGetStackSize(epicsThreadStackMedium),
+            (EPICSTHREADFUNC)c_run, this) == NULL) {
+        printf("%s:start: epicsThreadCreate failure\n", driverName);
+        return -1;
+    }
+    return 0;
+}
+
+/** Stop the event loop, finishing all of the clients */
+void ffmpegEventLoop::stop() {
+    epicsMutexMustLock(this->mutex);
+    this->stopping = 1;
+    epicsMutexUnlock(this->mutex);
+    this->wake();
+}
+
+/** Wake up the event loop thread. If the pipe is full it is already awake */
+void ffmpegEventLoop::wake() {
+    ssize_t ret = write(this->wakeFds[1], "x", 1);
+    (void) ret;
+}
+
+/** Make jpeg the latest frame of a channel, and wake up the event loop to
+send it. This takes over the reference to jpeg held by the caller */
+void ffmpegEventLoop::publish(ffmpegChannel *pChannel, NDArray *jpeg) {
+    ffmpegFrame *pFrame = (ffmpegFrame *) calloc(1, sizeof(ffmpegFrame));
+    ffmpegFrame *pOld;
+    pFrame->jpeg = jpeg;
+    pFrame->headerLen = snprintf(pFrame->header, sizeof(pFrame->header),
+            "Content-Type: image/jpeg\r\nContent-Length: %d\r\n\r\n",
+            (int) jpeg->dims[0].size);
+    pFrame->refs = 1;
+    epicsMutexMustLock(this->mutex);
+    pOld = pChannel->frame;
+    pChannel->frame = pFrame;
+    pChannel->seq++;
+    if (pOld) this->releaseFrame(pOld);
+    epicsMutexUnlock(this->mutex);
+    this->wake();
+}
+
+/** Return 1 if a frame has been published on this channel */
+int ffmpegEventLoop::hasFrame(ffmpegChannel *pChannel) {
+    int ret;
+    epicsMutexMustLock(this->mutex);
+    ret = (pChannel->frame != NULL);
+    epicsMutexUnlock(this->mutex);
+    return ret;
+}
+
+/** Hand a client to the event loop, which sends it frames on a duplicate of
+socket. socket itself is pointed at /dev/null, so the nullhttpd thread can
+close the connection and return straight away without disturbing the client.
+If waitForNext is 0 the current frame is sent straight away, otherwise the
+client starts with the next frame published. pClient must have been allocated
+with calloc, with channel, snapshot, address, finished and pvt filled in.
+Returns 0 if the event loop has taken the client, and will call finished and
+free it when it is done. Otherwise the caller still owns the client and socket
+is untouched */
+int ffmpegEventLoop::serve(ffmpegClient *pClient, int socket, int waitForNext) {
+    int devNull;
+    epicsMutexMustLock(this->mutex);
+    if (this->stopping) {
+        epicsMutexUnlock(this->mutex);
+        return -1;
+    }
+    pClient->socket = dup(socket);
+    devNull = open("/dev/null", O_RDWR);
+    if (pClient->socket < 0 || devNull < 0 || dup2(devNull, socket) < 0) {
+        epicsMutexUnlock(this->mutex);
+        printf("%s:serve: could not detach socket of %s: %s\n",
+                driverName, pClient->address, strerror(errno));
+        if (pClient->socket >= 0) close(pClient->socket);
+        if (devNull >= 0) close(devNull);
+        return -1;
+    }
+    close(devNull);
+    if (pClient->snapshot) {
+        epicsTimeGetCurrent(&pClient->deadline);
+        epicsTimeAddSeconds(&pClient->deadline, SNAPSHOT_TIMEOUT);
+    }
+    pClient->seq = pClient->channel->seq;
+    if (!waitForNext && pClient->channel->frame) pClient->seq--;
+    pClient->next = this->pending;
+    this->pending = pClient;
+    epicsMutexUnlock(this->mutex);
+    this->wake();
+    return 0;
+}
+
+/** Write a line for each client of a channel with its address, frame rate and
+dropped frames into buffer. Returns the number of clients */
+int ffmpegEventLoop::status(ffmpegChannel *pChannel, char *buffer, size_t size) {
+    ffmpegClient *pClient;
+    int nclients = 0;
+    size_t len = 0;
+    buffer[0] = '\0';
+    epicsMutexMustLock(this->mutex);
+    for (pClient = this->clients; pClient; pClient = pClient->next) {
+        if (pClient->channel != pChannel || pClient->snapshot) continue;
+        nclients++;
+        if (len < size) {
+            len += snprintf(buffer + len, size - len,
+                    "%s: %.1f fps, %u frames, %u dropped, %.0f kB\n",
+                    pClient->address, pClient->fps, pClient->frames,
+                    pClient->dropped, pClient->bytes / 1024);
+        }
+    }
+    epicsMutexUnlock(this->mutex);
+    return nclients;
+}
+
+/** Release a reference to a frame. Called with the mutex locked */
+void ffmpegEventLoop::releaseFrame(ffmpegFrame *pFrame) {
+    if (--pFrame->refs == 0) {
+        pFrame->jpeg->release();
+        free(pFrame);
+    }
+}
+
+/** Make the socket of a new client non-blocking, add it to epoll and start
+sending it a frame if there is one */
+void ffmpegEventLoop::addClient(ffmpegClient *pClient) {
+    struct epoll_event ev;
+    fcntl(pClient->socket, F_SETFL, fcntl(pClient->socket, F_GETFL, 0) | O_NONBLOCK);
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = pClient;
+    if (epoll_ctl(this->epfd, EPOLL_CTL_ADD, pClient->socket, &ev) < 0) {
+        this->finishClient(pClient);
+        return;
+    }
+    epicsMutexMustLock(this->mutex);
+    pClient->next = this->clients;
+    this->clients = pClient;
+    epicsMutexUnlock(this->mutex);
+    this->startFrame(pClient);
+}
+
+/** Remove a client from epoll and the client list, then finish it. The event
+loop must not touch the client after this */
+void ffmpegEventLoop::removeClient(ffmpegClient *pClient) {
+    ffmpegClient **ppClient;
+    epoll_ctl(this->epfd, EPOLL_CTL_DEL, pClient->socket, NULL);
+    epicsMutexMustLock(this->mutex);
+    for (ppClient = &this->clients; *ppClient; ppClient = &(*ppClient)->next) {
+        if (*ppClient == pClient) {
+            *ppClient = pClient->next;
+            break;
+        }
+    }
+    if (pClient->frame) this->releaseFrame(pClient->frame);
+    pClient->frame = NULL;
+    epicsMutexUnlock(this->mutex);
+    this->finishClient(pClient);
+}
+
+/** Close the socket of a client, tell its owner it has finished and free it */
+void ffmpegEventLoop::finishClient(ffmpegClient *pClient) {
+    close(pClient->socket);
+    if (pClient->finished) pClient->finished(pClient->pvt);
+    free(pClient);
+}
+
+/** Send "No Data" to the snapshots that are still waiting for a frame after
+SNAPSHOT_TIMEOUT, and remove them */
+void ffmpegEventLoop::expireSnapshots() {
+    epicsTimeStamp now;
+    ffmpegClient *pClient, *pNext;
+    ssize_t ret;
+    epicsTimeGetCurrent(&now);
+    for (pClient = this->clients; pClient; pClient = pNext) {
+        pNext = pClient->next;
+        if (!pClient->snapshot || pClient->frame || epicsTimeLessThan(&now, &pClient->deadline)) continue;
+        /* The socket is empty, so this small response fits without blocking */
+        ret = send(pClient->socket, noData, sizeof(noData) - 1, MSG_NOSIGNAL);
+        (void) ret;
+        this->removeClient(pClient);
+    }
+}
+
+/** Start sending the latest frame of the channel to an idle client, if it
+hasn't already sent it. The frames published since the last one it started are
+counted as dropped */
+void ffmpegEventLoop::startFrame(ffmpegClient *pClient) {
+    ffmpegFrame *pFrame;
+    epicsUInt32 seq;
+    int size;
+    epicsMutexMustLock(this->mutex);
+    pFrame = pClient->channel->frame;
+    seq = pClient->channel->seq;
+    if (pFrame == NULL || seq == pClient->seq) {
+        epicsMutexUnlock(this->mutex);
+        return;
+    }
+    pFrame->refs++;
+    epicsMutexUnlock(this->mutex);
+    pClient->dropped += seq - pClient->seq - 1;
+    pClient->seq = seq;
+    pClient->frame = pFrame;
+    size = (int) pFrame->jpeg->dims[0].size;
+    if (pClient->snapshot) {
+        snprintf(pClient->header, sizeof(pClient->header),
+                "HTTP/1.0 200 OK\r\nConnection: close\r\nCache-Control: no-cache\r\n"
+                "Content-Type: image/jpeg\r\nContent-Length: %d\r\n\r\n", size);
+        pClient->iov[0].iov_base = pClient->header;
+        pClient->iov[0].iov_len = strlen(pClient->header);
+        pClient->iov[1].iov_base = pFrame->jpeg->pData;
+        pClient->iov[1].iov_len = size;
+        pClient->iovCount = 2;
+    } else {
+        pClient->iov[0].iov_base = pFrame->header;
+        pClient->iov[0].iov_len = pFrame->headerLen;
+        pClient->iov[1].iov_base = pFrame->jpeg->pData;
+        pClient->iov[1].iov_len = size;
+        pClient->iov[2].iov_base = (void *) boundary;
+        pClient->iov[2].iov_len = sizeof(boundary) - 1;
+        pClient->iovCount = 3;
+    }
+    pClient->iovIndex = 0;
+    this->sendFrame(pClient);
+}
+
+/** Send as much of the current frame as the socket will take without
+blocking. If the socket is full wait for EPOLLOUT, otherwise when the frame is
+complete start the next one */
+void ffmpegEventLoop::sendFrame(ffmpegClient *pClient) {
+    struct msghdr msg;
+    ssize_t n;
+    while (pClient->iovIndex < pClient->iovCount) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &pClient->iov[pClient->iovIndex];
+        msg.msg_iovlen = pClient->iovCount - pClient->iovIndex;
+        /* MSG_NOSIGNAL so that a client that has gone away doesn't raise SIGPIPE */
+        n = sendmsg(pClient->socket, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                this->setWriting(pClient, 1);
+            } else {
+                this->removeClient(pClient);
+            }
+            return;
+        }
+        pClient->bytes += n;
+        while (n > 0) {
+            struct iovec *pIov = &pClient->iov[pClient->iovIndex];
+            if ((size_t) n >= pIov->iov_len) {
+                n -= pIov->iov_len;
+                pClient->iovIndex++;
+            } else {
+                pIov->iov_base = (char *) pIov->iov_base + n;
+                pIov->iov_len -= n;
+                n = 0;
+            }
+        }
+    }
+    /* The frame is complete */
+    pClient->frames++;
+    pClient->fpsFrames++;
+    epicsMutexMustLock(this->mutex);
+    this->releaseFrame(pClient->frame);
+    pClient->frame = NULL;
+    epicsMutexUnlock(this->mutex);
+    if (pClient->snapshot) {
+        this->removeClient(pClient);
+        return;
+    }
+    this->setWriting(pClient, 0);
+    this->startFrame(pClient);
+}
+
+/** Enable or disable EPOLLOUT for a client */
+void ffmpegEventLoop::setWriting(ffmpegClient *pClient, int writing) {
+    struct epoll_event ev;
+    if (pClient->writing == writing) return;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = writing ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    ev.data.ptr = pClient;
+    epoll_ctl(this->epfd, EPOLL_CTL_MOD, pClient->socket, &ev);
+    pClient->writing = writing;
+}
+
+/** Update the frame rate of each client about once a second */
+void ffmpegEventLoop::updateRates() {
+    epicsTimeStamp now;
+    double elapsed;
+    ffmpegClient *pClient;
+    epicsTimeGetCurrent(&now);
+    elapsed = epicsTimeDiffInSeconds(&now, &this->lastRates);
+    if (elapsed < 1.0) return;
+    for (pClient = this->clients; pClient; pClient = pClient->next) {
+        pClient->fps = pClient->fpsFrames / elapsed;
+        pClient->fpsFrames = 0;
+    }
+    this->lastRates = now;
+}
+
+/** The event loop thread. Wakes up for socket events, new clients and new
+frames, and sends every idle client the latest frame of its channel */
+void ffmpegEventLoop::run() {
+    struct epoll_event events[MAX_EVENTS];
+    ffmpegClient *pClient, *pNext;
+    char junk[256];
+    int i, n, stop;
+    ssize_t ret;
+    for (;;) {
+        n = epoll_wait(this->epfd, events, MAX_EVENTS, 1000);
+        for (i=0; i<n; i++) {
+            pClient = (ffmpegClient *) events[i].data.ptr;
+            if (pClient == NULL) {
+                /* Drain the wakeup pipe */
+                while (read(this->wakeFds[0], junk, sizeof(junk)) > 0);
+                continue;
+            }
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                this->removeClient(pClient);
+                continue;
+            }
+            if (events[i].events & EPOLLIN) {
+                /* Clients send nothing after the request, so this is normally the connection closing */
+                ret = recv(pClient->socket, junk, sizeof(junk), 0);
+                if (ret == 0 || (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                    this->removeClient(pClient);
+                    continue;
+                }
+            }
+            if (events[i].events & EPOLLOUT) {
+                this->sendFrame(pClient);
+            }
+        }
+        /* Add the new clients */
+        epicsMutexMustLock(this->mutex);
+        pClient = this->pending;
+        this->pending = NULL;
+        stop = this->stopping;
+        epicsMutexUnlock(this->mutex);
+        for (; pClient; pClient = pNext) {
+            pNext = pClient->next;
+            this->addClient(pClient);
+        }
+        if (stop) break;
+        /* Start sending new frames to the clients that are idle */
+        for (pClient = this->clients; pClient; pClient = pNext) {
+            pNext = pClient->next;
+            if (pClient->frame == NULL) this->startFrame(pClient);
+        }
+        this->expireSnapshots();
+        this->updateRates();
+    }
+    /* Finish all of the clients */
+    while (this->clients) {
+        this->removeClient(this->clients);
+    }
+}
+
+#endif /* FFMPEG_EVENT_LOOP */
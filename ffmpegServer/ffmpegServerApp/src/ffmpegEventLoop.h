@@ -0,0 +1,101 @@
+#ifndef ffmpegEventLoop_H
+#define ffmpegEventLoop_H
+
+/* The event loop needs epoll, so it is only built on linux. Other platforms
+   keep a blocking thread per http client */
+#ifdef __linux__
+#define FFMPEG_EVENT_LOOP
+
+#include <sys/uio.h>
+
+#include <epicsMutex.h>
+#include <epicsTime.h>
+
+#include "NDArray.h"
+
+/** An encoded jpeg with the multipart header that precedes it in an mjpg
+stream. It is shared by all of the clients sending it, and released when the
+last of them has finished. */
+typedef struct ffmpegFrame {
+    NDArray *jpeg;
+    char header[64];
+    int headerLen;
+    int refs;
+} ffmpegFrame;
+
+/** The latest frame of an ffmpegStream. seq counts the frames published, so
+that clients can tell how many they skipped */
+typedef struct ffmpegChannel {
+    ffmpegFrame *frame;
+    epicsUInt32 seq;
+} ffmpegChannel;
+
+/** A http client of an mjpg stream or a jpg snapshot, served by the event
+loop. The nullhttpd thread that accepted the connection allocates it and hands
+it to the event loop with serve(), which then owns it and its socket. When the
+event loop has finished with the client it calls finished and frees it */
+typedef struct ffmpegClient {
+    ffmpegChannel *channel;
+    int snapshot;           /* Send one jpeg with a http header, then finish */
+    char address[64];
+    void (*finished)(void *pvt);
+    void *pvt;
+    /* The rest is only used by the event loop */
+    int socket;             /* the event loop's duplicate of the connection */
+    epicsTimeStamp deadline;    /* a snapshot that has no frame by then is sent "No Data" */
+    int writing;            /* EPOLLOUT is enabled */
+    epicsUInt32 seq;        /* seq of the last frame started */
+    ffmpegFrame *frame;     /* frame being sent, if any */
+    struct iovec iov[3];
+    int iovIndex;
+    int iovCount;
+    char header[256];       /* http header of a snapshot */
+    /* Statistics, updated by the event loop without the lock */
+    epicsUInt32 frames;
+    epicsUInt32 dropped;
+    double fps;
+    double bytes;
+    epicsUInt32 fpsFrames;  /* frames sent since the rates were last updated */
+    struct ffmpegClient *next;
+} ffmpegClient;
+
+/** Sends the jpegs of all the ffmpegStreams to their http clients from one
+thread, with non-blocking scatter/gather writes. Each client sends the latest
+frame whenever it has finished the previous one, so a slow client skips frames
+instead of holding up the others. */
+class ffmpegEventLoop {
+public:
+    ffmpegEventLoop();
+    ~ffmpegEventLoop();
+    int start();
+    void stop();
+    void publish(ffmpegChannel *pChannel, NDArray *jpeg);
+    int hasFrame(ffmpegChannel *pChannel);
+    int serve(ffmpegClient *pClient, int socket, int waitForNext);
+    int status(ffmpegChannel *pChannel, char *buffer, size_t size);
+    void run();
+
+private:
+    void wake();
+    void addClient(ffmpegClient *pClient);
+    void removeClient(ffmpegClient *pClient);
+    void finishClient(ffmpegClient *pClient);
+    void expireSnapshots();
+    void startFrame(ffmpegClient *pClient);
+    void sendFrame(ffmpegClient *pClient);
+    void setWriting(ffmpegClient *pClient, int writing);
+    void releaseFrame(ffmpegFrame *pFrame);
+    void updateRates();
+
+    epicsMutexId mutex;     /* protects the channels, the frame refs and the client lists */
+    int epfd;
+    int wakeFds[2];
+    int stopping;
+    ffmpegClient *pending;  /* clients waiting to be added by the event loop thread */
+    ffmpegClient *clients;
+    epicsTimeStamp lastRates;
+};
+
+#endif /* __linux__ */
+
+#endif
@@ -35,6 +35,11 @@ int pthread_cond_signal (pthread_cond_t *cv) {
 
 static const char *driverName = "ffmpegServer";
 
+#ifdef FFMPEG_EVENT_LOOP
+/** The event loop that sends the jpegs of all the streams to their clients */
+static ffmpegEventLoop *eventLoop = NULL;
+#endif
+
 /** This is called whenever a client requests a stream */
 void dorequest(int sid) {
     char *portName;
@@ -75,6 +80,13 @@ void dorequest(int sid) {
                     free(portName);
                     return;
                 }
+#ifdef FFMPEG_EVENT_LOOP
+                if (strcmp(ext, "status") == 0) {
+                    streams[i]->send_status(sid);
+                    free(portName);
+                    return;
+                }
+#endif
 
             }
         }
@@ -178,6 +190,9 @@ static int stopping = 0;
 void c_shutdown(void *) {
     printf("Shutting down http server...");
     stopping = 1;
+#ifdef FFMPEG_EVENT_LOOP
+    if (eventLoop) eventLoop->stop();
+#endif
     server_shutdown();
     sleep(1);
     printf("OK\n");
@@ -194,6 +209,17 @@ void ffmpegServerConfigure(int port) {
     }    
     streams = (ffmpegStream **) calloc(MAX_FFMPEG_STREAMS, sizeof(ffmpegStream *));
     nstreams = 0;    
+#ifdef FFMPEG_EVENT_LOOP
+    /* Start the event loop that sends the jpegs */
+    eventLoop = new ffmpegEventLoop();
+    if (eventLoop->start()) {
+        printf("%s:ffmpegServerConfigure could not start the event loop, so the http server is not started\n",
+                driverName);
+        delete eventLoop;
+        eventLoop = NULL;
+        return;
+    }
+#endif
     config.server_port = port;
     config.server_loglevel=1;
     strncpy(config.server_hostname, "any", sizeof(config.server_hostname)-1);
@@ -223,6 +249,86 @@ void ffmpegServerConfigure(int port) {
     epicsAtExit(c_shutdown, NULL);    
 }
 
+#ifdef FFMPEG_EVENT_LOOP
+/** c function called by the event loop when it has finished with a client */
+static void c_client_finished(void *pvt) {
+    ((ffmpegStream *) pvt)->client_finished();
+}
+
+/** Called when the event loop has finished with a client of this stream */
+void ffmpegStream::client_finished() {
+    /* we're no longer listening */
+    pthread_mutex_lock( &this->mutex );    
+    this->nclients--;    
+    pthread_mutex_unlock(&this->mutex);    
+}
+
+/** Internal function to send a single snapshot. The event loop sends the http
+header and the jpeg, so this thread returns as soon as it has handed over the
+connection */
+void ffmpegStream::send_snapshot(int sid, int index) {
+    int always_on;
+    ffmpegClient *pClient;
+    /* Say we're listening */
+    getIntegerParam(0, ffmpegServerAlwaysOn, &always_on);
+    pthread_mutex_lock( &this->mutex );    
+    this->nclients++;   
+    if (this->nclients > 1) always_on = 1;
+    pthread_mutex_unlock(&this->mutex);
+    /* if always on or clients already listening then there is already a frame,
+     * otherwise the event loop waits for the next one */
+    if ((always_on || index) && !eventLoop->hasFrame(&this->channel)) {
+        pthread_mutex_lock( &this->mutex );    
+        this->nclients--;    
+        pthread_mutex_unlock(&this->mutex);    
+        /* If there's no data yet, say so */
+        printerror(sid, 200, "No Data", "No jpeg available yet");
+        return;
+    }
+    pClient = (ffmpegClient *) calloc(1, sizeof(ffmpegClient));
+    pClient->channel = &this->channel;
+    pClient->snapshot = 1;
+    strncpy(pClient->address, conn[sid].dat->in_RemoteAddr, sizeof(pClient->address)-1);
+    pClient->finished = c_client_finished;
+    pClient->pvt = this;
+    if (eventLoop->serve(pClient, conn[sid].socket, !(always_on || index))) {
+        free(pClient);
+        this->client_finished();
+    }
+    /* Clear up */
+    conn[sid].dat->out_headdone=1;
+    conn[sid].dat->out_bodydone=1;
+    conn[sid].dat->out_flushed=1;
+    conn[sid].dat->out_ReplyData[0]='\0';
+    flushbuffer(sid);
+}
+
+/** Internal function to send the frame rate and dropped frames of each client
+of the mjpg stream as plain text */
+void ffmpegStream::send_status(int sid) {
+    char buffer[8192];
+    char *line, *save;
+    int nclients = eventLoop->status(&this->channel, buffer, sizeof(buffer));
+    send_header(sid, 0, 200, "OK", "1", "text/plain", -1, -1);
+    prints("%s: %d mjpg clients\n", this->portName, nclients);
+    for (line = strtok_r(buffer, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        prints("%s\n", line);
+    }
+    flushbuffer(sid);
+}
+
+/** Report on this stream, and if details > 0 the frame rate and dropped frames
+of each of its mjpg clients */
+void ffmpegStream::report(FILE *fp, int details) {
+    char buffer[8192];
+    int nclients;
+    NDPluginDriver::report(fp, details);
+    if (details > 0 && eventLoop) {
+        nclients = eventLoop->status(&this->channel, buffer, sizeof(buffer));
+        fprintf(fp, "  %d mjpg clients\n%s", nclients, buffer);
+    }
+}
+#else
 /** Internal function to send a single snapshot */
 void ffmpegStream::send_snapshot(int sid, int index) {
     time_t now=time((time_t*)0);
@@ -265,6 +371,8 @@ void ffmpegStream::send_snapshot(int sid, int index) {
     flushbuffer(sid);
 }
 
+#endif
+
 #define MIN(a, b)  (((a) < (b)) ? (a) : (b))
 
 
@@ -316,6 +424,36 @@ NDArray* ffmpegStream::wait_for_jpeg(int sid) {
     return pArray;    
 }    
 
+#ifdef FFMPEG_EVENT_LOOP
+/** Internal function to send an mjpg stream. This thread sends the http header,
+then hands the connection to the event loop, which sends the frames until the
+client goes away */
+void ffmpegStream::send_stream(int sid) {
+    int always_on;
+    ffmpegClient *pClient;
+    time_t now=time((time_t*)0);    
+    /* Say we're listening */
+    getIntegerParam(0, ffmpegServerAlwaysOn, &always_on);
+    pthread_mutex_lock( &this->mutex );    
+    this->nclients++;    
+    if (this->nclients > 1) always_on = 1;
+    pthread_mutex_unlock(&this->mutex);    
+    /* Send the appropriate header */
+    send_fileheader(sid, 0, 200, "OK", "1", "multipart/x-mixed-replace;boundary=BOUNDARY", -1, now);
+    prints("--BOUNDARY\r\n");
+    flushbuffer(sid);
+    /* if always on or clients already listening then there is already a frame */    
+    pClient = (ffmpegClient *) calloc(1, sizeof(ffmpegClient));
+    pClient->channel = &this->channel;
+    strncpy(pClient->address, conn[sid].dat->in_RemoteAddr, sizeof(pClient->address)-1);
+    pClient->finished = c_client_finished;
+    pClient->pvt = this;
+    if (eventLoop->serve(pClient, conn[sid].socket, !always_on)) {
+        free(pClient);
+        this->client_finished();
+    }
+} 
+#else
 /** Internal function to send an mjpg stream */
 void ffmpegStream::send_stream(int sid) {
     int ret = 0;
@@ -347,7 +485,8 @@ void ffmpegStream::send_stream(int sid) {
     pthread_mutex_lock( &this->mutex );    
     this->nclients--;    
     pthread_mutex_unlock(&this->mutex);            
-} 
+}
+#endif
 
 /** Internal function to alloc a correctly sized processed array */
 void ffmpegStream::allocScArray(size_t size) {
@@ -380,6 +519,8 @@ void ffmpegStream::processCallbacks(NDArray *pArray)
     /* we're going to get these from the dims of the image */
     int width, height;
     size_t size;
+    /* the jpeg we produce */
+    NDArray *pJpeg;
     /* for printing errors */
     const char *functionName = "processCallbacks";
     /* for getting the colour mode */
@@ -503,21 +644,14 @@ void ffmpegStream::processCallbacks(NDArray *pArray)
         return;
     }      
 
-    /* lock the output plugin mutex */
-    pthread_mutex_lock(&this->mutex);
-
-    /* Release the last jpeg created */
-    if (this->jpeg) {
-        this->jpeg->release();
-    }
-    
-    /* Convert it to a jpeg */        
-    this->jpeg = this->pNDArrayPool->alloc(1, &size, NDInt8, 0, NULL);
+    /* Convert it to a jpeg. The clients only see it once it is complete, so
+     * this doesn't need the output plugin mutex */
+    pJpeg = this->pNDArrayPool->alloc(1, &size, NDInt8, 0, NULL);
 
     AVPacket pkt;
     int got_output;
     av_init_packet(&pkt);
-    pkt.data = (uint8_t*)this->jpeg->pData;    // packet data will be allocated by the encoder
+    pkt.data = (uint8_t*)pJpeg->pData;    // packet data will be allocated by the encoder
     pkt.size = c->width * c->height;
 
     if (avcodec_encode_video2(c, &pkt, scPicture, &got_output)) {
@@ -526,15 +660,34 @@ void ffmpegStream::processCallbacks(NDArray *pArray)
             driverName, functionName);
     }
 
-    this->jpeg->dims[0].size = pkt.size;
+    pJpeg->dims[0].size = pkt.size;
 
-    //printf("Frame! Size: %d\n", this->jpeg->dims[0].size);
+    //printf("Frame! Size: %d\n", pJpeg->dims[0].size);
+
+#ifdef FFMPEG_EVENT_LOOP
+    /* hand it to the event loop, which sends it to all of the clients. There
+     * are no clients if ffmpegServerConfigure could not start it */
+    if (eventLoop) {
+        eventLoop->publish(&this->channel, pJpeg);
+    } else {
+        pJpeg->release();
+    }
+#else
+    /* lock the output plugin mutex */
+    pthread_mutex_lock(&this->mutex);
+
+    /* Release the last jpeg created */
+    if (this->jpeg) {
+        this->jpeg->release();
+    }
+    this->jpeg = pJpeg;
     
     /* signal fresh_frame to output plugin and unlock mutex */
     for (int i=0; i<config.server_maxconn; i++) {
         pthread_cond_signal(&(this->cond[i]));
     }
     pthread_mutex_unlock(&this->mutex);
+#endif
 
     /* We must enter the loop and exit with the mutex locked */
     this->lock();
@@ -592,6 +745,10 @@ ffmpegStream::ffmpegStream(const char *portName, int queueSize, int blockingCall
     this->scPicture = NULL;            
     this->ctx = NULL;      
     this->cond = NULL;
+#ifdef FFMPEG_EVENT_LOOP
+    this->channel.frame = NULL;
+    this->channel.seq = 0;
+#endif
 
     /* Create some parameters */
     createParam(ffmpegServerQualityString,  asynParamInt32, &ffmpegServerQuality);
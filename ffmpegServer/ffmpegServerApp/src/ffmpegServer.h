@@ -14,6 +14,7 @@ extern "C" {
 #include "nullhttpd.h"
 }
 #include "ffmpegCommon.h"
+#include "ffmpegEventLoop.h"
 
 
 /** maximum number of streams that the http server will host, fairly arbitrary */
@@ -42,6 +43,11 @@ public:
     int send_frame(int sid, NDArray *pArray);
     void send_stream(int sid);
     void send_snapshot(int sid, int index);   
+#ifdef FFMPEG_EVENT_LOOP
+    void send_status(int sid);
+    void report(FILE *fp, int details);
+    void client_finished();
+#endif
 
 protected:
     int ffmpegServerQuality;
@@ -61,6 +67,10 @@ private:
     NDArray *scArray;    
     NDArray *jpeg;
     int nclients;
+#ifdef FFMPEG_EVENT_LOOP
+    /* the latest jpeg, sent to the clients by the event loop */
+    ffmpegChannel channel;
+#endif
          
     AVCodec *codec;
     AVCodecContext *c;